@@ -25,6 +25,7 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <errno.h>
+#include <ctype.h>
 #include <sys/select.h>
 #include <sys/socket.h>
 #include <sys/types.h>
@@ -36,16 +37,19 @@
 #include "client/client.h"
 #include "sysdep/unix/unix.h"
 
-#define SERVER_READ_BUF_LEN 4096
+#define SERVER_READ_BUF_LEN 4096	/* Initial size, grows for long lines */
+#define BATCH_READ_BUF_LEN 4096
+#define BATCH_WINDOW 32			/* Max commands sent in advance in batch mode */
 
-static char *opt_list = "s:vrl";
-static int verbose, restricted, once;
+static char *opt_list = "s:vrlb";
+static int verbose, restricted, once, batch;
 static char *init_cmd;
 
 static char *server_path = PATH_CONTROL_SOCKET;
 static int server_fd;
-static byte server_read_buf[SERVER_READ_BUF_LEN];
-static byte *server_read_pos = server_read_buf;
+static byte *server_read_buf;
+static byte *server_read_pos;
+static uint server_read_size;
 
 int init = 1;		/* During intial sequence */
 int busy = 1;		/* Executing BIRD command */
@@ -54,13 +58,18 @@ int interactive;	/* Whether stdin is terminal */
 static int num_lines, skip_input;
 int term_lns, term_cls;
 
+static byte batch_read_buf[BATCH_READ_BUF_LEN];
+static byte *batch_read_pos = batch_read_buf;
+static uint batch_pending;	/* Commands sent and not yet answered */
+static int batch_eof;
+
 
 /*** Parsing of arguments ***/
 
 static void
 usage(char *name)
 {
-  fprintf(stderr, "Usage: %s [-s <control-socket>] [-v] [-r] [-l]\n", name);
+  fprintf(stderr, "Usage: %s [-s <control-socket>] [-v] [-r] [-l] [-b]\n", name);
   exit(1);
 }
 
@@ -87,6 +96,10 @@ parse_args(int argc, char **argv)
 	if (!server_changed)
 	  server_path = xbasename(server_path);
 	break;
+      case 'b':
+	batch = 1;
+	interactive = 0;
+	break;
       default:
 	usage(argv[0]);
       }
@@ -94,6 +107,9 @@ parse_args(int argc, char **argv)
   /* If some arguments are not options, we take it as commands */
   if (optind < argc)
     {
+      if (batch)
+	usage(argv[0]);
+
       char *tmp;
       int i;
       int len = 0;
@@ -199,6 +215,13 @@ init_commands(void)
       exit(0);
     }
 
+  if (batch)
+    {
+      /* Commands are read from stdin by batch_submit() */
+      init = 0;
+      return;
+    }
+
   input_init();
 
   term_lns = (term_lns > 0) ? term_lns : 25;
@@ -208,6 +231,96 @@ init_commands(void)
 }
 
 
+/*** Batch mode ***/
+
+/*
+ * In batch mode, commands are read from stdin and sent to the server without
+ * waiting for replies to the previous ones, up to %BATCH_WINDOW commands in
+ * advance. The server processes them in order, so replies are printed in the
+ * same order as the commands. The window keeps both sides from blocking in
+ * write while the other one is writing too.
+ */
+
+static void
+batch_send(char *line)
+{
+  char *c = line;
+  while (isspace((unsigned char) *c))
+    c++;
+
+  /* Skip empty lines */
+  if (!*c)
+    return;
+
+  char *cmd = cmd_expand(line);
+
+  if (!cmd)
+    return;
+
+  server_send(cmd);
+  batch_pending++;
+  free(cmd);
+}
+
+/* Send buffered commands while the window allows, returns 1 if more input is wanted */
+static int
+batch_submit(void)
+{
+  byte *start = batch_read_buf, *p = batch_read_buf;
+
+  while ((p < batch_read_pos) && (batch_pending < BATCH_WINDOW))
+    if (*p++ == '\n')
+      {
+	p[-1] = 0;
+	batch_send(start);
+	start = p;
+      }
+
+  if (batch_eof && (start < batch_read_pos) && (batch_pending < BATCH_WINDOW))
+    {
+      /* Last line without newline */
+      *batch_read_pos = 0;
+      batch_send(start);
+      start = batch_read_pos;
+    }
+
+  if (start != batch_read_buf)
+    {
+      int l = batch_read_pos - start;
+      memmove(batch_read_buf, start, l);
+      batch_read_pos = batch_read_buf + l;
+    }
+
+  if (batch_eof && (batch_read_pos == batch_read_buf) && !batch_pending)
+    exit(0);
+
+  return !batch_eof && (batch_pending < BATCH_WINDOW);
+}
+
+static void
+batch_read(void)
+{
+  /* Keep one byte for terminating the last line */
+  int c = read(0, batch_read_pos, batch_read_buf + sizeof(batch_read_buf) - 1 - batch_read_pos);
+
+  if (c < 0)
+    {
+      if (errno == EINTR)
+	return;
+      DIE("Input read error");
+    }
+
+  if (!c)
+    batch_eof = 1;
+
+  batch_read_pos += c;
+
+  if (!memchr(batch_read_buf, '\n', batch_read_pos - batch_read_buf) &&
+      (batch_read_pos == batch_read_buf + sizeof(batch_read_buf) - 1))
+    die("Command too long");
+}
+
+
 /*** Output ***/
 
 void
@@ -285,6 +398,9 @@ server_got_reply(char *x)
 
       if (x[4] == ' ')
       {
+        if (batch && !init)
+          batch_pending--;
+
         busy = 0;
         skip_input = 0;
         return;
@@ -307,8 +423,16 @@ server_read(void)
   int c;
   byte *start, *p;
 
+  if (!server_read_buf)
+    {
+      server_read_size = SERVER_READ_BUF_LEN;
+      server_read_buf = server_read_pos = malloc(server_read_size);
+      if (!server_read_buf)
+	die("Out of memory");
+    }
+
  redo:
-  c = read(server_fd, server_read_pos, server_read_buf + sizeof(server_read_buf) - server_read_pos);
+  c = read(server_fd, server_read_pos, server_read_buf + server_read_size - server_read_pos);
   if (!c)
     die("Connection closed by server");
   if (c < 0)
@@ -335,10 +459,15 @@ server_read(void)
       memmove(server_read_buf, start, l);
       server_read_pos = server_read_buf + l;
     }
-  else if (server_read_pos == server_read_buf + sizeof(server_read_buf))
+  else if (server_read_pos == server_read_buf + server_read_size)
     {
-      strcpy(server_read_buf, "?<too-long>");
-      server_read_pos = server_read_buf + 11;
+      /* No complete line yet (e.g. long JSON output), make room for the rest */
+      uint l = server_read_size;
+      server_read_size *= 2;
+      server_read_buf = realloc(server_read_buf, server_read_size);
+      if (!server_read_buf)
+	die("Out of memory");
+      server_read_pos = server_read_buf + l;
     }
 }
 
@@ -351,14 +480,18 @@ select_loop(void)
       if (init && !busy)
 	init_commands();
 
-      if (!init)
+      int want_input = !busy;
+
+      if (batch && !init)
+	want_input = batch_submit();
+      else if (!init)
 	input_notify(!busy);
 
       fd_set select_fds;
       FD_ZERO(&select_fds);
 
       FD_SET(server_fd, &select_fds);
-      if (!busy)
+      if (want_input)
 	FD_SET(0, &select_fds);
 
       rv = select(server_fd+1, &select_fds, NULL, NULL, NULL);
@@ -372,7 +505,10 @@ select_loop(void)
 
       if (FD_ISSET(0, &select_fds))
 	{
-	  input_read();
+	  if (batch)
+	    batch_read();
+	  else
+	    input_read();
 	  continue;
 	}
 
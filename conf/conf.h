@@ -27,9 +27,11 @@ struct config {
   list symbols;				/* Configured symbols in config order */
 
   int mrtdump_file;			/* Configured MRTDump file (sysdep, fd in unix) */
+  u32 mrtdump_buffer;			/* MRTDump capture buffer size (bytes, 0 = unbuffered) */
   const char *syslog_name;		/* Name used for syslog (NULL -> no syslog) */
   struct rtable_config *def_tables[NET_MAX]; /* Default routing tables for each network */
   struct iface_patt *router_id_from;	/* Configured list of router ID iface patterns */
+  struct metrics_config *metrics;	/* Metrics endpoint (NULL -> disabled) */
 
   u32 router_id;			/* Our Router ID */
   unsigned proto_default_debug;		/* Default protocol debug mask */
@@ -39,12 +41,16 @@ struct config {
   struct timeformat tf_log;		/* Time format for the logfile */
   struct timeformat tf_base;		/* Time format for other purposes */
   u32 gr_wait;				/* Graceful restart wait timeout (sec) */
+  u32 startup_wait;			/* Startup convergence wait timeout (sec), 0 for disabled */
 
   int cli_debug;			/* Tracing of CLI connections and commands */
   int latency_debug;			/* I/O loop tracks duration of each event */
+  int cpu_accounting;			/* Protocols and channels track their CPU time */
+  int filter_profile;			/* Filters collect execution statistics */
   u32 latency_limit;			/* Events with longer duration are logged (us) */
   u32 watchdog_warning;			/* I/O loop watchdog limit for warning (us) */
   u32 watchdog_timeout;			/* Watchdog timeout (in seconds, 0 = disabled) */
+  u32 slab_watermark;			/* Empty slab pages kept for reuse */
   char *err_msg;			/* Parser error message */
   int err_lino;				/* Line containing error */
   int err_chno;				/* Character where the parser stopped */
@@ -52,6 +58,8 @@ struct config {
   char *file_name;			/* Name of main configuration file */
   int file_fd;				/* File descriptor of main configuration file */
   HASH(struct symbol) sym_hash;		/* Lexer: symbol hash table */
+  HASH(struct f_const_set) const_sets;	/* Filter: shared constant sets, see f_share_set() */
+  struct f_line_profile *filter_profiles; /* Filter: statistics of lines, see filter_show_profile() */
   struct config *fallback;		/* Link to regular config for CLI parsing */
   struct sym_scope *root_scope;		/* Scope for root symbols */
   int obstacle_count;			/* Number of items blocking freeing of this config */
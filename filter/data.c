@@ -401,10 +401,18 @@ clist_filter(struct linpool *pool, const struct adata *list, const struct f_val
   u32 *k = tmp;
   u32 *end = l + len;
 
+  /* Large clist is searched by bisection in a sorted copy */
+  const struct adata *sorted = NULL;
+  if (!tree && set->val.ad && (len >= INT_SET_BISECT_MIN) &&
+      (int_set_get_size(set->val.ad) >= INT_SET_BISECT_MIN))
+    sorted = int_set_sort(pool, set->val.ad);
+
   while (l < end) {
     v.val.i = *l++;
     /* pos && member(val, set) || !pos && !member(val, set),  member() depends on tree */
-    if ((tree ? !!find_tree(set->val.t, &v) : int_set_contains(set->val.ad, v.val.i)) == pos)
+    if ((tree ? !!find_tree(set->val.t, &v) :
+	 sorted ? int_set_contains_sorted(sorted, v.val.i) :
+	 int_set_contains(set->val.ad, v.val.i)) == pos)
       *k++ = v.val.i;
   }
 
@@ -166,6 +166,8 @@ struct f_trie
   u8 zero;
   s8 ipv4;				/* -1 for undefined / empty */
   u16 data_size;			/* Additional data for each trie node */
+  uint node_count;			/* Number of allocated trie nodes */
+  void *index;				/* Top-level stride index, see trie_compile() */
   struct f_trie_node root;		/* Root trie node */
 };
 
@@ -173,14 +175,25 @@ struct f_tree *f_new_tree(void);
 struct f_tree *build_tree(struct f_tree *);
 const struct f_tree *find_tree(const struct f_tree *t, const struct f_val *val);
 int same_tree(const struct f_tree *t0, const struct f_tree *t2);
+u32 tree_hash(const struct f_tree *t);
+int tree_net_dep(const struct f_tree *t);
+int tree_route_dep(const struct f_tree *t);
+u32 tree_ea_protos(const struct f_tree *t);
+void tree_roa_deps(struct f_line *dest, const struct f_tree *t);
 void tree_format(const struct f_tree *t, buffer *buf);
 
 struct f_trie *f_new_trie(linpool *lp, uint data_size);
 void *trie_add_prefix(struct f_trie *t, const net_addr *n, uint l, uint h);
+void trie_compile(struct f_trie *t);
 int trie_match_net(const struct f_trie *t, const net_addr *n);
 int trie_same(const struct f_trie *t1, const struct f_trie *t2);
+u32 trie_hash(const struct f_trie *t);
+void trie_diff(struct f_trie *diff, const struct f_trie *t1, const struct f_trie *t2);
+net_addr *trie_cover(const struct f_trie *t, uint *count);
 void trie_format(const struct f_trie *t, buffer *buf);
 
+struct f_val f_share_set(struct f_val v);
+
 #define F_CMP_ERROR 999
 
 const char *f_type_name(enum f_type t);
@@ -209,8 +209,12 @@ FID_DUMP_BODY()m4_dnl
 f_dump_line(item->fl$1, indent + 1);
 FID_LINEARIZE_BODY()m4_dnl
 item->fl$1 = f_linearize(whati->f$1);
+if (f_net_dep(item->fl$1)) dest->net_dep = 1;
+if (f_route_dep(item->fl$1)) dest->route_dep = 1;
+dest->ea_protos |= f_ea_protos(item->fl$1);
+f_merge_roa_deps(dest, item->fl$1);
 FID_SAME_BODY()m4_dnl
-if (!f_same(f1->fl$1, f2->fl$1)) return 0;
+if (!f_same_diff(f1->fl$1, f2->fl$1, diff)) return 0;
 FID_INTERPRET_EXEC()m4_dnl
 do { if (whati->fl$1) {
   LINEX_(whati->fl$1);
@@ -246,8 +250,15 @@ FID_INTERPRET_BODY()')
 m4_define(SYMBOL, `FID_MEMBER(struct symbol *, sym, [[strcmp(f1->sym->name, f2->sym->name) || (f1->sym->class != f2->sym->class)]], "symbol %s", item->sym->name)')
 m4_define(RTC, `FID_MEMBER(struct rtable_config *, rtc, [[strcmp(f1->rtc->name, f2->rtc->name)]], "route table %s", item->rtc->name)')
 m4_define(STATIC_ATTR, `FID_MEMBER(struct f_static_attr, sa, f1->sa.sa_code != f2->sa.sa_code,,)')
-m4_define(DYNAMIC_ATTR, `FID_MEMBER(struct f_dynamic_attr, da, f1->da.ea_code != f2->da.ea_code,,)')
-m4_define(ACCESS_RTE, `FID_HIC(,[[do { if (!fs->rte) runtime("No route to access"); } while (0)]],NEVER_CONSTANT())')
+m4_define(DYNAMIC_ATTR, `FID_MEMBER(struct f_dynamic_attr, da, f1->da.ea_code != f2->da.ea_code,,)
+FID_LINEARIZE_BODY()m4_dnl
+if (EA_PROTO(item->da.ea_code) < 32) dest->ea_protos |= 1u << EA_PROTO(item->da.ea_code);
+FID_INTERPRET_BODY()')
+m4_define(ACCESS_RTE, `ACCESS_RTE_NET()
+FID_LINEARIZE_BODY()m4_dnl
+dest->route_dep = 1;
+FID_INTERPRET_BODY()')
+m4_define(ACCESS_RTE_NET, `FID_HIC(,[[do { if (!fs->rte) runtime("No route to access"); } while (0)]],NEVER_CONSTANT())')
 
 #	2) Code wrapping
 #	The code produced in 1xx temporary diversions is a raw code without
@@ -265,6 +276,7 @@ m4_define(ACCESS_RTE, `FID_HIC(,[[do { if (!fs->rte) runtime("No route to access
 #	7	dump line item callers
 #	8	linearize
 #	9	same (filter comparator)
+#	10	interpreter dispatch table
 #	1	union in struct f_inst
 #	3	constructors + interpreter
 #
@@ -285,6 +297,7 @@ m4_define(FID_DUMP, `FID_ZONE(6, Dump line)')
 m4_define(FID_DUMP_CALLER, `FID_ZONE(7, Dump line caller)')
 m4_define(FID_LINEARIZE, `FID_ZONE(8, Linearize)')
 m4_define(FID_SAME, `FID_ZONE(9, Comparison)')
+m4_define(FID_DISPATCH, `FID_ZONE(10, Dispatch table entry)')
 
 #	This macro does all the code wrapping. See inline comments.
 m4_define(INST_FLUSH, `m4_ifdef([[INST_NAME]], [[
@@ -292,6 +305,8 @@ FID_ENUM()m4_dnl			 Contents of enum fi_code { ... }
   INST_NAME(),
 FID_ENUM_STR()m4_dnl			 Contents of const char * indexed by enum fi_code
   [INST_NAME()] = "INST_NAME()",
+FID_DISPATCH()m4_dnl			 Contents of interpreter dispatch table indexed by enum fi_code
+  [INST_NAME()] = &&FI_DISPATCH_LABEL_NAME(INST_NAME()),
 FID_INST()m4_dnl			 Anonymous structure inside struct f_inst
     struct {
 m4_undivert(101)m4_dnl
@@ -308,11 +323,12 @@ m4_undivert(102)m4_dnl
 );]],
 [[m4_dnl				 The one case in The Big Switch inside interpreter
   case INST_NAME():
+  FI_DISPATCH_LABEL(INST_NAME())
   #define whati (&(what->i_]]INST_NAME()[[))
   m4_ifelse(m4_eval(INST_INVAL() > 0), 1, [[if (fstk->vcnt < INST_INVAL()) runtime("Stack underflow"); fstk->vcnt -= INST_INVAL(); ]])
   m4_undivert(108)m4_dnl
   #undef whati
-  break;
+  FI_DISPATCH_NEXT;
 ]],
 [[m4_dnl				 Constructor itself
 struct f_inst *f_new_inst_]]INST_NAME()[[(enum f_instruction_code fi_code
@@ -422,6 +438,11 @@ m4_define(FID_WR_STOP, `m4_define([[FID_WR_PUT]])m4_divert(-1)')
 
 m4_changequote([[,]])
 FID_WR_DIRECT(I)
+#ifdef FI_THREADED_DISPATCH
+static const void * const fi_dispatch[] = {
+FID_WR_PUT(10)
+};
+#endif
 FID_WR_PUT(3)
 FID_WR_DIRECT(C)
 
@@ -431,6 +452,7 @@ FID_WR_DIRECT(C)
 #endif
 
 #include "nest/bird.h"
+#include "lib/hash.h"
 #include "filter/filter.h"
 #include "filter/f-inst.h"
 
@@ -536,6 +558,64 @@ FID_WR_PUT(8)
   return pos;
 }
 
+/* Values of scalar constants, the other ones are hashed just by type */
+static void
+f_val_hash_mix(u64 *h, const struct f_val *v)
+{
+  u32 type = v->type;
+  mem_hash_mix(h, &type, sizeof(type));
+
+  switch (v->type) {
+  case T_INT:
+  case T_BOOL:
+  case T_PAIR:
+  case T_QUAD:
+  case T_ENUM:
+    mem_hash_mix(h, &v->val.i, sizeof(v->val.i));
+    break;
+  case T_EC:
+  case T_RD:
+    mem_hash_mix(h, &v->val.ec, sizeof(v->val.ec));
+    break;
+  case T_LC:
+    mem_hash_mix(h, &v->val.lc, sizeof(v->val.lc));
+    break;
+  case T_IP:
+    mem_hash_mix(h, &v->val.ip, sizeof(v->val.ip));
+    break;
+  case T_NET:
+    mem_hash_mix(h, v->val.net, v->val.net->length);
+    break;
+  case T_STRING:
+    mem_hash_mix(h, v->val.s, strlen(v->val.s));
+    break;
+  default:
+    break;
+  }
+}
+
+/*
+ * Fingerprint of the line for f_same_diff(). It covers just what never
+ * differs in same lines, so lines with different fingerprints differ.
+ */
+static u32
+f_line_hash(const struct f_line *fl)
+{
+  u64 h;
+  mem_hash_init(&h);
+
+  for (uint i=0; i<fl->len; i++) {
+    const struct f_line_item *item = &fl->items[i];
+    u32 code[2] = { item->fi_code, item->flags };
+    mem_hash_mix(&h, code, sizeof(code));
+
+    if (item->fi_code == FI_CONSTANT)
+      f_val_hash_mix(&h, &item->i_FI_CONSTANT.val);
+  }
+
+  return mem_hash_value(&h);
+}
+
 struct f_line *
 f_linearize_concat(const struct f_inst * const inst[], uint count)
 {
@@ -549,6 +629,12 @@ f_linearize_concat(const struct f_inst * const inst[], uint count)
   for (uint i=0; i<count; i++)
     out->len = linearize(out, inst[i], out->len);
 
+  out->hash = f_line_hash(out);
+
+#ifdef ENABLE_FILTER_PROFILING
+  f_profile_line(out);
+#endif
+
 #ifdef LOCAL_DEBUG
   f_dump_line(out, 0);
 #endif
@@ -557,7 +643,7 @@ f_linearize_concat(const struct f_inst * const inst[], uint count)
 
 /* Filter line comparison */
 int
-f_same(const struct f_line *fl1, const struct f_line *fl2)
+f_same_diff(const struct f_line *fl1, const struct f_line *fl2, struct f_trie *diff)
 {
   if ((!fl1) && (!fl2))
     return 1;
@@ -565,6 +651,8 @@ f_same(const struct f_line *fl1, const struct f_line *fl2)
     return 0;
   if (fl1->len != fl2->len)
     return 0;
+  if (fl1->hash != fl2->hash)
+    return 0;
   for (uint i=0; i<fl1->len; i++) {
 #define f1_ (&(fl1->items[i]))
 #define f2_ (&(fl2->items[i]))
@@ -582,6 +670,12 @@ FID_WR_PUT(9)
   return 1;
 }
 
+int
+f_same(const struct f_line *fl1, const struct f_line *fl2)
+{
+  return f_same_diff(fl1, fl2, NULL);
+}
+
 #if defined(__GNUC__) && __GNUC__ >= 6
 #pragma GCC diagnostic pop
 #endif
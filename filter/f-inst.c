@@ -159,7 +159,7 @@
  *	m4_dnl	from the value stack.
  *	m4_dnl	For writing directly here, use FID_DUMP_BODY.
  *
- *	m4_dnl		f_same(...)
+ *	m4_dnl		f_same_diff(...)
  *	m4_dnl		{
  *	m4_dnl		  switch (f1_->fi_code) {
  *	m4_dnl		    case FI_EXAMPLE:
@@ -169,7 +169,8 @@
  *	m4_dnl		}
  *	m4_dnl	This code compares the two given instrucions (f1_ and f2_)
  *	m4_dnl	on reconfigure. For accessing your custom instruction data,
- *	m4_dnl	use macros f1 and f2.
+ *	m4_dnl	use macros f1 and f2. Instructions which may differ in a way
+ *	m4_dnl	affecting just some routes may record that into the diff trie.
  *	m4_dnl	For writing directly here, use FID_SAME_BODY.
  *
  *	m4_dnl		interpret(...)
@@ -195,6 +196,7 @@
  *	m4_dnl	  fpool		-> the current linpool
  *	m4_dnl	  NEVER_CONSTANT-> don't generate pre-interpretation code at all
  *	m4_dnl	  ACCESS_RTE	-> check that route is available, also NEVER_CONSTANT
+ *	m4_dnl	  ACCESS_RTE_NET	-> same as ACCESS_RTE, for instructions reading just the route network
  *	m4_dnl	  ACCESS_EATTRS	-> pre-cache the eattrs; use only with ACCESS_RTE
  *	m4_dnl	  f_rta_cow(fs)	-> function to call before any change to route should be done
  *
@@ -323,6 +325,10 @@
 	  }
 
 	  pm->item[i] = vv(i).val.pmi;
+
+	  /* Compile ASN sets for matching, also done at config time for constant masks */
+	  if ((pm->item[i].kind == PM_ASN_SET) && !pm->item[i].ranges)
+	    pm->item[i].ranges = as_path_compile_set(fpool, pm->item[i].set);
 	  break;
 
 	case T_INT:
@@ -338,6 +344,7 @@
 
 	  pm->item[i] = (struct f_path_mask_item) {
 	    .set = vv(i).val.t,
+	    .ranges = as_path_compile_set(fpool, vv(i).val.t),
 	    .kind = PM_ASN_SET,
 	  };
 	  break;
@@ -355,15 +362,45 @@
   INST(FI_NEQ, 2, 1) {
     ARG_ANY(1);
     ARG_ANY(2);
+    FID_NEW_BODY()
+      if ((f1->fi_code == FI_CONSTANT) && !f1->next)
+	return f_new_inst(FI_NEQ_CONST, f2, f1->i_FI_CONSTANT.val);
+      if ((f2->fi_code == FI_CONSTANT) && !f2->next)
+	return f_new_inst(FI_NEQ_CONST, f1, f2->i_FI_CONSTANT.val);
+    FID_INTERPRET_BODY()
     RESULT(T_BOOL, i, !val_same(&v1, &v2));
   }
 
   INST(FI_EQ, 2, 1) {
     ARG_ANY(1);
     ARG_ANY(2);
+    FID_NEW_BODY()
+      if ((f1->fi_code == FI_CONSTANT) && !f1->next)
+	return f_new_inst(FI_EQ_CONST, f2, f1->i_FI_CONSTANT.val);
+      if ((f2->fi_code == FI_CONSTANT) && !f2->next)
+	return f_new_inst(FI_EQ_CONST, f1, f2->i_FI_CONSTANT.val);
+    FID_INTERPRET_BODY()
     RESULT(T_BOOL, i, val_same(&v1, &v2));
   }
 
+  /*
+   * Superinstructions for comparison with a constant. Constructors of the
+   * generic comparisons above and below turn into these when one argument is
+   * a constant, so the constant is embedded in the instruction instead of
+   * being pushed to the value stack by a separate FI_CONSTANT.
+   */
+  INST(FI_NEQ_CONST, 1, 1) {
+    ARG_ANY(1);
+    FID_MEMBER(struct f_val, cval, [[ !val_same(&(f1->cval), &(f2->cval)) ]], "value %s", val_dump(&(item->cval)));
+    RESULT(T_BOOL, i, !val_same(&v1, &cval));
+  }
+
+  INST(FI_EQ_CONST, 1, 1) {
+    ARG_ANY(1);
+    FID_MEMBER(struct f_val, cval, [[ !val_same(&(f1->cval), &(f2->cval)) ]], "value %s", val_dump(&(item->cval)));
+    RESULT(T_BOOL, i, val_same(&v1, &cval));
+  }
+
   INST(FI_LT, 2, 1) {
     ARG_ANY(1);
     ARG_ANY(2);
@@ -394,6 +431,10 @@
   INST(FI_MATCH, 2, 1) {
     ARG_ANY(1);
     ARG_ANY(2);
+    FID_NEW_BODY()
+      if ((f2->fi_code == FI_CONSTANT) && !f2->next)
+	return f_new_inst(FI_MATCH_CONST, f1, f2->i_FI_CONSTANT.val);
+    FID_INTERPRET_BODY()
     int i = val_in_range(&v1, &v2);
     if (i == F_CMP_ERROR)
       runtime( "~ applied on unknown type pair" );
@@ -403,12 +444,43 @@
   INST(FI_NOT_MATCH, 2, 1) {
     ARG_ANY(1);
     ARG_ANY(2);
+    FID_NEW_BODY()
+      if ((f2->fi_code == FI_CONSTANT) && !f2->next)
+	return f_new_inst(FI_NOT_MATCH_CONST, f1, f2->i_FI_CONSTANT.val);
+    FID_INTERPRET_BODY()
     int i = val_in_range(&v1, &v2);
     if (i == F_CMP_ERROR)
       runtime( "!~ applied on unknown type pair" );
     RESULT(T_BOOL, i, !i);
   }
 
+  /* Matching against a constant set, see FI_EQ_CONST */
+  INST(FI_MATCH_CONST, 1, 1) {
+    ARG_ANY(1);
+    FID_MEMBER(struct f_val, cval, , "value %s", val_dump(&(item->cval)));
+    FID_SAME_BODY()
+      if (!val_same(&(f1->cval), &(f2->cval)) && !f_same_match_diff(fl1, fl2, i, diff))
+	return 0;
+    FID_INTERPRET_BODY()
+    int i = val_in_range(&v1, &cval);
+    if (i == F_CMP_ERROR)
+      runtime( "~ applied on unknown type pair" );
+    RESULT(T_BOOL, i, !!i);
+  }
+
+  INST(FI_NOT_MATCH_CONST, 1, 1) {
+    ARG_ANY(1);
+    FID_MEMBER(struct f_val, cval, , "value %s", val_dump(&(item->cval)));
+    FID_SAME_BODY()
+      if (!val_same(&(f1->cval), &(f2->cval)) && !f_same_match_diff(fl1, fl2, i, diff))
+	return 0;
+    FID_INTERPRET_BODY()
+    int i = val_in_range(&v1, &cval);
+    if (i == F_CMP_ERROR)
+      runtime( "!~ applied on unknown type pair" );
+    RESULT(T_BOOL, i, !i);
+  }
+
   INST(FI_DEFINED, 1, 1) {
     ARG_ANY(1);
     RESULT(T_BOOL, i, (v1.type != T_VOID) && !undef_value(v1));
@@ -463,6 +535,11 @@
 
   INST(FI_CONDITION, 1, 0) {
     ARG(1, T_BOOL);
+    FID_NEW_BODY()
+      struct f_inst *sw = f_condition_switch(f1, f2, f3);
+      if (sw)
+	return sw;
+    FID_INTERPRET_BODY()
     if (v1.val.i)
       LINE(2,0);
     else
@@ -480,6 +557,10 @@
 
   INST(FI_FLUSH, 0, 0) {
     NEVER_CONSTANT;
+    FID_LINEARIZE_BODY()
+      dest->net_dep = 1;	/* Logs the message once per route */
+      dest->route_dep = 1;
+    FID_INTERPRET_BODY()
     if (!(fs->flags & FF_SILENT))
       /* After log_commit, the buffer is reset */
       log_commit(*L_INFO, &fs->buf);
@@ -502,7 +583,13 @@
   INST(FI_RTA_GET, 0, 1) {
     {
       STATIC_ATTR;
-      ACCESS_RTE;
+      FID_LINEARIZE_BODY()
+	if (item->sa.sa_code == SA_NET)
+	  dest->net_dep = 1;
+	else
+	  dest->route_dep = 1;
+      FID_INTERPRET_BODY()
+      ACCESS_RTE_NET;
       struct rta *rta = (*fs->rte)->attrs;
 
       switch (sa.sa_code)
@@ -934,6 +1021,15 @@
     FID_SAME_BODY()
       if (!(f1->sym->flags & SYM_FLAG_SAME))
 	return 0;
+    FID_LINEARIZE_BODY()
+      /* Recursive call, the function body is not linearized yet */
+      if (!item->sym->function || item->sym->function->net_dep)
+	dest->net_dep = 1;
+      if (!item->sym->function || item->sym->function->route_dep)
+	dest->route_dep = 1;
+      dest->ea_protos |= item->sym->function ? item->sym->function->ea_protos : ~0u;
+      /* Its ROA tables are collected by the function itself */
+      f_merge_roa_deps(dest, item->sym->function);
     FID_INTERPRET_BODY()
 
     /* Push the body on stack */
@@ -963,6 +1059,15 @@
 
     FID_MEMBER(struct f_tree *, tree, [[!same_tree(f1->tree, f2->tree)]], "tree %p", item->tree);
 
+    FID_LINEARIZE_BODY()
+      if (tree_net_dep(item->tree))
+	dest->net_dep = 1;
+      if (tree_route_dep(item->tree))
+	dest->route_dep = 1;
+      dest->ea_protos |= tree_ea_protos(item->tree);
+      tree_roa_deps(dest, item->tree);
+    FID_INTERPRET_BODY()
+
     const struct f_tree *t = find_tree(tree, &v1);
     if (!t) {
       v1.type = T_VOID;
@@ -1161,6 +1266,10 @@
   INST(FI_ROA_CHECK_IMPLICIT, 0, 1) {	/* ROA Check */
     NEVER_CONSTANT;
     RTC(1);
+    FID_LINEARIZE_BODY()
+      dest->net_dep = 1;
+      f_add_roa_dep(dest, item->rtc);
+    FID_INTERPRET_BODY()
     struct rtable *table = rtc->table;
     ACCESS_RTE;
     ACCESS_EATTRS;
@@ -1193,6 +1302,11 @@
     ARG(1, T_NET);
     ARG(2, T_INT);
     RTC(3);
+    FID_LINEARIZE_BODY()
+      dest->net_dep = 1;	/* Result changes with the ROA table */
+      dest->route_dep = 1;
+      f_add_roa_dep(dest, item->rtc);
+    FID_INTERPRET_BODY()
     struct rtable *table = rtc->table;
 
     u32 as = v2.val.i;
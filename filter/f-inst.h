@@ -38,11 +38,38 @@ static inline const char *f_instruction_name(enum f_instruction_code fi)
 /* Line of instructions to be unconditionally executed one after another */
 struct f_line {
   uint len;				/* Line length */
+  u32 hash;				/* Fingerprint, lines differ if fingerprints differ */
   u8 args;				/* Function: Args required */
   u8 vars;
+  u8 net_dep;				/* Result may depend on the route network, see filter_net_dep() */
+  u8 route_dep;				/* Result may depend on other route data, see filter_route_dep() */
+  u32 ea_protos;			/* Protocol classes of accessed attributes, see filter_ea_protos() */
+  struct f_roa_dep *roa_deps;		/* ROA tables checked by the line, see filter_roa_deps() */
+#ifdef ENABLE_FILTER_PROFILING
+  struct f_line_profile *prof;		/* Execution statistics, see filter_show_profile() */
+#endif
   struct f_line_item items[0];		/* The items themselves */
 };
 
+#ifdef ENABLE_FILTER_PROFILING
+/* Execution statistics of a line, collected with debug filters enabled */
+struct f_line_profile {
+  struct f_line_profile *next;		/* Next profiled line of the config */
+  const struct f_line *line;		/* The line itself */
+  const char *name;			/* Filter or function the line is a body of */
+  const char *file;			/* Config file the line was parsed from */
+  u64 calls, accepts, rejects;		/* Runs of the line as a filter and their results */
+  u64 cycles;				/* Time spent in these runs (CPU cycles) */
+  u64 count[0];				/* Executions of each item */
+};
+
+void f_profile_line(struct f_line *fl);
+static inline void f_profile_name(struct f_line *fl, const char *name)
+{ if (fl->prof) fl->prof->name = name; }
+#else
+static inline void f_profile_name(struct f_line *fl UNUSED, const char *name UNUSED) { }
+#endif
+
 /* Convert the f_inst infix tree to the f_line structures */
 struct f_line *f_linearize_concat(const struct f_inst * const inst[], uint count);
 static inline struct f_line *f_linearize(const struct f_inst *root)
@@ -50,7 +77,12 @@ static inline struct f_line *f_linearize(const struct f_inst *root)
 
 void f_dump_line(const struct f_line *, uint indent);
 
+/* Compare filter lines, see filter_diff() */
+int f_same_diff(const struct f_line *f1, const struct f_line *f2, struct f_trie *diff);
+int f_same_match_diff(const struct f_line *fl1, const struct f_line *fl2, uint pos, struct f_trie *diff);
+
 struct filter *f_new_where(struct f_inst *);
+struct f_inst *f_condition_switch(const struct f_inst *cond, const struct f_inst *then, const struct f_inst *els);
 static inline struct f_dynamic_attr f_new_dynamic_attr(u8 type, enum f_type f_type, uint code) /* Type as core knows it, type as filters know it, and code of dynamic attribute */
 { return (struct f_dynamic_attr) { .type = type, .f_type = f_type, .ea_code = code }; }   /* f_type currently unused; will be handy for static type checking */
 static inline struct f_dynamic_attr f_new_dynamic_attr_bit(u8 bit, enum f_type f_type, uint code) /* Type as core knows it, type as filters know it, and code of dynamic attribute */
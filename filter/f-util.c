@@ -41,6 +41,228 @@ struct filter *f_new_where(struct f_inst *where)
   return f;
 }
 
+/*
+ * Chains of conditions comparing the same value with constants, like
+ * |if x = 1 then A; else if x = 2 then B; else C;|, are converted to the
+ * equivalent of |case x { 1: A; 2: B; else: C; }|, so the value is looked up
+ * in a balanced tree instead of being compared with each constant in turn.
+ * The conversion is done bottom-up as the conditions are parsed.
+ *
+ * Only pure reads of attributes and variables are accepted as the compared
+ * value, as it is evaluated just once. Their static type must match the type
+ * of all the constants and be one with total ordering in val_compare(), so
+ * find_tree() never sees a type mismatch. The only other possible value is
+ * undefined attribute, which matches neither constant in both forms.
+ */
+
+static int
+f_switch_key_same(const struct f_inst *a, const struct f_inst *b)
+{
+  if ((a->fi_code != b->fi_code) || a->next || b->next)
+    return 0;
+
+  switch (a->fi_code)
+  {
+  case FI_RTA_GET:
+    return a->i_FI_RTA_GET.sa.sa_code == b->i_FI_RTA_GET.sa.sa_code;
+
+  case FI_EA_GET:
+    return (a->i_FI_EA_GET.da.ea_code == b->i_FI_EA_GET.da.ea_code) &&
+      (a->i_FI_EA_GET.da.type == b->i_FI_EA_GET.da.type) &&
+      (a->i_FI_EA_GET.da.f_type == b->i_FI_EA_GET.da.f_type);
+
+  case FI_VAR_GET:
+    return a->i_FI_VAR_GET.sym == b->i_FI_VAR_GET.sym;
+
+  default:
+    return 0;
+  }
+}
+
+static int
+f_switch_key_type(enum f_type type)
+{
+  switch (type)
+  {
+  case T_INT:
+  case T_ENUM:
+  case T_PAIR:
+  case T_QUAD:
+  case T_EC:
+  case T_RD:
+  case T_LC:
+  case T_IP:
+    return 1;
+
+  default:
+    return 0;
+  }
+}
+
+static int
+f_switch_tree_typed(const struct f_tree *t, enum f_type type)
+{
+  for (; t; t = t->right)
+  {
+    if ((t->from.type != t->to.type) ||
+	((t->from.type != type) && (t->from.type != T_VOID)))
+      return 0;
+
+    if (!f_switch_tree_typed(t->left, type))
+      return 0;
+  }
+
+  return 1;
+}
+
+/* Convert built tree back to the degenerated one, linked by @left */
+static struct f_tree *
+f_switch_tree_unbuild(struct f_tree *t, struct f_tree *list)
+{
+  if (!t)
+    return list;
+
+  struct f_tree *l = t->left, *r = t->right;
+  list = f_switch_tree_unbuild(l, list);
+  list = f_switch_tree_unbuild(r, list);
+
+  t->left = list;
+  t->right = NULL;
+  return t;
+}
+
+static struct f_tree *
+f_switch_item(struct f_val val, const struct f_inst *cmds)
+{
+  struct f_tree *t = f_new_tree();
+  t->from = t->to = val;
+  t->data = f_linearize(cmds);
+  return t;
+}
+
+/**
+ * f_condition_switch - convert a chain of conditions to a switch
+ * @cond: condition
+ * @then: commands executed if @cond is true
+ * @els: commands executed otherwise
+ *
+ * Returns %FI_SWITCH instruction equivalent to |if @cond then @then else @els|,
+ * or %NULL if the condition is not a part of a convertible chain.
+ */
+struct f_inst *
+f_condition_switch(const struct f_inst *cond, const struct f_inst *then, const struct f_inst *els)
+{
+  if (!els || els->next || cond->next || (cond->fi_code != FI_EQ_CONST))
+    return NULL;
+
+  struct f_inst *key = cond->i_FI_EQ_CONST.f1;
+  const struct f_val *val = &cond->i_FI_EQ_CONST.cval;
+
+  if ((key->type != val->type) || !f_switch_key_type(val->type))
+    return NULL;
+
+  struct f_tree *tree;
+
+  if (els->fi_code == FI_CONDITION)
+  {
+    const struct f_inst *c2 = els->i_FI_CONDITION.f1;
+
+    if (c2->next || (c2->fi_code != FI_EQ_CONST) ||
+	!f_switch_key_same(key, c2->i_FI_EQ_CONST.f1) ||
+	(c2->i_FI_EQ_CONST.cval.type != val->type) ||
+	!val_compare(val, &c2->i_FI_EQ_CONST.cval))
+      return NULL;
+
+    tree = f_switch_item(c2->i_FI_EQ_CONST.cval, els->i_FI_CONDITION.f2);
+
+    if (els->i_FI_CONDITION.f3)
+      tree->left = f_switch_item((struct f_val) { .type = T_VOID }, els->i_FI_CONDITION.f3);
+  }
+  else if (els->fi_code == FI_SWITCH)
+  {
+    tree = els->i_FI_SWITCH.tree;
+
+    /* The condition takes precedence, its constant must not be in the switch */
+    if (!f_switch_key_same(key, els->i_FI_SWITCH.f1) ||
+	!f_switch_tree_typed(tree, val->type) ||
+	find_tree(tree, val))
+      return NULL;
+
+    tree = f_switch_tree_unbuild(tree, NULL);
+  }
+  else
+    return NULL;
+
+  struct f_tree *t = f_switch_item(*val, then);
+  t->left = tree;
+
+  return f_new_inst(FI_SWITCH, key, build_tree(t));
+}
+
+/*
+ * Constant sets are shared within a config. Generated configs often contain
+ * many identical prefix sets or other sets (e.g. the same prefix list for
+ * multiple peers), so each set constant is looked up in a hash table of sets
+ * already parsed and an identical one is reused instead of keeping a copy.
+ */
+
+struct f_const_set {
+  struct f_const_set *next;
+  u32 hash;
+  struct f_val val;
+};
+
+#define FCS_KEY(n)		&n->val, n->hash
+#define FCS_NEXT(n)		n->next
+#define FCS_EQ(v1,h1,v2,h2)	h1 == h2 && val_same(v1, v2)
+#define FCS_FN(v,h)		h
+
+#define FCS_REHASH		fcs_rehash
+#define FCS_PARAMS		/8, *2, 2, 2, 6, 20
+
+HASH_DEFINE_REHASH_FN(FCS, struct f_const_set)
+
+/**
+ * f_share_set - share a constant set
+ * @v: set value (%T_SET or %T_PREFIX_SET)
+ *
+ * Returns an identical set value parsed before in the same config, or @v when
+ * there is none. New prefix sets are compiled for matching. Sets in CLI
+ * commands are not shared.
+ */
+struct f_val
+f_share_set(struct f_val v)
+{
+  struct config *c = new_config;
+
+  if (c->fallback)
+  {
+    if (v.type == T_PREFIX_SET)
+      trie_compile((struct f_trie *) v.val.ti);
+
+    return v;
+  }
+
+  u32 hash = ((v.type == T_SET) ? tree_hash(v.val.t) : trie_hash(v.val.ti)) ^ v.type;
+
+  if (!c->const_sets.data)
+    HASH_INIT(c->const_sets, c->pool, 6);
+
+  struct f_const_set *cs = HASH_FIND(c->const_sets, FCS, &v, hash);
+  if (cs)
+    return cs->val;
+
+  if (v.type == T_PREFIX_SET)
+    trie_compile((struct f_trie *) v.val.ti);
+
+  cs = cfg_allocz(sizeof(struct f_const_set));
+  cs->hash = hash;
+  cs->val = v;
+  HASH_INSERT2(c->const_sets, FCS, c->pool, cs);
+
+  return v;
+}
+
 #define CA_KEY(n)	n->name, n->fda.type
 #define CA_NEXT(n)	n->next
 #define CA_EQ(na,ta,nb,tb)	(!strcmp(na,nb) && (ta == tb))
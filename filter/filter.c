@@ -35,10 +35,12 @@
 #include "lib/ip.h"
 #include "lib/net.h"
 #include "lib/flowspec.h"
+#include "lib/tracepoint.h"
 #include "nest/route.h"
 #include "nest/protocol.h"
 #include "nest/iface.h"
 #include "nest/attrs.h"
+#include "nest/cli.h"
 #include "conf/conf.h"
 #include "filter/filter.h"
 #include "filter/f-inst.h"
@@ -141,6 +143,24 @@ f_rta_cow(struct filter_state *fs)
 
 static struct tbf rl_runtime_err = TBF_DEFAULT_LOG_LIMITS;
 
+#ifdef ENABLE_FILTER_PROFILING
+#include <stdlib.h>
+#include <time.h>
+
+static inline u64
+f_profile_clock(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+  return __builtin_ia32_rdtsc();
+#else
+  /* Nanoseconds where there is no cheap cycle counter */
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (u64) ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+#endif
+
 /**
  * interpret
  * @fs: filter state
@@ -173,8 +193,21 @@ interpret(struct filter_state *fs, const struct f_line *line, struct f_val *val)
   fstk->estk[0].line = line;
   fstk->estk[0].pos = 0;
 
+#ifdef ENABLE_FILTER_PROFILING
+  int profile = config && config->filter_profile;
+#endif
+
 #define curline fstk->estk[fstk->ecnt-1]
 
+#ifdef ENABLE_FILTER_PROFILING
+#define FI_PROFILE_COUNT do { \
+  if (profile && curline.line->prof) \
+    curline.line->prof->count[curline.pos - 1]++; \
+} while (0)
+#else
+#define FI_PROFILE_COUNT do { } while (0)
+#endif
+
 #ifdef LOCAL_DEBUG
   debug("Interpreting line.");
   f_dump_line(line, 1);
@@ -183,6 +216,7 @@ interpret(struct filter_state *fs, const struct f_line *line, struct f_val *val)
   while (fstk->ecnt > 0) {
     while (curline.pos < curline.line->len) {
       const struct f_line_item *what = &(curline.line->items[curline.pos++]);
+      FI_PROFILE_COUNT;
 
       switch (what->fi_code) {
 #define res fstk->vstk[fstk->vcnt]
@@ -202,6 +236,31 @@ interpret(struct filter_state *fs, const struct f_line *line, struct f_val *val)
 
 #define ACCESS_EATTRS do { if (!fs->eattrs) f_cache_eattrs(fs); } while (0)
 
+/*
+ * With GCC-compatible compilers, the interpreter uses threaded dispatch:
+ * every instruction ends with its own computed jump directly to the next
+ * instruction instead of returning to the common switch. That gives the
+ * branch predictor one jump site per instruction, which helps much with long
+ * generated filters. Build with FILTER_NO_THREADED_DISPATCH to disable it.
+ * The jump bypasses the loop above, so it counts the instruction for profiling
+ * by itself.
+ */
+#if defined(__GNUC__) && !defined(FILTER_NO_THREADED_DISPATCH)
+#define FI_THREADED_DISPATCH
+#define FI_DISPATCH_LABEL_NAME(code) fi_label_##code
+#define FI_DISPATCH_LABEL(code) FI_DISPATCH_LABEL_NAME(code):
+#define FI_DISPATCH_NEXT \
+  if (curline.pos < curline.line->len) { \
+    what = &(curline.line->items[curline.pos++]); \
+    FI_PROFILE_COUNT; \
+    goto *fi_dispatch[what->fi_code]; \
+  } \
+  break
+#else
+#define FI_DISPATCH_LABEL(code)
+#define FI_DISPATCH_NEXT break
+#endif
+
 #include "filter/inst-interpret.c"
 #undef res
 #undef v1
@@ -211,6 +270,8 @@ interpret(struct filter_state *fs, const struct f_line *line, struct f_val *val)
 #undef falloc
 #undef fpool
 #undef ACCESS_EATTRS
+#undef FI_DISPATCH_LABEL
+#undef FI_DISPATCH_NEXT
       }
     }
 
@@ -273,6 +334,7 @@ f_run(const struct filter *filter, struct rte **rte, struct linpool *tmp_pool, i
 
   int rte_cow = ((*rte)->flags & REF_COW);
   DBG( "Running filter `%s'...", filter->name );
+  TRACEPOINT(f_run, filter, *rte);
 
   /* Initialize the filter state */
   filter_state = (struct filter_state) {
@@ -284,9 +346,27 @@ f_run(const struct filter *filter, struct rte **rte, struct linpool *tmp_pool, i
 
   LOG_BUFFER_INIT(filter_state.buf);
 
+#ifdef ENABLE_FILTER_PROFILING
+  struct f_line_profile *prof = config->filter_profile ? filter->root->prof : NULL;
+  u64 start = prof ? f_profile_clock() : 0;
+#endif
+
   /* Run the interpreter itself */
   enum filter_return fret = interpret(&filter_state, filter->root, NULL);
 
+#ifdef ENABLE_FILTER_PROFILING
+  if (prof)
+  {
+    prof->cycles += f_profile_clock() - start;
+    prof->calls++;
+
+    if (fret == F_ACCEPT)
+      prof->accepts++;
+    else
+      prof->rejects++;
+  }
+#endif
+
   if (filter_state.old_rta) {
     /*
      * Cached rta was modified and filter_state->rte contains now an uncached one,
@@ -317,12 +397,97 @@ f_run(const struct filter *filter, struct rte **rte, struct linpool *tmp_pool, i
   if (fret < F_ACCEPT) {
     if (!(filter_state.flags & FF_SILENT))
       log_rl(&rl_runtime_err, L_ERR "Filter %s did not return accept nor reject. Make up your mind", filter_name(filter));
+    TRACEPOINT(f_run__done, filter, F_ERROR);
     return F_ERROR;
   }
   DBG( "done (%u)\n", res.val.i );
+  TRACEPOINT(f_run__done, filter, fret);
   return fret;
 }
 
+#define F_BATCH_CACHE_ORDER	6
+
+struct f_batch_result {
+  const struct rta *attrs;		/* Input attributes */
+  struct rta *out_attrs;		/* Output attributes */
+  u16 pref, out_pref;			/* Input and output preference */
+  enum filter_return fret;
+};
+
+/**
+ * f_run_batch - run a filter for an array of routes
+ * @filter: filter to run
+ * @rte: array of routes being filtered, NULL entries are skipped
+ * @res: array for filter results
+ * @count: number of routes in @rte
+ * @tmp_pool: all filter allocations go from this pool
+ * @flags: flags
+ *
+ * This function is equivalent to calling f_run() for each route in @rte and
+ * storing the return value to the respective item of @res. Unless the filter
+ * depends on the network (see filter_net_dep()), a route which has the same
+ * cached &rta and preference as another already filtered route of the batch
+ * just gets the same result (and the same output attributes and preference)
+ * without running the filter again.
+ */
+void
+f_run_batch(const struct filter *filter, struct rte **rte, enum filter_return *res, uint count, struct linpool *tmp_pool, int flags)
+{
+  struct f_batch_result cache[1 << F_BATCH_CACHE_ORDER];
+  int share = (filter != FILTER_ACCEPT) && (filter != FILTER_REJECT) && !filter_net_dep(filter);
+
+  if (share)
+    memset(cache, 0, sizeof(cache));
+
+  for (uint i = 0; i < count; i++)
+  {
+    struct rte *e = rte[i];
+    if (!e)
+      continue;
+
+    if (!share || !rta_is_cached(e->attrs))
+    {
+      res[i] = f_run(filter, &rte[i], tmp_pool, flags);
+      continue;
+    }
+
+    struct rta *a = e->attrs;
+    u16 pref = e->pref;
+    struct f_batch_result *c = &cache[(a->hash_key ^ pref) >> (32 - F_BATCH_CACHE_ORDER)];
+
+    if ((c->attrs == a) && (c->pref == pref) && (c->fret != F_NOP))
+    {
+      /* Write the shared result back to the route as f_run() would do */
+      if (c->out_attrs != a)
+      {
+	ASSERT(!(e->flags & REF_COW));
+	e->attrs = rta_clone(c->out_attrs);
+	rta_free(a);
+      }
+
+      e->pref = c->out_pref;
+      res[i] = c->fret;
+      continue;
+    }
+
+    int rte_cow = (e->flags & REF_COW);
+    res[i] = f_run(filter, &rte[i], tmp_pool, flags);
+
+    /* The result is shared only if it can be reproduced for other routes */
+    struct rte *out = rte[i];
+    int same = (out == e) && rta_is_cached(out->attrs) &&
+      (!rte_cow || ((out->attrs == a) && (out->pref == pref)));
+
+    *c = (struct f_batch_result) {
+      .attrs = a,
+      .pref = pref,
+      .out_attrs = same ? out->attrs : NULL,
+      .out_pref = out->pref,
+      .fret = same ? res[i] : F_NOP,
+    };
+  }
+}
+
 /**
  * f_eval_rte - run a filter line for an uncached route
  * @expr: filter line to run
@@ -443,6 +608,354 @@ filter_same(const struct filter *new, const struct filter *old)
   return new->sym->flags & SYM_FLAG_SAME;
 }
 
+/**
+ * filter_diff - compare two filters and find the routes affected by the change
+ * @new: first filter to be compared
+ * @old: second filter to be compared
+ * @diff: trie collecting the affected ranges
+ *
+ * Works like filter_same(), but the filters are also considered the same when
+ * they differ just in prefix sets the route network is matched against. In
+ * that case, the ranges of networks that may be matched differently are added
+ * to @diff, so only routes whose network is matched by @diff (the family of
+ * which must be set by the caller) have to be filtered again. Returns 1 when
+ * the filters are the same in that sense, 0 otherwise.
+ */
+int
+filter_diff(const struct filter *new, const struct filter *old, struct f_trie *diff)
+{
+  if (filter_same(new, old))
+    return 1;
+
+  if (old == FILTER_ACCEPT || old == FILTER_REJECT ||
+      new == FILTER_ACCEPT || new == FILTER_REJECT)
+    return 0;
+
+  if ((!old->sym) != (!new->sym))
+    return 0;
+
+  if (old->sym && strcmp(old->sym->name, new->sym->name))
+    return 0;
+
+  return f_same_diff(new->root, old->root, diff);
+}
+
+/*
+ * f_same_match_diff - compare net match instructions of two filter lines
+ *
+ * This is called from f_same_diff() for FI_MATCH_CONST and FI_NOT_MATCH_CONST
+ * items at position @pos whose constants differ. If both instructions match
+ * the route network against a prefix set, the networks matched differently are
+ * added to @diff and 1 is returned.
+ */
+int
+f_same_match_diff(const struct f_line *fl1, const struct f_line *fl2, uint pos, struct f_trie *diff)
+{
+  if (!diff || !pos)
+    return 0;
+
+  /* The argument is the value of the preceding instruction */
+  const struct f_line_item *a1 = &fl1->items[pos - 1];
+  const struct f_line_item *a2 = &fl2->items[pos - 1];
+
+  if ((a1->fi_code != FI_RTA_GET) || (a1->i_FI_RTA_GET.sa.sa_code != SA_NET) ||
+      (a2->fi_code != FI_RTA_GET) || (a2->i_FI_RTA_GET.sa.sa_code != SA_NET))
+    return 0;
+
+  const struct f_line_item *i1 = &fl1->items[pos];
+  const struct f_line_item *i2 = &fl2->items[pos];
+  const struct f_val *v1 = (i1->fi_code == FI_MATCH_CONST) ? &i1->i_FI_MATCH_CONST.cval : &i1->i_FI_NOT_MATCH_CONST.cval;
+  const struct f_val *v2 = (i2->fi_code == FI_MATCH_CONST) ? &i2->i_FI_MATCH_CONST.cval : &i2->i_FI_NOT_MATCH_CONST.cval;
+
+  if ((v1->type != T_PREFIX_SET) || (v2->type != T_PREFIX_SET))
+    return 0;
+
+  trie_diff(diff, v1->val.ti, v2->val.ti);
+  return 1;
+}
+
+int
+f_net_dep(const struct f_line *fl)
+{
+  return fl && fl->net_dep;
+}
+
+/**
+ * filter_net_dep - check whether a filter depends on the route network
+ * @f: filter to be checked
+ *
+ * Returns 0 if the filter gives the same result for any two routes which
+ * differ only in their network, so the result of one run may be reused for
+ * all of them. Filters reading the network, checking ROA tables (whose content
+ * may change between runs) or logging something return 1.
+ */
+int
+filter_net_dep(const struct filter *f)
+{
+  if (f == FILTER_ACCEPT || f == FILTER_REJECT)
+    return 0;
+
+  return f_net_dep(f->root);
+}
+
+int
+f_route_dep(const struct f_line *fl)
+{
+  return fl && fl->route_dep;
+}
+
+/**
+ * filter_route_dep - check whether a filter depends on more than the network
+ * @f: filter to be checked
+ *
+ * Returns 0 if the filter gives the same result for any two routes of the
+ * same network, so the result of one run may be reused for all of them. Such
+ * filters do not access route attributes, do not modify the route, do not
+ * check ROA tables and do not log anything. Filters which may depend on
+ * anything else than the route network return 1.
+ */
+int
+filter_route_dep(const struct filter *f)
+{
+  if (f == FILTER_ACCEPT || f == FILTER_REJECT)
+    return 0;
+
+  return f_route_dep(f->root);
+}
+
+u32
+f_ea_protos(const struct f_line *fl)
+{
+  return fl ? fl->ea_protos : 0;
+}
+
+/**
+ * filter_ea_protos - find which extended attributes a filter accesses
+ * @f: filter to be checked
+ *
+ * Returns a bitmap of protocol classes (see EA_PROTO()) of extended attributes
+ * the filter may read or modify, including the functions it calls. Temporary
+ * attributes of routes from protocols not in the bitmap are not needed by the
+ * filter.
+ */
+u32
+filter_ea_protos(const struct filter *f)
+{
+  if (f == FILTER_ACCEPT || f == FILTER_REJECT)
+    return 0;
+
+  return f_ea_protos(f->root);
+}
+
+/**
+ * filter_roa_deps - find ROA tables a filter depends on
+ * @f: filter to be checked
+ *
+ * Returns the list of ROA tables checked by roa_check() in the filter,
+ * including the functions it calls. When such a table changes, the filter may
+ * give a different result for routes covered by the changed ROA.
+ */
+const struct f_roa_dep *
+filter_roa_deps(const struct filter *f)
+{
+  if (f == FILTER_ACCEPT || f == FILTER_REJECT)
+    return NULL;
+
+  return f->root ? f->root->roa_deps : NULL;
+}
+
+void
+f_add_roa_dep(struct f_line *fl, struct rtable_config *rtc)
+{
+  for (struct f_roa_dep *d = fl->roa_deps; d; d = d->next)
+    if (d->rtc == rtc)
+      return;
+
+  struct f_roa_dep *d = cfg_alloc(sizeof(struct f_roa_dep));
+  d->rtc = rtc;
+  d->next = fl->roa_deps;
+  fl->roa_deps = d;
+}
+
+void
+f_merge_roa_deps(struct f_line *dest, const struct f_line *src)
+{
+  if (!src)
+    return;
+
+  for (struct f_roa_dep *d = src->roa_deps; d; d = d->next)
+    f_add_roa_dep(dest, d->rtc);
+}
+
+#ifdef ENABLE_FILTER_PROFILING
+
+/* Called from f_linearize() for lines parsed from the config file */
+void
+f_profile_line(struct f_line *fl)
+{
+  struct config *c = new_config;
+
+  /* Lines from CLI commands are not profiled */
+  if (!c || c->fallback)
+    return;
+
+  fl->prof = cfg_allocz(sizeof(struct f_line_profile) + fl->len * sizeof(u64));
+  fl->prof->line = fl;
+  fl->prof->file = ifs ? ifs->file_name : c->file_name;
+  fl->prof->next = c->filter_profiles;
+  c->filter_profiles = fl->prof;
+}
+
+/* Executions of instructions on one config line */
+struct f_profile_spot {
+  const char *file;
+  const char *name;
+  uint lineno;
+  u64 count;
+};
+
+static int
+f_profile_cmp_cycles(const void *a, const void *b)
+{
+  const struct f_line_profile *p1 = *(const struct f_line_profile **) a;
+  const struct f_line_profile *p2 = *(const struct f_line_profile **) b;
+
+  return (p1->cycles < p2->cycles) - (p1->cycles > p2->cycles);
+}
+
+static int
+f_profile_cmp_place(const void *a, const void *b)
+{
+  const struct f_profile_spot *s1 = a, *s2 = b;
+  int c = strcmp(s1->file, s2->file);
+
+  return c ?: uint_cmp(s1->lineno, s2->lineno);
+}
+
+static int
+f_profile_cmp_count(const void *a, const void *b)
+{
+  const struct f_profile_spot *s1 = a, *s2 = b;
+
+  return (s1->count < s2->count) - (s1->count > s2->count);
+}
+
+static void
+f_show_profile_filters(uint max)
+{
+  struct f_line_profile *p, **buf;
+  uint n = 0;
+
+  for (p = config->filter_profiles; p; p = p->next)
+    n += !!p->calls;
+
+  buf = xmalloc(n * sizeof(struct f_line_profile *) + 1);
+  n = 0;
+
+  for (p = config->filter_profiles; p; p = p->next)
+    if (p->calls)
+      buf[n++] = p;
+
+  qsort(buf, n, sizeof(struct f_line_profile *), f_profile_cmp_cycles);
+
+  cli_msg(-1028, "%-20s %12s %12s %12s %16s %10s  %s", "Filter", "Calls",
+	  "Accepted", "Rejected", "Cycles", "Per call", "Location");
+
+  for (uint i = 0; i < MIN(n, max); i++)
+  {
+    p = buf[i];
+    cli_msg(-1028, "%-20s %12lu %12lu %12lu %16lu %10lu  %s:%u",
+	    p->name ?: "(unnamed)", p->calls, p->accepts, p->rejects,
+	    p->cycles, p->cycles / p->calls,
+	    p->file ?: "?", p->line->len ? p->line->items[0].lineno : 0);
+  }
+
+  xfree(buf);
+}
+
+static void
+f_show_profile_lines(uint max)
+{
+  struct f_line_profile *p;
+  struct f_profile_spot *buf;
+  uint n = 0;
+
+  for (p = config->filter_profiles; p; p = p->next)
+    for (uint i = 0; i < p->line->len; i++)
+      n += !!p->count[i];
+
+  buf = xmalloc(n * sizeof(struct f_profile_spot) + 1);
+  n = 0;
+
+  for (p = config->filter_profiles; p; p = p->next)
+    for (uint i = 0; i < p->line->len; i++)
+      if (p->count[i])
+	buf[n++] = (struct f_profile_spot) {
+	  .file = p->file ?: "?",
+	  .name = p->name,
+	  .lineno = p->line->items[i].lineno,
+	  .count = p->count[i],
+	};
+
+  /* Sum instructions on the same config line */
+  qsort(buf, n, sizeof(struct f_profile_spot), f_profile_cmp_place);
+
+  uint m = 0;
+  for (uint i = 0; i < n; i++)
+    if (m && !f_profile_cmp_place(&buf[m-1], &buf[i]))
+    {
+      buf[m-1].count += buf[i].count;
+      buf[m-1].name = buf[m-1].name ?: buf[i].name;
+    }
+    else
+      buf[m++] = buf[i];
+
+  qsort(buf, m, sizeof(struct f_profile_spot), f_profile_cmp_count);
+
+  cli_msg(-1028, "");
+  cli_msg(-1028, "%-32s %16s  %s", "Location", "Instructions", "Filter");
+
+  for (uint i = 0; i < MIN(m, max); i++)
+  {
+    char loc[64];
+    bsnprintf(loc, sizeof(loc), "%s:%u", buf[i].file, buf[i].lineno);
+    cli_msg(-1028, "%-32s %16lu  %s", loc, buf[i].count, buf[i].name ?: "-");
+  }
+
+  xfree(buf);
+}
+
+#endif
+
+/**
+ * filter_show_profile - show the most expensive filters and config lines
+ * @max: number of entries shown in each list
+ *
+ * Filters are ordered by time spent in them, config lines by number of
+ * executed instructions, including lines of functions and nested blocks.
+ * Statistics are collected with debug filters enabled and they are reset by
+ * reconfiguration.
+ */
+#ifdef ENABLE_FILTER_PROFILING
+void
+filter_show_profile(uint max)
+{
+  f_show_profile_filters(max);
+  f_show_profile_lines(max);
+
+  if (!config->filter_profile)
+    cli_msg(-1028, "Filters are profiled with debug filters enabled");
+
+  cli_msg(0, "");
+}
+#else
+void
+filter_show_profile(uint max UNUSED)
+{
+  cli_msg(8009, "Filter profiling is not compiled in");
+}
+#endif
+
 /**
  * filter_commit - do filter comparisons on all the named functions and filters
  */
@@ -50,8 +50,16 @@ struct filter {
 };
 
 struct rte;
+struct f_trie;
+
+/* ROA table checked by a filter, see filter_roa_deps() */
+struct f_roa_dep {
+  struct f_roa_dep *next;
+  struct rtable_config *rtc;
+};
 
 enum filter_return f_run(const struct filter *filter, struct rte **rte, struct linpool *tmp_pool, int flags);
+void f_run_batch(const struct filter *filter, struct rte **rte, enum filter_return *res, uint count, struct linpool *tmp_pool, int flags);
 enum filter_return f_eval_rte(const struct f_line *expr, struct rte **rte, struct linpool *tmp_pool);
 uint f_eval_int(const struct f_line *expr);
 enum filter_return f_eval_buf(const struct f_line *expr, struct linpool *tmp_pool, buffer *buf);
@@ -59,6 +67,17 @@ enum filter_return f_eval_buf(const struct f_line *expr, struct linpool *tmp_poo
 const char *filter_name(const struct filter *filter);
 int filter_same(const struct filter *new, const struct filter *old);
 int f_same(const struct f_line *f1, const struct f_line *f2);
+int filter_diff(const struct filter *new, const struct filter *old, struct f_trie *diff);
+int f_net_dep(const struct f_line *fl);
+int filter_net_dep(const struct filter *f);
+int f_route_dep(const struct f_line *fl);
+int filter_route_dep(const struct filter *f);
+u32 f_ea_protos(const struct f_line *fl);
+u32 filter_ea_protos(const struct filter *f);
+const struct f_roa_dep *filter_roa_deps(const struct filter *f);
+void filter_show_profile(uint count);
+void f_add_roa_dep(struct f_line *fl, struct rtable_config *rtc);
+void f_merge_roa_deps(struct f_line *dest, const struct f_line *src);
 
 void filter_commit(struct config *new, struct config *old);
 
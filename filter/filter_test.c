@@ -53,6 +53,39 @@ run_function(const void *arg)
   return (fret < F_REJECT);
 }
 
+#ifdef ENABLE_FILTER_PROFILING
+#define BT_CONFIG_PROFILE \
+  "debug filters on;\n" \
+  "function t_profile() int x; { x = 1; x = x + 2; x = x * 3; }\n"
+
+#define PROFILE_RUNS 10
+
+static int
+t_profile(void)
+{
+  struct config *cfg = bt_config_parse(BT_CONFIG_PROFILE);
+  if (!cfg)
+    return 0;
+
+  struct symbol *s = cf_find_symbol(cfg, "t_profile");
+  bt_assert(s && (s->class == SYM_FUNCTION));
+
+  const struct f_line *fl = s->function;
+  bt_assert(fl->prof && (fl->len > 1));
+
+  linpool *tmp = lp_new_default(&root_pool);
+  for (uint i = 0; i < PROFILE_RUNS; i++)
+    bt_assert(f_eval(fl, tmp, NULL) == F_NOP);
+  rfree(tmp);
+
+  /* Every instruction of the line is counted, not only the first one */
+  for (uint i = 0; i < fl->len; i++)
+    bt_assert(fl->prof->count[i] == PROFILE_RUNS);
+
+  return 1;
+}
+#endif
+
 static void
 bt_assert_filter(int result, const struct f_line_item *assert)
 {
@@ -82,6 +115,10 @@ main(int argc, char *argv[])
 
   bt_test_suite(t_reconfig, "Testing reconfiguration");
 
+#ifdef ENABLE_FILTER_PROFILING
+  bt_test_suite(t_profile, "Profile counts of a multi-instruction line");
+#endif
+
   struct f_bt_test_suite *t;
   WALK_LIST(t, config->tests)
     bt_test_suite_base(run_function, t->fn_name, t, BT_FORKING, BT_TIMEOUT, "%s", t->dsc);
@@ -27,15 +27,17 @@
 const struct f_tree *
 find_tree(const struct f_tree *t, const struct f_val *val)
 {
-  if (!t)
-    return NULL;
-  if ((val_compare(&(t->from), val) != 1) &&
-      (val_compare(&(t->to), val) != -1))
-    return t;
-  if (val_compare(&(t->from), val) == -1)
-    return find_tree(t->right, val);
-  else
-    return find_tree(t->left, val);
+  while (t)
+  {
+    int c = val_compare(&(t->from), val);
+
+    if ((c != 1) && (val_compare(&(t->to), val) != -1))
+      return t;
+
+    t = (c == -1) ? t->right : t->left;
+  }
+
+  return NULL;
 }
 
 static struct f_tree *
@@ -139,6 +141,108 @@ same_tree(const struct f_tree *t1, const struct f_tree *t2)
   return 1;
 }
 
+static u32
+tree_val_hash(const struct f_val *v)
+{
+  switch (v->type)
+  {
+  case T_VOID:
+    return 0;
+  case T_EC:
+  case T_RD:
+    return u64_hash(v->val.ec);
+  case T_LC:
+    return u32_hash(v->val.lc.asn) ^ u32_hash(v->val.lc.ldp1 + 1) ^ u32_hash(v->val.lc.ldp2 + 2);
+  case T_IP:
+    return ipa_hash(v->val.ip);
+  default:
+    return u32_hash(v->val.i);
+  }
+}
+
+/**
+ * tree_hash
+ * @t: tree to be hashed
+ *
+ * Computes a hash of set items in the tree, consistent with same_tree() for
+ * trees without attached data.
+ */
+u32
+tree_hash(const struct f_tree *t)
+{
+  if (!t)
+    return 0;
+
+  u32 h = tree_val_hash(&(t->from)) ^ (3 * tree_val_hash(&(t->to))) ^ t->from.type;
+  h = h * 65599 + tree_hash(t->left);
+  h = h * 65599 + tree_hash(t->right);
+  return h;
+}
+
+/**
+ * tree_net_dep
+ * @t: tree of a |case| statement
+ *
+ * Returns 1 if any of the filter lines attached to the tree may depend on the
+ * route network, see filter_net_dep().
+ */
+int
+tree_net_dep(const struct f_tree *t)
+{
+  if (!t)
+    return 0;
+  return f_net_dep(t->data) || tree_net_dep(t->left) || tree_net_dep(t->right);
+}
+
+/**
+ * tree_route_dep
+ * @t: tree of a |case| statement
+ *
+ * Returns 1 if any of the filter lines attached to the tree may depend on
+ * other route data than the network, see filter_route_dep().
+ */
+int
+tree_route_dep(const struct f_tree *t)
+{
+  if (!t)
+    return 0;
+  return f_route_dep(t->data) || tree_route_dep(t->left) || tree_route_dep(t->right);
+}
+
+/**
+ * tree_ea_protos
+ * @t: tree of a |case| statement
+ *
+ * Returns protocol classes of attributes accessed by the filter lines attached
+ * to the tree, see filter_ea_protos().
+ */
+u32
+tree_ea_protos(const struct f_tree *t)
+{
+  if (!t)
+    return 0;
+  return f_ea_protos(t->data) | tree_ea_protos(t->left) | tree_ea_protos(t->right);
+}
+
+/**
+ * tree_roa_deps
+ * @dest: filter line to add the ROA tables to
+ * @t: tree of a |case| statement
+ *
+ * Adds ROA tables checked by the filter lines attached to the tree to @dest,
+ * see filter_roa_deps().
+ */
+void
+tree_roa_deps(struct f_line *dest, const struct f_tree *t)
+{
+  if (!t)
+    return;
+
+  f_merge_roa_deps(dest, t->data);
+  tree_roa_deps(dest, t->left);
+  tree_roa_deps(dest, t->right);
+}
+
 
 static void
 tree_node_format(const struct f_tree *t, buffer *buf)
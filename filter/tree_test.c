@@ -173,6 +173,7 @@ t_balancing(void)
     show_tree(balanced_tree_from_simple);
 
     bt_assert(same_tree(balanced_tree_from_simple, expected_balanced_tree));
+    bt_assert(tree_hash(balanced_tree_from_simple) == tree_hash(expected_balanced_tree));
   }
 
   return 1;
@@ -203,6 +204,7 @@ t_balancing_random(void)
       show_tree(balanced_tree_from_random);
 
       bt_assert(same_tree(balanced_tree_from_random, expected_balanced_tree));
+      bt_assert(tree_hash(balanced_tree_from_random) == tree_hash(expected_balanced_tree));
     }
   }
 
@@ -67,6 +67,16 @@
  *
  * The walking code in trie_match_prefix() is structured according to
  * these cases.
+ *
+ * Large prefix sets (e.g. generated from IRR data) form deep tries, so
+ * trie_compile() builds a top-level stride index for them when the
+ * prefix set is finished. The index has one slot for each value of the
+ * first %TRIE_INDEX_BITS bits of the address. A slot contains the first
+ * node of that path with &plen >= %TRIE_INDEX_BITS (where the regular
+ * walk continues) and a bitwise or of &accept masks of all shorter nodes
+ * on the path (that would be checked by the regular walk before).
+ * Prefixes longer than %TRIE_INDEX_BITS are then matched by one indexed
+ * lookup instead of walking through the upper part of the trie.
  */
 
 #include "nest/bird.h"
@@ -91,6 +101,20 @@
 #define ipt_from_ip4(x) _MI6(_I(x), 0, 0, 0)
 #define ipt_to_ip4(x) _MI4(_I0(x))
 
+#define TRIE_INDEX_BITS		16
+#define TRIE_INDEX_SIZE		(1 << TRIE_INDEX_BITS)
+#define TRIE_INDEX_MIN_NODES	4096
+
+struct f_trie_slot4 {
+  ip4_addr accept;			/* Accept masks of skipped nodes */
+  const struct f_trie_node4 *node;	/* Where to continue the walk */
+};
+
+struct f_trie_slot6 {
+  ip6_addr accept;
+  const struct f_trie_node6 *node;
+};
+
 
 /**
  * f_new_trie - allocates and returns a new empty trie
@@ -133,6 +157,8 @@ new_node6(struct f_trie *t, int plen, ip6_addr paddr, ip6_addr pmask, ip6_addr a
 static inline struct f_trie_node *
 new_node(struct f_trie *t, int plen, ip_addr paddr, ip_addr pmask, ip_addr amask)
 {
+  t->node_count++;
+
   if (t->ipv4)
     return (struct f_trie_node *) new_node4(t, plen, ipt_to_ip4(paddr), ipt_to_ip4(pmask), ipt_to_ip4(amask));
   else
@@ -195,6 +221,9 @@ trie_add_prefix(struct f_trie *t, const net_addr *net, uint l, uint h)
   default: bug("invalid type");
   }
 
+  /* The index is built for the final trie */
+  t->index = NULL;
+
   if (t->ipv4 != v4)
   {
     if (t->ipv4 < 0)
@@ -279,6 +308,100 @@ trie_add_prefix(struct f_trie *t, const net_addr *net, uint l, uint h)
   return a;
 }
 
+/*
+ * The index is filled by one recursive walk through the upper part of the
+ * trie. A node with &plen < %TRIE_INDEX_BITS covers a contiguous range of
+ * slots, other slots of its parent range end out of path. A node with
+ * &plen >= %TRIE_INDEX_BITS (or a missing child) ends the walk for the whole
+ * range of its parent.
+ */
+
+static void
+trie_index_fill4(struct f_trie_slot4 *idx, const struct f_trie_node4 *n, ip4_addr accept, uint lo, uint hi)
+{
+  if (!n || (n->plen >= TRIE_INDEX_BITS))
+  {
+    for (uint i = lo; i < hi; i++)
+      idx[i] = (struct f_trie_slot4) { .accept = accept, .node = n };
+    return;
+  }
+
+  uint base = ip4_to_u32(n->addr) >> (IP4_MAX_PREFIX_LENGTH - TRIE_INDEX_BITS);
+  uint size = 1 << (TRIE_INDEX_BITS - n->plen);
+
+  /* Out of path, the walk would end here */
+  for (uint i = lo; i < base; i++)
+    idx[i] = (struct f_trie_slot4) { .accept = accept, .node = NULL };
+
+  for (uint i = base + size; i < hi; i++)
+    idx[i] = (struct f_trie_slot4) { .accept = accept, .node = NULL };
+
+  accept = ip4_or(accept, n->accept);
+  trie_index_fill4(idx, n->c[0], accept, base, base + size / 2);
+  trie_index_fill4(idx, n->c[1], accept, base + size / 2, base + size);
+}
+
+static void
+trie_index_fill6(struct f_trie_slot6 *idx, const struct f_trie_node6 *n, ip6_addr accept, uint lo, uint hi)
+{
+  if (!n || (n->plen >= TRIE_INDEX_BITS))
+  {
+    for (uint i = lo; i < hi; i++)
+      idx[i] = (struct f_trie_slot6) { .accept = accept, .node = n };
+    return;
+  }
+
+  uint base = _I0(n->addr) >> (32 - TRIE_INDEX_BITS);
+  uint size = 1 << (TRIE_INDEX_BITS - n->plen);
+
+  for (uint i = lo; i < base; i++)
+    idx[i] = (struct f_trie_slot6) { .accept = accept, .node = NULL };
+
+  for (uint i = base + size; i < hi; i++)
+    idx[i] = (struct f_trie_slot6) { .accept = accept, .node = NULL };
+
+  accept = ip6_or(accept, n->accept);
+  trie_index_fill6(idx, n->c[0], accept, base, base + size / 2);
+  trie_index_fill6(idx, n->c[1], accept, base + size / 2, base + size);
+}
+
+static void
+trie_compile4(struct f_trie *t)
+{
+  struct f_trie_slot4 *idx = lp_alloc(t->lp, TRIE_INDEX_SIZE * sizeof(struct f_trie_slot4));
+  trie_index_fill4(idx, &t->root.v4, IP4_NONE, 0, TRIE_INDEX_SIZE);
+  t->index = idx;
+}
+
+static void
+trie_compile6(struct f_trie *t)
+{
+  struct f_trie_slot6 *idx = lp_alloc(t->lp, TRIE_INDEX_SIZE * sizeof(struct f_trie_slot6));
+  trie_index_fill6(idx, &t->root.v6, IP6_NONE, 0, TRIE_INDEX_SIZE);
+  t->index = idx;
+}
+
+/**
+ * trie_compile
+ * @t: trie
+ *
+ * Prepares a finished trie for matching. For large tries, it builds
+ * a top-level stride index (see above) that is used by trie_match_net().
+ * The index is allocated from the trie linpool and it is dropped when
+ * another prefix is added to the trie.
+ */
+void
+trie_compile(struct f_trie *t)
+{
+  if ((t->ipv4 < 0) || (t->node_count < TRIE_INDEX_MIN_NODES))
+    return;
+
+  if (t->ipv4)
+    trie_compile4(t);
+  else
+    trie_compile6(t);
+}
+
 static int
 trie_match_net4(const struct f_trie *t, ip4_addr px, uint plen)
 {
@@ -291,6 +414,16 @@ trie_match_net4(const struct f_trie *t, ip4_addr px, uint plen)
   int plentest = plen - 1;
   const struct f_trie_node4 *n = &t->root.v4;
 
+  if (t->index && (plen > TRIE_INDEX_BITS))
+  {
+    const struct f_trie_slot4 *s = &((const struct f_trie_slot4 *) t->index)[ip4_to_u32(paddr) >> (IP4_MAX_PREFIX_LENGTH - TRIE_INDEX_BITS)];
+
+    if (ip4_getbit(s->accept, plentest))
+      return 1;
+
+    n = s->node;
+  }
+
   while (n)
   {
     ip4_addr cmask = ip4_and(n->mask, pmask);
@@ -326,6 +459,16 @@ trie_match_net6(const struct f_trie *t, ip6_addr px, uint plen)
   int plentest = plen - 1;
   const struct f_trie_node6 *n = &t->root.v6;
 
+  if (t->index && (plen > TRIE_INDEX_BITS))
+  {
+    const struct f_trie_slot6 *s = &((const struct f_trie_slot6 *) t->index)[_I0(paddr) >> (32 - TRIE_INDEX_BITS)];
+
+    if (ip6_getbit(s->accept, plentest))
+      return 1;
+
+    n = s->node;
+  }
+
   while (n)
   {
     ip6_addr cmask = ip6_and(n->mask, pmask);
@@ -378,6 +521,173 @@ trie_match_net(const struct f_trie *t, const net_addr *n)
   }
 }
 
+static void
+trie_diff_add(struct f_trie *diff, const struct f_trie_node *n, int v4)
+{
+  net_addr net;
+
+  if (v4)
+    net_fill_ip4(&net, n->v4.addr, n->v4.plen);
+  else
+    net_fill_ip6(&net, n->v6.addr, n->v6.plen);
+
+  /* Any network overlapping the node may be affected */
+  trie_add_prefix(diff, &net, 0, v4 ? IP4_MAX_PREFIX_LENGTH : IP6_MAX_PREFIX_LENGTH);
+}
+
+static void
+trie_diff_subtree(struct f_trie *diff, const struct f_trie_node *n, int v4)
+{
+  if (!n)
+    return;
+
+  /* The range of the node covers all its descendants */
+  if (ipa_nonzero(GET_ADDR(n, accept, v4)))
+  {
+    trie_diff_add(diff, n, v4);
+    return;
+  }
+
+  trie_diff_subtree(diff, GET_CHILD(n, c, v4, 0), v4);
+  trie_diff_subtree(diff, GET_CHILD(n, c, v4, 1), v4);
+}
+
+static void
+trie_diff_nodes(struct f_trie *diff, const struct f_trie_node *a, const struct f_trie_node *b, int v4)
+{
+  if (!a || !b)
+  {
+    trie_diff_subtree(diff, a ?: b, v4);
+    return;
+  }
+
+  uint alen = v4 ? a->v4.plen : a->v6.plen;
+  uint blen = v4 ? b->v4.plen : b->v6.plen;
+  ip_addr baddr = GET_ADDR(b, addr, v4);
+  ip_addr cmask = ipa_mkmask(MIN(alen, blen));
+
+  /* Nodes are out of path of each other */
+  if (ipa_compare(ipa_and(GET_ADDR(a, addr, v4), cmask), ipa_and(baddr, cmask)))
+  {
+    trie_diff_subtree(diff, a, v4);
+    trie_diff_subtree(diff, b, v4);
+    return;
+  }
+
+  if (alen == blen)
+  {
+    if (ipa_compare(GET_ADDR(a, accept, v4), GET_ADDR(b, accept, v4)))
+    {
+      trie_diff_add(diff, a, v4);
+      return;
+    }
+
+    trie_diff_nodes(diff, GET_CHILD(a, c, v4, 0), GET_CHILD(b, c, v4, 0), v4);
+    trie_diff_nodes(diff, GET_CHILD(a, c, v4, 1), GET_CHILD(b, c, v4, 1), v4);
+    return;
+  }
+
+  if (alen > blen)
+  {
+    const struct f_trie_node *x = a; a = b; b = x;
+    alen = blen;
+    baddr = GET_ADDR(b, addr, v4);
+  }
+
+  /*
+   * Node a has no counterpart in the other trie. If it accepts nothing, it is
+   * just a branching node and it does not change the matching by itself.
+   */
+  if (ipa_nonzero(GET_ADDR(a, accept, v4)))
+  {
+    trie_diff_add(diff, a, v4);
+    return;
+  }
+
+  int bit = ipa_getbit(baddr, alen) ? 1 : 0;
+  trie_diff_nodes(diff, GET_CHILD(a, c, v4, bit), b, v4);
+  trie_diff_subtree(diff, GET_CHILD(a, c, v4, !bit), v4);
+}
+
+/**
+ * trie_diff
+ * @diff: trie collecting the ranges
+ * @t1: first trie to be compared
+ * @t2: second one
+ *
+ * Adds prefix patterns to @diff so that it matches (see trie_match_net()) all
+ * networks which may be matched differently by @t1 and @t2. That is done by
+ * adding the range of every node which differs between the tries, as only
+ * networks overlapping such node can be affected. The family of @diff must be
+ * already set; tries of the other family match nothing and are skipped.
+ */
+void
+trie_diff(struct f_trie *diff, const struct f_trie *t1, const struct f_trie *t2)
+{
+  int v4 = diff->ipv4;
+  const struct f_trie_node *r1 = (t1->ipv4 == v4) ? &t1->root : NULL;
+  const struct f_trie_node *r2 = (t2->ipv4 == v4) ? &t2->root : NULL;
+
+  if ((r1 && t1->zero) != (r2 && t2->zero))
+  {
+    net_addr net;
+    net_fill_ipa(&net, v4 ? IPA_NONE4 : IPA_NONE6, 0);
+    trie_add_prefix(diff, &net, 0, 0);
+  }
+
+  trie_diff_nodes(diff, r1, r2, v4);
+}
+
+static void
+trie_cover_node(const struct f_trie_node *n, net_addr *px, uint *count, int v4)
+{
+  if (!n)
+    return;
+
+  /* The node covers all networks matched in its subtree */
+  if (ipa_nonzero(GET_ADDR(n, accept, v4)))
+  {
+    if (v4)
+      net_fill_ip4(&px[(*count)++], n->v4.addr, n->v4.plen);
+    else
+      net_fill_ip6(&px[(*count)++], n->v6.addr, n->v6.plen);
+
+    return;
+  }
+
+  trie_cover_node(GET_CHILD(n, c, v4, 0), px, count, v4);
+  trie_cover_node(GET_CHILD(n, c, v4, 1), px, count, v4);
+}
+
+/**
+ * trie_cover
+ * @t: trie
+ * @count: number of returned prefixes
+ *
+ * Returns an array of non-overlapping prefixes in the prefix order (as used by
+ * fib_next_ordered()) such that any network matched by @t is a subnet or a
+ * supernet of one of them. The array is allocated from the trie linpool. It
+ * allows to visit networks matched by @t in an ordered structure without
+ * walking all of it.
+ */
+net_addr *
+trie_cover(const struct f_trie *t, uint *count)
+{
+  net_addr *px = lp_alloc(t->lp, (t->node_count + 1) * sizeof(net_addr));
+  *count = 0;
+
+  if (t->ipv4 < 0)
+    return px;
+
+  trie_cover_node(&t->root, px, count, t->ipv4);
+
+  /* Just the default network */
+  if (t->zero && !*count)
+    net_fill_ipa(&px[(*count)++], t->ipv4 ? IPA_NONE4 : IPA_NONE6, 0);
+
+  return px;
+}
+
 static int
 trie_node_same4(const struct f_trie_node4 *t1, const struct f_trie_node4 *t2)
 {
@@ -431,6 +741,47 @@ trie_same(const struct f_trie *t1, const struct f_trie *t2)
     return trie_node_same6(&t1->root.v6, &t2->root.v6);
 }
 
+static u32
+trie_node_hash4(const struct f_trie_node4 *n)
+{
+  if (!n)
+    return 0;
+
+  u32 h = ip4_hash(n->addr) ^ (3 * ip4_hash(n->accept)) ^ n->plen;
+  h = h * 65599 + trie_node_hash4(n->c[0]);
+  h = h * 65599 + trie_node_hash4(n->c[1]);
+  return h;
+}
+
+static u32
+trie_node_hash6(const struct f_trie_node6 *n)
+{
+  if (!n)
+    return 0;
+
+  u32 h = ip6_hash(n->addr) ^ (3 * ip6_hash(n->accept)) ^ n->plen;
+  h = h * 65599 + trie_node_hash6(n->c[0]);
+  h = h * 65599 + trie_node_hash6(n->c[1]);
+  return h;
+}
+
+/**
+ * trie_hash
+ * @t: trie to be hashed
+ *
+ * Computes a hash of the trie, consistent with trie_same().
+ */
+u32
+trie_hash(const struct f_trie *t)
+{
+  u32 h = t->zero ^ ((u32) (t->ipv4 + 1) << 1);
+
+  if (t->ipv4)
+    return h ^ trie_node_hash4(&t->root.v4);
+  else
+    return h ^ trie_node_hash6(&t->root.v6);
+}
+
 static void
 trie_node_format4(const struct f_trie_node4 *t, buffer *buf)
 {
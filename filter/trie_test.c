@@ -31,6 +31,14 @@ xrandom(u32 max)
   return (bt_random() % max);
 }
 
+static const char *
+net_str(const net_addr *n)
+{
+  static char buf[NET_MAX_TEXT_LENGTH+1];
+  net_format(n, buf, sizeof(buf));
+  return buf;
+}
+
 static int
 is_prefix_included(list *prefixes, struct f_prefix *needle)
 {
@@ -134,6 +142,178 @@ t_match_net(void)
   return 1;
 }
 
+static struct f_prefix
+get_random_ip4_prefix(void)
+{
+  struct f_prefix p;
+  u8 pxlen = xrandom(25)+8;
+  net_addr_ip4 net4 = NET_ADDR_IP4(ip4_from_u32(bt_random()), pxlen);
+  net_normalize_ip4(&net4);
+
+  p.net = *((net_addr*) &net4);
+  p.lo = p.net.pxlen;
+  p.hi = (bt_random() % 2) ? p.net.pxlen : IP4_MAX_PREFIX_LENGTH;
+
+  return p;
+}
+
+static int
+t_match_net_index(void)
+{
+  bt_bird_init();
+  bt_config_parse(BT_CONFIG_SIMPLE);
+
+  uint round;
+  for (round = 0; round < TESTS_NUM; round++)
+  {
+    int v4 = round % 2;
+    struct f_trie *plain = f_new_trie(config->mem, 0);
+    struct f_trie *indexed = f_new_trie(config->mem, 0);
+
+    struct f_prefix *pxs = calloc(PREFIX_TESTS_NUM, sizeof(struct f_prefix));
+
+    int i;
+    for (i = 0; i < PREFIX_TESTS_NUM; i++)
+    {
+      struct f_prefix *f = &pxs[i];
+      *f = v4 ? get_random_ip4_prefix() : get_random_ip6_prefix();
+      trie_add_prefix(plain, &f->net, f->lo, f->hi);
+      trie_add_prefix(indexed, &f->net, f->lo, f->hi);
+    }
+
+    trie_compile(indexed);
+    bt_assert(indexed->index != NULL);
+
+    for (i = 0; i < PREFIX_TESTS_NUM; i++)
+    {
+      struct f_prefix f = v4 ? get_random_ip4_prefix() : get_random_ip6_prefix();
+
+      /* Derive every other tested prefix from the set to get more matches */
+      if (i % 2)
+      {
+	f = pxs[xrandom(PREFIX_TESTS_NUM)];
+	f.net.pxlen = xrandom(net_max_prefix_length[f.net.type] + 1);
+      }
+
+      bt_assert_msg(trie_match_net(plain, &f.net) == trie_match_net(indexed, &f.net), "Prefix %s matched differently in indexed trie", net_str(&f.net));
+    }
+
+    free(pxs);
+  }
+
+  bt_bird_cleanup();
+  return 1;
+}
+
+static int
+t_trie_diff(void)
+{
+  bt_bird_init();
+  bt_config_parse(BT_CONFIG_SIMPLE);
+
+  uint round;
+  for (round = 0; round < TESTS_NUM; round++)
+  {
+    int v4 = round % 2;
+    struct f_trie *trie1 = f_new_trie(config->mem, 0);
+    struct f_trie *trie2 = f_new_trie(config->mem, 0);
+    struct f_trie *diff = f_new_trie(config->mem, 0);
+    diff->ipv4 = v4;
+
+    struct f_prefix *pxs = calloc(PREFIX_TESTS_NUM, sizeof(struct f_prefix));
+
+    int i;
+    for (i = 0; i < PREFIX_TESTS_NUM; i++)
+    {
+      struct f_prefix *f = &pxs[i];
+      *f = v4 ? get_random_ip4_prefix() : get_random_ip6_prefix();
+
+      /* Some prefixes are in just one of the tries */
+      if (i % 50)
+	trie_add_prefix(trie1, &f->net, f->lo, f->hi);
+      if ((i % 50) != 1)
+	trie_add_prefix(trie2, &f->net, f->lo, f->hi);
+    }
+
+    trie_diff(diff, trie1, trie2);
+
+    for (i = 0; i < PREFIX_TESTS_NUM; i++)
+    {
+      struct f_prefix f = pxs[xrandom(PREFIX_TESTS_NUM)];
+      f.net.pxlen = xrandom(net_max_prefix_length[f.net.type] + 1);
+
+      if (trie_match_net(trie1, &f.net) != trie_match_net(trie2, &f.net))
+	bt_assert_msg(trie_match_net(diff, &f.net), "Prefix %s matched differently but not in diff", net_str(&f.net));
+    }
+
+    /* Same tries have empty diff */
+    diff = f_new_trie(config->mem, 0);
+    diff->ipv4 = v4;
+    trie_diff(diff, trie1, trie1);
+    bt_assert(!diff->zero && !diff->node_count);
+    bt_assert(v4 ? !ip4_nonzero(diff->root.v4.accept) : !ip6_nonzero(diff->root.v6.accept));
+
+    free(pxs);
+  }
+
+  bt_bird_cleanup();
+  return 1;
+}
+
+static int
+t_trie_cover(void)
+{
+  bt_bird_init();
+  bt_config_parse(BT_CONFIG_SIMPLE);
+
+  uint round;
+  for (round = 0; round < TESTS_NUM; round++)
+  {
+    int v4 = round % 2;
+    struct f_trie *trie = f_new_trie(config->mem, 0);
+
+    struct f_prefix *pxs = calloc(PREFIX_TESTS_NUM, sizeof(struct f_prefix));
+
+    int i;
+    for (i = 0; i < PREFIXES_NUM; i++)
+    {
+      pxs[i] = v4 ? get_random_ip4_prefix() : get_random_ip6_prefix();
+      trie_add_prefix(trie, &pxs[i].net, pxs[i].lo, pxs[i].hi);
+    }
+
+    uint count;
+    net_addr *cover = trie_cover(trie, &count);
+
+    /* Covering prefixes are ordered and do not overlap */
+    for (uint j = 1; j < count; j++)
+      bt_assert_msg(!net_in_netX(&cover[j], &cover[j-1]) && !net_in_netX(&cover[j-1], &cover[j]) &&
+		    (net_compare(&cover[j-1], &cover[j]) < 0),
+		    "Covering prefixes %s and %s overlap", net_str(&cover[j-1]), net_str(&cover[j]));
+
+    for (i = 0; i < PREFIX_TESTS_NUM; i++)
+    {
+      struct f_prefix f = pxs[xrandom(PREFIXES_NUM)];
+      f.net.pxlen = xrandom(net_max_prefix_length[f.net.type] + 1);
+      net_normalize(&f.net);
+
+      if (!trie_match_net(trie, &f.net))
+	continue;
+
+      uint j;
+      for (j = 0; j < count; j++)
+	if (net_in_netX(&f.net, &cover[j]) || net_in_netX(&cover[j], &f.net))
+	  break;
+
+      bt_assert_msg(j < count, "Prefix %s matched but not covered", net_str(&f.net));
+    }
+
+    free(pxs);
+  }
+
+  bt_bird_cleanup();
+  return 1;
+}
+
 static int
 t_trie_same(void)
 {
@@ -163,6 +343,7 @@ t_trie_same(void)
     }
 
     bt_assert(trie_same(trie1, trie2));
+    bt_assert(trie_hash(trie1) == trie_hash(trie2));
 
     struct f_prefix_node *nxt;
     WALK_LIST_DELSAFE(n, nxt, prefixes)
@@ -174,13 +355,48 @@ t_trie_same(void)
   return 1;
 }
 
+#define BENCH_PREFIXES		10000
+#define BENCH_NETS		4096
+
+static void
+b_trie_match_net(uint n)
+{
+  static struct f_trie *trie;
+  static net_addr nets[BENCH_NETS];
+
+  if (!trie)
+  {
+    trie = f_new_trie(lp_new_default(&root_pool), 0);
+
+    for (uint i = 0; i < BENCH_PREFIXES; i++)
+    {
+      struct f_prefix f = get_random_ip4_prefix();
+      trie_add_prefix(trie, &f.net, f.lo, f.hi);
+    }
+
+    for (uint i = 0; i < BENCH_NETS; i++)
+      nets[i] = get_random_ip4_prefix().net;
+  }
+
+  uint found = 0;
+  for (uint i = 0; i < n; i++)
+    found += trie_match_net(trie, &nets[i % BENCH_NETS]);
+
+  bt_debug("Found %u\n", found);
+}
+
 int
 main(int argc, char *argv[])
 {
   bt_init(argc, argv);
 
   bt_test_suite(t_match_net, "Testing random prefix matching");
+  bt_test_suite(t_match_net_index, "Testing prefix matching with trie index");
+  bt_test_suite(t_trie_diff, "Testing ranges of prefixes matched differently by two tries");
+  bt_test_suite(t_trie_cover, "Testing prefixes covering networks matched by a trie");
   bt_test_suite(t_trie_same, "A trie filled forward should be same with a trie filled backward.");
 
+  bt_bench(b_trie_match_net, "Matching random IPv4 prefixes in a trie");
+
   return bt_exit_value();
 }
@@ -56,6 +56,23 @@ bmap_free(struct bmap *b)
   b->data = NULL;
 }
 
+/* Test whether all bits set in @a are set in @b */
+int
+bmap_is_subset(struct bmap *a, struct bmap *b)
+{
+  uint n = MIN(a->size, b->size) / 4;
+
+  for (uint i = 0; i < n; i++)
+    if (a->data[i] & ~b->data[i])
+      return 0;
+
+  for (uint i = n; i < a->size / 4; i++)
+    if (a->data[i])
+      return 0;
+
+  return 1;
+}
+
 
 
 /*
@@ -20,6 +20,7 @@ void bmap_init(struct bmap *b, pool *p, uint size);
 void bmap_reset(struct bmap *b, uint size);
 void bmap_grow(struct bmap *b, uint need);
 void bmap_free(struct bmap *b);
+int bmap_is_subset(struct bmap *a, struct bmap *b);
 
 static inline uint bmap_max(struct bmap *b)
 { return 8 * b->size; }
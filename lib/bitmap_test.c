@@ -55,6 +55,45 @@ t_bmap_set_clear_random(void)
   return 1;
 }
 
+static int
+t_bmap_subset(void)
+{
+  struct bmap a, b;
+
+  resource_init();
+  bmap_init(&a, &root_pool, 1024);
+  bmap_init(&b, &root_pool, 1024);
+
+  bt_assert(bmap_is_subset(&a, &b));
+
+  for (uint i = 0; i < MAX_SET; i++)
+  {
+    uint n = bt_random() % MAX_NUM;
+    bmap_set(&a, n);
+    bmap_set(&b, n);
+    bmap_set(&b, bt_random() % MAX_NUM);
+  }
+
+  bt_assert(bmap_is_subset(&a, &b));
+
+  /* Bit beyond the size of @b */
+  bmap_set(&a, MAX_NUM * 2);
+  bt_assert(!bmap_is_subset(&a, &b));
+  bmap_clear(&a, MAX_NUM * 2);
+  bt_assert(bmap_is_subset(&a, &b));
+
+  /* Bit within both */
+  uint n = bt_random() % MAX_NUM;
+  while (bmap_test(&b, n))
+    n = (n + 1) % MAX_NUM;
+
+  bmap_set(&a, n);
+  bt_assert(!bmap_is_subset(&a, &b));
+  bt_assert(bmap_is_subset(&b, &b));
+
+  return 1;
+}
+
 static int
 t_hmap_set_clear_random(void)
 {
@@ -179,6 +218,7 @@ main(int argc, char *argv[])
   bt_init(argc, argv);
 
   bt_test_suite(t_bmap_set_clear_random, "BMap - random sequence of sets / clears");
+  bt_test_suite(t_bmap_subset, "BMap - subset test");
   bt_test_suite(t_hmap_set_clear_random, "HMap - random sequence of sets / clears");
   bt_test_suite(t_hmap_set_clear_fill, "HMap - linear sets and random clears");
 
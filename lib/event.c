@@ -17,12 +17,18 @@
  *
  * You can also define your own event lists (the &event_list structure), enqueue your
  * events in them and explicitly ask to run them.
+ *
+ * Event lists are not thread-safe. Threads other than the main one signal it
+ * by sending events to an &ev_queue (see ev_send()), a lock-free queue with
+ * many producers and a single consumer. The consumer loop is woken up by the
+ * first event sent to an empty queue and runs all pending events at once.
  */
 
 #include "nest/bird.h"
 #include "lib/event.h"
 
 event_list global_event_list;
+event_list global_work_list;
 
 inline void
 ev_postpone(event *e)
@@ -114,7 +120,20 @@ ev_schedule(event *e)
   ev_enqueue(&global_event_list, e);
 }
 
-void io_log_event(void *hook, void *data);
+/**
+ * ev_schedule_work - schedule a bulk work event
+ * @e: an event
+ *
+ * This function schedules an event to a system-wide list of low priority
+ * events, like route feeding or table maintenance. These are run after regular
+ * events and timers, only for a limited time in each I/O loop iteration, so
+ * they do not delay socket and timer hooks.
+ */
+void
+ev_schedule_work(event *e)
+{
+  ev_enqueue(&global_work_list, e);
+}
 
 /**
  * ev_run_list - run an event list
@@ -137,9 +156,104 @@ ev_run_list(event_list *l)
 
       /* This is ugly hack, we want to log just events executed from the main I/O loop */
       if (l == &global_event_list)
-	io_log_event(e->hook, e->data);
+	io_log_event(e->hook, e->data, IO_HOOK_EVENT);
+
+      ev_run(e);
+    }
+  return !EMPTY_LIST(*l);
+}
+
+/**
+ * ev_run_list_limited - run a part of an event list
+ * @l: an event list
+ * @limit: maximum number of events to run
+ *
+ * This function calls ev_run() for at most @limit events from the head of the
+ * list @l. Events enqueued by them are appended to the list. The function
+ * returns 1 if some events remain in the list.
+ */
+int
+ev_run_list_limited(event_list *l, uint limit)
+{
+  node *n;
+
+  for (; limit && !EMPTY_LIST(*l); limit--)
+    {
+      n = HEAD(*l);
+      event *e = SKIP_BACK(event, n, n);
+
+      /* This is ugly hack, we want to log just events executed from the main I/O loop */
+      if (l == &global_work_list)
+	io_log_event(e->hook, e->data, IO_HOOK_EVENT);
 
       ev_run(e);
     }
+
   return !EMPTY_LIST(*l);
 }
+
+/**
+ * ev_send - send an event to another thread
+ * @q: an event queue
+ * @e: an event
+ *
+ * This function atomically pushes the event @e to the queue @q, which may be
+ * done from any thread. The queue is run in the thread owning it, which is
+ * woken up when the queue was empty. If the event is already pending in some
+ * queue, it is not added again, so its hook is called once for any number
+ * of ev_send() calls before it is run. The event must not be freed while
+ * pending.
+ */
+void
+ev_send(ev_queue *q, event *e)
+{
+  if (__atomic_exchange_n(&e->xqueued, 1, __ATOMIC_ACQ_REL))
+    return;
+
+  event *head = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+  do
+    e->xnext = head;
+  while (!__atomic_compare_exchange_n(&q->head, &head, e, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+  /* Only the first event wakes up the consumer, the rest is run in the same batch */
+  if (!head)
+    ev_queue_kick(q);
+}
+
+/**
+ * ev_queue_run - run events sent to a queue
+ * @q: an event queue
+ *
+ * This function takes all events sent to the queue @q so far and runs them in
+ * the order they were sent. It is called by the thread owning the queue, the
+ * sysdep code does that when the queue wakeup fd becomes readable. Events sent
+ * again from their hooks are run in the next batch. The function returns the
+ * number of events run.
+ */
+uint
+ev_queue_run(ev_queue *q)
+{
+  event *e = __atomic_exchange_n(&q->head, NULL, __ATOMIC_ACQUIRE);
+  event *list = NULL;
+  uint n = 0;
+
+  /* Reverse the stack to get FIFO order */
+  while (e)
+  {
+    event *next = e->xnext;
+    e->xnext = list;
+    list = e;
+    e = next;
+  }
+
+  while (e = list)
+  {
+    list = e->xnext;
+    e->xnext = NULL;
+    __atomic_store_n(&e->xqueued, 0, __ATOMIC_RELEASE);
+    e->hook(e->data);
+    n++;
+  }
+
+  return n;
+}
@@ -16,19 +16,33 @@ typedef struct event {
   void (*hook)(void *);
   void *data;
   node n;				/* Internal link */
+  struct event *xnext;			/* Internal link in ev_queue */
+  u32 xqueued;				/* Pending in some ev_queue, accessed atomically */
 } event;
 
 typedef list event_list;
 
+/* Queue of events sent from other threads, see ev_send() */
+typedef struct ev_queue {
+  event *head;				/* Sent events, newest first, accessed atomically */
+  int wfd;				/* Wakeup fd of the consumer (eventfd or pipe) */
+  struct birdsock *rsk, *wsk;		/* Sysdep wakeup sockets */
+} ev_queue;
+
 extern event_list global_event_list;
+extern event_list global_work_list;
 
 event *ev_new(pool *);
 void ev_run(event *);
 #define ev_init_list(el) init_list(el)
 void ev_enqueue(event_list *, event *);
 void ev_schedule(event *);
+void ev_schedule_work(event *);
 void ev_postpone(event *);
 int ev_run_list(event_list *);
+int ev_run_list_limited(event_list *, uint);
+void ev_send(ev_queue *, event *);
+uint ev_queue_run(ev_queue *);
 
 static inline int
 ev_active(event *e)
@@ -45,5 +59,29 @@ ev_new_init(pool *p, void (*hook)(void *), void *data)
   return e;
 }
 
+/* Kinds of hooks run from the main I/O loop, for latency statistics */
+enum io_hook_kind {
+  IO_HOOK_EVENT,
+  IO_HOOK_TABLE,			/* Routing table maintenance event */
+  IO_HOOK_TIMER,
+  IO_HOOK_RX,				/* Socket rx hook */
+  IO_HOOK_TX,				/* Socket tx hook */
+  IO_HOOK_ASYNC,			/* Signal handling */
+  IO_HOOK_TIMER_DELAY,			/* Delay of timers after their expiration */
+  IO_HOOK_LOOP,				/* Loop cycle without poll() */
+  IO_HOOK_MAX
+};
+
+struct histogram;
+
+extern const char * const io_hook_kind_names[IO_HOOK_MAX];
+
+/* Implemented in sysdep code */
+void io_log_event(void *hook, void *data, uint kind);
+void io_log_delay(uint kind, btime delay);
+const struct histogram *io_latency_histogram(uint kind);
+int ev_work_yield(void);
+ev_queue *ev_queue_new(pool *);
+void ev_queue_kick(ev_queue *);
 
 #endif
@@ -7,6 +7,8 @@
  */
 
 
+#include <pthread.h>
+
 #include "test/birdtest.h"
 
 #include "lib/net.h"
@@ -77,12 +79,127 @@ t_ev_run_list(void)
   return 1;
 }
 
+static int
+t_ev_run_list_limited(void)
+{
+  event_list list;
+
+  resource_init();
+  ev_init_list(&list);
+  init_event_check_points();
+
+  for (int i = 1; i < MAX_NUM; i++)
+  {
+    struct event *e = ev_new(&root_pool);
+    e->hook = (i == 1) ? event_hook_1 : (i == 2) ? event_hook_2 : event_hook_3;
+    ev_enqueue(&list, e);
+  }
+
+  bt_assert(ev_run_list_limited(&list, 2));
+  bt_assert(event_check_points[1] && event_check_points[2] && !event_check_points[3]);
+
+  bt_assert(!ev_run_list_limited(&list, 2));
+  bt_assert(event_check_points[3]);
+
+  return 1;
+}
+
+#define SEND_THREADS 4
+#define SEND_EVENTS 64
+#define SEND_ROUNDS 1000
+
+struct send_arg {
+  ev_queue *q;
+  event *events;
+  int sent;
+};
+
+static void
+send_hook(void *data)
+{
+  (*(int *) data)++;
+}
+
+static void *
+send_thread(void *data)
+{
+  struct send_arg *a = data;
+
+  for (int i = 0; i < SEND_ROUNDS; i++)
+    ev_send(a->q, &a->events[i % SEND_EVENTS]);
+
+  __atomic_store_n(&a->sent, 1, __ATOMIC_RELEASE);
+  return NULL;
+}
+
+static int
+t_ev_send(void)
+{
+  struct send_arg args[SEND_THREADS];
+  pthread_t threads[SEND_THREADS];
+  static event events[SEND_THREADS][SEND_EVENTS];
+  static int counts[SEND_THREADS][SEND_EVENTS];
+
+  resource_init();
+  timer_init();
+  io_init();
+  ev_queue *q = ev_queue_new(&root_pool);
+
+  for (int i = 0; i < SEND_THREADS; i++)
+  {
+    for (int j = 0; j < SEND_EVENTS; j++)
+      events[i][j] = (event) { .hook = send_hook, .data = &counts[i][j] };
+
+    args[i] = (struct send_arg) { .q = q, .events = events[i] };
+    bt_assert(!pthread_create(&threads[i], NULL, send_thread, &args[i]));
+  }
+
+  /* Run the queue concurrently with senders */
+  int done;
+  do
+  {
+    done = 1;
+    for (int i = 0; i < SEND_THREADS; i++)
+      done &= __atomic_load_n(&args[i].sent, __ATOMIC_ACQUIRE);
+
+    ev_queue_run(q);
+  }
+  while (!done);
+
+  for (int i = 0; i < SEND_THREADS; i++)
+    pthread_join(threads[i], NULL);
+
+  ev_queue_run(q);
+  bt_assert(!ev_queue_run(q));
+
+  /* Every event was run at least once after its last send, and not more often than sent */
+  for (int i = 0; i < SEND_THREADS; i++)
+    for (int j = 0; j < SEND_EVENTS; j++)
+    {
+      bt_assert(counts[i][j] >= 1);
+      bt_assert(counts[i][j] <= SEND_ROUNDS / SEND_EVENTS + 1);
+      bt_assert(!events[i][j].xqueued);
+    }
+
+  /* An event sent twice before run is run once */
+  int cnt = 0;
+  event e = { .hook = send_hook, .data = &cnt };
+  ev_send(q, &e);
+  ev_send(q, &e);
+  bt_assert(ev_queue_run(q) == 1);
+  bt_assert(cnt == 1);
+
+  return 1;
+}
+
 int
 main(int argc, char *argv[])
 {
   bt_init(argc, argv);
 
   bt_test_suite(t_ev_run_list, "Schedule and run 3 events in right order.");
+  bt_test_suite(t_ev_run_list_limited, "Run events in right order with limit.");
+  bt_test_suite(t_ev_send, "Send events to a queue from many threads.");
 
   return bt_exit_value();
 }
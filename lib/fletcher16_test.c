@@ -168,6 +168,48 @@ t_fletcher16_checksum(void)
   return bt_assert_batch(test_vectors, test_fletcher16_checksum, bt_fmt_str, bt_fmt_unsigned);
 }
 
+#define RANDOM_DATA_LEN 20000
+
+static int
+t_fletcher16_random(void)
+{
+  static u8 data[RANDOM_DATA_LEN], swapped[RANDOM_DATA_LEN];
+  struct fletcher16_context ctx, ctx_n32;
+  int c0 = 0, c1 = 0;
+
+  for (int i = 0; i < RANDOM_DATA_LEN; i++)
+  {
+    data[i] = bt_random();
+    c0 = (c0 + data[i]) % 255;
+    c1 = (c1 + c0) % 255;
+  }
+
+  for (int i = 0; i < RANDOM_DATA_LEN; i++)
+    swapped[i] = data[i ^ 3];
+
+  for (int k = 0; k < 10; k++)
+  {
+    fletcher16_init(&ctx);
+    fletcher16_init(&ctx_n32);
+
+    /* Process data in blocks of random length */
+    for (int pos = 0, len; pos < RANDOM_DATA_LEN; pos += len)
+    {
+      len = (bt_random() % 7000) & ~3;
+      len = MIN(MAX(len, 4), RANDOM_DATA_LEN - pos);
+
+      fletcher16_update(&ctx, data + pos, len - k % 4);
+      fletcher16_update(&ctx, data + pos + len - k % 4, k % 4);
+      fletcher16_update_n32(&ctx_n32, swapped + pos, len);
+    }
+
+    bt_assert(fletcher16_compute(&ctx) == ((c0 << 8) | c1));
+    bt_assert(fletcher16_compute(&ctx_n32) == ((c0 << 8) | c1));
+  }
+
+  return 1;
+}
+
 int
 main(int argc, char *argv[])
 {
@@ -175,6 +217,7 @@ main(int argc, char *argv[])
 
   bt_test_suite(t_fletcher16_compute, "Fletcher-16 Compute Tests");
   bt_test_suite(t_fletcher16_checksum, "Fletcher-16 Checksum Tests");
+  bt_test_suite(t_fletcher16_random, "Fletcher-16 Random Data Tests");
 
   return bt_exit_value();
 }
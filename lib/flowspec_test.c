@@ -607,6 +607,29 @@ t_builder6(void)
   return 1;
 }
 
+static int
+t_hash4(void)
+{
+  byte nlri1[] = { 0, FLOW_TYPE_DST_PREFIX, 32, 10, 1, 2, 3, FLOW_TYPE_DST_PORT, 0x81, 53 };
+  byte nlri2[] = { 0, FLOW_TYPE_DST_PREFIX, 32, 10, 1, 2, 3, FLOW_TYPE_DST_PORT, 0x81, 123 };
+  *nlri1 = (u8) sizeof(nlri1);
+  *nlri2 = (u8) sizeof(nlri2);
+
+  net_addr_flow4 *f1, *f2, *f3;
+  NET_ADDR_FLOW4_(f1, ip4_build(10, 1, 2, 3), 32, nlri1);
+  NET_ADDR_FLOW4_(f2, ip4_build(10, 1, 2, 3), 32, nlri2);
+  NET_ADDR_FLOW4_(f3, ip4_build(10, 1, 2, 3), 32, nlri1);
+
+  /* Rules for the same destination differ in hash */
+  bt_assert(!net_equal((net_addr *) f1, (net_addr *) f2));
+  bt_assert(net_hash((net_addr *) f1) != net_hash((net_addr *) f2));
+
+  bt_assert(net_equal((net_addr *) f1, (net_addr *) f3));
+  bt_assert(net_hash((net_addr *) f1) == net_hash((net_addr *) f3));
+
+  return 1;
+}
+
 static int
 t_formatting4(void)
 {
@@ -682,6 +705,7 @@ main(int argc, char *argv[])
   bt_test_suite(t_validation6,  "Testing validation (IPv6)");
   bt_test_suite(t_builder4,     "Inserting components into existing Flow Specification (IPv4)");
   bt_test_suite(t_builder6,     "Inserting components into existing Flow Specification (IPv6)");
+  bt_test_suite(t_hash4,        "Hashing Flow Specification components (IPv4)");
   bt_test_suite(t_formatting4,  "Formatting Flow Specification (IPv4) into text representation");
   bt_test_suite(t_formatting6,  "Formatting Flow Specification (IPv6) into text representation");
 
@@ -10,31 +10,51 @@
 #ifndef _BIRD_HASH_H_
 #define _BIRD_HASH_H_
 
-#define HASH(type)		struct { type **data; uint count, order; }
+#define HASH(type)		struct { type **data, **old; uint count, order, old_order, moved; }
 #define HASH_TYPE(v)		typeof(** (v).data)
 #define HASH_SIZE(v)		(1U << (v).order)
+#define HASH_OLD_SIZE(v)	((v).old ? (1U << (v).old_order) : 0)
 
 #define HASH_EQ(v,id,k1,k2...)	(id##_EQ(k1, k2))
 #define HASH_FN(v,id,key...)	((u32) (id##_FN(key)) >> (32 - (v).order))
 
+/*
+ * Resizing is incremental. HASH_REHASH() just allocates the new table and
+ * keeps the old one, whose chains are moved to the new table by a few at a
+ * time during following HASH_INSERT2() calls, in order of their index. As the
+ * chain index is taken from the top bits of the hash value, old chains below
+ * @moved contain exactly the keys already belonging to the new table, so every
+ * key is still kept in just one chain and lookups check just one table.
+ */
+
+#define HASH_CHAIN(v,id,key...)						\
+  ({									\
+    u32 _f = (u32) (id##_FN(key));					\
+    u32 _o = (v).old ? (_f >> (32 - (v).old_order)) : 0;		\
+    ((v).old && (_o >= (v).moved)) ?					\
+      (v).old + _o : (v).data + (_f >> (32 - (v).order));		\
+  })
 
 #define HASH_INIT(v,pool,init_order)					\
   ({									\
     (v).count = 0;							\
     (v).order = (init_order);						\
     (v).data = mb_allocz(pool, HASH_SIZE(v) * sizeof(* (v).data));	\
+    (v).old = NULL;							\
+    (v).old_order = (v).moved = 0;					\
   })
 
 #define HASH_FREE(v)							\
   ({									\
     mb_free((v).data);							\
+    if ((v).old)							\
+      mb_free((v).old);							\
     (v) = (typeof(v)){ };						\
   })
 
 #define HASH_FIND(v,id,key...)						\
   ({									\
-    u32 _h = HASH_FN(v, id, key);					\
-    HASH_TYPE(v) *_n = (v).data[_h];					\
+    HASH_TYPE(v) *_n = *HASH_CHAIN(v, id, key);				\
     while (_n && !HASH_EQ(v, id, id##_KEY(_n), key))			\
       _n = id##_NEXT(_n);						\
     _n;									\
@@ -42,8 +62,7 @@
 
 #define HASH_INSERT(v,id,node)						\
   ({									\
-    u32 _h = HASH_FN(v, id, id##_KEY((node)));				\
-    HASH_TYPE(v) **_nn = (v).data + _h;					\
+    HASH_TYPE(v) **_nn = HASH_CHAIN(v, id, id##_KEY((node)));		\
     id##_NEXT(node) = *_nn;						\
     *_nn = node;							\
     (v).count++;							\
@@ -57,8 +76,7 @@
 
 #define HASH_DELETE(v,id,key...)					\
   ({									\
-    u32 _h = HASH_FN(v, id, key);					\
-    HASH_TYPE(v) *_n, **_nn = (v).data + _h;				\
+    HASH_TYPE(v) *_n, **_nn = HASH_CHAIN(v, id, key);			\
 									\
     while ((*_nn) && !HASH_EQ(v, id, id##_KEY((*_nn)), key))		\
       _nn = &(id##_NEXT((*_nn)));					\
@@ -70,8 +88,7 @@
 
 #define HASH_REMOVE(v,id,node)						\
   ({									\
-    u32 _h = HASH_FN(v, id, id##_KEY((node)));				\
-    HASH_TYPE(v) *_n, **_nn = (v).data + _h;				\
+    HASH_TYPE(v) *_n, **_nn = HASH_CHAIN(v, id, id##_KEY((node)));	\
 									\
     while ((*_nn) && (*_nn != (node)))					\
       _nn = &(id##_NEXT((*_nn)));					\
@@ -82,22 +99,48 @@
   })
 
 
-#define HASH_REHASH(v,id,pool,step)					\
+/* Number of old chains moved in one step of incremental rehash */
+#define HASH_REHASH_CHUNK	16
+
+#define HASH_REHASH_MOVE(v,id,limit)					\
   ({									\
-    HASH_TYPE(v) *_n, *_n2, **_od;					\
-    uint _i, _os;							\
+    HASH_TYPE(v) *_n, *_n2, **_nn;					\
+    uint _os = HASH_OLD_SIZE(v), _lim = (limit);			\
 									\
-    _os = HASH_SIZE(v);							\
-    _od = (v).data;							\
-    (v).count = 0;							\
-    (v).order += (step);						\
-    (v).data = mb_allocz(pool, HASH_SIZE(v) * sizeof(* (v).data));	\
+    for (; ((v).moved < _os) && _lim; (v).moved++, _lim--)		\
+    {									\
+      for (_n = (v).old[(v).moved]; _n && (_n2 = id##_NEXT(_n), 1); _n = _n2) \
+      {									\
+	_nn = (v).data + HASH_FN(v, id, id##_KEY(_n));			\
+	id##_NEXT(_n) = *_nn;						\
+	*_nn = _n;							\
+      }									\
+      (v).old[(v).moved] = NULL;					\
+    }									\
 									\
-    for (_i = 0; _i < _os; _i++)					\
-      for (_n = _od[_i]; _n && (_n2 = id##_NEXT(_n), 1); _n = _n2)	\
-	HASH_INSERT(v, id, _n);						\
+    if ((v).moved == _os)						\
+    {									\
+      mb_free((v).old);							\
+      (v).old = NULL;							\
+    }									\
+  })
+
+/* Start resizing by @step, or move next chunk of old chains if @step is 0 */
+#define HASH_REHASH(v,id,pool,step)					\
+  ({									\
+    if (step)								\
+    {									\
+      if ((v).old)							\
+	HASH_REHASH_MOVE(v, id, ~0U);					\
 									\
-    mb_free(_od);							\
+      (v).old = (v).data;						\
+      (v).old_order = (v).order;					\
+      (v).moved = 0;							\
+      (v).order += (step);						\
+      (v).data = mb_allocz(pool, HASH_SIZE(v) * sizeof(* (v).data));	\
+    }									\
+    else if ((v).old)							\
+      HASH_REHASH_MOVE(v, id, HASH_REHASH_CHUNK);			\
   })
 
 #define REHASH_LO_MARK(a,b,c,d,e,f)	a
@@ -118,14 +161,19 @@
 
 #define HASH_MAY_STEP_UP_(v,pool,rehash_fn,args)			\
   ({                                                                    \
+    if ((v).old)							\
+      rehash_fn(&(v), pool, 0);						\
+									\
     if (((v).count > (HASH_SIZE(v) REHASH_HI_MARK(args))) &&		\
 	((v).order < (REHASH_HI_BOUND(args))))				\
       rehash_fn(&(v), pool, REHASH_HI_STEP(args));			\
   })
 
+/* Chains are not moved here, so removing nodes during HASH_WALK_DELSAFE() is safe */
 #define HASH_MAY_STEP_DOWN_(v,pool,rehash_fn,args)			\
   ({                                                                    \
-    if (((v).count < (HASH_SIZE(v) REHASH_LO_MARK(args))) &&		\
+    if (!(v).old &&							\
+	((v).count < (HASH_SIZE(v) REHASH_LO_MARK(args))) &&		\
 	((v).order > (REHASH_LO_BOUND(args))))				\
       rehash_fn(&(v), pool, -(REHASH_LO_STEP(args)));			\
   })
@@ -138,6 +186,8 @@
       _o -= (REHASH_LO_STEP(args));					\
     if (_o < (v).order)							\
       rehash_fn(&(v), pool, _o - (v).order);				\
+    while ((v).old)							\
+      rehash_fn(&(v), pool, 0);						\
   })
 
 
@@ -162,13 +212,19 @@
   })
 
 
+/* Walks go through both tables, as captured at the beginning of the walk */
+
+#define HASH_WALK_TABLES(v)						\
+    HASH_TYPE(v) **_d[2] = { (v).data, (v).old };			\
+    uint _s[2] = { HASH_SIZE(v), HASH_OLD_SIZE(v) };			\
+    for (uint _t = 0; _t < 2; _t++)					\
+      for (uint _i = 0; _i < _s[_t]; _i++)
+
 #define HASH_WALK(v,next,n)						\
   do {									\
     HASH_TYPE(v) *n;							\
-    uint _i;								\
-    uint _s = HASH_SIZE(v);						\
-    for (_i = 0; _i < _s; _i++)						\
-      for (n = (v).data[_i]; n; n = n->next)
+    HASH_WALK_TABLES(v)							\
+      for (n = _d[_t][_i]; n; n = n->next)
 
 #define HASH_WALK_END } while (0)
 
@@ -176,10 +232,8 @@
 #define HASH_WALK_DELSAFE(v,next,n)					\
   do {									\
     HASH_TYPE(v) *n, *_next;						\
-    uint _i;								\
-    uint _s = HASH_SIZE(v);						\
-    for (_i = 0; _i < _s; _i++)						\
-      for (n = (v).data[_i]; n && (_next = n->next, 1); n = _next)
+    HASH_WALK_TABLES(v)							\
+      for (n = _d[_t][_i]; n && (_next = n->next, 1); n = _next)
 
 #define HASH_WALK_DELSAFE_END } while (0)
 
@@ -187,14 +241,36 @@
 #define HASH_WALK_FILTER(v,next,n,nn)					\
   do {									\
     HASH_TYPE(v) *n, **nn;						\
-    uint _i;								\
-    uint _s = HASH_SIZE(v);						\
-    for (_i = 0; _i < _s; _i++)						\
-      for (nn = (v).data + _i; n = *nn; (*nn == n) ? (nn = &n->next) : NULL)
+    HASH_WALK_TABLES(v)							\
+      for (nn = _d[_t] + _i; n = *nn; (*nn == n) ? (nn = &n->next) : NULL)
 
 #define HASH_WALK_FILTER_END } while (0)
 
 
+struct hash_stats {
+  uint count;				/* Number of entries */
+  uint size;				/* Number of chains in both tables */
+  uint used;				/* Number of non-empty chains */
+  uint max_chain;			/* Length of the longest chain */
+};
+
+#define HASH_STATS(v,next,st)						\
+  ({									\
+    (st) = (struct hash_stats) {					\
+      .count = (v).count,						\
+      .size = HASH_SIZE(v) + HASH_OLD_SIZE(v),				\
+    };									\
+    HASH_WALK_TABLES(v)							\
+    {									\
+      uint _len = 0;							\
+      for (HASH_TYPE(v) *_n = _d[_t][_i]; _n; _n = _n->next)		\
+	_len++;								\
+      (st).used += !!_len;						\
+      (st).max_chain = MAX((st).max_chain, _len);			\
+    }									\
+  })
+
+
 static inline void
 mem_hash_init(u64 *h)
 {
@@ -171,6 +171,45 @@ t_insert2_find(void)
   return 1;
 }
 
+static int
+t_incremental_rehash(void)
+{
+  init_hash_(1);
+
+  uint i;
+  struct test_node *node;
+  for (i = 0; i < MAX_NUM; i++)
+  {
+    node = &nodes[i];
+    HASH_INSERT2(hash, TEST, my_pool, node);
+
+    /* Every node inserted so far must be found, even in the middle of rehash */
+    bt_assert(HASH_FIND(hash, TEST, nodes[i / 2].key) == &nodes[i / 2]);
+    bt_assert(HASH_FIND(hash, TEST, nodes[i].key) == &nodes[i]);
+  }
+
+  /* Walk goes through both tables */
+  uint walked = 0;
+  HASH_WALK(hash, next, n)
+    walked++;
+  HASH_WALK_END;
+  bt_assert(walked == MAX_NUM);
+
+  struct hash_stats st;
+  HASH_STATS(hash, next, st);
+  bt_assert(st.count == MAX_NUM);
+  bt_assert(st.used > 0 && st.used <= st.size);
+
+  for (i = 0; i < MAX_NUM; i++)
+    bt_assert(HASH_REMOVE2(hash, TEST, my_pool, &nodes[i]) == &nodes[i]);
+
+  HASH_MAY_RESIZE_DOWN(hash, TEST, my_pool);
+  bt_assert(!hash.old);
+  validate_empty_hash();
+
+  return 1;
+}
+
 static int
 t_walk(void)
 {
@@ -294,6 +333,7 @@ main(int argc, char *argv[])
   bt_test_suite(t_insert_find, 		"HASH_INSERT and HASH_FIND");
   bt_test_suite(t_insert_find_random, 	"HASH_INSERT pseudo-random keys and HASH_FIND");
   bt_test_suite(t_insert2_find, 	"HASH_INSERT2 and HASH_FIND. HASH_INSERT2 is HASH_INSERT and a smart auto-resize function");
+  bt_test_suite(t_incremental_rehash,	"HASH_INSERT2 and HASH_FIND during incremental rehash");
   bt_test_suite(t_walk, 		"HASH_WALK");
   bt_test_suite(t_walk_delsafe_delete, 	"HASH_WALK_DELSAFE and HASH_DELETE");
   bt_test_suite(t_walk_delsafe_delete2,	"HASH_WALK_DELSAFE and HASH_DELETE2. HASH_DELETE2 is HASH_DELETE and smart auto-resize function");
@@ -0,0 +1,86 @@
+/*
+ *	BIRD Library -- Latency Histograms
+ *
+ *	Can be freely distributed and used under the terms of the GNU GPL.
+ */
+
+#include "nest/bird.h"
+#include "lib/histogram.h"
+
+/**
+ * histogram_bucket_min - lowest value of a histogram bucket
+ * @i: bucket index
+ */
+u64
+histogram_bucket_min(uint i)
+{
+  if (i < HISTOGRAM_SUB)
+    return i;
+
+  uint e = i / HISTOGRAM_SUB + HISTOGRAM_SUB_BITS - 1;
+  u64 sub = i % HISTOGRAM_SUB;
+  return (HISTOGRAM_SUB + sub) << (e - HISTOGRAM_SUB_BITS);
+}
+
+/**
+ * histogram_bucket_max - highest value of a histogram bucket
+ * @i: bucket index
+ */
+u64
+histogram_bucket_max(uint i)
+{
+  return (i + 1 < HISTOGRAM_BUCKETS) ? histogram_bucket_min(i + 1) - 1 : ~(u64) 0;
+}
+
+/**
+ * histogram_quantile - estimate a quantile of values
+ * @h: histogram
+ * @permille: requested quantile in permille, e.g. 990 for p99
+ *
+ * Returns the upper bound of the bucket containing the quantile, clamped to
+ * the range of recorded values, or 0 for an empty histogram.
+ */
+u64
+histogram_quantile(const struct histogram *h, uint permille)
+{
+  if (!h->count)
+    return 0;
+
+  /* Rank of the requested value, counted from 1 */
+  u64 rank = (h->count * MIN(permille, 1000) + 999) / 1000;
+  rank = MAX(rank, 1);
+
+  u64 seen = 0;
+  for (uint i = 0; i < HISTOGRAM_BUCKETS; i++)
+  {
+    seen += h->bucket[i];
+    if (seen >= rank)
+      return MAX(MIN(histogram_bucket_max(i), h->max), h->min);
+  }
+
+  return h->max;
+}
+
+/**
+ * histogram_merge - add values of one histogram to another
+ * @to: destination histogram
+ * @from: source histogram
+ */
+void
+histogram_merge(struct histogram *to, const struct histogram *from)
+{
+  if (!from->count)
+    return;
+
+  if (!to->count || (from->min < to->min))
+    to->min = from->min;
+
+  if (from->max > to->max)
+    to->max = from->max;
+
+  to->count += from->count;
+  to->sum += from->sum;
+
+  for (uint i = 0; i < HISTOGRAM_BUCKETS; i++)
+    to->bucket[i] += from->bucket[i];
+}
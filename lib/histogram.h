@@ -0,0 +1,56 @@
+/*
+ *	BIRD Library -- Latency Histograms
+ *
+ *	Can be freely distributed and used under the terms of the GNU GPL.
+ */
+
+#ifndef _BIRD_HISTOGRAM_H_
+#define _BIRD_HISTOGRAM_H_
+
+/*
+ * Values are sorted to buckets by their binary exponent and two following
+ * bits, so the relative error of quantiles is at most 25 %. Values 0-7 have
+ * exact buckets.
+ */
+#define HISTOGRAM_SUB_BITS	2
+#define HISTOGRAM_SUB		(1 << HISTOGRAM_SUB_BITS)
+#define HISTOGRAM_BUCKETS	((64 - HISTOGRAM_SUB_BITS + 1) * HISTOGRAM_SUB)
+
+struct histogram {
+  u64 count;				/* Number of values */
+  u64 sum;				/* Sum of values */
+  u64 min, max;				/* Extreme values, valid if count > 0 */
+  u64 bucket[HISTOGRAM_BUCKETS];
+};
+
+static inline uint
+histogram_index(u64 v)
+{
+  if (v < HISTOGRAM_SUB)
+    return v;
+
+  uint e = 63 - __builtin_clzll(v);
+  uint sub = (v >> (e - HISTOGRAM_SUB_BITS)) & (HISTOGRAM_SUB - 1);
+  return (e - HISTOGRAM_SUB_BITS + 1) * HISTOGRAM_SUB + sub;
+}
+
+static inline void
+histogram_add(struct histogram *h, u64 v)
+{
+  if (!h->count || (v < h->min))
+    h->min = v;
+
+  if (v > h->max)
+    h->max = v;
+
+  h->count++;
+  h->sum += v;
+  h->bucket[histogram_index(v)]++;
+}
+
+u64 histogram_bucket_min(uint i);
+u64 histogram_bucket_max(uint i);
+u64 histogram_quantile(const struct histogram *h, uint permille);
+void histogram_merge(struct histogram *to, const struct histogram *from);
+
+#endif
@@ -0,0 +1,92 @@
+/*
+ *	BIRD Library -- Latency Histograms Tests
+ *
+ *	Can be freely distributed and used under the terms of the GNU GPL.
+ */
+
+#include "test/birdtest.h"
+
+#include "lib/histogram.h"
+
+static int
+t_buckets(void)
+{
+  /* Every value must fall into the bucket covering it */
+  for (uint i = 0; i < 64; i++)
+    for (int d = -1; d <= 1; d++)
+    {
+      u64 v = ((u64) 1 << i) + d;
+      uint b = histogram_index(v);
+
+      bt_assert(b < HISTOGRAM_BUCKETS);
+      bt_assert_msg((histogram_bucket_min(b) <= v) && (v <= histogram_bucket_max(b)),
+		    "value %lu in bucket %u <%lu, %lu>", v, b,
+		    histogram_bucket_min(b), histogram_bucket_max(b));
+    }
+
+  /* Buckets are contiguous */
+  for (uint i = 1; i < HISTOGRAM_BUCKETS; i++)
+    bt_assert(histogram_bucket_min(i) == histogram_bucket_max(i - 1) + 1);
+
+  bt_assert(histogram_index(~(u64) 0) == HISTOGRAM_BUCKETS - 1);
+
+  return 1;
+}
+
+static int
+t_quantile(void)
+{
+  struct histogram h = {};
+
+  bt_assert(histogram_quantile(&h, 500) == 0);
+
+  for (uint i = 1; i <= 1000; i++)
+    histogram_add(&h, i);
+
+  bt_assert(h.count == 1000);
+  bt_assert(h.sum == 500500);
+  bt_assert(h.min == 1);
+  bt_assert(h.max == 1000);
+
+  /* Quantiles are precise to one bucket, i.e. 25 % */
+  u64 p50 = histogram_quantile(&h, 500);
+  u64 p99 = histogram_quantile(&h, 990);
+
+  bt_assert_msg((p50 >= 500) && (p50 < 625), "p50 = %lu", p50);
+  bt_assert_msg((p99 >= 990) && (p99 <= 1000), "p99 = %lu", p99);
+  bt_assert(histogram_quantile(&h, 0) == 1);
+  bt_assert(histogram_quantile(&h, 1000) == 1000);
+
+  return 1;
+}
+
+static int
+t_merge(void)
+{
+  struct histogram a = {}, b = {};
+
+  histogram_add(&a, 10);
+  histogram_add(&b, 5);
+  histogram_add(&b, 20);
+  histogram_merge(&a, &b);
+
+  bt_assert(a.count == 3);
+  bt_assert(a.sum == 35);
+  bt_assert(a.min == 5);
+  bt_assert(a.max == 20);
+  bt_assert(a.bucket[histogram_index(5)] == 1);
+
+  return 1;
+}
+
+int
+main(int argc, char *argv[])
+{
+  bt_init(argc, argv);
+
+  bt_test_suite(t_buckets, "Histogram buckets");
+  bt_test_suite(t_quantile, "Histogram quantiles");
+  bt_test_suite(t_merge, "Merging of histograms");
+
+  return bt_exit_value();
+}
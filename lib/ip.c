@@ -24,6 +24,15 @@
 int
 ip6_compare(ip6_addr a, ip6_addr b)
 {
+#ifdef __SSE2__
+  /* Find the first differing word at once, then compare just that one */
+  uint eq = ip6_veqmask(ip6_vload(a), ip6_vload(b));
+  if (eq == 0xffff)
+    return 0;
+
+  uint i = u32_ctz(~eq) / 4;
+  return (a.addr[i] > b.addr[i]) ? 1 : -1;
+#else
   int i;
   for (i=0; i<4; i++)
     if (a.addr[i] > b.addr[i])
@@ -31,6 +40,7 @@ ip6_compare(ip6_addr a, ip6_addr b)
     else if (a.addr[i] < b.addr[i])
       return -1;
   return 0;
+#endif
 }
 
 ip6_addr
@@ -144,6 +144,90 @@ static inline ip4_addr ip4_not(ip4_addr a)
 { return _MI4(~_I(a)); }
 
 
+/*
+ * IPv6 addresses are processed as 128-bit vectors where the target has them
+ * (SSE2 on x86-64, NEON on AArch64). Words are kept in host order, so only
+ * bitwise operations and equality tests are done on whole vectors.
+ */
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define IP6_VEC
+typedef __m128i ip6_vec;
+
+static inline ip6_vec ip6_vload(ip6_addr a)
+{ return _mm_loadu_si128((const __m128i *) a.addr); }
+
+static inline ip6_addr ip6_vstore(ip6_vec v)
+{ ip6_addr a; _mm_storeu_si128((__m128i *) a.addr, v); return a; }
+
+/* Bit mask of equal bytes */
+static inline uint ip6_veqmask(ip6_vec a, ip6_vec b)
+{ return _mm_movemask_epi8(_mm_cmpeq_epi32(a, b)); }
+
+static inline int ip6_vequal(ip6_vec a, ip6_vec b)
+{ return ip6_veqmask(a, b) == 0xffff; }
+
+static inline int ip6_vzero(ip6_vec a)
+{ return ip6_vequal(a, _mm_setzero_si128()); }
+
+#define ip6_vand(a,b) _mm_and_si128(a, b)
+#define ip6_vor(a,b)  _mm_or_si128(a, b)
+#define ip6_vxor(a,b) _mm_xor_si128(a, b)
+#define ip6_vnot(a)   _mm_xor_si128(a, _mm_set1_epi32(-1))
+
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define IP6_VEC
+typedef uint32x4_t ip6_vec;
+
+static inline ip6_vec ip6_vload(ip6_addr a)
+{ return vld1q_u32(a.addr); }
+
+static inline ip6_addr ip6_vstore(ip6_vec v)
+{ ip6_addr a; vst1q_u32(a.addr, v); return a; }
+
+static inline int ip6_vequal(ip6_vec a, ip6_vec b)
+{ return vminvq_u32(vceqq_u32(a, b)) != 0; }
+
+static inline int ip6_vzero(ip6_vec a)
+{ return vmaxvq_u32(a) == 0; }
+
+#define ip6_vand(a,b) vandq_u32(a, b)
+#define ip6_vor(a,b)  vorrq_u32(a, b)
+#define ip6_vxor(a,b) veorq_u32(a, b)
+#define ip6_vnot(a)   vmvnq_u32(a)
+#endif
+
+#ifdef IP6_VEC
+
+static inline int ip6_equal(ip6_addr a, ip6_addr b)
+{ return ip6_vequal(ip6_vload(a), ip6_vload(b)); }
+
+static inline int ip6_zero(ip6_addr a)
+{ return ip6_vzero(ip6_vload(a)); }
+
+static inline int ip6_nonzero(ip6_addr a)
+{ return !ip6_vzero(ip6_vload(a)); }
+
+static inline ip6_addr ip6_and(ip6_addr a, ip6_addr b)
+{ return ip6_vstore(ip6_vand(ip6_vload(a), ip6_vload(b))); }
+
+static inline ip6_addr ip6_or(ip6_addr a, ip6_addr b)
+{ return ip6_vstore(ip6_vor(ip6_vload(a), ip6_vload(b))); }
+
+static inline ip6_addr ip6_xor(ip6_addr a, ip6_addr b)
+{ return ip6_vstore(ip6_vxor(ip6_vload(a), ip6_vload(b))); }
+
+static inline ip6_addr ip6_not(ip6_addr a)
+{ return ip6_vstore(ip6_vnot(ip6_vload(a))); }
+
+/* Is @a in prefix @px masked by @mask? Done without storing intermediate results */
+static inline int ip6_in_mask(ip6_addr a, ip6_addr px, ip6_addr mask)
+{ return ip6_vzero(ip6_vand(ip6_vxor(ip6_vload(a), ip6_vload(px)), ip6_vload(mask))); }
+
+#else
+
 static inline int ip6_equal(ip6_addr a, ip6_addr b)
 { return _I0(a) == _I0(b) && _I1(a) == _I1(b) && _I2(a) == _I2(b) && _I3(a) == _I3(b); }
 
@@ -165,6 +249,11 @@ static inline ip6_addr ip6_xor(ip6_addr a, ip6_addr b)
 static inline ip6_addr ip6_not(ip6_addr a)
 { return _MI6(~_I0(a), ~_I1(a), ~_I2(a), ~_I3(a)); }
 
+static inline int ip6_in_mask(ip6_addr a, ip6_addr px, ip6_addr mask)
+{ return ip6_zero(ip6_and(ip6_xor(a, px), mask)); }
+
+#endif
+
 
 #define ipa_equal(x,y) ip6_equal(x,y)
 #define ipa_zero(x) ip6_zero(x)
@@ -167,6 +167,107 @@ t_ip6_ntop(void)
   return bt_assert_batch(test_vectors, test_ipa_ntop, bt_fmt_ipa, bt_fmt_str);
 }
 
+#define IP6_OPS_TESTS	10000
+
+static ip6_addr
+ip6_random(void)
+{
+  ip6_addr a = ip6_build(bt_random(), bt_random(), bt_random(), bt_random());
+
+  /* Make equal words, zero words and equal addresses likely enough */
+  for (int i = 0; i < 4; i++)
+    if (!(bt_random() % 4))
+      a.addr[i] = 0;
+
+  return a;
+}
+
+static int
+ip6_compare_ref(ip6_addr a, ip6_addr b)
+{
+  for (int i = 0; i < 4; i++)
+    if (a.addr[i] != b.addr[i])
+      return (a.addr[i] > b.addr[i]) ? 1 : -1;
+
+  return 0;
+}
+
+static int
+t_ip6_ops(void)
+{
+  for (int n = 0; n < IP6_OPS_TESTS; n++)
+  {
+    ip6_addr a = ip6_random();
+    ip6_addr b = (bt_random() % 4) ? ip6_random() : a;
+    ip6_addr r;
+
+    if (bt_random() % 2)
+      b.addr[bt_random() % 4] = a.addr[bt_random() % 4];
+
+    int eq = 1, zero = 1;
+    for (int i = 0; i < 4; i++)
+    {
+      eq = eq && (a.addr[i] == b.addr[i]);
+      zero = zero && !a.addr[i];
+    }
+
+    bt_assert(ip6_equal(a, b) == eq);
+    bt_assert(ip6_zero(a) == zero);
+    bt_assert(ip6_nonzero(a) == !zero);
+    bt_assert(ip6_compare(a, b) == ip6_compare_ref(a, b));
+    bt_assert(ip6_compare(b, a) == -ip6_compare_ref(a, b));
+
+    r = ip6_and(a, b);
+    for (int i = 0; i < 4; i++)
+      bt_assert(r.addr[i] == (a.addr[i] & b.addr[i]));
+
+    r = ip6_or(a, b);
+    for (int i = 0; i < 4; i++)
+      bt_assert(r.addr[i] == (a.addr[i] | b.addr[i]));
+
+    r = ip6_xor(a, b);
+    for (int i = 0; i < 4; i++)
+      bt_assert(r.addr[i] == (a.addr[i] ^ b.addr[i]));
+
+    r = ip6_not(a);
+    for (int i = 0; i < 4; i++)
+      bt_assert(r.addr[i] == ~a.addr[i]);
+  }
+
+  return 1;
+}
+
+static int
+t_ip6_masks(void)
+{
+  for (uint len = 0; len <= IP6_MAX_PREFIX_LENGTH; len++)
+  {
+    ip6_addr m = ip6_mkmask(len);
+
+    for (uint i = 0; i < IP6_MAX_PREFIX_LENGTH; i++)
+      bt_assert(!!(m.addr[i / 32] & (0x80000000 >> (i % 32))) == (i < len));
+
+    bt_assert(ip6_masklen(&m) == len);
+
+    for (int n = 0; n < IP6_OPS_TESTS / 100; n++)
+    {
+      ip6_addr px = ip6_and(ip6_random(), m);
+      ip6_addr a = ip6_or(px, ip6_and(ip6_random(), ip6_not(m)));
+
+      bt_assert(ip6_in_mask(a, px, m));
+
+      if (len)
+      {
+	uint bit = bt_random() % len;
+	a.addr[bit / 32] ^= 0x80000000 >> (bit % 32);
+	bt_assert(!ip6_in_mask(a, px, m));
+      }
+    }
+  }
+
+  return 1;
+}
+
 int
 main(int argc, char *argv[])
 {
@@ -176,6 +277,8 @@ main(int argc, char *argv[])
   bt_test_suite(t_ip6_pton, "Converting IPv6 string to ip6_addr struct");
   bt_test_suite(t_ip4_ntop, "Converting ip4_addr struct to IPv4 string");
   bt_test_suite(t_ip6_ntop, "Converting ip6_addr struct to IPv6 string");
+  bt_test_suite(t_ip6_ops, "Bitwise operations and comparison of ip6_addr");
+  bt_test_suite(t_ip6_masks, "IPv6 netmasks and prefix matching");
 
   return bt_exit_value();
 }
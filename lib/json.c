@@ -0,0 +1,215 @@
+/*
+ *	BIRD Library -- JSON Output
+ *
+ *	Can be freely distributed and used under the terms of the GNU GPL.
+ */
+
+/**
+ * DOC: JSON output
+ *
+ * The JSON writer produces compact JSON text for machine-readable CLI
+ * output. It writes into a single growable buffer, so a caller can build one
+ * object per output line without any intermediate representation. Strings
+ * are escaped by json_string(), other values are formatted by json_printf()
+ * using bsprintf() directives, so e.g. addresses and prefixes can be written
+ * as quoted %I or %N.
+ */
+
+#include <stdlib.h>
+
+#include "nest/bird.h"
+#include "lib/json.h"
+#include "lib/string.h"
+
+/**
+ * json_init - initialize JSON writer
+ * @w: writer
+ * @size: initial size of the buffer
+ */
+void
+json_init(struct json_writer *w, uint size)
+{
+  w->start = xmalloc(size);
+  w->end = w->start + size;
+  json_reset(w);
+}
+
+/**
+ * json_free - release buffer of JSON writer
+ * @w: writer
+ */
+void
+json_free(struct json_writer *w)
+{
+  xfree(w->start);
+  w->start = w->pos = w->end = NULL;
+}
+
+static void
+json_grow(struct json_writer *w, uint need)
+{
+  uint used = w->pos - w->start;
+  uint size = w->end - w->start;
+
+  while (used + need > size)
+    size *= 2;
+
+  w->start = xrealloc(w->start, size);
+  w->pos = w->start + used;
+  w->end = w->start + size;
+}
+
+static inline void
+json_put(struct json_writer *w, const char *data, uint len)
+{
+  if (w->pos + len > w->end)
+    json_grow(w, len);
+
+  memcpy(w->pos, data, len);
+  w->pos += len;
+}
+
+static inline void
+json_separator(struct json_writer *w)
+{
+  if (w->comma)
+    json_put(w, ",", 1);
+}
+
+/**
+ * json_key - start a value
+ * @w: writer
+ * @key: key of the value in the current object, or %NULL in arrays
+ */
+void
+json_key(struct json_writer *w, const char *key)
+{
+  json_separator(w);
+  w->comma = 0;
+
+  if (key)
+  {
+    json_string(w, key);
+    json_put(w, ":", 1);
+    w->comma = 0;
+  }
+}
+
+/**
+ * json_open - open an object or an array
+ * @w: writer
+ * @key: key in the current object, or %NULL
+ * @type: '{' or '['
+ */
+void
+json_open(struct json_writer *w, const char *key, char type)
+{
+  json_key(w, key);
+  json_put(w, &type, 1);
+  w->comma = 0;
+}
+
+/**
+ * json_close - close an object or an array
+ * @w: writer
+ * @type: '}' or ']'
+ */
+void
+json_close(struct json_writer *w, char type)
+{
+  json_put(w, &type, 1);
+  w->comma = 1;
+}
+
+/**
+ * json_printf - write a formatted value
+ * @w: writer
+ * @fmt: bsprintf() format string
+ *
+ * The output is written as is, it is up to the caller to produce valid JSON.
+ */
+void
+json_printf(struct json_writer *w, const char *fmt, ...)
+{
+  va_list args;
+
+  json_separator(w);
+
+  while (1)
+  {
+    va_start(args, fmt);
+    int n = bvsnprintf(w->pos, w->end - w->pos, fmt, args);
+    va_end(args);
+
+    if (n >= 0)
+    {
+      w->pos += n;
+      break;
+    }
+
+    json_grow(w, (w->end - w->start) + 1);
+  }
+
+  w->comma = 1;
+}
+
+/**
+ * json_string - write a string value
+ * @w: writer
+ * @str: zero-terminated string
+ */
+void
+json_string(struct json_writer *w, const char *str)
+{
+  json_separator(w);
+  json_put(w, "\"", 1);
+
+  for (const char *s = str; *s; s++)
+  {
+    byte c = *s;
+
+    if (c == '"' || c == '\\')
+    {
+      char esc[2] = { '\\', c };
+      json_put(w, esc, 2);
+    }
+    else if (c < 0x20)
+    {
+      char esc[8];
+      bsprintf(esc, "\\u%04x", c);
+      json_put(w, esc, 6);
+    }
+    else
+      json_put(w, (char *) &c, 1);
+  }
+
+  json_put(w, "\"", 1);
+  w->comma = 1;
+}
+
+/**
+ * json_hex - write binary data as a hexadecimal string
+ * @w: writer
+ * @data: data
+ * @len: length of data
+ */
+void
+json_hex(struct json_writer *w, const byte *data, uint len)
+{
+  static const char digits[] = "0123456789abcdef";
+
+  json_separator(w);
+
+  if (w->pos + 2*len + 2 > w->end)
+    json_grow(w, 2*len + 2);
+
+  *w->pos++ = '"';
+  for (uint i = 0; i < len; i++)
+  {
+    *w->pos++ = digits[data[i] >> 4];
+    *w->pos++ = digits[data[i] & 0xf];
+  }
+  *w->pos++ = '"';
+
+  w->comma = 1;
+}
@@ -0,0 +1,50 @@
+/*
+ *	BIRD Library -- JSON Output
+ *
+ *	Can be freely distributed and used under the terms of the GNU GPL.
+ */
+
+#ifndef _BIRD_JSON_H_
+#define _BIRD_JSON_H_
+
+/*
+ * Simple writer of JSON text into a growable buffer. Separators between
+ * values are inserted automatically, values inside objects are preceded by
+ * json_key(). Keys passed to json_put_*() functions may be NULL for values
+ * inside arrays.
+ */
+
+struct json_writer {
+  byte *start, *pos, *end;		/* Output buffer, allocated by xmalloc() */
+  int comma;				/* Next value needs a separator */
+};
+
+void json_init(struct json_writer *w, uint size);
+void json_free(struct json_writer *w);
+
+static inline void json_reset(struct json_writer *w)
+{ w->pos = w->start; w->comma = 0; }
+
+static inline uint json_length(struct json_writer *w)
+{ return w->pos - w->start; }
+
+void json_open(struct json_writer *w, const char *key, char type);
+void json_close(struct json_writer *w, char type);
+void json_key(struct json_writer *w, const char *key);
+void json_printf(struct json_writer *w, const char *fmt, ...);
+void json_string(struct json_writer *w, const char *str);
+void json_hex(struct json_writer *w, const byte *data, uint len);
+
+static inline void json_put_uint(struct json_writer *w, const char *key, u64 val)
+{ json_key(w, key); json_printf(w, "%lu", val); }
+
+static inline void json_put_int(struct json_writer *w, const char *key, s64 val)
+{ json_key(w, key); json_printf(w, "%ld", val); }
+
+static inline void json_put_bool(struct json_writer *w, const char *key, int val)
+{ json_key(w, key); json_printf(w, val ? "true" : "false"); }
+
+static inline void json_put_string(struct json_writer *w, const char *key, const char *str)
+{ json_key(w, key); json_string(w, str); }
+
+#endif
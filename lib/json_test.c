@@ -0,0 +1,90 @@
+/*
+ *	BIRD Library -- JSON Output Tests
+ *
+ *	Can be freely distributed and used under the terms of the GNU GPL.
+ */
+
+#include "test/birdtest.h"
+
+#include "lib/json.h"
+
+static int
+json_is(struct json_writer *w, const char *expected)
+{
+  uint len = json_length(w);
+  int ok = (len == strlen(expected)) && !memcmp(w->start, expected, len);
+
+  bt_assert_msg(ok, "got '%.*s', expected '%s'", len, w->start, expected);
+  return ok;
+}
+
+static int
+t_structure(void)
+{
+  struct json_writer w;
+  json_init(&w, 4);
+
+  json_open(&w, NULL, '{');
+  json_put_string(&w, "name", "bgp1");
+  json_put_uint(&w, "routes", 42);
+  json_put_bool(&w, "up", 1);
+  json_open(&w, "path", '[');
+  json_put_uint(&w, NULL, 65000);
+  json_open(&w, NULL, '[');
+  json_put_uint(&w, NULL, 1);
+  json_put_uint(&w, NULL, 2);
+  json_close(&w, ']');
+  json_close(&w, ']');
+  json_open(&w, "empty", '{');
+  json_close(&w, '}');
+  json_put_int(&w, "neg", -5);
+  json_close(&w, '}');
+
+  json_is(&w, "{\"name\":\"bgp1\",\"routes\":42,\"up\":true,\"path\":[65000,[1,2]],\"empty\":{},\"neg\":-5}");
+
+  json_reset(&w);
+  json_key(&w, NULL);
+  json_printf(&w, "\"%I\"", ipa_build4(10, 0, 0, 1));
+  json_is(&w, "\"10.0.0.1\"");
+
+  json_free(&w);
+  return 1;
+}
+
+static int
+t_escape(void)
+{
+  struct json_writer w;
+  json_init(&w, 64);
+
+  json_string(&w, "a\"b\\c\nd\x01");
+  json_is(&w, "\"a\\\"b\\\\c\\u000ad\\u0001\"");
+
+  json_reset(&w);
+  json_hex(&w, (const byte []) { 0x00, 0xab, 0x7f }, 3);
+  json_is(&w, "\"00ab7f\"");
+
+  /* Long values grow the buffer */
+  json_reset(&w);
+  json_open(&w, NULL, '[');
+  for (uint i = 0; i < 1000; i++)
+    json_put_uint(&w, NULL, 1000000 + i);
+  json_close(&w, ']');
+
+  bt_assert(json_length(&w) == 2 + 1000 * 7 + 999);
+  bt_assert(w.start[0] == '[' && w.pos[-1] == ']');
+
+  json_free(&w);
+  return 1;
+}
+
+int
+main(int argc, char *argv[])
+{
+  bt_init(argc, argv);
+
+  bt_test_suite(t_structure, "Nesting and separators of JSON values");
+  bt_test_suite(t_escape, "Escaping of strings and buffer growth");
+
+  return bt_exit_value();
+}
@@ -1095,6 +1095,26 @@ t_sha256_concating(void)
   return 1;
 }
 
+static int
+t_sha256_long(void)
+{
+  char hash[SHA256_HEX_SIZE];
+  byte buf[1000];
+  memset(buf, 'a', sizeof(buf));
+
+  /* One million of 'a', in chunks not aligned to blocks */
+  struct hash_context ctx;
+  sha256_init(&ctx);
+  for (uint i = 0; i < 1000; i++)
+    sha256_update(&ctx, buf, sizeof(buf));
+  bt_bytes_to_hex(hash, sha256_final(&ctx), SHA256_SIZE);
+
+  bt_assert_msg(!strcmp(hash, "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0"),
+		"Hash %s of one million of 'a'", hash);
+
+  return 1;
+}
+
 
 static int
 t_sha512_concating(void)
@@ -1154,6 +1174,7 @@ main(int argc, char *argv[])
 
   bt_test_suite(t_sha256_concating, "Testing concatenation input string to hash using sha256_update");
   bt_test_suite(t_sha512_concating, "Testing concatenation input string to hash using sha512_update");
+  bt_test_suite(t_sha256_long, "Testing SHA-256 of a long input");
 
   return bt_exit_value();
 }
@@ -16,6 +16,14 @@
  * Example: Each configuration is described by a complex system of structures,
  * linked lists and function trees which are all allocated from a single linear
  * pool, thus they can be freed at once when the configuration is no longer used.
+ *
+ * Temporary pools are flushed very often, so they avoid calling the libc
+ * allocator in steady state. Normal chunks are kept by the pool after flush
+ * and reused. A few large chunks (allocated for requests too big for normal
+ * chunks) are kept too and reused for large requests they can hold. Normal
+ * chunks of freed pools are kept in a small per-thread cache and reused by
+ * pools with the same chunk size created later. Threads should call
+ * lp_thread_flush() before they exit to free their cache.
  */
 
 #include <stdlib.h>
@@ -25,6 +33,16 @@
 #include "lib/resource.h"
 #include "lib/string.h"
 
+#if defined(USE_PTHREADS) && defined(HAVE_THREAD_LOCAL)
+#define LP_THREAD_LOCAL _Thread_local
+#else
+#define LP_THREAD_LOCAL
+#endif
+
+#define LP_LARGE_CACHE_COUNT	4		/* Large chunks kept by a pool after flush */
+#define LP_LARGE_CACHE_SIZE	(256 * 1024)	/* Larger chunks are always freed */
+#define LP_CHUNK_CACHE_COUNT	16		/* Normal chunks of freed pools kept by a thread */
+
 struct lp_chunk {
   struct lp_chunk *next;
   uint size;
@@ -39,9 +57,15 @@ struct linpool {
   byte *ptr, *end;
   struct lp_chunk *first, *current;		/* Normal (reusable) chunks */
   struct lp_chunk *first_large;			/* Large chunks */
+  struct lp_chunk *cached_large;		/* Unused large chunks kept for reuse */
   uint chunk_size, threshold, total, total_large;
+  uint count_large, cached_large_count, cached_large_total;
 };
 
+/* Normal chunks of freed pools, with mixed sizes */
+static LP_THREAD_LOCAL struct lp_chunk *lp_chunk_cache;
+static LP_THREAD_LOCAL uint lp_chunk_cache_count;
+
 static void lp_free(resource *);
 static void lp_dump(resource *);
 static resource *lp_lookup(resource *, unsigned long);
@@ -74,6 +98,91 @@ linpool
   return m;
 }
 
+static struct lp_chunk *
+lp_get_chunk(linpool *m)
+{
+  for (struct lp_chunk **cp = &lp_chunk_cache; *cp; cp = &(*cp)->next)
+    if ((*cp)->size == m->chunk_size)
+    {
+      struct lp_chunk *c = *cp;
+      *cp = c->next;
+      lp_chunk_cache_count--;
+      return c;
+    }
+
+  struct lp_chunk *c = xmalloc(sizeof(struct lp_chunk) + m->chunk_size);
+  c->size = m->chunk_size;
+  return c;
+}
+
+static void
+lp_put_chunk(struct lp_chunk *c)
+{
+  if (lp_chunk_cache_count >= LP_CHUNK_CACHE_COUNT)
+  {
+    xfree(c);
+    return;
+  }
+
+  c->next = lp_chunk_cache;
+  lp_chunk_cache = c;
+  lp_chunk_cache_count++;
+}
+
+static struct lp_chunk *
+lp_get_large(linpool *m, uint size)
+{
+  /* First fit, the cache is short */
+  for (struct lp_chunk **cp = &m->cached_large; *cp; cp = &(*cp)->next)
+    if ((*cp)->size >= size)
+    {
+      struct lp_chunk *c = *cp;
+      *cp = c->next;
+      m->cached_large_count--;
+      m->cached_large_total -= c->size;
+      return c;
+    }
+
+  struct lp_chunk *c = xmalloc(sizeof(struct lp_chunk) + size);
+  c->size = size;
+  return c;
+}
+
+static void
+lp_put_large(linpool *m, struct lp_chunk *c)
+{
+  if ((m->cached_large_count >= LP_LARGE_CACHE_COUNT) || (c->size > LP_LARGE_CACHE_SIZE))
+  {
+    xfree(c);
+    return;
+  }
+
+  c->next = m->cached_large;
+  m->cached_large = c;
+  m->cached_large_count++;
+  m->cached_large_total += c->size;
+}
+
+/**
+ * lp_thread_flush - free cached chunks of the current thread
+ *
+ * Normal chunks of freed linear pools are cached per thread for reuse. This
+ * function frees the cache, it should be called before a thread exits.
+ */
+void
+lp_thread_flush(void)
+{
+  struct lp_chunk *c;
+
+  while (c = lp_chunk_cache)
+  {
+    lp_chunk_cache = c->next;
+    xfree(c);
+  }
+
+  lp_chunk_cache_count = 0;
+}
+
 /**
  * lp_alloc - allocate memory from a &linpool
  * @m: linear memory pool
@@ -101,15 +210,16 @@ lp_alloc(linpool *m, uint size)
     }
   else
     {
+      size_t old = lp_memsize(&m->r);
       struct lp_chunk *c;
       if (size >= m->threshold)
 	{
 	  /* Too large => allocate large chunk */
-	  c = xmalloc(sizeof(struct lp_chunk) + size);
-	  m->total_large += size;
+	  c = lp_get_large(m, size);
+	  m->total_large += c->size;
+	  m->count_large++;
 	  c->next = m->first_large;
 	  m->first_large = c;
-	  c->size = size;
 	}
       else
 	{
@@ -121,10 +231,9 @@ lp_alloc(linpool *m, uint size)
 	  else
 	    {
 	      /* Need to allocate a new chunk */
-	      c = xmalloc(sizeof(struct lp_chunk) + m->chunk_size);
+	      c = lp_get_chunk(m);
 	      m->total += m->chunk_size;
 	      c->next = NULL;
-	      c->size = m->chunk_size;
 
 	      if (m->current)
 		m->current->next = c;
@@ -135,6 +244,7 @@ lp_alloc(linpool *m, uint size)
 	  m->ptr = c->data + size;
 	  m->end = c->data + m->chunk_size;
 	}
+      rmem_update(&m->r, (ssize_t) (lp_memsize(&m->r) - old));
       return c->data;
     }
 }
@@ -185,14 +295,15 @@ lp_allocz(linpool *m, uint size)
  * @m: linear memory pool
  *
  * This function frees the whole contents of the given &linpool @m,
- * but leaves the pool itself.
+ * but leaves the pool itself. Its chunks are kept for reuse.
  */
 void
 lp_flush(linpool *m)
 {
   struct lp_chunk *c;
+  size_t old = lp_memsize(&m->r);
 
-  /* Move ptr to the first chunk and free all large chunks */
+  /* Move ptr to the first chunk and release all large chunks */
   m->current = c = m->first;
   m->ptr = c ? c->data : NULL;
   m->end = c ? c->data + m->chunk_size : NULL;
@@ -200,9 +311,12 @@ lp_flush(linpool *m)
   while (c = m->first_large)
     {
       m->first_large = c->next;
-      xfree(c);
+      lp_put_large(m, c);
     }
   m->total_large = 0;
+  m->count_large = 0;
+
+  rmem_update(&m->r, (ssize_t) (lp_memsize(&m->r) - old));
 }
 
 /**
@@ -235,8 +349,9 @@ void
 lp_restore(linpool *m, lp_state *p)
 {
   struct lp_chunk *c;
+  size_t old = lp_memsize(&m->r);
 
-  /* Move ptr to the saved pos and free all newer large chunks */
+  /* Move ptr to the saved pos and release all newer large chunks */
   m->current = c = p->current;
   m->ptr = p->ptr;
   m->end = c ? c->data + m->chunk_size : NULL;
@@ -245,8 +360,11 @@ lp_restore(linpool *m, lp_state *p)
     {
       m->first_large = c->next;
       m->total_large -= c->size;
-      xfree(c);
+      m->count_large--;
+      lp_put_large(m, c);
     }
+
+  rmem_update(&m->r, (ssize_t) (lp_memsize(&m->r) - old));
 }
 
 static void
@@ -258,13 +376,18 @@ lp_free(resource *r)
   for(d=m->first; d; d = c)
     {
       c = d->next;
-      xfree(d);
+      lp_put_chunk(d);
     }
   for(d=m->first_large; d; d = c)
     {
       c = d->next;
       xfree(d);
     }
+  for(d=m->cached_large; d; d = c)
+    {
+      c = d->next;
+      xfree(d);
+    }
 }
 
 static void
@@ -278,30 +401,26 @@ lp_dump(resource *r)
     ;
   for(cntl=0, c=m->first_large; c; c=c->next, cntl++)
     ;
-  debug("(chunk=%d threshold=%d count=%d+%d total=%d+%d)\n",
+  debug("(chunk=%d threshold=%d count=%d+%d total=%d+%d cached=%d/%d)\n",
 	m->chunk_size,
 	m->threshold,
 	cnt,
 	cntl,
 	m->total,
-	m->total_large);
+	m->total_large,
+	m->cached_large_count,
+	m->cached_large_total);
 }
 
 static size_t
 lp_memsize(resource *r)
 {
   linpool *m = (linpool *) r;
-  struct lp_chunk *c;
-  int cnt = 0;
-
-  for(c=m->first; c; c=c->next)
-    cnt++;
-  for(c=m->first_large; c; c=c->next)
-    cnt++;
+  uint cnt = (m->chunk_size ? m->total / m->chunk_size : 0) + m->count_large + m->cached_large_count;
 
   return ALLOC_OVERHEAD + sizeof(struct linpool) +
     cnt * (ALLOC_OVERHEAD + sizeof(struct lp_chunk)) +
-    m->total + m->total_large;
+    m->total + m->total_large + m->cached_large_total;
 }
 
 
@@ -288,13 +288,11 @@ ipa_in_netX(const ip_addr a, const net_addr *n)
   case NET_ROA6:
   case NET_FLOW6:
     if (ipa_is_ip4(a)) return 0;
-    return ip6_zero(ip6_and(ip6_xor(ipa_to_ip6(a), net6_prefix(n)),
-			    ip6_mkmask(net6_pxlen(n))));
+    return ip6_in_mask(ipa_to_ip6(a), net6_prefix(n), ip6_mkmask(net6_pxlen(n)));
 
   case NET_IP6_SADR:
     if (ipa_is_ip4(a)) return 0;
-    return ip6_zero(ip6_and(ip6_xor(ipa_to_ip6(a), net6_prefix(n)),
-			    ip6_mkmask(net6_pxlen(n))));
+    return ip6_in_mask(ipa_to_ip6(a), net6_prefix(n), ip6_mkmask(net6_pxlen(n)));
 
   case NET_MPLS:
   default:
@@ -11,6 +11,7 @@
 #define _BIRD_NET_H_
 
 #include "lib/ip.h"
+#include "lib/hash.h"
 
 
 #define NET_IP4		1
@@ -500,11 +501,12 @@ static inline u32 net_hash_roa4(const net_addr_roa4 *n)
 static inline u32 net_hash_roa6(const net_addr_roa6 *n)
 { return ip6_hash(n->prefix) ^ ((u32) n->pxlen << 26); }
 
+/* Flow rules often share the destination prefix, so components are hashed too */
 static inline u32 net_hash_flow4(const net_addr_flow4 *n)
-{ return ip4_hash(n->prefix) ^ ((u32) n->pxlen << 26); }
+{ return ip4_hash(n->prefix) ^ ((u32) n->pxlen << 26) ^ mem_hash(n->data, n->length - sizeof(net_addr_flow4)); }
 
 static inline u32 net_hash_flow6(const net_addr_flow6 *n)
-{ return ip6_hash(n->prefix) ^ ((u32) n->pxlen << 26); }
+{ return ip6_hash(n->prefix) ^ ((u32) n->pxlen << 26) ^ mem_hash(n->data, n->length - sizeof(net_addr_flow6)); }
 
 static inline u32 net_hash_ip6_sadr(const net_addr_ip6_sadr *n)
 { return net_hash_ip6((net_addr_ip6 *) n); }
@@ -596,7 +598,7 @@ static inline int ipa_in_px4(ip4_addr a, ip4_addr prefix, uint pxlen)
 { return ip4_zero(ip4_and(ip4_xor(a, prefix), ip4_mkmask(pxlen))); }
 
 static inline int ipa_in_px6(ip6_addr a, ip6_addr prefix, uint pxlen)
-{ return ip6_zero(ip6_and(ip6_xor(a, prefix), ip6_mkmask(pxlen))); }
+{ return ip6_in_mask(a, prefix, ip6_mkmask(pxlen)); }
 
 static inline int ipa_in_net_ip4(ip4_addr a, const net_addr_ip4 *n)
 { return ipa_in_px4(a, n->prefix, n->pxlen); }
@@ -114,6 +114,17 @@ t_bstrcmp(void)
   return 1;
 }
 
+static void
+b_bsnprintf(uint n)
+{
+  char buf[256];
+  ip4_addr ip = ip4_from_u32(0xc0a80100);
+
+  for (uint i = 0; i < n; i++)
+    if (bsnprintf(buf, sizeof(buf), "%I4/%d via %I4 metric %u, %s", ip, 24, ip, i, "static") < 0)
+      bt_abort();
+}
+
 int
 main(int argc, char *argv[])
 {
@@ -124,5 +135,7 @@ main(int argc, char *argv[])
   bt_test_suite(t_time, "print time");
   bt_test_suite(t_bstrcmp, "bstrcmp");
 
+  bt_bench(b_bsnprintf, "Formatting of a route line");
+
   return bt_exit_value();
 }
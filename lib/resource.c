@@ -26,14 +26,39 @@
  *
  * Example: Almost all modules of BIRD have their private pool which
  * is freed upon shutdown of the module.
+ *
+ * Each pool keeps the total size and number of all resources inside it,
+ * including nested pools. Totals are updated along the chain of parent pools
+ * whenever a resource is created, freed, moved or resized, so rmemsize() of
+ * a pool is just a read. Resizing resources (slabs, linear pools, memory
+ * blocks) report their changes by rmem_update().
  */
 
 struct pool {
   resource r;
   list inside;
   const char *name;
+  size_t size;				/* Memory of the pool and everything inside */
+  uint count;				/* Number of resources inside, recursively */
 };
 
+/* Slabs with magazines may grow from several threads */
+#ifdef USE_PTHREADS
+#define RP_ADD(x, v)	__atomic_add_fetch(&(x), (v), __ATOMIC_RELAXED)
+#else
+#define RP_ADD(x, v)	((x) += (v))
+#endif
+
+static void
+rp_account(pool *p, ssize_t size, int count)
+{
+  for (; p; p = p->r.parent)
+  {
+    RP_ADD(p->size, size);
+    RP_ADD(p->count, count);
+  }
+}
+
 static void pool_dump(resource *);
 static void pool_free(resource *);
 static resource *pool_lookup(resource *, unsigned long);
@@ -65,6 +90,7 @@ rp_new(pool *p, const char *name)
 {
   pool *z = ralloc(p, &pool_class);
   z->name = name;
+  z->size = sizeof(pool) + ALLOC_OVERHEAD;
   init_list(&z->inside);
   return z;
 }
@@ -101,13 +127,42 @@ static size_t
 pool_memsize(resource *P)
 {
   pool *p = (pool *) P;
-  resource *r;
-  size_t sum = sizeof(pool) + ALLOC_OVERHEAD;
+  return p->size;
+}
 
-  WALK_LIST(r, p->inside)
-    sum += rmemsize(r);
+/**
+ * rp_count - number of resources in a pool
+ * @p: pool
+ *
+ * Returns the number of resources inside the pool @p and all its nested
+ * pools, including the nested pools themselves.
+ */
+uint
+rp_count(pool *p)
+{
+  return p->count;
+}
+
+/* Number of resources accounted to parent pools by the resource */
+static inline uint
+rcount(resource *r)
+{
+  return 1 + ((r->class == &pool_class) ? ((pool *) r)->count : 0);
+}
 
-  return sum;
+/**
+ * rmem_update - report change of resource size
+ * @r: resource
+ * @delta: change of the value returned by memsize() hook
+ *
+ * Resources with variable size call this function whenever their size
+ * changes, so totals of pools containing them stay up to date.
+ */
+void
+rmem_update(resource *r, ssize_t delta)
+{
+  if (delta)
+    rp_account(r->parent, delta, 0);
 }
 
 static resource *
@@ -136,9 +191,16 @@ void rmove(void *res, pool *p)
 
   if (r)
     {
+      size_t size = rmemsize(r);
+      uint count = rcount(r);
+
       if (r->n.next)
         rem_node(&r->n);
+      rp_account(r->parent, -size, -count);
+
       add_tail(&p->inside, &r->n);
+      r->parent = p;
+      rp_account(p, size, count);
     }
 }
 
@@ -162,6 +224,11 @@ rfree(void *res)
 
   if (r->n.next)
     rem_node(&r->n);
+
+  /* Resources freed by the free hook of a pool are accounted only to it */
+  rp_account(r->parent, -rmemsize(r), -rcount(r));
+  r->parent = NULL;
+
   r->class->free(r);
   r->class = NULL;
   xfree(r);
@@ -204,6 +271,59 @@ rmemsize(void *res)
   return r->class->memsize(r);
 }
 
+static void
+rmemstat_add(struct rmem_stat *st, const char *name, size_t size)
+{
+  uint i;
+
+  for (i = 0; i < st->num; i++)
+    if (!strcmp(st->cls[i].name, name))
+      break;
+
+  if (i == st->num)
+  {
+    if (st->num == RMEM_CLASSES)
+      i = RMEM_CLASSES - 1;		/* Should not happen, merge to the last one */
+    else
+      st->cls[st->num++] = (struct rmem_class) { .name = name };
+  }
+
+  st->cls[i].size += size;
+  st->cls[i].count++;
+}
+
+/**
+ * rmemstat - break down memory usage by resource class
+ * @res: resource
+ * @st: statistics to be updated
+ *
+ * This function adds memory used by the resource and, in case of a pool,
+ * by all resources inside it to @st, sorted by classes of the resources. Pools
+ * themselves are accounted only by their own overhead. The sum over classes
+ * equals rmemsize() of @res. Statistics are computed by walking the resource
+ * tree, so they have no cost unless requested.
+ */
+void
+rmemstat(void *res, struct rmem_stat *st)
+{
+  resource *r = res;
+  if (!r)
+    return;
+
+  if (r->class == &pool_class)
+  {
+    pool *p = (pool *) r;
+    resource *rr;
+
+    rmemstat_add(st, r->class->name, sizeof(pool) + ALLOC_OVERHEAD);
+    WALK_LIST(rr, p->inside)
+      rmemstat(rr, st);
+    return;
+  }
+
+  rmemstat_add(st, r->class->name, rmemsize(r));
+}
+
 /**
  * ralloc - create a resource
  * @p: pool to create the resource in
@@ -212,7 +332,8 @@ rmemsize(void *res)
  * This function is called by the resource classes to create a new
  * resource of the specified class and link it to the given pool.
  * Allocated memory is zeroed. Size of the resource structure is taken
- * from the @size field of the &resclass.
+ * from the @size field of the &resclass. Any memory allocated by the resource
+ * later has to be reported by rmem_update().
  */
 void *
 ralloc(pool *p, struct resclass *c)
@@ -222,7 +343,11 @@ ralloc(pool *p, struct resclass *c)
 
   r->class = c;
   if (p)
+  {
     add_tail(&p->inside, &r->n);
+    r->parent = p;
+    rp_account(p, c->size + ALLOC_OVERHEAD, 1);
+  }
   return r;
 }
 
@@ -261,6 +386,8 @@ resource_init(void)
 {
   root_pool.r.class = &pool_class;
   root_pool.name = "Root";
+  root_pool.size = sizeof(pool) + ALLOC_OVERHEAD;
+  root_pool.count = 0;
   init_list(&root_pool.inside);
 }
 
@@ -342,7 +469,9 @@ mb_alloc(pool *p, unsigned size)
   b->r.class = &mb_class;
   b->r.n = (node) {};
   add_tail(&p->inside, &b->r.n);
+  b->r.parent = p;
   b->size = size;
+  rp_account(p, mbl_memsize(&b->r), 1);
   return b->data;
 }
 
@@ -387,6 +516,8 @@ mb_realloc(void *m, unsigned size)
 {
   struct mblock *b = SKIP_BACK(struct mblock, data, m);
 
+  rmem_update(&b->r, (ssize_t) size - (ssize_t) b->size);
+
   b = xrealloc(b, sizeof(struct mblock) + size);
   update_node(&b->r.n);
   b->size = size;
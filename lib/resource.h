@@ -16,6 +16,7 @@
 typedef struct resource {
   node n;				/* Inside resource pool */
   struct resclass *class;		/* Resource class */
+  struct pool *parent;			/* Pool containing the resource, for memory accounting */
 } resource;
 
 /* Resource class */
@@ -29,6 +30,11 @@ struct resclass {
   size_t (*memsize)(resource *);	/* Return size of memory used by the resource, may be NULL */
 };
 
+/*
+ * Resources with memsize() must report every change of their size by
+ * rmem_update(), as pools keep totals of their contents incrementally.
+ */
+
 /* Estimate of system allocator overhead per item, for memory consumtion stats */
 #define ALLOC_OVERHEAD		8
 
@@ -41,6 +47,24 @@ pool *rp_new(pool *, const char *);	/* Create new pool */
 void rfree(void *);			/* Free single resource */
 void rdump(void *);			/* Dump to debug output */
 size_t rmemsize(void *res);		/* Return size of memory used by the resource */
+uint rp_count(pool *p);			/* Return number of resources inside the pool */
+void rmem_update(resource *r, ssize_t delta); /* Report change of resource size */
+
+/* Memory usage broken down by resource class, see rmemstat() */
+#define RMEM_CLASSES 16
+
+struct rmem_class {
+  const char *name;			/* Name of resource class */
+  size_t size;				/* Memory used by resources of the class */
+  uint count;				/* Number of resources */
+};
+
+struct rmem_stat {
+  struct rmem_class cls[RMEM_CLASSES];
+  uint num;
+};
+
+void rmemstat(void *res, struct rmem_stat *st);
 void rlookup(unsigned long);		/* Look up address (only for debugging) */
 void rmove(void *, pool *);		/* Move to a different pool */
 
@@ -71,6 +95,7 @@ void *lp_allocz(linpool *, unsigned size);	/* With clear */
 void lp_flush(linpool *);			/* Free everything, but leave linpool */
 void lp_save(linpool *m, lp_state *p);		/* Save state */
 void lp_restore(linpool *m, lp_state *p);	/* Restore state */
+void lp_thread_flush(void);			/* Free chunk cache of the thread */
 
 extern const int lp_chunk_size;
 #define LP_GAS		    1024
@@ -82,9 +107,20 @@ extern const int lp_chunk_size;
 typedef struct slab slab;
 
 slab *sl_new(pool *, unsigned size);
+slab *sl_new_flags(pool *, unsigned size, unsigned flags);
+void sl_thread_flush(void);
 void *sl_alloc(slab *);
 void sl_free(slab *, void *);
 
+#define SL_MAGAZINES	1		/* Per-thread magazines, for slabs shared by threads */
+
+#define SLAB_DEFAULT_WATERMARK 8	/* Empty pages kept by each slab */
+
+extern uint slab_reclaim_watermark;
+void slab_set_watermark(uint pages);
+void slab_reclaim(void);
+size_t slab_graveyard_size(void);
+
 /*
  * Low-level memory allocation functions, please don't use
  * outside resource manager and possibly sysdep code.
@@ -12,6 +12,14 @@
 #include "lib/sha256.h"
 #include "lib/unaligned.h"
 
+/* SHA extensions are used when the compiler knows them and the CPU has them */
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <cpuid.h>
+#ifdef bit_SHA
+#define SHA256_X86_SHANI
+#include <immintrin.h>
+#endif
+#endif
 
 // #define SHA256_UNROLLED
 
@@ -105,6 +113,25 @@ sum1(u32 x)
       a = t1 + t2;						\
     } while (0)
 
+static const u32 K[64] = {
+  0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+  0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+  0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+  0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+  0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+  0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+  0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+  0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+  0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+  0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+  0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+  0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+  0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+  0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+  0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+  0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
 /*
     The SHA-256 core: Transform the message X which consists of 16
     32-bit-words. See FIPS 180-2 for details.
@@ -112,25 +139,6 @@ sum1(u32 x)
 static uint
 sha256_transform(struct sha256_context *ctx, const byte *data)
 {
-  static const u32 K[64] = {
-      0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
-      0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
-      0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
-      0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
-      0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
-      0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
-      0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
-      0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
-      0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
-      0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
-      0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
-      0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
-      0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
-      0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
-      0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
-      0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
-  };
-
   u32 a,b,c,d,e,f,g,h,t1,t2;
   u32 w[64];
   int i;
@@ -215,6 +223,94 @@ sha256_transform(struct sha256_context *ctx, const byte *data)
 #undef S1
 #undef R
 
+static void
+sha256_transform_blocks(struct sha256_context *ctx, const byte *data, uint n)
+{
+  for (; n; n--, data += SHA256_BLOCK_SIZE)
+    sha256_transform(ctx, data);
+}
+
+#ifdef SHA256_X86_SHANI
+
+/*
+    The same transform using the x86 SHA extensions. State words are kept
+    in the ABEF and CDGH order required by SHA256RNDS2 during all @n blocks.
+ */
+static void __attribute__((target("sha,sse4.1")))
+sha256_transform_blocks_shani(struct sha256_context *ctx, const byte *data, uint n)
+{
+  const __m128i mask = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+  __m128i state0, state1, msg, tmp, abef, cdgh, w[4];
+
+  tmp = _mm_loadu_si128((const __m128i *) &ctx->h0);
+  state1 = _mm_loadu_si128((const __m128i *) &ctx->h4);
+  tmp = _mm_shuffle_epi32(tmp, 0xB1);			/* CDAB */
+  state1 = _mm_shuffle_epi32(state1, 0x1B);		/* EFGH */
+  state0 = _mm_alignr_epi8(tmp, state1, 8);		/* ABEF */
+  state1 = _mm_blend_epi16(state1, tmp, 0xF0);		/* CDGH */
+
+  for (; n; n--, data += SHA256_BLOCK_SIZE)
+  {
+    abef = state0;
+    cdgh = state1;
+
+    for (int i = 0; i < 4; i++)
+      w[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (data + 16 * i)), mask);
+
+    /* Four rounds per step, message schedule runs three steps ahead */
+    for (int i = 0; i < 16; i++)
+    {
+      msg = _mm_add_epi32(w[i & 3], _mm_loadu_si128((const __m128i *) &K[4 * i]));
+      state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+      state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(msg, 0x0E));
+
+      if (i < 12)
+      {
+	tmp = _mm_sha256msg1_epu32(w[i & 3], w[(i + 1) & 3]);
+	tmp = _mm_add_epi32(tmp, _mm_alignr_epi8(w[(i + 3) & 3], w[(i + 2) & 3], 4));
+	w[i & 3] = _mm_sha256msg2_epu32(tmp, w[(i + 3) & 3]);
+      }
+    }
+
+    state0 = _mm_add_epi32(state0, abef);
+    state1 = _mm_add_epi32(state1, cdgh);
+  }
+
+  tmp = _mm_shuffle_epi32(state0, 0x1B);		/* FEBA */
+  state1 = _mm_shuffle_epi32(state1, 0xB1);		/* DCHG */
+  state0 = _mm_blend_epi16(tmp, state1, 0xF0);		/* DCBA */
+  state1 = _mm_alignr_epi8(state1, tmp, 8);		/* HGFE */
+
+  _mm_storeu_si128((__m128i *) &ctx->h0, state0);
+  _mm_storeu_si128((__m128i *) &ctx->h4, state1);
+}
+
+static void sha256_transform_blocks_detect(struct sha256_context *ctx, const byte *data, uint n);
+
+static void (*sha256_blocks)(struct sha256_context *ctx, const byte *data, uint n) =
+  sha256_transform_blocks_detect;
+
+/* Choose the implementation on first use, SHA extensions need also SSE4.1 */
+static void
+sha256_transform_blocks_detect(struct sha256_context *ctx, const byte *data, uint n)
+{
+  uint eax, ebx, ecx, edx;
+  int shani = 0;
+
+  if (__get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & bit_SSE4_1) &&
+      __get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) && (ebx & bit_SHA))
+    shani = 1;
+
+  sha256_blocks = shani ? sha256_transform_blocks_shani : sha256_transform_blocks;
+  sha256_blocks(ctx, data, n);
+}
+
+#else
+
+#define sha256_blocks sha256_transform_blocks
+
+#endif
+
 /* Common function to write a chunk of data to the transform function
    of a hash algorithm.  Note that the use of the term "block" does
    not imply a fixed size block.  Note that we explicitly allow to use
@@ -236,7 +332,7 @@ sha256_update(struct hash_context *CTX, const byte *buf, uint len)
       return;
 
     /* Process data from internal buffer */
-    sha256_transform(ctx, ctx->buf);
+    sha256_blocks(ctx, ctx->buf, 1);
     ctx->nblocks++;
     ctx->count = 0;
   }
@@ -245,12 +341,13 @@ sha256_update(struct hash_context *CTX, const byte *buf, uint len)
     return;
 
   /* Process data from input buffer */
-  while (len >= SHA256_BLOCK_SIZE)
+  if (len >= SHA256_BLOCK_SIZE)
   {
-    sha256_transform(ctx, buf);
-    ctx->nblocks++;
-    buf += SHA256_BLOCK_SIZE;
-    len -= SHA256_BLOCK_SIZE;
+    uint n = len / SHA256_BLOCK_SIZE;
+    sha256_blocks(ctx, buf, n);
+    ctx->nblocks += n;
+    buf += n * SHA256_BLOCK_SIZE;
+    len -= n * SHA256_BLOCK_SIZE;
   }
 
   /* Copy remaining data to internal buffer */
@@ -309,7 +406,7 @@ sha256_final(struct hash_context *CTX)
   /* append the 64 bit count */
   put_u32(ctx->buf + 56, msb);
   put_u32(ctx->buf + 60, lsb);
-  sha256_transform(ctx, ctx->buf);
+  sha256_blocks(ctx, ctx->buf, 1);
 
   byte *p = ctx->buf;
 #define X(a) do { put_u32(p, ctx->h##a); p += 4; } while(0)
@@ -23,6 +23,27 @@
  * of use of uninitialized or already freed memory easier.
  *
  * Example: Nodes of a FIB are allocated from a per-FIB Slab.
+ *
+ * Slabs shared by multiple threads can be created by sl_new_flags() with
+ * %SL_MAGAZINES. Each thread then keeps two magazines (arrays of free objects)
+ * per slab and allocates from them and frees to them without any locking.
+ * Only when both are empty (or full), it exchanges a magazine with the shared
+ * depot of the slab, which is protected by a mutex together with the slab
+ * pages. Objects thus move between threads and pages in batches. Threads
+ * should call sl_thread_flush() before they exit to return their magazines.
+ * Without thread support, the flag is ignored.
+ *
+ * Completely empty pages are kept by their slabs for reuse. When some slab
+ * has more of them than @slab_reclaim_watermark, slab_reclaim() called from
+ * the idle part of the main loop frees the excess pages and asks the libc
+ * allocator to return the memory to the OS.
+ *
+ * Freeing a slab does not free its pages immediately, as a slab of a full
+ * routing table may have hundreds of thousands of them. The pages are moved
+ * to a global graveyard list in constant time and slab_reclaim() frees them
+ * in batches of %SLAB_RECLAIM_BATCH, so protocol shutdown or table removal
+ * does not stall the main loop. If the main loop is not idle for a long
+ * time, slab_free() itself frees pages above %SLAB_GRAVEYARD_MAX.
  */
 
 #include <stdlib.h>
@@ -32,12 +53,21 @@
 #include "lib/resource.h"
 #include "lib/string.h"
 
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
 #undef FAKE_SLAB	/* Turn on if you want to debug memory allocations */
 
 #ifdef DEBUGGING
 #define POISON		/* Poison all regions after they are freed */
 #endif
 
+#if defined(USE_PTHREADS) && defined(HAVE_THREAD_LOCAL) && !defined(FAKE_SLAB)
+#define SLAB_MAGAZINES
+#include <pthread.h>
+#endif
+
 static void slab_free(resource *r);
 static void slab_dump(resource *r);
 static resource *slab_lookup(resource *r, unsigned long addr);
@@ -52,6 +82,7 @@ static size_t slab_memsize(resource *r);
 struct slab {
   resource r;
   uint size;
+  uint num_objs;
   list objs;
 };
 
@@ -79,12 +110,44 @@ sl_new(pool *p, uint size)
   return s;
 }
 
+slab *
+sl_new_flags(pool *p, uint size, uint flags UNUSED)
+{
+  return sl_new(p, size);
+}
+
+void
+sl_thread_flush(void)
+{
+}
+
+uint slab_reclaim_watermark = SLAB_DEFAULT_WATERMARK;
+
+void
+slab_set_watermark(uint pages)
+{
+  slab_reclaim_watermark = pages;
+}
+
+void
+slab_reclaim(void)
+{
+}
+
+size_t
+slab_graveyard_size(void)
+{
+  return 0;
+}
+
 void *
 sl_alloc(slab *s)
 {
   struct sl_obj *o = xmalloc(sizeof(struct sl_obj) + s->size);
 
   add_tail(&s->objs, &o->n);
+  s->num_objs++;
+  rmem_update(&s->r, ALLOC_OVERHEAD + s->size);
   return o->data;
 }
 
@@ -95,6 +158,8 @@ sl_free(slab *s, void *oo)
 
   rem_node(&o->n);
   xfree(o);
+  s->num_objs--;
+  rmem_update(&s->r, -(ssize_t) (ALLOC_OVERHEAD + s->size));
 }
 
 static void
@@ -123,13 +188,8 @@ static size_t
 slab_memsize(resource *r)
 {
   slab *s = (slab *) r;
-  size_t cnt = 0;
-  struct sl_obj *o;
 
-  WALK_LIST(o, s->objs)
-    cnt++;
-
-  return ALLOC_OVERHEAD + sizeof(struct slab) + cnt * (ALLOC_OVERHEAD + s->size);
+  return ALLOC_OVERHEAD + sizeof(struct slab) + s->num_objs * (ALLOC_OVERHEAD + s->size);
 }
 
 
@@ -140,12 +200,28 @@ slab_memsize(resource *r)
  */
 
 #define SLAB_SIZE 4096
-#define MAX_EMPTY_HEADS 1
+
+#define SL_MAG_SIZE 64		/* Objects per magazine */
+#define SL_TCACHE_SIZE 16	/* Slabs with magazines cached by a thread at once */
+
+struct sl_magazine;
 
 struct slab {
   resource r;
   uint obj_size, head_size, objs_per_slab, num_empty_heads, data_size;
+  uint num_heads;			/* Number of all pages, for memory accounting */
   list empty_heads, partial_heads, full_heads;
+  uint flags;
+  node n;				/* Node in slab_list */
+  u64 uid;				/* Unique ID, slab pointers may be reused */
+#ifdef SLAB_MAGAZINES
+  pthread_mutex_t lock;			/* Protects pages and depot of SL_MAGAZINES slabs */
+  struct sl_magazine *full_mags;	/* Depot of full magazines */
+  struct sl_magazine *empty_mags;	/* Depot of empty magazines */
+  struct sl_magazine *all_mags;		/* All magazines of the slab */
+  uint num_mags;			/* Number of allocated magazines */
+  uint num_full_mags;			/* Number of full magazines in depot */
+#endif
 };
 
 static struct resclass sl_class = {
@@ -176,6 +252,33 @@ struct sl_alignment {			/* Magic structure for testing of alignment */
   int x[0];
 };
 
+uint slab_reclaim_watermark = SLAB_DEFAULT_WATERMARK;
+
+/* All slabs, for slab_reclaim() and validation of thread cache entries */
+static list slab_list;
+static u64 slab_uid;
+static volatile int slab_reclaim_pending;
+
+/* Pages of freed slabs waiting for slab_reclaim(), protected by slab list lock */
+static list slab_graveyard;
+static uint slab_graveyard_pages;
+
+#define SLAB_RECLAIM_BATCH	1024
+#define SLAB_GRAVEYARD_MAX	65536
+
+#ifdef SLAB_MAGAZINES
+static pthread_mutex_t slab_list_lock = PTHREAD_MUTEX_INITIALIZER;
+#define SLAB_LIST_LOCK()	pthread_mutex_lock(&slab_list_lock)
+#define SLAB_LIST_UNLOCK()	pthread_mutex_unlock(&slab_list_lock)
+#define SLAB_LOCK(s)		do { if ((s)->flags & SL_MAGAZINES) pthread_mutex_lock(&(s)->lock); } while (0)
+#define SLAB_UNLOCK(s)		do { if ((s)->flags & SL_MAGAZINES) pthread_mutex_unlock(&(s)->lock); } while (0)
+#else
+#define SLAB_LIST_LOCK()	do { } while (0)
+#define SLAB_LIST_UNLOCK()	do { } while (0)
+#define SLAB_LOCK(s)		do { } while (0)
+#define SLAB_UNLOCK(s)		do { } while (0)
+#endif
+
 /**
  * sl_new - create a new Slab
  * @p: resource pool
@@ -186,6 +289,25 @@ struct sl_alignment {			/* Magic structure for testing of alignment */
  */
 slab *
 sl_new(pool *p, uint size)
+{
+  return sl_new_flags(p, size, 0);
+}
+
+#ifdef SLAB_MAGAZINES
+static void sl_mag_init(slab *s);
+#endif
+
+/**
+ * sl_new_flags - create a new Slab with options
+ * @p: resource pool
+ * @size: block size
+ * @flags: %SL_MAGAZINES to use per-thread magazines
+ *
+ * Like sl_new(), but @flags select the slab mode. Slabs created with
+ * %SL_MAGAZINES may be used from multiple threads at once.
+ */
+slab *
+sl_new_flags(pool *p, uint size, uint flags)
 {
   slab *s = ralloc(p, &sl_class);
   uint align = sizeof(struct sl_alignment);
@@ -205,6 +327,22 @@ sl_new(pool *p, uint size)
   init_list(&s->empty_heads);
   init_list(&s->partial_heads);
   init_list(&s->full_heads);
+  s->flags = 0;
+#ifdef SLAB_MAGAZINES
+  if (flags & SL_MAGAZINES)
+    sl_mag_init(s);
+#endif
+
+  SLAB_LIST_LOCK();
+  if (!slab_uid++)
+  {
+    init_list(&slab_list);
+    init_list(&slab_graveyard);
+  }
+  s->uid = slab_uid;
+  add_tail(&slab_list, &s->n);
+  SLAB_LIST_UNLOCK();
+
   return s;
 }
 
@@ -216,6 +354,9 @@ sl_new_head(slab *s)
   struct sl_obj *no;
   uint n = s->objs_per_slab;
 
+  s->num_heads++;
+  rmem_update(&s->r, ALLOC_OVERHEAD + SLAB_SIZE);
+
   *h = (struct sl_head) {
     .first_free = o,
     .num_full = 0,
@@ -231,15 +372,8 @@ sl_new_head(slab *s)
   return h;
 }
 
-/**
- * sl_alloc - allocate an object from Slab
- * @s: slab
- *
- * sl_alloc() allocates space for a single object from the
- * Slab and returns a pointer to the object.
- */
-void *
-sl_alloc(slab *s)
+static void *
+sl_alloc_page(slab *s)
 {
   struct sl_head *h;
   struct sl_obj *o;
@@ -254,9 +388,6 @@ okay:
     goto full_partial;
   h->first_free = o->u.next;
   h->num_full++;
-#ifdef POISON
-  memset(o->u.data, 0xcd, s->data_size);
-#endif
   return o->u.data;
 
 full_partial:
@@ -278,6 +409,303 @@ no_partial:
   goto okay;
 }
 
+static void
+sl_free_page(slab *s, void *oo)
+{
+  struct sl_obj *o = SKIP_BACK(struct sl_obj, u.data, oo);
+  struct sl_head *h = o->slab;
+
+  o->u.next = h->first_free;
+  h->first_free = o;
+  if (!--h->num_full)
+    {
+      rem_node(&h->n);
+      add_head(&s->empty_heads, &h->n);
+      if (++s->num_empty_heads > slab_reclaim_watermark)
+	slab_reclaim_pending = 1;
+    }
+  else if (!o->u.next)
+    {
+      rem_node(&h->n);
+      add_head(&s->partial_heads, &h->n);
+    }
+}
+
+
+#ifdef SLAB_MAGAZINES
+
+struct sl_magazine {
+  struct sl_magazine *next;		/* Next magazine in depot */
+  struct sl_magazine *all_next;		/* Next in slab->all_mags */
+  uint count;
+  void *objs[SL_MAG_SIZE];
+};
+
+/* Magazines loaded by the thread, indexed by slab address */
+struct sl_tcache {
+  slab *s;
+  u64 uid;
+  struct sl_magazine *loaded, *prev;
+};
+
+static _Thread_local struct sl_tcache sl_tcache[SL_TCACHE_SIZE];
+
+static void
+sl_mag_init(slab *s)
+{
+  s->flags |= SL_MAGAZINES;
+  pthread_mutex_init(&s->lock, NULL);
+  s->full_mags = s->empty_mags = s->all_mags = NULL;
+  s->num_mags = s->num_full_mags = 0;
+}
+
+/* Get an empty magazine, called with slab lock held */
+static struct sl_magazine *
+sl_mag_get_empty(slab *s)
+{
+  struct sl_magazine *m = s->empty_mags;
+
+  if (m)
+  {
+    s->empty_mags = m->next;
+    return m;
+  }
+
+  m = xmalloc(sizeof(struct sl_magazine));
+  m->count = 0;
+  m->all_next = s->all_mags;
+  s->all_mags = m;
+  s->num_mags++;
+  rmem_update(&s->r, ALLOC_OVERHEAD + sizeof(struct sl_magazine));
+  return m;
+}
+
+/* Return objects of a magazine to slab pages, called with slab lock held */
+static void
+sl_mag_drain(slab *s, struct sl_magazine *m)
+{
+  while (m->count)
+    sl_free_page(s, m->objs[--m->count]);
+}
+
+/* Return both magazines of a thread cache entry to the depot */
+static void
+sl_tcache_flush(struct sl_tcache *tc)
+{
+  slab *s = tc->s;
+  struct sl_magazine *mags[2] = { tc->loaded, tc->prev };
+
+  pthread_mutex_lock(&s->lock);
+  for (int i = 0; i < 2; i++)
+  {
+    struct sl_magazine *m = mags[i];
+    if (!m)
+      continue;
+
+    if (m->count == SL_MAG_SIZE)
+    {
+      m->next = s->full_mags;
+      s->full_mags = m;
+      s->num_full_mags++;
+      continue;
+    }
+
+    sl_mag_drain(s, m);
+    m->next = s->empty_mags;
+    s->empty_mags = m;
+  }
+  pthread_mutex_unlock(&s->lock);
+}
+
+/* Evict an entry, its slab may have been freed meanwhile */
+static void
+sl_tcache_evict(struct sl_tcache *tc)
+{
+  SLAB_LIST_LOCK();
+
+  slab *s;
+  WALK_LIST(s, slab_list)
+    if ((s == tc->s) && (s->uid == tc->uid))
+    {
+      sl_tcache_flush(tc);
+      break;
+    }
+
+  SLAB_LIST_UNLOCK();
+  *tc = (struct sl_tcache) { };
+}
+
+static inline struct sl_tcache *
+sl_tcache_get(slab *s)
+{
+  struct sl_tcache *tc = &sl_tcache[((uintptr_t) s / sizeof(struct slab)) % SL_TCACHE_SIZE];
+
+  if ((tc->s == s) && (tc->uid == s->uid))
+    return tc;
+
+  if (tc->s)
+    sl_tcache_evict(tc);
+
+  tc->s = s;
+  tc->uid = s->uid;
+  return tc;
+}
+
+static void *
+sl_alloc_mag(slab *s)
+{
+  struct sl_tcache *tc = sl_tcache_get(s);
+  struct sl_magazine *m;
+
+  if (tc->loaded && tc->loaded->count)
+    return tc->loaded->objs[--tc->loaded->count];
+
+  if (tc->prev && tc->prev->count)
+  {
+    m = tc->loaded;
+    tc->loaded = tc->prev;
+    tc->prev = m;
+    return tc->loaded->objs[--tc->loaded->count];
+  }
+
+  /* Both magazines empty, exchange one for a full one */
+  pthread_mutex_lock(&s->lock);
+  if (tc->prev)
+  {
+    tc->prev->next = s->empty_mags;
+    s->empty_mags = tc->prev;
+  }
+  tc->prev = tc->loaded;
+
+  if (m = s->full_mags)
+  {
+    s->full_mags = m->next;
+    s->num_full_mags--;
+  }
+  else
+  {
+    /* Refill in batch from pages */
+    m = sl_mag_get_empty(s);
+    while (m->count < SL_MAG_SIZE / 2)
+      m->objs[m->count++] = sl_alloc_page(s);
+  }
+  pthread_mutex_unlock(&s->lock);
+
+  tc->loaded = m;
+  return m->objs[--m->count];
+}
+
+static void
+sl_free_mag(slab *s, void *oo)
+{
+  struct sl_tcache *tc = sl_tcache_get(s);
+  struct sl_magazine *m;
+
+  if (tc->loaded && (tc->loaded->count < SL_MAG_SIZE))
+  {
+    tc->loaded->objs[tc->loaded->count++] = oo;
+    return;
+  }
+
+  if (tc->prev && (tc->prev->count < SL_MAG_SIZE))
+  {
+    m = tc->loaded;
+    tc->loaded = tc->prev;
+    tc->prev = m;
+    tc->loaded->objs[tc->loaded->count++] = oo;
+    return;
+  }
+
+  /* Both magazines full, move one to the depot */
+  pthread_mutex_lock(&s->lock);
+  if (tc->prev)
+  {
+    tc->prev->next = s->full_mags;
+    s->full_mags = tc->prev;
+    s->num_full_mags++;
+
+    /* Keep the depot bounded, the rest goes back to pages */
+    if (s->num_full_mags > 2)
+    {
+      m = s->full_mags->next;
+      s->full_mags->next = m->next;
+      s->num_full_mags--;
+      sl_mag_drain(s, m);
+      m->next = s->empty_mags;
+      s->empty_mags = m;
+    }
+  }
+  tc->prev = tc->loaded;
+  m = sl_mag_get_empty(s);
+  pthread_mutex_unlock(&s->lock);
+
+  tc->loaded = m;
+  m->objs[m->count++] = oo;
+}
+
+/**
+ * sl_thread_flush - return magazines of the current thread
+ *
+ * Return all magazines cached by the calling thread to the depots of their
+ * slabs. This should be called by threads using %SL_MAGAZINES slabs before
+ * they exit, otherwise the cached objects stay allocated until the slab is
+ * freed.
+ */
+void
+sl_thread_flush(void)
+{
+  for (int i = 0; i < SL_TCACHE_SIZE; i++)
+    if (sl_tcache[i].s)
+      sl_tcache_evict(&sl_tcache[i]);
+}
+
+static void
+sl_mag_free(slab *s)
+{
+  struct sl_magazine *m, *mn;
+  for (m = s->all_mags; m; m = mn)
+  {
+    mn = m->all_next;
+    xfree(m);
+  }
+
+  pthread_mutex_destroy(&s->lock);
+}
+
+#else
+
+void
+sl_thread_flush(void)
+{
+}
+
+#endif
+
+/**
+ * sl_alloc - allocate an object from Slab
+ * @s: slab
+ *
+ * sl_alloc() allocates space for a single object from the
+ * Slab and returns a pointer to the object.
+ */
+void *
+sl_alloc(slab *s)
+{
+  void *o;
+
+#ifdef SLAB_MAGAZINES
+  if (s->flags & SL_MAGAZINES)
+    o = sl_alloc_mag(s);
+  else
+#endif
+    o = sl_alloc_page(s);
+
+#ifdef POISON
+  memset(o, 0xcd, s->data_size);
+#endif
+  return o;
+}
+
 /**
  * sl_free - return a free object back to a Slab
  * @s: slab
@@ -289,44 +717,140 @@ no_partial:
 void
 sl_free(slab *s, void *oo)
 {
-  struct sl_obj *o = SKIP_BACK(struct sl_obj, u.data, oo);
-  struct sl_head *h = o->slab;
-
 #ifdef POISON
   memset(oo, 0xdb, s->data_size);
 #endif
-  o->u.next = h->first_free;
-  h->first_free = o;
-  if (!--h->num_full)
-    {
-      rem_node(&h->n);
-      if (s->num_empty_heads >= MAX_EMPTY_HEADS)
-	xfree(h);
-      else
-	{
-	  add_head(&s->empty_heads, &h->n);
-	  s->num_empty_heads++;
-	}
-    }
-  else if (!o->u.next)
+
+#ifdef SLAB_MAGAZINES
+  if (s->flags & SL_MAGAZINES)
+    sl_free_mag(s, oo);
+  else
+#endif
+    sl_free_page(s, oo);
+}
+
+/**
+ * slab_set_watermark - set number of empty pages kept by slabs
+ * @pages: number of completely empty pages each slab may keep
+ *
+ * Excess pages are freed by the next slab_reclaim().
+ */
+void
+slab_set_watermark(uint pages)
+{
+  slab_reclaim_watermark = pages;
+  slab_reclaim_pending = 1;
+}
+
+/**
+ * slab_reclaim - free excess empty pages
+ *
+ * Free completely empty pages of all slabs with more than
+ * @slab_reclaim_watermark of them and return the memory to the OS if possible.
+ * It does nothing unless some slab crossed the watermark since the last call,
+ * so it is cheap enough to be called whenever the main loop is idle.
+ */
+/* Called with slab list lock held */
+static uint
+slab_graveyard_free(uint max)
+{
+  uint freed = 0;
+
+  while ((freed < max) && !EMPTY_LIST(slab_graveyard))
+  {
+    struct sl_head *h = HEAD(slab_graveyard);
+    rem_node(&h->n);
+    xfree(h);
+    freed++;
+  }
+
+  slab_graveyard_pages -= freed;
+  return freed;
+}
+
+/**
+ * slab_graveyard_size - memory of freed slabs not yet reclaimed
+ *
+ * Returns the size of pages waiting for slab_reclaim() in bytes.
+ */
+size_t
+slab_graveyard_size(void)
+{
+  return (size_t) slab_graveyard_pages * (ALLOC_OVERHEAD + SLAB_SIZE);
+}
+
+void
+slab_reclaim(void)
+{
+  if (!slab_reclaim_pending)
+    return;
+
+  slab_reclaim_pending = 0;
+  uint freed = 0;
+
+  SLAB_LIST_LOCK();
+
+  /* Pages of freed slabs, one batch per call to keep the main loop responsive */
+  freed += slab_graveyard_free(SLAB_RECLAIM_BATCH);
+
+  if (slab_graveyard_pages)
+    slab_reclaim_pending = 1;
+
+  slab *s;
+  WALK_LIST(s, slab_list)
+  {
+    SLAB_LOCK(s);
+    while (s->num_empty_heads > slab_reclaim_watermark)
     {
+      struct sl_head *h = HEAD(s->empty_heads);
       rem_node(&h->n);
-      add_head(&s->partial_heads, &h->n);
+      xfree(h);
+      s->num_empty_heads--;
+      s->num_heads--;
+      rmem_update(&s->r, -(ssize_t) (ALLOC_OVERHEAD + SLAB_SIZE));
+      freed++;
     }
+    SLAB_UNLOCK(s);
+  }
+
+  SLAB_LIST_UNLOCK();
+
+#ifdef __GLIBC__
+  /* Trimming is expensive, wait for the last batch */
+  if (freed && !slab_graveyard_pages)
+    malloc_trim(0);
+#endif
 }
 
 static void
 slab_free(resource *r)
 {
   slab *s = (slab *) r;
-  struct sl_head *h, *g;
 
-  WALK_LIST_DELSAFE(h, g, s->empty_heads)
-    xfree(h);
-  WALK_LIST_DELSAFE(h, g, s->partial_heads)
-    xfree(h);
-  WALK_LIST_DELSAFE(h, g, s->full_heads)
-    xfree(h);
+  /* Thread cache entries of this slab become stale, the uid check skips them */
+  SLAB_LIST_LOCK();
+  rem_node(&s->n);
+  SLAB_LIST_UNLOCK();
+
+#ifdef SLAB_MAGAZINES
+  if (s->flags & SL_MAGAZINES)
+    sl_mag_free(s);
+#endif
+
+  /* Pages are freed later by slab_reclaim() */
+  SLAB_LIST_LOCK();
+  list *heads[] = { &s->empty_heads, &s->partial_heads, &s->full_heads };
+  for (uint i = 0; i < ARRAY_SIZE(heads); i++)
+    if (!EMPTY_LIST(*heads[i]))
+      add_tail_list(&slab_graveyard, heads[i]);
+
+  slab_graveyard_pages += s->num_heads;
+
+  if (slab_graveyard_pages > SLAB_GRAVEYARD_MAX)
+    slab_graveyard_free(slab_graveyard_pages - SLAB_GRAVEYARD_MAX);
+
+  slab_reclaim_pending = 1;
+  SLAB_LIST_UNLOCK();
 }
 
 static void
@@ -343,23 +867,26 @@ slab_dump(resource *r)
   WALK_LIST(h, s->full_heads)
     fc++;
   debug("(%de+%dp+%df blocks per %d objs per %d bytes)\n", ec, pc, fc, s->objs_per_slab, s->obj_size);
+
+#ifdef SLAB_MAGAZINES
+  if (s->flags & SL_MAGAZINES)
+    debug("\t(%d magazines, %d full in depot)\n", s->num_mags, s->num_full_mags);
+#endif
 }
 
 static size_t
 slab_memsize(resource *r)
 {
   slab *s = (slab *) r;
-  size_t heads = 0;
-  struct sl_head *h;
+  size_t heads = s->num_heads;
 
-  WALK_LIST(h, s->empty_heads)
-    heads++;
-  WALK_LIST(h, s->partial_heads)
-    heads++;
-  WALK_LIST(h, s->full_heads)
-    heads++;
+  size_t mags = 0;
+#ifdef SLAB_MAGAZINES
+  if (s->flags & SL_MAGAZINES)
+    mags = s->num_mags * (ALLOC_OVERHEAD + sizeof(struct sl_magazine));
+#endif
 
-  return ALLOC_OVERHEAD + sizeof(struct slab) + heads * (ALLOC_OVERHEAD + SLAB_SIZE);
+  return ALLOC_OVERHEAD + sizeof(struct slab) + heads * (ALLOC_OVERHEAD + SLAB_SIZE) + mags;
 }
 
 static resource *
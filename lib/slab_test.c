@@ -0,0 +1,339 @@
+/*
+ *	BIRD Library -- Slab Allocator Tests
+ *
+ *	Can be freely distributed and used under the terms of the GNU GPL.
+ */
+
+#include "test/birdtest.h"
+
+#include "lib/resource.h"
+
+#ifdef USE_PTHREADS
+#include <pthread.h>
+#endif
+
+#define OBJ_SIZE 40
+#define OBJ_COUNT 10000
+#define OBJ_ROUNDS 50000
+#define THREADS 4
+
+struct obj {
+  u32 owner;
+  u32 serial;
+  byte pad[OBJ_SIZE - 8];
+};
+
+static void
+slab_random_ops(slab *s, struct obj **objs, u32 owner)
+{
+  for (int i = 0; i < OBJ_ROUNDS; i++)
+  {
+    int j = bt_random() % OBJ_COUNT;
+
+    if (objs[j])
+    {
+      bt_assert((objs[j]->owner == owner) && (objs[j]->serial == (u32) j));
+      sl_free(s, objs[j]);
+      objs[j] = NULL;
+    }
+    else
+    {
+      objs[j] = sl_alloc(s);
+      objs[j]->owner = owner;
+      objs[j]->serial = j;
+    }
+  }
+}
+
+static int
+slab_run(uint flags)
+{
+  static struct obj *objs[OBJ_COUNT];
+
+  slab *s = sl_new_flags(&root_pool, sizeof(struct obj), flags);
+
+  slab_random_ops(s, objs, 1);
+
+  for (int i = 0; i < OBJ_COUNT; i++)
+    if (objs[i])
+    {
+      bt_assert((objs[i]->owner == 1) && (objs[i]->serial == (u32) i));
+      sl_free(s, objs[i]);
+      objs[i] = NULL;
+    }
+
+  sl_thread_flush();
+  rfree(s);
+  return 1;
+}
+
+static int
+t_slab(void)
+{
+  resource_init();
+  return slab_run(0);
+}
+
+static int
+t_slab_magazines(void)
+{
+  resource_init();
+  return slab_run(SL_MAGAZINES);
+}
+
+static int
+t_slab_graveyard(void)
+{
+  resource_init();
+
+  size_t before = slab_graveyard_size();
+  slab *s = sl_new(&root_pool, sizeof(struct obj));
+
+  /* Enough pages for several reclaim batches */
+  for (int i = 0; i < 50 * OBJ_COUNT; i++)
+    sl_alloc(s);
+
+  rfree(s);
+
+  size_t size = slab_graveyard_size();
+  bt_assert(size > before);
+
+  /* Pages are freed incrementally, each call makes progress */
+  int calls = 0;
+  while (slab_graveyard_size() && (calls < 1000))
+  {
+    size_t last = slab_graveyard_size();
+    slab_reclaim();
+    bt_assert(slab_graveyard_size() < last);
+    calls++;
+  }
+
+  bt_assert(!slab_graveyard_size());
+  bt_assert(calls > 1);
+
+  return 1;
+}
+
+#ifdef USE_PTHREADS
+
+struct thread_data {
+  slab *s;
+  u32 owner;
+  struct obj *objs[OBJ_COUNT];
+};
+
+static void *
+slab_thread(void *arg)
+{
+  struct thread_data *d = arg;
+
+  slab_random_ops(d->s, d->objs, d->owner);
+  sl_thread_flush();
+  return NULL;
+}
+
+static void *
+slab_thread_free(void *arg)
+{
+  struct thread_data *d = arg;
+
+  for (int i = 0; i < OBJ_COUNT; i++)
+    if (d->objs[i])
+    {
+      sl_free(d->s, d->objs[i]);
+      d->objs[i] = NULL;
+    }
+
+  sl_thread_flush();
+  return NULL;
+}
+
+static int
+t_slab_threads(void)
+{
+  static struct thread_data data[THREADS];
+  pthread_t thr[THREADS];
+
+  resource_init();
+  slab *s = sl_new_flags(&root_pool, sizeof(struct obj), SL_MAGAZINES);
+
+  for (int i = 0; i < THREADS; i++)
+  {
+    data[i] = (struct thread_data) { .s = s, .owner = i + 1 };
+    pthread_create(&thr[i], NULL, slab_thread, &data[i]);
+  }
+
+  for (int i = 0; i < THREADS; i++)
+    pthread_join(thr[i], NULL);
+
+  /* Objects allocated by a thread are freed by another one */
+  for (int i = 0; i < THREADS; i++)
+  {
+    for (int j = 0; j < OBJ_COUNT; j++)
+      if (data[i].objs[j])
+	bt_assert((data[i].objs[j]->owner == data[i].owner) && (data[i].objs[j]->serial == (u32) j));
+
+    pthread_create(&thr[i], NULL, slab_thread_free, &data[(i + 1) % THREADS]);
+  }
+
+  for (int i = 0; i < THREADS; i++)
+    pthread_join(thr[i], NULL);
+
+  rfree(s);
+  return 1;
+}
+
+#endif
+
+static int
+t_linpool_reuse(void)
+{
+  resource_init();
+  linpool *lp = lp_new(&root_pool, LP_GOOD_SIZE(1024));
+
+  /* Large chunks are reused after flush if they are big enough */
+  void *large = lp_alloc(lp, 4000);
+  lp_flush(lp);
+  bt_assert(lp_alloc(lp, 3000) == large);
+  bt_assert(lp_alloc(lp, 8000) != large);
+
+  /* And after restore */
+  lp_state st;
+  lp_save(lp, &st);
+  void *larger = lp_alloc(lp, 10000);
+  lp_restore(lp, &st);
+  bt_assert(lp_alloc(lp, 9000) == larger);
+
+  /* Normal chunks of a freed pool are reused by a new pool of the same size */
+  void *normal = lp_alloc(lp, 16);
+  rfree(lp);
+
+  lp = lp_new(&root_pool, LP_GOOD_SIZE(1024));
+  bt_assert(lp_alloc(lp, 16) == normal);
+
+  rfree(lp);
+  lp_thread_flush();
+  return 1;
+}
+
+static size_t
+rmem_walk(pool *p, uint *count)
+{
+  struct rmem_stat st = {};
+  rmemstat(p, &st);
+
+  size_t size = 0;
+  *count = 0;
+  for (uint i = 0; i < st.num; i++)
+  {
+    size += st.cls[i].size;
+    *count += st.cls[i].count;
+  }
+
+  /* The pool itself is counted by rmemstat() */
+  (*count)--;
+  return size;
+}
+
+static int
+t_rmem_totals(void)
+{
+  resource_init();
+  pool *p = rp_new(&root_pool, "Test");
+  pool *q = rp_new(p, "Nested");
+  slab *s = sl_new(q, sizeof(struct obj));
+  linpool *lp = lp_new(q, LP_GOOD_SIZE(1024));
+  void *objs[1000], *mbs[100];
+  uint count;
+
+  for (uint i = 0; i < 1000; i++)
+    objs[i] = sl_alloc(s);
+
+  for (uint i = 0; i < 100; i++)
+    mbs[i] = mb_alloc((i % 2) ? p : q, i + 1);
+
+  for (uint i = 0; i < 100; i++)
+    lp_alloc(lp, 10 * i);
+
+  bt_assert(rmemsize(p) == rmem_walk(p, &count));
+  bt_assert(rp_count(p) == count);
+
+  for (uint i = 0; i < 100; i += 3)
+    mbs[i] = mb_realloc(mbs[i], 1000);
+
+  for (uint i = 0; i < 100; i += 5)
+    mb_free(mbs[i]);
+
+  lp_flush(lp);
+  lp_alloc(lp, 5000);
+  rmove(lp, p);
+
+  bt_assert(rmemsize(p) == rmem_walk(p, &count));
+  bt_assert(rp_count(p) == count);
+
+  for (uint i = 0; i < 1000; i++)
+    sl_free(s, objs[i]);
+
+  size_t before = rmemsize(&root_pool);
+  size_t nested = rmemsize(q);
+  rfree(q);
+
+  bt_assert(rmemsize(&root_pool) == before - nested);
+  bt_assert(rmemsize(p) == rmem_walk(p, &count));
+  bt_assert(rp_count(p) == count);
+
+  rfree(p);
+  bt_assert(rmemsize(&root_pool) == rmem_walk(&root_pool, &count));
+  return 1;
+}
+
+static void
+b_slab(uint n)
+{
+  static slab *s;
+
+  if (!s)
+  {
+    s = sl_new(&root_pool, sizeof(struct obj));
+  }
+
+  for (uint i = 0; i < n; i++)
+    sl_free(s, sl_alloc(s));
+}
+
+static void
+b_linpool(uint n)
+{
+  static linpool *lp;
+
+  if (!lp)
+  {
+    lp = lp_new_default(&root_pool);
+  }
+
+  for (uint i = 0; i < n; i++)
+    if (!lp_alloc(lp, OBJ_SIZE))
+      bt_abort();
+
+  lp_flush(lp);
+}
+
+int
+main(int argc, char *argv[])
+{
+  bt_init(argc, argv);
+
+  bt_test_suite(t_slab, "Slab allocation and freeing");
+  bt_test_suite(t_slab_magazines, "Slab with magazines");
+  bt_test_suite(t_slab_graveyard, "Pages of freed slabs are reclaimed incrementally");
+#ifdef USE_PTHREADS
+  bt_test_suite(t_slab_threads, "Slab with magazines shared by threads");
+#endif
+  bt_test_suite(t_linpool_reuse, "Linpool chunk reuse");
+  bt_test_suite(t_rmem_totals, "Pool memory totals match resource tree");
+
+  bt_bench(b_slab, "Slab allocation and freeing of one object");
+  bt_bench(b_linpool, "Linpool allocation");
+
+  return bt_exit_value();
+}
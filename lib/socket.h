@@ -60,6 +60,7 @@ typedef struct birdsock {
   byte *tbuf, *tpos;			/* NULL=allocate automatically */
   byte *ttx;				/* Internal */
   uint tbsize;
+  struct sk_tx_batch *txb;		/* Internal, datagrams queued by sk_tx_batch_begin() */
   void (*tx_hook)(struct birdsock *);
 
   void (*err_hook)(struct birdsock *, int); /* errno or zero if EOF */
@@ -73,9 +74,11 @@ typedef struct birdsock {
   int af;				/* System-dependend adress family (e.g. AF_INET) */
   int fd;				/* System-dependent data */
   int index;				/* Index in poll buffer */
+  u32 ep_events;			/* Events registered in epoll, if used */
   int rcv_ttl;				/* TTL of last received datagram */
   node n;
   void *rbuf_alloc, *tbuf_alloc;
+  uint bufs_size;			/* Size of allocated buffers, for memory accounting */
   const char *password;			/* Password for MD5 authentication */
   const char *err;			/* Error message */
   struct ssh_sock *ssh;			/* Used in SK_SSH */
@@ -89,9 +92,11 @@ int sk_rx_ready(sock *s);
 int sk_send(sock *, uint len);		/* Send data, <0=err, >0=ok, 0=sleep */
 int sk_send_to(sock *, uint len, ip_addr to, uint port); /* sk_send to given destination */
 void sk_reallocate(sock *);		/* Free and allocate tbuf & rbuf */
-void sk_set_rbsize(sock *s, uint val);	/* Resize RX buffer */
+void sk_set_rbsize(sock *s, uint val);	/* Resize RX buffer, keeping content */
 void sk_set_tbsize(sock *s, uint val);	/* Resize TX buffer, keeping content */
 void sk_set_tbuf(sock *s, void *tbuf);	/* Switch TX buffer, NULL-> return to internal */
+void sk_tx_batch_begin(sock *s);	/* Queue datagrams from sk_send_to() for sending together */
+int sk_tx_batch_end(sock *s);		/* Send queued datagrams, <0=err, >0=ok, 0=sleep */
 void sk_dump_all(void);
 
 int sk_is_ipv4(sock *s);		/* True if socket is IPv4 */
@@ -111,6 +116,18 @@ int sk_set_ipv6_checksum(sock *s, int offset);
 int sk_set_icmp6_filter(sock *s, int p1, int p2);
 void sk_log_error(sock *s, const char *p);
 
+struct sk_tcp_info {
+  u32 rtt, rttvar;			/* Smoothed RTT and its variation [us] */
+  u32 snd_cwnd, snd_mss;		/* Congestion window [segments] and segment size [bytes] */
+  u32 unacked;				/* Segments sent but not yet acknowledged */
+  u32 retrans, total_retrans;		/* Segments retransmitted now / during the whole connection */
+  u32 rcv_space;			/* Receiver estimate of needed buffer space [bytes] */
+  u32 sndbuf, rcvbuf;			/* Kernel socket buffers [bytes] */
+};
+
+int sk_get_tcp_info(sock *s, struct sk_tcp_info *info); /* Get kernel TCP state of connected socket */
+int sk_grow_kernel_buffers(sock *s, uint rcv, uint snd); /* Enlarge kernel socket buffers */
+
 byte * sk_rx_buffer(sock *s, int *len);	/* Temporary */
 
 extern int sk_priority_control;		/* Suggested priority for control traffic, should be sysdep define */
@@ -123,6 +140,7 @@ extern int sk_priority_control;		/* Suggested priority for control traffic, shou
 #define SKF_TTL_RX	0x08	/* Report TTL / Hop Limit for RX packets */
 #define SKF_BIND	0x10	/* Bind datagram socket to given source address */
 #define SKF_HIGH_PORT	0x20	/* Choose port from high range if possible */
+#define SKF_BATCH_RX	0x40	/* Receive more datagrams per syscall if possible, rx_hook must not close the socket */
 
 #define SKF_THREAD	0x100	/* Socked used in thread, Do not add to main loop */
 #define SKF_TRUNCATED	0x200	/* Received packet was truncated, set by IO layer */
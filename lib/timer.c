@@ -24,6 +24,14 @@
  * handler function (@hook), data private to this function (@data), time the
  * function should be called at (@expires, 0 for inactive timers), for the other
  * fields see |timer.h|.
+ *
+ * Active timers are kept in a heap ordered by @heap_time. Timers are often
+ * postponed long before they expire (e.g. hold timers restarted by every
+ * received keepalive), so postponing a timer just updates @expires and leaves
+ * the timer at its old heap position. When such timer reaches the top of the
+ * heap, timers_fire() moves it to its proper position. Therefore @heap_time is
+ * never later than @expires and the top of the heap after timers_fire() is
+ * always the timer which expires first.
  */
 
 #include <stdio.h>
@@ -32,6 +40,7 @@
 
 #include "nest/bird.h"
 
+#include "lib/event.h"
 #include "lib/heap.h"
 #include "lib/resource.h"
 #include "lib/timer.h"
@@ -44,7 +53,7 @@ struct timeloop main_timeloop;
 
 #include <pthread.h>
 
-/* Data accessed and modified from proto/bfd/io.c */
+/* Data accessed and modified from sysdep/unix/io-loop.c */
 pthread_key_t current_time_key;
 
 static inline struct timeloop *
@@ -88,7 +97,7 @@ current_real_time(void)
 }
 
 
-#define TIMER_LESS(a,b)		((a)->expires < (b)->expires)
+#define TIMER_LESS(a,b)		((a)->heap_time < (b)->heap_time)
 #define TIMER_SWAP(heap,a,b,t)	(t = heap[a], heap[a] = heap[b], heap[b] = t, \
 				   heap[a]->index = (a), heap[b]->index = (b))
 
@@ -144,19 +153,24 @@ tm_set(timer *t, btime when)
   if (!t->expires)
   {
     t->index = ++tc;
-    t->expires = when;
+    t->expires = t->heap_time = when;
     BUFFER_PUSH(loop->timers) = t;
     HEAP_INSERT(loop->timers.data, tc, timer *, TIMER_LESS, TIMER_SWAP);
   }
   else if (t->expires < when)
   {
+    /* Postponed, moved in the heap lazily by timers_fire() */
     t->expires = when;
-    HEAP_INCREASE(loop->timers.data, tc, timer *, TIMER_LESS, TIMER_SWAP, t->index);
   }
   else if (t->expires > when)
   {
     t->expires = when;
-    HEAP_DECREASE(loop->timers.data, tc, timer *, TIMER_LESS, TIMER_SWAP, t->index);
+
+    if (t->heap_time > when)
+    {
+      t->heap_time = when;
+      HEAP_DECREASE(loop->timers.data, tc, timer *, TIMER_LESS, TIMER_SWAP, t->index);
+    }
   }
 
 #ifdef CONFIG_BFD
@@ -185,7 +199,7 @@ tm_stop(timer *t)
   BUFFER_POP(loop->timers);
 
   t->index = -1;
-  t->expires = 0;
+  t->expires = t->heap_time = 0;
 }
 
 void
@@ -197,8 +211,6 @@ timers_init(struct timeloop *loop, pool *p)
   BUFFER_PUSH(loop->timers) = NULL;
 }
 
-void io_log_event(void *hook, void *data);
-
 void
 timers_fire(struct timeloop *loop)
 {
@@ -210,9 +222,18 @@ timers_fire(struct timeloop *loop)
 
   while (t = timers_first(loop))
   {
+    if (t->heap_time < t->expires)
+    {
+      t->heap_time = t->expires;
+      HEAP_INCREASE(loop->timers.data, timers_count(loop), timer *, TIMER_LESS, TIMER_SWAP, 1);
+      continue;
+    }
+
     if (t->expires > base_time)
       return;
 
+    btime expires = t->expires;
+
     if (t->recurrent)
     {
       btime when = t->expires + t->recurrent;
@@ -230,7 +251,10 @@ timers_fire(struct timeloop *loop)
 
     /* This is ugly hack, we want to log just timers executed from the main I/O loop */
     if (loop == &main_timeloop)
-      io_log_event(t->hook, t->data);
+    {
+      io_log_delay(IO_HOOK_TIMER_DELAY, base_time - expires);
+      io_log_event(t->hook, t->data, IO_HOOK_TIMER);
+    }
 
     t->hook(t);
   }
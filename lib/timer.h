@@ -22,6 +22,7 @@ typedef struct timer
   void *data;
 
   btime expires;			/* 0=inactive */
+  btime heap_time;			/* Heap key, may lag behind postponed expires */
   uint randomize;			/* Amount of randomization */
   uint recurrent;			/* Timer recurrence */
 
@@ -0,0 +1,129 @@
+/*
+ *	BIRD Library -- Timer Tests
+ *
+ *	Can be freely distributed and used under the terms of the GNU GPL.
+ */
+
+#include "test/birdtest.h"
+#include "test/bt-utils.h"
+
+#include "lib/timer.h"
+#include "conf/conf.h"
+
+#define MAX_NUM 1000
+#define MAX_TIME 100000
+
+static timer *timers[MAX_NUM];
+static btime fire_last;
+static uint fire_count;
+
+static void
+timer_hook(timer *t)
+{
+  bt_assert_msg(t->expires == 0, "Fired timer should be inactive");
+  bt_assert_msg(fire_last <= (btime) (uintptr_t) t->data, "Timers should fire in order of expiration");
+
+  fire_last = (btime) (uintptr_t) t->data;
+  fire_count++;
+}
+
+static void
+set_timer(timer *t, btime when)
+{
+  tm_set(t, when);
+  t->data = (void *) (uintptr_t) when;
+}
+
+static int
+t_timers_fire(void)
+{
+  btime base = current_time() - MAX_TIME - 1;
+  uint active = 0;
+
+  bt_assert(base > 0);
+
+  for (uint i = 0; i < MAX_NUM; i++)
+  {
+    timers[i] = tm_new_init(&root_pool, timer_hook, NULL, 0, 0);
+    set_timer(timers[i], base + 1 + bt_random() % MAX_TIME);
+  }
+
+  /* Postpone, advance and stop timers in random order */
+  for (uint i = 0; i < 4 * MAX_NUM; i++)
+  {
+    timer *t = timers[bt_random() % MAX_NUM];
+
+    switch (bt_random() % 4)
+    {
+    case 0:
+      tm_stop(t);
+      break;
+
+    case 1:
+      /* Postpone, but not beyond the range of the others */
+      if (tm_active(t) && (t->expires < base + MAX_TIME))
+	set_timer(t, t->expires + 1 + bt_random() % (base + MAX_TIME - t->expires));
+      break;
+
+    default:
+      set_timer(t, base + 1 + bt_random() % MAX_TIME);
+    }
+  }
+
+  for (uint i = 0; i < MAX_NUM; i++)
+    if (tm_active(timers[i]))
+      active++;
+
+  fire_last = 0;
+  fire_count = 0;
+  timers_fire(&main_timeloop);
+
+  bt_assert(fire_count == active);
+  bt_assert(!timers_first(&main_timeloop));
+
+  return 1;
+}
+
+static int
+t_timers_first(void)
+{
+  btime base = current_time() + 1000 S;
+
+  for (uint i = 0; i < MAX_NUM; i++)
+  {
+    timers[i] = tm_new_init(&root_pool, timer_hook, NULL, 0, 0);
+    set_timer(timers[i], base + 1 + bt_random() % MAX_TIME);
+  }
+
+  /* Postponing all but one timer leaves it as the first one */
+  for (uint i = 1; i < MAX_NUM; i++)
+    set_timer(timers[i], base + MAX_TIME + 1 + bt_random() % MAX_TIME);
+
+  set_timer(timers[0], base);
+
+  timers_fire(&main_timeloop);
+
+  timer *t = timers_first(&main_timeloop);
+  bt_assert(t == timers[0]);
+  bt_assert(t->heap_time == t->expires);
+
+  for (uint i = 0; i < MAX_NUM; i++)
+    tm_stop(timers[i]);
+
+  bt_assert(!timers_first(&main_timeloop));
+
+  return 1;
+}
+
+int
+main(int argc, char *argv[])
+{
+  bt_init(argc, argv);
+  bt_bird_init();
+  config = config_alloc("");
+
+  bt_test_suite(t_timers_fire, "Timers fire in order after postponing and stopping");
+  bt_test_suite(t_timers_first, "First timer is exact after lazily postponed timers");
+
+  return bt_exit_value();
+}
@@ -0,0 +1,29 @@
+/*
+ *	BIRD Library -- Static Tracepoints
+ *
+ *	Can be freely distributed and used under the terms of the GNU GPL.
+ */
+
+#ifndef _BIRD_TRACEPOINT_H_
+#define _BIRD_TRACEPOINT_H_
+
+/*
+ * Static tracepoints are USDT probes of provider 'bird', which can be attached
+ * by bpftrace, perf or SystemTap, e.g.:
+ *
+ *   bpftrace -e 'usdt:/usr/sbin/bird:bird:rte_update { @[str(arg0)] = count(); }'
+ *
+ * A disabled probe costs just a NOP instruction, but its arguments are still
+ * evaluated, so they should be cheap (pointers and values at hand). Timing is
+ * obtained by pairs of probes with a __done suffix at the end of the traced
+ * operation. Tracepoints are compiled in only with --enable-usdt.
+ */
+
+#ifdef HAVE_USDT
+#include <sys/sdt.h>
+#define TRACEPOINT(name, args...)	STAP_PROBEV(bird, name, ##args)
+#else
+#define TRACEPOINT(name, args...)	do { } while (0)
+#endif
+
+#endif
@@ -13,6 +13,7 @@
 #include "lib/resource.h"
 #include "lib/unaligned.h"
 #include "lib/string.h"
+#include "lib/json.h"
 #include "filter/data.h"
 
 // static inline void put_as(byte *data, u32 as) { put_u32(data, as); }
@@ -397,6 +398,52 @@ as_path_format(const struct adata *path, byte *bb, uint size)
     strcpy(b->end - 12, "...");
 }
 
+void
+as_path_json(const struct adata *path, struct json_writer *w)
+{
+  const byte *pos = path->data;
+  const byte *end = pos + path->length;
+  const char *type;
+
+  json_open(w, NULL, '[');
+
+  while (pos < end)
+  {
+    uint len = pos[1];
+
+    switch (pos[0])
+    {
+    case AS_PATH_SET:			type = "set";		break;
+    case AS_PATH_SEQUENCE:		type = "sequence";	break;
+    case AS_PATH_CONFED_SEQUENCE:	type = "confed_sequence"; break;
+    case AS_PATH_CONFED_SET:		type = "confed_set";	break;
+    default: bug("Invalid path segment");
+    }
+
+    pos += 2;
+
+    json_open(w, NULL, '{');
+    json_put_string(w, "type", type);
+    json_open(w, "asns", '[');
+    while (len--)
+    {
+      json_put_uint(w, NULL, get_as(pos));
+      pos += BS;
+    }
+    json_close(w, ']');
+    json_close(w, '}');
+  }
+
+  json_close(w, ']');
+}
+
+static inline int
+as_path_is_one_sequence(const struct adata *path)
+{
+  return (path->length >= 2) && (path->data[0] == AS_PATH_SEQUENCE) &&
+    (path->length == 2 + BS * (uint) path->data[1]);
+}
+
 int
 as_path_getlen(const struct adata *path)
 {
@@ -404,6 +451,10 @@ as_path_getlen(const struct adata *path)
   const byte *end = pos + path->length;
   uint res = 0;
 
+  /* Most paths are one AS_SEQUENCE, answered by its segment header */
+  if (as_path_is_one_sequence(path))
+    return pos[1];
+
   while (pos < end)
   {
     uint t = pos[0];
@@ -434,6 +485,15 @@ as_path_get_last(const struct adata *path, u32 *orig_as)
   int found = 0;
   u32 val = 0;
 
+  if (as_path_is_one_sequence(path))
+  {
+    if (!pos[1])
+      return 0;
+
+    *orig_as = get_as(end - BS);
+    return 1;
+  }
+
   while (pos < end)
   {
     uint type = pos[0];
@@ -748,15 +808,89 @@ pm_match_val(const struct pm_pos *pos, u32 asn, u32 asn2)
   return 0;
 }
 
+static void
+as_path_compile_tree(const struct f_tree *t, u32 *buf, uint *n)
+{
+  if (!t)
+    return;
+
+  as_path_compile_tree(t->left, buf, n);
+
+  u32 from = t->from.val.i;
+  u32 to = t->to.val.i;
+
+  /* Merge with the previous interval if overlapping or adjacent */
+  if (*n && ((u64) from <= (u64) buf[*n - 1] + 1))
+    buf[*n - 1] = MAX(buf[*n - 1], to);
+  else
+  {
+    buf[(*n)++] = from;
+    buf[(*n)++] = to;
+  }
+
+  as_path_compile_tree(t->right, buf, n);
+}
+
+static uint
+as_path_tree_size(const struct f_tree *t)
+{
+  return t ? as_path_tree_size(t->left) + 1 + as_path_tree_size(t->right) : 0;
+}
+
+/**
+ * as_path_compile_set - compile ASN set of a path mask
+ * @pool: linpool for the result
+ * @set: ASN set (a tree of integer intervals)
+ *
+ * The function flattens the tree to sorted, disjoint intervals stored as
+ * pairs of u32, which are searched by bisection during path matching instead
+ * of generic value comparisons in find_tree().
+ */
+const struct adata *
+as_path_compile_set(struct linpool *pool, const struct f_tree *set)
+{
+  uint max = 2 * as_path_tree_size(set);
+  struct adata *res = lp_alloc_adata(pool, max * sizeof(u32));
+  uint n = 0;
+
+  as_path_compile_tree(set, (u32 *) res->data, &n);
+  res->length = n * sizeof(u32);
+
+  return res;
+}
+
+static int
+pm_match_ranges(const struct adata *ranges, u32 asn)
+{
+  const u32 *r = (const u32 *) ranges->data;
+  int lo = 0, hi = ranges->length / (2 * sizeof(u32));
+
+  /* Find the last interval starting at or below asn */
+  while (lo < hi)
+  {
+    int m = (lo + hi) / 2;
+
+    if (r[2*m] <= asn)
+      lo = m + 1;
+    else
+      hi = m;
+  }
+
+  return lo && (asn <= r[2*lo - 1]);
+}
+
 static int
-pm_match_set(const struct pm_pos *pos, const struct f_tree *set)
+pm_match_set(const struct pm_pos *pos, const struct f_path_mask_item *mask)
 {
   struct f_val asn = { .type = T_INT };
 
   if (! pos->set)
   {
+    if (mask->ranges)
+      return pm_match_ranges(mask->ranges, pos->val.asn);
+
     asn.val.i = pos->val.asn;
-    return !!find_tree(set, &asn);
+    return !!find_tree(mask->set, &asn);
   }
 
   const u8 *p = pos->val.sp;
@@ -766,7 +900,7 @@ pm_match_set(const struct pm_pos *pos, const struct f_tree *set)
   for (i = 0; i < len; i++)
   {
     asn.val.i = get_as(p + i * BS);
-    if (find_tree(set, &asn))
+    if (mask->ranges ? pm_match_ranges(mask->ranges, asn.val.i) : !!find_tree(mask->set, &asn))
       return 1;
   }
 
@@ -779,7 +913,7 @@ pm_match(const struct pm_pos *pos, const struct f_path_mask_item *mask, u32 asn,
   return ((mask->kind == PM_QUESTION) ||
 	  ((mask->kind != PM_ASN_SET) ?
 	   pm_match_val(pos, asn, asn2) :
-	   pm_match_set(pos, mask->set)));
+	   pm_match_set(pos, mask)));
 }
 
 static void
@@ -12,6 +12,7 @@
 #include "nest/route.h"
 #include "nest/attrs.h"
 #include "lib/resource.h"
+#include "filter/data.h"
 
 #define TESTS_NUM 30
 #define AS_PATH_LENGTH 1000
@@ -61,12 +62,69 @@ t_as_path_match(void)
     bt_assert(as_path_get_last(as_path, &asn));
     bt_assert_msg(asn == first_prepended, "as_path_get_last() should return the first prepended ASN");
 
+    bt_assert(as_path_getlen(as_path) == AS_PATH_LENGTH);
+
     rfree(lp);
   }
 
   return 1;
 }
 
+#define TREE_NODE(f, t, l, r) \
+  { .from = { .type = T_INT, .val.i = f }, .to = { .type = T_INT, .val.i = t }, .left = l, .right = r }
+
+static int
+t_as_path_match_set(void)
+{
+  resource_init();
+  struct linpool *lp = lp_new_default(&root_pool);
+
+  /* Set [10..20, 15..30, 31, 100..200] as a tree sorted by interval start */
+  struct f_tree n1 = TREE_NODE(10, 20, NULL, NULL);
+  struct f_tree n3 = TREE_NODE(31, 31, NULL, NULL);
+  struct f_tree n4 = TREE_NODE(100, 200, NULL, NULL);
+  struct f_tree n2 = TREE_NODE(15, 30, &n1, &n3);
+  n3.right = &n4;
+
+  /* Overlapping and adjacent intervals are merged */
+  const struct adata *ranges = as_path_compile_set(lp, &n2);
+  const u32 *r = (const u32 *) ranges->data;
+  bt_assert(ranges->length == 4 * sizeof(u32));
+  bt_assert((r[0] == 10) && (r[1] == 31) && (r[2] == 100) && (r[3] == 200));
+
+  /* Mask [= * set * =] */
+  struct f_path_mask *mask = alloca(sizeof(struct f_path_mask) + 3 * sizeof(struct f_path_mask_item));
+  mask->len = 3;
+  mask->item[0].kind = PM_ASTERISK;
+  mask->item[1].kind = PM_ASN_SET;
+  mask->item[1].set = &n2;
+  mask->item[2].kind = PM_ASTERISK;
+
+  for (u32 asn = 0; asn < 256; asn++)
+  {
+    struct adata empty_as_path = {};
+    const struct adata *path = &empty_as_path;
+    path = as_path_prepend(lp, path, 1000);
+    path = as_path_prepend(lp, path, asn);
+    path = as_path_prepend(lp, path, 2000);
+
+    mask->item[1].ranges = NULL;
+    int expected = as_path_match(path, mask);
+    bt_assert(expected == (((asn >= 10) && (asn <= 31)) || ((asn >= 100) && (asn <= 200))));
+
+    mask->item[1].ranges = ranges;
+    bt_assert_msg(as_path_match(path, mask) == expected, "Compiled set mismatch for ASN %u", asn);
+
+    /* Single-segment path accessors */
+    u32 last;
+    bt_assert(as_path_getlen(path) == 3);
+    bt_assert(as_path_get_last(path, &last) && (last == 1000));
+  }
+
+  rfree(lp);
+  return 1;
+}
+
 static int
 t_path_format(void)
 {
@@ -204,14 +262,52 @@ t_as_path_converting(void)
 }
 #endif
 
+static void
+b_as_path_match(uint n)
+{
+  static struct adata *paths[16];
+  static struct f_path_mask *mask;
+
+  if (!mask)
+  {
+    struct linpool *lp = lp_new_default(&root_pool);
+
+    /* Paths of length 8, half of them containing 65001 */
+    for (uint i = 0; i < 16; i++)
+    {
+      struct adata *path = lp_allocz(lp, sizeof(struct adata));
+      for (uint j = 0; j < 8; j++)
+	path = as_path_prepend(lp, path, ((i % 2) && (j == i % 8)) ? 65001 : 64512 + bt_random() % 1000);
+      paths[i] = path;
+    }
+
+    /* Mask * 65001 * */
+    mask = lp_allocz(lp, sizeof(struct f_path_mask) + 3 * sizeof(struct f_path_mask_item));
+    mask->len = 3;
+    mask->item[0].kind = PM_ASTERISK;
+    mask->item[1].kind = PM_ASN;
+    mask->item[1].asn = 65001;
+    mask->item[2].kind = PM_ASTERISK;
+  }
+
+  uint matched = 0;
+  for (uint i = 0; i < n; i++)
+    matched += as_path_match(paths[i % 16], mask);
+
+  bt_debug("Matched %u\n", matched);
+}
+
 int
 main(int argc, char *argv[])
 {
   bt_init(argc, argv);
 
   bt_test_suite(t_as_path_match, "Testing AS path matching and some a-path utilities.");
+  bt_test_suite(t_as_path_match_set, "Testing AS path matching with compiled ASN sets");
   bt_test_suite(t_path_format, "Testing formating as path into byte buffer");
   bt_test_suite(t_path_include, "Testing including a AS number in AS path");
+
+  bt_bench(b_as_path_match, "Matching AS paths with mask * 65001 *");
   // bt_test_suite(t_as_path_converting, "Testing as_path_convert_to_*() output constancy");
 
   return bt_exit_value();
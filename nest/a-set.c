@@ -14,6 +14,7 @@
 #include "nest/attrs.h"
 #include "lib/resource.h"
 #include "lib/string.h"
+#include "lib/json.h"
 
 /**
  * int_set_format - format an &set for printing
@@ -178,6 +179,64 @@ lc_set_format(const struct adata *set, int from, byte *buf, uint bufsize)
   return 0;
 }
 
+/**
+ * int_set_json - write integer set as JSON
+ * @set: set
+ * @way: write values as pairs of 16-bit numbers (communities)
+ * @w: JSON writer
+ */
+void
+int_set_json(const struct adata *set, int way, struct json_writer *w)
+{
+  u32 *z = int_set_get_data(set);
+  int to = int_set_get_size(set);
+
+  json_open(w, NULL, '[');
+  for (int i = 0; i < to; i++)
+    if (way)
+      json_printf(w, "[%u,%u]", z[i] >> 16, z[i] & 0xffff);
+    else
+      json_put_uint(w, NULL, z[i]);
+  json_close(w, ']');
+}
+
+/**
+ * ec_set_json - write extended community set as JSON
+ * @set: set
+ * @w: JSON writer
+ *
+ * Extended communities are written as pairs of their upper and lower 32 bits,
+ * as 64-bit numbers are not safely representable in JSON.
+ */
+void
+ec_set_json(const struct adata *set, struct json_writer *w)
+{
+  u32 *z = int_set_get_data(set);
+  int to = int_set_get_size(set);
+
+  json_open(w, NULL, '[');
+  for (int i = 0; i < to; i += 2)
+    json_printf(w, "[%u,%u]", z[i], z[i+1]);
+  json_close(w, ']');
+}
+
+/**
+ * lc_set_json - write large community set as JSON
+ * @set: set
+ * @w: JSON writer
+ */
+void
+lc_set_json(const struct adata *set, struct json_writer *w)
+{
+  u32 *z = int_set_get_data(set);
+  int to = int_set_get_size(set);
+
+  json_open(w, NULL, '[');
+  for (int i = 0; i < to; i += 3)
+    json_printf(w, "[%u,%u,%u]", z[i], z[i+1], z[i+2]);
+  json_close(w, ']');
+}
+
 int
 int_set_contains(const struct adata *list, u32 val)
 {
@@ -185,16 +244,53 @@ int_set_contains(const struct adata *list, u32 val)
     return 0;
 
   u32 *l = (u32 *) list->data;
-  int len = int_set_get_size(list);
-  int i;
+  uint len = int_set_get_size(list);
+  uint i = 0;
+
+  /* Blocks without branches between comparisons are vectorized by compiler */
+  for (; i + 4 <= len; i += 4)
+    if ((l[i] == val) | (l[i+1] == val) | (l[i+2] == val) | (l[i+3] == val))
+      return 1;
 
-  for (i = 0; i < len; i++)
-    if (*l++ == val)
+  for (; i < len; i++)
+    if (l[i] == val)
       return 1;
 
   return 0;
 }
 
+/**
+ * int_set_contains_sorted - check membership in a sorted set
+ * @list: set sorted by int_set_sort()
+ * @val: value to look for
+ *
+ * Bisection variant of int_set_contains() for large sets searched repeatedly,
+ * see %INT_SET_BISECT_MIN.
+ */
+int
+int_set_contains_sorted(const struct adata *list, u32 val)
+{
+  if (!list)
+    return 0;
+
+  u32 *l = int_set_get_data(list);
+  int lo = 0, hi = int_set_get_size(list);
+
+  while (lo < hi)
+  {
+    int m = (lo + hi) / 2;
+
+    if (l[m] == val)
+      return 1;
+    else if (l[m] < val)
+      lo = m + 1;
+    else
+      hi = m;
+  }
+
+  return 0;
+}
+
 int
 ec_set_contains(const struct adata *list, u64 val)
 {
@@ -314,19 +410,27 @@ lc_set_add(struct linpool *pool, const struct adata *list, lcomm val)
 const struct adata *
 int_set_del(struct linpool *pool, const struct adata *list, u32 val)
 {
-  if (!int_set_contains(list, val))
+  if (!list)
+    return list;
+
+  u32 *l = int_set_get_data(list);
+  uint len = int_set_get_size(list);
+  uint num = 0;
+
+  /* Count occurrences in one vectorizable pass */
+  for (uint i = 0; i < len; i++)
+    num += (l[i] == val);
+
+  if (!num)
     return list;
 
   struct adata *res;
-  res = lp_alloc(pool, sizeof(struct adata) + list->length - 4);
-  res->length = list->length - 4;
+  res = lp_alloc(pool, sizeof(struct adata) + list->length - 4 * num);
+  res->length = list->length - 4 * num;
 
-  u32 *l = int_set_get_data(list);
   u32 *k = int_set_get_data(res);
-  int len = int_set_get_size(list);
-  int i;
 
-  for (i = 0; i < len; i++)
+  for (uint i = 0; i < len; i++)
     if (l[i] != val)
       *k++ = l[i];
 
@@ -397,9 +501,19 @@ int_set_union(struct linpool *pool, const struct adata *l1, const struct adata *
   u32 *k = tmp;
   int i;
 
-  for (i = 0; i < len; i++)
-    if (!int_set_contains(l1, l[i]))
-      *k++ = l[i];
+  /* Avoid quadratic time for large sets */
+  if ((int_set_get_size(l1) >= INT_SET_BISECT_MIN) && (len >= INT_SET_BISECT_MIN))
+  {
+    const struct adata *s1 = int_set_sort(pool, l1);
+
+    for (i = 0; i < len; i++)
+      if (!int_set_contains_sorted(s1, l[i]))
+	*k++ = l[i];
+  }
+  else
+    for (i = 0; i < len; i++)
+      if (!int_set_contains(l1, l[i]))
+	*k++ = l[i];
 
   if (k == tmp)
     return l1;
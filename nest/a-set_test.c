@@ -108,6 +108,45 @@ t_set_int_union(void)
   return 1;
 }
 
+static int
+t_set_int_union_large(void)
+{
+  resource_init();
+  lp = lp_new_default(&root_pool);
+
+  /* Large enough for bisection in int_set_union() */
+  const int size = 4 * INT_SET_BISECT_MIN;
+  struct adata empty = {};
+  const struct adata *l1 = &empty, *l2 = &empty;
+
+  for (int i = 0; i < size; i++)
+  {
+    l1 = int_set_add(lp, l1, (size - i) * 3);
+    l2 = int_set_add(lp, l2, i * 2);
+  }
+
+  /* Common values are positive multiples of 6 up to 2*(size-1) */
+  const struct adata *set_union = int_set_union(lp, l1, l2);
+  int common = (2 * (size - 1)) / 6;
+  bt_assert_msg(int_set_get_size(set_union) == 2 * size - common,
+		"int_set_get_size(set_union) %d, expected %d", int_set_get_size(set_union), 2 * size - common);
+
+  for (int i = 0; i < size; i++)
+  {
+    bt_assert(int_set_contains(set_union, (size - i) * 3));
+    bt_assert(int_set_contains(set_union, i * 2));
+  }
+
+  const struct adata *sorted = int_set_sort(lp, set_union);
+  for (int i = 0; i < size; i++)
+    bt_assert(int_set_contains_sorted(sorted, i * 2));
+  bt_assert(!int_set_contains_sorted(sorted, 1));
+  bt_assert(!int_set_contains_sorted(sorted, 7 * size));
+
+  rfree(lp);
+  return 1;
+}
+
 static int
 t_set_int_format(void)
 {
@@ -240,6 +279,46 @@ t_set_ec_delete(void)
   return 1;
 }
 
+#define BENCH_SET_SIZE 20
+
+static void
+b_int_set_contains(uint n)
+{
+  static const struct adata *set;
+
+  if (!set)
+  {
+    generate_set_sequence(SET_TYPE_INT, BENCH_SET_SIZE);
+    set = set_sequence;
+  }
+
+  uint found = 0;
+  for (uint i = 0; i < n; i++)
+    found += int_set_contains(set, i % (2 * BENCH_SET_SIZE));
+
+  bt_debug("Found %u\n", found);
+}
+
+static void
+b_int_set_add(uint n)
+{
+  static const struct adata *set;
+  static struct linpool *add_lp;
+
+  if (!set)
+  {
+    generate_set_sequence(SET_TYPE_INT, BENCH_SET_SIZE);
+    set = set_sequence;
+    add_lp = lp_new_default(&root_pool);
+  }
+
+  lp_flush(add_lp);
+
+  for (uint i = 0; i < n; i++)
+    if (!int_set_add(add_lp, set, BENCH_SET_SIZE + i % BENCH_SET_SIZE))
+      bt_abort();
+}
+
 int
 main(int argc, char *argv[])
 {
@@ -248,6 +327,7 @@ main(int argc, char *argv[])
   bt_test_suite(t_set_int_contains, "Testing sets of integers: contains, get_data");
   bt_test_suite(t_set_int_format,   "Testing sets of integers: format");
   bt_test_suite(t_set_int_union,    "Testing sets of integers: union");
+  bt_test_suite(t_set_int_union_large, "Testing sets of integers: union of large sets");
   bt_test_suite(t_set_int_delete,   "Testing sets of integers: delete");
 
   bt_test_suite(t_set_ec_contains, "Testing sets of Extended Community values: contains, get_data");
@@ -255,5 +335,8 @@ main(int argc, char *argv[])
   bt_test_suite(t_set_ec_union,    "Testing sets of Extended Community values: union");
   bt_test_suite(t_set_ec_delete,   "Testing sets of Extended Community values: delete");
 
+  bt_bench(b_int_set_contains, "Lookup in set of integers");
+  bt_bench(b_int_set_add, "Adding new value to set of integers");
+
   return bt_exit_value();
 }
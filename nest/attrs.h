@@ -13,6 +13,7 @@
 #include "lib/unaligned.h"
 #include "nest/route.h"
 
+struct json_writer;
 
 /* a-path.c */
 
@@ -41,6 +42,7 @@ struct adata *as_path_to_old(struct linpool *pool, const struct adata *path);
 struct adata *as_path_cut(struct linpool *pool, const struct adata *path, uint num);
 const struct adata *as_path_merge(struct linpool *pool, const struct adata *p1, const struct adata *p2);
 void as_path_format(const struct adata *path, byte *buf, uint size);
+void as_path_json(const struct adata *path, struct json_writer *w);
 int as_path_getlen(const struct adata *path);
 int as_path_getlen_int(const struct adata *path, int bs);
 int as_path_get_first(const struct adata *path, u32 *orig_as);
@@ -67,7 +69,10 @@ struct f_path_mask_item {
   union {
     u32 asn; /* PM_ASN */
     const struct f_line *expr; /* PM_ASN_EXPR */
-    const struct f_tree *set; /* PM_ASN_SET */
+    struct { /* PM_ASN_SET */
+      const struct f_tree *set;
+      const struct adata *ranges; /* Intervals of set, see as_path_compile_set() */
+    };
     struct { /* PM_ASN_RANGE */
       u32 from;
       u32 to;
@@ -82,6 +87,7 @@ struct f_path_mask {
 };
 
 int as_path_match(const struct adata *path, const struct f_path_mask *mask);
+const struct adata *as_path_compile_set(struct linpool *pool, const struct f_tree *set);
 
 
 /* Counterparts to appropriate as_path_* functions */
@@ -195,12 +201,19 @@ static inline u32 *lc_copy(u32 *dst, const u32 *src)
 { memcpy(dst, src, LCOMM_LENGTH); return dst + 3; }
 
 
+/* Sets at least this large are searched repeatedly in a sorted copy */
+#define INT_SET_BISECT_MIN	16
+
 int int_set_format(const struct adata *set, int way, int from, byte *buf, uint size);
 int ec_format(byte *buf, u64 ec);
 int ec_set_format(const struct adata *set, int from, byte *buf, uint size);
 int lc_format(byte *buf, lcomm lc);
 int lc_set_format(const struct adata *set, int from, byte *buf, uint size);
+void int_set_json(const struct adata *set, int way, struct json_writer *w);
+void ec_set_json(const struct adata *set, struct json_writer *w);
+void lc_set_json(const struct adata *set, struct json_writer *w);
 int int_set_contains(const struct adata *list, u32 val);
+int int_set_contains_sorted(const struct adata *list, u32 val);
 int ec_set_contains(const struct adata *list, u64 val);
 int lc_set_contains(const struct adata *list, lcomm val);
 const struct adata *int_set_prepend(struct linpool *pool, const struct adata *list, u32 val);
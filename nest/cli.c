@@ -61,12 +61,26 @@
  * queue, it calls cli_written(), tha frees all buffers (except the
  * first one) and schedules cli.event .
  *
+ * Long replies are produced by the @cont hook while the previous output
+ * is still being written, but only as long as less than %CLI_TX_MAX_PENDING
+ * bytes wait in the buffer queue. When the consumer has written some of the
+ * buffers, it calls cli_write_progress(), which frees them and resumes the
+ * continuation if enough of the queue has been drained. Therefore, a slow
+ * client just pauses its own reply and each session keeps a bounded amount
+ * of buffered output.
+ *
+ * The continuation is scheduled as a bulk work event (see ev_schedule_work()),
+ * so long replies (e.g. route listings requested by a looking glass) are
+ * produced only within the time budget for bulk work and do not delay
+ * protocol events and timers.
+ *
  */
 
 #include "nest/bird.h"
 #include "nest/cli.h"
 #include "conf/conf.h"
 #include "lib/string.h"
+#include "lib/json.h"
 
 pool *cli_pool;
 
@@ -77,17 +91,21 @@ cli_alloc_out(cli *c, int size)
 
   if (!(o = c->tx_write) || o->wpos + size > o->end)
     {
-      if (!o && c->tx_buf)
+      if (!o && c->tx_buf && (size <= CLI_TX_BUF_SIZE))
 	o = c->tx_buf;
       else
 	{
-	  o = mb_alloc(c->pool, sizeof(struct cli_out) + CLI_TX_BUF_SIZE);
+	  /* Long lines (e.g. JSON output) get a dedicated buffer */
+	  uint bsize = MAX(size, CLI_TX_BUF_SIZE);
+	  o = mb_alloc(c->pool, sizeof(struct cli_out) + bsize);
 	  if (c->tx_write)
 	    c->tx_write->next = o;
+	  else if (c->tx_buf)
+	    c->tx_buf->next = o;
 	  else
 	    c->tx_buf = o;
 	  o->wpos = o->outpos = o->buf;
-	  o->end = o->buf + CLI_TX_BUF_SIZE;
+	  o->end = o->buf + bsize;
 	}
       c->tx_write = o;
       if (!c->tx_pos)
@@ -160,6 +178,58 @@ cli_printf(cli *c, int code, char *msg, ...)
   memcpy(cli_alloc_out(c, size), buf, size);
 }
 
+static struct json_writer cli_json;
+
+/**
+ * cli_json_begin - start a JSON reply line
+ *
+ * Returns a JSON writer shared by all CLI sessions. The caller writes one
+ * JSON value to it and then passes it to cli_json_end() before returning
+ * to the main loop. Unlike cli_printf(), the line length is not limited.
+ */
+struct json_writer *
+cli_json_begin(void)
+{
+  if (!cli_json.start)
+    json_init(&cli_json, CLI_TX_BUF_SIZE);
+
+  json_reset(&cli_json);
+  return &cli_json;
+}
+
+/**
+ * cli_json_end - send a JSON reply line
+ * @c: CLI connection
+ * @code: numeric code of the reply, like in cli_printf()
+ */
+void
+cli_json_end(cli *c, int code)
+{
+  byte prefix[8];
+  int cd = code;
+  uint plen;
+
+  /* Always use full prefix, so each line can be parsed separately */
+  if (cd < 0)
+    {
+      cd = -cd;
+      plen = bsprintf(prefix, "%04d-", cd);
+    }
+  else
+    {
+      plen = bsprintf(prefix, "%04d ", cd);
+      cd = 0;
+    }
+
+  c->last_reply = cd;
+
+  uint len = json_length(&cli_json);
+  byte *out = cli_alloc_out(c, plen + len + 1);
+  memcpy(out, prefix, plen);
+  memcpy(out + plen, cli_json.start, len);
+  out[plen + len] = '\n';
+}
+
 static void
 cli_copy_message(cli *c)
 {
@@ -222,11 +292,63 @@ cli_free_out(cli *c)
   c->async_msg_size = 0;
 }
 
+static inline void
+cli_resume(cli *c)
+{
+  if (c->cont)
+    ev_schedule_work(c->event);
+  else
+    ev_schedule(c->event);
+}
+
 void
 cli_written(cli *c)
 {
   cli_free_out(c);
-  ev_schedule(c->event);
+  cli_resume(c);
+}
+
+/**
+ * cli_out_pending - get size of unwritten output
+ * @c: CLI connection
+ *
+ * Returns the number of bytes in the TX buffer queue which have not been
+ * passed to the consumer yet. Continuation routines may use it to stop
+ * early when the reply is produced faster than the client reads it.
+ */
+uint
+cli_out_pending(cli *c)
+{
+  uint size = 0;
+
+  for (struct cli_out *o = c->tx_pos; o; o = o->next)
+    size += o->wpos - o->outpos;
+
+  return size;
+}
+
+/**
+ * cli_write_progress - release written output
+ * @c: CLI connection
+ *
+ * This function is called by the consumer after some, but not all TX
+ * buffers were written. Buffers before cli.tx_pos are freed and the
+ * continuation is resumed when the unwritten output dropped below half of
+ * %CLI_TX_MAX_PENDING.
+ */
+void
+cli_write_progress(cli *c)
+{
+  struct cli_out *o;
+
+  while ((o = c->tx_buf) && c->tx_pos && (o != c->tx_pos))
+    {
+      c->tx_buf = o->next;
+      mb_free(o);
+    }
+
+  if (c->cont && (cli_out_pending(c) < CLI_TX_MAX_PENDING / 2))
+    ev_schedule_work(c->event);
 }
 
 
@@ -287,10 +409,16 @@ cli_event(void *data)
       c->async_msg_size < CLI_MAX_ASYNC_QUEUE)
     cli_copy_message(c);
 
-  if (c->tx_pos)
+  if (c->cont && (cli_out_pending(c) < CLI_TX_MAX_PENDING))
+    {
+      c->cont(c);
+
+      /* Continue while the client keeps up, writes will resume us otherwise */
+      if (c->cont && (cli_out_pending(c) < CLI_TX_MAX_PENDING))
+	ev_schedule_work(c->event);
+    }
+  else if (c->tx_pos || c->cont)
     ;
-  else if (c->cont)
-    c->cont(c);
   else
     {
       err = cli_get_command(c);
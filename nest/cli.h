@@ -15,6 +15,7 @@
 #define CLI_RX_BUF_SIZE 4096
 #define CLI_TX_BUF_SIZE 4096
 #define CLI_MAX_ASYNC_QUEUE 4096
+#define CLI_TX_MAX_PENDING (64 * 1024)	/* Continuation pauses with more unwritten output */
 
 #define CLI_MSG_SIZE 500
 #define CLI_LINE_SIZE 512
@@ -57,6 +58,13 @@ extern struct cli *this_cli;		/* Used during parsing */
 void cli_printf(cli *, int, char *, ...);
 #define cli_msg(x...) cli_printf(this_cli, x)
 void cli_set_log_echo(cli *, uint mask, uint size);
+uint cli_out_pending(cli *c);
+
+#define CLI_JSON_CODE 1027		/* Reply code of JSON output lines */
+
+struct json_writer;
+struct json_writer *cli_json_begin(void);
+void cli_json_end(cli *c, int code);
 
 static inline void cli_separator(cli *c)
 { if (c->last_reply) cli_printf(c, -c->last_reply, ""); };
@@ -68,6 +76,7 @@ void cli_init(void);
 void cli_free(cli *);
 void cli_kick(cli *);
 void cli_written(cli *);
+void cli_write_progress(cli *);
 void cli_echo(uint class, byte *msg);
 
 static inline int cli_access_restricted(void)
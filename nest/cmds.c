@@ -83,14 +83,108 @@ print_size(char *dsc, size_t val)
 extern pool *rt_table_pool;
 extern pool *rta_pool;
 
+static void
+print_rta_stats(struct rta_stats *st)
+{
+  cli_msg(-1018, "%-17s %8u %8u %7u.%02u %8u %8u %8u %8u", st->proto ? st->proto->name : "Total:",
+	  st->count, st->refs, st->refs / (st->count ?: 1), (st->refs * 100 / (st->count ?: 1)) % 100,
+	  (uint) (st->rta_mem >> 10), (uint) (st->nh_mem >> 10),
+	  (uint) (st->ea_mem >> 10), (uint) (st->adata_mem >> 10));
+}
+
+/* Memory of a protocol instance, including its structures outside its pool */
+static size_t
+proto_memsize(struct proto *p)
+{
+  size_t size = rmemsize(p->pool) + p->proto->proto_size + ALLOC_OVERHEAD;
+
+  struct channel *c;
+  WALK_LIST(c, p->channels)
+    size += c->channel->channel_size + ALLOC_OVERHEAD;
+
+  return size;
+}
+
+static void
+cmd_show_memory_protocols(void)
+{
+  uint count[PROTOCOL__MAX] = {};
+  size_t size[PROTOCOL__MAX] = {};
+
+  struct proto *p;
+  WALK_LIST(p, proto_list)
+  {
+    count[p->proto->class]++;
+    size[p->proto->class] += proto_memsize(p);
+  }
+
+  cli_msg(-1018, "");
+  cli_msg(-1018, "Protocol instances:");
+  cli_msg(-1018, "%-17s %8s %8s %8s", "Protocol", "Count", "kB", "B each");
+  for (uint i = 0; i < PROTOCOL__MAX; i++)
+    if (count[i])
+      cli_msg(-1018, "%-17s %8u %8u %8u", class_to_protocol[i]->name, count[i],
+	      (uint) (size[i] >> 10), (uint) (size[i] / count[i]));
+}
+
+static void
+cmd_show_memory_details(void)
+{
+  struct rmem_stat ms = {};
+  rmemstat(&root_pool, &ms);
+
+  cli_msg(-1018, "");
+  cli_msg(-1018, "By resource class:");
+  for (uint i = 0; i < ms.num; i++)
+  {
+    char dsc[32];
+    bsnprintf(dsc, sizeof(dsc), "%s:", ms.cls[i].name);
+    print_size(dsc, ms.cls[i].size);
+  }
+
+  cmd_show_memory_protocols();
+
+  struct rta_stats total, *ps;
+  uint pn = rta_get_stats(&total, &ps, this_cli->parser_pool);
+
+  cli_msg(-1018, "");
+  cli_msg(-1018, "Route attribute cache:");
+  cli_msg(-1018, "Lookups:          %8lu, hits %lu (%u%%)", total.lookups, total.hits,
+	  (uint) (total.hits * 100 / (total.lookups ?: 1)));
+  cli_msg(-1018, "Hash table:       %8u slots, %u used, longest chain %u",
+	  total.size, total.chains, total.max_chain);
+  cli_msg(-1018, "%-17s %8s %8s %10s %8s %8s %8s %8s", "Protocol", "Entries", "Refs", "Dedup",
+	  "rta kB", "nh kB", "ea kB", "data kB");
+  for (uint i = 0; i < pn; i++)
+    print_rta_stats(&ps[i]);
+  print_rta_stats(&total);
+
+  struct hash_stats hs[2];
+  const char *hn[2] = { "Route sources:", "Attribute data:" };
+  rta_get_hash_stats(&hs[0], &hs[1]);
+
+  cli_msg(-1018, "");
+  cli_msg(-1018, "Other hash tables:");
+  for (uint i = 0; i < 2; i++)
+    cli_msg(-1018, "%-17s %8u entries, %u slots, %u used, longest chain %u",
+	    hn[i], hs[i].count, hs[i].size, hs[i].used, hs[i].max_chain);
+}
+
 void
-cmd_show_memory(void)
+cmd_show_memory(int verbose)
 {
   cli_msg(-1018, "BIRD memory usage");
   print_size("Routing tables:", rmemsize(rt_table_pool));
   print_size("Route attributes:", rmemsize(rta_pool));
   print_size("Protocols:", rmemsize(proto_pool));
   print_size("Total:", rmemsize(&root_pool));
+
+  if (slab_graveyard_size())
+    print_size("Being freed:", slab_graveyard_size());
+
+  if (verbose)
+    cmd_show_memory_details();
+
   cli_msg(0, "");
 }
 
@@ -15,7 +15,7 @@ struct f_inst;
 
 void cmd_show_status(void);
 void cmd_show_symbols(struct sym_show_data *sym);
-void cmd_show_memory(void);
+void cmd_show_memory(int verbose);
 
 struct f_line;
 void cmd_eval(const struct f_line *expr);
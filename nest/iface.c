@@ -21,6 +21,11 @@
  * The interface module keeps a `soft-up' state for each &iface which
  * is a conjunction of link being up, the interface being of a `sane'
  * type and at least one IP address assigned to it.
+ *
+ * Interfaces are indexed by name and by index in hash tables, addresses are
+ * indexed by their IP address and by their network prefix (or by the opposite
+ * address for peer addresses), so lookups of interfaces and of interfaces
+ * directly connected to a given address do not have to walk all of them.
  */
 
 #undef LOCAL_DEBUG
@@ -31,12 +36,89 @@
 #include "nest/cli.h"
 #include "lib/resource.h"
 #include "lib/string.h"
+#include "lib/hash.h"
 #include "conf/conf.h"
 #include "sysdep/unix/krt.h"
 
 static pool *if_pool;
 
 list iface_list;
+static uint if_list_pos;
+
+#define IFN_KEY(i)		i->name
+#define IFN_NEXT(i)		i->next_name
+#define IFN_EQ(n1,n2)		!strcmp(n1, n2)
+#define IFN_FN(n)		mem_hash(n, strlen(n))
+
+#define IFN_REHASH		if_name_rehash
+#define IFN_PARAMS		/8, *2, 2, 2, 4, 16
+
+#define IFI_KEY(i)		i->index
+#define IFI_NEXT(i)		i->next_index
+#define IFI_EQ(i1,i2)		i1 == i2
+#define IFI_FN(i)		u32_hash(i)
+
+#define IFI_REHASH		if_index_rehash
+#define IFI_PARAMS		/8, *2, 2, 2, 4, 16
+
+#define IAH_KEY(a)		a->ip
+#define IAH_NEXT(a)		a->next_ip
+#define IAH_EQ(a1,a2)		ipa_equal(a1, a2)
+#define IAH_FN(a)		ipa_hash(a)
+
+#define IAH_REHASH		ifa_ip_rehash
+#define IAH_PARAMS		/8, *2, 2, 2, 4, 16
+
+/* Prefix class is the prefix length, with IFA_NET_IP6 flag for IPv6 */
+#define IFA_NET_IP6		0x100
+
+#define IAN_KEY(a)		ifa_net_key(a), ifa_net_class(a)
+#define IAN_NEXT(a)		a->next_net
+#define IAN_EQ(a1,c1,a2,c2)	c1 == c2 && ipa_equal(a1, a2)
+#define IAN_FN(a,c)		ipa_hash(a) ^ u32_hash(c)
+
+#define IAN_REHASH		ifa_net_rehash
+#define IAN_PARAMS		/8, *2, 2, 2, 4, 16
+
+static HASH(struct iface) if_name_hash;
+static HASH(struct iface) if_index_hash;
+static HASH(struct ifa) ifa_ip_hash;
+static HASH(struct ifa) ifa_net_hash;
+
+/* Number of indexed addresses with given prefix class */
+static uint ifa_net_classes[IFA_NET_IP6 + IP6_MAX_PREFIX_LENGTH + 1];
+
+static inline uint
+ifa_net_class(struct ifa *a)
+{
+  if (a->flags & IA_PEER)
+    return (a->prefix.type == NET_IP4) ? IP4_MAX_PREFIX_LENGTH : (IFA_NET_IP6 | IP6_MAX_PREFIX_LENGTH);
+
+  return (a->prefix.type == NET_IP4) ? net_pxlen(&a->prefix) : (IFA_NET_IP6 | net_pxlen(&a->prefix));
+}
+
+static inline ip_addr
+ifa_net_mask(ip_addr a, uint class)
+{
+  if (class & IFA_NET_IP6)
+    return ipa_and(a, ip6_mkmask(class & ~IFA_NET_IP6));
+  else
+    return ipa_from_ip4(ip4_and(ipa_to_ip4(a), ip4_mkmask(class)));
+}
+
+static inline ip_addr
+ifa_net_key(struct ifa *a)
+{
+  if (a->flags & IA_PEER)
+    return a->opposite;
+
+  return ifa_net_mask(net_prefix(&a->prefix), ifa_net_class(a));
+}
+
+HASH_DEFINE_REHASH_FN(IFN, struct iface)
+HASH_DEFINE_REHASH_FN(IFI, struct iface)
+HASH_DEFINE_REHASH_FN(IAH, struct ifa)
+HASH_DEFINE_REHASH_FN(IAN, struct ifa)
 
 static void if_recalc_preferred(struct iface *i);
 
@@ -301,33 +383,35 @@ if_update(struct iface *new)
   struct iface *i;
   unsigned c;
 
-  WALK_LIST(i, iface_list)
-    if (!strcmp(new->name, i->name))
+  i = HASH_FIND(if_name_hash, IFN, new->name);
+  if (i)
+  {
+    new->flags = if_recalc_flags(new, new->flags);
+    c = if_what_changed(i, new);
+    if (c & IF_CHANGE_TOO_MUCH)	/* Changed a lot, convert it to down/up */
       {
-	new->flags = if_recalc_flags(new, new->flags);
-	c = if_what_changed(i, new);
-	if (c & IF_CHANGE_TOO_MUCH)	/* Changed a lot, convert it to down/up */
-	  {
-	    DBG("Interface %s changed too much -- forcing down/up transition\n", i->name);
-	    if_change_flags(i, i->flags | IF_TMP_DOWN);
-	    rem_node(&i->n);
-	    new->addr4 = i->addr4;
-	    new->addr6 = i->addr6;
-	    new->llv6 = i->llv6;
-	    new->sysdep = i->sysdep;
-	    memcpy(&new->addrs, &i->addrs, sizeof(i->addrs));
-	    memcpy(i, new, sizeof(*i));
-	    i->flags &= ~IF_UP;		/* IF_TMP_DOWN will be added later */
-	    goto newif;
-	  }
+	DBG("Interface %s changed too much -- forcing down/up transition\n", i->name);
+	if_change_flags(i, i->flags | IF_TMP_DOWN);
+	rem_node(&i->n);
+	HASH_REMOVE2(if_name_hash, IFN, if_pool, i);
+	HASH_REMOVE2(if_index_hash, IFI, if_pool, i);
+	new->addr4 = i->addr4;
+	new->addr6 = i->addr6;
+	new->llv6 = i->llv6;
+	new->sysdep = i->sysdep;
+	memcpy(&new->addrs, &i->addrs, sizeof(i->addrs));
+	memcpy(i, new, sizeof(*i));
+	i->flags &= ~IF_UP;		/* IF_TMP_DOWN will be added later */
+	goto newif;
+      }
 
-	if_copy(i, new);
-	if (c)
-	  if_notify_change(c, i);
+    if_copy(i, new);
+    if (c)
+      if_notify_change(c, i);
 
-	i->flags |= IF_UPDATED;
-	return i;
-      }
+    i->flags |= IF_UPDATED;
+    return i;
+  }
   i = mb_alloc(if_pool, sizeof(struct iface));
   memcpy(i, new, sizeof(*i));
   init_list(&i->addrs);
@@ -335,6 +419,9 @@ newif:
   init_list(&i->neighbors);
   i->flags |= IF_UPDATED | IF_TMP_DOWN;		/* Tmp down as we don't have addresses yet */
   add_tail(&iface_list, &i->n);
+  i->list_pos = ++if_list_pos;
+  HASH_INSERT2(if_name_hash, IFN, if_pool, i);
+  HASH_INSERT2(if_index_hash, IFI, if_pool, i);
   return i;
 }
 
@@ -427,9 +514,8 @@ if_feed_baby(struct proto *p)
 struct iface *
 if_find_by_index(unsigned idx)
 {
-  struct iface *i;
-
-  WALK_LIST(i, iface_list)
+  /* Shut down interfaces may share index with the current one */
+  for (struct iface *i = *HASH_CHAIN(if_index_hash, IFI, idx); i; i = i->next_index)
     if (i->index == idx && !(i->flags & IF_SHUTDOWN))
       return i;
   return NULL;
@@ -446,22 +532,18 @@ if_find_by_index(unsigned idx)
 struct iface *
 if_find_by_name(const char *name)
 {
-  struct iface *i;
+  struct iface *i = HASH_FIND(if_name_hash, IFN, name);
 
-  WALK_LIST(i, iface_list)
-    if (!strcmp(i->name, name) && !(i->flags & IF_SHUTDOWN))
-      return i;
-  return NULL;
+  return (i && !(i->flags & IF_SHUTDOWN)) ? i : NULL;
 }
 
 struct iface *
 if_get_by_name(const char *name)
 {
-  struct iface *i;
+  struct iface *i = HASH_FIND(if_name_hash, IFN, name);
 
-  WALK_LIST(i, iface_list)
-    if (!strcmp(i->name, name))
-      return i;
+  if (i)
+    return i;
 
   /* No active iface, create a dummy */
   i = mb_allocz(if_pool, sizeof(struct iface));
@@ -470,6 +552,9 @@ if_get_by_name(const char *name)
   init_list(&i->addrs);
   init_list(&i->neighbors);
   add_tail(&iface_list, &i->n);
+  i->list_pos = ++if_list_pos;
+  HASH_INSERT2(if_name_hash, IFN, if_pool, i);
+  HASH_INSERT2(if_index_hash, IFI, if_pool, i);
   return i;
 }
 
@@ -570,6 +655,90 @@ ifa_same(struct ifa *a, struct ifa *b)
   return ipa_equal(a->ip, b->ip) && net_equal(&a->prefix, &b->prefix);
 }
 
+static void
+ifa_index_add(struct ifa *a)
+{
+  HASH_INSERT2(ifa_ip_hash, IAH, if_pool, a);
+  HASH_INSERT2(ifa_net_hash, IAN, if_pool, a);
+  ifa_net_classes[ifa_net_class(a)]++;
+}
+
+static void
+ifa_index_remove(struct ifa *a)
+{
+  HASH_REMOVE2(ifa_ip_hash, IAH, if_pool, a);
+  HASH_REMOVE2(ifa_net_hash, IAN, if_pool, a);
+  ifa_net_classes[ifa_net_class(a)]--;
+}
+
+static inline int
+if_add_candidate(struct iface **ifs, int n, uint max, struct iface *i)
+{
+  int k;
+
+  for (k = 0; k < n; k++)
+    if (ifs[k] == i)
+      return n;
+
+  if ((uint) n >= max)
+    return -1;
+
+  /* Keep candidates in iface_list order */
+  for (k = n; (k > 0) && (ifs[k-1]->list_pos > i->list_pos); k--)
+    ifs[k] = ifs[k-1];
+
+  ifs[k] = i;
+  return n + 1;
+}
+
+static int
+if_add_net_candidates(ip_addr a, uint lo, uint hi, struct iface **ifs, int n, uint max)
+{
+  for (uint c = lo; (c <= hi) && (n >= 0); c++)
+  {
+    if (!ifa_net_classes[c])
+      continue;
+
+    ip_addr px = ifa_net_mask(a, c);
+    for (struct ifa *b = *HASH_CHAIN(ifa_net_hash, IAN, px, c); b && (n >= 0); b = b->next_net)
+      if (IAN_EQ(ifa_net_key(b), ifa_net_class(b), px, c))
+	n = if_add_candidate(ifs, n, max, b->iface);
+  }
+
+  return n;
+}
+
+/**
+ * if_connected_candidates - find interfaces possibly connected to an address
+ * @a: IP address
+ * @ifs: array to be filled with found interfaces
+ * @max: size of @ifs
+ *
+ * This function uses the address indexes to find all interfaces which have an
+ * address equal to @a, a peer address with opposite end @a, or a prefix
+ * containing @a. These are the only interfaces for which if_connected() may
+ * find @a directly connected without %NEF_IFACE or %NEF_ONLINK flags.
+ *
+ * Result: Number of interfaces stored in @ifs in the order of &iface_list, or
+ * -1 if there are more than @max of them.
+ */
+int
+if_connected_candidates(ip_addr a, struct iface **ifs, uint max)
+{
+  int n = 0;
+
+  for (struct ifa *b = *HASH_CHAIN(ifa_ip_hash, IAH, a); b && (n >= 0); b = b->next_ip)
+    if (ipa_equal(b->ip, a))
+      n = if_add_candidate(ifs, n, max, b->iface);
+
+  if (ipa_is_ip4(a))
+    n = if_add_net_candidates(a, 0, IP4_MAX_PREFIX_LENGTH, ifs, n, max);
+
+  n = if_add_net_candidates(a, IFA_NET_IP6, IFA_NET_IP6 | IP6_MAX_PREFIX_LENGTH, ifs, n, max);
+
+  return n;
+}
+
 
 /**
  * ifa_update - update interface address
@@ -606,6 +775,7 @@ ifa_update(struct ifa *a)
   b = mb_alloc(if_pool, sizeof(struct ifa));
   memcpy(b, a, sizeof(struct ifa));
   add_tail(&i->addrs, &b->n);
+  ifa_index_add(b);
   b->flags |= IA_UPDATED;
 
   i->flags |= IF_NEEDS_RECALC;
@@ -632,6 +802,7 @@ ifa_delete(struct ifa *a)
     if (ifa_same(b, a))
       {
 	rem_node(&b->n);
+	ifa_index_remove(b);
 
 	if (b->flags & IA_PRIMARY)
 	  {
@@ -711,6 +882,10 @@ if_init(void)
 {
   if_pool = rp_new(&root_pool, "Interfaces");
   init_list(&iface_list);
+  HASH_INIT(if_name_hash, if_pool, 4);
+  HASH_INIT(if_index_hash, if_pool, 4);
+  HASH_INIT(ifa_ip_hash, if_pool, 4);
+  HASH_INIT(ifa_net_hash, if_pool, 4);
   neigh_init(if_pool);
 }
 
@@ -26,6 +26,7 @@ struct ifa {				/* Interface address */
   ip_addr opposite;			/* Opposite end of a point-to-point link */
   unsigned scope;			/* Interface address scope */
   unsigned flags;			/* Analogous to iface->flags */
+  struct ifa *next_ip, *next_net;	/* Address hash links, see iface.c */
 };
 
 struct iface {
@@ -42,6 +43,8 @@ struct iface {
   struct ifa *llv6;			/* Primary link-local address for IPv6 */
   ip4_addr sysdep;			/* Arbitrary IPv4 address for internal sysdep use */
   list neighbors;			/* All neighbors on this interface */
+  struct iface *next_name, *next_index;	/* Interface hash links, see iface.c */
+  uint list_pos;			/* Order in iface_list, see if_connected_candidates() */
 };
 
 #define IF_UP 1				/* Currently just IF_ADMIN_UP */
@@ -117,6 +120,7 @@ void if_feed_baby(struct proto *);
 struct iface *if_find_by_index(unsigned);
 struct iface *if_find_by_name(const char *);
 struct iface *if_get_by_name(const char *);
+int if_connected_candidates(ip_addr a, struct iface **ifs, uint max);
 void if_recalc_all_preferred_addresses(void);
 
 
@@ -125,6 +129,7 @@ void if_recalc_all_preferred_addresses(void);
 typedef struct neighbor {
   node n;				/* Node in neighbor hash table chain */
   node if_n;				/* Node in per-interface neighbor list */
+  node notify_n;			/* Node in pending notification list */
   ip_addr addr;				/* Address of the neighbor */
   struct ifa *ifa;			/* Ifa on related iface */
   struct iface *iface;			/* Interface it's connected to */
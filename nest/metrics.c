@@ -0,0 +1,567 @@
+/*
+ *	BIRD Internet Routing Daemon -- Metrics Endpoint
+ *
+ *	Can be freely distributed and used under the terms of the GNU GPL.
+ */
+
+/**
+ * DOC: Metrics endpoint
+ *
+ * The metrics endpoint serves counters of BIRD over HTTP in the Prometheus
+ * text exposition format, so monitoring does not have to scrape the CLI and
+ * parse its human-readable tables. The output is generated directly from
+ * channel statistics, routing tables, memory pool totals, main loop latency
+ * histograms and protocol specific counters, which protocols provide by the @metrics and
+ * @get_metrics fields of &protocol.
+ *
+ * The endpoint runs in the main loop. Each request is answered by a single
+ * pass over protocols and tables, the response is then sent from its buffer
+ * and the connection is closed. The number of concurrent connections is
+ * limited, so slow clients cannot accumulate many responses in memory.
+ */
+
+#include <stdlib.h>
+
+#include "nest/bird.h"
+#include "nest/protocol.h"
+#include "nest/route.h"
+#include "nest/metrics.h"
+#include "conf/conf.h"
+#include "lib/event.h"
+#include "lib/histogram.h"
+#include "lib/socket.h"
+#include "lib/string.h"
+
+#define METRICS_HEADER_SIZE	256	/* Space reserved for HTTP response header */
+
+struct metrics_client {
+  node n;
+  sock *sk;
+  byte *out;				/* Response buffer, xmalloc'ed */
+};
+
+static pool *metrics_pool;
+static sock *metrics_sk;
+static list metrics_clients;
+static uint metrics_client_count;
+static struct metrics_config metrics_cf;
+
+
+/*
+ *	Serialization
+ */
+
+/**
+ * metrics_print - append formatted text to metrics output
+ * @b: output buffer, allocated by xmalloc()
+ * @fmt: format string
+ *
+ * Like buffer_print(), but the buffer grows as needed.
+ */
+void
+metrics_print(buffer *b, const char *fmt, ...)
+{
+  va_list args;
+
+  while (1)
+  {
+    va_start(args, fmt);
+    int n = bvsnprintf(b->pos, b->end - b->pos, fmt, args);
+    va_end(args);
+
+    if (n >= 0)
+    {
+      b->pos += n;
+      return;
+    }
+
+    uint used = b->pos - b->start;
+    uint size = 2 * (b->end - b->start);
+
+    b->start = xrealloc(b->start, size);
+    b->pos = b->start + used;
+    b->end = b->start + size;
+  }
+}
+
+static inline void
+metrics_header(buffer *b, const char *name, const char *help, const char *type)
+{
+  metrics_print(b, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+/* Upper bounds of exported histogram buckets */
+static const u64 metrics_histogram_bounds[] = {
+  1, 4, 16, 64, 256, 1024, 4096, 16384, 65536, 262144, 1048576, 4194304, 16777216,
+};
+
+/**
+ * metrics_histogram - write a histogram in metrics output
+ * @b: output buffer
+ * @name: metric name
+ * @labels: labels for all samples, without braces
+ * @h: histogram
+ *
+ * Histogram buckets are exported with fixed bounds growing by the factor of
+ * four, buckets of &histogram are summed to them. The header of the metric
+ * has to be written by the caller.
+ */
+void
+metrics_histogram(buffer *b, const char *name, const char *labels, const struct histogram *h)
+{
+  u64 count = 0;
+  uint i = 0;
+
+  for (uint j = 0; j < ARRAY_SIZE(metrics_histogram_bounds); j++)
+  {
+    u64 le = metrics_histogram_bounds[j];
+
+    for (; (i < HISTOGRAM_BUCKETS) && (histogram_bucket_max(i) <= le); i++)
+      count += h->bucket[i];
+
+    metrics_print(b, "%s_bucket{%s,le=\"%lu\"} %lu\n", name, labels, le, count);
+  }
+
+  metrics_print(b, "%s_bucket{%s,le=\"+Inf\"} %lu\n", name, labels, h->count);
+  metrics_print(b, "%s_sum{%s} %lu\n", name, labels, h->sum);
+  metrics_print(b, "%s_count{%s} %lu\n", name, labels, h->count);
+}
+
+struct metrics_channel_stat {
+  const char *name;
+  const char *help;
+  const char *labels;
+  uint offset;				/* Offset in &proto_stats */
+};
+
+#define STAT(n, h, l, f) { n, h, l, OFFSETOF(struct proto_stats, f) }
+
+/* Stats with the same name must be adjacent */
+static const struct metrics_channel_stat metrics_channel_stats[] = {
+  STAT("bird_channel_routes", "Number of routes of channel", "kind=\"imported\"", imp_routes),
+  STAT("bird_channel_routes", "", "kind=\"filtered\"", filt_routes),
+  STAT("bird_channel_routes", "", "kind=\"exported\"", exp_routes),
+  STAT("bird_channel_routes", "", "kind=\"preferred\"", pref_routes),
+  STAT("bird_channel_import_updates_total", "Number of route updates imported by channel", "result=\"received\"", imp_updates_received),
+  STAT("bird_channel_import_updates_total", "", "result=\"invalid\"", imp_updates_invalid),
+  STAT("bird_channel_import_updates_total", "", "result=\"filtered\"", imp_updates_filtered),
+  STAT("bird_channel_import_updates_total", "", "result=\"ignored\"", imp_updates_ignored),
+  STAT("bird_channel_import_updates_total", "", "result=\"accepted\"", imp_updates_accepted),
+  STAT("bird_channel_import_withdraws_total", "Number of route withdraws imported by channel", "result=\"received\"", imp_withdraws_received),
+  STAT("bird_channel_import_withdraws_total", "", "result=\"invalid\"", imp_withdraws_invalid),
+  STAT("bird_channel_import_withdraws_total", "", "result=\"ignored\"", imp_withdraws_ignored),
+  STAT("bird_channel_import_withdraws_total", "", "result=\"accepted\"", imp_withdraws_accepted),
+  STAT("bird_channel_export_updates_total", "Number of route updates exported by channel", "result=\"received\"", exp_updates_received),
+  STAT("bird_channel_export_updates_total", "", "result=\"rejected\"", exp_updates_rejected),
+  STAT("bird_channel_export_updates_total", "", "result=\"filtered\"", exp_updates_filtered),
+  STAT("bird_channel_export_updates_total", "", "result=\"accepted\"", exp_updates_accepted),
+  STAT("bird_channel_export_withdraws_total", "Number of route withdraws exported by channel", "result=\"received\"", exp_withdraws_received),
+  STAT("bird_channel_export_withdraws_total", "", "result=\"accepted\"", exp_withdraws_accepted),
+};
+
+#undef STAT
+
+static void
+metrics_channels(buffer *b)
+{
+  const char *last = NULL;
+
+  for (uint i = 0; i < ARRAY_SIZE(metrics_channel_stats); i++)
+  {
+    const struct metrics_channel_stat *st = &metrics_channel_stats[i];
+
+    if (!last || strcmp(last, st->name))
+      metrics_header(b, st->name, st->help, strstr(st->name, "_total") ? "counter" : "gauge");
+    last = st->name;
+
+    struct proto *p;
+    WALK_LIST(p, proto_list)
+    {
+      struct channel *c;
+      WALK_LIST(c, p->channels)
+      {
+	u32 val = *(u32 *) ((byte *) &c->stats + st->offset);
+	metrics_print(b, "%s{protocol=\"%s\",channel=\"%s\",%s} %u\n",
+		      st->name, p->name, c->name, st->labels, val);
+      }
+    }
+  }
+}
+
+static void
+metrics_channel_latency(buffer *b)
+{
+  const char *name = "bird_channel_export_latency_microseconds";
+  struct proto *p;
+
+  metrics_header(b, name, "Latency of route export from import by channel", "histogram");
+  WALK_LIST(p, proto_list)
+  {
+    struct channel *c;
+    WALK_LIST(c, p->channels)
+      if (c->export_latency)
+      {
+	byte labels[128];
+	bsnprintf(labels, sizeof(labels), "protocol=\"%s\",channel=\"%s\"", p->name, c->name);
+	metrics_histogram(b, name, labels, c->export_latency);
+      }
+  }
+}
+
+static void
+metrics_channel_cpu(buffer *b)
+{
+  if (!config->cpu_accounting)
+    return;
+
+  metrics_header(b, "bird_channel_cpu_seconds_total", "CPU time spent on routes of channel", "counter");
+  struct proto *p;
+  WALK_LIST(p, proto_list)
+  {
+    struct channel *c;
+    WALK_LIST(c, p->channels)
+      for (uint i = CPU_ACCT_FILTER; i < CPU_ACCT_MAX; i++)
+	metrics_print(b, "bird_channel_cpu_seconds_total{protocol=\"%s\",channel=\"%s\",kind=\"%s\"} %lu.%09lu\n",
+		      p->name, c->name, cpu_acct_names[i],
+		      c->cpu.time[i] / 1000000000, c->cpu.time[i] % 1000000000);
+  }
+
+  metrics_header(b, "bird_protocol_cpu_seconds_total", "CPU time spent in rx hooks of protocol", "counter");
+  WALK_LIST(p, proto_list)
+    metrics_print(b, "bird_protocol_cpu_seconds_total{protocol=\"%s\",kind=\"rx\"} %lu.%09lu\n",
+		  p->name, p->cpu.time[CPU_ACCT_RX] / 1000000000, p->cpu.time[CPU_ACCT_RX] % 1000000000);
+}
+
+static void
+metrics_protocols(buffer *b)
+{
+  struct proto *p;
+
+  metrics_header(b, "bird_protocol_up", "Whether protocol is up", "gauge");
+  WALK_LIST(p, proto_list)
+    metrics_print(b, "bird_protocol_up{protocol=\"%s\",type=\"%s\"} %u\n",
+		  p->name, p->proto->name, p->proto_state == PS_UP);
+
+  /* Protocol specific metrics */
+  for (uint cl = 0; cl < PROTOCOL__MAX; cl++)
+  {
+    struct protocol *P = class_to_protocol[cl];
+    if (!P || !P->metrics)
+      continue;
+
+    uint count = 0;
+    while (P->metrics[count].name)
+      count++;
+
+    u64 *vals = alloca(count * sizeof(u64));
+
+    for (uint i = 0; i < count; i++)
+    {
+      const struct proto_metric *m = &P->metrics[i];
+      byte name[64];
+
+      bsnprintf(name, sizeof(name), "bird_%s", m->name);
+      metrics_header(b, name, m->help, m->gauge ? "gauge" : "counter");
+
+      WALK_LIST(p, proto_list)
+	if (p->proto == P)
+	{
+	  P->get_metrics(p, vals);
+	  metrics_print(b, "%s{protocol=\"%s\"} %lu\n", name, p->name, vals[i]);
+	}
+    }
+  }
+}
+
+static void
+metrics_tables(buffer *b)
+{
+  rtable *t;
+
+  metrics_header(b, "bird_table_routes", "Number of routes in table", "gauge");
+  WALK_LIST(t, routing_tables)
+    metrics_print(b, "bird_table_routes{table=\"%s\"} %u\n", t->name, t->rt_count);
+
+  metrics_header(b, "bird_table_networks", "Number of networks in table", "gauge");
+  WALK_LIST(t, routing_tables)
+    metrics_print(b, "bird_table_networks{table=\"%s\"} %u\n", t->name, t->fib.entries);
+
+  metrics_header(b, "bird_table_filtered_routes", "Number of routes rejected by import filter kept in table", "gauge");
+  WALK_LIST(t, routing_tables)
+    metrics_print(b, "bird_table_filtered_routes{table=\"%s\"} %u\n", t->name, t->stats->filtered);
+
+  metrics_header(b, "bird_table_source_routes", "Number of routes in table by source", "gauge");
+  WALK_LIST(t, routing_tables)
+    for (uint i = 0; i < RTS_MAX; i++)
+      if (t->stats->sources[i])
+	metrics_print(b, "bird_table_source_routes{table=\"%s\",source=\"%s\"} %u\n",
+		      t->name, rta_src_names[i], t->stats->sources[i]);
+}
+
+extern pool *rt_table_pool;
+extern pool *rta_pool;
+
+static void
+metrics_memory(buffer *b)
+{
+  /* Pool totals are maintained incrementally, reading them is cheap */
+  struct { const char *name; pool *p; } pools[] = {
+    { "tables", rt_table_pool },
+    { "attributes", rta_pool },
+    { "protocols", proto_pool },
+    { "total", &root_pool },
+  };
+
+  metrics_header(b, "bird_memory_bytes", "Memory used by resource pools", "gauge");
+  for (uint i = 0; i < ARRAY_SIZE(pools); i++)
+    metrics_print(b, "bird_memory_bytes{pool=\"%s\"} %lu\n", pools[i].name, (u64) rmemsize(pools[i].p));
+
+  metrics_header(b, "bird_memory_objects", "Number of resources in resource pools", "gauge");
+  for (uint i = 0; i < ARRAY_SIZE(pools); i++)
+    metrics_print(b, "bird_memory_objects{pool=\"%s\"} %u\n", pools[i].name, rp_count(pools[i].p));
+}
+
+static void
+metrics_loop(buffer *b)
+{
+  metrics_header(b, "bird_loop_latency_microseconds", "Latency of main loop hooks", "histogram");
+
+  for (uint i = 0; i < IO_HOOK_MAX; i++)
+  {
+    byte labels[64];
+    bsnprintf(labels, sizeof(labels), "kind=\"%s\"", io_hook_kind_names[i]);
+    metrics_histogram(b, "bird_loop_latency_microseconds", labels, io_latency_histogram(i));
+  }
+}
+
+/**
+ * metrics_generate - generate all metrics
+ * @b: output buffer, allocated by xmalloc()
+ */
+void
+metrics_generate(buffer *b)
+{
+  metrics_header(b, "bird_info", "BIRD version", "gauge");
+  metrics_print(b, "bird_info{version=\"%s\"} 1\n", BIRD_VERSION);
+
+  metrics_header(b, "bird_uptime_seconds", "Time since BIRD start", "gauge");
+  metrics_print(b, "bird_uptime_seconds %u\n", (uint) ((current_time() - boot_time) TO_S));
+
+  metrics_protocols(b);
+  metrics_channels(b);
+  metrics_channel_latency(b);
+  metrics_channel_cpu(b);
+  metrics_tables(b);
+  metrics_memory(b);
+  metrics_loop(b);
+}
+
+
+/*
+ *	HTTP server
+ */
+
+static void
+metrics_close(struct metrics_client *c)
+{
+  rem_node(&c->n);
+  metrics_client_count--;
+
+  rfree(c->sk);
+  xfree(c->out);
+  mb_free(c);
+}
+
+static void
+metrics_reply_error(struct metrics_client *c, const char *status)
+{
+  sock *sk = c->sk;
+  int len = bsnprintf(sk->tbuf, sk->tbsize,
+		      "HTTP/1.0 %s\r\nContent-Length: 0\r\nConnection: close\r\n\r\n", status);
+
+  /* Partial send is finished by metrics_tx(), errors by metrics_err() */
+  if (sk_send(sk, len) > 0)
+    metrics_close(c);
+}
+
+static void
+metrics_reply(struct metrics_client *c)
+{
+  buffer b;
+  b.start = xmalloc(64 << 10);
+  b.pos = b.start + METRICS_HEADER_SIZE;
+  b.end = b.start + (64 << 10);
+
+  metrics_generate(&b);
+
+  /* Prepend the header right before the body */
+  byte hdr[METRICS_HEADER_SIZE];
+  uint body_len = b.pos - (b.start + METRICS_HEADER_SIZE);
+  int hdr_len = bsnprintf(hdr, sizeof(hdr),
+			  "HTTP/1.0 200 OK\r\n"
+			  "Content-Type: text/plain; version=0.0.4\r\n"
+			  "Content-Length: %u\r\n"
+			  "Connection: close\r\n\r\n", body_len);
+
+  byte *out = b.start + METRICS_HEADER_SIZE - hdr_len;
+  memcpy(out, hdr, hdr_len);
+  c->out = b.start;
+
+  sk_set_tbuf(c->sk, out);
+  if (sk_send(c->sk, hdr_len + body_len) > 0)
+    metrics_close(c);
+}
+
+static int
+metrics_rx(sock *sk, uint size)
+{
+  struct metrics_client *c = sk->data;
+
+  /* Response already in progress */
+  if (c->out)
+    return 1;
+
+  byte *end = NULL;
+  for (byte *pos = sk->rbuf; pos + 4 <= sk->rbuf + size; pos++)
+    if (!memcmp(pos, "\r\n\r\n", 4))
+    {
+      end = pos;
+      break;
+    }
+
+  if (!end)
+  {
+    if (size < sk->rbsize)
+      return 0;
+
+    metrics_reply_error(c, "431 Request Header Fields Too Large");
+    return 0;
+  }
+
+  if ((size < 4) || memcmp(sk->rbuf, "GET ", 4))
+  {
+    metrics_reply_error(c, "405 Method Not Allowed");
+    return 0;
+  }
+
+  /* Any path is accepted, but /metrics is the usual one */
+  metrics_reply(c);
+  return 0;
+}
+
+static void
+metrics_tx(sock *sk)
+{
+  /* Whole response sent */
+  metrics_close(sk->data);
+}
+
+static void
+metrics_err(sock *sk, int err)
+{
+  struct metrics_client *c = sk->data;
+
+  if (err)
+    log(L_WARN "Metrics: Connection error: %M", err);
+
+  metrics_close(c);
+}
+
+static int
+metrics_accept(sock *sk, uint size UNUSED)
+{
+  if (metrics_client_count >= metrics_cf.max_clients)
+  {
+    log(L_WARN "Metrics: Too many connections");
+    rfree(sk);
+    return 0;
+  }
+
+  struct metrics_client *c = mb_allocz(metrics_pool, sizeof(struct metrics_client));
+  c->sk = sk;
+  add_tail(&metrics_clients, &c->n);
+  metrics_client_count++;
+
+  sk->data = c;
+  sk->rx_hook = metrics_rx;
+  sk->tx_hook = metrics_tx;
+  sk->err_hook = metrics_err;
+  return 0;
+}
+
+static void
+metrics_listen_err(sock *sk UNUSED, int err)
+{
+  log(L_ERR "Metrics: Listening socket error: %M", err);
+}
+
+static void
+metrics_stop(void)
+{
+  struct metrics_client *c, *cn;
+  WALK_LIST_DELSAFE(c, cn, metrics_clients)
+    metrics_close(c);
+
+  rfree(metrics_sk);
+  metrics_sk = NULL;
+}
+
+static void
+metrics_start(struct metrics_config *cf)
+{
+  sock *sk = sk_new(metrics_pool);
+  sk->type = SK_TCP_PASSIVE;
+  sk->saddr = cf->addr;
+  sk->sport = cf->port;
+  sk->rbsize = METRICS_RX_SIZE;
+  sk->tbsize = 512;
+  sk->rx_hook = metrics_accept;
+  sk->err_hook = metrics_listen_err;
+
+  if (sk_open(sk) < 0)
+  {
+    log(L_ERR "Metrics: Cannot open listening socket on port %u: %s%#m", cf->port, sk->err);
+    rfree(sk);
+    return;
+  }
+
+  metrics_sk = sk;
+}
+
+static inline int
+metrics_same(struct metrics_config *a, struct metrics_config *b)
+{
+  return ipa_equal(a->addr, b->addr) && (a->port == b->port);
+}
+
+/**
+ * metrics_commit - apply configuration of the metrics endpoint
+ * @new: new configuration
+ * @old: old configuration or %NULL
+ */
+void
+metrics_commit(struct config *new, struct config *old UNUSED)
+{
+  struct metrics_config *cf = new->shutdown ? NULL : new->metrics;
+
+  if (!metrics_pool)
+  {
+    metrics_pool = rp_new(&root_pool, "Metrics");
+    init_list(&metrics_clients);
+  }
+
+  if (metrics_sk && cf && metrics_same(&metrics_cf, cf))
+  {
+    metrics_cf.max_clients = cf->max_clients;
+    return;
+  }
+
+  if (metrics_sk)
+    metrics_stop();
+
+  if (!cf)
+    return;
+
+  metrics_cf = *cf;
+  metrics_start(cf);
+}
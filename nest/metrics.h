@@ -0,0 +1,36 @@
+/*
+ *	BIRD Internet Routing Daemon -- Metrics Endpoint
+ *
+ *	Can be freely distributed and used under the terms of the GNU GPL.
+ */
+
+#ifndef _BIRD_METRICS_H_
+#define _BIRD_METRICS_H_
+
+#include "lib/ip.h"
+
+struct config;
+struct histogram;
+
+struct metrics_config {
+  ip_addr addr;				/* Listening address, IPA_NONE for any */
+  uint port;				/* Listening TCP port */
+  uint max_clients;			/* Limit of concurrent connections */
+};
+
+/* Protocol specific metric, see protocol->metrics */
+struct proto_metric {
+  const char *name;			/* Name without bird_ prefix, NULL terminates the array */
+  const char *help;			/* Description */
+  int gauge;				/* Gauge, otherwise counter */
+};
+
+#define METRICS_DEFAULT_MAX_CLIENTS	8
+#define METRICS_RX_SIZE			4096	/* Longer HTTP requests are rejected */
+
+void metrics_print(buffer *b, const char *fmt, ...);
+void metrics_histogram(buffer *b, const char *name, const char *labels, const struct histogram *h);
+void metrics_generate(buffer *b);
+void metrics_commit(struct config *new, struct config *old);
+
+#endif
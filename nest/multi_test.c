@@ -17,6 +17,9 @@ typedef struct threadArgs{
     int threadNumber;
 } threadArgs;
 
+//The fib is not thread safe, threads take turns on it
+static pthread_mutex_t fibMutex = PTHREAD_MUTEX_INITIALIZER;
+
 static int
 t_fib_simple(void){
 
@@ -102,6 +105,247 @@ static int t_fib_10000_address(void){
 }
 
 
+static int t_fib_small(void){
+
+    resource_init(); //Initialize the root pool
+
+    //Routing tables start with a small hash and let it grow
+    struct fib *f = mb_alloc(&root_pool, sizeof(struct fib));
+    fib_init(f, &root_pool, NET_IP4, sizeof(net), OFFSETOF(net, n), 4, NULL);
+
+    for (int i = 0; i < 10000; i++){
+        net_addr_ip4 a = NET_ADDR_IP4(i << 8, 24);
+        fib_get(f, (net_addr*) &a);
+
+        net_addr_ip4 b = NET_ADDR_IP4((i / 2) << 8, 24);
+        bt_assert_msg(fib_find(f, (net_addr*) &b), "Node %d lost while growing\n", i / 2);
+    }
+
+    bt_assert_msg(f->entries == 10000, "Fib count is %u, not 10000\n", f->entries);
+
+    int count = 0;
+    FIB_WALK(f, net, e)
+    {
+        count++;
+    }
+    FIB_WALK_END;
+
+    bt_assert_msg(count == 10000, "Walked %d nodes, not 10000\n", count);
+
+    for (int i = 0; i < 10000; i++){
+        net_addr_ip4 a = NET_ADDR_IP4(i << 8, 24);
+        fib_delete(f, fib_find(f, (net_addr*) &a));
+    }
+
+    bt_assert_msg(f->entries == 0, "Fib count is %u after removing all entries\n", f->entries);
+
+    fib_free(f);
+
+    return 1;
+}
+
+
+static int t_fib_iterate(void){
+
+    resource_init(); //Initialize the root pool
+
+    struct fib *f = mb_alloc(&root_pool, sizeof(struct fib));
+    fib_init(f, &root_pool, NET_IP4, sizeof(net), OFFSETOF(net, n), 0, NULL);
+
+    static byte seen[20000];
+    memset(seen, 0, sizeof(seen));
+
+    for (int i = 0; i < 10000; i++){
+        net_addr_ip4 a = NET_ADDR_IP4(i, 32);
+        fib_get(f, (net_addr*) &a);
+    }
+
+    //Walk the fib in small steps, deleting every other node and adding new ones while suspended
+    struct fib_iterator fit;
+    FIB_ITERATE_INIT(&fit, f);
+
+    int count = 0;
+again:
+    FIB_ITERATE_START(f, &fit, net, n)
+    {
+        u32 i = ip4_to_u32(((net_addr_ip4 *) n->n.addr)->prefix);
+        bt_assert_msg(!seen[i], "Node %u visited twice\n", i);
+        seen[i] = 1;
+
+        if ((i < 10000) && (i % 2)){
+            FIB_ITERATE_PUT(&fit);
+            fib_delete(f, n);
+            goto again;
+        }
+
+        if ((++count % 100) == 0){
+            FIB_ITERATE_PUT_NEXT(&fit, f);
+
+            for (int j = 0; j < 10; j++){
+                net_addr_ip4 a = NET_ADDR_IP4(10000 + count / 10 + j, 32);
+                fib_get(f, (net_addr*) &a);
+            }
+
+            goto again;
+        }
+    }
+    FIB_ITERATE_END;
+
+    for (int i = 0; i < 10000; i++){
+        net_addr_ip4 a = NET_ADDR_IP4(i, 32);
+        bt_assert_msg(seen[i], "Node %d not visited\n", i);
+        bt_assert_msg(!fib_find(f, (net_addr*) &a) == (i % 2), "Node %d in wrong state\n", i);
+    }
+
+    fib_free(f);
+
+    return 1;
+}
+
+
+static int t_fib_rehash(void){
+
+    resource_init(); //Initialize the root pool
+
+    struct fib *f = mb_alloc(&root_pool, sizeof(struct fib));
+    fib_init(f, &root_pool, NET_IP4, sizeof(net), OFFSETOF(net, n), 0, NULL);
+
+    //Fill the table until a rehash starts
+    int n = 0;
+    while (!f->old_table){
+        net_addr_ip4 a = NET_ADDR_IP4(n++, 32);
+        fib_get(f, (net_addr*) &a);
+    }
+
+    bt_assert_msg(f->rehash_pos < f->old_size, "Rehash finished in one step\n");
+
+    //Every node must be found during the migration, in either table
+    for (int i = 0; i < n; i++){
+        net_addr_ip4 a = NET_ADDR_IP4(i, 32);
+        net* entry = fib_find(f, (net_addr*) &a);
+        bt_assert_msg(entry, "Node %d lost during rehash\n", i);
+        bt_assert_msg(net_equal_ip4((net_addr_ip4*) &(entry->n.addr), &a), "Entry found is not the entry added\n");
+    }
+
+    //Delete nodes from the end, these are most likely still in the old table
+    for (int i = n - 1; i >= n - 50; i--){
+        net_addr_ip4 a = NET_ADDR_IP4(i, 32);
+        fib_delete(f, fib_find(f, (net_addr*) &a));
+    }
+    n -= 50;
+
+    //Keep inserting until the migration is done
+    while (f->old_table){
+        net_addr_ip4 a = NET_ADDR_IP4(n++, 32);
+        fib_get(f, (net_addr*) &a);
+    }
+
+    bt_assert_msg(f->entries == (uint) n, "Fib count is %u, not %d\n", f->entries, n);
+
+    int count = 0;
+    FIB_WALK(f, net, e)
+    {
+        count++;
+    }
+    FIB_WALK_END;
+
+    bt_assert_msg(count == n, "Walked %d nodes, not %d\n", count, n);
+
+    for (int i = 0; i < n; i++){
+        net_addr_ip4 a = NET_ADDR_IP4(i, 32);
+        bt_assert_msg(fib_find(f, (net_addr*) &a), "Node %d lost after rehash\n", i);
+    }
+
+    fib_free(f);
+
+    return 1;
+}
+
+
+static net *
+fib_route_slow(struct fib *f, net_addr_ip4 n){
+
+    net *r;
+
+    while (!(r = fib_find(f, (net_addr*) &n)) && (n.pxlen > 0)){
+        n.pxlen--;
+        ip4_clrbit(&n.prefix, n.pxlen);
+    }
+
+    return r;
+}
+
+static int t_fib_lpm(void){
+
+    resource_init(); //Initialize the root pool
+
+    struct fib *f = mb_alloc(&root_pool, sizeof(struct fib));
+    fib_init(f, &root_pool, NET_IP4, sizeof(net), OFFSETOF(net, n), 0, NULL);
+
+    //Short random prefixes in 10.0.0.0/8 so that many of them overlap
+    for (int i = 0; i < 2000; i++){
+        u32 pxlen = 8 + bt_random() % 17;
+        net_addr_ip4 a = NET_ADDR_IP4(ip4_and(ip4_from_u32(0x0a000000 | (bt_random() & 0xffffff)), ip4_mkmask(pxlen)), pxlen);
+        fib_get(f, (net_addr*) &a);
+
+        //Index built from the existing nodes, then maintained
+        if (i == 1000)
+            fib_lpm_init(f);
+    }
+
+    //Delete some of them
+    for (int i = 0; i < 2000; i++){
+        u32 pxlen = 8 + bt_random() % 17;
+        net_addr_ip4 a = NET_ADDR_IP4(ip4_and(ip4_from_u32(0x0a000000 | (bt_random() & 0xffffff)), ip4_mkmask(pxlen)), pxlen);
+        net *n = fib_find(f, (net_addr*) &a);
+        if (n)
+            fib_delete(f, n);
+    }
+
+    for (int i = 0; i < 10000; i++){
+        net_addr_ip4 a = NET_ADDR_IP4(ip4_from_u32(0x0a000000 | (bt_random() & 0xffffff)), 32);
+        net *n = fib_route(f, (net_addr*) &a);
+        bt_assert_msg(n == fib_route_slow(f, a), "Wrong longest prefix match for %x\n", ip4_to_u32(a.prefix));
+
+        void *nodes[FIB_LPM_MAX];
+        uint cnt = fib_route_list(f, (net_addr*) &a, nodes);
+        bt_assert_msg(!cnt == !n, "Covering nodes missing for %x\n", ip4_to_u32(a.prefix));
+        for (uint j = 1; j < cnt; j++)
+            bt_assert_msg(((net *) nodes[j - 1])->n.addr->pxlen < ((net *) nodes[j])->n.addr->pxlen, "Covering nodes not ordered\n");
+    }
+
+    //Ordered walk visits all nodes in prefix order
+    uint cnt = 0;
+    net *last = NULL;
+    FIB_WALK_ORDERED(f, net, n){
+        bt_assert_msg(!last || (net_compare(last->n.addr, n->n.addr) < 0), "Nodes not in prefix order\n");
+        last = n;
+        cnt++;
+    }
+    FIB_WALK_END;
+    bt_assert_msg(cnt == f->entries, "Ordered walk visited %u of %u nodes\n", cnt, f->entries);
+
+    //Walk resumed from addresses not in the fib
+    for (int i = 0; i < 1000; i++){
+        u32 pxlen = 8 + bt_random() % 17;
+        net_addr_ip4 a = NET_ADDR_IP4(ip4_and(ip4_from_u32(0x0a000000 | (bt_random() & 0xffffff)), ip4_mkmask(pxlen)), pxlen);
+        net *next = fib_next_ordered(f, (net_addr*) &a);
+        net *slow = NULL;
+
+        FIB_WALK(f, net, n){
+            if ((net_compare(n->n.addr, (net_addr*) &a) > 0) && (!slow || (net_compare(n->n.addr, slow->n.addr) < 0)))
+                slow = n;
+        }
+        FIB_WALK_END;
+        bt_assert_msg(next == slow, "Wrong next node in prefix order for %x/%u\n", ip4_to_u32(a.prefix), pxlen);
+    }
+
+    fib_free(f);
+
+    return 1;
+}
+
+
 void* f_multi_Add(void* argus){
 
     threadArgs* args = (threadArgs*) argus;
@@ -110,7 +354,9 @@ void* f_multi_Add(void* argus){
 
     for (int i = 0; i < 10000; i++){
         net_addr_ip4 a = NET_ADDR_IP4(6*i + threadNumber, 32);
+        pthread_mutex_lock(&fibMutex);
         net* entry = fib_get(args->fib, (net_addr*) &a);
+        pthread_mutex_unlock(&fibMutex);
         bt_assert_msg(entry, "Failed to add node %d in t_fib_10000_address\n", i);
     }
     
@@ -125,9 +371,11 @@ void* f_multi_remove(void* argus){
 
     for (int i = 0; i < 10000; i++){
         net_addr_ip4 a = NET_ADDR_IP4(6*i + threadNumber, 32);
+        pthread_mutex_lock(&fibMutex);
         net* entry = fib_find(args->fib, (net_addr*) &a);
         bt_assert_msg(entry, "Failed to add node %d in t_fib_10000_address\n", i);
         fib_delete(args->fib, entry);
+        pthread_mutex_unlock(&fibMutex);
     }
 } 
 
@@ -191,6 +439,64 @@ static int t_multi_thread(void){
 }
 
 
+#define BENCH_NETS 100000
+
+static struct fib *bench_fib;
+static net_addr_ip4 bench_nets[BENCH_NETS];
+
+static void
+bench_fib_init(void)
+{
+  if (bench_fib)
+    return;
+
+  bench_fib = mb_alloc(&root_pool, sizeof(struct fib));
+  fib_init(bench_fib, &root_pool, NET_IP4, sizeof(net), OFFSETOF(net, n), 0, NULL);
+
+  for (uint i = 0; i < BENCH_NETS; i++)
+  {
+    uint pxlen = 16 + bt_random() % 9;
+    bench_nets[i] = NET_ADDR_IP4(ip4_and(ip4_from_u32(bt_random()), ip4_mkmask(pxlen)), pxlen);
+    fib_get(bench_fib, (net_addr *) &bench_nets[i]);
+  }
+
+  fib_lpm_init(bench_fib);
+}
+
+static void
+b_fib_find(uint n)
+{
+  bench_fib_init();
+
+  for (uint i = 0; i < n; i++)
+    if (!fib_find(bench_fib, (net_addr *) &bench_nets[i % BENCH_NETS]))
+      bt_abort();
+}
+
+static void
+b_fib_get(uint n)
+{
+  bench_fib_init();
+
+  for (uint i = 0; i < n; i++)
+    fib_get(bench_fib, (net_addr *) &bench_nets[i % BENCH_NETS]);
+}
+
+static void
+b_fib_route(uint n)
+{
+  bench_fib_init();
+
+  for (uint i = 0; i < n; i++)
+  {
+    net_addr_ip4 *a = &bench_nets[i % BENCH_NETS];
+    net_addr_ip4 host = NET_ADDR_IP4(ip4_or(a->prefix, ip4_from_u32(i & 0xff)), 32);
+    if (!fib_route(bench_fib, (net_addr *) &host))
+      bt_abort();
+  }
+}
+
+
 int
 main(int argc, char *argv[])
 {
@@ -198,7 +504,15 @@ main(int argc, char *argv[])
 
   bt_test_suite(t_fib_simple, "Testing Simple operation fib");
   bt_test_suite(t_fib_10000_address, "Testing Adding/get/remove operation fib");
+  bt_test_suite(t_fib_small, "Testing fib growing from a small hash");
+  bt_test_suite(t_fib_iterate, "Testing asynchronous iteration over modified fib");
+  bt_test_suite(t_fib_rehash, "Testing lookups during incremental rehash");
+  bt_test_suite(t_fib_lpm, "Testing longest prefix match index");
   bt_test_suite(t_multi_thread, "Testing Adding/remove operation in multithreaded fib");
 
+  bt_bench(b_fib_find, "Lookup of existing network in fib");
+  bt_bench(b_fib_get, "Get of existing network from fib");
+  bt_bench(b_fib_route, "Longest prefix match of host address in fib");
+
   return bt_exit_value();
 }
\ No newline at end of file
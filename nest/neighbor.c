@@ -43,7 +43,13 @@
  *
  * When a neighbor event occurs (a neighbor gets disconnected or a sticky
  * inactive neighbor becomes connected), the protocol hook neigh_notify() is
- * called to advertise the change.
+ * called to advertise the change. Neighbors going down are notified
+ * immediately, as they may be freed right after that. Other notifications
+ * (neighbor going up, changed address or link state) are queued and delivered
+ * together from one event, so an interface change affecting many neighbors
+ * does not cause a storm of synchronous calls in the middle of interface
+ * processing. Multiple queued notifications of one neighbor are merged, the
+ * hook always sees the current state of the neighbor.
  */
 
 #undef LOCAL_DEBUG
@@ -53,12 +59,16 @@
 #include "nest/protocol.h"
 #include "lib/hash.h"
 #include "lib/resource.h"
+#include "lib/event.h"
 
 #define NEIGH_HASH_SIZE 256
 #define NEIGH_HASH_OFFSET 24
+#define NEIGH_CANDIDATES 16
 
 static slab *neigh_slab;
 static list neigh_hash_table[NEIGH_HASH_SIZE], sticky_neigh_list;
+static list neigh_notify_list;		/* Neighbors with pending notification */
+static event *neigh_notify_event;
 
 static inline uint
 neigh_hash(struct proto *p, ip_addr a, struct iface *i)
@@ -144,14 +154,33 @@ if_connected(ip_addr a, struct iface *i, struct ifa **ap, uint flags)
 static inline int
 if_connected_any(ip_addr a, struct iface *vrf, uint vrf_set, struct iface **iface, struct ifa **addr, uint flags)
 {
-  struct iface *i;
+  struct iface *i, *ifs[NEIGH_CANDIDATES];
   struct ifa *b;
   int s, scope = -1;
+  int n = -1;
 
   *iface = NULL;
   *addr = NULL;
 
+  /* Without these flags, only interfaces with matching addresses are relevant */
+  if (!(flags & (NEF_IFACE | NEF_ONLINK)))
+    n = if_connected_candidates(a, ifs, NEIGH_CANDIDATES);
+
   /* Prefer SCOPE_HOST or longer prefix */
+  if (n >= 0)
+  {
+    for (int k = 0; k < n; k++)
+      if ((!vrf_set || vrf == ifs[k]->master) && ((s = if_connected(a, ifs[k], &b, flags)) >= 0))
+	if (scope_better(s, scope) || (scope_remote(s, scope) && ifa_better(b, *addr)))
+	{
+	  *iface = ifs[k];
+	  *addr = b;
+	  scope = s;
+	}
+
+    return scope;
+  }
+
   WALK_LIST(i, iface_list)
     if ((!vrf_set || vrf == i->master) && ((s = if_connected(a, i, &b, flags)) >= 0))
       if (scope_better(s, scope) || (scope_remote(s, scope) && ifa_better(b, *addr)))
@@ -308,12 +337,33 @@ neigh_dump_all(void)
 }
 
 static inline void
-neigh_notify(neighbor *n)
+neigh_notify_now(neighbor *n)
 {
+  if (NODE_VALID(&n->notify_n))
+    rem_node(&n->notify_n);
+
   if (n->proto->neigh_notify && (n->proto->proto_state != PS_STOP))
     n->proto->neigh_notify(n);
 }
 
+static void
+neigh_notify(neighbor *n)
+{
+  if (!n->proto->neigh_notify || NODE_VALID(&n->notify_n))
+    return;
+
+  add_tail(&neigh_notify_list, &n->notify_n);
+  ev_schedule(neigh_notify_event);
+}
+
+static void
+neigh_notify_pending(void *data UNUSED)
+{
+  /* Hooks may queue more notifications, they are processed in this run too */
+  while (!EMPTY_LIST(neigh_notify_list))
+    neigh_notify_now(SKIP_BACK(neighbor, notify_n, HEAD(neigh_notify_list)));
+}
+
 static void
 neigh_up(neighbor *n, struct iface *i, struct ifa *a, int scope)
 {
@@ -339,7 +389,7 @@ neigh_down(neighbor *n)
   rem_node(&n->if_n);
   add_tail(&sticky_neigh_list, &n->if_n);
 
-  neigh_notify(n);
+  neigh_notify_now(n);
 }
 
 static inline void
@@ -347,6 +397,10 @@ neigh_free(neighbor *n)
 {
   rem_node(&n->n);
   rem_node(&n->if_n);
+
+  if (NODE_VALID(&n->notify_n))
+    rem_node(&n->notify_n);
+
   sl_free(neigh_slab, n);
 }
 
@@ -566,4 +620,6 @@ neigh_init(pool *if_pool)
     init_list(&neigh_hash_table[i]);
 
   init_list(&sticky_neigh_list);
+  init_list(&neigh_notify_list);
+  neigh_notify_event = ev_new_init(if_pool, neigh_notify_pending, NULL);
 }
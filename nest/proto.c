@@ -8,6 +8,8 @@
 
 #undef LOCAL_DEBUG
 
+#include <time.h>
+
 #include "nest/bird.h"
 #include "nest/protocol.h"
 #include "lib/resource.h"
@@ -15,11 +17,13 @@
 #include "lib/event.h"
 #include "lib/timer.h"
 #include "lib/string.h"
+#include "lib/json.h"
 #include "conf/conf.h"
 #include "nest/route.h"
 #include "nest/iface.h"
 #include "nest/cli.h"
 #include "filter/filter.h"
+#include "filter/data.h"
 
 pool *proto_pool;
 list  proto_list;
@@ -29,6 +33,9 @@ struct protocol *class_to_protocol[PROTOCOL__MAX];
 
 #define PD(pr, msg, args...) do { if (pr->debug & D_STATES) { log(L_TRACE "%s: " msg, pr->name , ## args); } } while(0)
 
+/* Initial size of channel route maps [bytes], they grow as needed */
+#define CHANNEL_MAP_SIZE 128
+
 static timer *proto_shutdown_timer;
 static timer *gr_wait_timer;
 
@@ -39,6 +46,7 @@ static timer *gr_wait_timer;
 
 static int graceful_restart_state;
 static u32 graceful_restart_locks;
+static int graceful_restart_startup;
 
 static char *p_states[] = { "DOWN", "START", "UP", "STOP" };
 static char *c_states[] = { "DOWN", "START", "UP", "FLUSHING" };
@@ -140,6 +148,20 @@ proto_find_channel_by_name(struct proto *p, const char *n)
  * (@proto_pool) and they are automatically freed when the protocol is removed.
  */
 
+/* Allocate or free the export latency histogram of the channel */
+static void
+channel_setup_export_latency(struct channel *c, int enabled)
+{
+  if (enabled && !c->export_latency)
+    c->export_latency = mb_allocz(proto_pool, sizeof(struct histogram));
+
+  if (!enabled && c->export_latency)
+  {
+    mb_free(c->export_latency);
+    c->export_latency = NULL;
+  }
+}
+
 struct channel *
 proto_add_channel(struct proto *p, struct channel_config *cf)
 {
@@ -161,12 +183,17 @@ proto_add_channel(struct proto *p, struct channel_config *cf)
   c->preference = cf->preference;
   c->merge_limit = cf->merge_limit;
   c->in_keep_filtered = cf->in_keep_filtered;
+  channel_setup_export_latency(c, cf->export_latency);
 
   c->channel_state = CS_DOWN;
   c->export_state = ES_DOWN;
   c->last_state_change = current_time();
   c->last_tx_filter_change = current_time();
   c->reloadable = 1;
+  init_list(&c->roa_subscriptions);
+  init_list(&c->routes);
+  init_list(&c->in_routes);
+  init_list(&c->out_routes);
 
   CALL(c->channel->init, c, cf);
 
@@ -185,6 +212,7 @@ proto_remove_channel(struct proto *p, struct channel *c)
   PD(p, "Channel %s removed", c->name);
 
   rem_node(&c->n);
+  channel_setup_export_latency(c, 0);
   mb_free(c);
 }
 
@@ -233,7 +261,16 @@ channel_schedule_feed(struct channel *c, int initial)
   c->export_state = ES_FEEDING;
   c->refeeding = !initial;
 
-  ev_schedule(c->feed_event);
+  ev_schedule_work(c->feed_event);
+}
+
+static inline void
+channel_free_range(struct f_trie **range)
+{
+  if (*range)
+    rfree((*range)->lp);
+
+  *range = NULL;
 }
 
 static void
@@ -241,17 +278,20 @@ channel_feed_loop(void *ptr)
 {
   struct channel *c = ptr;
 
-  if (c->export_state != ES_FEEDING)
+  if ((c->export_state != ES_FEEDING) || c->feed_paused)
     return;
 
+  /* Partial refeed is not announced to the protocol */
   if (!c->feed_active)
-    if (c->proto->feed_begin)
+    if (c->proto->feed_begin && !c->feed_range)
       c->proto->feed_begin(c, !c->refeeding);
 
   // DBG("Feeding protocol %s continued\n", p->name);
   if (!rt_feed_channel(c))
   {
-    ev_schedule(c->feed_event);
+    /* Paused feed is continued by channel_resume_feed() */
+    if (!c->feed_paused)
+      ev_schedule_work(c->feed_event);
     return;
   }
 
@@ -267,7 +307,7 @@ channel_feed_loop(void *ptr)
 
     /* Continue in feed - it will process routing table again from beginning */
     c->refeed_count = 0;
-    ev_schedule(c->feed_event);
+    ev_schedule_work(c->feed_event);
     return;
   }
 
@@ -275,8 +315,10 @@ channel_feed_loop(void *ptr)
   c->export_state = ES_READY;
   // proto_log_state_change(p);
 
-  if (c->proto->feed_end)
+  if (c->proto->feed_end && !c->feed_range)
     c->proto->feed_end(c);
+
+  channel_free_range(&c->feed_range);
 }
 
 
@@ -297,8 +339,14 @@ channel_stop_export(struct channel *c)
     rt_feed_channel_abort(c);
 
   c->export_state = ES_DOWN;
+  c->feed_paused = 0;
   c->stats.exp_routes = 0;
-  bmap_reset(&c->export_map, 1024);
+  bmap_reset(&c->export_map, CHANNEL_MAP_SIZE);
+  if (c->reject_map.data)
+    bmap_reset(&c->reject_map, CHANNEL_MAP_SIZE);
+  rt_flush_export_cache(c);
+  rt_flush_merged_cache(c);
+  channel_free_range(&c->feed_range);
 }
 
 
@@ -309,7 +357,8 @@ channel_schedule_reload(struct channel *c)
   ASSERT(c->channel_state == CS_UP);
 
   rt_reload_channel_abort(c);
-  ev_schedule(c->reload_event);
+  channel_free_range(&c->reload_range);
+  ev_schedule_work(c->reload_event);
 }
 
 static void
@@ -319,52 +368,212 @@ channel_reload_loop(void *ptr)
 
   if (!rt_reload_channel(c))
   {
-    ev_schedule(c->reload_event);
+    ev_schedule_work(c->reload_event);
     return;
   }
+
+  channel_free_range(&c->reload_range);
+
+  /* ROA changes received during the reload */
+  if (c->roa_range)
+    ev_schedule(c->roa_event);
 }
 
+static void channel_roa_unsubscribe(struct channel *c);
+static void channel_request_partial_reload(struct channel *c, struct f_trie *range);
+
 static void
 channel_reset_import(struct channel *c)
 {
   /* Need to abort feeding */
   ev_postpone(c->reload_event);
   rt_reload_channel_abort(c);
+  channel_free_range(&c->reload_range);
 
-  rt_prune_sync(c->in_table, 1);
+  channel_roa_unsubscribe(c);
+
+  rt_prune_sync(c->in_table, c, 1);
 }
 
 static void
 channel_reset_export(struct channel *c)
 {
+  ev_postpone(c->resend_event);
+  rt_resend_channel_abort(c);
+
   /* Just free the routes */
-  rt_prune_sync(c->out_table, 1);
+  rt_prune_sync(c->out_table, c, 1);
+}
+
+/*
+ * Channels with an export table may answer a refresh request by sending the
+ * routes from the table again (see rt_resend_channel()), which is much cheaper
+ * than a refeed as export filters are not evaluated. The resend is demarcated
+ * by feed_begin() and feed_end() hooks like a refeed. Any refeed supersedes it.
+ */
+static void
+channel_resend_loop(void *ptr)
+{
+  struct channel *c = ptr;
+
+  /* Superseded by a feed */
+  if (c->export_state != ES_READY)
+  {
+    rt_resend_channel_abort(c);
+    return;
+  }
+
+  if (!c->resend_active && c->proto->feed_begin)
+    c->proto->feed_begin(c, 0);
+
+  if (!rt_resend_channel(c))
+  {
+    ev_schedule_work(c->resend_event);
+    return;
+  }
+
+  if (c->proto->feed_end)
+    c->proto->feed_end(c);
+}
+
+/* Called by protocol to resend exported routes from out_table */
+void
+channel_request_resend(struct channel *c)
+{
+  ASSERT(c->channel_state == CS_UP);
+  ASSERT(c->out_table);
+
+  /* Pending or running feed sends all routes anyway */
+  if (c->export_state != ES_READY)
+  {
+    channel_request_feeding(c);
+    return;
+  }
+
+  /* A running resend is restarted */
+  rt_resend_channel_abort(c);
+  ev_schedule_work(c->resend_event);
+}
+
+/*
+ * Channels with an import table follow changes of ROA tables checked by their
+ * import filter. Networks covered by the changed ROAs are collected into
+ * roa_range and reloaded from the import table, so route validity is updated
+ * without a full reload. Reload requests are postponed while another reload
+ * runs, as a partial reload cannot be merged with it.
+ */
+
+struct channel_roa_subscription {
+  node n;				/* Node in channel->roa_subscriptions */
+  struct roa_subscription s;
+  struct channel *c;
+};
+
+static void
+channel_roa_changed(struct roa_subscription *s, const net_addr *roa)
+{
+  struct channel_roa_subscription *rs = SKIP_BACK(struct channel_roa_subscription, s, s);
+  struct channel *c = rs->c;
+  net_addr n;
+
+  if (!c->roa_range)
+  {
+    c->roa_range = f_new_trie(lp_new_default(c->proto->pool), 0);
+    c->roa_range->ipv4 = (roa->type == NET_ROA4);
+  }
+
+  /* Validity of any network covered by the ROA may have changed */
+  if (roa->type == NET_ROA4)
+    net_fill_ip4(&n, net4_prefix(roa), net4_pxlen(roa));
+  else
+    net_fill_ip6(&n, net6_prefix(roa), net6_pxlen(roa));
+
+  trie_add_prefix(c->roa_range, &n, net_pxlen(&n), net_max_prefix_length[n.type]);
+  ev_schedule(c->roa_event);
+}
+
+static void
+channel_roa_reload(void *ptr)
+{
+  struct channel *c = ptr;
+
+  if (!c->roa_range || (c->channel_state != CS_UP))
+    return;
+
+  /* Retried from channel_reload_loop() */
+  if (c->reload_active || ev_active(c->reload_event))
+    return;
+
+  struct f_trie *range = c->roa_range;
+  c->roa_range = NULL;
+
+  PD(c->proto, "Channel %s reloading networks affected by ROA changes", c->name);
+
+  trie_compile(range);
+  channel_request_partial_reload(c, range);
+}
+
+static void
+channel_roa_subscribe(struct channel *c)
+{
+  uint roa_type;
+
+  switch (c->net_type)
+  {
+  case NET_IP4: roa_type = NET_ROA4; break;
+  case NET_IP6: roa_type = NET_ROA6; break;
+  default: return;
+  }
+
+  for (const struct f_roa_dep *d = filter_roa_deps(c->in_filter); d; d = d->next)
+  {
+    rtable *tab = d->rtc->table;
+    if (!tab || (tab->addr_type != roa_type))
+      continue;
+
+    struct channel_roa_subscription *rs = mb_allocz(c->proto->pool, sizeof(struct channel_roa_subscription));
+    rs->c = c;
+    rs->s.hook = channel_roa_changed;
+    rt_roa_subscribe(tab, &rs->s);
+    add_tail(&c->roa_subscriptions, &rs->n);
+  }
+}
+
+static void
+channel_roa_unsubscribe(struct channel *c)
+{
+  struct channel_roa_subscription *rs;
+  node *nxt;
+
+  WALK_LIST_DELSAFE(rs, nxt, c->roa_subscriptions)
+  {
+    rem_node(&rs->n);
+    rt_roa_unsubscribe(&rs->s);
+    mb_free(rs);
+  }
+
+  if (c->roa_event)
+    ev_postpone(c->roa_event);
+  channel_free_range(&c->roa_range);
 }
 
 /* Called by protocol to activate in_table */
 void
 channel_setup_in_table(struct channel *c)
 {
-  struct rtable_config *cf = mb_allocz(c->proto->pool, sizeof(struct rtable_config));
-  cf->name = "import";
-  cf->addr_type = c->net_type;
-
-  c->in_table = mb_allocz(c->proto->pool, sizeof(struct rtable));
-  rt_setup(c->proto->pool, c->in_table, cf);
+  c->in_table = rt_get_in_table(c->table);
+  c->in_table_count = 0;
 
   c->reload_event = ev_new_init(c->proto->pool, channel_reload_loop, c);
+  c->roa_event = ev_new_init(c->proto->pool, channel_roa_reload, c);
 }
 
 /* Called by protocol to activate out_table */
 void
 channel_setup_out_table(struct channel *c)
 {
-  struct rtable_config *cf = mb_allocz(c->proto->pool, sizeof(struct rtable_config));
-  cf->name = "export";
-  cf->addr_type = c->net_type;
-
-  c->out_table = mb_allocz(c->proto->pool, sizeof(struct rtable));
-  rt_setup(c->proto->pool, c->out_table, cf);
+  c->out_table = rt_get_out_table(c->table);
+  c->resend_event = ev_new_init(c->proto->pool, channel_resend_loop, c);
 }
 
 
@@ -377,8 +586,16 @@ channel_do_start(struct channel *c)
 
   c->feed_event = ev_new_init(c->proto->pool, channel_feed_loop, c);
 
-  bmap_init(&c->export_map, c->proto->pool, 1024);
+  bmap_init(&c->export_map, c->proto->pool, CHANNEL_MAP_SIZE);
+
+  /* Export verdicts are cached only by rt_notify_accepted() */
+  if (c->ra_mode == RA_ACCEPTED)
+    bmap_init(&c->reject_map, c->proto->pool, CHANNEL_MAP_SIZE);
   memset(&c->stats, 0, sizeof(struct proto_stats));
+  memset(&c->cpu, 0, sizeof(struct cpu_acct));
+
+  if (c->export_latency)
+    memset(c->export_latency, 0, sizeof(struct histogram));
 
   channel_reset_limit(&c->rx_limit);
   channel_reset_limit(&c->in_limit);
@@ -390,7 +607,7 @@ channel_do_start(struct channel *c)
 static void
 channel_do_flush(struct channel *c)
 {
-  rt_schedule_prune(c->table);
+  rt_schedule_prune_channel(c->table, c);
 
   c->gr_wait = 0;
   if (c->gr_lock)
@@ -400,15 +617,39 @@ channel_do_flush(struct channel *c)
 
   /* This have to be done in here, as channel pool is freed before channel_do_down() */
   bmap_free(&c->export_map);
+  bmap_free(&c->reject_map);
+  rt_flush_export_cache(c);
+  rt_flush_merged_cache(c);
+
+  /* Import table is shared, remove our routes and release it */
+  if (c->in_table)
+  {
+    ev_postpone(c->reload_event);
+    rt_reload_channel_abort(c);
+    rt_prune_sync(c->in_table, c, 1);
+    rt_unlock_table(c->in_table);
+  }
+
+  /* Export table is shared as well */
+  if (c->out_table)
+  {
+    ev_postpone(c->resend_event);
+    rt_resend_channel_abort(c);
+    rt_prune_sync(c->out_table, c, 1);
+    rt_unlock_table(c->out_table);
+  }
+
   c->in_table = NULL;
   c->reload_event = NULL;
+  c->roa_event = NULL;
   c->out_table = NULL;
+  c->resend_event = NULL;
 }
 
 static void
 channel_do_down(struct channel *c)
 {
-  ASSERT(!c->feed_active && !c->reload_active);
+  ASSERT(!c->feed_active && !c->reload_active && !c->resend_active);
 
   rem_node(&c->table_node);
   rt_unlock_table(c->table);
@@ -422,7 +663,9 @@ channel_do_down(struct channel *c)
 
   c->in_table = NULL;
   c->reload_event = NULL;
+  c->roa_event = NULL;
   c->out_table = NULL;
+  c->resend_event = NULL;
 
   CALL(c->channel->cleanup, c);
 
@@ -469,9 +712,16 @@ channel_set_state(struct channel *c, uint state)
     if (cs == CS_DOWN)
       channel_do_start(c);
 
+    /* Defer export until startup convergence is done */
+    if (graceful_restart_startup && (graceful_restart_state != GRS_DONE))
+      c->gr_wait = 1;
+
     if (!c->gr_wait && c->proto->rt_notify)
       channel_start_export(c);
 
+    if (c->in_table)
+      channel_roa_subscribe(c);
+
     break;
 
   case CS_FLUSHING:
@@ -501,6 +751,40 @@ channel_set_state(struct channel *c, uint state)
   // XXXX proto_log_state_change(c);
 }
 
+/**
+ * channel_pause_feed - pause feeding of a channel
+ * @c: channel
+ *
+ * A protocol calls this function when it cannot keep up with routes fed to
+ * the channel, e.g. when its output queue reaches some limit. Feeding stops
+ * after the current network and waits for channel_resume_feed(). Regular
+ * route updates are not affected.
+ */
+void
+channel_pause_feed(struct channel *c)
+{
+  c->feed_paused = 1;
+}
+
+/**
+ * channel_resume_feed - resume paused feeding of a channel
+ * @c: channel
+ *
+ * A protocol calls this function when its output queue has drained enough
+ * after channel_pause_feed(). It is cheap to call when the feed is not paused.
+ */
+void
+channel_resume_feed(struct channel *c)
+{
+  if (!c->feed_paused)
+    return;
+
+  c->feed_paused = 0;
+
+  if (c->export_state == ES_FEEDING)
+    ev_schedule_work(c->feed_event);
+}
+
 /**
  * channel_request_feeding - request feeding routes to the channel
  * @c: given channel
@@ -520,6 +804,9 @@ channel_request_feeding(struct channel *c)
   if (c->export_state == ES_DOWN)
     return;
 
+  /* Any pending partial refeed is extended to a full one */
+  channel_free_range(&c->feed_range);
+
   /* If we are already feeding, we want to restart it */
   if (c->export_state == ES_FEEDING)
   {
@@ -530,6 +817,13 @@ channel_request_feeding(struct channel *c)
     rt_feed_channel_abort(c);
   }
 
+  /* Refeed supersedes resend from the export table */
+  if (c->out_table)
+  {
+    ev_postpone(c->resend_event);
+    rt_resend_channel_abort(c);
+  }
+
   /* Track number of exported routes during refeed */
   c->refeed_count = 0;
 
@@ -559,6 +853,90 @@ channel_request_reload(struct channel *c)
   channel_reset_limit(&c->in_limit);
 }
 
+/*
+ * Partial reload and refeed are requested by channel_reconfigure() when just
+ * prefix sets in filters have changed. The @range trie of networks to be
+ * processed is owned by the channel from now on. Pending requests are not
+ * merged, a full reload or refeed is done instead.
+ */
+static void
+channel_request_partial_reload(struct channel *c, struct f_trie *range)
+{
+  ASSERT(c->in_table);
+
+  if (c->reload_active || ev_active(c->reload_event))
+  {
+    channel_free_range(&range);
+    channel_request_reload(c);
+    return;
+  }
+
+  channel_schedule_reload(c);
+  c->reload_range = range;
+
+  channel_reset_limit(&c->rx_limit);
+  channel_reset_limit(&c->in_limit);
+}
+
+static void
+channel_request_partial_feeding(struct channel *c, struct f_trie *range)
+{
+  ASSERT(c->channel_state == CS_UP);
+
+  if (c->export_state != ES_READY)
+  {
+    channel_free_range(&range);
+    channel_request_feeding(c);
+    return;
+  }
+
+  c->refeed_count = 0;
+  c->feed_range = range;
+  channel_schedule_feed(c, 0);	/* Sets ES_FEEDING */
+}
+
+/*
+ * channel_filter_diff - find networks affected by a filter change
+ *
+ * Returns a trie matching all networks of the channel that may be filtered
+ * differently by @new and @old filters, or NULL when all routes are affected.
+ */
+static struct f_trie *
+channel_filter_diff(struct channel *c, const struct filter *new, const struct filter *old)
+{
+  int v4;
+
+  switch (c->net_type)
+  {
+  case NET_IP4:
+  case NET_VPN4:
+  case NET_ROA4:
+    v4 = 1;
+    break;
+
+  case NET_IP6:
+  case NET_VPN6:
+  case NET_ROA6:
+    v4 = 0;
+    break;
+
+  default:
+    return NULL;
+  }
+
+  struct f_trie *diff = f_new_trie(lp_new_default(c->proto->pool), 0);
+  diff->ipv4 = v4;
+
+  if (!filter_diff(new, old, diff))
+  {
+    channel_free_range(&diff);
+    return NULL;
+  }
+
+  trie_compile(diff);
+  return diff;
+}
+
 const struct channel_class channel_basic = {
   .channel_size = sizeof(struct channel),
   .config_size = sizeof(struct channel_config)
@@ -646,11 +1024,16 @@ channel_reconfigure(struct channel *c, struct channel_config *cf)
   int import_changed = !filter_same(cf->in_filter, c->in_filter);
   int export_changed = !filter_same(cf->out_filter, c->out_filter);
 
+  /* Changes other than in filters affect all routes */
+  int import_all = 0, export_all = 0;
+  const struct filter *old_in_filter = c->in_filter;
+  const struct filter *old_out_filter = c->out_filter;
+
   if (c->preference != cf->preference)
-    import_changed = 1;
+    import_all = 1;
 
   if (c->merge_limit != cf->merge_limit)
-    export_changed = 1;
+    export_all = 1;
 
   /* Reconfigure channel fields */
   c->in_filter = cf->in_filter;
@@ -663,20 +1046,38 @@ channel_reconfigure(struct channel *c, struct channel_config *cf)
   c->merge_limit = cf->merge_limit;
   c->preference = cf->preference;
   c->in_keep_filtered = cf->in_keep_filtered;
+  channel_setup_export_latency(c, cf->export_latency);
 
   channel_verify_limits(c);
 
+  /* Execute channel-specific reconfigure hook */
+  if (c->channel->reconfigure && !c->channel->reconfigure(c, cf, &import_all, &export_all))
+    return 0;
+
+  import_changed |= import_all;
+  export_changed |= export_all;
+
   if (export_changed)
+  {
     c->last_tx_filter_change = current_time();
+    rt_flush_export_cache(c);
 
-  /* Execute channel-specific reconfigure hook */
-  if (c->channel->reconfigure && !c->channel->reconfigure(c, cf, &import_changed, &export_changed))
-    return 0;
+    /* Cached verdicts of the old filter */
+    if ((c->export_state != ES_DOWN) && c->reject_map.data)
+      bmap_reset(&c->reject_map, CHANNEL_MAP_SIZE);
+  }
 
   /* If the channel is not open, it has no routes and we cannot reload it anyways */
   if (c->channel_state != CS_UP)
     return 1;
 
+  /* The import filter may check other ROA tables now */
+  if (import_changed && c->in_table)
+  {
+    channel_roa_unsubscribe(c);
+    channel_roa_subscribe(c);
+  }
+
   if (reconfigure_type == RECONFIG_SOFT)
   {
     if (import_changed)
@@ -692,13 +1093,24 @@ channel_reconfigure(struct channel *c, struct channel_config *cf)
   if (import_changed && !channel_reloadable(c))
     return 0;
 
+  /* Changes of prefix sets in filters may affect just some routes */
+  struct f_trie *import_diff = (import_changed && !import_all && c->in_table) ?
+    channel_filter_diff(c, cf->in_filter, old_in_filter) : NULL;
+  struct f_trie *export_diff = (export_changed && !export_all) ?
+    channel_filter_diff(c, cf->out_filter, old_out_filter) : NULL;
+
   if (import_changed || export_changed)
-    log(L_INFO "Reloading channel %s.%s", c->proto->name, c->name);
+    log(L_INFO "Reloading channel %s.%s%s", c->proto->name, c->name,
+	((!import_changed || import_diff) && (!export_changed || export_diff)) ? " partially" : "");
 
-  if (import_changed)
+  if (import_diff)
+    channel_request_partial_reload(c, import_diff);
+  else if (import_changed)
     channel_request_reload(c);
 
-  if (export_changed)
+  if (export_diff)
+    channel_request_partial_feeding(c, export_diff);
+  else if (export_changed)
     channel_request_feeding(c);
 
   return 1;
@@ -831,8 +1243,9 @@ proto_start(struct proto *p)
 {
   /* Here we cannot use p->cf->name since it won't survive reconfiguration */
   p->pool = rp_new(proto_pool, p->proto->name);
+  memset(&p->cpu, 0, sizeof(struct cpu_acct));
 
-  if (graceful_restart_state == GRS_INIT)
+  if ((graceful_restart_state == GRS_INIT) && !graceful_restart_startup)
     p->gr_recovery = 1;
 }
 
@@ -985,7 +1398,8 @@ proto_reconfigure(struct proto *p, struct proto_config *oc, struct proto_config
       (nc->net_type != oc->net_type) ||
       (nc->disabled != p->disabled) ||
       (nc->vrf != oc->vrf) ||
-      (nc->vrf_set != oc->vrf_set))
+      (nc->vrf_set != oc->vrf_set) ||
+      (nc->io_priority != oc->io_priority))
     return 0;
 
   p->name = nc->name;
@@ -1250,6 +1664,14 @@ proto_spawn(struct proto_config *cf, uint disabled)
  * The graceful restart recovery is finished when either all graceful restart
  * locks are unlocked or when graceful restart wait timer fires.
  *
+ * The same mechanism is used for optional startup convergence, requested by
+ * startup_convergence() when BIRD starts regularly. Protocols are not marked
+ * with @gr_recovery, but the core sets @gr_wait for all channels going up
+ * before the end of convergence, so routes are imported and best routes are
+ * selected, but not exported. Protocols lock convergence of channels that are
+ * expected to receive a full table (e.g. BGP until end-of-RIB). When all locks
+ * are released or the startup convergence wait timer fires, export to all
+ * waiting channels is started, each fed once from converged tables.
  */
 
 static void graceful_restart_done(timer *t);
@@ -1267,6 +1689,47 @@ graceful_restart_recovery(void)
   graceful_restart_state = GRS_INIT;
 }
 
+/**
+ * startup_convergence - request initial startup convergence
+ *
+ * Called by the platform initialization code if startup convergence is
+ * configured and graceful restart recovery was not requested. Have to be
+ * called before protos_commit().
+ */
+void
+startup_convergence(void)
+{
+  if (graceful_restart_state)
+    return;
+
+  graceful_restart_state = GRS_INIT;
+  graceful_restart_startup = 1;
+}
+
+/**
+ * startup_convergence_pending - check for initial phase of startup convergence
+ *
+ * Returns nonzero when protocols may lock startup convergence by
+ * channel_graceful_restart_lock().
+ */
+int
+startup_convergence_pending(void)
+{
+  return graceful_restart_startup && (graceful_restart_state == GRS_INIT);
+}
+
+static inline const char *
+graceful_restart_name(void)
+{
+  return graceful_restart_startup ? "Startup convergence" : "Graceful restart";
+}
+
+static inline uint
+graceful_restart_wait(void)
+{
+  return graceful_restart_startup ? config->startup_wait : config->gr_wait;
+}
+
 /**
  * graceful_restart_init - initialize graceful restart
  *
@@ -1280,7 +1743,7 @@ graceful_restart_init(void)
   if (!graceful_restart_state)
     return;
 
-  log(L_INFO "Graceful restart started");
+  log(L_INFO "%s started", graceful_restart_name());
 
   if (!graceful_restart_locks)
   {
@@ -1290,7 +1753,7 @@ graceful_restart_init(void)
 
   graceful_restart_state = GRS_ACTIVE;
   gr_wait_timer = tm_new_init(proto_pool, graceful_restart_done, NULL, 0, 0);
-  tm_start(gr_wait_timer, config->gr_wait S);
+  tm_start(gr_wait_timer, graceful_restart_wait() S);
 }
 
 /**
@@ -1306,13 +1769,13 @@ graceful_restart_init(void)
 static void
 graceful_restart_done(timer *t UNUSED)
 {
-  log(L_INFO "Graceful restart done");
+  log(L_INFO "%s done", graceful_restart_name());
   graceful_restart_state = GRS_DONE;
 
   struct proto *p;
   WALK_LIST(p, proto_list)
   {
-    if (!p->gr_recovery)
+    if (!p->gr_recovery && !graceful_restart_startup)
       continue;
 
     struct channel *c;
@@ -1339,9 +1802,13 @@ graceful_restart_show_status(void)
   if (graceful_restart_state != GRS_ACTIVE)
     return;
 
-  cli_msg(-24, "Graceful restart recovery in progress");
+  if (graceful_restart_startup)
+    cli_msg(-24, "Startup convergence in progress");
+  else
+    cli_msg(-24, "Graceful restart recovery in progress");
+
   cli_msg(-24, "  Waiting for %d channels to recover", graceful_restart_locks);
-  cli_msg(-24, "  Wait timer is %t/%u", tm_remains(gr_wait_timer), config->gr_wait);
+  cli_msg(-24, "  Wait timer is %t/%u", tm_remains(gr_wait_timer), graceful_restart_wait());
 }
 
 /**
@@ -1361,7 +1828,7 @@ void
 channel_graceful_restart_lock(struct channel *c)
 {
   ASSERT(graceful_restart_state == GRS_INIT);
-  ASSERT(c->proto->gr_recovery);
+  ASSERT(c->proto->gr_recovery || graceful_restart_startup);
 
   if (c->gr_lock)
     return;
@@ -1445,6 +1912,7 @@ proto_build(struct protocol *p)
 
 /* FIXME: convert this call to some protocol hook */
 extern void bfd_init_all(void);
+extern void bmp_init_all(void);
 
 /**
  * protos_build - build a protocol list
@@ -1483,6 +1951,10 @@ protos_build(void)
 #ifdef CONFIG_BGP
   proto_build(&proto_bgp);
 #endif
+#ifdef CONFIG_BMP
+  proto_build(&proto_bmp);
+  bmp_init_all();
+#endif
 #ifdef CONFIG_BFD
   proto_build(&proto_bfd);
   bfd_init_all();
@@ -1496,6 +1968,9 @@ protos_build(void)
 #ifdef CONFIG_PERF
   proto_build(&proto_perf);
 #endif
+#ifdef CONFIG_AGGREGATOR
+  proto_build(&proto_aggregator);
+#endif
 
   proto_pool = rp_new(&root_pool, "Protocols");
   proto_shutdown_timer = tm_new(proto_pool);
@@ -1801,6 +2276,76 @@ proto_state_name(struct proto *p)
   }
 }
 
+/*
+ * CPU time accounting uses the monotonic clock, as all route processing runs
+ * in the main thread. Nested sections (e.g. export run from best route
+ * selection) are subtracted using the global sum of accounted time.
+ */
+
+static u64 cpu_acct_accounted;
+
+const char * const cpu_acct_names[CPU_ACCT_MAX] = {
+  [CPU_ACCT_RX]		= "rx",
+  [CPU_ACCT_FILTER]	= "filter",
+  [CPU_ACCT_TABLE]	= "table",
+  [CPU_ACCT_EXPORT]	= "export",
+};
+
+static inline u64
+cpu_acct_now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec * (u64) 1000000000 + ts.tv_nsec;
+}
+
+struct cpu_acct_mark
+cpu_acct_begin_(void)
+{
+  return (struct cpu_acct_mark) {
+    .begin = cpu_acct_now(),
+    .accounted = cpu_acct_accounted,
+  };
+}
+
+void
+cpu_acct_end_(struct cpu_acct *a, enum cpu_acct_kind kind, struct cpu_acct_mark m)
+{
+  u64 total = cpu_acct_now() - m.begin;
+  u64 nested = cpu_acct_accounted - m.accounted;
+  u64 own = (total > nested) ? total - nested : 0;
+
+  a->time[kind] += own;
+  cpu_acct_accounted += own;
+}
+
+/* Format nanoseconds as seconds with millisecond precision */
+static char *
+cpu_acct_fmt(char *buf, u64 t)
+{
+  bsprintf(buf, "%lu.%03u s", t / 1000000000, (uint) ((t / 1000000) % 1000));
+  return buf;
+}
+
+static void
+channel_show_cpu(struct channel *c)
+{
+  struct proto_stats *s = &c->stats;
+  const struct cpu_acct *a = &c->cpu;
+  u64 total = cpu_acct_total(a);
+  u64 routes = (u64) s->imp_updates_received + s->imp_withdraws_received +
+    s->exp_updates_received + s->exp_withdraws_received;
+  char b0[32], b1[32], b2[32], b3[32];
+
+  cli_msg(-1006, "    CPU time:       %s (filter %s, table %s, export %s), %lu routes/s",
+	  cpu_acct_fmt(b0, total),
+	  cpu_acct_fmt(b1, a->time[CPU_ACCT_FILTER]),
+	  cpu_acct_fmt(b2, a->time[CPU_ACCT_TABLE]),
+	  cpu_acct_fmt(b3, a->time[CPU_ACCT_EXPORT]),
+	  total ? routes * 1000000 / MAX(total / 1000, 1) : 0);
+}
+
 static void
 channel_show_stats(struct channel *c)
 {
@@ -1826,6 +2371,15 @@ channel_show_stats(struct channel *c)
 	  s->exp_updates_filtered, s->exp_updates_accepted);
   cli_msg(-1006, "      Export withdraws:   %10u        ---        ---        --- %10u",
 	  s->exp_withdraws_received, s->exp_withdraws_accepted);
+
+  const struct histogram *h = c->export_latency;
+  if (h && h->count)
+    cli_msg(-1006, "    Export latency: %lu routes, min %lu us, median %lu us, 90%% %lu us, 99%% %lu us, max %lu us",
+	    h->count, h->min, histogram_quantile(h, 500), histogram_quantile(h, 900),
+	    histogram_quantile(h, 990), h->max);
+
+  if (config->cpu_accounting)
+    channel_show_cpu(c);
 }
 
 void
@@ -1849,7 +2403,7 @@ channel_show_info(struct channel *c)
   cli_msg(-1006, "    Output filter:  %s", filter_name(c->out_filter));
 
   if (graceful_restart_state == GRS_ACTIVE)
-    cli_msg(-1006, "    GR recovery:   %s%s",
+    cli_msg(-1006, graceful_restart_startup ? "    Convergence:   %s%s" : "    GR recovery:   %s%s",
 	    c->gr_lock ? " pending" : "",
 	    c->gr_wait ? " waiting" : "");
 
@@ -1893,6 +2447,11 @@ proto_cmd_show(struct proto *p, uintptr_t verbose, int cnt)
       cli_msg(-1006, "  Router ID:      %R", p->cf->router_id);
     if (p->vrf_set)
       cli_msg(-1006, "  VRF:            %s", p->vrf ? p->vrf->name : "default");
+    if (config->cpu_accounting && p->cpu.time[CPU_ACCT_RX])
+    {
+      char b[32];
+      cli_msg(-1006, "  CPU time (rx):  %s", cpu_acct_fmt(b, p->cpu.time[CPU_ACCT_RX]));
+    }
 
     if (p->proto->show_proto_info)
       p->proto->show_proto_info(p);
@@ -1907,6 +2466,137 @@ proto_cmd_show(struct proto *p, uintptr_t verbose, int cnt)
   }
 }
 
+static void
+channel_json_stats(struct json_writer *w, struct channel *c)
+{
+  struct proto_stats *s = &c->stats;
+
+  json_open(w, "routes", '{');
+  json_put_uint(w, "imported", s->imp_routes);
+  json_put_uint(w, "filtered", s->filt_routes);
+  json_put_uint(w, "exported", s->exp_routes);
+  json_put_uint(w, "preferred", s->pref_routes);
+  json_close(w, '}');
+
+  json_open(w, "import_updates", '{');
+  json_put_uint(w, "received", s->imp_updates_received);
+  json_put_uint(w, "rejected", s->imp_updates_invalid);
+  json_put_uint(w, "filtered", s->imp_updates_filtered);
+  json_put_uint(w, "ignored", s->imp_updates_ignored);
+  json_put_uint(w, "accepted", s->imp_updates_accepted);
+  json_close(w, '}');
+
+  json_open(w, "import_withdraws", '{');
+  json_put_uint(w, "received", s->imp_withdraws_received);
+  json_put_uint(w, "rejected", s->imp_withdraws_invalid);
+  json_put_uint(w, "ignored", s->imp_withdraws_ignored);
+  json_put_uint(w, "accepted", s->imp_withdraws_accepted);
+  json_close(w, '}');
+
+  json_open(w, "export_updates", '{');
+  json_put_uint(w, "received", s->exp_updates_received);
+  json_put_uint(w, "rejected", s->exp_updates_rejected);
+  json_put_uint(w, "filtered", s->exp_updates_filtered);
+  json_put_uint(w, "accepted", s->exp_updates_accepted);
+  json_close(w, '}');
+
+  json_open(w, "export_withdraws", '{');
+  json_put_uint(w, "received", s->exp_withdraws_received);
+  json_put_uint(w, "accepted", s->exp_withdraws_accepted);
+  json_close(w, '}');
+
+  const struct histogram *h = c->export_latency;
+  if (h)
+  {
+    json_open(w, "export_latency", '{');
+    json_put_uint(w, "count", h->count);
+    json_put_uint(w, "min", h->count ? h->min : 0);
+    json_put_uint(w, "p50", histogram_quantile(h, 500));
+    json_put_uint(w, "p90", histogram_quantile(h, 900));
+    json_put_uint(w, "p99", histogram_quantile(h, 990));
+    json_put_uint(w, "max", h->max);
+    json_close(w, '}');
+  }
+
+  if (config->cpu_accounting)
+  {
+    json_open(w, "cpu_time_ns", '{');
+    for (uint i = CPU_ACCT_FILTER; i < CPU_ACCT_MAX; i++)
+      json_put_uint(w, cpu_acct_names[i], c->cpu.time[i]);
+    json_close(w, '}');
+  }
+}
+
+static void
+channel_json_info(struct json_writer *w, struct channel *c)
+{
+  json_open(w, NULL, '{');
+  json_put_string(w, "name", c->name);
+  json_put_string(w, "state", c_states[c->channel_state]);
+  json_put_string(w, "table", c->table->name);
+  json_put_uint(w, "preference", c->preference);
+  json_put_string(w, "input_filter", filter_name(c->in_filter));
+  json_put_string(w, "output_filter", filter_name(c->out_filter));
+
+  if (c->channel_state != CS_DOWN)
+    channel_json_stats(w, c);
+
+  json_close(w, '}');
+}
+
+/**
+ * proto_cmd_show_json - show protocol as a JSON line
+ * @p: protocol
+ * @verbose: include details and channels
+ * @cnt: unused
+ *
+ * The JSON counterpart of proto_cmd_show(). Protocol specific details
+ * provided by show_proto_info() hook are not included.
+ */
+void
+proto_cmd_show_json(struct proto *p, uintptr_t verbose, int cnt UNUSED)
+{
+  struct json_writer *w = cli_json_begin();
+  byte buf[256];
+
+  buf[0] = 0;
+  if (p->proto->get_status)
+    p->proto->get_status(p, buf);
+
+  json_open(w, NULL, '{');
+  json_put_string(w, "name", p->name);
+  json_put_string(w, "protocol", p->proto->name);
+  if (p->main_channel)
+    json_put_string(w, "table", p->main_channel->table->name);
+  json_put_string(w, "state", proto_state_name(p));
+  json_put_uint(w, "age", (current_time() - p->last_state_change) TO_S);
+  json_put_string(w, "info", buf);
+
+  if (verbose)
+  {
+    if (p->cf->dsc)
+      json_put_string(w, "description", p->cf->dsc);
+    if (p->message)
+      json_put_string(w, "message", p->message);
+    if (p->cf->router_id)
+    {
+      json_key(w, "router_id");
+      json_printf(w, "\"%R\"", p->cf->router_id);
+    }
+    if (p->vrf_set)
+      json_put_string(w, "vrf", p->vrf ? p->vrf->name : "default");
+
+    struct channel *c;
+    json_open(w, "channels", '[');
+    WALK_LIST(c, p->channels)
+      channel_json_info(w, c);
+    json_close(w, ']');
+  }
+
+  json_close(w, '}');
+  cli_json_end(this_cli, -CLI_JSON_CODE);
+}
+
 void
 proto_cmd_disable(struct proto *p, uintptr_t arg, int cnt UNUSED)
 {
@@ -2000,6 +2690,45 @@ proto_cmd_reload(struct proto *p, uintptr_t dir, int cnt UNUSED)
   cli_msg(-15, "%s: reloading", p->name);
 }
 
+void
+proto_cmd_reload_range(struct proto *p, uintptr_t arg, int cnt UNUSED)
+{
+  const net_addr *n = (void *) arg;
+  struct channel *c;
+
+  if (p->disabled)
+  {
+    cli_msg(-8, "%s: already disabled", p->name);
+    return;
+  }
+
+  /* If the protocol in not UP, it has no routes */
+  if (p->proto_state != PS_UP)
+    return;
+
+  /* Partial reload is done from import tables */
+  WALK_LIST(c, p->channels)
+    if ((c->channel_state == CS_UP) && (c->net_type == n->type) && !c->in_table)
+    {
+      cli_msg(-8006, "%s: reload failed", p->name);
+      return;
+    }
+
+  log(L_INFO "Reloading protocol %s in range %N", p->name, n);
+
+  WALK_LIST(c, p->channels)
+    if ((c->channel_state == CS_UP) && (c->net_type == n->type))
+    {
+      struct f_trie *range = f_new_trie(lp_new_default(c->proto->pool), 0);
+      trie_add_prefix(range, n, net_pxlen(n), net_max_prefix_length[n->type]);
+      trie_compile(range);
+
+      channel_request_partial_reload(c, range);
+    }
+
+  cli_msg(-15, "%s: reloading", p->name);
+}
+
 void
 proto_cmd_debug(struct proto *p, uintptr_t mask, int cnt UNUSED)
 {
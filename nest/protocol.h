@@ -31,6 +31,7 @@ struct channel;
 struct ea_list;
 struct eattr;
 struct symbol;
+struct proto_metric;
 
 
 /*
@@ -39,9 +40,11 @@ struct symbol;
 
 enum protocol_class {
   PROTOCOL_NONE,
+  PROTOCOL_AGGREGATOR,
   PROTOCOL_BABEL,
   PROTOCOL_BFD,
   PROTOCOL_BGP,
+  PROTOCOL_BMP,
   PROTOCOL_DEVICE,
   PROTOCOL_DIRECT,
   PROTOCOL_KERNEL,
@@ -68,6 +71,7 @@ struct protocol {
   uint channel_mask;			/* Mask of accepted channel types (NB_*) */
   uint proto_size;			/* Size of protocol data structure */
   uint config_size;			/* Size of protocol config data structure */
+  uint rte_size;			/* Size of rte with protocol-dependent data (RTE_SIZE()), 0 for none */
 
   void (*preconfig)(struct protocol *, struct config *);	/* Just before configuring */
   void (*postconfig)(struct proto_config *);			/* After configuring each instance */
@@ -83,6 +87,8 @@ struct protocol {
   int (*get_attr)(const struct eattr *, byte *buf, int buflen);	/* ASCIIfy dynamic attribute (returns GA_*) */
   void (*show_proto_info)(struct proto *);	/* Show protocol info (for `show protocols all' command) */
   void (*copy_config)(struct proto_config *, struct proto_config *);	/* Copy config from given protocol instance */
+  const struct proto_metric *metrics;		/* Protocol specific metrics, NULL-terminated (for metrics endpoint) */
+  void (*get_metrics)(struct proto *, u64 *vals); /* Get values of metrics in the same order */
 };
 
 void protos_build(void);
@@ -103,7 +109,8 @@ void protos_dump_all(void);
 extern struct protocol
   proto_device, proto_radv, proto_rip, proto_static, proto_mrt,
   proto_ospf, proto_perf,
-  proto_pipe, proto_bgp, proto_bfd, proto_babel, proto_rpki;
+  proto_pipe, proto_bgp, proto_bmp, proto_bfd, proto_babel, proto_rpki,
+  proto_aggregator;
 
 /*
  *	Routing Protocol Instance
@@ -121,6 +128,7 @@ struct proto_config {
   u8 net_type;				/* Protocol network type (NET_*), 0 for undefined */
   u8 disabled;				/* Protocol enabled/disabled by default */
   u8 vrf_set;				/* Related VRF instance (below) is defined */
+  u8 io_priority;			/* Sockets are read before others in the main loop (sock.fast_rx) */
   u32 debug, mrtdump;			/* Debugging bitfields, both use D_* constants */
   u32 router_id;			/* Protocol specific router ID */
 
@@ -158,6 +166,51 @@ struct proto_stats {
   u32 exp_withdraws_accepted;	/* Number of route withdraws accepted and processed */
 };
 
+/*
+ *	CPU time accounting, enabled by the 'cpu accounting' option
+ *
+ *	Times are exclusive like in &rt_phase_stats, so e.g. export to another
+ *	channel is not charged to the table operation of the importing channel.
+ */
+
+enum cpu_acct_kind {
+  CPU_ACCT_RX,				/* Socket rx hooks of the protocol */
+  CPU_ACCT_FILTER,			/* Import and export filters */
+  CPU_ACCT_TABLE,			/* Attribute caching and best route selection */
+  CPU_ACCT_EXPORT,			/* Announcement to the protocol */
+  CPU_ACCT_MAX
+};
+
+struct cpu_acct {
+  u64 time[CPU_ACCT_MAX];		/* Time spent [ns] */
+};
+
+struct cpu_acct_mark {
+  u64 begin;
+  u64 accounted;
+};
+
+extern const char * const cpu_acct_names[CPU_ACCT_MAX];
+
+struct cpu_acct_mark cpu_acct_begin_(void);
+void cpu_acct_end_(struct cpu_acct *a, enum cpu_acct_kind kind, struct cpu_acct_mark m);
+
+/* Both are no-op unless CPU accounting is enabled */
+static inline struct cpu_acct_mark cpu_acct_begin(void)
+{ return config->cpu_accounting ? cpu_acct_begin_() : (struct cpu_acct_mark) {}; }
+
+static inline void cpu_acct_end(struct cpu_acct *a, enum cpu_acct_kind kind, struct cpu_acct_mark m)
+{ if (m.begin) cpu_acct_end_(a, kind, m); }
+
+static inline u64
+cpu_acct_total(const struct cpu_acct *a)
+{
+  u64 sum = 0;
+  for (uint i = 0; i < CPU_ACCT_MAX; i++)
+    sum += a->time[i];
+  return sum;
+}
+
 struct proto {
   node n;				/* Node in global proto_list */
   struct protocol *proto;		/* Protocol */
@@ -190,6 +243,7 @@ struct proto {
   btime last_state_change;		/* Time of last state transition */
   char *last_state_name_announced;	/* Last state name we've announced to the user */
   char *message;			/* State-change message, allocated from proto_pool */
+  struct cpu_acct cpu;			/* CPU time of rx hooks since protocol start */
 
   /*
    *	General protocol hooks:
@@ -272,6 +326,8 @@ void proto_clone_config(struct symbol *sym, struct proto_config *parent);
 void proto_set_message(struct proto *p, char *msg, int len);
 
 void graceful_restart_recovery(void);
+void startup_convergence(void);
+int startup_convergence_pending(void);
 void graceful_restart_init(void);
 void graceful_restart_show_status(void);
 void channel_graceful_restart_lock(struct channel *c);
@@ -283,10 +339,12 @@ void channel_show_limit(struct channel_limit *l, const char *dsc);
 void channel_show_info(struct channel *c);
 
 void proto_cmd_show(struct proto *, uintptr_t, int);
+void proto_cmd_show_json(struct proto *, uintptr_t, int);
 void proto_cmd_disable(struct proto *, uintptr_t, int);
 void proto_cmd_enable(struct proto *, uintptr_t, int);
 void proto_cmd_restart(struct proto *, uintptr_t, int);
 void proto_cmd_reload(struct proto *, uintptr_t, int);
+void proto_cmd_reload_range(struct proto *, uintptr_t, int);
 void proto_cmd_debug(struct proto *, uintptr_t, int);
 void proto_cmd_mrtdump(struct proto *, uintptr_t, int);
 
@@ -498,6 +556,14 @@ struct channel_config {
   u16 preference;			/* Default route preference */
   u8 merge_limit;			/* Maximal number of nexthops for RA_MERGED */
   u8 in_keep_filtered;			/* Routes rejected in import filter are kept */
+  u8 export_latency;			/* Keep histogram of import-to-export latency */
+};
+
+/* Refresh cycles of channel routes in one table, see rt_refresh_begin() */
+struct channel_refresh {
+  u8 count;				/* Cycle of routes sent in the current refresh */
+  u8 valid;				/* Routes of older cycles are to be discarded */
+  u8 modify;				/* Routes of older cycles are to be modified */
 };
 
 struct channel {
@@ -512,17 +578,30 @@ struct channel {
   const struct filter *in_filter;	/* Input filter */
   const struct filter *out_filter;	/* Output filter */
   struct bmap export_map;		/* Keeps track which routes passed export filter */
+  struct bmap reject_map;		/* Routes rejected by export filter in RA_ACCEPTED mode, see rt_notify_accepted() */
+  struct export_cache_entry *out_cache;	/* Cached export filter results, see rt_flush_export_cache() */
+  struct export_merged_cache *merged_cache; /* Exported merged routes, see rt_flush_merged_cache() */
   struct channel_limit rx_limit;	/* Receive limit (for in_keep_filtered) */
   struct channel_limit in_limit;	/* Input limit */
   struct channel_limit out_limit;	/* Output limit */
 
   struct event *feed_event;		/* Event responsible for feeding */
   struct fib_iterator feed_fit;		/* Routing table iterator used during feeding */
+  node feed_node;			/* Node in table feed_group, see rt_feed_channel() */
+  u32 feed_stop;			/* Key of net where shared table walk was joined */
+  u8 feed_wrap;				/* Position in shared table walk (RT_FEED_*) */
+  u8 feed_done;				/* Feed finished by shared table walk */
+  u8 feed_ordered;			/* Feeding in prefix order, from feed_last */
+  net_addr feed_last;			/* Last net fed in prefix order, zero type at start */
+  struct f_trie *feed_range;		/* Only networks matching this trie are refed, NULL for all */
   struct proto_stats stats;		/* Per-channel protocol statistics */
+  struct cpu_acct cpu;			/* Per-channel CPU time, reset with stats */
   u32 refeed_count;			/* Number of routes exported during refeed regardless of out_limit */
+  struct histogram *export_latency;	/* Import-to-export latency of routes [us], NULL if disabled */
 
   u8 net_type;				/* Routing table network type (NET_*), 0 for undefined */
   u8 ra_mode;				/* Mode of received route advertisements (RA_*) */
+  u8 ra_limit;				/* Max routes per network in RA_ANY mode, 0 for all */
   u16 preference;			/* Default route preference */
   u8 merge_limit;			/* Maximal number of nexthops for RA_MERGED */
   u8 in_keep_filtered;			/* Routes rejected in import filter are kept */
@@ -532,22 +611,44 @@ struct channel {
   u8 channel_state;
   u8 export_state;			/* Route export state (ES_*, see below) */
   u8 feed_active;
+  u8 feed_paused;			/* Feeding waits for the protocol, see channel_pause_feed() */
   u8 flush_active;
+  u8 prune_pending;			/* Routes of the channel are to be pruned, see rt_schedule_prune_channel() */
+  u8 prune_active;			/* Routes of the channel are being pruned, see rt_prune_table() */
   u8 refeeding;				/* We are refeeding (valid only if export_state == ES_FEEDING) */
   u8 reloadable;			/* Hook reload_routes() is allowed on the channel */
   u8 gr_lock;				/* Graceful restart mechanism should wait for this channel */
   u8 gr_wait;				/* Route export to channel is postponed until graceful restart */
 
+  struct channel_refresh refresh;	/* Refresh cycles in the routing table */
+  struct channel_refresh in_refresh;	/* Refresh cycles in in_table */
+
+  list routes;				/* Routes in the table sent by this channel (struct rte) */
+  list in_routes;			/* Routes in in_table sent by this channel */
+  list out_routes;			/* Routes in out_table exported to this channel */
+  node prune_node;			/* Position of the prune loop in @routes, see rt_prune_table() */
+
   btime last_state_change;		/* Time of last state transition */
   btime last_tx_filter_change;
 
-  struct rtable *in_table;		/* Internal table for received routes */
+  struct rtable *in_table;		/* Import table for received routes, shared by channels of c->table */
+  u32 in_table_count;			/* Number of routes of this channel in in_table */
   struct event *reload_event;		/* Event responsible for reloading from in_table */
   struct fib_iterator reload_fit;	/* FIB iterator in in_table used during reloading */
   struct rte *reload_next_rte;		/* Route iterator in in_table used during reloading */
+  struct f_trie *reload_range;		/* Only networks matching this trie are reloaded, NULL for all */
+  struct rt_reload_walk *reload_walk;	/* Ordered walk of reload_range, NULL for FIB iteration */
   u8 reload_active;			/* Iterator reload_fit is linked */
 
+  list roa_subscriptions;		/* ROA tables checked by in_filter (struct channel_roa_subscription) */
+  struct event *roa_event;		/* Event responsible for reloading after ROA changes */
+  struct f_trie *roa_range;		/* Networks affected by ROA changes, to be reloaded */
+
   struct rtable *out_table;		/* Internal table for exported routes */
+  struct event *resend_event;		/* Event responsible for resending from out_table */
+  struct fib_iterator resend_fit;	/* FIB iterator in out_table used during resending */
+  struct rte *resend_next_rte;		/* Route iterator in out_table used during resending */
+  u8 resend_active;			/* Iterator resend_fit is linked */
 };
 
 
@@ -624,6 +725,9 @@ static inline void channel_open(struct channel *c) { channel_set_state(c, CS_UP)
 static inline void channel_close(struct channel *c) { channel_set_state(c, CS_FLUSHING); }
 
 void channel_request_feeding(struct channel *c);
+void channel_request_resend(struct channel *c);
+void channel_pause_feed(struct channel *c);
+void channel_resume_feed(struct channel *c);
 void *channel_config_new(const struct channel_class *cc, const char *name, uint net_type, struct proto_config *proto);
 void *channel_config_get(const struct channel_class *cc, const char *name, uint net_type, struct proto_config *proto);
 int channel_reconfigure(struct channel *c, struct channel_config *cf);
@@ -12,6 +12,7 @@
 #include "lib/lists.h"
 #include "lib/bitmap.h"
 #include "lib/resource.h"
+#include "lib/histogram.h"
 #include "lib/net.h"
 
 struct ea_list;
@@ -21,6 +22,7 @@ struct rte_src;
 struct symbol;
 struct filter;
 struct cli;
+struct json_writer;
 
 /*
  *	Generic data structure for storing network prefixes. Also used
@@ -34,29 +36,52 @@ struct cli;
  *		- asynchronous retrieval of fib contents
  */
 
+/*
+ * Primary hash key of a node is not stored in it, as that would cost padding
+ * before the 8-byte aligned address. It is computed from the address where
+ * needed, hash table slots keep their own copies for lookups.
+ */
 struct fib_node {
-  struct fib_node *next;		/* Next in hash chain */
   struct fib_iterator *readers;		/* List of readers of this node */
   net_addr addr[0];
 };
 
 struct fib_iterator {			/* See lib/slists.h for an explanation */
-  struct fib_iterator *prev, *next;	/* Must be synced with struct fib_node! */
-  byte efef;				/* 0xff to distinguish between iterator and node */
-  byte pad[3];
+  struct fib_iterator *next;		/* Must be synced with struct fib_node! */
+  byte efef;				/* 0xff to distinguish between iterator and node (overlaps address type) */
+  byte pad[7];
+  struct fib_iterator *prev;
   struct fib_node *node;		/* Or NULL if freshly merged */
   uint hash;
 };
 
+/* Primary hash key of an address, ~0 is reserved for free hash table slots */
+static inline u32 fib_key(u32 h)
+{ return (h == ~0U) ? (~0U - 1) : h; }
+
+static inline u32 fib_node_key(const struct fib_node *e)
+{ return fib_key(net_hash(e->addr)); }
+
 typedef void (*fib_init_fn)(void *);
 
+#define FIB_LPM_MAX (IP6_MAX_PREFIX_LENGTH + 1)	/* Max number of nodes covering a prefix */
+
 struct fib {
   pool *fib_pool;			/* Pool holding all our data */
   slab *fib_slab;			/* Slab holding all fib nodes */
-  struct fib_node **hash_table;		/* Node hash table */
-  uint hash_size;			/* Number of hash table entries (a power of two) */
-  uint hash_order;			/* Binary logarithm of hash_size */
+  struct fib_node **hash_table;		/* Node hash table, open addressing */
+  u32 *hash_keys;			/* Primary hash keys of nodes in hash_table */
+  uint hash_size;			/* Number of hash table slots (home slots + overflow area) */
+  uint hash_order;			/* Binary logarithm of the number of home slots */
   uint hash_shift;			/* 32 - hash_order */
+  uint hash_extra;			/* Size of the overflow area */
+  struct fib_node **old_table;		/* Table being migrated from while rehashing, else NULL */
+  u32 *old_keys;			/* Primary hash keys of nodes in old_table */
+  uint old_size;			/* Number of old_table slots */
+  uint old_shift;			/* hash_shift of old_table */
+  uint rehash_pos;			/* First old_table slot not migrated yet */
+  struct fib_lpm_node *lpm_root;	/* Longest prefix match index, see fib_lpm_init() */
+  slab *lpm_slab;			/* Slab holding its nodes, NULL if not enabled */
   uint addr_type;			/* Type of address data stored in fib (NET_*) */
   uint node_size;			/* FIB node size, 0 for nonuniform,    SIZE OF WHAT IS INSIDE -> usualy a net which contain a fib node)  look like {struct rte*, fib_node}*/
   uint node_offset;			/* Offset of fib_node struct inside of user data,   WITH OFFSETOF(), offset between user data and fib node  (usually the pointer rte) */
@@ -73,11 +98,15 @@ static inline struct fib_node * fib_user_to_node(struct fib *f, void *e)
 
 void fib_init(struct fib *f, pool *p, uint addr_type, uint node_size, uint node_offset, uint hash_order, fib_init_fn init);
 void *fib_find(struct fib *, const net_addr *);	/* Find or return NULL if doesn't exist */
-void *fib_get_chain(struct fib *f, const net_addr *a); /* Find first node in linked list from hash table */
+struct fib_node **fib_get_chain(struct fib *f, const net_addr *a, uint *len); /* Find nodes with the same primary hash key */
 void *fib_get(struct fib *, const net_addr *);	/* Find or create new if nonexistent */
 void *fib_route(struct fib *, const net_addr *); /* Longest-match routing lookup */
+void fib_lpm_init(struct fib *f);	/* Enable longest prefix match index */
+uint fib_route_list(struct fib *f, const net_addr *n, void **nodes); /* All covering nodes, shortest first */
+void *fib_next_ordered(struct fib *f, const net_addr *after); /* Next node in prefix order */
 void fib_delete(struct fib *, void *);	/* Remove fib entry */
 void fib_free(struct fib *);		/* Destroy the fib */
+void fib_rehash_finish(struct fib *);	/* Complete pending incremental rehash */
 void fib_check(struct fib *);		/* Consistency check for debugging */
 
 void fit_init(struct fib_iterator *, struct fib *); /* Internal functions, don't call */
@@ -89,14 +118,21 @@ void fit_copy(struct fib *f, struct fib_iterator *dst, struct fib_iterator *src)
 
 
 #define FIB_WALK(fib, type, z) do {				\
+	fib_rehash_finish(fib);					\
 	struct fib_node *fn_, **ff_ = (fib)->hash_table;	\
 	uint count_ = (fib)->hash_size;				\
 	type *z;						\
 	while (count_--)					\
-	  for (fn_ = *ff_++; z = fib_node_to_user(fib, fn_); fn_=fn_->next)
+	  for (fn_ = *ff_++; z = fib_node_to_user(fib, fn_); fn_ = NULL)
 
 #define FIB_WALK_END } while (0)
 
+/* Like FIB_WALK(), but in prefix order, see fib_next_ordered() */
+#define FIB_WALK_ORDERED(fib, type, z) do {			\
+	type *z;						\
+	for (z = fib_next_ordered(fib, NULL); z;		\
+	     z = fib_next_ordered(fib, fib_user_to_node(fib, z)->addr))
+
 #define FIB_ITERATE_INIT(it, fib) fit_init(it, fib)
 
 #define FIB_ITERATE_START(fib, it, type, z) do {		\
@@ -114,7 +150,7 @@ void fit_copy(struct fib *f, struct fib_iterator *dst, struct fib_iterator *src)
 	    }							\
 	  z = fib_node_to_user(fib, fn_);
 
-#define FIB_ITERATE_END fn_ = fn_->next; } } while(0)
+#define FIB_ITERATE_END fn_ = NULL; } } while(0)
 
 #define FIB_ITERATE_PUT(it) fit_put(it, fn_)
 
@@ -147,6 +183,7 @@ struct rtable_config {
   int gc_max_ops;			/* Maximum number of operations before GC is run */
   int gc_min_time;			/* Minimum time between two consecutive GC runs */
   byte sorted;				/* Routes of network are sorted according to rte_better() */
+  byte ordered;				/* Feeds and snapshots walk networks in prefix order */
 };
 
 typedef struct rtable {
@@ -158,8 +195,15 @@ typedef struct rtable {
   int pipe_busy;			/* Pipe loop detection */
   int use_count;			/* Number of protocols using this table */
   u32 rt_count;				/* Number of routes in the table */
+  struct rt_stats *stats;		/* Route counters, see rt_show_tables() */
   struct hmap id_map;
   struct hostcache *hostcache;
+  struct roa_index *roa_index;		/* Index of valid ROAs, for ROA tables only */
+  list roa_subscribers;			/* Notified of ROA changes (struct roa_subscription) */
+  list feed_group;			/* Channels sharing the table walk (struct channel), see rt_feed_channel() */
+  struct fib_iterator feed_fit;		/* Iterator of the shared table walk */
+  byte feed_group_active;		/* Shared table walk is in progress */
+  byte feed_walking;			/* Inside of a pass of the shared table walk */
   struct rtable_config *config;		/* Configuration of this table */
   struct config *deleted;		/* Table doesn't exist in current configuration,
 					 * delete as soon as use_count becomes 0 and remove
@@ -169,17 +213,18 @@ typedef struct rtable {
   btime gc_time;			/* Time of last GC */
   int gc_counter;			/* Number of operations since last GC */
   byte prune_state;			/* Table prune state, 1 -> scheduled, 2-> running */
+  byte prune_full;			/* Next prune cycle walks the whole table */
+  byte prune_walk;			/* Running prune cycle walks the whole table */
   byte hcu_scheduled;			/* Hostcache update is scheduled */
-  byte nhu_state;			/* Next Hop Update state */
   struct fib_iterator prune_fit;	/* Rtable prune FIB iterator */
-  struct fib_iterator nhu_fit;		/* Next Hop Update FIB iterator */
+  list nhu_list;			/* Hostentries with routes pending Next Hop Update */
+  uint snapshots;			/* Number of live read snapshots, see rt_snapshot_new() */
+  struct rte *snapshot_limbo;		/* Routes removed while snapshots are live, freed later */
+  struct rtable *in_table;		/* Import table shared by attached channels */
+  struct rtable *out_table;		/* Export table shared by attached channels */
+  struct rtable *shared_of;		/* Main table, if this is a shared import/export table */
 } rtable;
 
-#define NHU_CLEAN	0
-#define NHU_SCHEDULED	1
-#define NHU_RUNNING	2
-#define NHU_DIRTY	3
-
 typedef struct network {
   struct rte *routes;			/* Available routes for this network */
   struct fib_node n;			/* FIB flags reserved for kernel syncer */
@@ -210,19 +255,31 @@ struct hostentry {
   byte dest;				/* Chosen route destination type (RTD_...) */
   byte nexthop_linkable;		/* Nexthop list is completely non-device */
   u32 igp_metric;			/* Chosen route IGP metric */
+  list routes;				/* Routes using this entry in the dependent table */
+  node nhu_mark;			/* End of routes pending Next Hop Update */
+  node nhu_node;			/* Node in nhu_list of the dependent table */
 };
 
+/*
+ * Fields needed to walk the list of routes in a network and compare them in
+ * rte_better() are kept together at the beginning, so a route selection scan
+ * touches one cache line per route (plus the shared protocol structures).
+ */
 typedef struct rte {
   struct rte *next;
   net *net;				/* Network this RTE belongs to */
-  struct channel *sender;		/* Channel used to send the route to the routing table */
   struct rta *attrs;			/* Attributes of this route */
+  struct proto *src_proto;		/* Protocol of attrs->src, cached for route selection */
   u32 id;				/* Table specific route id */
   byte flags;				/* Flags (REF_...) */
   byte pflags;				/* Protocol-specific flags */
+  byte stale_cycle;			/* Refresh cycle of the route, see rt_refresh_begin() */
   word pref;				/* Route preference */
+  struct channel *sender;		/* Channel used to send the route to the routing table */
+  node he_node;				/* Node in the list of routes of attrs->hostentry */
+  node sender_n;			/* Node in the list of routes of the sender, see rte_sender_list() */
   btime lastmod;			/* Last modified */
-  union {				/* Protocol-dependent data (metrics etc.) */
+  union {				/* Protocol-dependent data (metrics etc.), see RTE_SIZE() */
 #ifdef CONFIG_RIP
     struct {
       struct iface *from;		/* Incoming iface */
@@ -253,18 +310,24 @@ typedef struct rte {
     struct {				/* Routes generated by krt sync (both temporary and inherited ones) */
       s8 src;				/* Alleged route source (see krt.h) */
       u8 proto;				/* Kernel source protocol ID */
-      u8 seen;				/* Seen during last scan */
+      u8 seen;				/* Scan epoch it was last seen in */
       u8 best;				/* Best route in network, propagated to core */
       u32 metric;			/* Kernel metric */
     } krt;
   } u;
 } rte;
 
+/*
+ * Routes are allocated only with space for the protocol-dependent data of
+ * their source protocol, as given by &protocol.rte_size. Therefore, only
+ * the appropriate member of rte.u may be accessed and rte must not be copied
+ * by value.
+ */
+#define RTE_SIZE(x) (OFFSETOF(rte, u) + sizeof(((rte *) 0)->u.x))
+
 #define REF_COW		1		/* Copy this rte on write */
 #define REF_FILTERED	2		/* Route is rejected by import filter */
-#define REF_STALE	4		/* Route is stale in a refresh cycle */
-#define REF_DISCARD	8		/* Route is scheduled for discard */
-#define REF_MODIFY	16		/* Route is scheduled for modify */
+#define REF_INDEXED	4		/* Route is in the source index, see rt_src_index_net() */
 
 /* Route is valid for propagation (may depend on other flags in the future), accepts NULL */
 static inline int rte_is_valid(rte *r) { return r && !(r->flags & REF_FILTERED); }
@@ -280,6 +343,8 @@ static inline int rte_is_filtered(rte *r) { return !!(r->flags & REF_FILTERED);
 #define RA_ANY		3		/* Announcement of any route change */
 #define RA_MERGED	4		/* Announcement of optimal route merged with next ones */
 
+#define RA_LIMIT_MAX	32		/* Max routes per network in limited RA_ANY mode, see channel.ra_limit */
+
 /* Return value of preexport() callback */
 #define RIC_ACCEPT	1		/* Accepted by protocol */
 #define RIC_PROCESS	0		/* Process it through import filter */
@@ -294,16 +359,34 @@ void rt_preconfig(struct config *);
 void rt_commit(struct config *new, struct config *old);
 void rt_lock_table(rtable *);
 void rt_unlock_table(rtable *);
+rtable *rt_get_in_table(rtable *tab);
+rtable *rt_get_out_table(rtable *tab);
 void rt_setup(pool *, rtable *, struct rtable_config *);
+static inline int rt_ordered(rtable *tab) { return tab->config->ordered && tab->fib.lpm_slab; }
 static inline net *net_find(rtable *tab, const net_addr *addr) { return (net *) fib_find(&tab->fib, addr); }
 static inline net *net_find_valid(rtable *tab, const net_addr *addr)
 { net *n = net_find(tab, addr); return (n && rte_is_valid(n->routes)) ? n : NULL; }
 static inline net *net_get(rtable *tab, const net_addr *addr) { return (net *) fib_get(&tab->fib, addr); }
 void *net_route(rtable *tab, const net_addr *n);
 int net_roa_check(rtable *tab, const net_addr *n, u32 asn);
+struct roa_index *roa_index_new(pool *p);
+void roa_index_free(struct roa_index *ri);
+void roa_index_add(struct roa_index *ri, const net_addr *n);
+void roa_index_remove(struct roa_index *ri, const net_addr *n);
+int roa_index_check(struct roa_index *ri, const net_addr *n, u32 asn);
+
+struct roa_subscription {
+  node n;				/* Node in rtable->roa_subscribers */
+  rtable *tab;
+  void (*hook)(struct roa_subscription *s, const net_addr *roa); /* Called when the ROA gets valid or invalid */
+};
+
+void rt_roa_subscribe(rtable *tab, struct roa_subscription *s);
+void rt_roa_unsubscribe(struct roa_subscription *s);
 rte *rte_find(net *net, struct rte_src *src);
 rte *rte_get_temp(struct rta *);
 void rte_update2(struct channel *c, const net_addr *n, rte *new, struct rte_src *src);
+void rte_update_batch(struct channel *c, net_addr **nets, uint count, rte *new, struct rte_src *src);
 /* rte_update() moved to protocol.h to avoid dependency conflicts */
 int rt_examine(rtable *t, net_addr *a, struct proto *p, const struct filter *filter);
 rte *rt_export_merged(struct channel *c, net *net, rte **rt_free, linpool *pool, int silent);
@@ -311,6 +394,8 @@ void rt_refresh_begin(rtable *t, struct channel *c);
 void rt_refresh_end(rtable *t, struct channel *c);
 void rt_modify_stale(rtable *t, struct channel *c);
 void rt_schedule_prune(rtable *t);
+void rt_schedule_prune_channel(rtable *t, struct channel *c);
+void rt_event(void *ptr);
 void rte_dump(rte *);
 void rte_free(rte *);
 rte *rte_do_cow(rte *);
@@ -323,14 +408,86 @@ uintptr_t rte_store_tmp_attr(struct rte *r, uint id);
 void rt_dump(rtable *);
 void rt_dump_all(void);
 int rt_feed_channel(struct channel *c);
+void rt_flush_export_cache(struct channel *c);
+void rt_flush_merged_cache(struct channel *c);
 void rt_feed_channel_abort(struct channel *c);
 int rte_update_in(struct channel *c, const net_addr *n, rte *new, struct rte_src *src);
 int rt_reload_channel(struct channel *c);
 void rt_reload_channel_abort(struct channel *c);
-void rt_prune_sync(rtable *t, int all);
+int rt_resend_channel(struct channel *c);
+void rt_resend_channel_abort(struct channel *c);
+void rt_prune_sync(rtable *t, struct channel *c, int all);
 int rte_update_out(struct channel *c, const net_addr *n, rte *new, rte *old0, int refeed);
 struct rtable_config *rt_new_table(struct symbol *s, uint addr_type);
 
+/*
+ *	Read snapshot of a routing table. It is a flat array of pointers to all
+ *	routes of the table at the time of creation, grouped by network in table
+ *	order, each group terminated by NULL. While any snapshot of a table
+ *	exists, removed routes and orphaned networks are not freed, so the
+ *	snapshot and the routes it points to stay valid and unchanged and may be
+ *	read from any thread without locking. Only rte.flags and rte.next may be
+ *	changed by writers and must not be used by readers.
+ */
+
+struct rt_snapshot {
+  resource r;
+  rtable *table;			/* Snapshotted table, locked */
+  uint nets;				/* Number of networks with routes */
+  uint routes;				/* Number of routes */
+  struct rte **data;			/* Groups of routes, see above */
+  struct rte **end;			/* End of data */
+};
+
+struct rt_snapshot *rt_snapshot_new(pool *p, rtable *tab);
+
+/* Return the first route of the next network in snapshot */
+static inline struct rte **rt_snapshot_next(struct rte **pos)
+{ while (*pos++); return pos; }
+
+#define RT_SNAPSHOT_WALK(s, pos) \
+  for (rte **pos = (s)->data; pos < (s)->end; pos = rt_snapshot_next(pos))
+
+
+/*
+ *	Per-phase timing of route processing, enabled by the Perf protocol
+ *
+ *	The time of each phase is exclusive, i.e. the time spent in phases nested
+ *	in it (like export run from best route selection) is not included.
+ */
+
+enum rt_phase {
+  RT_PHASE_DECODE,			/* Decoding of protocol messages */
+  RT_PHASE_FILTER,			/* Import filter */
+  RT_PHASE_LOOKUP,			/* Attribute caching by rta_lookup() */
+  RT_PHASE_RECALC,			/* Best route selection by rte_recalculate() */
+  RT_PHASE_EXPORT,			/* Announcement to channels */
+  RT_PHASE_MAX
+};
+
+struct rt_phase_stats {
+  struct histogram phase[RT_PHASE_MAX];	/* Time of phase runs [ns] */
+  u64 accounted;			/* Sum of all phase times, for nesting */
+};
+
+struct rt_phase_mark {
+  u64 begin;
+  u64 accounted;
+};
+
+extern struct rt_phase_stats *rt_phase_stats;
+extern const char * const rt_phase_names[RT_PHASE_MAX];
+
+struct rt_phase_mark rt_phase_begin_(void);
+void rt_phase_end_(enum rt_phase phase, struct rt_phase_mark m);
+
+/* Both are no-op unless some rt_phase_stats are set */
+static inline struct rt_phase_mark rt_phase_begin(void)
+{ return rt_phase_stats ? rt_phase_begin_() : (struct rt_phase_mark) {}; }
+
+static inline void rt_phase_end(enum rt_phase phase, struct rt_phase_mark m)
+{ if (rt_phase_stats) rt_phase_end_(phase, m); }
+
 
 /* Default limit for ECMP next hops, defined in sysdep code */
 extern const int rt_default_ecmp;
@@ -339,6 +496,7 @@ struct rt_show_data_rtable {
   node n;
   rtable *table;
   struct channel *export_channel;
+  struct channel *table_channel;	/* Show only routes of this channel (shared import/export table) */
 };
 
 struct rt_show_data {
@@ -346,7 +504,8 @@ struct rt_show_data {
   list tables;
   struct rt_show_data_rtable *tab;	/* Iterator over table list */
   struct rt_show_data_rtable *last_table; /* Last table in output */
-  struct fib_iterator fit;		/* Iterator over networks in table */
+  struct rt_snapshot *snapshot;		/* Snapshot of the current table */
+  struct rte **snapshot_pos;		/* Next network in snapshot */
   int verbose, tables_defined_by;
   const struct filter *filter;
   struct proto *show_protocol;
@@ -354,15 +513,17 @@ struct rt_show_data {
   struct channel *export_channel;
   struct config *running_on_config;
   struct krt_proto *kernel;
-  int export_mode, primary_only, filtered, stats, show_for;
+  struct rt_show_verdict *verdicts;	/* Cached filter verdicts, see rt_show_filter() */
+  int export_mode, primary_only, filtered, stats, show_for, json;
 
-  int table_open;			/* Iteration (fit) is open */
+  int table_open;			/* Iteration (snapshot) is open */
   int net_counter, rt_counter, show_counter, table_counter;
   int net_counter_last, rt_counter_last, show_counter_last;
 };
 
 void rt_show(struct rt_show_data *);
 struct rt_show_data_rtable * rt_show_add_table(struct rt_show_data *d, rtable *t);
+void rt_show_tables(struct rtable_config *tc);
 
 /* Value of table definition mode in struct rt_show_data */
 #define RSD_TDB_DEFAULT	  0		/* no table specified */
@@ -409,6 +570,7 @@ struct rte_src {
   u32 private_id;			/* Private ID, assigned by the protocol */
   u32 global_id;			/* Globally unique ID of the source */
   unsigned uc;				/* Use count */
+  node n;				/* In list of unused sources when uc is 0 */
 };
 
 
@@ -425,6 +587,7 @@ typedef struct rta {
   u8 scope;				/* Route scope (SCOPE_... -- see ip.h) */
   u8 dest;				/* Route destination type (RTD_...) */
   u8 aflags;
+  u64 pref_key;				/* Protocol-specific route preference key, 0 if not cached yet */
   struct nexthop nh;			/* Next hop */
 } rta;
 
@@ -444,7 +607,18 @@ typedef struct rta {
 #define RTS_BABEL 13			/* Babel route */
 #define RTS_RPKI 14			/* Route Origin Authorization */
 #define RTS_PERF 15			/* Perf checker */
-#define RTS_MAX 16
+#define RTS_AGGREGATED 16		/* Aggregate of other routes */
+#define RTS_MAX 17
+
+extern const char * const rta_src_names[RTS_MAX];
+
+/* Route counters of a table, maintained as routes are linked and unlinked */
+struct rt_stats {
+  u32 nets;				/* Networks with a valid route */
+  u32 filtered;				/* Routes rejected by import filter */
+  u32 sources[RTS_MAX];			/* Routes by source (RTS_*) */
+  u32 pxlens[IP6_MAX_PREFIX_LENGTH + 1];	/* Routes by prefix length */
+};
 
 #define RTC_UNICAST 0
 #define RTC_BROADCAST 1
@@ -500,6 +674,7 @@ typedef struct eattr {
 const char *ea_custom_name(uint ea);
 
 #define EA_GEN_IGP_METRIC EA_CODE(PROTOCOL_NONE, 0)
+#define EA_GEN_PRIORITY_CLASS EA_CODE(PROTOCOL_NONE, 1)
 
 #define EA_CODE_MASK 0xffff
 #define EA_CUSTOM_BIT 0x8000
@@ -554,11 +729,13 @@ typedef struct ea_list {
 #define EALF_BISECT 2			/* Use interval bisection for searching */
 #define EALF_CACHED 4			/* Attributes belonging to cached rta */
 #define EALF_TEMP 8			/* Temporary ea_list added by make_tmp_attrs hooks */
+#define EALF_INDEX 16			/* Cached ea_list followed by &ea_index, see ea__find() */
 
 struct rte_src *rt_find_source(struct proto *p, u32 id);
 struct rte_src *rt_get_source(struct proto *p, u32 id);
-static inline void rt_lock_source(struct rte_src *src) { src->uc++; }
-static inline void rt_unlock_source(struct rte_src *src) { src->uc--; }
+void rt_release_source(struct rte_src *src);
+static inline void rt_lock_source(struct rte_src *src) { if (!src->uc++) rem_node(&src->n); }
+static inline void rt_unlock_source(struct rte_src *src) { if (!--src->uc) rt_release_source(src); }
 void rt_prune_sources(void);
 
 struct ea_walk_state {
@@ -570,6 +747,7 @@ struct ea_walk_state {
 eattr *ea_find(ea_list *, unsigned ea);
 eattr *ea_walk(struct ea_walk_state *s, uint id, uint max);
 int ea_get_int(ea_list *, unsigned ea, int def);
+int rte_is_priority(rte *e);
 void ea_dump(ea_list *);
 void ea_sort(ea_list *);		/* Sort entries in all sub-lists */
 unsigned ea_scan(ea_list *);		/* How many bytes do we need for merged ea_list */
@@ -578,6 +756,7 @@ int ea_same(ea_list *x, ea_list *y);	/* Test whether two ea_lists are identical
 uint ea_hash(ea_list *e);	/* Calculate 16-bit hash value */
 ea_list *ea_append(ea_list *to, ea_list *what);
 void ea_format_bitfield(const struct eattr *a, byte *buf, int bufsize, const char **names, int min, int max);
+void ea_json(struct json_writer *w, const eattr *e);
 
 #define ea_normalize(ea) do { \
   if (ea->next) { \
@@ -643,6 +822,7 @@ static inline void nexthop_link(struct rta *a, struct nexthop *from)
 { memcpy(&a->nh, from, nexthop_size(from)); }
 void nexthop_insert(struct nexthop **n, struct nexthop *y);
 int nexthop_is_sorted(struct nexthop *x);
+u32 nexthop_hash(struct nexthop *x);
 
 void rta_init(void);
 static inline size_t rta_size(const rta *a) { return sizeof(rta) + sizeof(u32)*a->nh.labels; }
@@ -657,6 +837,18 @@ static inline rta * rta_cow(rta *r, linpool *lp) { return rta_is_cached(r) ? rta
 void rta_dump(rta *);
 void rta_dump_all(void);
 void rta_show(struct cli *, rta *);
+void rta_json(struct json_writer *, rta *);
+
+struct rta_stats {
+  struct proto *proto;			/* Source protocol, NULL for total */
+  u64 lookups, hits;			/* Calls of rta_lookup(), found in cache (only total) */
+  uint count, refs;			/* Cached rta's, references to them */
+  uint size, chains, max_chain;		/* Hash table size, non-empty chains, longest one (only total) */
+  size_t rta_mem, nh_mem, ea_mem, adata_mem;	/* Memory used by parts of cached rta's */
+};
+
+uint rta_get_stats(struct rta_stats *total, struct rta_stats **per_proto, linpool *lp);
+void rta_get_hash_stats(struct hash_stats *sources, struct hash_stats *adata);
 
 u32 rt_get_igp_metric(rte *rt);
 struct hostentry * rt_get_hostentry(rtable *tab, ip_addr a, ip_addr ll, rtable *dep);
@@ -704,6 +896,8 @@ static inline void rt_unlock_hostentry(struct hostentry *he) { if (he) he->uc--;
 #define DEF_PREF_RIP		120	/* RIP */
 #define DEF_PREF_BGP		100	/* BGP */
 #define DEF_PREF_RPKI		100	/* RPKI */
+#define DEF_PREF_AGGREGATED	50	/* Aggregate of more specific routes */
+#define DEF_PREF_MRT		20	/* Routes preloaded from MRT file */
 #define DEF_PREF_INHERITED	10	/* Routes inherited from other routing daemons */
 
 /*
@@ -55,6 +55,7 @@
 #include "lib/idm.h"
 #include "lib/resource.h"
 #include "lib/string.h"
+#include "lib/json.h"
 
 #include <stddef.h>
 
@@ -76,6 +77,7 @@ const char * const rta_src_names[RTS_MAX] = {
   [RTS_PIPE]		= "pipe",
   [RTS_BABEL]		= "Babel",
   [RTS_RPKI]		= "RPKI",
+  [RTS_AGGREGATED]	= "aggregated",
 };
 
 const char * rta_dest_names[RTD_MAX] = {
@@ -107,6 +109,7 @@ static struct idm src_ids;
 #define RSH_INIT_ORDER		6
 
 static HASH(struct rte_src) src_hash;
+static list src_unused;			/* Sources with zero use count, to be pruned */
 
 static void
 rte_src_init(void)
@@ -116,6 +119,7 @@ rte_src_init(void)
   idm_init(&src_ids, rta_pool, SRC_ID_INIT_SIZE);
 
   HASH_INIT(src_hash, rta_pool, RSH_INIT_ORDER);
+  init_list(&src_unused);
 }
 
 
@@ -142,23 +146,38 @@ rt_get_source(struct proto *p, u32 id)
   src->uc = 0;
 
   HASH_INSERT2(src_hash, RSH, rta_pool, src);
+  add_tail(&src_unused, &src->n);
 
   return src;
 }
 
+/* Called when the use count drops to zero, see rt_unlock_source() */
+void
+rt_release_source(struct rte_src *src)
+{
+  add_tail(&src_unused, &src->n);
+}
+
+/*
+ * Unused sources are kept in a list, so pruning does not have to walk the
+ * whole source hash, which may be huge with many ADD-PATH sessions.
+ */
 void
 rt_prune_sources(void)
 {
-  HASH_WALK_FILTER(src_hash, next, src, sp)
+  struct rte_src *src;
+  node *n, *x;
+
+  if (EMPTY_LIST(src_unused))
+    return;
+
+  WALK_LIST2_DELSAFE(src, n, x, src_unused, n)
   {
-    if (src->uc == 0)
-    {
-      HASH_DO_REMOVE(src_hash, RSH, sp);
-      idm_free(&src_ids, src->global_id);
-      sl_free(rte_src_slab, src);
-    }
+    rem_node(n);
+    HASH_REMOVE(src_hash, RSH, src);
+    idm_free(&src_ids, src->global_id);
+    sl_free(rte_src_slab, src);
   }
-  HASH_WALK_FILTER_END;
 
   HASH_MAY_RESIZE_DOWN(src_hash, RSH, rta_pool);
 }
@@ -168,7 +187,7 @@ rt_prune_sources(void)
  *	Multipath Next Hop
  */
 
-static inline u32
+u32
 nexthop_hash(struct nexthop *x)
 {
   u32 h = 0;
@@ -402,6 +421,67 @@ nexthop_free(struct nexthop *o)
  *	Extended Attributes
  */
 
+/*
+ * Cached attribute lists are flat and sorted, so attributes of one protocol
+ * form a contiguous block. For the protocol with most attributes in the list,
+ * the &ea_index appended after the attributes maps attribute IDs to their
+ * positions by a bitmap of present IDs and running counts of its words, so
+ * ea__find() finds them (or their absence) in constant time.
+ */
+struct ea_index {
+  u16 proto;				/* Indexed protocol, EA_PROTO() */
+  u16 start;				/* Position of the first attribute of the protocol */
+  u16 base[8];				/* Number of attributes in preceding map words */
+  u32 map[8];				/* Bitmap of present attribute IDs, EA_ID() */
+};
+
+static inline struct ea_index *
+ea_get_index(ea_list *e)
+{
+  return (struct ea_index *) (e->attrs + e->count);
+}
+
+static void
+ea_build_index(ea_list *e)
+{
+  struct ea_index *x = ea_get_index(e);
+  uint best = 0, best_count = 0;
+
+  /* Find the largest block of attributes of one protocol */
+  for (uint i = 0, j; i < e->count; i = j)
+  {
+    for (j = i; (j < e->count) && (EA_PROTO(e->attrs[j].id) == EA_PROTO(e->attrs[i].id)); j++)
+      ;
+
+    if (j - i > best_count)
+    {
+      best = i;
+      best_count = j - i;
+    }
+  }
+
+  if (!best_count)
+  {
+    e->flags &= ~EALF_INDEX;
+    return;
+  }
+
+  memset(x, 0, sizeof(struct ea_index));
+  x->proto = EA_PROTO(e->attrs[best].id);
+  x->start = best;
+
+  for (uint i = best; i < best + best_count; i++)
+  {
+    uint id = EA_ID(e->attrs[i].id);
+    x->map[id / 32] |= 1U << (id % 32);
+  }
+
+  for (uint k = 1; k < 8; k++)
+    x->base[k] = x->base[k-1] + u32_popcount(x->map[k-1]);
+
+  e->flags |= EALF_INDEX;
+}
+
 static inline eattr *
 ea__find(ea_list *e, unsigned id)
 {
@@ -410,7 +490,17 @@ ea__find(ea_list *e, unsigned id)
 
   while (e)
     {
-      if (e->flags & EALF_BISECT)
+      if ((e->flags & EALF_INDEX) && (EA_PROTO(id) == ea_get_index(e)->proto))
+	{
+	  struct ea_index *x = ea_get_index(e);
+	  uint i = EA_ID(id);
+	  u32 w = x->map[i / 32];
+	  u32 b = 1U << (i % 32);
+
+	  if (w & b)
+	    return &e->attrs[x->start + x->base[i / 32] + u32_popcount(w & (b - 1))];
+	}
+      else if (e->flags & EALF_BISECT)
 	{
 	  l = 0;
 	  r = e->count - 1;
@@ -550,6 +640,19 @@ ea_get_int(ea_list *e, unsigned id, int def)
   return a->u.data;
 }
 
+/**
+ * rte_is_priority - check route priority class
+ * @e: route
+ *
+ * Routes of a nonzero priority class (generic attribute %EA_GEN_PRIORITY_CLASS)
+ * are sent out by protocols before other pending routes.
+ */
+int
+rte_is_priority(rte *e)
+{
+  return ea_get_int(e->attrs->eattrs, EA_GEN_PRIORITY_CLASS, 0) > 0;
+}
+
 static inline void
 ea_do_sort(ea_list *e)
 {
@@ -738,35 +841,123 @@ ea_same(ea_list *x, ea_list *y)
       if (a->id != b->id ||
 	  a->flags != b->flags ||
 	  a->type != b->type ||
-	  ((a->type & EAF_EMBEDDED) ? a->u.data != b->u.data : !adata_same(a->u.ptr, b->u.ptr)))
+	  ((a->type & EAF_EMBEDDED) ? a->u.data != b->u.data :
+	   ((a->u.ptr != b->u.ptr) && !adata_same(a->u.ptr, b->u.ptr))))
 	return 0;
     }
   return 1;
 }
 
+/*
+ * Attribute data (AS paths, community sets and others) of cached attribute
+ * lists are hash-consed in a global store with use counts, so routes with
+ * different attribute lists share the same AS path or community set data.
+ * For cached lists, equal data mean the same pointer, and the hash of data
+ * is kept in the store.
+ *
+ * Most shared data are short AS paths, often just tens of bytes. Therefore,
+ * they are allocated from slabs of a few size classes instead of mb_alloc(),
+ * whose per-block overhead would be larger than the data itself. Only data
+ * longer than the largest class use mb_alloc().
+ */
+struct adata_shared {
+  struct adata_shared *next;		/* Next in hash chain */
+  u32 hash;				/* Value of mem_hash() over data */
+  u32 uc;				/* Use count */
+  adata ad;				/* Shared data, must be last */
+};
+
+#define ADH_KEY(n)		&n->ad, n->hash
+#define ADH_NEXT(n)		n->next
+#define ADH_EQ(a1,h1,a2,h2)	h1 == h2 && adata_same(a1, a2)
+#define ADH_FN(a,h)		h
+
+#define ADH_REHASH		adata_rehash
+#define ADH_PARAMS		/8, *2, 2, 2, 10, 24
+
+static HASH(struct adata_shared) adata_hash;
+HASH_DEFINE_REHASH_FN(ADH, struct adata_shared)
+
+#define ADATA_SLABS 6
+static const uint adata_slab_size[ADATA_SLABS] = { 32, 48, 64, 96, 128, 192 };
+static slab *adata_slab_[ADATA_SLABS];
+
+static inline slab *
+adata_slab(uint length)
+{
+  uint size = sizeof(struct adata_shared) + length;
+
+  for (uint i = 0; i < ADATA_SLABS; i++)
+    if (size <= adata_slab_size[i])
+      return adata_slab_[i];
+
+  return NULL;
+}
+
+static inline struct adata_shared *
+adata_shared(const adata *d)
+{
+  return SKIP_BACK(struct adata_shared, ad, (adata *) d);
+}
+
+static const adata *
+adata_get(const adata *d, u32 h)
+{
+  struct adata_shared *s = HASH_FIND(adata_hash, ADH, d, h);
+
+  if (s)
+  {
+    s->uc++;
+    return &s->ad;
+  }
+
+  slab *sl = adata_slab(d->length);
+  s = sl ? sl_alloc(sl) : mb_alloc(rta_pool, sizeof(struct adata_shared) + d->length);
+  s->hash = h;
+  s->uc = 1;
+  memcpy(&s->ad, d, sizeof(adata) + d->length);
+  HASH_INSERT2(adata_hash, ADH, rta_pool, s);
+
+  return &s->ad;
+}
+
+static void
+adata_put(const adata *d)
+{
+  struct adata_shared *s = adata_shared(d);
+
+  if (--s->uc)
+    return;
+
+  HASH_REMOVE2(adata_hash, ADH, rta_pool, s);
+
+  slab *sl = adata_slab(s->ad.length);
+  if (sl)
+    sl_free(sl, s);
+  else
+    mb_free(s);
+}
+
+/* Data hashes @dh, if given, are those computed by ea_hash_data() */
 static inline ea_list *
-ea_list_copy(ea_list *o)
+ea_list_copy(ea_list *o, const u32 *dh)
 {
   ea_list *n;
   unsigned i, len;
 
   if (!o)
     return NULL;
-  ASSERT(!o->next);
+  ASSERT(!o->next && (o->flags & EALF_SORTED));
   len = sizeof(ea_list) + sizeof(eattr) * o->count;
-  n = mb_alloc(rta_pool, len);
+  n = mb_alloc(rta_pool, len + sizeof(struct ea_index));
   memcpy(n, o, len);
   n->flags |= EALF_CACHED;
+  ea_build_index(n);
   for(i=0; i<o->count; i++)
     {
       eattr *a = &n->attrs[i];
       if (!(a->type & EAF_EMBEDDED))
-	{
-	  unsigned size = sizeof(struct adata) + a->u.ptr->length;
-	  struct adata *d = mb_alloc(rta_pool, size);
-	  memcpy(d, a->u.ptr, size);
-	  a->u.ptr = d;
-	}
+	a->u.ptr = adata_get(a->u.ptr, dh ? dh[i] : mem_hash(a->u.ptr->data, a->u.ptr->length));
     }
   return n;
 }
@@ -783,7 +974,7 @@ ea_free(ea_list *o)
 	{
 	  eattr *a = &o->attrs[i];
 	  if (!(a->type & EAF_EMBEDDED))
-	    mb_free((void *) a->u.ptr);
+	    adata_put(a->u.ptr);
 	}
       mb_free(o);
     }
@@ -798,6 +989,12 @@ get_generic_attr(const eattr *a, byte **buf, int buflen UNUSED)
       return GA_NAME;
     }
 
+  if (a->id == EA_GEN_PRIORITY_CLASS)
+    {
+      *buf += bsprintf(*buf, "priority_class");
+      return GA_NAME;
+    }
+
   return GA_UNKNOWN;
 }
 
@@ -972,6 +1169,97 @@ ea_show(struct cli *c, const eattr *e)
   cli_printf(c, -1012, "\t%s", buf);
 }
 
+static void
+ea_json_name(const eattr *e, byte *buf, uint size)
+{
+  struct protocol *p;
+  int status = GA_UNKNOWN;
+  byte *pos = buf, *end = buf + size;
+
+  if (EA_IS_CUSTOM(e->id))
+    {
+      const char *name = ea_custom_name(e->id);
+      if (name)
+	{
+	  bsnprintf(pos, size, "%s", name);
+	  return;
+	}
+
+      pos += bsprintf(pos, "%02x.", EA_PROTO(e->id));
+    }
+  else if (p = class_to_protocol[EA_PROTO(e->id)])
+    {
+      pos += bsprintf(pos, "%s.", p->name);
+      if (p->get_attr)
+	status = p->get_attr(e, pos, end - pos);
+
+      /* Names are followed by formatted value in 'name: value' form */
+      char *colon = (status == GA_FULL) ? strchr(pos, ':') : NULL;
+      if (colon)
+	*colon = 0;
+      pos += strlen(pos);
+    }
+  else if (EA_PROTO(e->id))
+    pos += bsprintf(pos, "%02x.", EA_PROTO(e->id));
+  else
+    status = get_generic_attr(e, &pos, end - pos);
+
+  if (status < GA_NAME)
+    bsprintf(pos, "%02x", EA_ID(e->id));
+}
+
+/**
+ * ea_json - write an &eattr as JSON
+ * @w: JSON writer, inside an object
+ * @e: attribute to be written
+ *
+ * This function writes an extended attribute as a key-value pair. The value
+ * is written in its raw form according to the type information, protocol
+ * specific formatting is not used. Only names of attributes are obtained
+ * from the get_attr() hook of the protocol defining the attribute.
+ */
+void
+ea_json(struct json_writer *w, const eattr *e)
+{
+  const struct adata *ad = (e->type & EAF_EMBEDDED) ? NULL : e->u.ptr;
+  byte name[CLI_MSG_SIZE];
+
+  ea_json_name(e, name, sizeof(name));
+  json_key(w, name);
+
+  switch (e->type & EAF_TYPE_MASK)
+    {
+    case EAF_TYPE_INT:
+    case EAF_TYPE_BITFIELD:
+      json_printf(w, "%u", e->u.data);
+      break;
+    case EAF_TYPE_ROUTER_ID:
+      json_printf(w, "\"%R\"", e->u.data);
+      break;
+    case EAF_TYPE_IP_ADDRESS:
+      json_printf(w, "\"%I\"", *(ip_addr *) ad->data);
+      break;
+    case EAF_TYPE_OPAQUE:
+      json_hex(w, ad->data, ad->length);
+      break;
+    case EAF_TYPE_AS_PATH:
+      as_path_json(ad, w);
+      break;
+    case EAF_TYPE_INT_SET:
+      int_set_json(ad, 1, w);
+      break;
+    case EAF_TYPE_EC_SET:
+      ec_set_json(ad, w);
+      break;
+    case EAF_TYPE_LC_SET:
+      lc_set_json(ad, w);
+      break;
+    case EAF_TYPE_UNDEF:
+    default:
+      json_printf(w, "null");
+    }
+}
+
 /**
  * ea_dump - dump an extended attribute
  * @e: attribute to be dumped
@@ -1024,8 +1312,8 @@ ea_dump(ea_list *e)
  * ea_hash() takes an extended attribute list and calculated a hopefully
  * uniformly distributed hash value from its contents.
  */
-inline uint
-ea_hash(ea_list *e)
+static inline uint
+ea_hash_data(ea_list *e, u32 *dh)
 {
   const u64 mul = 0x68576150f3d6847;
   u64 h = 0xafcef24eda8b29;
@@ -1039,10 +1327,16 @@ ea_hash(ea_list *e)
 	  h ^= a->id; h *= mul;
 	  if (a->type & EAF_EMBEDDED)
 	    h ^= a->u.data;
+	  else if (e->flags & EALF_CACHED)
+	    h ^= adata_shared(a->u.ptr)->hash;
 	  else
 	    {
+	      /* Keep data hashes for the shared store, see rta_lookup() */
 	      const struct adata *d = a->u.ptr;
-	      h ^= mem_hash(d->data, d->length);
+	      u32 x = mem_hash(d->data, d->length);
+	      if (dh)
+		dh[i] = x;
+	      h ^= x;
 	    }
 	  h *= mul;
 	}
@@ -1050,6 +1344,12 @@ ea_hash(ea_list *e)
   return (h >> 32) ^ (h & 0xffffffff);
 }
 
+inline uint
+ea_hash(ea_list *e)
+{
+  return ea_hash_data(e, NULL);
+}
+
 /**
  * ea_append - concatenate &ea_list's
  * @to: destination list (can be %NULL)
@@ -1081,6 +1381,7 @@ static uint rta_cache_size = 32;
 static uint rta_cache_limit;
 static uint rta_cache_mask;
 static rta **rta_hash_table;
+static u64 rta_cache_lookups, rta_cache_hits;
 
 static void
 rta_alloc_hash(void)
@@ -1094,7 +1395,7 @@ rta_alloc_hash(void)
 }
 
 static inline uint
-rta_hash(rta *a)
+rta_hash(rta *a, u32 *dh)
 {
   u64 h;
   mem_hash_init(&h);
@@ -1108,7 +1409,7 @@ rta_hash(rta *a)
   MIX(dest);
 #undef MIX
 
-  return mem_hash_value(&h) ^ nexthop_hash(&(a->nh)) ^ ea_hash(a->eattrs);
+  return mem_hash_value(&h) ^ nexthop_hash(&(a->nh)) ^ ea_hash_data(a->eattrs, dh);
 }
 
 static inline int
@@ -1132,14 +1433,15 @@ rta_slab(rta *a)
 }
 
 static rta *
-rta_copy(rta *o)
+rta_copy(rta *o, const u32 *dh)
 {
   rta *r = sl_alloc(rta_slab(o));
 
   memcpy(r, o, rta_size(o));
   r->uc = 1;
+  r->pref_key = 0;
   r->nh.next = nexthop_copy(o->nh.next);
-  r->eattrs = ea_list_copy(o->eattrs);
+  r->eattrs = ea_list_copy(o->eattrs, dh);
   return r;
 }
 
@@ -1197,12 +1499,19 @@ rta_lookup(rta *o)
   if (o->eattrs)
     ea_normalize(o->eattrs);
 
-  h = rta_hash(o);
+  /* Hashes of attribute data are computed just once */
+  u32 dh[o->eattrs ? o->eattrs->count : 1];
+
+  rta_cache_lookups++;
+  h = rta_hash(o, dh);
   for(r=rta_hash_table[h & rta_cache_mask]; r; r=r->next)
     if (r->hash_key == h && rta_same(r, o))
+    {
+      rta_cache_hits++;
       return rta_clone(r);
+    }
 
-  r = rta_copy(o);
+  r = rta_copy(o, (o->eattrs && !(o->eattrs->flags & EALF_CACHED)) ? dh : NULL);
   r->hash_key = h;
   r->aflags = RTAF_CACHED;
   rt_lock_source(r->src);
@@ -1245,6 +1554,7 @@ rta_do_cow(rta *o, linpool *lp)
     }
   r->aflags = 0;
   r->uc = 0;
+  r->pref_key = 0;
   return r;
 }
 
@@ -1308,6 +1618,121 @@ rta_dump_all(void)
   debug("\n");
 }
 
+static void
+rta_stats_add(struct rta_stats *st, rta *a)
+{
+  st->count++;
+  st->refs += a->uc;
+  st->rta_mem += rta_size(a);
+
+  for (struct nexthop *nh = a->nh.next; nh; nh = nh->next)
+    st->nh_mem += nexthop_size(nh);
+
+  ea_list *e = a->eattrs;
+  if (!e)
+    return;
+
+  st->ea_mem += sizeof(ea_list) + sizeof(eattr) * e->count + sizeof(struct ea_index);
+  for (uint i = 0; i < e->count; i++)
+    if (!(e->attrs[i].type & EAF_EMBEDDED))
+    {
+      /* Shared data are accounted proportionally to their users */
+      const adata *d = e->attrs[i].u.ptr;
+      st->adata_mem += (sizeof(struct adata_shared) + d->length) / adata_shared(d)->uc;
+    }
+}
+
+/**
+ * rta_get_stats - collect statistics of route attribute cache
+ * @total: statistics of the whole cache
+ * @per_proto: returned array of per-protocol statistics
+ * @lp: linpool for @per_proto array and temporary data
+ *
+ * This function walks the attribute cache and computes number of cached
+ * &rta's, their references (so the ratio is the deduplication factor), hash
+ * chain lengths and memory used by &rta's, their next hops, extended attribute
+ * lists and attribute data, both in total and per source protocol. Memory
+ * sizes are without allocator overhead. The function returns the number of
+ * entries in @per_proto.
+ */
+uint
+rta_get_stats(struct rta_stats *total, struct rta_stats **per_proto, linpool *lp)
+{
+  /* Small open hash from protocols to their statistics */
+  uint psize = 64, pcount = 0;
+  struct rta_stats *ps = lp_allocz(lp, psize * sizeof(struct rta_stats));
+
+  *total = (struct rta_stats) {
+    .lookups = rta_cache_lookups,
+    .hits = rta_cache_hits,
+    .size = rta_cache_size,
+  };
+
+  for (uint h = 0; h < rta_cache_size; h++)
+  {
+    uint len = 0;
+
+    for (rta *a = rta_hash_table[h]; a; a = a->next, len++)
+    {
+      struct proto *p = a->src->proto;
+
+      if (2 * pcount >= psize)
+      {
+	struct rta_stats *old = ps;
+	uint osize = psize;
+
+	psize *= 2;
+	ps = lp_allocz(lp, psize * sizeof(struct rta_stats));
+	for (uint i = 0; i < osize; i++)
+	  if (old[i].proto)
+	  {
+	    uint j = ptr_hash(old[i].proto) & (psize - 1);
+	    while (ps[j].proto)
+	      j = (j + 1) & (psize - 1);
+	    ps[j] = old[i];
+	  }
+      }
+
+      uint j = ptr_hash(p) & (psize - 1);
+      while (ps[j].proto && (ps[j].proto != p))
+	j = (j + 1) & (psize - 1);
+
+      if (!ps[j].proto)
+      {
+	ps[j].proto = p;
+	pcount++;
+      }
+
+      rta_stats_add(&ps[j], a);
+      rta_stats_add(total, a);
+    }
+
+    total->chains += !!len;
+    total->max_chain = MAX(total->max_chain, len);
+  }
+
+  struct rta_stats *res = lp_alloc(lp, (pcount ?: 1) * sizeof(struct rta_stats));
+  uint n = 0;
+  for (uint i = 0; i < psize; i++)
+    if (ps[i].proto)
+      res[n++] = ps[i];
+
+  *per_proto = res;
+  return n;
+}
+
+/**
+ * rta_get_hash_stats - collect statistics of route source and attribute data hashes
+ * @sources: statistics of route source hash
+ * @adata: statistics of shared attribute data hash
+ */
+void
+rta_get_hash_stats(struct hash_stats *sources, struct hash_stats *adata)
+{
+  HASH_STATS(src_hash, next, *sources);
+  HASH_STATS(adata_hash, next, *adata);
+}
+
 void
 rta_show(struct cli *c, rta *a)
 {
@@ -1318,6 +1743,27 @@ rta_show(struct cli *c, rta *a)
       ea_show(c, &eal->attrs[i]);
 }
 
+/**
+ * rta_json - write route attributes as JSON
+ * @w: JSON writer, inside an object
+ * @a: attributes
+ *
+ * This function writes route type, scope and all extended attributes of @a,
+ * similarly to rta_show().
+ */
+void
+rta_json(struct json_writer *w, rta *a)
+{
+  json_put_string(w, "type", rta_src_names[a->source]);
+  json_put_string(w, "scope", ip_scope_text(a->scope));
+
+  json_open(w, "attributes", '{');
+  for(ea_list *eal = a->eattrs; eal; eal=eal->next)
+    for(int i=0; i<eal->count; i++)
+      ea_json(w, &eal->attrs[i]);
+  json_close(w, '}');
+}
+
 /**
  * rta_init - initialize route attribute cache
  *
@@ -1329,17 +1775,22 @@ rta_init(void)
 {
   rta_pool = rp_new(&root_pool, "Attributes");
 
-  rta_slab_[0] = sl_new(rta_pool, sizeof(rta));
-  rta_slab_[1] = sl_new(rta_pool, sizeof(rta) + sizeof(u32));
-  rta_slab_[2] = sl_new(rta_pool, sizeof(rta) + sizeof(u32)*2);
-  rta_slab_[3] = sl_new(rta_pool, sizeof(rta) + sizeof(u32)*MPLS_MAX_LABEL_STACK);
+  rta_slab_[0] = sl_new_flags(rta_pool, sizeof(rta), SL_MAGAZINES);
+  rta_slab_[1] = sl_new_flags(rta_pool, sizeof(rta) + sizeof(u32), SL_MAGAZINES);
+  rta_slab_[2] = sl_new_flags(rta_pool, sizeof(rta) + sizeof(u32)*2, SL_MAGAZINES);
+  rta_slab_[3] = sl_new_flags(rta_pool, sizeof(rta) + sizeof(u32)*MPLS_MAX_LABEL_STACK, SL_MAGAZINES);
+
+  nexthop_slab_[0] = sl_new_flags(rta_pool, sizeof(struct nexthop), SL_MAGAZINES);
+  nexthop_slab_[1] = sl_new_flags(rta_pool, sizeof(struct nexthop) + sizeof(u32), SL_MAGAZINES);
+  nexthop_slab_[2] = sl_new_flags(rta_pool, sizeof(struct nexthop) + sizeof(u32)*2, SL_MAGAZINES);
+  nexthop_slab_[3] = sl_new_flags(rta_pool, sizeof(struct nexthop) + sizeof(u32)*MPLS_MAX_LABEL_STACK, SL_MAGAZINES);
 
-  nexthop_slab_[0] = sl_new(rta_pool, sizeof(struct nexthop));
-  nexthop_slab_[1] = sl_new(rta_pool, sizeof(struct nexthop) + sizeof(u32));
-  nexthop_slab_[2] = sl_new(rta_pool, sizeof(struct nexthop) + sizeof(u32)*2);
-  nexthop_slab_[3] = sl_new(rta_pool, sizeof(struct nexthop) + sizeof(u32)*MPLS_MAX_LABEL_STACK);
+  for (uint i = 0; i < ADATA_SLABS; i++)
+    adata_slab_[i] = sl_new_flags(rta_pool, adata_slab_size[i], SL_MAGAZINES);
 
   rta_alloc_hash();
+  HASH_INIT(adata_hash, rta_pool, 10);
+
   rte_src_init();
 }
 
@@ -18,12 +18,11 @@
  *
  * Internally, each FIB is represented as a collection of nodes of type &fib_node
  * indexed using a sophisticated hashing mechanism.
- * We use two-stage hashing where we calculate a 16-bit primary hash key independent
- * on hash table size and then we just divide the primary keys modulo table size
- * to get a real hash key used for determining the bucket containing the node.
- * The lists of nodes in each bucket are sorted according to the primary hash
- * key, hence if we keep the total number of buckets to be a power of two,
- * re-hashing of the structure keeps the relative order of the nodes.
+ * We use two-stage hashing where we calculate a 32-bit primary hash key independent
+ * on hash table size and then we just take its top bits to get the home slot
+ * of the node in an open addressing table. The slots are kept sorted according
+ * to the primary hash key, hence if we keep the number of home slots to be a
+ * power of two, re-hashing of the structure keeps the relative order of the nodes.
  *
  * To get the asynchronous reading consistent over node deletions, we need to
  * keep a list of readers for each node. When a node gets deleted, its readers
@@ -50,6 +49,11 @@
  * the FIB would then contain a pointer to invalid memory. Therefore, after each
  * FIB_ITERATE_INIT() or FIB_ITERATE_PUT() there must be either
  * FIB_ITERATE_START() or FIB_ITERATE_UNLINK() before the iterator is destroyed.
+ *
+ * IP FIBs used for longest prefix matches may also keep a path-compressed
+ * binary trie of their nodes, see fib_lpm_init(). Then fib_route() and
+ * fib_route_list() walk the trie instead of probing the hash table for each
+ * prefix length.
  */
 
 #undef LOCAL_DEBUG
@@ -59,71 +63,101 @@
 #include "lib/string.h"
 
 /*
- * The FIB rehash values are maintaining FIB count between N/5 and 2N. What
- * does it mean?
+ * The FIB rehash values are maintaining FIB count between N/8 and 3N/4 where
+ * N is the number of home slots. What does it mean?
  *
- * +------------+--------+---------+-----------+----------+-----------+
- * | Table size | Memory | Min cnt | net + rte |  Max cnt | net + rte |
- * +------------+--------+---------+-----------+----------+-----------+
- * |         1k |     8k |    0    |      0    |       2k |    192  k |
- * |         2k |    16k |  409    |     38.3k |       4k |    384  k |
- * |         4k |    32k |  819    |     76.8k |       8k |    768  k |
- * |         8k |    64k |    1.6k |    153.6k |      16k |      1.5M |
- * |        16k |   128k |    3.2k |    307.1k |      32k |      3  M |
- * |        32k |   256k |    6.4k |    614.3k |      64k |      6  M |
- * |        64k |   512k |   12.8k |      1.2M |     128k |     12  M |
- * |       128k |  1024k |   25.6k |      2.4M |     256k |     24  M |
- * |       256k |     2M |   51.2k |      4.8M |     512k |     48  M |
- * |       512k |     4M |  102.4k |      9.6M |       1M |     96  M |
- * |         1M |     8M |  204.8k |     19.2M |       2M |    192  M |
- * |         2M |    16M |  409.6k |     38.4M |       4M |    384  M |
- * |         4M |    32M |  819.2k |     76.8M |       8M |    768  M |
- * |         8M |    64M |    1.6M |    153.6M | infinity |  infinity |
- * +------------+--------+---------+-----------+----------+-----------+
+ * +------------+--------+---------+----------+
+ * | Table size | Memory | Min cnt |  Max cnt |
+ * +------------+--------+---------+----------+
+ * |         1k |    12k |       0 |      768 |
+ * |         2k |    24k |     256 |     1.5k |
+ * |         4k |    48k |     512 |       3k |
+ * |         8k |    96k |      1k |       6k |
+ * |        16k |   192k |      2k |      12k |
+ * |        32k |   384k |      4k |      24k |
+ * |        64k |   768k |      8k |      48k |
+ * |       128k |   1.5M |     16k |      96k |
+ * |       256k |     3M |     32k |     192k |
+ * |       512k |     6M |     64k |     384k |
+ * |         1M |    12M |    128k |     768k |
+ * |         2M |    24M |    256k |     1.5M |
+ * |         4M |    48M |    512k |       3M |
+ * |         8M |    96M |      1M |       6M |
+ * |        16M |   192M |      2M |      12M |
+ * +------------+--------+---------+----------+
  *
- * Table size	shows how many slots are in FIB table.
- * Memory	shows how much memory is eaten by FIB table.
+ * Table size	shows how many home slots are in FIB table.
+ * Memory	shows how much memory is eaten by FIB table (one node pointer
+ *		and one 32-bit key per slot).
  * Min cnt	minimal number of nets in table of given size
  * Max cnt	maximal number of nets in table of given size
- * net + rte	memory eaten by 1 net and one route in it for min cnt and max cnt
  *
  * Example: If we have 750,000 network entries in a table:
- * * the table size may be 512k if we have never had more
- * * the table size may be 1M or 2M if we at least happened to have more
- * * 256k is too small, 8M is too big
+ * * the table size may be 1M if we have never had more
+ * * the table size may be 2M or 4M if we at least happened to have more
+ * * 512k is too small, 8M is too big
  *
  * When growing, rehash is done on demand so we do it on every power of 2.
  * When shrinking, rehash is done on delete which is done (in global tables)
- * in a scheduled event. Rehashing down 2 steps.
+ * in a scheduled event. Rehashing down 1 step, which leaves the table a
+ * quarter full.
+ *
+ * Rehashing is incremental. The old table is kept aside and each following
+ * insertion or deletion migrates HASH_MOVE_STEP of its slots to the new table,
+ * taking them from the start so that the old table stays a valid ordered
+ * table. New nodes go to the new table, lookups consult both. With the load
+ * limits above, the migration ends long before another rehash is needed.
+ * Walking the FIB, starting or resuming an iterator, and deleting a node
+ * having readers complete the pending migration first, so that the readers
+ * always see a single table.
  *
+ * The table uses open addressing with ordered linear probing. Each node is
+ * stored in its home slot (the top bits of its primary hash key) or in the
+ * first free slot after it, and the slots are kept sorted by the primary key.
+ * Hence there are never free slots between the home slot of a node and the
+ * node itself, a lookup stops at the first larger key, and re-hashing keeps
+ * the relative order of the nodes. Primary keys are kept in a separate array
+ * so that a probe usually touches a single cache line. Runs reaching past the
+ * last home slot continue in a small overflow area; the very last slot is
+ * always free and terminates all scans.
  */
 
 
 #define HASH_DEF_ORDER 10
-#define HASH_HI_MARK * 2
+#define HASH_HI_MARK * 3 / 4
 #define HASH_HI_STEP 1
-#define HASH_HI_MAX 24
-#define HASH_LO_MARK / 5
-#define HASH_LO_STEP 2
+#define HASH_HI_MAX 30
+#define HASH_LO_MARK / 8
+#define HASH_LO_STEP 1
 #define HASH_LO_MIN 10
 
+#define HASH_EMPTY 0xffffffff
+#define HASH_EXTRA 64
+#define HASH_MOVE_STEP 64
+
 
 static void
 fib_ht_alloc(struct fib *f)
 {
-  f->hash_size = 1 << f->hash_order;
+  uint home = 1 << f->hash_order;
+
+  f->hash_size = home + f->hash_extra;
   f->hash_shift = 32 - f->hash_order;
   if (f->hash_order > HASH_HI_MAX - HASH_HI_STEP)
     f->entries_max = ~0;
   else
-    f->entries_max = f->hash_size HASH_HI_MARK;
+    f->entries_max = home HASH_HI_MARK;
   if (f->hash_order < HASH_LO_MIN + HASH_LO_STEP)
     f->entries_min = 0;
   else
-    f->entries_min = f->hash_size HASH_LO_MARK;
+    f->entries_min = home HASH_LO_MARK;
   DBG("Allocating FIB hash of order %d: %d entries, %d low, %d high\n",
       f->hash_order, f->hash_size, f->entries_min, f->entries_max);
-  f->hash_table = mb_alloc(f->fib_pool, f->hash_size * sizeof(struct fib_node *));
+
+  /* Node pointers and primary keys share one block */
+  f->hash_table = mb_allocz(f->fib_pool, f->hash_size * (sizeof(struct fib_node *) + sizeof(u32)));
+  f->hash_keys = (u32 *) (f->hash_table + f->hash_size);
+  memset(f->hash_keys, 0xff, f->hash_size * sizeof(u32));
 }
 
 static inline void
@@ -132,7 +166,6 @@ fib_ht_free(struct fib_node **h)
   mb_free(h);
 }
 
-
 static inline u32 fib_hash(struct fib *f, const net_addr *a);
 
 /**
@@ -160,98 +193,261 @@ fib_init(struct fib *f, pool *p, uint addr_type, uint node_size, uint node_offse
   f->node_size = node_size;
   f->node_offset = node_offset;
   f->hash_order = hash_order;
+  f->hash_extra = HASH_EXTRA;
+  f->old_table = NULL;
+  f->old_keys = NULL;
+  f->lpm_root = NULL;
+  f->lpm_slab = NULL;
   fib_ht_alloc(f);
-  bzero(f->hash_table, f->hash_size * sizeof(struct fib_node *));
   f->entries = 0;
   f->entries_min = 0;
   f->init = init;
 }
 
+/* Rebuild the current table in one go, used to enlarge its overflow area */
 static void
-fib_rehash(struct fib *f, int step)
+fib_ht_rebuild(struct fib *f)
 {
-  unsigned old, new, oldn, newn, ni, nh;
-  struct fib_node **n, *e, *x, **t, **m, **h;
+  struct fib_node **h = f->hash_table;
+  u32 *k = f->hash_keys;
+  uint oldn = f->hash_size;
+
+  DBG("Rebuilding FIB hash of order %d with %d extra slots\n", f->hash_order, f->hash_extra);
 
-  old = f->hash_order;
-  oldn = f->hash_size;
-  new = old + step;
-  m = h = f->hash_table;
-  DBG("Re-hashing FIB from order %d to %d\n", old, new);
-  f->hash_order = new;
+again:
   fib_ht_alloc(f);
-  t = n = f->hash_table;
-  newn = f->hash_size;
-  ni = 0;
 
-  while (oldn--)
-    {
-      x = *h++;
-      while (e = x)
-	{
-	  x = e->next;
-	  nh = fib_hash(f, e->addr);
-	  while (nh > ni)
-	    {
-	      *t = NULL;
-	      ni++;
-	      t = ++n;
-	    }
-	  *t = e;
-	  t = &e->next;
-	}
-    }
-  while (ni < newn)
+  /* Nodes are visited in key order, so each one goes to its home slot or right after the previous one */
+  uint pos = 0;
+  for (uint i = 0; i < oldn; i++)
+    if (h[i])
+      {
+	uint nh = MAX(k[i] >> f->hash_shift, pos);
+	if (nh >= f->hash_size - 1)
+	  {
+	    /* Overflow area too small, the last slot must stay free */
+	    fib_ht_free(f->hash_table);
+	    f->hash_extra *= 2;
+	    goto again;
+	  }
+
+	f->hash_table[nh] = h[i];
+	f->hash_keys[nh] = k[i];
+	pos = nh + 1;
+      }
+
+  fib_ht_free(h);
+}
+
+/* Remove node in slot @i, shifting back the following nodes which are not in their home slots */
+static void
+fib_ht_remove(struct fib_node **tab, u32 *keys, uint shift, uint i)
+{
+  uint j;
+
+  for (j = i + 1; (keys[j] != HASH_EMPTY) && ((keys[j] >> shift) < j); j++)
+    ;
+
+  memmove(tab + i, tab + i + 1, (j - i - 1) * sizeof(struct fib_node *));
+  memmove(keys + i, keys + i + 1, (j - i - 1) * sizeof(u32));
+  tab[j - 1] = NULL;
+  keys[j - 1] = HASH_EMPTY;
+}
+
+/* Slot index of a node in the given table, ~0 if it is not there */
+static uint
+fib_ht_slot(struct fib_node **tab, u32 *keys, uint shift, struct fib_node *e, u32 h)
+{
+  uint i = h >> shift;
+
+  for (; keys[i] <= h; i++)
+    if (tab[i] == e)
+      return i;
+
+  return ~0;
+}
+
+static void fib_insert_node(struct fib *f, struct fib_node *e, u32 h);
+
+/* Move old table nodes to the current table, @n slots at most */
+static void
+fib_rehash_step(struct fib *f, uint n)
+{
+  while (n-- && (f->rehash_pos < f->old_size))
+  {
+    struct fib_node *e = f->old_table[f->rehash_pos];
+    u32 h = f->old_keys[f->rehash_pos];
+
+    if (!e)
     {
-      *t = NULL;
-      ni++;
-      t = ++n;
+      f->rehash_pos++;
+      continue;
     }
-  fib_ht_free(m);
+
+    /* All slots before rehash_pos are free, so the next node shifts to rehash_pos */
+    fib_ht_remove(f->old_table, f->old_keys, f->old_shift, f->rehash_pos);
+    fib_insert_node(f, e, h);
+  }
+
+  if (f->rehash_pos >= f->old_size)
+  {
+    DBG("Re-hashing FIB to order %d done\n", f->hash_order);
+    fib_ht_free(f->old_table);
+    f->old_table = NULL;
+    f->old_keys = NULL;
+  }
+}
+
+static inline void
+fib_rehash_done(struct fib *f)
+{
+  if (f->old_table)
+    fib_rehash_step(f, ~0);
+}
+
+/**
+ * fib_rehash_finish - complete pending rehash
+ * @f: FIB to work with
+ *
+ * Migrate all nodes left in the old hash table, if any. This is done before
+ * FIB iteration, as the iterators address slots of a single table.
+ */
+void
+fib_rehash_finish(struct fib *f)
+{
+  if (!f->old_table)
+    return;
+
+  fib_rehash_done(f);
+}
+
+static void
+fib_rehash(struct fib *f, int step)
+{
+  /* Pending migration, if any, must be done before the next one */
+  fib_rehash_done(f);
+
+  DBG("Re-hashing FIB from order %d to %d\n", f->hash_order, f->hash_order + step);
+  f->old_table = f->hash_table;
+  f->old_keys = f->hash_keys;
+  f->old_size = f->hash_size;
+  f->old_shift = f->hash_shift;
+  f->rehash_pos = 0;
+
+  f->hash_order += step;
+  fib_ht_alloc(f);
+
+  fib_rehash_step(f, HASH_MOVE_STEP);
 }
 
 #define CAST(t) (const net_addr_##t *)
 #define CAST2(t) (net_addr_##t *)
 
-#define FIB_HASH(f,a,t) (net_hash_##t(CAST(t) a) >> f->hash_shift)
+#define FIB_FIND_HT(tab,keys,shift,h,a,t)				\
+  ({									\
+    const u32 *k = keys;						\
+    uint i = h >> shift;						\
+    struct fib_node *e = NULL;						\
+									\
+    while (k[i] < h)							\
+      i++;								\
+									\
+    for (; k[i] == h; i++)						\
+      if (net_equal_##t(CAST(t) tab[i]->addr, CAST(t) a))		\
+      {									\
+	e = tab[i];							\
+	break;								\
+      }									\
+									\
+    e;									\
+  })
 
 #define FIB_FIND(f,a,t)							\
   ({									\
-    struct fib_node *e = f->hash_table[FIB_HASH(f, a, t)];		\
-    while (e && !net_equal_##t(CAST(t) e->addr, CAST(t) a))		\
-      e = e->next;							\
+    u32 h = fib_key(net_hash_##t(CAST(t) a));				\
+    struct fib_node *e = FIB_FIND_HT(f->hash_table, f->hash_keys, f->hash_shift, h, a, t); \
+									\
+    if (!e && f->old_table)						\
+      e = FIB_FIND_HT(f->old_table, f->old_keys, f->old_shift, h, a, t); \
+									\
     fib_node_to_user(f, e);						\
   })
 
 #define FIB_INSERT(f,a,e,t)						\
   ({									\
-  u32 h = net_hash_##t(CAST(t) a);					\
-  struct fib_node **ee = f->hash_table + (h >> f->hash_shift);		\
-  struct fib_node *g;							\
-									\
-  while ((g = *ee) && (net_hash_##t(CAST(t) g->addr) < h))		\
-    ee = &g->next;							\
-									\
   net_copy_##t(CAST2(t) e->addr, CAST(t) a);				\
-  e->next = *ee;							\
-  *ee = e;								\
+  fib_insert_node(f, e, fib_key(net_hash_##t(CAST(t) a)));		\
   })
 
 
 static inline u32
 fib_hash(struct fib *f, const net_addr *a)
 {
-  /* Same as FIB_HASH() */
-  return net_hash(a) >> f->hash_shift;
+  /* Home slot, same as in FIB_FIND() */
+  return fib_key(net_hash(a)) >> f->hash_shift;
 }
 
-void *
-fib_get_chain(struct fib *f, const net_addr *a)
+/* Slot index of a node in the table */
+static uint
+fib_slot(struct fib *f, struct fib_node *e)
+{
+  uint i = fib_ht_slot(f->hash_table, f->hash_keys, f->hash_shift, e, fib_node_key(e));
+
+  if (i == ~0U)
+    bug("fib_slot() called for invalid node");
+
+  return i;
+}
+
+/**
+ * fib_get_chain - find nodes sharing a primary hash key
+ * @f: FIB to search in
+ * @a: network address
+ * @len: number of returned nodes
+ *
+ * Return a pointer to the run of hash table slots holding nodes with the same
+ * primary hash key as @a and store its length to @len. These contain all nodes
+ * equal to @a, but also nodes whose addresses differ only in parts not
+ * covered by the hash function (e.g. ROA max length or SADR source prefix).
+ *
+ * During rehash, the nodes with this key are first pulled from the old table,
+ * so that the whole run is in the current one.
+ */
+struct fib_node **
+fib_get_chain(struct fib *f, const net_addr *a, uint *len)
 {
   ASSERT(f->addr_type == a->type);
 
-  struct fib_node *e = f->hash_table[fib_hash(f, a)];
-  return e;
+  u32 h = fib_key(net_hash(a));
+  uint i, j;
+
+  if (f->old_table)
+  {
+    for (;;)
+    {
+      /* Removal shifts back the rest of the run, start from its home again */
+      for (i = h >> f->old_shift; f->old_keys[i] < h; i++)
+	;
+
+      if (f->old_keys[i] != h)
+	break;
+
+      struct fib_node *e = f->old_table[i];
+      fib_ht_remove(f->old_table, f->old_keys, f->old_shift, i);
+      fib_insert_node(f, e, h);
+    }
+  }
+
+  i = h >> f->hash_shift;
+
+  while (f->hash_keys[i] < h)
+    i++;
+
+  for (j = i; f->hash_keys[j] == h; j++)
+    ;
+
+  *len = j - i;
+  return f->hash_table + i;
 }
 
 /**
@@ -283,6 +479,292 @@ fib_find(struct fib *f, const net_addr *a)
   }
 }
 
+
+/*
+ * Longest prefix match index. Nodes of the trie keep prefixes (as IPv6
+ * addresses, IPv4 ones are stored in the top 32 bits) and have the FIB node
+ * attached or are glue nodes having always both children. Children are
+ * indexed by the bit just after the node prefix.
+ */
+
+struct fib_lpm_node {
+  struct fib_lpm_node *c[2];
+  struct fib_node *fn;			/* NULL for glue nodes */
+  ip6_addr addr;
+  uint len;
+};
+
+static inline ip6_addr
+fib_lpm_key(const net_addr *a, uint *len)
+{
+  if (a->type == NET_IP4)
+  {
+    const net_addr_ip4 *n = (const void *) a;
+    *len = n->pxlen;
+    return ip6_build(ip4_to_u32(n->prefix), 0, 0, 0);
+  }
+
+  const net_addr_ip6 *n = (const void *) a;
+  *len = n->pxlen;
+  return n->prefix;
+}
+
+/* Length of the common prefix of two keys */
+static inline uint
+fib_lpm_common(ip6_addr a, ip6_addr b)
+{
+  return ip6_equal(a, b) ? IP6_MAX_PREFIX_LENGTH : ip6_pxlen(a, b);
+}
+
+static inline uint
+fib_lpm_bit(ip6_addr a, uint pos)
+{
+  return !!ip6_getbit(a, pos);
+}
+
+static struct fib_lpm_node *
+fib_lpm_new(struct fib *f, ip6_addr addr, uint len, struct fib_node *fn)
+{
+  struct fib_lpm_node *n = sl_alloc(f->lpm_slab);
+
+  n->c[0] = n->c[1] = NULL;
+  n->fn = fn;
+  n->addr = addr;
+  n->len = len;
+  return n;
+}
+
+static void
+fib_lpm_insert(struct fib *f, struct fib_node *fn)
+{
+  struct fib_lpm_node **np = &f->lpm_root, *n;
+  uint len;
+  ip6_addr k = fib_lpm_key(fn->addr, &len);
+
+  while (n = *np)
+  {
+    uint cl = MIN(fib_lpm_common(k, n->addr), MIN(len, n->len));
+
+    if (cl < n->len)
+    {
+      struct fib_lpm_node *m = fib_lpm_new(f, k, len, fn);
+
+      if (cl == len)
+      {
+	/* The new prefix covers the node */
+	m->c[fib_lpm_bit(n->addr, len)] = n;
+	*np = m;
+	return;
+      }
+
+      /* Both hang on a new glue node at the point they diverge */
+      struct fib_lpm_node *g = fib_lpm_new(f, ip6_and(k, ip6_mkmask(cl)), cl, NULL);
+      g->c[fib_lpm_bit(k, cl)] = m;
+      g->c[fib_lpm_bit(n->addr, cl)] = n;
+      *np = g;
+      return;
+    }
+
+    if (len == n->len)
+    {
+      /* An existing glue node */
+      n->fn = fn;
+      return;
+    }
+
+    np = &n->c[fib_lpm_bit(k, n->len)];
+  }
+
+  *np = fib_lpm_new(f, k, len, fn);
+}
+
+static void
+fib_lpm_remove(struct fib *f, struct fib_node *fn)
+{
+  struct fib_lpm_node **np = &f->lpm_root, **pp = NULL, *n;
+  uint len;
+  ip6_addr k = fib_lpm_key(fn->addr, &len);
+
+  while ((n = *np) && (n->len < len))
+  {
+    pp = np;
+    np = &n->c[fib_lpm_bit(k, n->len)];
+  }
+
+  if (!n || (n->fn != fn))
+    bug("fib_lpm_remove() called for invalid node");
+
+  n->fn = NULL;
+  if (n->c[0] && n->c[1])
+    return;
+
+  *np = n->c[0] ?: n->c[1];
+  sl_free(f->lpm_slab, n);
+
+  /* The parent may have become a glue node with a single child */
+  struct fib_lpm_node *p = pp ? *pp : NULL;
+  if (p && !p->fn && !(p->c[0] && p->c[1]))
+  {
+    *pp = p->c[0] ?: p->c[1];
+    sl_free(f->lpm_slab, p);
+  }
+}
+
+/**
+ * fib_lpm_init - enable longest prefix match index
+ * @f: FIB to work with
+ *
+ * Build the trie of all nodes of @f, which is then kept up to date by
+ * fib_get() and fib_delete(). Only %NET_IP4 and %NET_IP6 FIBs are supported,
+ * for other types this function does nothing. Calling it again is harmless.
+ */
+void
+fib_lpm_init(struct fib *f)
+{
+  if (f->lpm_slab || ((f->addr_type != NET_IP4) && (f->addr_type != NET_IP6)))
+    return;
+
+  f->lpm_slab = sl_new(f->fib_pool, sizeof(struct fib_lpm_node));
+
+  for (uint i = 0; i < f->hash_size; i++)
+    if (f->hash_table[i])
+      fib_lpm_insert(f, f->hash_table[i]);
+
+  if (f->old_table)
+    for (uint i = 0; i < f->old_size; i++)
+      if (f->old_table[i])
+	fib_lpm_insert(f, f->old_table[i]);
+}
+
+/**
+ * fib_route_list - find all nodes covering a prefix
+ * @f: FIB with longest prefix match index
+ * @n: network address
+ * @nodes: array of at least %FIB_LPM_MAX entries to store the nodes to
+ *
+ * Store nodes of @f whose prefix is equal to @n or covers it to @nodes and
+ * return their number. The nodes are in the order of the trie walk, i.e. the
+ * shortest prefix first and @n itself (if present) last. Unlike fib_route(),
+ * this allows the caller to skip nodes it is not interested in.
+ */
+uint
+fib_route_list(struct fib *f, const net_addr *n, void **nodes)
+{
+  ASSERT(f->lpm_slab && (f->addr_type == n->type));
+
+  struct fib_lpm_node *t;
+  uint len, cnt = 0;
+  ip6_addr k = fib_lpm_key(n, &len);
+
+  for (t = f->lpm_root; t && (t->len <= len) && (fib_lpm_common(k, t->addr) >= t->len); )
+  {
+    if (t->fn)
+      nodes[cnt++] = fib_node_to_user(f, t->fn);
+
+    if (t->len == len)
+      break;
+
+    t = t->c[fib_lpm_bit(k, t->len)];
+  }
+
+  return cnt;
+}
+
+/* First node of the subtree in prefix order, glue nodes have both children */
+static inline struct fib_lpm_node *
+fib_lpm_first(struct fib_lpm_node *t)
+{
+  while (t && !t->fn)
+    t = t->c[0] ?: t->c[1];
+
+  return t;
+}
+
+/**
+ * fib_next_ordered - walk a FIB in prefix order
+ * @f: FIB with longest prefix match index
+ * @after: network address, NULL for the first node
+ *
+ * Return the node of @f following @after in the order of prefixes (by
+ * address, shorter prefixes first, as net_compare()), or NULL if there is
+ * none. The address @after does not have to be in @f, so a walk may be
+ * resumed from the last visited address regardless of changes of @f in the
+ * meantime, without any iterator to be relinked.
+ */
+void *
+fib_next_ordered(struct fib *f, const net_addr *after)
+{
+  ASSERT(f->lpm_slab);
+
+  struct fib_lpm_node *t = f->lpm_root, *next = NULL;
+
+  if (!after)
+  {
+    t = fib_lpm_first(t);
+    goto done;
+  }
+
+  ASSERT(f->addr_type == after->type);
+
+  uint len;
+  ip6_addr k = fib_lpm_key(after, &len);
+
+  /* Walk down along @after, remembering the nearest right subtree */
+  while (t)
+  {
+    uint cl = MIN(fib_lpm_common(k, t->addr), MIN(len, t->len));
+
+    /* The whole subtree follows @after, or precedes it */
+    if (cl < t->len)
+    {
+      if ((cl == len) || fib_lpm_bit(t->addr, cl))
+	next = t;
+      break;
+    }
+
+    /* Node of @after or its prefix, only some of its descendants follow */
+    uint b = (t->len < len) ? fib_lpm_bit(k, t->len) : 0;
+    if (!b && t->c[1])
+      next = t->c[1];
+
+    t = t->c[b];
+  }
+
+  t = fib_lpm_first(next);
+
+done:
+  return t ? fib_node_to_user(f, t->fn) : NULL;
+}
+
+static void
+fib_insert_node(struct fib *f, struct fib_node *e, u32 h)
+{
+  uint i, j;
+
+again:
+  /* Insert after all nodes with smaller or equal key */
+  i = h >> f->hash_shift;
+  while (f->hash_keys[i] <= h)
+    i++;
+
+  /* Find the end of the run */
+  for (j = i; f->hash_keys[j] != HASH_EMPTY; j++)
+    ;
+
+  if (j == f->hash_size - 1)
+  {
+    /* The run reached the last slot, enlarge the overflow area */
+    f->hash_extra *= 2;
+    fib_ht_rebuild(f);
+    goto again;
+  }
+
+  memmove(f->hash_table + i + 1, f->hash_table + i, (j - i) * sizeof(struct fib_node *));
+  memmove(f->hash_keys + i + 1, f->hash_keys + i, (j - i) * sizeof(u32));
+  f->hash_table[i] = e;
+  f->hash_keys[i] = h;
+}
+
 static void
 fib_insert(struct fib *f, const net_addr *a, struct fib_node *e)
 {
@@ -329,12 +811,17 @@ fib_get(struct fib *f, const net_addr *a)
   e->readers = NULL;
   fib_insert(f, a, e);
 
+  if (f->lpm_slab)
+    fib_lpm_insert(f, e);
+
   memset(b, 0, f->node_offset);
   if (f->init)
     f->init(b);
 
   if (f->entries++ > f->entries_max)
     fib_rehash(f, HASH_HI_STEP);
+  else if (f->old_table)
+    fib_rehash_step(f, HASH_MOVE_STEP);
 
   return b;
 }
@@ -381,6 +868,13 @@ fib_route(struct fib *f, const net_addr *n)
 {
   ASSERT(f->addr_type == n->type);
 
+  if (f->lpm_slab)
+  {
+    void *nodes[FIB_LPM_MAX];
+    uint cnt = fib_route_list(f, n, nodes);
+    return cnt ? nodes[cnt - 1] : NULL;
+  }
+
   net_addr *n0 = alloca(n->length);
   net_copy(n0, n);
 
@@ -451,41 +945,50 @@ void
 fib_delete(struct fib *f, void *E)
 {
   struct fib_node *e = fib_user_to_node(f, E);
-  uint h = fib_hash(f, e->addr);
-  struct fib_node **ee = f->hash_table + h;
+  uint i, j;
   struct fib_iterator *it;
 
-  while (*ee)
+  if (f->lpm_slab)
+    fib_lpm_remove(f, e);
+
+  /* Readers are moved to the next node in the final table order */
+  if (e->readers)
+    fib_rehash_done(f);
+
+  u32 h = fib_node_key(e);
+  i = fib_ht_slot(f->hash_table, f->hash_keys, f->hash_shift, e, h);
+  if (i == ~0U)
+  {
+    /* Not migrated yet */
+    i = f->old_table ? fib_ht_slot(f->old_table, f->old_keys, f->old_shift, e, h) : ~0U;
+    if (i == ~0U)
+      bug("fib_delete() called for invalid node");
+
+    fib_ht_remove(f->old_table, f->old_keys, f->old_shift, i);
+    goto removed;
+  }
+
+  if (it = e->readers)
     {
-      if (*ee == e)
-	{
-	  *ee = e->next;
-	  if (it = e->readers)
-	    {
-	      struct fib_node *l = e->next;
-	      while (!l)
-		{
-		  h++;
-		  if (h >= f->hash_size)
-		    break;
-		  else
-		    l = f->hash_table[h];
-		}
-	      fib_merge_readers(it, l);
-	    }
-
-	  if (f->fib_slab)
-	    sl_free(f->fib_slab, E);
-	  else
-	    mb_free(E);
-
-	  if (f->entries-- < f->entries_min)
-	    fib_rehash(f, -HASH_LO_STEP);
-	  return;
-	}
-      ee = &((*ee)->next);
+      struct fib_node *l = NULL;
+      for (j = i + 1; !l && (j < f->hash_size); j++)
+	l = f->hash_table[j];
+      fib_merge_readers(it, l);
     }
-  bug("fib_delete() called for invalid node");
+
+  fib_ht_remove(f->hash_table, f->hash_keys, f->hash_shift, i);
+
+removed:
+
+  if (f->fib_slab)
+    sl_free(f->fib_slab, E);
+  else
+    mb_free(E);
+
+  if (f->entries-- < f->entries_min)
+    fib_rehash(f, -HASH_LO_STEP);
+  else if (f->old_table)
+    fib_rehash_step(f, HASH_MOVE_STEP);
 }
 
 /**
@@ -498,8 +1001,11 @@ fib_delete(struct fib *f, void *E)
 void
 fib_free(struct fib *f)
 {
+  if (f->old_table)
+    fib_ht_free(f->old_table);
   fib_ht_free(f->hash_table);
   rfree(f->fib_slab);
+  rfree(f->lpm_slab);
 }
 
 void
@@ -508,6 +1014,8 @@ fit_init(struct fib_iterator *i, struct fib *f)
   unsigned h;
   struct fib_node *n;
 
+  fib_rehash_finish(f);
+
   i->efef = 0xff;
   for(h=0; h<f->hash_size; h++)
     if (n = f->hash_table[h])
@@ -530,6 +1038,8 @@ fit_get(struct fib *f, struct fib_iterator *i)
   struct fib_node *n;
   struct fib_iterator *j, *k;
 
+  fib_rehash_finish(f);
+
   if (!i->prev)
     {
       /* We are at the end */
@@ -548,7 +1058,7 @@ fit_get(struct fib *f, struct fib_iterator *i)
   if (k = i->next)
     k->prev = j;
   j->next = k;
-  i->hash = fib_hash(f, n->addr);
+  i->hash = fib_slot(f, n);
   return n;
 }
 
@@ -568,9 +1078,6 @@ fit_put(struct fib_iterator *i, struct fib_node *n)
 void
 fit_put_next(struct fib *f, struct fib_iterator *i, struct fib_node *n, uint hpos)
 {
-  if (n = n->next)
-    goto found;
-
   while (++hpos < f->hash_size)
     if (n = f->hash_table[hpos])
       goto found;
@@ -620,6 +1127,53 @@ fit_copy(struct fib *f, struct fib_iterator *dst, struct fib_iterator *src)
 
 #ifdef DEBUGGING
 
+static uint
+fib_check_ht(struct fib_node **tab, u32 *keys, uint size, uint shift)
+{
+  uint i, ec, nulls;
+
+  ec = 0;
+  if (keys[size - 1] != HASH_EMPTY)
+    bug("fib_check: last slot occupied");
+  for(i=0; i<size; i++)
+    {
+      struct fib_node *n = tab[i];
+      if (!n)
+	{
+	  if (keys[i] != HASH_EMPTY)
+	    bug("fib_check: stray key %x at %x", keys[i], i);
+	  continue;
+	}
+
+      struct fib_iterator *j, *j0;
+      uint h0 = keys[i] >> shift;
+      if (keys[i] != fib_node_key(n))
+	bug("fib_check: key mismatch at %x", i);
+      if (h0 > i)
+	bug("fib_check: mishashed %x->%x (shift %d)", h0, i, shift);
+      if (i && (h0 < i) && !tab[i-1])
+	bug("fib_check: hole before %x", i);
+      if (i && tab[i-1] && (keys[i-1] > keys[i]))
+	bug("fib_check: unsorted keys at %x", i);
+      j0 = (struct fib_iterator *) n;
+      nulls = 0;
+      for(j=n->readers; j; j=j->next)
+	{
+	  if (j->prev != j0)
+	    bug("fib_check: iterator->prev mismatch");
+	  j0 = j;
+	  if (!j->node)
+	    nulls++;
+	  else if (nulls)
+	    bug("fib_check: iterator nullified");
+	  else if (j->node != n)
+	    bug("fib_check: iterator->node mismatch");
+	}
+      ec++;
+    }
+  return ec;
+}
+
 /**
  * fib_check - audit a FIB
  * @f: FIB to be checked
@@ -630,38 +1184,13 @@ fit_copy(struct fib *f, struct fib_iterator *dst, struct fib_iterator *src)
 void
 fib_check(struct fib *f)
 {
-  uint i, ec, nulls;
+  uint ec = fib_check_ht(f->hash_table, f->hash_keys, f->hash_size, f->hash_shift);
+
+  if (f->old_table)
+    ec += fib_check_ht(f->old_table, f->old_keys, f->old_size, f->old_shift);
 
-  ec = 0;
-  for(i=0; i<f->hash_size; i++)
-    {
-      struct fib_node *n;
-      for(n=f->hash_table[i]; n; n=n->next)
-	{
-	  struct fib_iterator *j, *j0;
-	  uint h0 = fib_hash(f, n->addr);
-	  if (h0 != i)
-	    bug("fib_check: mishashed %x->%x (order %d)", h0, i, f->hash_order);
-	  j0 = (struct fib_iterator *) n;
-	  nulls = 0;
-	  for(j=n->readers; j; j=j->next)
-	    {
-	      if (j->prev != j0)
-		bug("fib_check: iterator->prev mismatch");
-	      j0 = j;
-	      if (!j->node)
-		nulls++;
-	      else if (nulls)
-		bug("fib_check: iterator nullified");
-	      else if (j->node != n)
-		bug("fib_check: iterator->node mismatch");
-	    }
-	  ec++;
-	}
-    }
   if (ec != f->entries)
     bug("fib_check: invalid entry count (%d != %d)", ec, f->entries);
-  return;
 }
 
 /*
@@ -0,0 +1,302 @@
+/*
+ *	BIRD -- ROA Validation Index
+ *
+ *	Can be freely distributed and used under the terms of the GNU GPL.
+ */
+
+/**
+ * DOC: ROA validation index
+ *
+ * ROA tables keep an index of their valid ROAs for net_roa_check(). It is a
+ * path-compressed binary trie of ROA prefixes, where each node has a vector of
+ * (ASN, max length) pairs of ROAs with that prefix, sorted by ASN. Validation
+ * walks the trie down along the checked prefix once, instead of doing a FIB
+ * lookup for each covering prefix length, and searches the vectors of the
+ * visited nodes.
+ *
+ * The index is updated from rte_announce() whenever a ROA net gets or loses
+ * its valid best route, so it is kept in sync both for ROAs received from an
+ * RPKI cache and for static ones.
+ */
+
+#undef LOCAL_DEBUG
+
+#include "nest/bird.h"
+#include "nest/route.h"
+#include "lib/resource.h"
+#include "lib/string.h"
+
+struct roa_entry {
+  u32 asn;
+  u32 max_pxlen;
+};
+
+struct roa_node {
+  struct roa_node *c[2];		/* Children, indexed by the bit after prefix */
+  struct roa_entry *entries;		/* Sorted by ASN and max length */
+  ip6_addr addr;
+  uint len;
+  uint count, size;			/* Zero count for glue nodes, these have both children */
+};
+
+struct roa_index {
+  pool *pool;
+  slab *slab;
+  struct roa_node *root;
+  uint entries;				/* Number of indexed ROAs */
+};
+
+#define ROA_ENTRIES_MIN 4
+
+/* ROA4 keys are stored in the top 32 bits of IPv6 address */
+static inline ip6_addr
+roa_key(const net_addr *n, uint *len)
+{
+  switch (n->type)
+  {
+  case NET_IP4:
+  case NET_ROA4:
+    *len = net4_pxlen(n);
+    return ip6_build(ip4_to_u32(net4_prefix(n)), 0, 0, 0);
+
+  case NET_IP6:
+  case NET_ROA6:
+    *len = net6_pxlen(n);
+    return net6_prefix(n);
+
+  default:
+    bug("invalid type");
+  }
+}
+
+static inline uint
+roa_common(ip6_addr a, ip6_addr b)
+{
+  return ip6_equal(a, b) ? IP6_MAX_PREFIX_LENGTH : ip6_pxlen(a, b);
+}
+
+static inline uint
+roa_bit(ip6_addr a, uint pos)
+{
+  return !!ip6_getbit(a, pos);
+}
+
+static struct roa_node *
+roa_node_new(struct roa_index *ri, ip6_addr addr, uint len)
+{
+  struct roa_node *n = sl_alloc(ri->slab);
+
+  memset(n, 0, sizeof(struct roa_node));
+  n->addr = addr;
+  n->len = len;
+  return n;
+}
+
+static void
+roa_node_free(struct roa_index *ri, struct roa_node *n)
+{
+  mb_free(n->entries);
+  sl_free(ri->slab, n);
+}
+
+/* Find or create the node of given prefix */
+static struct roa_node *
+roa_node_get(struct roa_index *ri, ip6_addr k, uint len)
+{
+  struct roa_node **np = &ri->root, *n;
+
+  while (n = *np)
+  {
+    uint cl = MIN(roa_common(k, n->addr), MIN(len, n->len));
+
+    if (cl < n->len)
+    {
+      struct roa_node *m = roa_node_new(ri, k, len);
+
+      if (cl == len)
+      {
+	/* The new prefix covers the node */
+	m->c[roa_bit(n->addr, len)] = n;
+	*np = m;
+	return m;
+      }
+
+      /* Both hang on a new glue node at the point they diverge */
+      struct roa_node *g = roa_node_new(ri, ip6_and(k, ip6_mkmask(cl)), cl);
+      g->c[roa_bit(k, cl)] = m;
+      g->c[roa_bit(n->addr, cl)] = n;
+      *np = g;
+      return m;
+    }
+
+    if (len == n->len)
+      return n;
+
+    np = &n->c[roa_bit(k, n->len)];
+  }
+
+  return *np = roa_node_new(ri, k, len);
+}
+
+/* Position of the first entry not smaller than (asn, max_pxlen) */
+static uint
+roa_entry_pos(struct roa_node *n, u32 asn, u32 max_pxlen)
+{
+  uint lo = 0, hi = n->count;
+
+  while (lo < hi)
+  {
+    uint mid = (lo + hi) / 2;
+    struct roa_entry *e = &n->entries[mid];
+
+    if ((e->asn < asn) || ((e->asn == asn) && (e->max_pxlen < max_pxlen)))
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  return lo;
+}
+
+/**
+ * roa_index_new - create a ROA index
+ * @p: parent pool
+ *
+ * The index gets its own pool inside @p, which is freed by roa_index_free().
+ */
+struct roa_index *
+roa_index_new(pool *p)
+{
+  pool *pp = rp_new(p, "ROA index");
+  struct roa_index *ri = mb_allocz(pp, sizeof(struct roa_index));
+
+  ri->pool = pp;
+  ri->slab = sl_new(pp, sizeof(struct roa_node));
+  return ri;
+}
+
+/**
+ * roa_index_free - free a ROA index
+ * @ri: ROA index
+ */
+void
+roa_index_free(struct roa_index *ri)
+{
+  rfree(ri->pool);
+}
+
+/**
+ * roa_index_add - add a ROA to the index
+ * @ri: ROA index
+ * @n: ROA of type %NET_ROA4 or %NET_ROA6
+ */
+void
+roa_index_add(struct roa_index *ri, const net_addr *n)
+{
+  const net_addr_roa4 *r4 = (const void *) n;
+  const net_addr_roa6 *r6 = (const void *) n;
+  u32 asn = (n->type == NET_ROA4) ? r4->asn : r6->asn;
+  u32 max_pxlen = (n->type == NET_ROA4) ? r4->max_pxlen : r6->max_pxlen;
+
+  uint len;
+  ip6_addr k = roa_key(n, &len);
+  struct roa_node *t = roa_node_get(ri, k, len);
+
+  if (t->count == t->size)
+  {
+    t->size = MAX(2 * t->size, ROA_ENTRIES_MIN);
+    t->entries = t->entries ?
+      mb_realloc(t->entries, t->size * sizeof(struct roa_entry)) :
+      mb_alloc(ri->pool, t->size * sizeof(struct roa_entry));
+  }
+
+  uint pos = roa_entry_pos(t, asn, max_pxlen);
+  memmove(t->entries + pos + 1, t->entries + pos, (t->count - pos) * sizeof(struct roa_entry));
+  t->entries[pos] = (struct roa_entry) { .asn = asn, .max_pxlen = max_pxlen };
+  t->count++;
+  ri->entries++;
+}
+
+/**
+ * roa_index_remove - remove a ROA from the index
+ * @ri: ROA index
+ * @n: ROA of type %NET_ROA4 or %NET_ROA6, previously added by roa_index_add()
+ */
+void
+roa_index_remove(struct roa_index *ri, const net_addr *n)
+{
+  const net_addr_roa4 *r4 = (const void *) n;
+  const net_addr_roa6 *r6 = (const void *) n;
+  u32 asn = (n->type == NET_ROA4) ? r4->asn : r6->asn;
+  u32 max_pxlen = (n->type == NET_ROA4) ? r4->max_pxlen : r6->max_pxlen;
+
+  struct roa_node **np = &ri->root, **pp = NULL, *t;
+  uint len;
+  ip6_addr k = roa_key(n, &len);
+
+  while ((t = *np) && (t->len < len))
+  {
+    pp = np;
+    np = &t->c[roa_bit(k, t->len)];
+  }
+
+  uint pos = t ? roa_entry_pos(t, asn, max_pxlen) : 0;
+  if (!t || (t->len != len) || (pos == t->count) ||
+      (t->entries[pos].asn != asn) || (t->entries[pos].max_pxlen != max_pxlen))
+    bug("roa_index_remove() called for ROA not in index");
+
+  memmove(t->entries + pos, t->entries + pos + 1, (t->count - pos - 1) * sizeof(struct roa_entry));
+  t->count--;
+  ri->entries--;
+
+  if (t->count || (t->c[0] && t->c[1]))
+    return;
+
+  *np = t->c[0] ?: t->c[1];
+  roa_node_free(ri, t);
+
+  /* The parent may have become a glue node with a single child */
+  struct roa_node *p = pp ? *pp : NULL;
+  if (p && !p->count && !(p->c[0] && p->c[1]))
+  {
+    *pp = p->c[0] ?: p->c[1];
+    roa_node_free(ri, p);
+  }
+}
+
+/**
+ * roa_index_check - check route origination against a ROA index
+ * @ri: ROA index
+ * @n: network prefix of type %NET_IP4 or %NET_IP6
+ * @asn: origin AS number, 0 if unknown
+ *
+ * Same as net_roa_check(), returns %ROA_VALID, %ROA_INVALID or %ROA_UNKNOWN.
+ */
+int
+roa_index_check(struct roa_index *ri, const net_addr *n, u32 asn)
+{
+  struct roa_node *t;
+  uint len;
+  ip6_addr k = roa_key(n, &len);
+  int anything = 0;
+
+  for (t = ri->root; t && (t->len <= len) && (roa_common(k, t->addr) >= t->len); )
+  {
+    if (t->count)
+    {
+      anything = 1;
+
+      /* Entries of the same ASN are sorted by max length, check the largest */
+      uint pos = roa_entry_pos(t, asn, ~0U);
+      if (asn && pos && (t->entries[pos - 1].asn == asn) && (t->entries[pos - 1].max_pxlen >= len))
+	return ROA_VALID;
+    }
+
+    if (t->len == len)
+      break;
+
+    t = t->c[roa_bit(k, t->len)];
+  }
+
+  return anything ? ROA_INVALID : ROA_UNKNOWN;
+}
@@ -0,0 +1,104 @@
+/*
+ *	BIRD -- ROA Validation Index Tests
+ *
+ *	Can be freely distributed and used under the terms of the GNU GPL.
+ */
+
+#include "test/birdtest.h"
+#include "test/bt-utils.h"
+
+#include "lib/resource.h"
+#include "nest/route.h"
+
+#define ROA_COUNT 2000
+#define ROA_CHECKS 20000
+
+static net_addr_roa4 roas[ROA_COUNT];
+static byte present[ROA_COUNT];
+
+/* Reference implementation, just scan all ROAs */
+static int
+roa_check_slow(const net_addr_ip4 *n, u32 asn)
+{
+  int anything = 0;
+
+  for (int i = 0; i < ROA_COUNT; i++)
+  {
+    net_addr_roa4 *r = &roas[i];
+
+    if (!present[i] || (r->pxlen > n->pxlen) ||
+	!ip4_equal(ip4_and(n->prefix, ip4_mkmask(r->pxlen)), r->prefix))
+      continue;
+
+    anything = 1;
+    if (asn && (r->asn == asn) && (r->max_pxlen >= n->pxlen))
+      return ROA_VALID;
+  }
+
+  return anything ? ROA_INVALID : ROA_UNKNOWN;
+}
+
+static void
+random_roa(net_addr_roa4 *r)
+{
+  /* Few ASNs and prefixes from a small range, so that they overlap */
+  uint pxlen = 8 + bt_random() % 17;
+  ip4_addr px = ip4_and(ip4_from_u32(0x0a000000 | (bt_random() & 0xffffff)), ip4_mkmask(pxlen));
+  uint max_pxlen = pxlen + bt_random() % (33 - pxlen);
+
+  *r = NET_ADDR_ROA4(px, pxlen, max_pxlen, 64500 + bt_random() % 8);
+}
+
+static int
+t_roa_index(void)
+{
+  resource_init();
+
+  struct roa_index *ri = roa_index_new(&root_pool);
+
+  for (int i = 0; i < ROA_COUNT; i++)
+  {
+    random_roa(&roas[i]);
+    roa_index_add(ri, (net_addr *) &roas[i]);
+    present[i] = 1;
+  }
+
+  /* Remove some, including duplicates of remaining ones */
+  for (int i = 0; i < ROA_COUNT; i += 3)
+  {
+    roa_index_remove(ri, (net_addr *) &roas[i]);
+    present[i] = 0;
+  }
+
+  for (int i = 0; i < ROA_CHECKS; i++)
+  {
+    uint pxlen = 8 + bt_random() % 25;
+    ip4_addr px = ip4_and(ip4_from_u32(0x0a000000 | (bt_random() & 0xffffff)), ip4_mkmask(pxlen));
+    net_addr_ip4 n = NET_ADDR_IP4(px, pxlen);
+    u32 asn = 64500 + bt_random() % 9;
+
+    bt_assert(roa_index_check(ri, (net_addr *) &n, asn) == roa_check_slow(&n, asn));
+    bt_assert(roa_index_check(ri, (net_addr *) &n, 0) == roa_check_slow(&n, 0));
+  }
+
+  /* Empty index again */
+  for (int i = 0; i < ROA_COUNT; i++)
+    if (present[i])
+      roa_index_remove(ri, (net_addr *) &roas[i]);
+
+  net_addr_ip4 n = NET_ADDR_IP4(ip4_from_u32(0x0a000000), 8);
+  bt_assert(roa_index_check(ri, (net_addr *) &n, 64500) == ROA_UNKNOWN);
+
+  roa_index_free(ri);
+  return 1;
+}
+
+int
+main(int argc, char *argv[])
+{
+  bt_init(argc, argv);
+
+  bt_test_suite(t_roa_index, "ROA index against linear scan");
+
+  return bt_exit_value();
+}
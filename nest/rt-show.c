@@ -10,18 +10,20 @@
 #undef LOCAL_DEBUG
 
 #include "nest/bird.h"
+#include "lib/alloca.h"
 #include "nest/route.h"
 #include "nest/protocol.h"
 #include "nest/cli.h"
 #include "nest/iface.h"
 #include "filter/filter.h"
+#include "lib/json.h"
 #include "sysdep/unix/krt.h"
 
 static void
 rt_show_table(struct cli *c, struct rt_show_data *d)
 {
-  /* No table blocks in 'show route count' */
-  if (d->stats == 2)
+  /* No table blocks in 'show route count' and JSON output */
+  if ((d->stats == 2) || d->json)
     return;
 
   if (d->last_table) cli_printf(c, -1007, "");
@@ -99,9 +101,137 @@ rt_show_rte(struct cli *c, byte *ia, rte *e, struct rt_show_data *d, int primary
 }
 
 static void
-rt_show_net(struct cli *c, net *n, struct rt_show_data *d)
+rt_show_rte_json(struct cli *c, rte *e, struct rt_show_data *d, int primary)
 {
-  rte *e, *ee;
+  rta *a = e->attrs;
+  struct json_writer *w = cli_json_begin();
+
+  /* Need to normalize the extended attributes */
+  if (d->verbose && !rta_is_cached(a) && a->eattrs)
+    ea_normalize(a->eattrs);
+
+  json_open(w, NULL, '{');
+  json_put_string(w, "table", d->tab->table->name);
+  json_key(w, "network");
+  json_printf(w, "\"%N\"", e->net->n.addr);
+  json_put_string(w, "protocol", a->src->proto->name);
+  json_put_bool(w, "primary", primary);
+
+  if (d->kernel)
+    json_put_bool(w, "sync_error", krt_get_sync_error(d->kernel, e));
+
+  json_put_string(w, "dest", rta_dest_name(a->dest));
+  json_put_uint(w, "age", (current_time() - e->lastmod) TO_S);
+  json_put_uint(w, "preference", e->pref);
+
+  if (ipa_nonzero(a->from))
+  {
+    json_key(w, "from");
+    json_printf(w, "\"%I\"", a->from);
+  }
+
+  if (a->dest == RTD_UNICAST)
+  {
+    json_open(w, "nexthops", '[');
+    for (struct nexthop *nh = &(a->nh); nh; nh = nh->next)
+    {
+      json_open(w, NULL, '{');
+
+      if (ipa_nonzero(nh->gw))
+      {
+	json_key(w, "gateway");
+	json_printf(w, "\"%I\"", nh->gw);
+      }
+
+      json_put_string(w, "interface", nh->iface->name);
+
+      if (nh->labels)
+      {
+	json_open(w, "mpls", '[');
+	for (int i = 0; i < nh->labels; i++)
+	  json_put_uint(w, NULL, nh->label[i]);
+	json_close(w, ']');
+      }
+
+      if (nh->flags & RNF_ONLINK)
+	json_put_bool(w, "onlink", 1);
+
+      if (a->nh.next)
+	json_put_uint(w, "weight", nh->weight + 1);
+
+      json_close(w, '}');
+    }
+    json_close(w, ']');
+  }
+
+  if (d->verbose)
+    rta_json(w, a);
+
+  json_close(w, '}');
+  cli_json_end(c, -CLI_JSON_CODE);
+}
+
+static void
+rt_show_counts_json(struct cli *c, const char *table, int shown, int routes, int nets)
+{
+  struct json_writer *w = cli_json_begin();
+
+  json_open(w, NULL, '{');
+  if (table)
+    json_put_string(w, "table", table);
+  json_put_uint(w, "shown", shown);
+  json_put_uint(w, "routes", routes);
+  json_put_uint(w, "networks", nets);
+  json_close(w, '}');
+
+  cli_json_end(c, -CLI_JSON_CODE);
+}
+
+/*
+ * Filters which do not depend on the route network (see filter_net_dep()) give
+ * the same verdict for all routes with the same attributes. As many routes
+ * typically share their attributes (e.g. all routes received in one BGP
+ * UPDATE), queries like 'show route where bgp_path ~ [= * 64500 =]' keep their
+ * verdicts in a small direct-mapped cache keyed by the cached rta. The snapshot
+ * of the table keeps the routes and their rtas alive, so the cache is valid
+ * until the snapshot is released.
+ */
+
+#define RT_SHOW_VERDICT_ORDER	10
+#define RT_SHOW_VERDICT_SIZE	(1 << RT_SHOW_VERDICT_ORDER)
+
+struct rt_show_verdict {
+  rta *attrs;
+  u16 pref;
+  u8 accept;
+};
+
+static int
+rt_show_filter(struct cli *c, struct rt_show_data *d, rte **e, rte *ee)
+{
+  struct rt_show_verdict *v = NULL;
+
+  if (d->verdicts && (*e == ee) && !ee->attrs->src->proto->make_tmp_attrs)
+  {
+    v = &d->verdicts[ee->attrs->hash_key >> (32 - RT_SHOW_VERDICT_ORDER)];
+
+    if ((v->attrs == ee->attrs) && (v->pref == ee->pref))
+      return v->accept;
+  }
+
+  int accept = (f_run(d->filter, e, c->show_pool, 0) <= F_ACCEPT);
+
+  /* Routes modified by the filter always go through the interpreter */
+  if (v && (!accept || (*e == ee)))
+    *v = (struct rt_show_verdict) { .attrs = ee->attrs, .pref = ee->pref, .accept = accept };
+
+  return accept;
+}
+
+static void
+rt_show_net(struct cli *c, net *n, rte **routes, struct rt_show_data *d)
+{
+  rte *e, *ee, **pos;
   byte ia[NET_MAX_TEXT_LENGTH+1];
   struct channel *ec = d->tab->export_channel;
 
@@ -114,11 +244,15 @@ rt_show_net(struct cli *c, net *n, struct rt_show_data *d)
 
   bsnprintf(ia, sizeof(ia), "%N", n->n.addr);
 
-  for (e = n->routes; e; e = e->next)
+  for (pos = routes; e = *pos; pos++)
     {
       if (rte_is_filtered(e) != d->filtered)
 	continue;
 
+      /* Shared import/export table, skip routes of other channels */
+      if (d->tab->table_channel && (e->sender != d->tab->table_channel))
+	continue;
+
       d->rt_counter++;
       d->net_counter += first;
       first = 0;
@@ -127,6 +261,11 @@ rt_show_net(struct cli *c, net *n, struct rt_show_data *d)
 	continue;
 
       ee = e;
+
+      /* Without export, the protocol is checked before any route processing */
+      if (!d->export_mode && d->show_protocol && (d->show_protocol != e->attrs->src->proto))
+	goto skip;
+
       rte_make_tmp_attrs(&e, c->show_pool, NULL);
 
       /* Export channel is down, do not try to export routes to it */
@@ -183,11 +322,13 @@ rt_show_net(struct cli *c, net *n, struct rt_show_data *d)
       if (d->show_protocol && (d->show_protocol != e->attrs->src->proto))
 	goto skip;
 
-      if (f_run(d->filter, &e, c->show_pool, 0) > F_ACCEPT)
+      if ((d->filter != FILTER_ACCEPT) && !rt_show_filter(c, d, &e, ee))
 	goto skip;
 
-      if (d->stats < 2)
-	rt_show_rte(c, ia, e, d, (e->net->routes == ee));
+      if ((d->stats < 2) && d->json)
+	rt_show_rte_json(c, e, d, (pos == routes));
+      else if (d->stats < 2)
+	rt_show_rte(c, ia, e, d, (pos == routes));
 
       d->show_counter++;
       ia[0] = 0;
@@ -211,9 +352,12 @@ rt_show_cleanup(struct cli *c)
   struct rt_show_data *d = c->rover;
   struct rt_show_data_rtable *tab;
 
-  /* Unlink the iterator */
+  /* Release the snapshot */
   if (d->table_open)
-    fit_get(&d->tab->table->fib, &d->fit);
+    rfree(d->snapshot);
+
+  if (d->verdicts)
+    mb_free(d->verdicts);
 
   /* Unlock referenced tables */
   WALK_LIST(tab, d->tables)
@@ -229,8 +373,6 @@ rt_show_cont(struct cli *c)
 #else
   unsigned max = 64;
 #endif
-  struct fib *fib = &d->tab->table->fib;
-  struct fib_iterator *it = &d->fit;
 
   if (d->running_on_config && (d->running_on_config != config))
   {
@@ -240,11 +382,20 @@ rt_show_cont(struct cli *c)
 
   if (!d->table_open)
   {
-    FIB_ITERATE_INIT(&d->fit, &d->tab->table->fib);
+    d->snapshot = rt_snapshot_new(c->pool, d->tab->table);
+    d->snapshot_pos = d->snapshot->data;
     d->table_open = 1;
     d->table_counter++;
     d->kernel = rt_show_get_kernel(d);
 
+    if ((d->filter != FILTER_ACCEPT) && !filter_net_dep(d->filter))
+    {
+      if (!d->verdicts)
+	d->verdicts = mb_alloc(c->pool, RT_SHOW_VERDICT_SIZE * sizeof(struct rt_show_verdict));
+
+      memset(d->verdicts, 0, RT_SHOW_VERDICT_SIZE * sizeof(struct rt_show_verdict));
+    }
+
     d->show_counter_last = d->show_counter;
     d->rt_counter_last   = d->rt_counter;
     d->net_counter_last  = d->net_counter;
@@ -253,18 +404,21 @@ rt_show_cont(struct cli *c)
       rt_show_table(c, d);
   }
 
-  FIB_ITERATE_START(fib, it, net, n)
+  for (rte **pos = d->snapshot_pos; pos < d->snapshot->end; pos = rt_snapshot_next(pos))
   {
-    if (!max--)
+    /* Stop early when the client does not keep up with the output */
+    if (!max-- || (cli_out_pending(c) >= CLI_TX_MAX_PENDING))
     {
-      FIB_ITERATE_PUT(it);
+      d->snapshot_pos = pos;
       return;
     }
-    rt_show_net(c, n, d);
+    rt_show_net(c, pos[0]->net, pos, d);
   }
-  FIB_ITERATE_END;
 
-  if (d->stats)
+  if (d->stats && d->json)
+    rt_show_counts_json(c, d->tab->table->name, d->show_counter - d->show_counter_last,
+			d->rt_counter - d->rt_counter_last, d->net_counter - d->net_counter_last);
+  else if (d->stats)
   {
     if (d->last_table != d->tab)
       rt_show_table(c, d);
@@ -274,6 +428,8 @@ rt_show_cont(struct cli *c)
 	       d->net_counter - d->net_counter_last, d->tab->table->name);
   }
 
+  rfree(d->snapshot);
+  d->snapshot = NULL;
   d->kernel = NULL;
   d->table_open = 0;
   d->tab = NODE_NEXT(d->tab);
@@ -281,7 +437,12 @@ rt_show_cont(struct cli *c)
   if (NODE_VALID(d->tab))
     return;
 
-  if (d->stats && (d->table_counter > 1))
+  if (d->stats && d->json && (d->table_counter > 1))
+  {
+    rt_show_counts_json(c, NULL, d->show_counter, d->rt_counter, d->net_counter);
+    cli_printf(c, 0, "");
+  }
+  else if (d->stats && (d->table_counter > 1))
   {
     if (d->last_table) cli_printf(c, -1007, "");
     cli_printf(c, 14, "Total: %d of %d routes for %d networks in %d tables",
@@ -426,7 +587,19 @@ rt_show(struct rt_show_data *d)
 	n = net_find(tab->table, d->addr);
 
       if (n)
-	rt_show_net(this_cli, n, d);
+      {
+	uint cnt = 0;
+	for (rte *e = n->routes; e; e = e->next)
+	  cnt++;
+
+	rte **routes = alloca((cnt + 1) * sizeof(rte *));
+	rte **pos = routes;
+	for (rte *e = n->routes; e; e = e->next)
+	  *pos++ = e;
+	*pos = NULL;
+
+	rt_show_net(this_cli, n, routes, d);
+      }
     }
 
     if (d->rt_counter)
@@ -435,3 +608,50 @@ rt_show(struct rt_show_data *d)
       cli_msg(8001, "Network not found");
   }
 }
+
+static void
+rt_show_table_stats(rtable *t, int details)
+{
+  const struct rt_stats *s = t->stats;
+
+  cli_msg(-1029, "%-16s %10u %10u %10u", t->name, s->nets, t->rt_count, s->filtered);
+
+  if (!details)
+    return;
+
+  cli_msg(-1029, "");
+  cli_msg(-1029, "Routes by source:");
+  for (uint i = 0; i < RTS_MAX; i++)
+    if (s->sources[i])
+      cli_msg(-1029, "  %-14s %10u", rta_src_names[i], s->sources[i]);
+
+  cli_msg(-1029, "");
+  cli_msg(-1029, "Routes by prefix length:");
+  for (uint i = 0; i <= IP6_MAX_PREFIX_LENGTH; i++)
+    if (s->pxlens[i])
+      cli_msg(-1029, "  /%-13u %10u", i, s->pxlens[i]);
+}
+
+/**
+ * rt_show_tables - show route counters of tables
+ * @tc: table to show in detail, or %NULL for all tables
+ *
+ * The counters are maintained as routes are added and removed, so this is
+ * cheap regardless of table sizes, unlike counting by |show route count|.
+ */
+void
+rt_show_tables(struct rtable_config *tc)
+{
+  cli_msg(-1029, "%-16s %10s %10s %10s", "Table", "Networks", "Routes", "Filtered");
+
+  if (tc)
+    rt_show_table_stats(tc->table, 1);
+  else
+  {
+    rtable *t;
+    WALK_LIST(t, routing_tables)
+      rt_show_table_stats(t, 0);
+  }
+
+  cli_msg(0, "");
+}
@@ -30,6 +30,9 @@
 
 #undef LOCAL_DEBUG
 
+#include <stdlib.h>
+#include <time.h>
+
 #include "nest/bird.h"
 #include "nest/route.h"
 #include "nest/protocol.h"
@@ -37,6 +40,7 @@
 #include "lib/resource.h"
 #include "lib/event.h"
 #include "lib/string.h"
+#include "lib/tracepoint.h"
 #include "conf/conf.h"
 #include "filter/filter.h"
 #include "filter/data.h"
@@ -50,11 +54,70 @@
 
 pool *rt_table_pool;
 
-static slab *rte_slab;
+/* Slabs for rte with protocol-dependent data of different sizes */
+#define RTE_SLABS (BIRD_ALIGN(sizeof(((rte *) 0)->u), sizeof(u64)) / sizeof(u64) + 1)
+static slab *rte_slab_[RTE_SLABS];
 static linpool *rte_update_pool;
 
+/* Max changed routes per run of rt_prune_table() */
+#define RT_PRUNE_LIMIT 512
+
+/*
+ * Initial sizes of table structures. Setups with thousands of VRFs have many
+ * small tables, so tables start small and grow with their content.
+ */
+#define RT_FIB_ORDER	4		/* Initial order of FIB hash */
+#define RT_ID_MAP_SIZE	64		/* Initial size of route ID map [bytes] */
+
+/* Max routes of a net in sorted table searched linearly, see rt_sorted_position() */
+#define RT_SORTED_LINEAR 8
+
+/* Min routes of a net to be put into the source index, see rt_src_index_net() */
+#define RT_SRC_INDEX_MIN 16
+
 list routing_tables;
 
+struct rt_phase_stats *rt_phase_stats;
+
+const char * const rt_phase_names[RT_PHASE_MAX] = {
+  [RT_PHASE_DECODE] = "decode",
+  [RT_PHASE_FILTER] = "filter",
+  [RT_PHASE_LOOKUP] = "rta_lookup",
+  [RT_PHASE_RECALC] = "recalculate",
+  [RT_PHASE_EXPORT] = "export",
+};
+
+struct rt_phase_mark
+rt_phase_begin_(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (struct rt_phase_mark) {
+    .begin = ts.tv_sec * (u64) 1000000000 + ts.tv_nsec,
+    .accounted = rt_phase_stats->accounted,
+  };
+}
+
+void
+rt_phase_end_(enum rt_phase phase, struct rt_phase_mark m)
+{
+  struct rt_phase_stats *s = rt_phase_stats;
+  struct timespec ts;
+
+  /* Timing enabled in the middle of the phase */
+  if (!m.begin)
+    return;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  u64 total = ts.tv_sec * (u64) 1000000000 + ts.tv_nsec - m.begin;
+  u64 nested = s->accounted - m.accounted;
+  u64 own = (total > nested) ? total - nested : 0;
+
+  histogram_add(&s->phase[phase], own);
+  s->accounted += own;
+}
+
 static void rt_free_hostcache(rtable *tab);
 static void rt_notify_hostcache(rtable *tab, net *net);
 static void rt_update_hostcache(rtable *tab);
@@ -91,10 +154,26 @@ net_route_ip6(rtable *t, net_addr_ip6 *n)
   return r;
 }
 
+/* Like net_route_ip4() and net_route_ip6(), but using the FIB trie */
+static inline void *
+net_route_lpm(rtable *t, const net_addr *n)
+{
+  net *nodes[FIB_LPM_MAX];
+  uint cnt = fib_route_list(&t->fib, n, (void **) nodes);
+
+  /* Longest prefix is the last one */
+  for (uint i = cnt; i > 0; i--)
+    if (rte_is_valid(nodes[i - 1]->routes))
+      return nodes[i - 1];
+
+  return NULL;
+}
+
 static inline void *
 net_route_ip6_sadr(rtable *t, net_addr_ip6_sadr *n)
 {
-  struct fib_node *fn;
+  struct fib_node **fn;
+  uint len;
 
   while (1)
   {
@@ -104,15 +183,15 @@ net_route_ip6_sadr(rtable *t, net_addr_ip6_sadr *n)
     /* We need to do dst first matching. Since sadr addresses are hashed on dst
        prefix only, find the hash table chain and go through it to find the
        match with the smallest matching src prefix. */
-    for (fn = fib_get_chain(&t->fib, (net_addr *) n); fn; fn = fn->next)
+    for (fn = fib_get_chain(&t->fib, (net_addr *) n, &len); len; fn++, len--)
     {
-      net_addr_ip6_sadr *a = (void *) fn->addr;
+      net_addr_ip6_sadr *a = (void *) (*fn)->addr;
 
       if (net_equal_dst_ip6_sadr(n, a) &&
 	  net_in_net_src_ip6_sadr(n, a) &&
 	  (a->src_pxlen >= best_pxlen))
       {
-	best = fib_node_to_user(&t->fib, fn);
+	best = fib_node_to_user(&t->fib, *fn);
 	best_pxlen = a->src_pxlen;
       }
     }
@@ -135,6 +214,9 @@ net_route(rtable *tab, const net_addr *n)
 {
   ASSERT(tab->addr_type == n->type);
 
+  if (tab->fib.lpm_slab)
+    return net_route_lpm(tab, n);
+
   net_addr *n0 = alloca(n->length);
   net_copy(n0, n);
 
@@ -159,70 +241,6 @@ net_route(rtable *tab, const net_addr *n)
 }
 
 
-static int
-net_roa_check_ip4(rtable *tab, const net_addr_ip4 *px, u32 asn)
-{
-  struct net_addr_roa4 n = NET_ADDR_ROA4(px->prefix, px->pxlen, 0, 0);
-  struct fib_node *fn;
-  int anything = 0;
-
-  while (1)
-  {
-    for (fn = fib_get_chain(&tab->fib, (net_addr *) &n); fn; fn = fn->next)
-    {
-      net_addr_roa4 *roa = (void *) fn->addr;
-      net *r = fib_node_to_user(&tab->fib, fn);
-
-      if (net_equal_prefix_roa4(roa, &n) && rte_is_valid(r->routes))
-      {
-	anything = 1;
-	if (asn && (roa->asn == asn) && (roa->max_pxlen >= px->pxlen))
-	  return ROA_VALID;
-      }
-    }
-
-    if (n.pxlen == 0)
-      break;
-
-    n.pxlen--;
-    ip4_clrbit(&n.prefix, n.pxlen);
-  }
-
-  return anything ? ROA_INVALID : ROA_UNKNOWN;
-}
-
-static int
-net_roa_check_ip6(rtable *tab, const net_addr_ip6 *px, u32 asn)
-{
-  struct net_addr_roa6 n = NET_ADDR_ROA6(px->prefix, px->pxlen, 0, 0);
-  struct fib_node *fn;
-  int anything = 0;
-
-  while (1)
-  {
-    for (fn = fib_get_chain(&tab->fib, (net_addr *) &n); fn; fn = fn->next)
-    {
-      net_addr_roa6 *roa = (void *) fn->addr;
-      net *r = fib_node_to_user(&tab->fib, fn);
-
-      if (net_equal_prefix_roa6(roa, &n) && rte_is_valid(r->routes))
-      {
-	anything = 1;
-	if (asn && (roa->asn == asn) && (roa->max_pxlen >= px->pxlen))
-	  return ROA_VALID;
-      }
-    }
-
-    if (n.pxlen == 0)
-      break;
-
-    n.pxlen--;
-    ip6_clrbit(&n.prefix, n.pxlen);
-  }
-
-  return anything ? ROA_INVALID : ROA_UNKNOWN;
-}
-
 /**
  * roa_check - check validity of route origination in a ROA table
  * @tab: ROA table
@@ -241,14 +259,139 @@ net_roa_check_ip6(rtable *tab, const net_addr_ip6 *px, u32 asn)
 int
 net_roa_check(rtable *tab, const net_addr *n, u32 asn)
 {
-  if ((tab->addr_type == NET_ROA4) && (n->type == NET_IP4))
-    return net_roa_check_ip4(tab, (const net_addr_ip4 *) n, asn);
-  else if ((tab->addr_type == NET_ROA6) && (n->type == NET_IP6))
-    return net_roa_check_ip6(tab, (const net_addr_ip6 *) n, asn);
+  if (((tab->addr_type == NET_ROA4) && (n->type == NET_IP4)) ||
+      ((tab->addr_type == NET_ROA6) && (n->type == NET_IP6)))
+    return roa_index_check(tab->roa_index, n, asn);
   else
     return ROA_UNKNOWN;	/* Should not happen */
 }
 
+/**
+ * rt_roa_subscribe - watch ROA changes
+ * @tab: ROA table
+ * @s: subscription with the hook filled in
+ *
+ * The hook of @s is called whenever a ROA in @tab appears or disappears, that
+ * is whenever the result of net_roa_check() may change for networks covered
+ * by the ROA. The table is locked until rt_roa_unsubscribe() is called.
+ */
+void
+rt_roa_subscribe(rtable *tab, struct roa_subscription *s)
+{
+  ASSERT(tab->roa_index);
+
+  rt_lock_table(tab);
+  s->tab = tab;
+  add_tail(&tab->roa_subscribers, &s->n);
+}
+
+void
+rt_roa_unsubscribe(struct roa_subscription *s)
+{
+  rem_node(&s->n);
+  rt_unlock_table(s->tab);
+  s->tab = NULL;
+}
+
+/*
+ * Source index
+ *
+ * Routes of a network are found by their source by walking the route list,
+ * which is fine for the common case of a few routes. Networks with many routes
+ * (e.g. with ADD-PATH or on route collectors) are put into a hash keyed by
+ * network and source, so an update does not have to compare sources of all
+ * the other routes. Networks are unique across tables, so one hash serves all
+ * of them. All routes of an indexed network have REF_INDEXED flag, the network
+ * stays indexed until its last route is removed.
+ */
+
+struct rt_src_entry {
+  struct rt_src_entry *next;
+  rte *e;
+};
+
+#define RSI_KEY(n)		n->e->net, n->e->attrs->src
+#define RSI_NEXT(n)		n->next
+#define RSI_EQ(n1,s1,n2,s2)	n1 == n2 && s1 == s2
+#define RSI_FN(n,s)		ptr_hash(n) ^ u32_hash(s->global_id)
+
+#define RSI_REHASH		rt_src_index_rehash
+#define RSI_PARAMS		/8, *2, 2, 2, 8, 24
+#define RSI_INIT_ORDER		8
+
+static HASH(struct rt_src_entry) rt_src_hash;
+static slab *rt_src_slab;
+
+HASH_DEFINE_REHASH_FN(RSI, struct rt_src_entry)
+
+static inline int
+rt_src_indexed(net *n)
+{
+  return n->routes && (n->routes->flags & REF_INDEXED);
+}
+
+static inline rte *
+rt_src_index_find(net *n, struct rte_src *src)
+{
+  struct rt_src_entry *se = HASH_FIND(rt_src_hash, RSI, n, src);
+  return se ? se->e : NULL;
+}
+
+static void
+rt_src_index_add(rte *e)
+{
+  struct rt_src_entry *se = sl_alloc(rt_src_slab);
+  se->e = e;
+  e->flags |= REF_INDEXED;
+
+  HASH_INSERT2(rt_src_hash, RSI, rt_table_pool, se);
+}
+
+/* Put all routes of @n into the source index */
+static void
+rt_src_index_net(net *n)
+{
+  for (rte *e = n->routes; e; e = e->next)
+    if (!(e->flags & REF_INDEXED))
+      rt_src_index_add(e);
+}
+
+/* Called just after @e was linked to @n */
+static inline void
+rt_src_index_link(net *n, rte *e)
+{
+  /* The route may be a copy of an indexed route */
+  e->flags &= ~REF_INDEXED;
+
+  rte *r = (n->routes != e) ? n->routes : e->next;
+  if (r && (r->flags & REF_INDEXED))
+    rt_src_index_add(e);
+}
+
+/* Called just after @e was unlinked from its network */
+static inline void
+rt_src_index_unlink(rte *e)
+{
+  if (!(e->flags & REF_INDEXED))
+    return;
+
+  struct rt_src_entry *se = HASH_DELETE2(rt_src_hash, RSI, rt_table_pool, e->net, e->attrs->src);
+  ASSERT_DIE(se && (se->e == e));
+  sl_free(rt_src_slab, se);
+}
+
+/* Called when @new took over the list position of @old */
+static inline void
+rt_src_index_replace(rte *old, rte *new)
+{
+  if (!(old->flags & REF_INDEXED))
+    return;
+
+  struct rt_src_entry *se = HASH_FIND(rt_src_hash, RSI, old->net, old->attrs->src);
+  ASSERT_DIE(se && (se->e == old));
+  se->e = new;
+}
+
 /**
  * rte_find - find a route
  * @net: network node
@@ -262,6 +405,9 @@ rte_find(net *net, struct rte_src *src)
 {
   rte *e = net->routes;
 
+  if (rt_src_indexed(net))
+    return rt_src_index_find(net, src);
+
   while (e && e->attrs->src != src)
     e = e->next;
   return e;
@@ -276,12 +422,26 @@ rte_find(net *net, struct rte_src *src)
  * Also set route preference to the default preference set for
  * the protocol.
  */
+/* Size of rte including protocol-dependent data of its source protocol */
+static inline uint
+rte_size(rta *a)
+{
+  return a->src->proto->proto->rte_size ?: OFFSETOF(rte, u);
+}
+
+static inline slab *
+rte_slab(uint size)
+{
+  return rte_slab_[BIRD_ALIGN(size - OFFSETOF(rte, u), sizeof(u64)) / sizeof(u64)];
+}
+
 rte *
 rte_get_temp(rta *a)
 {
-  rte *e = sl_alloc(rte_slab);
+  rte *e = sl_alloc(rte_slab(rte_size(a)));
 
   e->attrs = a;
+  e->src_proto = a->src->proto;
   e->id = 0;
   e->flags = 0;
   e->pref = 0;
@@ -291,9 +451,10 @@ rte_get_temp(rta *a)
 rte *
 rte_do_cow(rte *r)
 {
-  rte *e = sl_alloc(rte_slab);
+  uint size = rte_size(r->attrs);
+  rte *e = sl_alloc(rte_slab(size));
 
-  memcpy(e, r, sizeof(rte));
+  memcpy(e, r, size);
   e->attrs = rta_clone(r->attrs);
   e->flags = 0;
   return e;
@@ -452,7 +613,7 @@ void
 rte_make_tmp_attrs(rte **r, linpool *lp, rta **old_attrs)
 {
   void (*make_tmp_attrs)(rte *r, linpool *lp);
-  make_tmp_attrs = (*r)->attrs->src->proto->make_tmp_attrs;
+  make_tmp_attrs = (*r)->src_proto->make_tmp_attrs;
 
   if (!make_tmp_attrs)
     return;
@@ -481,7 +642,7 @@ static void
 rte_store_tmp_attrs(rte *r, linpool *lp, rta *old_attrs)
 {
   void (*store_tmp_attrs)(rte *rt, linpool *lp);
-  store_tmp_attrs = r->attrs->src->proto->store_tmp_attrs;
+  store_tmp_attrs = r->src_proto->store_tmp_attrs;
 
   if (!store_tmp_attrs)
     return;
@@ -500,6 +661,13 @@ rte_store_tmp_attrs(rte *r, linpool *lp, rta *old_attrs)
   rta_free(old_attrs);
 }
 
+/* Temporary attributes are made only for filters accessing them */
+static inline int
+rte_filter_tmp_attrs(const struct filter *filter, rte *r)
+{
+  return !!(filter_ea_protos(filter) & (1u << r->src_proto->proto->class));
+}
+
 
 static int				/* Actually better or at least as good as */
 rte_better(rte *new, rte *old)
@@ -515,16 +683,16 @@ rte_better(rte *new, rte *old)
     return 1;
   if (new->pref < old->pref)
     return 0;
-  if (new->attrs->src->proto->proto != old->attrs->src->proto->proto)
+  if (new->src_proto->proto != old->src_proto->proto)
     {
       /*
        *  If the user has configured protocol preferences, so that two different protocols
        *  have the same preference, try to break the tie by comparing addresses. Not too
        *  useful, but keeps the ordering of routes unambiguous.
        */
-      return new->attrs->src->proto->proto > old->attrs->src->proto->proto;
+      return new->src_proto->proto > old->src_proto->proto;
     }
-  if (better = new->attrs->src->proto->rte_better)
+  if (better = new->src_proto->rte_better)
     return better(new, old);
   return 0;
 }
@@ -540,10 +708,10 @@ rte_mergable(rte *pri, rte *sec)
   if (pri->pref != sec->pref)
     return 0;
 
-  if (pri->attrs->src->proto->proto != sec->attrs->src->proto->proto)
+  if (pri->src_proto->proto != sec->src_proto->proto)
     return 0;
 
-  if (mergable = pri->attrs->src->proto->rte_mergable)
+  if (mergable = pri->src_proto->rte_mergable)
     return mergable(pri, sec);
 
   return 0;
@@ -569,6 +737,104 @@ rte_trace_out(uint flag, struct proto *p, rte *e, char *msg)
     rte_trace(p, e, '<', msg);
 }
 
+/*
+ * Export filter cache
+ *
+ * Export filters which do not depend on the route network (see
+ * filter_net_dep()) give the same verdict for all routes sharing the same
+ * attributes, which is common when feeding a channel from a large table. Such
+ * verdicts are kept in a small direct-mapped cache keyed by the interned rta
+ * (and route preference, which is also visible to filters). Only plain accept
+ * and reject verdicts are cached, routes modified by the filter always go
+ * through the interpreter. Cached entries hold a reference to their rta, so
+ * the key pointer cannot be reused for other attributes while cached. The
+ * cache is flushed whenever the export filter changes or the export stops.
+ */
+
+#define EXPORT_CACHE_ORDER	10
+#define EXPORT_CACHE_SIZE	(1 << EXPORT_CACHE_ORDER)
+
+struct export_cache_entry {
+  rta *attrs;
+  u16 pref;
+  u8 accept;
+};
+
+void
+rt_flush_export_cache(struct channel *c)
+{
+  if (!c->out_cache)
+    return;
+
+  for (uint i = 0; i < EXPORT_CACHE_SIZE; i++)
+    rta_free(c->out_cache[i].attrs);
+
+  mb_free(c->out_cache);
+  c->out_cache = NULL;
+}
+
+static inline struct export_cache_entry *
+export_cache_get(struct channel *c, rte *rt)
+{
+  /* Protocol-specific route data may be visible to filters as tmp attrs */
+  if (rt->src_proto->make_tmp_attrs || filter_net_dep(c->out_filter))
+    return NULL;
+
+  if (!c->out_cache)
+    c->out_cache = mb_allocz(c->proto->pool, EXPORT_CACHE_SIZE * sizeof(struct export_cache_entry));
+
+  return &c->out_cache[rt->attrs->hash_key >> (32 - EXPORT_CACHE_ORDER)];
+}
+
+/*
+ * Export verdict memo
+ *
+ * When a change is announced to many channels sharing the same export filter,
+ * the filter gives the same verdict for the same route in all of them. During
+ * rte_announce(), plain accept and reject verdicts are therefore remembered by
+ * filter and route, so the filter is run just once per announcement instead of
+ * once per channel. The memo lives on the stack of rte_announce() and nested
+ * announcements (e.g. through pipes) use their own.
+ *
+ * All routes seen during one announcement share the same network. Filters
+ * depending on nothing but the network (see filter_route_dep()), typically
+ * prefix set matches, give the same verdict for all of them, so their verdict
+ * is reused for other routes too (e.g. in RA_ACCEPTED and RA_MERGED modes).
+ * Channel feeding uses a memo per network for the same purpose.
+ */
+
+#define EXPORT_MEMO_SIZE	8
+
+struct export_memo {
+  uint pos;
+  struct export_memo_entry {
+    const struct filter *filter;
+    rte *rt;
+    int verdict;
+  } e[EXPORT_MEMO_SIZE];
+};
+
+static struct export_memo *export_memo;
+
+static inline struct export_memo_entry *
+export_memo_find(const struct filter *filter, rte *rt)
+{
+  int any_rt = !filter_route_dep(filter);
+
+  for (uint i = 0; i < EXPORT_MEMO_SIZE; i++)
+    if ((export_memo->e[i].filter == filter) && (any_rt || (export_memo->e[i].rt == rt)))
+      return &export_memo->e[i];
+
+  return NULL;
+}
+
+static inline void
+export_memo_add(const struct filter *filter, rte *rt, int verdict)
+{
+  export_memo->e[export_memo->pos++ % EXPORT_MEMO_SIZE] =
+    (struct export_memo_entry) { .filter = filter, .rt = rt, .verdict = verdict };
+}
+
 static rte *
 export_filter_(struct channel *c, rte *rt0, rte **rt_free, linpool *pool, int silent)
 {
@@ -576,7 +842,7 @@ export_filter_(struct channel *c, rte *rt0, rte **rt_free, linpool *pool, int si
   const struct filter *filter = c->out_filter;
   struct proto_stats *stats = &c->stats;
   rte *rt;
-  int v;
+  int v, tmp_late = 0;
 
   rt = rt0;
   *rt_free = NULL;
@@ -599,11 +865,46 @@ export_filter_(struct channel *c, rte *rt0, rte **rt_free, linpool *pool, int si
       goto accept;
     }
 
-  rte_make_tmp_attrs(&rt, pool, NULL);
+  /* Routes stay unmodified unless the filter needs temporary attributes */
+  tmp_late = !rte_filter_tmp_attrs(filter, rt);
+  if (!tmp_late)
+    rte_make_tmp_attrs(&rt, pool, NULL);
+
+  /* Shown routes are not exported, keep them out of the cache */
+  struct export_cache_entry *ce = NULL;
+  if (filter && (filter != FILTER_REJECT) && !silent && (rt == rt0))
+    ce = export_cache_get(c, rt);
+
+  /* Verdict of the same filter for the same route in another channel */
+  int memo = export_memo && filter && (filter != FILTER_REJECT) && !silent && (rt == rt0);
+  struct export_memo_entry *me = memo ? export_memo_find(filter, rt0) : NULL;
+
+  if (me)
+    v = me->verdict;
+  else if (ce && (ce->attrs == rt->attrs) && (ce->pref == rt->pref))
+    v = !ce->accept;
+  else
+  {
+    struct cpu_acct_mark cm = cpu_acct_begin();
+    v = filter && ((filter == FILTER_REJECT) ||
+		   (f_run(filter, &rt, pool,
+			  (silent ? FF_SILENT : 0)) > F_ACCEPT));
+    cpu_acct_end(&c->cpu, CPU_ACCT_FILTER, cm);
+
+    if (memo && (v || (rt == rt0)))
+      export_memo_add(filter, rt0, v);
+
+    if (ce && (v || (rt == rt0)))
+    {
+      rta_free(ce->attrs);
+      *ce = (struct export_cache_entry) {
+	.attrs = rta_clone(rt0->attrs),
+	.pref = rt0->pref,
+	.accept = !v,
+      };
+    }
+  }
 
-  v = filter && ((filter == FILTER_REJECT) ||
-		 (f_run(filter, &rt, pool,
-			(silent ? FF_SILENT : 0)) > F_ACCEPT));
   if (v)
     {
       if (silent)
@@ -615,17 +916,41 @@ export_filter_(struct channel *c, rte *rt0, rte **rt_free, linpool *pool, int si
     }
 
  accept:
+  /* Temporary attributes are also read by the receiving protocol */
+  if (tmp_late)
+    rte_make_tmp_attrs(&rt, pool, NULL);
+
+  TRACEPOINT(export_filter, p->name, rt0->net->n.addr, 1);
   if (rt != rt0)
     *rt_free = rt;
   return rt;
 
  reject:
+  TRACEPOINT(export_filter, p->name, rt0->net->n.addr, 0);
   /* Discard temporary rte */
   if (rt != rt0)
     rte_free(rt);
   return NULL;
 }
 
+/*
+ * Exports are done synchronously from route updates, so routes do not carry
+ * their ingress time. It is the time when the outermost update began (see
+ * rte_update_lock()), updates nested through pipes keep it. Export latency is
+ * measured to the return from the rt_notify() hook, so it includes the work of
+ * the hook (e.g. the kernel syscall), unlike the cached current_time().
+ */
+static btime rte_update_time;		/* Begin of the outermost update, 0 outside of updates */
+
+static inline btime
+rt_latency_now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec S + ts.tv_nsec NS;
+}
+
 static inline rte *
 export_filter(struct channel *c, rte *rt0, rte **rt_free, int silent)
 {
@@ -688,6 +1013,10 @@ do_rt_notify(struct channel *c, net *net, rte *new, rte *old, int refeed)
   }
 
   p->rt_notify(p, c, net, new, old);
+
+  /* Routes sent during refeed were not changed recently */
+  if (c->export_latency && new && rte_update_time && !refeed)
+    histogram_add(c->export_latency, rt_latency_now() - rte_update_time);
 }
 
 static void
@@ -717,6 +1046,79 @@ rt_notify_basic(struct channel *c, net *net, rte *new, rte *old, int refeed)
     rte_free(new_free);
 }
 
+/*
+ * Channels in RA_ANY mode with ra_limit get only the best ra_limit routes of
+ * each network. The best routes are selected by rt_select_best() once per
+ * change for all such channels. Besides the changed route itself, routes
+ * which moved into or out of the best ones are announced or withdrawn, as
+ * found by the export map.
+ */
+static uint
+rt_select_best(net *net, rte **best, uint max)
+{
+  rte *e = net->routes;
+  uint cnt = 0;
+
+  if (!rte_is_valid(e))
+    return 0;
+
+  /* The selected route goes first regardless of rte_better() */
+  best[cnt++] = e;
+
+  for (e = e->next; e; e = e->next)
+  {
+    if (!rte_is_valid(e))
+      continue;
+
+    uint i = cnt;
+    while ((i > 1) && rte_better(e, best[i - 1]))
+      i--;
+
+    if (i >= max)
+      continue;
+
+    memmove(best + i + 1, best + i, (MIN(cnt, max - 1) - i) * sizeof(rte *));
+    best[i] = e;
+    cnt = MIN(cnt + 1, max);
+  }
+
+  return cnt;
+}
+
+static inline int
+rt_is_best(rte **best, uint cnt, rte *e)
+{
+  for (uint i = 0; i < cnt; i++)
+    if (best[i] == e)
+      return 1;
+
+  return 0;
+}
+
+static void
+rt_notify_limited(struct channel *c, net *net, rte *new, rte *old, rte **best, uint cnt)
+{
+  if (new && !rt_is_best(best, cnt, new))
+    new = NULL;
+
+  if ((new || old) && (new != old))
+    rt_notify_basic(c, net, new, old, 0);
+
+  for (rte *e = net->routes; e; e = e->next)
+  {
+    if ((e == new) || !rte_is_valid(e))
+      continue;
+
+    int in = rt_is_best(best, cnt, e);
+    int was = bmap_test(&c->export_map, e->id);
+
+    if (in && !was)
+      rt_notify_basic(c, net, e, NULL, 0);
+    else if (!in && was)
+      rt_notify_basic(c, net, NULL, e, 0);
+  }
+}
+
 static void
 rt_notify_accepted(struct channel *c, net *net, rte *new_changed, rte *old_changed, int refeed)
 {
@@ -740,6 +1142,12 @@ rt_notify_accepted(struct channel *c, net *net, rte *new_changed, rte *old_chang
    * feed or old_best is old_changed -> we need to recompute new_best
    * old_best is before new_changed -> new_best is old_best, ignore
    * old_best is after new_changed -> try new_changed, otherwise old_best
+   *
+   * Routes rejected by the export filter are remembered in reject_map, so the
+   * recomputation does not run the filter again for routes which have not
+   * changed since. Route IDs are kept when routes are replaced, therefore
+   * the bits of changed routes are cleared. On feed, any route may have been
+   * changed (e.g. by next hop update), so the bits of the net are cleared.
    */
 
   if (net->routes)
@@ -747,6 +1155,16 @@ rt_notify_accepted(struct channel *c, net *net, rte *new_changed, rte *old_chang
   else
     c->stats.exp_withdraws_received++;
 
+  if (new_changed)
+    bmap_clear(&c->reject_map, new_changed->id);
+
+  if (old_changed)
+    bmap_clear(&c->reject_map, old_changed->id);
+
+  if (!new_changed && !old_changed)
+    for (rte *r = net->routes; r; r = r->next)
+      bmap_clear(&c->reject_map, r->id);
+
   /* Find old_best - either old_changed, or route for net->routes */
   if (old_changed && bmap_test(&c->export_map, old_changed->id))
     old_best = old_changed;
@@ -771,16 +1189,28 @@ rt_notify_accepted(struct channel *c, net *net, rte *new_changed, rte *old_chang
   {
     /* Feed or old_best changed -> find first accepted by filters */
     for (rte *r = net->routes; rte_is_valid(r); r = r->next)
+    {
+      /* Rejected before and not changed since */
+      if (bmap_test(&c->reject_map, r->id))
+	continue;
+
       if (new_best = export_filter(c, r, &new_free, 0))
 	break;
+
+      bmap_set(&c->reject_map, r->id);
+    }
   }
   else
   {
     /* Other cases -> either new_changed, or old_best (and nothing changed) */
-    if (new_first && (new_changed = export_filter(c, new_changed, &new_free, 0)))
-      new_best = new_changed;
-    else
+    if (!new_first)
+      return;
+
+    if (!(new_best = export_filter(c, new_changed, &new_free, 0)))
+    {
+      bmap_set(&c->reject_map, new_changed->id);
       return;
+    }
   }
 
   if (!new_best && !old_best)
@@ -853,22 +1283,126 @@ rt_export_merged(struct channel *c, net *net, rte **rt_free, linpool *pool, int
 }
 
 
-static void
-rt_notify_merged(struct channel *c, net *net, rte *new_changed, rte *old_changed,
-		 rte *new_best, rte *old_best, int refeed)
-{
-  // struct proto *p = c->proto;
-  rte *new_free = NULL;
+/*
+ * Merged route cache
+ *
+ * Merged routes are built again on each relevant change of their network, but
+ * the change often does not affect the result (e.g. other attributes of a
+ * secondary route changed, or the path is over the merge limit). Attributes of
+ * merged routes exported to the channel are therefore interned and kept by
+ * their network, so the export is skipped when neither the best route nor the
+ * merged attributes changed.
+ */
 
-  /* We assume that all rte arguments are either NULL or rte_is_valid() */
+struct export_merged {
+  struct export_merged *next;
+  net *net;
+  rta *attrs;				/* Cached attributes of the exported merged route */
+};
 
-  /* This check should be done by the caller */
-  if (!new_best && !old_best)
-    return;
+struct export_merged_cache {
+  HASH(struct export_merged) hash;
+  slab *slab;
+};
 
-  /* Check whether the change is relevant to the merged route */
-  if ((new_best == old_best) &&
-      (new_changed != old_changed) &&
+#define EMC_KEY(e)		e->net
+#define EMC_NEXT(e)		e->next
+#define EMC_EQ(a,b)		a == b
+#define EMC_FN(n)		ptr_hash(n)
+
+#define EMC_REHASH		export_merged_rehash
+#define EMC_PARAMS		/8, *2, 2, 2, 10, 24
+
+HASH_DEFINE_REHASH_FN(EMC, struct export_merged)
+
+void
+rt_flush_merged_cache(struct channel *c)
+{
+  struct export_merged_cache *mc = c->merged_cache;
+
+  if (!mc)
+    return;
+
+  HASH_WALK(mc->hash, next, m)
+    rta_free(m->attrs);
+  HASH_WALK_END;
+
+  HASH_FREE(mc->hash);
+  rfree(mc->slab);
+  mb_free(mc);
+  c->merged_cache = NULL;
+}
+
+static struct export_merged_cache *
+export_merged_cache_get(struct channel *c)
+{
+  struct export_merged_cache *mc = c->merged_cache;
+
+  if (mc)
+    return mc;
+
+  mc = c->merged_cache = mb_allocz(c->proto->pool, sizeof(struct export_merged_cache));
+  HASH_INIT(mc->hash, c->proto->pool, 10);
+  mc->slab = sl_new(c->proto->pool, sizeof(struct export_merged));
+
+  return mc;
+}
+
+/* Remember attributes of the merged route exported for @net, NULL if none */
+static void
+export_merged_update(struct channel *c, net *net, rte *new)
+{
+  struct export_merged_cache *mc = export_merged_cache_get(c);
+  struct export_merged *m = HASH_FIND(mc->hash, EMC, net);
+
+  if (new && !m)
+  {
+    m = sl_alloc(mc->slab);
+    *m = (struct export_merged) { .net = net };
+    HASH_INSERT2(mc->hash, EMC, c->proto->pool, m);
+  }
+  else if (!new && m)
+  {
+    HASH_REMOVE2(mc->hash, EMC, c->proto->pool, m);
+    rta_free(m->attrs);
+    sl_free(mc->slab, m);
+    return;
+  }
+
+  if (m)
+  {
+    rta_free(m->attrs);
+    m->attrs = rta_clone(new->attrs);
+  }
+}
+
+/* The merged route is the same as the one exported, see export_merged_update() */
+static int
+export_merged_same(struct channel *c, net *net, rte *new, rte *old)
+{
+  if (!c->merged_cache || (new->id != old->id))
+    return 0;
+
+  struct export_merged *m = HASH_FIND(c->merged_cache->hash, EMC, net);
+  return m && (m->attrs == new->attrs);
+}
+
+static void
+rt_notify_merged(struct channel *c, net *net, rte *new_changed, rte *old_changed,
+		 rte *new_best, rte *old_best, int refeed)
+{
+  // struct proto *p = c->proto;
+  rte *new_free = NULL;
+
+  /* We assume that all rte arguments are either NULL or rte_is_valid() */
+
+  /* This check should be done by the caller */
+  if (!new_best && !old_best)
+    return;
+
+  /* Check whether the change is relevant to the merged route */
+  if ((new_best == old_best) &&
+      (new_changed != old_changed) &&
       !rte_mergable(new_best, new_changed) &&
       !rte_mergable(old_best, old_changed))
     return;
@@ -887,10 +1421,22 @@ rt_notify_merged(struct channel *c, net *net, rte *new_changed, rte *old_changed
     old_best = NULL;
 
   if (!new_best && !old_best)
-    return;
+    goto done;
+
+  /* Merged attributes are cached to be compared with the exported ones */
+  if (new_best && !rta_is_cached(new_best->attrs))
+    new_best->attrs = rta_lookup(new_best->attrs);
+
+  /* The change did not affect the merged route */
+  if (new_best && old_best && !refeed && export_merged_same(c, net, new_best, old_best))
+    goto done;
 
   do_rt_notify(c, net, new_best, old_best, refeed);
 
+  export_merged_update(c, net,
+      (new_best && bmap_test(&c->export_map, new_best->id)) ? new_best : NULL);
+
+done:
   /* Discard temporary rte */
   if (new_free)
     rte_free(new_free);
@@ -935,6 +1481,13 @@ rt_notify_merged(struct channel *c, net *net, rte *new_changed, rte *old_changed
  *
  * Note that there are also calls of rt_notify() hooks due to feed, but that is
  * done outside of scope of rte_announce().
+ *
+ * Exports are synchronous. The old route passed to rt_notify() is freed by the
+ * caller right after the announcement and the export map refers to it just by
+ * its ID, which may be reused for another route. Deferring exports would need
+ * the channel to keep its own copy of exported routes, as the export table
+ * (&out_table) does. Slow consumers are expected to coalesce pending changes
+ * on their own, as BGP does in its prefix and bucket hashes.
  */
 static void
 rte_announce(rtable *tab, uint type, net *net, rte *new, rte *old,
@@ -955,6 +1508,8 @@ rte_announce(rtable *tab, uint type, net *net, rte *new, rte *old,
   if (!new && !old && !new_best && !old_best)
     return;
 
+  TRACEPOINT(rte_announce, tab->name, net->n.addr, type, new, old);
+
   if (new_best != old_best)
   {
     if (new_best)
@@ -964,8 +1519,29 @@ rte_announce(rtable *tab, uint type, net *net, rte *new, rte *old,
 
     if (tab->hostcache)
       rt_notify_hostcache(tab, net);
+
+    if (tab->roa_index && !new_best != !old_best)
+    {
+      if (new_best)
+	roa_index_add(tab->roa_index, net->n.addr);
+      else
+	roa_index_remove(tab->roa_index, net->n.addr);
+
+      struct roa_subscription *s;
+      WALK_LIST(s, tab->roa_subscribers)
+	s->hook(s, net->n.addr);
+    }
   }
 
+  struct rt_phase_mark pm = rt_phase_begin();
+
+  struct export_memo memo = {}, *memo_outer = export_memo;
+  export_memo = &memo;
+
+  /* Best routes for limited channels, selected on demand */
+  rte *best[RA_LIMIT_MAX];
+  uint best_cnt = 0, best_max = 0;
+
   struct channel *c; node *n;
   WALK_LIST2(c, n, tab->channels, table_node)
   {
@@ -975,6 +1551,8 @@ rte_announce(rtable *tab, uint type, net *net, rte *new, rte *old,
     if (type && (type != c->ra_mode))
       continue;
 
+    struct cpu_acct_mark cm = cpu_acct_begin();
+
     switch (c->ra_mode)
     {
     case RA_OPTIMAL:
@@ -983,7 +1561,14 @@ rte_announce(rtable *tab, uint type, net *net, rte *new, rte *old,
       break;
 
     case RA_ANY:
-      if (new != old)
+      if (c->ra_limit)
+      {
+	if (best_max < c->ra_limit)
+	  best_cnt = rt_select_best(net, best, best_max = c->ra_limit);
+
+	rt_notify_limited(c, net, new, old, best, MIN(best_cnt, c->ra_limit));
+      }
+      else if (new != old)
 	rt_notify_basic(c, net, new, old, 0);
       break;
 
@@ -995,7 +1580,12 @@ rte_announce(rtable *tab, uint type, net *net, rte *new, rte *old,
       rt_notify_merged(c, net, new, old, new_best, old_best, 0);
       break;
     }
+
+    cpu_acct_end(&c->cpu, CPU_ACCT_EXPORT, cm);
   }
+
+  export_memo = memo_outer;
+  rt_phase_end(RT_PHASE_EXPORT, pm);
 }
 
 static inline int
@@ -1047,16 +1637,77 @@ rte_validate(rte *e)
 void
 rte_free(rte *e)
 {
+  slab *s = rte_slab(rte_size(e->attrs));
+
   if (rta_is_cached(e->attrs))
     rta_free(e->attrs);
-  sl_free(rte_slab, e);
+  sl_free(s, e);
 }
 
 static inline void
 rte_free_quick(rte *e)
 {
+  slab *s = rte_slab(rte_size(e->attrs));
+
   rta_free(e->attrs);
-  sl_free(rte_slab, e);
+  sl_free(s, e);
+}
+
+/* Is there a valid route in @n other than @e? */
+static inline int
+rt_net_has_valid(net *n, rte *e)
+{
+  for (rte *r = n->routes; r; r = r->next)
+    if ((r != e) && rte_is_valid(r))
+      return 1;
+
+  return 0;
+}
+
+/* Update table counters, called just after @e was linked to @n */
+static void
+rt_stats_add(rtable *tab, net *n, rte *e)
+{
+  struct rt_stats *s = tab->stats;
+
+  tab->rt_count++;
+  s->sources[e->attrs->source]++;
+  s->pxlens[MIN(n->n.addr->pxlen, IP6_MAX_PREFIX_LENGTH)]++;
+
+  if (rte_is_filtered(e))
+    s->filtered++;
+  else if (!rt_net_has_valid(n, e))
+    s->nets++;
+}
+
+/* Update table counters, called just after @e was unlinked from @n */
+static void
+rt_stats_remove(rtable *tab, net *n, rte *e)
+{
+  struct rt_stats *s = tab->stats;
+
+  tab->rt_count--;
+  s->sources[e->attrs->source]--;
+  s->pxlens[MIN(n->n.addr->pxlen, IP6_MAX_PREFIX_LENGTH)]--;
+
+  if (rte_is_filtered(e))
+    s->filtered--;
+  else if (!rt_net_has_valid(n, NULL))
+    s->nets--;
+}
+
+/* Free a route removed from the table, postponed while snapshots are live */
+static inline void
+rte_free_table(rtable *tab, rte *e)
+{
+  if (tab->snapshots)
+  {
+    e->next = tab->snapshot_limbo;
+    tab->snapshot_limbo = e;
+    return;
+  }
+
+  rte_free_quick(e);
 }
 
 static int
@@ -1067,12 +1718,102 @@ rte_same(rte *x, rte *y)
     x->attrs == y->attrs &&
     x->pflags == y->pflags &&
     x->pref == y->pref &&
-    (!x->attrs->src->proto->rte_same || x->attrs->src->proto->rte_same(x, y)) &&
+    (!x->src_proto->rte_same || x->src_proto->rte_same(x, y)) &&
     rte_is_filtered(x) == rte_is_filtered(y);
 }
 
 static inline int rte_is_ok(rte *e) { return e && !rte_is_filtered(e); }
 
+/* Hostentry of a route stored in its dependent table, see rt_next_hop_update() */
+static inline struct hostentry *
+rte_hostentry(rtable *tab, rte *e)
+{
+  struct hostentry *he = e->attrs->hostentry;
+  return (he && (he->tab == tab)) ? he : NULL;
+}
+
+static inline void
+rte_link_hostentry(rtable *tab, rte *e)
+{
+  struct hostentry *he = rte_hostentry(tab, e);
+  if (he)
+    add_tail(&he->routes, &e->he_node);
+}
+
+static inline void
+rte_unlink_hostentry(rtable *tab, rte *e)
+{
+  if (rte_hostentry(tab, e))
+    rem_node(&e->he_node);
+}
+
+/*
+ * Each channel keeps lists of its own routes in the main table and in the
+ * shared import and export tables, so flushing and pruning of the channel
+ * cost is proportional to the number of its routes, not to the table size.
+ */
+static inline list *
+rte_sender_list(rtable *tab, struct channel *c)
+{
+  return (tab == c->in_table) ? &c->in_routes :
+    (tab == c->out_table) ? &c->out_routes : &c->routes;
+}
+
+static inline void
+rte_link_sender(rtable *tab, rte *e)
+{
+  /* The route may be a copy of another linked route */
+  e->sender_n = (node) {};
+  add_tail(rte_sender_list(tab, e->sender), &e->sender_n);
+}
+
+static inline void
+rte_unlink_sender(rte *e)
+{
+  rem_node(&e->sender_n);
+}
+
+/*
+ * Find position of @new in the sorted route list starting at @k. The list is
+ * ordered by rte_better(), so for longer lists (e.g. with ADD-PATH or on route
+ * collectors) the position is found by binary search over an index of list
+ * links built on stack, needing just O(log n) calls of rte_better().
+ */
+static rte **
+rt_sorted_position(rte **k, rte *new)
+{
+  uint count = 0;
+  for (rte *e = *k; e; e = e->next)
+    count++;
+
+  if (count <= RT_SORTED_LINEAR)
+  {
+    for (; *k; k = &(*k)->next)
+      if (rte_better(new, *k))
+	break;
+
+    return k;
+  }
+
+  rte ***links = alloca(count * sizeof(rte **));
+  for (uint i = 0; i < count; i++, k = &(*k)->next)
+    links[i] = k;
+
+  /* Find the first route worse than @new */
+  uint lo = 0, hi = count;
+  while (lo < hi)
+  {
+    uint mid = (lo + hi) / 2;
+
+    if (rte_better(new, *links[mid]))
+      hi = mid;
+    else
+      lo = mid + 1;
+  }
+
+  return (lo < count) ? links[lo] : k;
+}
+
 static void
 rte_recalculate(struct channel *c, net *net, rte *new, struct rte_src *src)
 {
@@ -1085,10 +1826,19 @@ rte_recalculate(struct channel *c, net *net, rte *new, struct rte_src *src)
   rte *old = NULL;
   rte **k;
 
+  TRACEPOINT(rte_recalculate, p->name, net->n.addr, new, old_best);
+
+  /* In indexed nets, the route is found by the index and the list is walked just to unlink it */
+  int indexed = rt_src_indexed(net);
+  rte *found = indexed ? rt_src_index_find(net, src) : NULL;
+  uint walked = 0;
+
   k = &net->routes;			/* Find and remove original route from the same protocol */
-  while (old = *k)
+  if (indexed && !found)
+    k = &net->routes->next;		/* Not there, new route goes after the best one */
+  else while (old = *k)
     {
-      if (old->attrs->src == src)
+      if (indexed ? (old == found) : (old->attrs->src == src))
 	{
 	  /* If there is the same route in the routing table but from
 	   * a different sender, then there are two paths from the
@@ -1114,7 +1864,7 @@ rte_recalculate(struct channel *c, net *net, rte *new, struct rte_src *src)
 	    {
 	      /* No changes, ignore the new route and refresh the old one */
 
-	      old->flags &= ~(REF_STALE | REF_DISCARD | REF_MODIFY);
+	      old->stale_cycle = new->stale_cycle;
 
 	      if (!rte_is_filtered(new))
 		{
@@ -1126,13 +1876,18 @@ rte_recalculate(struct channel *c, net *net, rte *new, struct rte_src *src)
 	      return;
 	    }
 	  *k = old->next;
-	  table->rt_count--;
+	  rt_stats_remove(table, net, old);
+	  rt_src_index_unlink(old);
 	  break;
 	}
       k = &old->next;
       before_old = old;
+      walked++;
     }
 
+  if (!indexed && (walked >= RT_SRC_INDEX_MIN))
+    rt_src_index_net(net);
+
   /* Save the last accessed position */
   rte **pos = k;
 
@@ -1226,14 +1981,12 @@ rte_recalculate(struct channel *c, net *net, rte *new, struct rte_src *src)
 	  else
 	    k = &net->routes;
 
-	  for (; *k; k=&(*k)->next)
-	    if (rte_better(new, *k))
-	      break;
+	  k = rt_sorted_position(k, new);
 
 	  new->next = *k;
 	  *k = new;
 
-	  table->rt_count++;
+	  rt_stats_add(table, net, new);
 	}
     }
   else
@@ -1252,7 +2005,7 @@ rte_recalculate(struct channel *c, net *net, rte *new, struct rte_src *src)
 	  new->next = net->routes;
 	  net->routes = new;
 
-	  table->rt_count++;
+	  rt_stats_add(table, net, new);
 	}
       else if (old == old_best)
 	{
@@ -1269,7 +2022,7 @@ rte_recalculate(struct channel *c, net *net, rte *new, struct rte_src *src)
 	      new->next = *pos;
 	      *pos = new;
 
-	      table->rt_count++;
+	      rt_stats_add(table, net, new);
 	    }
 
 	  /* Find a new optimal route (if there is any) */
@@ -1297,7 +2050,7 @@ rte_recalculate(struct channel *c, net *net, rte *new, struct rte_src *src)
 	  new->next = *pos;
 	  *pos = new;
 
-	  table->rt_count++;
+	  rt_stats_add(table, net, new);
 	}
       /* The fourth (empty) case - suboptimal route was removed, nothing to do */
     }
@@ -1305,6 +2058,9 @@ rte_recalculate(struct channel *c, net *net, rte *new, struct rte_src *src)
   if (new)
     {
       new->lastmod = current_time();
+      rte_link_hostentry(table, new);
+      rte_link_sender(table, new);
+      rt_src_index_link(net, new);
 
       if (!old)
         {
@@ -1349,7 +2105,9 @@ rte_recalculate(struct channel *c, net *net, rte *new, struct rte_src *src)
       if (!new)
 	hmap_clear(&table->id_map, old->id);
 
-      rte_free_quick(old);
+      rte_unlink_hostentry(table, old);
+      rte_unlink_sender(old);
+      rte_free_table(table, old);
     }
 }
 
@@ -1358,36 +2116,219 @@ static int rte_update_nest_cnt;		/* Nesting counter to allow recursive updates *
 static inline void
 rte_update_lock(void)
 {
-  rte_update_nest_cnt++;
+  if (!rte_update_nest_cnt++)
+    rte_update_time = current_time();
 }
 
 static inline void
 rte_update_unlock(void)
 {
   if (!--rte_update_nest_cnt)
+  {
     lp_flush(rte_update_pool);
+    rte_update_time = 0;
+  }
 }
 
+/* Hidden dummy route is not counted in nets, see rt_stats_add() */
 static inline void
-rte_hide_dummy_routes(net *net, rte **dummy)
+rte_hide_dummy_routes(rtable *tab, net *net, rte **dummy)
 {
   if (net->routes && net->routes->attrs->source == RTS_DUMMY)
   {
     *dummy = net->routes;
     net->routes = (*dummy)->next;
+
+    if (rte_is_valid(*dummy) && !rt_net_has_valid(net, NULL))
+      tab->stats->nets--;
   }
 }
 
 static inline void
-rte_unhide_dummy_routes(net *net, rte **dummy)
+rte_unhide_dummy_routes(rtable *tab, net *net, rte **dummy)
 {
   if (*dummy)
   {
+    if (rte_is_valid(*dummy) && !rt_net_has_valid(net, NULL))
+      tab->stats->nets++;
+
     (*dummy)->next = net->routes;
     net->routes = *dummy;
   }
 }
 
+/*
+ * rte_import_validate - first part of the import stage of rte_update()
+ *
+ * Fills in the channel defaults and validates the route. Returns 0 when the
+ * route is invalid; it is not freed in that case.
+ */
+static int
+rte_import_validate(struct channel *c, rte *new)
+{
+  struct proto_stats *stats = &c->stats;
+
+  new->sender = c;
+  new->stale_cycle = c->refresh.count;
+
+  if (!new->pref)
+    new->pref = c->preference;
+
+  stats->imp_updates_received++;
+  if (!rte_validate(new))
+    {
+      rte_trace_in(D_FILTERS, c->proto, new, "invalid");
+      stats->imp_updates_invalid++;
+      return 0;
+    }
+
+  return 1;
+}
+
+/*
+ * rte_import_filtered - finish the import stage after the import filter
+ *
+ * Processes the result @fr of the import filter run on a route prepared by
+ * rte_make_tmp_attrs() (which gave @old_attrs) when rte_filter_tmp_attrs()
+ * asked for it, and interns its attributes.
+ * Returns the prepared route, or NULL when it has been dropped (and freed).
+ */
+static rte *
+rte_import_filtered(struct channel *c, rte *new, int fr, rta *old_attrs)
+{
+  struct proto_stats *stats = &c->stats;
+
+  if (fr > F_ACCEPT)
+    {
+      stats->imp_updates_filtered++;
+      rte_trace_in(D_FILTERS, c->proto, new, "filtered out");
+
+      if (! c->in_keep_filtered)
+	{
+	  rta_free(old_attrs);
+	  rte_free(new);
+	  return NULL;
+	}
+
+      new->flags |= REF_FILTERED;
+    }
+
+  if (rte_filter_tmp_attrs(c->in_filter, new))
+    rte_store_tmp_attrs(new, rte_update_pool, old_attrs);
+
+  if (!rta_is_cached(new->attrs)) /* Need to copy attributes */
+  {
+    struct rt_phase_mark pm = rt_phase_begin();
+    struct cpu_acct_mark cm = cpu_acct_begin();
+    new->attrs = rta_lookup(new->attrs);
+    cpu_acct_end(&c->cpu, CPU_ACCT_TABLE, cm);
+    rt_phase_end(RT_PHASE_LOOKUP, pm);
+  }
+  new->flags |= REF_COW;
+
+  return new;
+}
+
+/*
+ * rte_import_filter - second part of the import stage of rte_update()
+ *
+ * Runs the import filter of the channel on a validated route and interns its
+ * attributes. This stage touches only the route itself, the channel and the
+ * temporary rte_update_pool; it neither reads nor modifies the routing table.
+ * Returns the prepared route, or NULL when it has been dropped (and freed).
+ */
+static rte *
+rte_import_filter(struct channel *c, rte *new)
+{
+  struct proto *p = c->proto;
+  struct proto_stats *stats = &c->stats;
+  const struct filter *filter = c->in_filter;
+
+  if (filter == FILTER_REJECT)
+    {
+      stats->imp_updates_filtered++;
+      rte_trace_in(D_FILTERS, p, new, "filtered out");
+
+      if (! c->in_keep_filtered)
+	goto drop;
+
+      /* new is a private copy, i could modify it */
+      new->flags |= REF_FILTERED;
+    }
+  else if (filter)
+    {
+      rta *old_attrs = NULL;
+      if (rte_filter_tmp_attrs(filter, new))
+	rte_make_tmp_attrs(&new, rte_update_pool, &old_attrs);
+
+      struct rt_phase_mark pm = rt_phase_begin();
+      struct cpu_acct_mark cm = cpu_acct_begin();
+      int fr = f_run(filter, &new, rte_update_pool, 0);
+      cpu_acct_end(&c->cpu, CPU_ACCT_FILTER, cm);
+      rt_phase_end(RT_PHASE_FILTER, pm);
+
+      return rte_import_filtered(c, new, fr, old_attrs);
+    }
+  if (!rta_is_cached(new->attrs)) /* Need to copy attributes */
+  {
+    struct rt_phase_mark pm = rt_phase_begin();
+    struct cpu_acct_mark cm = cpu_acct_begin();
+    new->attrs = rta_lookup(new->attrs);
+    cpu_acct_end(&c->cpu, CPU_ACCT_TABLE, cm);
+    rt_phase_end(RT_PHASE_LOOKUP, pm);
+  }
+  new->flags |= REF_COW;
+
+  return new;
+
+ drop:
+  rte_free(new);
+  return NULL;
+}
+
+static inline rte *
+rte_import_prepare(struct channel *c, rte *new)
+{
+  if (rte_import_validate(c, new))
+    return rte_import_filter(c, new);
+
+  rte_free(new);
+  return NULL;
+}
+
+/*
+ * rte_import_commit - table stage of rte_update()
+ *
+ * Finds the table node for @n and recalculates its best route. A NULL @new
+ * means a withdraw; the table node is then only looked up, never created.
+ * This is the only part of the import path that accesses the table itself.
+ * Returns 0 when there was nothing to withdraw.
+ */
+static int
+rte_import_commit(struct channel *c, const net_addr *n, rte *new, struct rte_src *src)
+{
+  rte *dummy = NULL;
+  net *nn;
+
+  if (new)
+    nn = net_get(c->table, n);
+  else if (!(nn = net_find(c->table, n)))
+    return 0;
+
+  if (new)
+    new->net = nn;
+
+  /* And recalculate the best route */
+  struct rt_phase_mark pm = rt_phase_begin();
+  struct cpu_acct_mark cm = cpu_acct_begin();
+  rte_hide_dummy_routes(c->table, nn, &dummy);
+  rte_recalculate(c, nn, new, src);
+  rte_unhide_dummy_routes(c->table, nn, &dummy);
+  cpu_acct_end(&c->cpu, CPU_ACCT_TABLE, cm);
+  rt_phase_end(RT_PHASE_RECALC, pm);
+  return 1;
+}
+
 /**
  * rte_update - enter a new update to a routing table
  * @table: table to be updated
@@ -1433,105 +2374,154 @@ rte_unhide_dummy_routes(net *net, rte **dummy)
 void
 rte_update2(struct channel *c, const net_addr *n, rte *new, struct rte_src *src)
 {
-  struct proto *p = c->proto;
   struct proto_stats *stats = &c->stats;
-  const struct filter *filter = c->in_filter;
-  rte *dummy = NULL;
-  net *nn;
 
   ASSERT(c->channel_state == CS_UP);
+  TRACEPOINT(rte_update, c->proto->name, n, new);
 
   rte_update_lock();
   if (new)
     {
       /* Create a temporary table node */
-      nn = alloca(sizeof(net) + n->length);
+      net *nn = alloca(sizeof(net) + n->length);
       memset(nn, 0, sizeof(net) + n->length);
       net_copy(nn->n.addr, n);
-
       new->net = nn;
-      new->sender = c;
 
-      if (!new->pref)
-	new->pref = c->preference;
+      /* A dropped route withdraws the previous one, if any */
+      new = rte_import_prepare(c, new);
+    }
+  else
+    {
+      stats->imp_withdraws_received++;
 
-      stats->imp_updates_received++;
-      if (!rte_validate(new))
-	{
-	  rte_trace_in(D_FILTERS, p, new, "invalid");
-	  stats->imp_updates_invalid++;
-	  goto drop;
-	}
+      if (!src || !rte_import_commit(c, n, NULL, src))
+	stats->imp_withdraws_ignored++;
 
-      if (filter == FILTER_REJECT)
-	{
-	  stats->imp_updates_filtered++;
-	  rte_trace_in(D_FILTERS, p, new, "filtered out");
+      rte_update_unlock();
+      TRACEPOINT(rte_update__done, c->proto->name, n);
+      return;
+    }
 
-	  if (! c->in_keep_filtered)
-	    goto drop;
+  rte_import_commit(c, n, new, src);
+  rte_update_unlock();
+  TRACEPOINT(rte_update__done, c->proto->name, n);
+}
 
-	  /* new is a private copy, i could modify it */
-	  new->flags |= REF_FILTERED;
-	}
-      else if (filter)
-	{
-	  rta *old_attrs = NULL;
-	  rte_make_tmp_attrs(&new, rte_update_pool, &old_attrs);
+/**
+ * rte_update_batch - enter a batch of updates sharing the same route
+ * @c: channel doing the update
+ * @nets: networks to be updated
+ * @count: number of networks in @nets
+ * @new: a temporary &rte used as a template for all networks, or %NULL for removal
+ * @src: protocol originating the update
+ *
+ * This function has the same effect as calling rte_update2() with a copy of
+ * @new for each of @nets, but is intended for protocols receiving many
+ * networks with the same attributes at once (e.g. BGP UPDATE messages). The
+ * update pool is flushed once per batch and, unless the import filter of the
+ * channel depends on the network itself, the filter is run just once and its
+ * result is reused for the other networks. @new is consumed in any case,
+ * its attributes are interned by rta_lookup() if not cached already.
+ */
+void
+rte_update_batch(struct channel *c, net_addr **nets, uint count, rte *new, struct rte_src *src)
+{
+  struct proto_stats *stats = &c->stats;
+  int shared = !filter_net_dep(c->in_filter);
+  int filtered = 0;
+  rte *done = NULL;
 
-	  int fr = f_run(filter, &new, rte_update_pool, 0);
-	  if (fr > F_ACCEPT)
-	  {
-	    stats->imp_updates_filtered++;
-	    rte_trace_in(D_FILTERS, p, new, "filtered out");
+  ASSERT(c->channel_state == CS_UP);
+  TRACEPOINT(rte_update_batch, c->proto->name, count, new);
 
-	    if (! c->in_keep_filtered)
-	    {
-	      rta_free(old_attrs);
-	      goto drop;
-	    }
+  /* Intern the template once, so that filters modifying attributes of one
+     network copy them instead of changing the template for the others */
+  if (new && !rta_is_cached(new->attrs))
+    new->attrs = rta_lookup(new->attrs);
 
-	    new->flags |= REF_FILTERED;
-	  }
+  rte_update_lock();
+  for (uint i = 0; i < count; i++)
+    {
+      const net_addr *n = nets[i];
+      rte *e;
 
-	  rte_store_tmp_attrs(new, rte_update_pool, old_attrs);
+      if (new)
+	{
+	  /* Create a temporary table node */
+	  net *nn = lp_allocz(rte_update_pool, sizeof(net) + n->length);
+	  net_copy(nn->n.addr, n);
+	  new->net = nn;
 	}
-      if (!rta_is_cached(new->attrs)) /* Need to copy attributes */
-	new->attrs = rta_lookup(new->attrs);
-      new->flags |= REF_COW;
 
-      /* Use the actual struct network, not the dummy one */
-      nn = net_get(c->table, n);
-      new->net = nn;
-    }
-  else
-    {
-      stats->imp_withdraws_received++;
+      if (c->in_table)
+	{
+	  /* rte_update_in() frees a dropped route, but the template is shared
+	     by the rest of the batch, so it gets a private copy */
+	  rte *in = new ? rte_do_cow(new) : NULL;
 
-      if (!(nn = net_find(c->table, n)) || !src)
+	  if (!rte_update_in(c, n, in, src))
+	    continue;
+
+	  if (in)
+	    rte_free(in);
+	}
+
+      if (!new)
 	{
-	  stats->imp_withdraws_ignored++;
-	  rte_update_unlock();
-	  return;
+	  stats->imp_withdraws_received++;
+
+	  if (!src || !rte_import_commit(c, n, NULL, src))
+	    stats->imp_withdraws_ignored++;
+
+	  continue;
 	}
-    }
 
- recalc:
-  /* And recalculate the best route */
-  rte_hide_dummy_routes(nn, &dummy);
-  rte_recalculate(c, nn, new, src);
-  rte_unhide_dummy_routes(nn, &dummy);
+      if (!rte_import_validate(c, new))
+	e = NULL;
+      else if (!shared || !filtered)
+	{
+	  e = rte_import_filter(c, rte_do_cow(new));
 
-  rte_update_unlock();
-  return;
+	  /* Keep the result for the rest of the batch */
+	  if (shared && e)
+	    {
+	      done = rte_do_cow(e);
+	      done->flags = e->flags;
+	    }
 
- drop:
-  rte_free(new);
-  new = NULL;
-  if (nn = net_find(c->table, n))
-    goto recalc;
+	  filtered = 1;
+	}
+      else if (done)
+	{
+	  if (done->flags & REF_FILTERED)
+	    {
+	      stats->imp_updates_filtered++;
+	      rte_trace_in(D_FILTERS, c->proto, new, "filtered out");
+	    }
+
+	  e = rte_do_cow(done);
+	  e->flags = done->flags;
+	}
+      else
+	{
+	  stats->imp_updates_filtered++;
+	  rte_trace_in(D_FILTERS, c->proto, new, "filtered out");
+	  e = NULL;
+	}
+
+      /* A dropped route withdraws the previous one, if any */
+      rte_import_commit(c, n, e, src);
+    }
+
+  if (new)
+    rte_free(new);
+
+  if (done)
+    rte_free(done);
 
   rte_update_unlock();
+  TRACEPOINT(rte_update_batch__done, c->proto->name, count);
 }
 
 /* Independent call to rte_announce(), used from next hop
@@ -1566,7 +2556,10 @@ rte_modify(rte *old)
     {
       if (!rta_is_cached(new->attrs))
 	new->attrs = rta_lookup(new->attrs);
-      new->flags = (old->flags & ~REF_MODIFY) | REF_COW;
+      new->flags = old->flags | REF_COW;
+
+      /* Stays stale, but is not to be modified again */
+      new->stale_cycle = old->sender->refresh.count - 1;
     }
 
     rte_recalculate(old->sender, old->net, new, old->attrs->src);
@@ -1591,7 +2584,8 @@ rt_examine(rtable *t, net_addr *a, struct proto *p, const struct filter *filter)
   int v = p->preexport ? p->preexport(p, &rt, rte_update_pool) : 0;
   if (v == RIC_PROCESS)
   {
-    rte_make_tmp_attrs(&rt, rte_update_pool, NULL);
+    if (rte_filter_tmp_attrs(filter, rt))
+      rte_make_tmp_attrs(&rt, rte_update_pool, NULL);
     v = (f_run(filter, &rt, rte_update_pool, FF_SILENT) <= F_ACCEPT);
   }
 
@@ -1605,6 +2599,38 @@ rt_examine(rtable *t, net_addr *a, struct proto *p, const struct filter *filter)
 }
 
 
+static inline struct channel_refresh *
+rt_refresh_cycles(rtable *t, struct channel *c)
+{
+  return (t == c->in_table) ? &c->in_refresh : &c->refresh;
+}
+
+/* Route was not sent during the current refresh cycle */
+static inline int
+rte_is_stale(struct channel_refresh *rc, rte *e)
+{
+  return e->stale_cycle < rc->count;
+}
+
+/* Renumber cycles of channel routes to low values, keeping their meaning */
+static void
+rt_refresh_renumber(rtable *t, struct channel *c, struct channel_refresh *rc)
+{
+  rte *e;
+  node *n;
+
+  WALK_LIST2(e, n, *rte_sender_list(t, c), sender_n)
+    if (n != &c->prune_node)
+      e->stale_cycle =
+	(e->stale_cycle < rc->valid) ? 0 :
+	(e->stale_cycle < rc->modify) ? 1 :
+	(e->stale_cycle < rc->count) ? 2 : 3;
+
+  rc->modify = (rc->modify > rc->valid) ? 2 : 0;
+  rc->valid = rc->valid ? 1 : 0;
+  rc->count = 3;
+}
+
 /**
  * rt_refresh_begin - start a refresh cycle
  * @t: related routing table
@@ -1614,22 +2640,27 @@ rt_examine(rtable *t, net_addr *a, struct proto *p, const struct filter *filter)
  * hook. The refresh cycle is a sequence where the protocol sends all its valid
  * routes to the routing table (by rte_update()). After that, all protocol
  * routes (more precisely routes with @c as @sender) not sent during the
- * refresh cycle but still in the table from the past are pruned. This is
- * implemented by marking all related routes as stale by REF_STALE flag in
- * rt_refresh_begin(), then marking all related stale routes with REF_DISCARD
- * flag in rt_refresh_end() and then removing such routes in the prune loop.
+ * refresh cycle but still in the table from the past are pruned.
+ *
+ * This is implemented by refresh cycle numbers, so no walk over the table is
+ * needed to start or end the cycle. Each route keeps the cycle in which it was
+ * last sent by the channel. Starting a cycle just increments the number of
+ * the current cycle, so all routes of the channel become stale. Ending it
+ * sets the lowest valid cycle and schedules the prune loop, which discards
+ * routes of older cycles. One run of the prune loop serves refresh cycles of
+ * all channels of the table. The cycle number advances by two, the skipped
+ * number is used for stale routes modified by rt_modify_stale(). Before the
+ * number would overflow, routes of the channel are renumbered.
  */
 void
 rt_refresh_begin(rtable *t, struct channel *c)
 {
-  FIB_WALK(&t->fib, net, n)
-    {
-      rte *e;
-      for (e = n->routes; e; e = e->next)
-	if (e->sender == c)
-	  e->flags |= REF_STALE;
-    }
-  FIB_WALK_END;
+  struct channel_refresh *rc = rt_refresh_cycles(t, c);
+
+  if (rc->count >= 250)
+    rt_refresh_renumber(t, c, rc);
+
+  rc->count += 2;
 }
 
 /**
@@ -1643,43 +2674,28 @@ rt_refresh_begin(rtable *t, struct channel *c)
 void
 rt_refresh_end(rtable *t, struct channel *c)
 {
-  int prune = 0;
-
-  FIB_WALK(&t->fib, net, n)
-    {
-      rte *e;
-      for (e = n->routes; e; e = e->next)
-	if ((e->sender == c) && (e->flags & REF_STALE))
-	  {
-	    e->flags |= REF_DISCARD;
-	    prune = 1;
-	  }
-    }
-  FIB_WALK_END;
+  struct channel_refresh *rc = rt_refresh_cycles(t, c);
 
-  if (prune)
-    rt_schedule_prune(t);
+  rc->valid = rc->count;
+  rt_schedule_prune_channel(t, c);
 }
 
+/**
+ * rt_modify_stale - modify stale routes of a refresh cycle
+ * @t: related routing table
+ * @c: related channel
+ *
+ * Routes not yet sent during the current refresh cycle are modified by the
+ * rte_modify() protocol hook in the prune loop. They stay stale, so they are
+ * still discarded at the end of the cycle.
+ */
 void
 rt_modify_stale(rtable *t, struct channel *c)
 {
-  int prune = 0;
-
-  FIB_WALK(&t->fib, net, n)
-    {
-      rte *e;
-      for (e = n->routes; e; e = e->next)
-	if ((e->sender == c) && (e->flags & REF_STALE) && !(e->flags & REF_FILTERED))
-	  {
-	    e->flags |= REF_MODIFY;
-	    prune = 1;
-	  }
-    }
-  FIB_WALK_END;
+  struct channel_refresh *rc = rt_refresh_cycles(t, c);
 
-  if (prune)
-    rt_schedule_prune(t);
+  rc->modify = rc->count - 1;
+  rt_schedule_prune_channel(t, c);
 }
 
 /**
@@ -1695,8 +2711,8 @@ rte_dump(rte *e)
   debug("%-1N ", n->n.addr);
   debug("PF=%02x pref=%d ", e->pflags, e->pref);
   rta_dump(e->attrs);
-  if (e->attrs->src->proto->proto->dump_attrs)
-    e->attrs->src->proto->proto->dump_attrs(e);
+  if (e->src_proto->proto->dump_attrs)
+    e->src_proto->proto->dump_attrs(e);
   debug("\n");
 }
 
@@ -1744,34 +2760,55 @@ rt_schedule_hcu(rtable *tab)
     return;
 
   tab->hcu_scheduled = 1;
-  ev_schedule(tab->rt_event);
+  ev_schedule_work(tab->rt_event);
 }
 
 static inline void
-rt_schedule_nhu(rtable *tab)
+rt_schedule_nhu(struct hostentry *he)
 {
-  if (tab->nhu_state == NHU_CLEAN)
-    ev_schedule(tab->rt_event);
+  rtable *tab = he->tab;
 
-  /* state change:
-   *   NHU_CLEAN   -> NHU_SCHEDULED
-   *   NHU_RUNNING -> NHU_DIRTY
-   */
-  tab->nhu_state |= NHU_SCHEDULED;
+  if (EMPTY_LIST(tab->nhu_list))
+    ev_schedule_work(tab->rt_event);
+
+  if (!NODE_VALID(&he->nhu_node))
+    add_tail(&tab->nhu_list, &he->nhu_node);
+
+  /* All routes currently using the hostentry are to be checked */
+  if (NODE_VALID(&he->nhu_mark))
+    rem_node(&he->nhu_mark);
+
+  add_tail(&he->routes, &he->nhu_mark);
 }
 
-void
-rt_schedule_prune(rtable *tab)
+static void
+rt_schedule_prune_cycle(rtable *tab)
 {
   if (tab->prune_state == 0)
-    ev_schedule(tab->rt_event);
+    ev_schedule_work(tab->rt_event);
 
   /* state change 0->1, 2->3 */
   tab->prune_state |= 1;
 }
 
+/* Schedule prune of the whole table, also collecting orphaned networks */
+void
+rt_schedule_prune(rtable *tab)
+{
+  tab->prune_full = 1;
+  rt_schedule_prune_cycle(tab);
+}
 
-static void
+/* Schedule prune of routes of @c only, see rt_prune_table() */
+void
+rt_schedule_prune_channel(rtable *tab, struct channel *c)
+{
+  c->prune_pending = 1;
+  rt_schedule_prune_cycle(tab);
+}
+
+
+void
 rt_event(void *ptr)
 {
   rtable *tab = ptr;
@@ -1781,7 +2818,7 @@ rt_event(void *ptr)
   if (tab->hcu_scheduled)
     rt_update_hostcache(tab);
 
-  if (tab->nhu_state)
+  if (!EMPTY_LIST(tab->nhu_list))
     rt_next_hop_update(tab);
 
   if (tab->prune_state)
@@ -1797,12 +2834,21 @@ rt_setup(pool *p, rtable *t, struct rtable_config *cf)
   t->name = cf->name;
   t->config = cf;
   t->addr_type = cf->addr_type;
-  fib_init(&t->fib, p, t->addr_type, sizeof(net), OFFSETOF(net, n), 0, NULL);
+  fib_init(&t->fib, p, t->addr_type, sizeof(net), OFFSETOF(net, n), RT_FIB_ORDER, NULL);
+  if (cf->ordered)
+    fib_lpm_init(&t->fib);
   init_list(&t->channels);
+  init_list(&t->feed_group);
 
-  hmap_init(&t->id_map, p, 1024);
+  init_list(&t->roa_subscribers);
+  init_list(&t->nhu_list);
+  if ((t->addr_type == NET_ROA4) || (t->addr_type == NET_ROA6))
+    t->roa_index = roa_index_new(p);
+
+  hmap_init(&t->id_map, p, RT_ID_MAP_SIZE);
   hmap_set(&t->id_map, 0);
 
+  t->stats = mb_allocz(p, sizeof(struct rt_stats));
   t->rt_event = ev_new_init(p, rt_event, t);
   t->gc_time = current_time();
 }
@@ -1819,30 +2865,154 @@ rt_init(void)
   rta_init();
   rt_table_pool = rp_new(&root_pool, "Routing tables");
   rte_update_pool = lp_new_default(rt_table_pool);
-  rte_slab = sl_new(rt_table_pool, sizeof(rte));
+  HASH_INIT(rt_src_hash, rt_table_pool, RSI_INIT_ORDER);
+  rt_src_slab = sl_new(rt_table_pool, sizeof(struct rt_src_entry));
+  for (uint i = 0; i < RTE_SLABS; i++)
+    rte_slab_[i] = sl_new_flags(rt_table_pool, OFFSETOF(rte, u) + i * sizeof(u64), SL_MAGAZINES);
   init_list(&routing_tables);
 }
 
 
+/*
+ * rt_prune_net - remove all routes of flushing channels from a network
+ *
+ * All routes of flushing channels and discarded routes are removed in one
+ * sweep, and routes marked for modification are modified. Each change is
+ * announced by rte_recalculate() as usual, but the caller holds the update
+ * lock over the whole prune chunk, so temporary data are flushed just once.
+ * Returns the number of changed routes.
+ */
+static int
+rt_prune_net(net *n)
+{
+  int changed = 0;
+  rte *e;
+
+rescan:
+  for (e = n->routes; e; e = e->next)
+  {
+    if (e->sender->flush_active || (e->stale_cycle < e->sender->refresh.valid))
+    {
+      rte_recalculate(e->sender, n, NULL, e->attrs->src);
+      changed++;
+
+      /* The route list may have been reordered */
+      goto rescan;
+    }
+
+    if ((e->stale_cycle < e->sender->refresh.modify) && !(e->flags & REF_FILTERED))
+    {
+      rte_modify(e);
+      changed++;
+      goto rescan;
+    }
+  }
+
+  return changed;
+}
+
+/* Check the budget of the prune loop, returns 1 when the run is to be interrupted */
+static inline int
+rt_prune_yield(int *limit)
+{
+  if ((*limit <= 0) && !ev_work_yield())
+    *limit = RT_PRUNE_LIMIT;
+
+  return *limit <= 0;
+}
+
+/* Prune networks of the whole table, returns 0 when interrupted */
+static int
+rt_prune_walk(rtable *tab, int *limit)
+{
+  struct fib_iterator *fit = &tab->prune_fit;
+
+again:
+  FIB_ITERATE_START(&tab->fib, fit, net, n)
+    {
+      if (rt_prune_yield(limit))
+	{
+	  FIB_ITERATE_PUT(fit);
+	  return 0;
+	}
+
+      *limit -= rt_prune_net(n);
+
+      if (!n->routes && !tab->snapshots)	/* Orphaned FIB entry */
+	{
+	  FIB_ITERATE_PUT(fit);
+	  fib_delete(&tab->fib, n);
+	  goto again;
+	}
+    }
+  FIB_ITERATE_END;
+
+  return 1;
+}
+
+/* Prune networks with routes of @c, returns 0 when interrupted */
+static int
+rt_prune_channel(rtable *tab, struct channel *c, int *limit)
+{
+  node *m = &c->prune_node;
+
+  while (NODE_VALID(m->next))
+  {
+    if (rt_prune_yield(limit))
+      return 0;
+
+    rte *e = SKIP_BACK(rte, sender_n, m->next);
+    net *n = e->net;
+
+    /* Step over the route before it is possibly removed */
+    rem_node(m);
+    insert_node(m, &e->sender_n);
+
+    *limit -= rt_prune_net(n);
+
+    if (!n->routes && !tab->snapshots)	/* Orphaned FIB entry */
+    {
+      fib_delete(&tab->fib, n);
+
+      /* Already collected, not to be counted for GC */
+      tab->gc_counter--;
+    }
+  }
+
+  rem_node(m);
+  c->prune_active = 0;
+  return 1;
+}
+
 /**
  * rt_prune_table - prune a routing table
  *
- * The prune loop scans routing tables and removes routes belonging to flushing
- * protocols, discarded routes and also stale network entries. It is called from
- * rt_event(). The event is rescheduled if the current iteration do not finish
- * the table. The pruning is directed by the prune state (@prune_state),
- * specifying whether the prune cycle is scheduled or running, and there
- * is also a persistent pruning iterator (@prune_fit).
+ * The prune loop removes routes belonging to flushing channels, discarded
+ * routes and also stale network entries. It is called from rt_event(). The
+ * event is rescheduled if the current iteration do not finish the table. The
+ * pruning is directed by the prune state (@prune_state), specifying whether the
+ * prune cycle is scheduled or running.
+ *
+ * Channels to flush and channels with ended refresh cycles (see
+ * rt_schedule_prune_channel()) are marked before the iteration and flushed
+ * channels are notified after the iteration. As each channel keeps a list of
+ * its routes (see rte_sender_list()), the prune loop usually walks just these
+ * lists, so when a small peer goes down, its routes are removed without
+ * walking the rest of the table. Only when a full prune is requested by
+ * rt_schedule_prune() (by the garbage collector of orphaned networks or when
+ * the last table snapshot is released), the whole table is walked, using a
+ * persistent pruning iterator (@prune_fit). Channel lists are resumed from a
+ * marker node (@prune_node) instead.
  *
- * The prune loop is used also for channel flushing. For this purpose, the
- * channels to flush are marked before the iteration and notified after the
- * iteration.
+ * Networks are pruned whole by rt_prune_net(), under one update lock per run
+ * of the event. The run is split into chunks of %RT_PRUNE_LIMIT changed routes
+ * and ends when the time budget of work events is spent (see ev_work_yield()).
  */
 static void
 rt_prune_table(rtable *tab)
 {
-  struct fib_iterator *fit = &tab->prune_fit;
-  int limit = 512;
+  int limit = RT_PRUNE_LIMIT;
+  int done = 1;
 
   struct channel *c;
   node *n, *x;
@@ -1857,75 +3027,64 @@ rt_prune_table(rtable *tab)
 
   if (tab->prune_state == 1)
   {
-    /* Mark channels to flush */
+    tab->prune_walk = tab->prune_full;
+    tab->prune_full = 0;
+
+    /* Mark channels to flush and channels to prune */
     WALK_LIST2(c, n, tab->channels, table_node)
+    {
       if (c->channel_state == CS_FLUSHING)
 	c->flush_active = 1;
 
-    FIB_ITERATE_INIT(fit, &tab->fib);
-    tab->prune_state = 2;
-  }
-
-again:
-  FIB_ITERATE_START(&tab->fib, fit, net, n)
-    {
-      rte *e;
-
-    rescan:
-      for (e=n->routes; e; e=e->next)
+      /* The full walk serves all channels */
+      if ((c->flush_active || c->prune_pending) && !tab->prune_walk)
       {
-	if (e->sender->flush_active || (e->flags & REF_DISCARD))
-	  {
-	    if (limit <= 0)
-	      {
-		FIB_ITERATE_PUT(fit);
-		ev_schedule(tab->rt_event);
-		return;
-	      }
+	c->prune_active = 1;
+	add_head(&c->routes, &c->prune_node);
+      }
 
-	    rte_discard(e);
-	    limit--;
+      c->prune_pending = 0;
+    }
 
-	    goto rescan;
-	  }
+    if (tab->prune_walk)
+      FIB_ITERATE_INIT(&tab->prune_fit, &tab->fib);
 
-	if (e->flags & REF_MODIFY)
-	  {
-	    if (limit <= 0)
-	      {
-		FIB_ITERATE_PUT(fit);
-		ev_schedule(tab->rt_event);
-		return;
-	      }
+    tab->prune_state = 2;
+  }
 
-	    rte_modify(e);
-	    limit--;
+  rte_update_lock();
 
-	    goto rescan;
-	  }
-      }
+  if (tab->prune_walk)
+    done = rt_prune_walk(tab, &limit);
+  else
+    WALK_LIST2(c, n, tab->channels, table_node)
+      if (c->prune_active && !(done = rt_prune_channel(tab, c, &limit)))
+	break;
 
-      if (!n->routes)		/* Orphaned FIB entry */
-	{
-	  FIB_ITERATE_PUT(fit);
-	  fib_delete(&tab->fib, n);
-	  goto again;
-	}
-    }
-  FIB_ITERATE_END;
+  rte_update_unlock();
+
+  if (!done)
+  {
+    ev_schedule_work(tab->rt_event);
+    return;
+  }
 
 #ifdef DEBUGGING
   fib_check(&tab->fib);
 #endif
 
-  tab->gc_counter = 0;
-  tab->gc_time = current_time();
+  if (tab->prune_walk)
+  {
+    tab->gc_counter = 0;
+    tab->gc_time = current_time();
+    tab->prune_walk = 0;
+  }
 
   /* state change 2->0, 3->1 */
   tab->prune_state &= 1;
 
   if (tab->prune_state > 0)
-    ev_schedule(tab->rt_event);
+    ev_schedule_work(tab->rt_event);
 
   /* FIXME: This should be handled in a better way */
   rt_prune_sources();
@@ -2074,8 +3233,9 @@ rt_next_hop_update_rte(rtable *tab UNUSED, rte *old)
   rta_apply_hostentry(a, old->attrs->hostentry, &mls);
   a->aflags = 0;
 
-  rte *e = sl_alloc(rte_slab);
-  memcpy(e, old, sizeof(rte));
+  uint size = rte_size(old->attrs);
+  rte *e = sl_alloc(rte_slab(size));
+  memcpy(e, old, size);
   e->attrs = rta_lookup(a);
 
   return e;
@@ -2098,16 +3258,23 @@ rt_next_hop_update_net(rtable *tab, net *n)
 	new = rt_next_hop_update_rte(tab, e);
 	*k = new;
 
+	/* The copy takes over the position of the old route */
+	update_node(&new->sender_n);
+	rt_src_index_replace(e, new);
+
+	rte_unlink_hostentry(tab, e);
+	rte_link_hostentry(tab, new);
+
 	rte_trace_in(D_ROUTES, new->sender->proto, new, "updated");
 	rte_announce_i(tab, RA_ANY, n, new, e, NULL, NULL);
 
 	/* Call a pre-comparison hook */
 	/* Not really an efficient way to compute this */
-	if (e->attrs->src->proto->rte_recalculate)
-	  e->attrs->src->proto->rte_recalculate(tab, n, new, e, NULL);
+	if (e->src_proto->rte_recalculate)
+	  e->src_proto->rte_recalculate(tab, n, new, e, NULL);
 
 	if (e != old_best)
-	  rte_free_quick(e);
+	  rte_free_table(tab, e);
 	else /* Freeing of the old best rte is postponed */
 	  free_old_best = 1;
 
@@ -2143,46 +3310,68 @@ rt_next_hop_update_net(rtable *tab, net *n)
   rte_announce_i(tab, RA_UNDEF, n, NULL, NULL, n->routes, old_best);
 
   if (free_old_best)
-    rte_free_quick(old_best);
+    rte_free_table(tab, old_best);
 
   return count;
 }
 
+/*
+ * Next hop update
+ *
+ * Each hostentry keeps a list of routes using it in its dependent table. When
+ * the hostentry changes, it is queued in nhu_list of the table and a mark is
+ * appended to its route list. Routes before the mark may be outdated; their
+ * networks are updated one by one and the routes of the hostentry in an
+ * updated network are moved behind the mark. Routes added later already use
+ * the current hostentry and are added behind the mark too. The hostentry is
+ * done when the mark reaches the head of the list, so the work is proportional
+ * to the number of routes depending on changed hostentries, not to the size of
+ * the table. As the progress is kept just in the lists, the update may yield
+ * at any point and route changes in the meantime need no special care.
+ */
+
+static void
+rt_next_hop_update_he(rtable *tab, struct hostentry *he, net *n)
+{
+  rt_next_hop_update_net(tab, n);
+
+  /* Move the routes of the updated network behind the mark */
+  for (rte *e = n->routes; e; e = e->next)
+    if (rte_hostentry(tab, e) == he)
+    {
+      rem_node(&e->he_node);
+      add_tail(&he->routes, &e->he_node);
+    }
+}
+
 static void
 rt_next_hop_update(rtable *tab)
 {
-  struct fib_iterator *fit = &tab->nhu_fit;
   int max_feed = 32;
 
-  if (tab->nhu_state == NHU_CLEAN)
-    return;
+  while (!EMPTY_LIST(tab->nhu_list))
+  {
+    struct hostentry *he = SKIP_BACK(struct hostentry, nhu_node, HEAD(tab->nhu_list));
 
-  if (tab->nhu_state == NHU_SCHEDULED)
+    while (HEAD(he->routes) != &he->nhu_mark)
     {
-      FIB_ITERATE_INIT(fit, &tab->fib);
-      tab->nhu_state = NHU_RUNNING;
-    }
+      if ((max_feed <= 0) && !ev_work_yield())
+	max_feed = 32;
 
-  FIB_ITERATE_START(&tab->fib, fit, net, n)
-    {
       if (max_feed <= 0)
-	{
-	  FIB_ITERATE_PUT(fit);
-	  ev_schedule(tab->rt_event);
-	  return;
-	}
-      max_feed -= rt_next_hop_update_net(tab, n);
-    }
-  FIB_ITERATE_END;
+      {
+	ev_schedule_work(tab->rt_event);
+	return;
+      }
 
-  /* State change:
-   *   NHU_DIRTY   -> NHU_SCHEDULED
-   *   NHU_RUNNING -> NHU_CLEAN
-   */
-  tab->nhu_state &= 1;
+      rte *e = SKIP_BACK(rte, he_node, HEAD(he->routes));
+      rt_next_hop_update_he(tab, he, e->net);
+      max_feed--;
+    }
 
-  if (tab->nhu_state != NHU_CLEAN)
-    ev_schedule(tab->rt_event);
+    rem_node(&he->nhu_mark);
+    rem_node(&he->nhu_node);
+  }
 }
 
 
@@ -2226,24 +3415,119 @@ rt_lock_table(rtable *r)
   r->use_count++;
 }
 
-/**
- * rt_unlock_table - unlock a routing table
- * @r: routing table to be unlocked
- *
- * Unlock a routing table formerly locked by rt_lock_table(),
+/* Shared tables are ordered together with their main table */
+static void
+rt_order_shared_table(rtable *t, int ordered)
+{
+  if (!t)
+    return;
+
+  t->config->ordered = ordered;
+  if (ordered)
+    fib_lpm_init(&t->fib);
+}
+
+static rtable *
+rt_get_shared_table(rtable *tab, rtable **tp, const char *name)
+{
+  if (!*tp)
+  {
+    struct rtable_config *cf = mb_allocz(rt_table_pool, sizeof(struct rtable_config));
+    cf->name = (char *) name;
+    cf->addr_type = tab->addr_type;
+    cf->ordered = tab->config->ordered;
+
+    rtable *t = mb_allocz(rt_table_pool, sizeof(struct rtable));
+    rt_setup(rt_table_pool, t, cf);
+    t->shared_of = tab;
+
+    *tp = t;
+    rt_lock_table(tab);
+  }
+
+  rt_lock_table(*tp);
+  return *tp;
+}
+
+/**
+ * rt_get_in_table - get a shared import table
+ * @tab: main routing table
+ *
+ * All channels with an import table connected to @tab share one import table,
+ * so the prefix nodes of received routes are stored just once. Each channel
+ * keeps only its own &rte records there, marked by their sender. The returned
+ * table is locked and it is freed when unlocked by its last user.
+ */
+rtable *
+rt_get_in_table(rtable *tab)
+{
+  return rt_get_shared_table(tab, &tab->in_table, "import");
+}
+
+/**
+ * rt_get_out_table - get a shared export table
+ * @tab: main routing table
+ *
+ * Like rt_get_in_table(), but for export tables. Routes exported to different
+ * channels from the same network share the prefix node and usually also the
+ * cached &rta, so an export table costs just one &rte per exported route.
+ */
+rtable *
+rt_get_out_table(rtable *tab)
+{
+  return rt_get_shared_table(tab, &tab->out_table, "export");
+}
+
+static void
+rt_free_shared_table(rtable *r)
+{
+  rtable *tab = r->shared_of;
+
+  DBG("Deleting %s table of %s\n", r->name, tab->name);
+  ASSERT(!r->rt_count && !r->snapshots);
+
+  if (tab->in_table == r)
+    tab->in_table = NULL;
+
+  if (tab->out_table == r)
+    tab->out_table = NULL;
+
+  fib_free(&r->fib);
+  hmap_free(&r->id_map);
+  rfree(r->rt_event);
+  mb_free(r->config);
+  mb_free(r);
+
+  rt_unlock_table(tab);
+}
+
+/**
+ * rt_unlock_table - unlock a routing table
+ * @r: routing table to be unlocked
+ *
+ * Unlock a routing table formerly locked by rt_lock_table(),
  * that is decrease its use count and delete it if it's scheduled
  * for deletion by configuration changes.
  */
 void
 rt_unlock_table(rtable *r)
 {
-  if (!--r->use_count && r->deleted)
+  if (!--r->use_count && r->shared_of)
+    rt_free_shared_table(r);
+  else if (!r->use_count && r->deleted)
     {
       struct config *conf = r->deleted;
       DBG("Deleting routing table %s\n", r->name);
       r->config->table = NULL;
+
+      node *n, *x;
+      WALK_LIST_DELSAFE(n, x, r->nhu_list)
+	rem_node(n);
+
       if (r->hostcache)
 	rt_free_hostcache(r);
+      if (r->roa_index)
+	roa_index_free(r->roa_index);
       rem_node(&r->n);
       fib_free(&r->fib);
       hmap_free(&r->id_map);
@@ -2253,6 +3537,122 @@ rt_unlock_table(rtable *r)
     }
 }
 
+static void
+rt_snapshot_free(resource *r)
+{
+  struct rt_snapshot *s = (void *) r;
+  rtable *tab = s->table;
+
+  xfree(s->data);
+
+  if (!--tab->snapshots)
+  {
+    rte *e, *next;
+    for (e = tab->snapshot_limbo; e; e = next)
+    {
+      next = e->next;
+      rte_free_quick(e);
+    }
+    tab->snapshot_limbo = NULL;
+
+    /* Orphaned networks were kept for us */
+    rt_schedule_prune(tab);
+  }
+
+  rt_unlock_table(tab);
+}
+
+static void
+rt_snapshot_dump(resource *r)
+{
+  struct rt_snapshot *s = (void *) r;
+  debug("(table %s, %u nets, %u routes)\n", s->table->name, s->nets, s->routes);
+}
+
+static size_t
+rt_snapshot_memsize(resource *r)
+{
+  struct rt_snapshot *s = (void *) r;
+  return sizeof(struct rt_snapshot) + (s->end - s->data) * sizeof(rte *) + 2 * ALLOC_OVERHEAD;
+}
+
+static struct resclass rt_snapshot_class = {
+  "Table snapshot",
+  sizeof(struct rt_snapshot),
+  rt_snapshot_free,
+  rt_snapshot_dump,
+  NULL,
+  rt_snapshot_memsize
+};
+
+/**
+ * rt_snapshot_new - take a read snapshot of a routing table
+ * @p: pool to allocate the snapshot from
+ * @tab: routing table
+ *
+ * The snapshot lists all routes of @tab in a flat array, see &rt_snapshot.
+ * Until it is freed by rfree(), routes removed from @tab are kept in a limbo
+ * list and empty networks are not pruned, so readers may walk the snapshot
+ * at their own pace, even from another thread, while the table is updated.
+ * Taking the snapshot is a single pass over the table without any per-node
+ * iterator bookkeeping. Networks of ordered tables are listed in prefix order.
+ * The snapshot must be created and freed from the main loop.
+ */
+struct rt_snapshot *
+rt_snapshot_new(pool *p, rtable *tab)
+{
+  struct rt_snapshot *s = ralloc(p, &rt_snapshot_class);
+  rte *e, **pos;
+
+  s->table = tab;
+  rt_lock_table(tab);
+  tab->snapshots++;
+
+  FIB_WALK(&tab->fib, net, n)
+  {
+    if (!n->routes)
+      continue;
+
+    s->nets++;
+    for (e = n->routes; e; e = e->next)
+      s->routes++;
+  }
+  FIB_WALK_END;
+
+  pos = s->data = xmalloc((s->nets + s->routes + 1) * sizeof(rte *));
+
+  if (rt_ordered(tab))
+  {
+    FIB_WALK_ORDERED(&tab->fib, net, n)
+    {
+      if (!n->routes)
+	continue;
+
+      for (e = n->routes; e; e = e->next)
+	*pos++ = e;
+      *pos++ = NULL;
+    }
+    FIB_WALK_END;
+  }
+  else
+  {
+    FIB_WALK(&tab->fib, net, n)
+    {
+      if (!n->routes)
+	continue;
+
+      for (e = n->routes; e; e = e->next)
+	*pos++ = e;
+      *pos++ = NULL;
+    }
+    FIB_WALK_END;
+  }
+
+  s->end = pos;
+  rmem_update(&s->r, ALLOC_OVERHEAD + (s->end - s->data) * sizeof(rte *));
+  return s;
+}
+
 static struct rtable_config *
 rt_find_table_config(struct config *cf, char *name)
 {
@@ -2294,6 +3694,10 @@ rt_commit(struct config *new, struct config *old)
 		  ot->config = r;
 		  if (o->sorted != r->sorted)
 		    log(L_WARN "Reconfiguration of rtable sorted flag not implemented");
+		  if (r->ordered)
+		    fib_lpm_init(&ot->fib);
+		  rt_order_shared_table(ot->in_table, r->ordered);
+		  rt_order_shared_table(ot->out_table, r->ordered);
 		}
 	      else
 		{
@@ -2332,6 +3736,267 @@ do_feed_channel(struct channel *c, net *n, rte *e)
   rte_update_unlock();
 }
 
+/* Feed states of a channel in a shared table walk, see rt_feed_channel() */
+#define RT_FEED_WHOLE	0		/* Walk covers the whole table */
+#define RT_FEED_JOINED	1		/* Joined the walk midway, nets up to feed_stop to be wrapped around */
+#define RT_FEED_WRAPPED	2		/* Walking from the beginning up to feed_stop */
+
+static int
+rt_feed_net(struct channel *c, net *n)
+{
+  rte *e = n->routes;
+  int fed = 0;
+
+  /* Partial refeed skips networks out of the range */
+  if (c->feed_range && !trie_match_net(c->feed_range, n->n.addr))
+    return 0;
+
+  if ((c->ra_mode == RA_OPTIMAL) ||
+      (c->ra_mode == RA_ACCEPTED) ||
+      (c->ra_mode == RA_MERGED))
+    if (rte_is_valid(e))
+      {
+	/* In the meantime, the protocol may fell down */
+	if (c->export_state != ES_FEEDING)
+	  return -1;
+
+	do_feed_channel(c, n, e);
+	fed++;
+      }
+
+  if ((c->ra_mode == RA_ANY) && c->ra_limit)
+    {
+      rte *best[RA_LIMIT_MAX];
+      uint cnt = rt_select_best(n, best, c->ra_limit);
+
+      for (uint i = 0; i < cnt; i++)
+	{
+	  /* In the meantime, the protocol may fell down */
+	  if (c->export_state != ES_FEEDING)
+	    return -1;
+
+	  do_feed_channel(c, n, best[i]);
+	  fed++;
+	}
+    }
+  else if (c->ra_mode == RA_ANY)
+    for(; e; e = e->next)
+      {
+	/* In the meantime, the protocol may fell down */
+	if (c->export_state != ES_FEEDING)
+	  return -1;
+
+	if (!rte_is_valid(e))
+	  continue;
+
+	do_feed_channel(c, n, e);
+	fed++;
+      }
+
+  return fed;
+}
+
+/* Primary key of the node the iterator is parked at */
+static u32
+rt_feed_position(struct fib_iterator *it)
+{
+  struct fib_iterator *j = it;
+
+  if (!it->prev)
+    return ~0U;
+
+  while (j->efef == 0xff)
+    j = j->prev;
+
+  return fib_node_key((struct fib_node *) j);
+}
+
+static void
+rt_feed_join(struct channel *c)
+{
+  rtable *t = c->table;
+
+  /* Left over from aborted feed during a shared walk */
+  if (NODE_VALID(&c->feed_node))
+    rem_node(&c->feed_node);
+
+  if (!t->feed_group_active)
+  {
+    FIB_ITERATE_INIT(&t->feed_fit, &t->fib);
+    t->feed_group_active = 1;
+    c->feed_wrap = RT_FEED_WHOLE;
+  }
+  else
+  {
+    c->feed_wrap = RT_FEED_JOINED;
+    c->feed_stop = rt_feed_position(&t->feed_fit);
+  }
+
+  add_tail(&t->feed_group, &c->feed_node);
+}
+
+static void
+rt_feed_leave(struct channel *c)
+{
+  rtable *t = c->table;
+
+  rem_node(&c->feed_node);
+
+  if (EMPTY_LIST(t->feed_group) && t->feed_group_active)
+  {
+    fit_get(&t->fib, &t->feed_fit);
+    t->feed_group_active = 0;
+  }
+}
+
+/*
+ * One pass of the shared table walk. Each net is fed to all channels in the
+ * group. A channel which joined midway skips nets with its starting key here
+ * and gets them after the wrap around, so no net is fed twice or missed.
+ * Paused channels continue alone from the current net.
+ */
+static int
+rt_feed_shared(struct channel *c)
+{
+  rtable *t = c->table;
+  struct fib_iterator *fit = &t->feed_fit;
+  struct channel *m;
+  node *nn, *nx;
+  int max_feed = 256;
+
+  struct export_memo memo, *memo_outer = export_memo;
+  export_memo = &memo;
+  t->feed_walking = 1;
+
+  FIB_ITERATE_START(&t->fib, fit, net, n)
+    {
+      if ((max_feed <= 0) && !ev_work_yield())
+	max_feed = 256;
+
+      if ((max_feed <= 0) || !NODE_VALID(&c->feed_node))
+	{
+	  /* Channels aborted during the walk must not stay in the group */
+	  WALK_LIST2_DELSAFE(m, nn, nx, t->feed_group, feed_node)
+	    if (!m->feed_active || (m->export_state != ES_FEEDING))
+	      rem_node(&m->feed_node);
+
+	  if (EMPTY_LIST(t->feed_group))
+	    t->feed_group_active = 0;
+	  else
+	    FIB_ITERATE_PUT(fit);
+
+	  t->feed_walking = 0;
+	  export_memo = memo_outer;
+	  return 0;
+	}
+
+      memo = (struct export_memo) {};
+
+      WALK_LIST2_DELSAFE(m, nn, nx, t->feed_group, feed_node)
+	{
+	  /* Aborted during the walk */
+	  if (!m->feed_active || (m->export_state != ES_FEEDING))
+	    {
+	      rem_node(&m->feed_node);
+	      continue;
+	    }
+
+	  if (m->feed_paused)
+	    {
+	      rem_node(&m->feed_node);
+	      FIB_ITERATE_PUT(&m->feed_fit);
+	      continue;
+	    }
+
+	  if ((m->feed_wrap == RT_FEED_JOINED) && (fib_node_key(&n->n) == m->feed_stop))
+	    continue;
+
+	  int fed = rt_feed_net(m, n);
+	  if (fed > 0)
+	    max_feed -= fed;
+	}
+    }
+  FIB_ITERATE_END;
+
+  /* End of table, joined channels continue alone from the beginning */
+  t->feed_group_active = 0;
+  t->feed_walking = 0;
+  export_memo = memo_outer;
+
+  WALK_LIST2_DELSAFE(m, nn, nx, t->feed_group, feed_node)
+    {
+      rem_node(&m->feed_node);
+
+      if (!m->feed_active || (m->export_state != ES_FEEDING))
+	continue;
+
+      if (m->feed_wrap == RT_FEED_JOINED)
+	{
+	  m->feed_wrap = RT_FEED_WRAPPED;
+	  FIB_ITERATE_INIT(&m->feed_fit, &t->fib);
+	}
+      else
+	m->feed_done = 1;
+    }
+
+  if (!c->feed_done)
+    return 0;
+
+  c->feed_done = 0;
+  c->feed_active = 0;
+  return 1;
+}
+
+/*
+ * Feed of an ordered table walks it in prefix order. Every channel walks alone
+ * and resumes from the last fed net, so no iterator has to be kept.
+ */
+static void
+rt_feed_ordered_init(struct channel *c)
+{
+  /* Left over from aborted feed during a shared walk */
+  if (NODE_VALID(&c->feed_node))
+    rem_node(&c->feed_node);
+
+  c->feed_last = (net_addr) {};
+}
+
+static int
+rt_feed_ordered(struct channel *c)
+{
+  struct fib *f = &c->table->fib;
+  int max_feed = 256;
+  net *n;
+
+  struct export_memo memo, *memo_outer = export_memo;
+  export_memo = &memo;
+
+  while (n = fib_next_ordered(f, c->feed_last.type ? &c->feed_last : NULL))
+    {
+      if ((max_feed <= 0) && !ev_work_yield())
+	max_feed = 256;
+
+      if ((max_feed <= 0) || c->feed_paused)
+	{
+	  export_memo = memo_outer;
+	  return 0;
+	}
+
+      net_copy(&c->feed_last, n->n.addr);
+      memo = (struct export_memo) {};
+
+      int fed = rt_feed_net(c, n);
+      if (fed < 0)
+	break;
+
+      max_feed -= fed;
+    }
+
+  export_memo = memo_outer;
+  c->feed_active = 0;
+  return 1;
+}
+
 /**
  * rt_feed_channel - advertise all routes to a channel
  * @c: channel to be fed
@@ -2339,7 +4004,17 @@ do_feed_channel(struct channel *c, net *n, rte *e)
  * This function performs one pass of advertisement of routes to a channel that
  * is in the ES_FEEDING state. It is called by the protocol code as long as it
  * has something to do. (We avoid transferring all the routes in single pass in
- * order not to monopolize CPU time.)
+ * order not to monopolize CPU time.) When run from a work event, the pass
+ * continues in chunks until the time budget of work events is spent, see
+ * ev_work_yield(). The pass also ends when the protocol paused the feed by
+ * channel_pause_feed().
+ *
+ * Channels feeding the whole table at the same time share one table walk, so
+ * each net is looked up once for all of them. A channel starting its feed
+ * while the walk is in progress joins it at the current position, and after
+ * the walk ends, it continues alone from the beginning of the table up to the
+ * position where it joined. Ordered tables are fed by each channel alone
+ * in prefix order, see rt_feed_ordered().
  */
 int
 rt_feed_channel(struct channel *c)
@@ -2349,51 +4024,77 @@ rt_feed_channel(struct channel *c)
 
   ASSERT(c->export_state == ES_FEEDING);
 
+  /* Finished by shared walk run by another channel */
+  if (c->feed_done)
+    {
+      c->feed_done = 0;
+      c->feed_active = 0;
+      return 1;
+    }
+
   if (!c->feed_active)
     {
-      FIB_ITERATE_INIT(fit, &c->table->fib);
       c->feed_active = 1;
+      c->feed_wrap = RT_FEED_WHOLE;
+      c->feed_ordered = rt_ordered(c->table);
+
+      if (c->feed_ordered)
+	rt_feed_ordered_init(c);
+      else if (!c->feed_range)
+	rt_feed_join(c);
+      else
+	FIB_ITERATE_INIT(fit, &c->table->fib);
     }
 
+  if (c->feed_ordered)
+    return rt_feed_ordered(c);
+
+  if (NODE_VALID(&c->feed_node))
+    return rt_feed_shared(c);
+
+  struct export_memo memo, *memo_outer = export_memo;
+  export_memo = &memo;
+
   FIB_ITERATE_START(&c->table->fib, fit, net, n)
     {
-      rte *e = n->routes;
-      if (max_feed <= 0)
+      if ((max_feed <= 0) && !ev_work_yield())
+	max_feed = 256;
+
+      if ((max_feed <= 0) || c->feed_paused)
 	{
 	  FIB_ITERATE_PUT(fit);
+	  export_memo = memo_outer;
 	  return 0;
 	}
 
-      if ((c->ra_mode == RA_OPTIMAL) ||
-	  (c->ra_mode == RA_ACCEPTED) ||
-	  (c->ra_mode == RA_MERGED))
-	if (rte_is_valid(e))
-	  {
-	    /* In the meantime, the protocol may fell down */
-	    if (c->export_state != ES_FEEDING)
-	      goto done;
-
-	    do_feed_channel(c, n, e);
-	    max_feed--;
-	  }
-
-      if (c->ra_mode == RA_ANY)
-	for(e = n->routes; e; e = e->next)
-	  {
-	    /* In the meantime, the protocol may fell down */
-	    if (c->export_state != ES_FEEDING)
-	      goto done;
-
-	    if (!rte_is_valid(e))
-	      continue;
+      /* Wrapped feed ends where the shared walk was joined */
+      if ((c->feed_wrap == RT_FEED_WRAPPED) && (fib_node_key(&n->n) > c->feed_stop))
+	break;
 
-	    do_feed_channel(c, n, e);
-	    max_feed--;
-	  }
+      memo = (struct export_memo) {};
+
+      if ((c->feed_wrap != RT_FEED_JOINED) || (fib_node_key(&n->n) != c->feed_stop))
+	{
+	  int fed = rt_feed_net(c, n);
+	  if (fed < 0)
+	    goto done;
+
+	  max_feed -= fed;
+	}
     }
   FIB_ITERATE_END;
 
+  /* Left the shared walk midway, wrap around */
+  if (c->feed_wrap == RT_FEED_JOINED)
+    {
+      c->feed_wrap = RT_FEED_WRAPPED;
+      FIB_ITERATE_INIT(fit, &c->table->fib);
+      export_memo = memo_outer;
+      return 0;
+    }
+
 done:
+  export_memo = memo_outer;
   c->feed_active = 0;
   return 1;
 }
@@ -2408,10 +4109,24 @@ done:
 void
 rt_feed_channel_abort(struct channel *c)
 {
+  if (c->feed_done)
+    {
+      c->feed_done = 0;
+      c->feed_active = 0;
+    }
+
   if (c->feed_active)
     {
-      /* Unlink the iterator */
-      fit_get(&c->table->fib, &c->feed_fit);
+      /* Shared walk in progress removes the channel itself */
+      if (NODE_VALID(&c->feed_node))
+	{
+	  if (!c->table->feed_walking)
+	    rt_feed_leave(c);
+	}
+      else if (!c->feed_ordered)
+	/* Unlink the iterator */
+	fit_get(&c->table->fib, &c->feed_fit);
+
       c->feed_active = 0;
     }
 }
@@ -2421,6 +4136,24 @@ rt_feed_channel_abort(struct channel *c)
  *	Import table
  */
 
+/* Next route of channel @c in the shared import table, starting with @e */
+static inline rte *
+rte_next_sender(rte *e, struct channel *c)
+{
+  while (e && (e->sender != c))
+    e = e->next;
+
+  return e;
+}
+
+/* Remove a network left empty in a shared import/export table */
+static inline void
+rt_shared_table_cleanup_net(rtable *tab, net *n)
+{
+  if (!n->routes && !tab->snapshots)
+    fib_delete(&tab->fib, n);
+}
+
 int
 rte_update_in(struct channel *c, const net_addr *n, rte *new, struct rte_src *src)
 {
@@ -2448,14 +4181,14 @@ rte_update_in(struct channel *c, const net_addr *n, rte *new, struct rte_src *sr
 
   /* Find the old rte */
   for (pos = &net->routes; old = *pos; pos = &old->next)
-    if (old->attrs->src == src)
+    if ((old->sender == c) && (old->attrs->src == src))
     {
       if (new && rte_same(old, new))
       {
 	/* Refresh the old rte, continue with update to main rtable */
-	if (old->flags & (REF_STALE | REF_DISCARD | REF_MODIFY))
+	if (rte_is_stale(&c->in_refresh, old))
 	{
-	  old->flags &= ~(REF_STALE | REF_DISCARD | REF_MODIFY);
+	  old->stale_cycle = c->in_refresh.count;
 	  return 1;
 	}
 
@@ -2464,12 +4197,15 @@ rte_update_in(struct channel *c, const net_addr *n, rte *new, struct rte_src *sr
 
       /* Move iterator if needed */
       if (old == c->reload_next_rte)
-	c->reload_next_rte = old->next;
+	c->reload_next_rte = rte_next_sender(old->next, c);
 
       /* Remove the old rte */
       *pos = old->next;
-      rte_free_quick(old);
-      tab->rt_count--;
+      rt_stats_remove(tab, net, old);
+      rte_unlink_sender(old);
+      rt_src_index_unlink(old);
+      rte_free_table(tab, old);
+      c->in_table_count--;
 
       break;
     }
@@ -2479,14 +4215,15 @@ rte_update_in(struct channel *c, const net_addr *n, rte *new, struct rte_src *sr
     if (!old)
       goto drop_withdraw;
 
+    rt_shared_table_cleanup_net(tab, net);
     return 1;
   }
 
   struct channel_limit *l = &c->rx_limit;
   if (l->action && !old)
   {
-    if (tab->rt_count >= l->limit)
-      channel_notify_limit(c, l, PLD_RX, tab->rt_count);
+    if (c->in_table_count >= l->limit)
+      channel_notify_limit(c, l, PLD_RX, c->in_table_count);
 
     if (l->state == PLS_BLOCKED)
     {
@@ -2500,16 +4237,21 @@ rte_update_in(struct channel *c, const net_addr *n, rte *new, struct rte_src *sr
   e->flags |= REF_COW;
   e->net = net;
   e->sender = c;
+  e->stale_cycle = c->in_refresh.count;
   e->lastmod = current_time();
   e->next = *pos;
   *pos = e;
-  tab->rt_count++;
+  rte_link_sender(tab, e);
+  rt_src_index_link(net, e);
+  rt_stats_add(tab, net, e);
+  c->in_table_count++;
   return 1;
 
 drop_update:
   c->stats.imp_updates_received++;
   c->stats.imp_updates_ignored++;
   rte_free(new);
+  rt_shared_table_cleanup_net(tab, net);
   return 0;
 
 drop_withdraw:
@@ -2518,39 +4260,182 @@ drop_withdraw:
   return 0;
 }
 
+#define RELOAD_BATCH 64
+
+/*
+ * rte_reload_batch - re-import routes from the import table
+ *
+ * This is equivalent to calling rte_update2() with a copy of each route in
+ * @rtes, but the import filter is run for the whole batch by f_run_batch(), so
+ * routes sharing their attributes (e.g. received in the same BGP UPDATE) are
+ * usually filtered just once.
+ */
+static void
+rte_reload_batch(struct channel *c, rte **rtes, uint count)
+{
+  const struct filter *filter = c->in_filter;
+  int run = filter && (filter != FILTER_REJECT);
+  rte *new[RELOAD_BATCH];
+  rta *old_attrs[RELOAD_BATCH];
+  enum filter_return fr[RELOAD_BATCH];
+
+  rte_update_lock();
+
+  for (uint i = 0; i < count; i++)
+  {
+    new[i] = rte_do_cow(rtes[i]);
+    old_attrs[i] = NULL;
+
+    if (!rte_import_validate(c, new[i]))
+    {
+      rte_free(new[i]);
+      new[i] = NULL;
+    }
+    else if (run && rte_filter_tmp_attrs(filter, new[i]))
+      rte_make_tmp_attrs(&new[i], rte_update_pool, &old_attrs[i]);
+  }
+
+  if (run)
+  {
+    struct rt_phase_mark pm = rt_phase_begin();
+    struct cpu_acct_mark cm = cpu_acct_begin();
+    f_run_batch(filter, new, fr, count, rte_update_pool, 0);
+    cpu_acct_end(&c->cpu, CPU_ACCT_FILTER, cm);
+    rt_phase_end(RT_PHASE_FILTER, pm);
+  }
+
+  for (uint i = 0; i < count; i++)
+  {
+    if (new[i])
+      new[i] = run ?
+	rte_import_filtered(c, new[i], fr[i], old_attrs[i]) :
+	rte_import_filter(c, new[i]);
+
+    /* A dropped route withdraws the previous one, if any */
+    rte_import_commit(c, rtes[i]->net->n.addr, new[i], rtes[i]->attrs->src);
+  }
+
+  rte_update_unlock();
+}
+
+/*
+ * Partial reload from an ordered import table visits just networks around the
+ * prefixes covering the reload range (see trie_cover()) instead of the whole
+ * table. For each covering prefix, its supernets are looked up first, then its
+ * subnets are walked in the table order. The walk is resumed by the last
+ * visited network, so it needs no iterator to be relinked.
+ */
+struct rt_reload_walk {
+  net_addr *px;				/* Covering prefixes of reload_range */
+  uint count;				/* Number of covering prefixes */
+  uint pos;				/* Current covering prefix */
+  uint alen;				/* Length of the next supernet to check */
+  u8 inside;				/* Walking subnets, last is valid */
+  net_addr last;			/* Last visited subnet */
+};
+
+static void
+rt_reload_walk_init(struct channel *c)
+{
+  struct f_trie *range = c->reload_range;
+  struct rt_reload_walk *w = lp_allocz(range->lp, sizeof(struct rt_reload_walk));
+
+  w->px = trie_cover(range, &w->count);
+  c->reload_walk = w;
+}
+
+static net *
+rt_reload_walk_next(struct channel *c)
+{
+  struct rt_reload_walk *w = c->reload_walk;
+  const struct f_trie *range = c->reload_range;
+  rtable *tab = c->in_table;
+  net *n;
+
+  for (; w->pos < w->count; w->pos++, w->alen = 0, w->inside = 0)
+  {
+    const net_addr *px = &w->px[w->pos];
+    const net_addr *prev = w->pos ? &w->px[w->pos - 1] : NULL;
+
+    /* Supernets shared with the previous prefix were already visited */
+    while (!w->inside && (w->alen < net_pxlen(px)))
+    {
+      net_addr a;
+      net_copy(&a, px);
+      a.pxlen = w->alen++;
+      net_normalize(&a);
+
+      if ((!prev || !net_in_netX(prev, &a)) && trie_match_net(range, &a) && (n = net_find(tab, &a)))
+	return n;
+    }
+
+    n = w->inside ? fib_next_ordered(&tab->fib, &w->last) :
+      (net_find(tab, px) ?: fib_next_ordered(&tab->fib, px));
+
+    for (; n && net_in_netX(n->n.addr, px); n = fib_next_ordered(&tab->fib, n->n.addr))
+      if (trie_match_net(range, n->n.addr))
+      {
+	net_copy(&w->last, n->n.addr);
+	w->inside = 1;
+	return n;
+      }
+  }
+
+  return NULL;
+}
+
 int
 rt_reload_channel(struct channel *c)
 {
   struct rtable *tab = c->in_table;
   struct fib_iterator *fit = &c->reload_fit;
-  int max_feed = 64;
+  int max_feed = RELOAD_BATCH;
 
   ASSERT(c->channel_state == CS_UP);
 
   if (!c->reload_active)
   {
-    FIB_ITERATE_INIT(fit, &tab->fib);
+    if (c->reload_range && rt_ordered(tab))
+      rt_reload_walk_init(c);
+    else
+      FIB_ITERATE_INIT(fit, &tab->fib);
+
     c->reload_active = 1;
   }
 
+  rte *batch[RELOAD_BATCH];
+  uint count = 0;
+
   do {
-    for (rte *e = c->reload_next_rte; e; e = e->next)
+    for (rte *e = c->reload_next_rte; e; e = rte_next_sender(e->next, c))
     {
       if (max_feed-- <= 0)
       {
 	c->reload_next_rte = e;
+	rte_reload_batch(c, batch, count);
 	debug("%s channel reload burst split (max_feed=%d)", c->proto->name, max_feed);
 	return 0;
       }
 
-      rte_update2(c, e->net->n.addr, rte_do_cow(e), e->attrs->src);
+      batch[count++] = e;
     }
 
     c->reload_next_rte = NULL;
 
+    if (c->reload_walk)
+    {
+      net *n;
+      while ((n = rt_reload_walk_next(c)) && !(n->routes && (c->reload_next_rte = rte_next_sender(n->routes, c))))
+	;
+
+      continue;
+    }
+
     FIB_ITERATE_START(&tab->fib, fit, net, n)
     {
-      if (c->reload_next_rte = n->routes)
+      /* Partial reload skips networks out of the range */
+      if (n->routes && (!c->reload_range || trie_match_net(c->reload_range, n->n.addr)) &&
+	  (c->reload_next_rte = rte_next_sender(n->routes, c)))
       {
 	FIB_ITERATE_PUT_NEXT(fit, &tab->fib);
 	break;
@@ -2560,6 +4445,8 @@ rt_reload_channel(struct channel *c)
   }
   while (c->reload_next_rte);
 
+  rte_reload_batch(c, batch, count);
+  c->reload_walk = NULL;
   c->reload_active = 0;
   return 1;
 }
@@ -2570,34 +4457,51 @@ rt_reload_channel_abort(struct channel *c)
   if (c->reload_active)
   {
     /* Unlink the iterator */
-    fit_get(&c->in_table->fib, &c->reload_fit);
+    if (!c->reload_walk)
+      fit_get(&c->in_table->fib, &c->reload_fit);
+
+    c->reload_walk = NULL;
     c->reload_next_rte = NULL;
     c->reload_active = 0;
   }
 }
 
 void
-rt_prune_sync(rtable *t, int all)
+rt_prune_sync(rtable *t, struct channel *c, int all)
 {
-  FIB_WALK(&t->fib, net, n)
+  struct channel_refresh *rc = rt_refresh_cycles(t, c);
+  rte *e, **ee;
+  node *n, *x;
+
+  WALK_LIST2_DELSAFE(e, n, x, *rte_sender_list(t, c), sender_n)
   {
-    rte *e, **ee = &n->routes;
-    while (e = *ee)
-    {
-      if (all || (e->flags & (REF_STALE | REF_DISCARD)))
-      {
-	*ee = e->next;
-	rte_free_quick(e);
-	t->rt_count--;
-      }
-      else
-	ee = &e->next;
-    }
+    if (!all && !rte_is_stale(rc, e))
+      continue;
+
+    if (e == c->reload_next_rte)
+      c->reload_next_rte = rte_next_sender(e->next, c);
+
+    if (e == c->resend_next_rte)
+      c->resend_next_rte = rte_next_sender(e->next, c);
+
+    net *net = e->net;
+    for (ee = &net->routes; *ee != e; ee = &(*ee)->next)
+      ;
+
+    *ee = e->next;
+    rt_stats_remove(t, net, e);
+    rte_unlink_sender(e);
+    rt_src_index_unlink(e);
+    rte_free_table(t, e);
+
+    if (t == c->in_table)
+      c->in_table_count--;
+
+    if (!net->routes && !t->snapshots)
+      fib_delete(&t->fib, net);
   }
-  FIB_WALK_END;
 }
 
-
 /*
  *	Export table
  */
@@ -2631,26 +4535,25 @@ rte_update_out(struct channel *c, const net_addr *n, rte *new, rte *old0, int re
 
   /* Find the old rte */
   for (pos = &net->routes; old = *pos; pos = &old->next)
-    if ((c->ra_mode != RA_ANY) || (old->attrs->src == src))
+    if ((old->sender == c) && ((c->ra_mode != RA_ANY) || (old->attrs->src == src)))
     {
       if (new && rte_same(old, new))
       {
-	/* REF_STALE / REF_DISCARD not used in export table */
-	/*
-	if (old->flags & (REF_STALE | REF_DISCARD | REF_MODIFY))
-	{
-	  old->flags &= ~(REF_STALE | REF_DISCARD | REF_MODIFY);
-	  return 1;
-	}
-	*/
+	/* Refresh cycles are not used in export table */
 
 	goto drop_update;
       }
 
+      /* Move iterator if needed */
+      if (old == c->resend_next_rte)
+	c->resend_next_rte = rte_next_sender(old->next, c);
+
       /* Remove the old rte */
       *pos = old->next;
-      rte_free_quick(old);
-      tab->rt_count--;
+      rt_stats_remove(tab, net, old);
+      rte_unlink_sender(old);
+      rt_src_index_unlink(old);
+      rte_free_table(tab, old);
 
       break;
     }
@@ -2660,6 +4563,7 @@ rte_update_out(struct channel *c, const net_addr *n, rte *new, rte *old0, int re
     if (!old)
       goto drop_withdraw;
 
+    rt_shared_table_cleanup_net(tab, net);
     return 1;
   }
 
@@ -2671,7 +4575,9 @@ rte_update_out(struct channel *c, const net_addr *n, rte *new, rte *old0, int re
   e->lastmod = current_time();
   e->next = *pos;
   *pos = e;
-  tab->rt_count++;
+  rte_link_sender(tab, e);
+  rt_src_index_link(net, e);
+  rt_stats_add(tab, net, e);
   return 1;
 
 drop_update:
@@ -2681,6 +4587,75 @@ drop_withdraw:
   return 0;
 }
 
+/*
+ * rt_resend_channel - send routes of the export table again
+ *
+ * The routes exported to the channel are passed to its rt_notify() hook again
+ * right from the export table, without export filters, e.g. to answer a
+ * refresh request of a BGP neighbor. Like rt_reload_channel(), it works in
+ * batches and returns 0 when it should be called again.
+ */
+int
+rt_resend_channel(struct channel *c)
+{
+  struct rtable *tab = c->out_table;
+  struct fib_iterator *fit = &c->resend_fit;
+  struct proto *p = c->proto;
+  int max_feed = 256;
+
+  ASSERT(c->export_state == ES_READY);
+
+  if (!c->resend_active)
+  {
+    FIB_ITERATE_INIT(fit, &tab->fib);
+    c->resend_active = 1;
+  }
+
+  do {
+    for (rte *e = c->resend_next_rte; e; e = rte_next_sender(e->next, c))
+    {
+      if (max_feed-- <= 0)
+      {
+	c->resend_next_rte = e;
+	return 0;
+      }
+
+      rte_update_lock();
+      rte_trace_out(D_ROUTES, p, e, "resent");
+      p->rt_notify(p, c, e->net, e, NULL);
+      rte_update_unlock();
+    }
+
+    c->resend_next_rte = NULL;
+
+    FIB_ITERATE_START(&tab->fib, fit, net, n)
+    {
+      if (n->routes && (c->resend_next_rte = rte_next_sender(n->routes, c)))
+      {
+	FIB_ITERATE_PUT_NEXT(fit, &tab->fib);
+	break;
+      }
+    }
+    FIB_ITERATE_END;
+  }
+  while (c->resend_next_rte);
+
+  c->resend_active = 0;
+  return 1;
+}
+
+void
+rt_resend_channel_abort(struct channel *c)
+{
+  if (c->resend_active)
+  {
+    /* Unlink the iterator */
+    fit_get(&c->out_table->fib, &c->resend_fit);
+    c->resend_next_rte = NULL;
+    c->resend_active = 0;
+  }
+}
+
 
 /*
  *	Hostcache
@@ -2760,6 +4735,7 @@ hc_new_hostentry(struct hostcache *hc, ip_addr a, ip_addr ll, rtable *dep, unsig
     .hash_key = k,
   };
 
+  init_list(&he->routes);
   add_tail(&hc->hostentries, &he->ln);
   hc_insert(hc, he);
 
@@ -2775,6 +4751,12 @@ hc_delete_hostentry(struct hostcache *hc, struct hostentry *he)
 {
   rta_free(he->src);
 
+  if (NODE_VALID(&he->nhu_node))
+  {
+    rem_node(&he->nhu_mark);
+    rem_node(&he->nhu_node);
+  }
+
   rem_node(&he->ln);
   hc_remove(hc, he);
   sl_free(hc->slab, he);
@@ -2797,6 +4779,9 @@ rt_init_hostcache(rtable *tab)
   hc->lp = lp_new(rt_table_pool, LP_GOOD_SIZE(1024));
   hc->trie = f_new_trie(hc->lp, 0);
 
+  /* Next hop resolution does longest prefix matches */
+  fib_lpm_init(&tab->fib);
+
   tab->hostcache = hc;
 }
 
@@ -2811,6 +4796,9 @@ rt_free_hostcache(rtable *tab)
       struct hostentry *he = SKIP_BACK(struct hostentry, ln, n);
       rta_free(he->src);
 
+      if (NODE_VALID(&he->nhu_node))
+	rem_node(&he->nhu_node);
+
       if (he->uc)
 	log(L_ERR "Hostcache is not empty in table %s", tab->name);
     }
@@ -2961,7 +4949,7 @@ rt_update_hostcache(rtable *tab)
 	}
 
       if (rt_update_hostentry(tab, he))
-	rt_schedule_nhu(he->tab);
+	rt_schedule_nhu(he);
     }
 
   tab->hcu_scheduled = 0;
@@ -0,0 +1,147 @@
+/*
+ *	BIRD -- Routing Table Tests
+ *
+ *	Can be freely distributed and used under the terms of the GNU GPL.
+ */
+
+#include "test/birdtest.h"
+#include "test/bt-utils.h"
+
+#include "lib/resource.h"
+#include "nest/route.h"
+#include "nest/protocol.h"
+#include "lib/event.h"
+#include "lib/timer.h"
+#include "filter/filter.h"
+#include "conf/conf.h"
+
+#define BATCH_SIZE 16
+
+static struct config test_config;
+static struct protocol test_protocol = { .name = "Test" };
+static struct proto_config test_proto_cf = { .protocol = &test_protocol, .name = "test" };
+static struct rtable_config test_table_cf = { .name = "master4", .addr_type = NET_IP4 };
+static struct rtable_config test_in_table_cf = { .name = "test.in", .addr_type = NET_IP4 };
+
+static struct proto test_proto;
+static struct channel test_channel;
+static rtable test_table, test_in_table;
+
+static struct channel *
+test_setup(void)
+{
+  resource_init();
+  timer_init();
+  ev_init_list(&global_event_list);
+  ev_init_list(&global_work_list);
+  rt_init();
+  config = &test_config;
+
+  struct proto *p = &test_proto;
+  p->cf = &test_proto_cf;
+  p->proto = &test_protocol;
+  p->name = "test";
+  p->pool = &root_pool;
+  init_list(&p->channels);
+
+  rt_setup(&root_pool, &test_table, &test_table_cf);
+  rt_setup(&root_pool, &test_in_table, &test_in_table_cf);
+
+  struct channel *c = &test_channel;
+  c->proto = p;
+  c->table = &test_table;
+  c->in_table = &test_in_table;
+  c->in_filter = FILTER_ACCEPT;
+  c->out_filter = FILTER_REJECT;
+  c->channel_state = CS_UP;
+  c->preference = 100;
+  init_list(&c->roa_subscriptions);
+  init_list(&c->routes);
+  init_list(&c->in_routes);
+  init_list(&c->out_routes);
+  add_tail(&p->channels, &c->n);
+
+  return c;
+}
+
+static void
+test_announce(struct channel *c, net_addr **nets, uint count)
+{
+  struct rte_src *src = rt_get_source(c->proto, 0);
+  rta a0 = {
+    .src = src,
+    .source = RTS_STATIC,
+    .scope = SCOPE_UNIVERSE,
+    .dest = RTD_BLACKHOLE,
+  };
+
+  rte_update_batch(c, nets, count, rte_get_temp(&a0), src);
+}
+
+/* Each network of a batch must have its own route in both tables */
+static int
+test_check(struct channel *c, net_addr **nets, uint count)
+{
+  for (uint i = 0; i < count; i++)
+  {
+    net *in = net_find(c->in_table, nets[i]);
+    net *n = net_find(c->table, nets[i]);
+
+    bt_assert(in && in->routes && !in->routes->next);
+    bt_assert(in && in->routes && (in->routes->net == in));
+    bt_assert(n && n->routes && !n->routes->next);
+    bt_assert(n && n->routes && (n->routes->net == n));
+  }
+
+  bt_assert(c->in_table_count == count);
+  return 1;
+}
+
+static int
+t_batch_import_table(void)
+{
+  struct channel *c = test_setup();
+
+  net_addr_ip4 addrs[BATCH_SIZE];
+  net_addr *nets[BATCH_SIZE];
+  for (uint i = 0; i < BATCH_SIZE; i++)
+  {
+    addrs[i] = NET_ADDR_IP4(ip4_from_u32(0x0a000000 | (i << 8)), 24);
+    nets[i] = (net_addr *) &addrs[i];
+  }
+
+  test_announce(c, nets, BATCH_SIZE);
+  test_check(c, nets, BATCH_SIZE);
+
+  /* The same routes again, dropped as unchanged by the import table */
+  test_announce(c, nets, BATCH_SIZE);
+  test_check(c, nets, BATCH_SIZE);
+  bt_assert(c->stats.imp_updates_ignored == BATCH_SIZE);
+
+  /* The template must have been freed just once, a double free would put it
+     into the slab twice */
+  rta a0 = { .src = rt_get_source(c->proto, 0), .dest = RTD_BLACKHOLE };
+  rte *e1 = rte_get_temp(&a0);
+  rte *e2 = rte_get_temp(&a0);
+  bt_assert(e1 != e2);
+  rte_free(e1);
+  rte_free(e2);
+
+  /* Withdraw half of them */
+  rte_update_batch(c, nets, BATCH_SIZE / 2, NULL, rt_get_source(c->proto, 0));
+  for (uint i = 0; i < BATCH_SIZE / 2; i++)
+    bt_assert(!net_find(c->in_table, nets[i]) || !net_find(c->in_table, nets[i])->routes);
+
+  bt_assert(c->in_table_count == BATCH_SIZE / 2);
+  return 1;
+}
+
+int
+main(int argc, char *argv[])
+{
+  bt_init(argc, argv);
+
+  bt_test_suite(t_batch_import_table, "Batch import through an import table");
+
+  return bt_exit_value();
+}
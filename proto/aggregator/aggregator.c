@@ -0,0 +1,486 @@
+/*
+ *	BIRD -- Route Aggregator
+ *
+ *	Can be freely distributed and used under the terms of the GNU GPL.
+ */
+
+/**
+ * DOC: Route aggregator
+ *
+ * The aggregator protocol originates configured aggregate prefixes into its
+ * table as long as there is at least one more specific route (a contributor)
+ * exported to it. Aggregate routes are blackhole routes of source
+ * %RTS_AGGREGATED, optionally carrying an AS_SET of all ASNs in contributing
+ * AS paths and the union of their communities.
+ *
+ * The aggregates are never recomputed from the table. Each exported route is
+ * looked up in the &fib of configured aggregates (with the longest prefix
+ * match index, so fib_route_list() returns all covering aggregates at once)
+ * and the counters of those aggregates are updated incrementally. Each
+ * aggregate keeps the number of contributors and, in a hash table, the number
+ * of contributors carrying each ASN and community, so a withdrawal just
+ * decrements them. The cached attributes of every contributor are kept
+ * referenced, so we know what to decrement even if the withdrawal comes
+ * without the old route.
+ *
+ * Aggregates whose announced attributes changed are put to the dirty list and
+ * announced from an event, so a burst of updates (e.g. the initial feed) leads
+ * to just one announcement per aggregate.
+ */
+
+#undef LOCAL_DEBUG
+
+#include <stdlib.h>
+
+#include "nest/bird.h"
+#include "nest/iface.h"
+#include "nest/protocol.h"
+#include "nest/route.h"
+#include "nest/attrs.h"
+#include "nest/cli.h"
+#include "conf/conf.h"
+#include "lib/event.h"
+#include "lib/resource.h"
+#include "lib/string.h"
+#include "lib/unaligned.h"
+#include "proto/bgp/bgp.h"
+
+#include "aggregator.h"
+
+#define AGG_ASN		1
+#define AGG_COMM	2
+
+#define AGG_KEY(n)		n->type, n->key
+#define AGG_NEXT(n)		n->next
+#define AGG_EQ(t1,k1,t2,k2)	t1 == t2 && k1 == k2
+#define AGG_FN(t,k)		(u32_hash(k) ^ t)
+
+#define AGG_REHASH		agg_rehash
+#define AGG_PARAMS		/8, *2, 2, 2, 4, 20
+
+HASH_DEFINE_REHASH_FN(AGG, struct agg_count)
+
+static linpool *agg_lp;
+
+
+static void
+agg_mark(struct agg_proto *p, struct agg_item *a)
+{
+  a->changed = 1;
+
+  if (!NODE_VALID(&a->dirty_node))
+  {
+    add_tail(&p->dirty, &a->dirty_node);
+    ev_schedule(p->announce_event);
+  }
+}
+
+static void
+agg_count_update(struct agg_proto *p, struct agg_item *a, uint type, u32 key, int add)
+{
+  struct agg_count *c = HASH_FIND(a->values, AGG, type, key);
+
+  if (add)
+  {
+    if (c)
+    {
+      c->count++;
+      return;
+    }
+
+    c = sl_alloc(p->count_slab);
+    c->type = type;
+    c->key = key;
+    c->count = 1;
+    HASH_INSERT2(a->values, AGG, p->p.pool, c);
+  }
+  else
+  {
+    if (!c || --c->count)
+      return;
+
+    HASH_REMOVE2(a->values, AGG, p->p.pool, c);
+    sl_free(p->count_slab, c);
+  }
+
+  if (type == AGG_ASN)
+    a->asn_count += add ? 1 : -1;
+  else
+    a->comm_count += add ? 1 : -1;
+
+  agg_mark(p, a);
+}
+
+static void
+agg_contribute(struct agg_proto *p, struct agg_item *a, rta *attrs, int add)
+{
+  struct agg_config *cf = (void *) p->p.cf;
+  eattr *e;
+
+  if (add ? !a->count++ : !--a->count)
+  {
+    p->active += add ? 1 : -1;
+    agg_mark(p, a);
+  }
+
+  if (cf->as_set && (e = ea_find(attrs->eattrs, EA_CODE(PROTOCOL_BGP, BA_AS_PATH))))
+  {
+    const struct adata *path = e->u.ptr;
+    const byte *pos = path->data;
+    const byte *end = pos + path->length;
+
+    while (pos < end)
+    {
+      uint type = pos[0];
+      uint len = pos[1];
+      pos += 2;
+
+      /* Confederation segments do not leave the confederation */
+      if ((type == AS_PATH_SET) || (type == AS_PATH_SEQUENCE))
+	for (uint i = 0; i < len; i++)
+	  agg_count_update(p, a, AGG_ASN, get_u32(pos + 4 * i), add);
+
+      pos += 4 * len;
+    }
+  }
+
+  if (cf->merge_communities && (e = ea_find(attrs->eattrs, EA_CODE(PROTOCOL_BGP, BA_COMMUNITY))))
+  {
+    const struct adata *set = e->u.ptr;
+    const u32 *data = (const u32 *) set->data;
+
+    for (uint i = 0; i < set->length / 4; i++)
+      agg_count_update(p, a, AGG_COMM, data[i], add);
+  }
+}
+
+static void
+agg_update(struct agg_proto *p, const net_addr *net, rta *attrs, int add)
+{
+  void *nodes[FIB_LPM_MAX];
+  uint cnt = fib_route_list(&p->aggregates, net, nodes);
+
+  /* Only strictly more specific routes contribute */
+  for (uint i = 0; i < cnt; i++)
+  {
+    struct agg_item *a = nodes[i];
+
+    if (net_pxlen(a->n.addr) < net_pxlen(net))
+      agg_contribute(p, a, attrs, add);
+  }
+}
+
+static void
+agg_rt_notify(struct proto *P, struct channel *c UNUSED, net *n, rte *new, rte *old UNUSED)
+{
+  struct agg_proto *p = (void *) P;
+  const net_addr *net = n->n.addr;
+  struct agg_contributor *r = fib_find(&p->contributors, net);
+
+  if (r)
+  {
+    agg_update(p, net, r->attrs, 0);
+    rta_free(r->attrs);
+    r->attrs = NULL;
+  }
+
+  if (new)
+  {
+    /* Covered by no aggregate, nothing to keep */
+    if (!r && !fib_route(&p->aggregates, net))
+      return;
+
+    if (!r)
+      r = fib_get(&p->contributors, net);
+
+    r->attrs = rta_is_cached(new->attrs) ? rta_clone(new->attrs) : rta_lookup(new->attrs);
+    agg_update(p, net, r->attrs, 1);
+  }
+  else if (r)
+    fib_delete(&p->contributors, r);
+}
+
+static int
+agg_preexport(struct proto *P, rte **new, struct linpool *pool UNUSED)
+{
+  /* Never aggregate our own aggregates */
+  if ((*new)->attrs->src->proto == P)
+    return -1;
+
+  return 0;
+}
+
+static int
+agg_value_cmp(const void *X, const void *Y)
+{
+  const u32 *x = X, *y = Y;
+  return (*x < *y) ? -1 : (*x > *y) ? 1 : 0;
+}
+
+/* Collect sorted values of given type */
+static uint
+agg_values(struct agg_item *a, uint type, u32 *buf)
+{
+  uint cnt = 0;
+
+  HASH_WALK(a->values, next, c)
+    if (c->type == type)
+      buf[cnt++] = c->key;
+  HASH_WALK_END;
+
+  qsort(buf, cnt, sizeof(u32), agg_value_cmp);
+  return cnt;
+}
+
+static struct adata *
+agg_as_set(struct agg_item *a)
+{
+  u32 *asns = lp_alloc(agg_lp, a->asn_count * sizeof(u32));
+  uint cnt = agg_values(a, AGG_ASN, asns);
+  uint segs = (cnt + 254) / 255;
+
+  struct adata *path = lp_alloc_adata(agg_lp, 2 * segs + 4 * cnt);
+  byte *pos = path->data;
+
+  for (uint i = 0; i < cnt; )
+  {
+    uint len = MIN(cnt - i, 255);
+    pos[0] = AS_PATH_SET;
+    pos[1] = len;
+    pos += 2;
+
+    for (uint j = 0; j < len; j++, i++, pos += 4)
+      put_u32(pos, asns[i]);
+  }
+
+  return path;
+}
+
+static struct adata *
+agg_communities(struct agg_item *a)
+{
+  struct adata *set = lp_alloc_adata(agg_lp, a->comm_count * sizeof(u32));
+  agg_values(a, AGG_COMM, (u32 *) set->data);
+  return set;
+}
+
+static void
+agg_announce(struct agg_proto *p, struct agg_item *a)
+{
+  struct agg_config *cf = (void *) p->p.cf;
+
+  if (!a->count)
+  {
+    rte_update(&p->p, a->n.addr, NULL);
+    return;
+  }
+
+  rta *ra = allocz(RTA_MAX_SIZE);
+  ra->src = p->p.main_source;
+  ra->source = RTS_AGGREGATED;
+  ra->scope = SCOPE_UNIVERSE;
+  ra->dest = RTD_BLACKHOLE;
+
+  if (!cf->as_set)
+    ea_set_attr_data(&ra->eattrs, agg_lp, EA_CODE(PROTOCOL_BGP, BA_ATOMIC_AGGR),
+		     BAF_TRANSITIVE, EAF_TYPE_OPAQUE, NULL, 0);
+  else if (a->asn_count)
+    ea_set_attr_ptr(&ra->eattrs, agg_lp, EA_CODE(PROTOCOL_BGP, BA_AS_PATH),
+		    BAF_TRANSITIVE, EAF_TYPE_AS_PATH, agg_as_set(a));
+
+  if (cf->merge_communities && a->comm_count)
+    ea_set_attr_ptr(&ra->eattrs, agg_lp, EA_CODE(PROTOCOL_BGP, BA_COMMUNITY),
+		    BAF_OPTIONAL | BAF_TRANSITIVE, EAF_TYPE_INT_SET, agg_communities(a));
+
+  rte *e = rte_get_temp(ra);
+  e->pflags = 0;
+
+  rte_update(&p->p, a->n.addr, e);
+  lp_flush(agg_lp);
+}
+
+static void
+agg_announce_dirty(void *P)
+{
+  struct agg_proto *p = P;
+  struct agg_item *a;
+  node *n, *nxt;
+
+  WALK_LIST_DELSAFE(n, nxt, p->dirty)
+  {
+    a = SKIP_BACK(struct agg_item, dirty_node, n);
+    rem_node(n);
+
+    if (a->changed)
+    {
+      a->changed = 0;
+      agg_announce(p, a);
+    }
+  }
+}
+
+
+static void
+agg_postconfig(struct proto_config *CF)
+{
+  struct agg_config *cf = (void *) CF;
+  struct agg_prefix *ap;
+
+  if (EMPTY_LIST(CF->channels))
+    cf_error("Channel not specified");
+
+  WALK_LIST(ap, cf->aggregates)
+    if (ap->net->type != CF->net_type)
+      cf_error("Aggregate %N incompatible with channel type", ap->net);
+}
+
+static struct proto *
+agg_init(struct proto_config *CF)
+{
+  struct proto *P = proto_new(CF);
+
+  P->main_channel = proto_add_channel(P, proto_cf_main_channel(CF));
+
+  P->rt_notify = agg_rt_notify;
+  P->preexport = agg_preexport;
+
+  return P;
+}
+
+static int
+agg_start(struct proto *P)
+{
+  struct agg_proto *p = (void *) P;
+  struct agg_config *cf = (void *) P->cf;
+  struct agg_prefix *ap;
+
+  if (!agg_lp)
+    agg_lp = lp_new_default(&root_pool);
+
+  uint type = cf->c.net_type;
+
+  fib_init(&p->aggregates, P->pool, type, sizeof(struct agg_item),
+	   OFFSETOF(struct agg_item, n), 0, NULL);
+  fib_lpm_init(&p->aggregates);
+
+  fib_init(&p->contributors, P->pool, type, sizeof(struct agg_contributor),
+	   OFFSETOF(struct agg_contributor, n), 0, NULL);
+
+  WALK_LIST(ap, cf->aggregates)
+  {
+    struct agg_item *a = fib_get(&p->aggregates, ap->net);
+
+    if (!a->values.data)
+      HASH_INIT(a->values, P->pool, 4);
+  }
+
+  p->count_slab = sl_new(P->pool, sizeof(struct agg_count));
+  p->announce_event = ev_new_init(P->pool, agg_announce_dirty, p);
+  init_list(&p->dirty);
+  p->active = 0;
+
+  return PS_UP;
+}
+
+static void
+agg_cleanup(struct proto *P)
+{
+  struct agg_proto *p = (void *) P;
+
+  /* Everything else is freed with the protocol pool */
+  FIB_WALK(&p->contributors, struct agg_contributor, r)
+  {
+    rta_free(r->attrs);
+  }
+  FIB_WALK_END;
+}
+
+static int
+agg_same_aggregates(list *a, list *b)
+{
+  struct agg_prefix *x = HEAD(*a), *y = HEAD(*b);
+
+  for (; NODE_VALID(x) && NODE_VALID(y); x = NODE_NEXT(x), y = NODE_NEXT(y))
+    if (!net_equal(x->net, y->net))
+      return 0;
+
+  return !NODE_VALID(x) && !NODE_VALID(y);
+}
+
+static int
+agg_reconfigure(struct proto *P, struct proto_config *CF)
+{
+  struct agg_config *o = (void *) P->cf;
+  struct agg_config *n = (void *) CF;
+
+  if ((o->as_set != n->as_set) ||
+      (o->merge_communities != n->merge_communities) ||
+      !agg_same_aggregates(&o->aggregates, &n->aggregates))
+    return 0;
+
+  return proto_configure_channel(P, &P->main_channel, proto_cf_main_channel(CF));
+}
+
+static void
+agg_copy_config(struct proto_config *dest, struct proto_config *src)
+{
+  struct agg_config *d = (void *) dest;
+  struct agg_config *s = (void *) src;
+  struct agg_prefix *ap;
+
+  /* Shallow copy of the prefixes, they are never changed */
+  init_list(&d->aggregates);
+  WALK_LIST(ap, s->aggregates)
+  {
+    struct agg_prefix *np = cfg_alloc(sizeof(struct agg_prefix));
+    np->net = ap->net;
+    add_tail(&d->aggregates, &np->n);
+  }
+}
+
+static void
+agg_get_status(struct proto *P, byte *buf)
+{
+  struct agg_proto *p = (void *) P;
+
+  if (P->proto_state == PS_UP)
+    bsprintf(buf, "%u/%u active", p->active, p->aggregates.entries);
+}
+
+static void
+agg_show_proto_info(struct proto *P)
+{
+  struct agg_proto *p = (void *) P;
+  struct agg_config *cf = (void *) P->cf;
+
+  if (P->proto_state == PS_UP)
+  {
+    cli_msg(-1006, "  Aggregates:     %u active of %u", p->active, p->aggregates.entries);
+    cli_msg(-1006, "  Contributors:   %u", p->contributors.entries);
+  }
+
+  cli_msg(-1006, "  AS set:         %s", cf->as_set ? "yes" : "no");
+  cli_msg(-1006, "  Merge communities: %s", cf->merge_communities ? "yes" : "no");
+
+  if (P->main_channel)
+    channel_show_info(P->main_channel);
+}
+
+
+struct protocol proto_aggregator = {
+  .name =		"Aggregator",
+  .template =		"aggregator%d",
+  .class =		PROTOCOL_AGGREGATOR,
+  .preference =		DEF_PREF_AGGREGATED,
+  .channel_mask =	NB_IP,
+  .proto_size =		sizeof(struct agg_proto),
+  .config_size =	sizeof(struct agg_config),
+  .postconfig =		agg_postconfig,
+  .init =		agg_init,
+  .start =		agg_start,
+  .cleanup =		agg_cleanup,
+  .reconfigure =	agg_reconfigure,
+  .copy_config =	agg_copy_config,
+  .get_status =		agg_get_status,
+  .show_proto_info =	agg_show_proto_info
+};
@@ -0,0 +1,58 @@
+/*
+ *	BIRD -- Route Aggregator
+ *
+ *	Can be freely distributed and used under the terms of the GNU GPL.
+ */
+
+#ifndef _BIRD_AGGREGATOR_H_
+#define _BIRD_AGGREGATOR_H_
+
+#include "nest/route.h"
+#include "nest/protocol.h"
+#include "lib/hash.h"
+
+struct agg_config {
+  struct proto_config c;
+  list aggregates;			/* List of struct agg_prefix */
+  u8 as_set;				/* Announce AS_SET of contributing paths */
+  u8 merge_communities;			/* Announce union of contributing communities */
+};
+
+struct agg_prefix {
+  node n;
+  net_addr *net;
+};
+
+/* Number of contributors carrying a value (ASN or community) */
+struct agg_count {
+  struct agg_count *next;
+  u32 type;				/* AGG_ASN or AGG_COMM */
+  u32 key;
+  u32 count;
+};
+
+struct agg_item {
+  node dirty_node;			/* In agg_proto->dirty when waiting for announce */
+  uint count;				/* Number of contributing routes */
+  uint asn_count, comm_count;		/* Number of distinct values in the hash */
+  HASH(struct agg_count) values;
+  u8 changed;				/* Announced attributes have to be updated */
+  struct fib_node n;
+};
+
+struct agg_contributor {
+  rta *attrs;				/* Cached attributes of the contributing route */
+  struct fib_node n;
+};
+
+struct agg_proto {
+  struct proto p;
+  struct fib aggregates;		/* Configured aggregates (struct agg_item) */
+  struct fib contributors;		/* Routes counted in some aggregate (struct agg_contributor) */
+  slab *count_slab;			/* For struct agg_count */
+  list dirty;				/* Aggregates to be announced (struct agg_item) */
+  event *announce_event;
+  uint active;				/* Number of aggregates with contributors */
+};
+
+#endif
@@ -33,9 +33,19 @@
  * an entry is updated by receiving updates from the network or when modified by
  * internal timers. The function selects from feasible and reachable routes the
  * one with the lowest metric to be announced to the core.
+ *
+ * Routes and sources of all entries are indexed by hash tables keyed by the
+ * entry and the neighbor (resp. router ID), so updates are processed in
+ * constant time regardless of the number of neighbors. Route timeouts are kept
+ * in a binary heap ordered by the next expiry or refresh time, so the periodic
+ * timer processes just the due routes. The scan of all entries (expiration of
+ * sources, seqno requests and stale entries) runs only when some of these
+ * timeouts is due, or once per %BABEL_ENTRY_SCAN_INTERVAL to remove empty
+ * entries.
  */
 
 #include <stdlib.h>
+#include "lib/heap.h"
 #include "babel.h"
 
 
@@ -56,6 +66,50 @@ static void babel_update_cost(struct babel_neighbor *n);
 static inline void babel_kick_timer(struct babel_proto *p);
 static inline void babel_iface_kick_timer(struct babel_iface *ifa);
 
+#define BRH_KEY(r)		r->e, r->neigh
+#define BRH_NEXT(r)		r->next_hash
+#define BRH_EQ(e1,n1,e2,n2)	e1 == e2 && n1 == n2
+#define BRH_FN(e,n)		ptr_hash(e) ^ ptr_hash(n)
+
+#define BRH_REHASH		babel_brh_rehash
+#define BRH_PARAMS		/8, *2, 2, 2, 10, 24
+
+HASH_DEFINE_REHASH_FN(BRH, struct babel_route)
+
+#define BSH_KEY(s)		s->e, s->router_id
+#define BSH_NEXT(s)		s->next_hash
+#define BSH_EQ(e1,i1,e2,i2)	e1 == e2 && i1 == i2
+#define BSH_FN(e,i)		ptr_hash(e) ^ u64_hash(i)
+
+#define BSH_REHASH		babel_bsh_rehash
+#define BSH_PARAMS		/8, *2, 2, 2, 10, 24
+
+HASH_DEFINE_REHASH_FN(BSH, struct babel_source)
+
+#define BNH_KEY(n)		n->addr
+#define BNH_NEXT(n)		n->next_hash
+#define BNH_EQ(a,b)		ipa_equal(a, b)
+#define BNH_FN(a)		ipa_hash(a)
+
+#define BNH_REHASH		babel_bnh_rehash
+#define BNH_PARAMS		/8, *2, 2, 2, 4, 16
+
+HASH_DEFINE_REHASH_FN(BNH, struct babel_neighbor)
+
+/* Route heap is ordered by the nearest of expiry and refresh times */
+#define ROUTE_LESS(a,b)		(babel_route_timeout(a) < babel_route_timeout(b))
+#define ROUTE_SWAP(heap,a,b,t)	(t = heap[a], heap[a] = heap[b], heap[b] = t, \
+				 heap[a]->heap_index = (a), heap[b]->heap_index = (b))
+
+static inline btime
+babel_route_timeout(struct babel_route *r)
+{
+  if (!r->refresh_time || !r->expires)
+    return r->refresh_time ?: r->expires;
+
+  return MIN(r->refresh_time, r->expires);
+}
+
 static inline void babel_lock_neighbor(struct babel_neighbor *nbr)
 { if (nbr) nbr->uc++; }
 
@@ -93,32 +147,36 @@ babel_get_entry(struct babel_proto *p, const net_addr *n)
   return e;
 }
 
-static struct babel_source *
-babel_find_source(struct babel_entry *e, u64 router_id)
+static inline void
+babel_schedule_scan(struct babel_proto *p, btime time)
 {
-  struct babel_source *s;
-
-  WALK_LIST(s, e->sources)
-    if (s->router_id == router_id)
-      return s;
+  p->scan_time = MIN(p->scan_time, time);
+}
 
-  return NULL;
+static inline struct babel_source *
+babel_find_source(struct babel_proto *p, struct babel_entry *e, u64 router_id)
+{
+  return HASH_FIND(p->source_hash, BSH, e, router_id);
 }
 
 static struct babel_source *
 babel_get_source(struct babel_proto *p, struct babel_entry *e, u64 router_id)
 {
-  struct babel_source *s = babel_find_source(e, router_id);
+  struct babel_source *s = babel_find_source(p, e, router_id);
 
   if (s)
     return s;
 
   s = sl_alloc(p->source_slab);
+  s->e = e;
   s->router_id = router_id;
   s->expires = current_time() + BABEL_GARBAGE_INTERVAL;
   s->seqno = 0;
   s->metric = BABEL_INFINITY;
   add_tail(&e->sources, NODE s);
+  HASH_INSERT2(p->source_hash, BSH, p->p.pool, s);
+
+  babel_schedule_scan(p, s->expires);
 
   return s;
 }
@@ -134,27 +192,51 @@ babel_expire_sources(struct babel_proto *p, struct babel_entry *e)
     if (n->expires && n->expires <= now_)
     {
       rem_node(NODE n);
+      HASH_REMOVE2(p->source_hash, BSH, p->p.pool, n);
       sl_free(p->source_slab, n);
     }
+    else if (n->expires)
+      babel_schedule_scan(p, n->expires);
   }
 }
 
-static struct babel_route *
-babel_find_route(struct babel_entry *e, struct babel_neighbor *n)
+static inline struct babel_route *
+babel_find_route(struct babel_proto *p, struct babel_entry *e, struct babel_neighbor *n)
 {
-  struct babel_route *r;
+  return HASH_FIND(p->route_hash, BRH, e, n);
+}
 
-  WALK_LIST(r, e->routes)
-    if (r->neigh == n)
-      return r;
+/* Update position of the route in the route heap after change of its timers */
+static void
+babel_schedule_route(struct babel_proto *p, struct babel_route *r, btime old)
+{
+  btime new = babel_route_timeout(r);
+  uint num = p->route_heap.used - 1;
 
-  return NULL;
+  if (!r->heap_index && new)
+  {
+    BUFFER_PUSH(p->route_heap) = r;
+    r->heap_index = num + 1;
+    HEAP_INSERT(p->route_heap.data, num + 1, struct babel_route *, ROUTE_LESS, ROUTE_SWAP);
+  }
+  else if (r->heap_index && !new)
+  {
+    /* Zero timeout is less than any other, so the route bubbles up to the top */
+    HEAP_DECREASE(p->route_heap.data, num, struct babel_route *, ROUTE_LESS, ROUTE_SWAP, r->heap_index);
+    HEAP_DELMIN(p->route_heap.data, num, struct babel_route *, ROUTE_LESS, ROUTE_SWAP);
+    BUFFER_POP(p->route_heap);
+    r->heap_index = 0;
+  }
+  else if (new < old)
+    HEAP_DECREASE(p->route_heap.data, num, struct babel_route *, ROUTE_LESS, ROUTE_SWAP, r->heap_index);
+  else if (new > old)
+    HEAP_INCREASE(p->route_heap.data, num, struct babel_route *, ROUTE_LESS, ROUTE_SWAP, r->heap_index);
 }
 
 static struct babel_route *
 babel_get_route(struct babel_proto *p, struct babel_entry *e, struct babel_neighbor *nbr)
 {
-  struct babel_route *r = babel_find_route(e, nbr);
+  struct babel_route *r = babel_find_route(p, e, nbr);
 
   if (r)
     return r;
@@ -166,6 +248,7 @@ babel_get_route(struct babel_proto *p, struct babel_entry *e, struct babel_neigh
   r->neigh = nbr;
   add_tail(&e->routes, NODE r);
   add_tail(&nbr->routes, NODE &r->neigh_route);
+  HASH_INSERT2(p->route_hash, BRH, p->p.pool, r);
 
   return r;
 }
@@ -187,6 +270,14 @@ babel_flush_route(struct babel_proto *p, struct babel_route *r)
 
   rem_node(NODE r);
   rem_node(&r->neigh_route);
+  HASH_REMOVE2(p->route_hash, BRH, p->p.pool, r);
+
+  if (r->expires || r->refresh_time)
+  {
+    btime old = babel_route_timeout(r);
+    r->expires = r->refresh_time = 0;
+    babel_schedule_route(p, r, old);
+  }
 
   if (r->e->selected == r)
     r->e->selected = NULL;
@@ -204,8 +295,10 @@ babel_expire_route(struct babel_proto *p, struct babel_route *r)
 
   if (r->metric < BABEL_INFINITY)
   {
+    btime old = babel_route_timeout(r);
     r->metric = r->advert_metric = BABEL_INFINITY;
     r->expires = current_time() + cf->hold_time;
+    babel_schedule_route(p, r, old);
   }
   else
   {
@@ -216,58 +309,67 @@ babel_expire_route(struct babel_proto *p, struct babel_route *r)
 static void
 babel_refresh_route(struct babel_proto *p, struct babel_route *r)
 {
+  btime old = babel_route_timeout(r);
+
   if (r == r->e->selected)
     babel_send_route_request(p, r->e, r->neigh);
 
   r->refresh_time = 0;
+  babel_schedule_route(p, r, old);
 }
 
 static void
-babel_expire_routes_(struct babel_proto *p, struct fib *rtable)
+babel_expire_routes_(struct babel_proto *p)
 {
-  struct babel_config *cf = (void *) p->p.cf;
-  struct babel_route *r, *rx;
-  struct fib_iterator fit;
   btime now_ = current_time();
 
-  FIB_ITERATE_INIT(&fit, rtable);
-
-loop:
-  FIB_ITERATE_START(rtable, &fit, struct babel_entry, e)
+  /* Process due routes from the top of the route heap */
+  while ((p->route_heap.used > 1) && (babel_route_timeout(p->route_heap.data[1]) <= now_))
   {
+    struct babel_route *r = p->route_heap.data[1];
+    struct babel_entry *e = r->e;
     int changed = 0;
 
-    WALK_LIST_DELSAFE(r, rx, e->routes)
-    {
-      if (r->refresh_time && r->refresh_time <= now_)
-	babel_refresh_route(p, r);
+    if (r->refresh_time && r->refresh_time <= now_)
+      babel_refresh_route(p, r);
 
-      if (r->expires && r->expires <= now_)
-      {
-	changed = changed || (r == e->selected);
-	babel_expire_route(p, r);
-      }
+    if (r->expires && r->expires <= now_)
+    {
+      changed = (r == e->selected);
+      babel_expire_route(p, r);
     }
 
     if (changed)
-    {
-      /*
-       * We have to restart the iteration because there may be a cascade of
-       * synchronous events babel_select_route() -> nest table change ->
-       * babel_rt_notify() -> rtable change, invalidating hidden variables.
-       */
-      FIB_ITERATE_PUT(&fit);
       babel_select_route(p, e, NULL);
-      goto loop;
-    }
+  }
+}
 
+static void
+babel_expire_entries_(struct babel_proto *p, struct fib *rtable)
+{
+  struct babel_config *cf = (void *) p->p.cf;
+  struct fib_iterator fit;
+  btime now_ = current_time();
+
+  FIB_ITERATE_INIT(&fit, rtable);
+
+loop:
+  FIB_ITERATE_START(rtable, &fit, struct babel_entry, e)
+  {
     /* Clean up stale entries */
     if ((e->valid == BABEL_ENTRY_STALE) && ((e->updated + cf->hold_time) <= now_))
       e->valid = BABEL_ENTRY_DUMMY;
+    else if (e->valid == BABEL_ENTRY_STALE)
+      babel_schedule_scan(p, e->updated + cf->hold_time);
 
     /* Clean up unreachable route */
     if (e->unreachable && (!e->valid || (e->router_id == p->router_id)))
     {
+      /*
+       * We have to restart the iteration because there may be a cascade of
+       * synchronous events babel_announce_retraction() -> nest table change ->
+       * babel_rt_notify() -> rtable change, invalidating hidden variables.
+       */
       FIB_ITERATE_PUT(&fit);
       babel_announce_retraction(p, e);
       goto loop;
@@ -290,8 +392,15 @@ loop:
 static void
 babel_expire_routes(struct babel_proto *p)
 {
-  babel_expire_routes_(p, &p->ip4_rtable);
-  babel_expire_routes_(p, &p->ip6_rtable);
+  babel_expire_routes_(p);
+
+  if (p->scan_time > current_time())
+    return;
+
+  /* Entry scans schedule the next one for their pending timeouts */
+  p->scan_time = current_time() + BABEL_ENTRY_SCAN_INTERVAL;
+  babel_expire_entries_(p, &p->ip4_rtable);
+  babel_expire_entries_(p, &p->ip6_rtable);
 }
 
 static inline int seqno_request_valid(struct babel_seqno_request *sr)
@@ -333,6 +442,7 @@ found:
   sr->expires = current_time() + BABEL_SEQNO_REQUEST_EXPIRY;
   babel_lock_neighbor(sr->nbr = nbr);
   add_tail(&e->requests, NODE sr);
+  babel_schedule_scan(p, sr->expires);
 
   babel_send_seqno_request(p, e, sr);
 }
@@ -395,19 +505,15 @@ babel_expire_requests(struct babel_proto *p, struct babel_entry *e)
 	continue;
       }
     }
+
+    babel_schedule_scan(p, sr->expires);
   }
 }
 
-static struct babel_neighbor *
+static inline struct babel_neighbor *
 babel_find_neighbor(struct babel_iface *ifa, ip_addr addr)
 {
-  struct babel_neighbor *nbr;
-
-  WALK_LIST(nbr, ifa->neigh_list)
-    if (ipa_equal(nbr->addr, addr))
-      return nbr;
-
-  return NULL;
+  return HASH_FIND(ifa->neigh_hash, BNH, addr);
 }
 
 static struct babel_neighbor *
@@ -430,6 +536,7 @@ babel_get_neighbor(struct babel_iface *ifa, ip_addr addr)
   init_list(&nbr->routes);
   babel_lock_neighbor(nbr);
   add_tail(&ifa->neigh_list, NODE nbr);
+  HASH_INSERT2(ifa->neigh_hash, BNH, ifa->pool, nbr);
 
   return nbr;
 }
@@ -449,6 +556,7 @@ babel_flush_neighbor(struct babel_proto *p, struct babel_neighbor *nbr)
     babel_flush_route(p, r);
   }
 
+  HASH_REMOVE2(nbr->ifa->neigh_hash, BNH, nbr->ifa->pool, nbr);
   nbr->ifa = NULL;
   rem_node(NODE nbr);
   babel_unlock_neighbor(nbr);
@@ -811,17 +919,27 @@ babel_send_ihu(struct babel_iface *ifa, struct babel_neighbor *n)
 {
   union babel_msg msg = {};
   babel_build_ihu(&msg, ifa, n);
-  babel_send_unicast(&msg, ifa, n->addr);
+  babel_enqueue(&msg, ifa);
   n->ihu_cnt = BABEL_IHU_INTERVAL_FACTOR;
 }
 
+/*
+ * IHUs for all neighbors are sent together with every BABEL_IHU_INTERVAL_FACTOR
+ * hello, so they are aggregated in the same packets instead of being spread
+ * over hello intervals. IHUs with changed rxcost are sent with the next hello.
+ */
 static void
 babel_send_ihus(struct babel_iface *ifa)
 {
   struct babel_neighbor *n;
+  int all = (--ifa->ihu_cnt <= 0);
+
+  if (all)
+    ifa->ihu_cnt = BABEL_IHU_INTERVAL_FACTOR;
+
   WALK_LIST(n, ifa->neigh_list)
   {
-    if (n->hello_cnt && (--n->ihu_cnt <= 0))
+    if (n->hello_cnt && (all || (n->ihu_cnt <= 0)))
     {
       union babel_msg msg = {};
       babel_build_ihu(&msg, ifa, n);
@@ -905,6 +1023,17 @@ babel_send_seqno_request(struct babel_proto *p, struct babel_entry *e, struct ba
   }
 }
 
+static int
+babel_compare_updates(const void *A, const void *B)
+{
+  const struct babel_msg_update *a = A, *b = B;
+
+  if (a->router_id != b->router_id)
+    return (a->router_id < b->router_id) ? -1 : 1;
+
+  return net_compare(&a->net, &b->net);
+}
+
 /**
  * babel_send_update - send route table updates
  * @ifa: Interface to transmit on
@@ -914,11 +1043,18 @@ babel_send_seqno_request(struct babel_proto *p, struct babel_entry *e, struct ba
  * indicated by the &changed parameter and queues them for transmission on the
  * selected interface. During the process, the feasibility distance for each
  * transmitted entry is updated.
+ *
+ * The update TLVs are sorted by router ID and prefix before they are queued,
+ * so a Router-ID TLV is written once per group of routes with the same router
+ * ID and consecutive prefixes share the longest possible leading part, which is
+ * omitted by the prefix compression. The next hop is the same for all updates
+ * of one address family, which are sent together.
  */
 static void
 babel_send_update_(struct babel_iface *ifa, btime changed, struct fib *rtable)
 {
   struct babel_proto *p = ifa->proto;
+  ip_addr next_hop = (rtable == &p->ip4_rtable) ? ifa->next_hop_ip4 : ifa->next_hop_ip6;
 
   /* Update increase was requested */
   if (p->update_seqno_inc)
@@ -947,22 +1083,20 @@ babel_send_update_(struct babel_iface *ifa, btime changed, struct fib *rtable)
     TRACE(D_PACKETS, "Sending update for %N router-id %lR seqno %d metric %d",
 	  e->n.addr, e->router_id, e->seqno, e->metric);
 
-    union babel_msg msg = {};
-    msg.type = BABEL_TLV_UPDATE;
-    msg.update.interval = ifa->cf->update_interval;
-    msg.update.seqno = e->seqno;
-    msg.update.metric = e->metric;
-    msg.update.router_id = e->router_id;
-    net_copy(&msg.update.net, e->n.addr);
-
-    msg.update.next_hop = ((e->n.addr->type == NET_IP4) ?
-			   ifa->next_hop_ip4 : ifa->next_hop_ip6);
-
     /* Do not send route if next hop is unknown, e.g. no configured IPv4 address */
-    if (ipa_zero(msg.update.next_hop))
+    if (ipa_zero(next_hop))
       continue;
 
-    babel_enqueue(&msg, ifa);
+    struct babel_msg_update *msg = &BUFFER_PUSH(p->update_buf);
+    *msg = (struct babel_msg_update) {
+      .type = BABEL_TLV_UPDATE,
+      .interval = ifa->cf->update_interval,
+      .seqno = e->seqno,
+      .metric = e->metric,
+      .router_id = e->router_id,
+      .next_hop = next_hop,
+    };
+    net_copy(&msg->net, e->n.addr);
 
     /* Update feasibility distance for redistributed routes */
     if (e->router_id != p->router_id)
@@ -970,15 +1104,26 @@ babel_send_update_(struct babel_iface *ifa, btime changed, struct fib *rtable)
       struct babel_source *s = babel_get_source(p, e, e->router_id);
       s->expires = current_time() + BABEL_GARBAGE_INTERVAL;
 
-      if ((msg.update.seqno > s->seqno) ||
-	  ((msg.update.seqno == s->seqno) && (msg.update.metric < s->metric)))
+      if ((msg->seqno > s->seqno) ||
+	  ((msg->seqno == s->seqno) && (msg->metric < s->metric)))
       {
-	s->seqno = msg.update.seqno;
-	s->metric = msg.update.metric;
+	s->seqno = msg->seqno;
+	s->metric = msg->metric;
       }
     }
   }
   FIB_WALK_END;
+
+  qsort(p->update_buf.data, p->update_buf.used, sizeof(struct babel_msg_update),
+	babel_compare_updates);
+
+  BUFFER_WALK(p->update_buf, upd)
+  {
+    union babel_msg msg = { .update = upd };
+    babel_enqueue(&msg, ifa);
+  }
+
+  BUFFER_FLUSH(p->update_buf);
 }
 
 static void
@@ -1060,10 +1205,16 @@ babel_send_wildcard_retraction(struct babel_iface *ifa)
  *	TLV handler helpers
  */
 
-/* Update hello history according to Appendix A1 of the RFC */
-static void
+/*
+ * Update hello history according to Appendix A1 of the RFC. Returns 1 if the
+ * history changed, so the neighbor cost has to be recomputed.
+ */
+static int
 babel_update_hello_history(struct babel_neighbor *n, u16 seqno, uint interval)
 {
+  u16 old_map = n->hello_map;
+  u8 old_cnt = n->hello_cnt;
+
   /*
    * Compute the difference between expected and received seqno (modulo 2^16).
    * If the expected and received seqnos are within 16 of each other, the modular
@@ -1104,6 +1255,8 @@ babel_update_hello_history(struct babel_neighbor *n, u16 seqno, uint interval)
   /* Update expiration */
   n->hello_expiry = current_time() + BABEL_HELLO_EXPIRY_FACTOR(interval);
   n->last_hello_int = interval;
+
+  return (n->hello_map != old_map) || (n->hello_cnt != old_cnt);
 }
 
 
@@ -1135,10 +1288,12 @@ babel_handle_hello(union babel_msg *m, struct babel_iface *ifa)
   struct babel_neighbor *n = babel_get_neighbor(ifa, msg->sender);
   int first_hello = !n->hello_cnt;
 
-  babel_update_hello_history(n, msg->seqno, msg->interval);
-  babel_update_cost(n);
+  /* In steady state with full history, the cost does not change */
+  if (babel_update_hello_history(n, msg->seqno, msg->interval))
+    babel_update_cost(n);
 
-  /* Speed up session establishment by sending IHU immediately */
+  /* Speed up session establishment by sending IHU immediately, IHUs for
+     neighbors appearing at once are aggregated in the same packet */
   if (first_hello)
     babel_send_ihu(ifa, n);
 }
@@ -1157,9 +1312,13 @@ babel_handle_ihu(union babel_msg *m, struct babel_iface *ifa)
 	msg->rxcost, (btime) msg->interval);
 
   struct babel_neighbor *n = babel_get_neighbor(ifa, msg->sender);
-  n->txcost = msg->rxcost;
   n->ihu_expiry = current_time() + BABEL_IHU_EXPIRY_FACTOR(msg->interval);
-  babel_update_cost(n);
+
+  if (n->txcost != msg->rxcost)
+  {
+    n->txcost = msg->rxcost;
+    babel_update_cost(n);
+  }
 }
 
 /**
@@ -1235,7 +1394,7 @@ babel_handle_update(union babel_msg *m, struct babel_iface *ifa)
 	return;
 
       /* The route entry indexed by neighbour */
-      r = babel_find_route(e, nbr);
+      r = babel_find_route(p, e, nbr);
 
       if (!r)
 	return;
@@ -1251,7 +1410,7 @@ babel_handle_update(union babel_msg *m, struct babel_iface *ifa)
   /* Regular update */
   e = babel_get_entry(p, &msg->net);
   r = babel_get_route(p, e, nbr); /* the route entry indexed by neighbour */
-  s = babel_find_source(e, msg->router_id); /* for feasibility */
+  s = babel_find_source(p, e, msg->router_id); /* for feasibility */
   feasible = babel_is_feasible(s, msg->seqno, msg->metric);
   metric = babel_compute_metric(nbr, msg->metric);
   best = e->selected;
@@ -1265,8 +1424,10 @@ babel_handle_update(union babel_msg *m, struct babel_iface *ifa)
   if (r == best && !feasible && (msg->router_id == r->router_id))
     return;
 
+  btime old = babel_route_timeout(r);
   r->expires = current_time() + BABEL_ROUTE_EXPIRY_FACTOR(msg->interval);
   r->refresh_time = current_time() + BABEL_ROUTE_REFRESH_FACTOR(msg->interval);
+  babel_schedule_route(p, r, old);
 
   /* No further processing if there is no change */
   if ((r->feasible == feasible) && (r->seqno == msg->seqno) &&
@@ -1608,6 +1769,7 @@ babel_add_iface(struct babel_proto *p, struct iface *new, struct babel_iface_con
     log(L_WARN "%s: Missing IPv4 next hop address for %s", p->p.name, new->name);
 
   init_list(&ifa->neigh_list);
+  HASH_INIT(ifa->neigh_hash, ifa->pool, 4);
   ifa->hello_seqno = 1;
 
   ifa->timer = tm_new_init(ifa->pool, babel_iface_timer, ifa, 0, 0);
@@ -2146,6 +2308,10 @@ babel_rt_notify(struct proto *P, struct channel *c UNUSED, struct network *net,
     e->seqno = rt_seqno;
     e->metric = rt_metric;
     e->router_id = rt_router_id;
+
+    /* Our unreachable route is to be removed by the next scan */
+    if (e->unreachable)
+      babel_schedule_scan(p, current_time());
   }
   else
   {
@@ -2160,6 +2326,7 @@ babel_rt_notify(struct proto *P, struct channel *c UNUSED, struct network *net,
 
     babel_trigger_update(p);
     e->updated = current_time();
+    babel_schedule_scan(p, e->updated + ((struct babel_config *) p->p.cf)->hold_time);
   }
 }
 
@@ -2245,6 +2412,13 @@ babel_start(struct proto *P)
   if (cf->randomize_router_id)
     babel_randomize_router_id(p);
 
+  HASH_INIT(p->route_hash, P->pool, 10);
+  HASH_INIT(p->source_hash, P->pool, 10);
+  BUFFER_INIT(p->route_heap, P->pool, 64);
+  BUFFER_INIT(p->update_buf, P->pool, 64);
+  BUFFER_PUSH(p->route_heap) = NULL;
+  p->scan_time = current_time() + BABEL_ENTRY_SCAN_INTERVAL;
+
   p->route_slab = sl_new(P->pool, sizeof(struct babel_route));
   p->source_slab = sl_new(P->pool, sizeof(struct babel_source));
   p->msg_slab = sl_new(P->pool, sizeof(struct babel_msg_node));
@@ -2313,6 +2487,7 @@ struct protocol proto_babel = {
   .channel_mask =	NB_IP | NB_IP6_SADR,
   .proto_size =		sizeof(struct babel_proto),
   .config_size =	sizeof(struct babel_config),
+  .rte_size =		RTE_SIZE(babel),
   .postconfig =		babel_postconfig,
   .init =		babel_init,
   .dump =		babel_dump,
@@ -24,6 +24,8 @@
 #include "lib/socket.h"
 #include "lib/string.h"
 #include "lib/timer.h"
+#include "lib/buffer.h"
+#include "lib/hash.h"
 
 #define EA_BABEL_METRIC		EA_CODE(PROTOCOL_BABEL, 0)
 #define EA_BABEL_ROUTER_ID	EA_CODE(PROTOCOL_BABEL, 1)
@@ -47,6 +49,7 @@
 #define BABEL_SEQNO_REQUEST_RETRY	4
 #define BABEL_SEQNO_REQUEST_EXPIRY	(2 S_)
 #define BABEL_GARBAGE_INTERVAL		(300 S_)
+#define BABEL_ENTRY_SCAN_INTERVAL	(30 S_)	/* Max interval between scans of all entries */
 #define BABEL_RXCOST_WIRED		96
 #define BABEL_RXCOST_WIRELESS		256
 #define BABEL_INITIAL_HOP_COUNT		255
@@ -154,6 +157,12 @@ struct babel_proto {
   u8 update_seqno_inc;			/* Request for update_seqno increase */
   u8 triggered;				/* For triggering global updates */
 
+  HASH(struct babel_route) route_hash;	/* Routes indexed by (entry, neighbor) */
+  HASH(struct babel_source) source_hash; /* Sources indexed by (entry, router ID) */
+  BUFFER_(struct babel_route *) route_heap; /* Routes ordered by next timeout, index 0 unused */
+  btime scan_time;			/* Next scan of all entries */
+  BUFFER_(struct babel_msg_update) update_buf; /* Updates to be sorted before sending */
+
   slab *route_slab;
   slab *source_slab;
   slab *msg_slab;
@@ -180,9 +189,11 @@ struct babel_iface {
   ip_addr next_hop_ip6;
   int tx_length;
   list neigh_list;			/* List of neighbors seen on this iface (struct babel_neighbor) */
+  HASH(struct babel_neighbor) neigh_hash; /* Neighbors indexed by address */
   list msg_queue;
 
   u16 hello_seqno;			/* To be increased on each hello */
+  s8 ihu_cnt;				/* IHU countdown for all neighbors, 0 to send them */
 
   btime next_hello;
   btime next_regular;
@@ -195,6 +206,7 @@ struct babel_iface {
 
 struct babel_neighbor {
   node n;
+  struct babel_neighbor *next_hash;
   struct babel_iface *ifa;
 
   ip_addr addr;
@@ -202,7 +214,7 @@ struct babel_neighbor {
   u16 rxcost;				/* Sent in last IHU */
   u16 txcost;				/* Received in last IHU */
   u16 cost;				/* Computed neighbor cost */
-  s8 ihu_cnt;				/* IHU countdown, 0 to send it */
+  s8 ihu_cnt;				/* 0 to send IHU with next hello, regardless of countdown */
   u8 hello_cnt;
   u16 hello_map;
   u16 next_hello_seqno;
@@ -216,6 +228,8 @@ struct babel_neighbor {
 
 struct babel_source {
   node n;
+  struct babel_source *next_hash;
+  struct babel_entry *e;
 
   u64 router_id;
   u16 seqno;
@@ -226,8 +240,10 @@ struct babel_source {
 struct babel_route {
   node n;
   node neigh_route;
+  struct babel_route *next_hash;
   struct babel_entry    *e;
   struct babel_neighbor *neigh;
+  uint heap_index;			/* Position in route_heap, 0 if not there */
 
   u8 feasible;
   u16 seqno;
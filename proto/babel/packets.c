@@ -148,6 +148,8 @@ struct babel_write_state {
   u8 router_id_seen;
   ip_addr next_hop_ip4;
   ip_addr next_hop_ip6;
+  u8 def_ip4_prefix[4];		/* Implicit IPv4 prefix in network order */
+  u8 def_ip4_pxlen;
   u8 def_ip6_prefix[16];	/* Implicit IPv6 prefix in network order */
   u8 def_ip6_pxlen;
 };
@@ -748,7 +750,29 @@ babel_write_update(struct babel_tlv *hdr, union babel_msg *m,
   {
     tlv->ae = BABEL_AE_IP4;
     tlv->plen = net4_pxlen(&msg->net);
-    put_ip4_px(tlv->addr, &msg->net);
+
+    /* Address compression - omit initial matching bytes */
+    u8 buf[4], omit;
+    put_ip4(buf, net4_prefix(&msg->net));
+    omit = bytes_equal(buf, state->def_ip4_prefix,
+		       MIN(tlv->plen, state->def_ip4_pxlen) / 8);
+
+    if (omit > 0)
+    {
+      memcpy(tlv->addr, buf + omit, NET_SIZE(&msg->net) - omit);
+
+      tlv->omitted = omit;
+      tlv->length -= omit;
+      len -= omit;
+    }
+    else
+    {
+      put_ip4_px(tlv->addr, &msg->net);
+      tlv->flags |= BABEL_UF_DEF_PREFIX;
+
+      put_ip4(state->def_ip4_prefix, net4_prefix(&msg->net));
+      state->def_ip4_pxlen = tlv->plen;
+    }
   }
   else
   {
@@ -1245,8 +1269,11 @@ void
 babel_send_queue(void *arg)
 {
   struct babel_iface *ifa = arg;
+
+  sk_tx_batch_begin(ifa->sk);
   while ((babel_write_queue(ifa, &ifa->msg_queue) > 0) &&
 	 (babel_send_to(ifa, IP6_BABEL_ROUTERS) > 0));
+  sk_tx_batch_end(ifa->sk);
 }
 
 static inline void
@@ -1493,6 +1520,7 @@ babel_open_socket(struct babel_iface *ifa)
   sk->vrf = p->p.vrf;
 
   sk->rx_hook = babel_rx_hook;
+  sk->fast_rx = p->p.cf->io_priority;
   sk->tx_hook = babel_tx_hook;
   sk->err_hook = babel_err_hook;
   sk->data = ifa;
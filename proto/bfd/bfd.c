@@ -63,7 +63,7 @@
  * handled by BFD protocol like it is a BFD client -- when a BFD neighbor is
  * ready, the protocol just creates a BFD request like any other protocol.
  *
- * The protocol uses a new generic event loop (structure &birdloop) from |io.c|,
+ * The protocol uses a new generic event loop (structure &birdloop) from |io-loop.c|,
  * which supports sockets, timers and events like the main loop. A birdloop is
  * associated with a thread (field @thread) in which event hooks are executed.
  * Most functions for setting event sources (like sk_start() or tm_start()) must
@@ -82,7 +82,7 @@
  * BFD thread to the main thread. This is done in an asynchronous way, sesions
  * with pending notifications are linked (in the BFD thread) to @notify_list in
  * &bfd_proto, and then bfd_notify_hook() in the main thread is activated using
- * bfd_notify_kick() and a pipe. The hook then processes scheduled sessions and
+ * bfd_notify_kick(), which sends an event to the main thread by ev_send(). The hook then processes scheduled sessions and
  * calls hooks from associated BFD requests. This @notify_list (and state fields
  * in structure &bfd_session) is protected by a spinlock in &bfd_proto and
  * functions bfd_lock_sessions() / bfd_unlock_sessions().
@@ -179,18 +179,34 @@ bfd_session_update_tx_interval(struct bfd_session *s)
   tm_set(s->tx_timer, s->last_tx + tx_int_l);
 }
 
-static void
-bfd_session_update_detection_time(struct bfd_session *s, int kick)
+static inline btime
+bfd_session_detection_time(struct bfd_session *s)
 {
   btime timeout = (btime) MAX(s->req_min_rx_int, s->rem_min_tx_int) * s->rem_detect_mult;
+  return s->last_rx + timeout;
+}
 
+/*
+ * The hold timer is postponed lazily. Received packets just update last_rx and
+ * the timer is moved forward by bfd_hold_timer_hook() when it fires, so the
+ * timer heap is not updated for every received packet. The timer is reset
+ * immediately only when the detection time moves backward.
+ */
+static void
+bfd_session_update_detection_time(struct bfd_session *s, int kick)
+{
   if (kick)
     s->last_rx = current_time();
 
   if (!s->last_rx)
     return;
 
-  tm_set(s->hold_timer, s->last_rx + timeout);
+  btime expires = bfd_session_detection_time(s);
+
+  if (tm_active(s->hold_timer) && (s->hold_timer->expires <= expires))
+    return;
+
+  tm_set(s->hold_timer, expires);
 }
 
 static void
@@ -390,7 +406,17 @@ bfd_tx_timer_hook(timer *t)
 static void
 bfd_hold_timer_hook(timer *t)
 {
-  bfd_session_timeout(t->data);
+  struct bfd_session *s = t->data;
+  btime expires = bfd_session_detection_time(s);
+
+  /* Detection time was postponed by received packets */
+  if (expires > current_time())
+  {
+    tm_set(t, expires);
+    return;
+  }
+
+  bfd_session_timeout(s);
 }
 
 static u32
@@ -859,26 +885,18 @@ bfd_reconfigure_neighbors(struct bfd_proto *p, struct bfd_config *new)
 
 
 /*
- *	BFD notify socket
+ *	BFD notify event
  */
 
-/* This core notify code should be replaced after main loop transition to birdloop */
-
-int pipe(int pipefd[2]);
-void pipe_drain(int fd);
-void pipe_kick(int fd);
-
-static int
-bfd_notify_hook(sock *sk, uint len UNUSED)
+static void
+bfd_notify_hook(void *data)
 {
-  struct bfd_proto *p = sk->data;
+  struct bfd_proto *p = data;
   struct bfd_session *s;
   list tmp_list;
   u8 state, diag;
   node *n, *nn;
 
-  pipe_drain(sk->fd);
-
   bfd_lock_sessions(p);
   init_list(&tmp_list);
   add_tail_list(&tmp_list, &p->notify_list);
@@ -902,52 +920,19 @@ bfd_notify_hook(sock *sk, uint len UNUSED)
     if (EMPTY_LIST(s->request_list))
       bfd_remove_session(p, s);
   }
-
-  return 0;
 }
 
 static inline void
 bfd_notify_kick(struct bfd_proto *p)
 {
-  pipe_kick(p->notify_ws->fd);
-}
-
-static void
-bfd_noterr_hook(sock *sk, int err)
-{
-  struct bfd_proto *p = sk->data;
-  log(L_ERR "%s: Notify socket error: %m", p->p.name, err);
+  ev_send(p->notify_queue, p->notify_event);
 }
 
 static void
 bfd_notify_init(struct bfd_proto *p)
 {
-  int pfds[2];
-  sock *sk;
-
-  int rv = pipe(pfds);
-  if (rv < 0)
-    die("pipe: %m");
-
-  sk = sk_new(p->p.pool);
-  sk->type = SK_MAGIC;
-  sk->rx_hook = bfd_notify_hook;
-  sk->err_hook = bfd_noterr_hook;
-  sk->fd = pfds[0];
-  sk->data = p;
-  if (sk_open(sk) < 0)
-    die("bfd: sk_open failed");
-  p->notify_rs = sk;
-
-  /* The write sock is not added to any event loop */
-  sk = sk_new(p->p.pool);
-  sk->type = SK_MAGIC;
-  sk->fd = pfds[1];
-  sk->data = p;
-  sk->flags = SKF_THREAD;
-  if (sk_open(sk) < 0)
-    die("bfd: sk_open failed");
-  p->notify_ws = sk;
+  p->notify_queue = ev_queue_new(p->p.pool);
+  p->notify_event = ev_new_init(p->p.pool, bfd_notify_hook, p);
 }
 
 
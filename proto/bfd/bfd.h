@@ -22,7 +22,7 @@
 #include "lib/string.h"
 
 #include "nest/bfd.h"
-#include "io.h"
+#include "lib/io-loop.h"
 
 
 #define BFD_CONTROL_PORT	3784
@@ -87,8 +87,8 @@ struct bfd_proto
   HASH(struct bfd_session) session_hash_id;
   HASH(struct bfd_session) session_hash_ip;
 
-  sock *notify_rs;
-  sock *notify_ws;
+  ev_queue *notify_queue;
+  event *notify_event;
   list notify_list;
 
   sock *rx4_1;
@@ -423,7 +423,7 @@ bfd_open_rx_sk(struct bfd_proto *p, int multihop, int af)
   /* TODO: configurable ToS and priority */
   sk->tos = IP_PREC_INTERNET_CONTROL;
   sk->priority = sk_priority_control;
-  sk->flags = SKF_THREAD | SKF_LADDR_RX | (!multihop ? SKF_TTL_RX : 0);
+  sk->flags = SKF_THREAD | SKF_BATCH_RX | SKF_LADDR_RX | (!multihop ? SKF_TTL_RX : 0);
 
   if (sk_open(sk) < 0)
     goto err;
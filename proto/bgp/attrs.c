@@ -442,12 +442,14 @@ bgp_decode_as_path(struct bgp_parse_state *s, uint code UNUSED, uint flags, byte
   if (!as_path_valid(data, len, as_length, as_sets, as_confed, err, sizeof(err)))
     WITHDRAW("Malformed AS_PATH attribute - %s", err);
 
+  struct adata *ad = NULL;
   if (!s->as4_session)
   {
-    /* Prepare 32-bit AS_PATH (from 16-bit one) in a temporary buffer */
-    byte *src = data;
-    data = alloca(2*len);
-    len = as_path_16to32(data, src, len);
+    /* Convert 16-bit AS_PATH directly into the attribute value */
+    ad = lp_alloc_adata(s->pool, 2*len);
+    ad->length = as_path_16to32(ad->data, data, len);
+    data = ad->data;
+    len = ad->length;
   }
 
   /* In some circumstances check for initial AS_CONFED_SEQUENCE; RFC 5065 5.0 */
@@ -460,7 +462,10 @@ bgp_decode_as_path(struct bgp_parse_state *s, uint code UNUSED, uint flags, byte
       !bgp_as_path_first_as_equal(data, len, p->remote_as))
     WITHDRAW("Malformed AS_PATH attribute - %s", "First AS differs from neigbor AS");
 
-  bgp_set_attr_data(to, s->pool, BA_AS_PATH, flags, data, len);
+  if (ad)
+    bgp_set_attr_ptr(to, s->pool, BA_AS_PATH, flags, ad);
+  else
+    bgp_set_attr_data(to, s->pool, BA_AS_PATH, flags, data, len);
 }
 
 
@@ -1398,6 +1403,52 @@ withdraw:
   return NULL;
 }
 
+/**
+ * bgp_decode_attrs_raw - decode BGP attributes without a session
+ * @pool: linpool for decoded attributes
+ * @name: name used in error messages
+ * @data: start of attribute block
+ * @len: length of attribute block
+ *
+ * This function decodes an attribute block which was not received from a
+ * session, like attributes stored in MRT RIB entries. The attributes are
+ * treated as received over an internal AS4 session, checks that depend on
+ * session parameters are not done. The block must not contain MP_REACH_NLRI
+ * or MP_UNREACH_NLRI attributes. Returns decoded attributes or %NULL when the
+ * block is malformed.
+ */
+ea_list *
+bgp_decode_attrs_raw(struct linpool *pool, const char *name, byte *data, uint len)
+{
+  static struct bgp_config cf = {
+    .allow_as_sets = 1,
+    .allow_local_pref = 1,
+    .default_local_pref = 100,
+  };
+
+  struct bgp_proto p = {
+    .p.name = name,
+    .cf = &cf,
+    .as4_session = 1,
+    .is_internal = 1,
+    .is_interior = 1,
+  };
+
+  struct bgp_parse_state s = {
+    .proto = &p,
+    .pool = pool,
+    .as4_session = 1,
+    .mp_reach_len = 1,			/* Pretend there is some NLRI */
+  };
+
+  if (setjmp(s.err_jmpbuf))
+    return NULL;
+
+  ea_list *attrs = bgp_decode_attrs(&s, data, len);
+
+  return s.err_withdraw ? NULL : attrs;
+}
+
 void
 bgp_finish_attrs(struct bgp_parse_state *s, rta *a)
 {
@@ -1443,51 +1494,49 @@ bgp_free_bucket_table(struct bgp_channel *c)
   WALK_LIST_FIRST(b, c->bucket_queue)
   {
     rem_node(&b->send_node);
+    mb_free(b->encoded);
     mb_free(b);
   }
 
   mb_free(c->withdraw_bucket);
   c->withdraw_bucket = NULL;
+
+  bgp_leave_update_group(c);
 }
 
-static struct bgp_bucket *
-bgp_get_bucket(struct bgp_channel *c, ea_list *new)
+static uint
+bgp_eattrs_copy_size(ea_list *src)
 {
-  /* Hash and lookup */
-  u32 hash = ea_hash(new);
-  struct bgp_bucket *b = HASH_FIND(c->bucket_hash, RBH, new, hash);
-
-  if (b)
-    return b;
-
-  uint ea_size = sizeof(ea_list) + new->count * sizeof(eattr);
-  uint ea_size_aligned = BIRD_ALIGN(ea_size, CPU_STRUCT_ALIGN);
-  uint size = sizeof(struct bgp_bucket) + ea_size_aligned;
-  uint i;
-  byte *dest;
+  uint ea_size = sizeof(ea_list) + src->count * sizeof(eattr);
+  uint size = BIRD_ALIGN(ea_size, CPU_STRUCT_ALIGN);
 
   /* Gather total size of non-inline attributes */
-  for (i = 0; i < new->count; i++)
+  for (uint i = 0; i < src->count; i++)
   {
-    eattr *a = &new->attrs[i];
+    eattr *a = &src->attrs[i];
 
     if (!(a->type & EAF_EMBEDDED))
       size += BIRD_ALIGN(sizeof(struct adata) + a->u.ptr->length, CPU_STRUCT_ALIGN);
   }
 
-  /* Create the bucket */
-  b = mb_alloc(c->pool, size);
-  init_list(&b->prefixes);
-  b->hash = hash;
+  return size;
+}
 
-  /* Copy list of extended attributes */
-  memcpy(b->eattrs, new, ea_size);
-  dest = ((byte *) b->eattrs) + ea_size_aligned;
+static void
+bgp_eattrs_copy(ea_list *dst, ea_list *src)
+{
+  uint ea_size = sizeof(ea_list) + src->count * sizeof(eattr);
+  uint ea_size_aligned = BIRD_ALIGN(ea_size, CPU_STRUCT_ALIGN);
+
+  /* Copy list of extended attributes, without index of cached lists */
+  memcpy(dst, src, ea_size);
+  dst->flags &= ~EALF_INDEX;
+  byte *dest = ((byte *) dst) + ea_size_aligned;
 
   /* Copy values of non-inline attributes */
-  for (i = 0; i < new->count; i++)
+  for (uint i = 0; i < src->count; i++)
   {
-    eattr *a = &b->eattrs->attrs[i];
+    eattr *a = &dst->attrs[i];
 
     if (!(a->type & EAF_EMBEDDED))
     {
@@ -1498,6 +1547,25 @@ bgp_get_bucket(struct bgp_channel *c, ea_list *new)
       dest += BIRD_ALIGN(sizeof(struct adata) + na->length, CPU_STRUCT_ALIGN);
     }
   }
+}
+
+static struct bgp_bucket *
+bgp_get_bucket(struct bgp_channel *c, ea_list *new)
+{
+  /* Hash and lookup */
+  u32 hash = ea_hash(new);
+  struct bgp_bucket *b = HASH_FIND(c->bucket_hash, RBH, new, hash);
+
+  if (b)
+    return b;
+
+  /* Create the bucket */
+  b = mb_alloc(c->pool, sizeof(struct bgp_bucket) + bgp_eattrs_copy_size(new));
+  init_list(&b->prefixes);
+  b->hash = hash;
+  b->encoded = NULL;
+  b->encoded_length = 0;
+  bgp_eattrs_copy(b->eattrs, new);
 
   /* Insert the bucket to send queue and bucket hash */
   add_tail(&c->bucket_queue, &b->send_node);
@@ -1523,9 +1591,18 @@ bgp_free_bucket(struct bgp_channel *c, struct bgp_bucket *b)
 {
   rem_node(&b->send_node);
   HASH_REMOVE2(c->bucket_hash, RBH, c->pool, b);
+  mb_free(b->encoded);
   mb_free(b);
 }
 
+/* Move bucket with a priority route to the front of the send queue */
+static inline void
+bgp_prioritize_bucket(struct bgp_channel *c, struct bgp_bucket *b)
+{
+  rem_node(&b->send_node);
+  add_head(&c->bucket_queue, &b->send_node);
+}
+
 void
 bgp_defer_bucket(struct bgp_channel *c, struct bgp_bucket *b)
 {
@@ -1551,6 +1628,199 @@ bgp_withdraw_bucket(struct bgp_channel *c, struct bgp_bucket *b)
 }
 
 
+/*
+ *	Update groups
+ */
+
+/*
+ * Channels of different BGP sessions that encode path attributes the same way
+ * (same AFI, same placement of next hop and same AS number width) form an
+ * update group. Members of a group with more than one channel share a cache of
+ * encoded attribute blocks, so a route exported with identical attributes to
+ * many peers is encoded only once. The cache is keyed by the bucket attribute
+ * list, i.e. by the attributes after export processing of each peer, so it
+ * is correct regardless of per-peer export policy. It is flushed when it grows
+ * over BGP_UPDATE_GROUP_MAX entries and freed with the last member.
+ */
+
+static list bgp_update_groups;		/* Global list of update groups */
+
+#define BEA_KEY(e)		e->eattrs, e->hash
+#define BEA_NEXT(e)		e->next
+#define BEA_EQ(a1,h1,a2,h2)	h1 == h2 && ea_same(a1, a2)
+#define BEA_FN(a,h)		h
+
+#define BEA_REHASH		bgp_bea_rehash
+#define BEA_PARAMS		/8, *2, 2, 2, 8, 20
+
+HASH_DEFINE_REHASH_FN(BEA, struct bgp_encoded_attrs)
+
+void
+bgp_join_update_group(struct bgp_channel *c)
+{
+  struct bgp_proto *p = (void *) c->c.proto;
+  struct bgp_update_group *g;
+
+  u32 afi = c->afi;
+  u8 mp_reach = (c->afi != BGP_AF_IPV4) || c->ext_next_hop;
+  u8 as4_session = p->as4_session;
+
+  ASSERT(!c->group);
+
+  if (!bgp_update_groups.head)
+    init_list(&bgp_update_groups);
+
+  WALK_LIST(g, bgp_update_groups)
+    if ((g->afi == afi) && (g->mp_reach == mp_reach) && (g->as4_session == as4_session))
+    {
+      g->uc++;
+      c->group = g;
+      return;
+    }
+
+  pool *pool = rp_new(proto_pool, "BGP update group");
+  g = mb_allocz(pool, sizeof(struct bgp_update_group));
+  g->pool = pool;
+  g->uc = 1;
+  g->afi = afi;
+  g->mp_reach = mp_reach;
+  g->as4_session = as4_session;
+  HASH_INIT(g->hash, pool, 8);
+
+  add_tail(&bgp_update_groups, &g->n);
+  c->group = g;
+}
+
+void
+bgp_leave_update_group(struct bgp_channel *c)
+{
+  struct bgp_update_group *g = c->group;
+
+  if (!g)
+    return;
+
+  c->group = NULL;
+
+  if (--g->uc)
+    return;
+
+  rem_node(&g->n);
+  rfree(g->pool);
+}
+
+static void
+bgp_flush_update_group(struct bgp_update_group *g)
+{
+  HASH_WALK_DELSAFE(g->hash, next, e)
+    mb_free(e);
+  HASH_WALK_DELSAFE_END;
+
+  HASH_FREE(g->hash);
+  HASH_INIT(g->hash, g->pool, 8);
+  g->count = 0;
+}
+
+/* Recover side effects of encoding of bucket attributes from the bucket */
+static int
+bgp_copy_bucket_attrs(struct bgp_write_state *s, struct bgp_bucket *buck, const byte *data, uint len, byte *buf, byte *end)
+{
+  if (len > (uint) (end - buf))
+    return -1;
+
+  memcpy(buf, data, len);
+
+  if (s->mp_reach)
+    s->mp_next_hop = bgp_find_attr(buck->eattrs, BA_NEXT_HOP);
+
+  eattr *a = bgp_find_attr(buck->eattrs, BA_MPLS_LABEL_STACK);
+  if (a)
+    s->mpls_labels = a->u.ptr;
+
+  return len;
+}
+
+/**
+ * bgp_cache_bucket_attrs - keep encoded attributes of a route bucket
+ * @c: BGP channel
+ * @buck: bucket being sent
+ * @data: encoded attribute block (without MP_REACH_NLRI)
+ * @len: length of @data
+ *
+ * Buckets with more prefixes than fit into one UPDATE message are sent in
+ * several messages with the same attribute block. The block is kept by the
+ * bucket after the first message, so the next ones just copy it (see
+ * bgp_encode_bucket_attrs()). It is freed with the bucket.
+ */
+void
+bgp_cache_bucket_attrs(struct bgp_channel *c, struct bgp_bucket *buck, const byte *data, uint len)
+{
+  if (buck->encoded || EMPTY_LIST(buck->prefixes))
+    return;
+
+  buck->encoded = mb_alloc(c->pool, len);
+  buck->encoded_length = len;
+  memcpy(buck->encoded, data, len);
+}
+
+/**
+ * bgp_encode_bucket_attrs - encode attributes of a route bucket
+ * @s: BGP write state
+ * @buck: bucket to be sent
+ * @buf: buffer
+ * @end: buffer end
+ *
+ * This is a variant of bgp_encode_attrs() for UPDATE messages. The attribute
+ * block kept by the bucket (see bgp_cache_bucket_attrs()) is used first. When
+ * the channel shares an update group with other channels, the encoded
+ * attribute block is looked up in (or stored to) the group cache. The side
+ * effects of encoding (next hop and MPLS labels deferred to MP_REACH_NLRI) are
+ * recovered from the bucket attributes when a cached block is used.
+ *
+ * Result: Length of the attribute block generated or -1 if not enough space.
+ */
+int
+bgp_encode_bucket_attrs(struct bgp_write_state *s, struct bgp_bucket *buck, byte *buf, byte *end)
+{
+  struct bgp_update_group *g = s->channel->group;
+
+  if (buck->encoded)
+    return bgp_copy_bucket_attrs(s, buck, buck->encoded, buck->encoded_length, buf, end);
+
+  if (!g || (g->uc < 2) || s->sham)
+    return bgp_encode_attrs(s, buck->eattrs, buf, end);
+
+  struct bgp_encoded_attrs *e = HASH_FIND(g->hash, BEA, buck->eattrs, buck->hash);
+
+  if (e)
+  {
+    g->hits++;
+    return bgp_copy_bucket_attrs(s, buck, e->data, e->length, buf, end);
+  }
+
+  int len = bgp_encode_attrs(s, buck->eattrs, buf, end);
+
+  if (len < 0)
+    return len;
+
+  if (g->count >= BGP_UPDATE_GROUP_MAX)
+    bgp_flush_update_group(g);
+
+  uint ea_size = BIRD_ALIGN(sizeof(struct bgp_encoded_attrs) + len, CPU_STRUCT_ALIGN);
+  e = mb_alloc(g->pool, ea_size + bgp_eattrs_copy_size(buck->eattrs));
+  e->eattrs = (ea_list *) (((byte *) e) + ea_size);
+  e->hash = buck->hash;
+  e->length = len;
+  memcpy(e->data, buf, len);
+  bgp_eattrs_copy(e->eattrs, buck->eattrs);
+
+  HASH_INSERT2(g->hash, BEA, g->pool, e);
+  g->count++;
+  g->misses++;
+
+  return len;
+}
+
+
 /*
  *	Prefix hash table
  */
@@ -1622,6 +1892,10 @@ bgp_free_prefix(struct bgp_channel *c, struct bgp_prefix *px)
     sl_free(c->prefix_slab, px);
   else
     mb_free(px);
+
+  /* Resume paused feed when half of the queue is sent */
+  if (c->c.feed_paused && (c->prefix_hash.count <= c->cf->export_queue_limit / 2))
+    channel_resume_feed(&c->c);
 }
 
 
@@ -1641,6 +1915,14 @@ bgp_preexport(struct proto *P, rte **new, struct linpool *pool UNUSED)
   if (src == p)
     return -1;
 
+  /* Routes denied by neighbor prefix ORF, RFC 5292 */
+  if (p->orf_channels && !bgp_orf_export(p, e))
+    return -1;
+
+  /* VPN routes outside of neighbor RT membership, RFC 4684 */
+  if (p->rtc && !bgp_rtc_export(p, e))
+    return -1;
+
   /* Accept non-BGP routes */
   if (src == NULL)
     return 0;
@@ -1801,6 +2083,65 @@ bgp_update_attrs(struct bgp_proto *p, struct bgp_channel *c, rte *e, ea_list *at
   return bgp_export_attrs(&s, attrs);
 }
 
+/*
+ * Exported changes may be held before an UPDATE is scheduled. With update
+ * packing, changes are held for up to pack_time, so prefixes arriving in a
+ * burst share buckets and fill UPDATE messages better; the hold ends early
+ * when the held prefixes would fill an UPDATE message anyway. With minimum
+ * route advertisement interval (MRAI), rounds of UPDATEs start at least mrai
+ * apart. Repeated changes of a prefix during the hold just move its
+ * &bgp_prefix between buckets, so only its last state is sent. Changes
+ * arriving while UPDATEs are being sent join the current round.
+ */
+static void
+bgp_schedule_update(struct bgp_proto *p, struct bgp_channel *c, const net_addr *n)
+{
+  btime now = current_time();
+  btime hold = 0;
+
+  if (c->packets_to_send & (1 << PKT_UPDATE))
+    goto send;
+
+  if (c->cf->mrai && (c->last_update + c->cf->mrai > now))
+    hold = c->last_update + c->cf->mrai - now;
+
+  if (c->cf->pack_time)
+  {
+    c->pack_bytes += 1 + BYTES(net_pxlen(n)) + (c->add_path_tx ? 4 : 0);
+    if (!hold && (c->pack_bytes >= bgp_max_packet_length(p->conn)))
+      goto send;
+
+    hold = MAX(hold, c->cf->pack_time);
+  }
+
+  if (!hold)
+    goto send;
+
+  if (!tm_active(c->update_timer))
+    tm_start(c->update_timer, hold);
+
+  return;
+
+send:
+  tm_stop(c->update_timer);
+  c->pack_bytes = 0;
+  c->last_update = now;
+  bgp_schedule_packet(p->conn, c, PKT_UPDATE);
+}
+
+void
+bgp_update_timeout(timer *t)
+{
+  struct bgp_channel *c = t->data;
+  struct bgp_proto *p = (void *) c->c.proto;
+
+  c->pack_bytes = 0;
+  c->last_update = current_time();
+
+  if (p->conn && (p->conn->state == BS_ESTABLISHED))
+    bgp_schedule_packet(p->conn, c, PKT_UPDATE);
+}
+
 void
 bgp_rt_notify(struct proto *P, struct channel *C, net *n, rte *new, rte *old)
 {
@@ -1827,9 +2168,24 @@ bgp_rt_notify(struct proto *P, struct channel *C, net *n, rte *new, rte *old)
   }
 
   px = bgp_get_prefix(c, n->n.addr, c->add_path_tx ? path : 0);
-  add_tail(&buck->prefixes, &px->buck_node);
 
-  bgp_schedule_packet(p->conn, c, PKT_UPDATE);
+  /* Priority routes go first in the next UPDATE */
+  if (rte_is_priority(new ?: old))
+  {
+    add_head(&buck->prefixes, &px->buck_node);
+
+    if (buck != c->withdraw_bucket)
+      bgp_prioritize_bucket(c, buck);
+  }
+  else
+    add_tail(&buck->prefixes, &px->buck_node);
+
+  /* Do not let feeding fill the queue faster than the session sends it */
+  if ((c->c.export_state == ES_FEEDING) && c->cf->export_queue_limit &&
+      (c->prefix_hash.count >= c->cf->export_queue_limit))
+    channel_pause_feed(&c->c);
+
+  bgp_schedule_update(p, c, n->n.addr);
 }
 
 
@@ -1860,11 +2216,56 @@ rte_stale(rte *r)
   return r->u.bgp.stale;
 }
 
+/*
+ * The leading attribute-based criteria of the best route selection (local
+ * preference, AS path length and origin) are packed to one integer, where a
+ * higher value means a better route, and cached in the rta. Routes with AIGP
+ * metric are compared in the full way, as AIGP goes between local preference
+ * and AS path length and its value depends on the IGP metric.
+ */
+#define BGP_KEY_VALID		1
+#define BGP_KEY_AIGP		2
+#define BGP_KEY_MASK		(~0xffULL)
+#define BGP_KEY_PATH_MASK	(0xffffULL << 16)
+
+static u64
+bgp_rte_key(rte *r)
+{
+  rta *a = r->attrs;
+
+  /* Only cached rta is immutable, others may have a stale copied key */
+  if (rta_is_cached(a) && a->pref_key)
+    return a->pref_key;
+
+  struct bgp_proto *p = (struct bgp_proto *) a->src->proto;
+  eattr *e;
+
+  e = ea_find(a->eattrs, EA_CODE(PROTOCOL_BGP, BA_LOCAL_PREF));
+  u32 lpref = e ? e->u.data : p->cf->default_local_pref;
+
+  e = ea_find(a->eattrs, EA_CODE(PROTOCOL_BGP, BA_AS_PATH));
+  u32 len = e ? as_path_getlen(e->u.ptr) : AS_PATH_MAXLEN;
+
+  e = ea_find(a->eattrs, EA_CODE(PROTOCOL_BGP, BA_ORIGIN));
+  u32 origin = e ? e->u.data : ORIGIN_INCOMPLETE;
+
+  u64 key = ((u64) lpref << 32) |
+    ((u64) (0xffff - MIN(len, 0xffff)) << 16) |
+    ((0xff - MIN(origin, 0xff)) << 8) |
+    (ea_find(a->eattrs, EA_CODE(PROTOCOL_BGP, BA_AIGP)) ? BGP_KEY_AIGP : 0) |
+    BGP_KEY_VALID;
+
+  if (rta_is_cached(a))
+    a->pref_key = key;
+
+  return key;
+}
+
 int
 bgp_rte_better(rte *new, rte *old)
 {
-  struct bgp_proto *new_bgp = (struct bgp_proto *) new->attrs->src->proto;
-  struct bgp_proto *old_bgp = (struct bgp_proto *) old->attrs->src->proto;
+  struct bgp_proto *new_bgp = (struct bgp_proto *) new->src_proto;
+  struct bgp_proto *old_bgp = (struct bgp_proto *) old->src_proto;
   eattr *x, *y;
   u32 n, o;
 
@@ -1892,6 +2293,26 @@ bgp_rte_better(rte *new, rte *old)
   if (n < o)
     return 1;
 
+  /* Local preferences, AS path lengths and origins by cached keys */
+  u64 kn = bgp_rte_key(new);
+  u64 ko = bgp_rte_key(old);
+  if (!((kn | ko) & BGP_KEY_AIGP))
+  {
+    kn &= BGP_KEY_MASK;
+    ko &= BGP_KEY_MASK;
+
+    if (!new_bgp->cf->compare_path_lengths && !old_bgp->cf->compare_path_lengths)
+    {
+      kn &= ~BGP_KEY_PATH_MASK;
+      ko &= ~BGP_KEY_PATH_MASK;
+    }
+
+    if (kn != ko)
+      return kn > ko;
+
+    goto med;
+  }
+
  /* Start with local preferences */
   x = ea_find(new->attrs->eattrs, EA_CODE(PROTOCOL_BGP, BA_LOCAL_PREF));
   y = ea_find(old->attrs->eattrs, EA_CODE(PROTOCOL_BGP, BA_LOCAL_PREF));
@@ -1933,6 +2354,7 @@ bgp_rte_better(rte *new, rte *old)
   if (n > o)
     return 0;
 
+med:
   /* RFC 4271 9.1.2.2. c) Compare MED's */
   /* Proper RFC 4271 path selection cannot be interpreted as finding
    * the best path in some ordering. It is implemented partially in
@@ -2008,8 +2430,8 @@ bgp_rte_better(rte *new, rte *old)
 int
 bgp_rte_mergable(rte *pri, rte *sec)
 {
-  struct bgp_proto *pri_bgp = (struct bgp_proto *) pri->attrs->src->proto;
-  struct bgp_proto *sec_bgp = (struct bgp_proto *) sec->attrs->src->proto;
+  struct bgp_proto *pri_bgp = (struct bgp_proto *) pri->src_proto;
+  struct bgp_proto *sec_bgp = (struct bgp_proto *) sec->src_proto;
   eattr *x, *y;
   u32 p, s;
 
@@ -2025,35 +2447,17 @@ bgp_rte_mergable(rte *pri, rte *sec)
   if (rte_stale(pri) != rte_stale(sec))
     return 0;
 
-  /* Start with local preferences */
-  x = ea_find(pri->attrs->eattrs, EA_CODE(PROTOCOL_BGP, BA_LOCAL_PREF));
-  y = ea_find(sec->attrs->eattrs, EA_CODE(PROTOCOL_BGP, BA_LOCAL_PREF));
-  p = x ? x->u.data : pri_bgp->cf->default_local_pref;
-  s = y ? y->u.data : sec_bgp->cf->default_local_pref;
-  if (p != s)
-    return 0;
+  /* Local preferences, AS path lengths and origins by cached keys */
+  u64 kp = bgp_rte_key(pri) & BGP_KEY_MASK;
+  u64 ks = bgp_rte_key(sec) & BGP_KEY_MASK;
 
-  /* RFC 4271 9.1.2.2. a)  Use AS path lengths */
-  if (pri_bgp->cf->compare_path_lengths || sec_bgp->cf->compare_path_lengths)
+  if (!pri_bgp->cf->compare_path_lengths && !sec_bgp->cf->compare_path_lengths)
   {
-    x = ea_find(pri->attrs->eattrs, EA_CODE(PROTOCOL_BGP, BA_AS_PATH));
-    y = ea_find(sec->attrs->eattrs, EA_CODE(PROTOCOL_BGP, BA_AS_PATH));
-    p = x ? as_path_getlen(x->u.ptr) : AS_PATH_MAXLEN;
-    s = y ? as_path_getlen(y->u.ptr) : AS_PATH_MAXLEN;
-
-    if (p != s)
-      return 0;
-
-//    if (DELTA(p, s) > pri_bgp->cf->relax_multipath)
-//      return 0;
+    kp &= ~BGP_KEY_PATH_MASK;
+    ks &= ~BGP_KEY_PATH_MASK;
   }
 
-  /* RFC 4271 9.1.2.2. b) Use origins */
-  x = ea_find(pri->attrs->eattrs, EA_CODE(PROTOCOL_BGP, BA_ORIGIN));
-  y = ea_find(sec->attrs->eattrs, EA_CODE(PROTOCOL_BGP, BA_ORIGIN));
-  p = x ? x->u.data : ORIGIN_INCOMPLETE;
-  s = y ? y->u.data : ORIGIN_INCOMPLETE;
-  if (p != s)
+  if (kp != ks)
     return 0;
 
   /* RFC 4271 9.1.2.2. c) Compare MED's */
@@ -2093,7 +2497,7 @@ same_group(rte *r, u32 lpref, u32 lasn)
 static inline int
 use_deterministic_med(rte *r)
 {
-  struct proto *P = r->attrs->src->proto;
+  struct proto *P = r->src_proto;
   return (P->proto == &proto_bgp) && ((struct bgp_proto *) P)->cf->deterministic_med;
 }
 
@@ -49,7 +49,9 @@
  * buffer becomes empty, we call bgp_fire_tx(). It inspects state of all the
  * packet type bits and calls the corresponding bgp_create_xx() functions,
  * eventually rescheduling the same packet type if we have more data of the same
- * type to send.
+ * type to send. Packets are batched in the transmit buffer as long as there is
+ * room for another message of maximum length, and the whole batch is written
+ * to the socket at once.
  *
  * The processing of attributes consists of two functions: bgp_decode_attrs()
  * for checking of the attribute blocks and translating them to the language of
@@ -115,6 +117,7 @@
 #include "nest/route.h"
 #include "nest/cli.h"
 #include "nest/locks.h"
+#include "nest/metrics.h"
 #include "conf/conf.h"
 #include "filter/filter.h"
 #include "lib/socket.h"
@@ -122,6 +125,7 @@
 #include "lib/string.h"
 
 #include "bgp.h"
+#include "proto/bmp/bmp.h"
 
 
 struct linpool *bgp_linpool;		/* Global temporary pool */
@@ -377,8 +381,11 @@ bgp_close_conn(struct bgp_conn *conn)
   // struct bgp_proto *p = conn->bgp;
 
   DBG("BGP: Closing connection\n");
+  bgp_ka_stop(conn);
   conn->packets_to_send = 0;
   conn->channels_to_send = 0;
+  conn->tx_len = 0;
+  conn->rx_pos = 0;
   rfree(conn->connect_timer);
   conn->connect_timer = NULL;
   rfree(conn->keepalive_timer);
@@ -394,6 +401,11 @@ bgp_close_conn(struct bgp_conn *conn)
   conn->local_caps = NULL;
   mb_free(conn->remote_caps);
   conn->remote_caps = NULL;
+
+  mb_free(conn->local_open_msg);
+  conn->local_open_msg = NULL;
+  mb_free(conn->remote_open_msg);
+  conn->remote_open_msg = NULL;
 }
 
 
@@ -634,8 +646,8 @@ bgp_conn_enter_established_state(struct bgp_conn *conn)
     /* Remember last LLGR stale time */
     c->stale_time = local->llgr_aware ? rem->llgr_time : 0;
 
-    /* Channels not able to recover gracefully */
-    if (p->p.gr_recovery && (!active || !peer_gr_ready))
+    /* Channels not able to recover gracefully or not negotiated at all */
+    if (!active || (p->p.gr_recovery && !peer_gr_ready))
       channel_graceful_restart_unlock(&c->c);
 
     /* Channels waiting for local convergence */
@@ -659,6 +671,8 @@ bgp_conn_enter_established_state(struct bgp_conn *conn)
     c->ext_next_hop = c->cf->ext_next_hop && (bgp_channel_is_ipv6(c) || rem->ext_next_hop);
     c->add_path_rx = (loc->add_path & BGP_ADD_PATH_RX) && (rem->add_path & BGP_ADD_PATH_TX);
     c->add_path_tx = (loc->add_path & BGP_ADD_PATH_TX) && (rem->add_path & BGP_ADD_PATH_RX);
+    c->orf_rx = (loc->orf & BGP_ORF_RX) && (rem->orf & BGP_ORF_TX) &&
+      local->route_refresh && peer->route_refresh;
 
     if (active)
       summary_add_path_rx |= !c->add_path_rx ? 1 : 2;
@@ -670,6 +684,8 @@ bgp_conn_enter_established_state(struct bgp_conn *conn)
       c->c.ra_mode = RA_ACCEPTED;
     else
       c->c.ra_mode = RA_OPTIMAL;
+
+    c->c.ra_limit = c->add_path_tx ? c->cf->add_path_limit : 0;
   }
 
   p->afi_map = mb_alloc(p->p.pool, num * sizeof(u32));
@@ -689,7 +705,19 @@ bgp_conn_enter_established_state(struct bgp_conn *conn)
   /* proto_notify_state() will likely call bgp_feed_begin(), setting c->feed_state */
 
   bgp_conn_set_state(conn, BS_ESTABLISHED);
+  bgp_ka_start(conn);
+
+  /* RT membership has to be exchanged before VPN routes, RFC 4684 */
+  const struct bgp_af_caps *rtc = bgp_find_af_caps(peer, BGP_AF_RTC);
+  if (p->cf->rtc && rtc && rtc->ready)
+  {
+    bgp_rtc_init(p);
+    conn->rtc_sent = 0;
+    bgp_schedule_packet(conn, NULL, PKT_RTC_UPDATE);
+  }
+
   proto_notify_state(&p->p, PS_UP);
+  bmp_peer_up(conn);
 }
 
 static void
@@ -698,6 +726,8 @@ bgp_conn_leave_established_state(struct bgp_proto *p)
   BGP_TRACE(D_EVENTS, "BGP session closed");
   p->last_established = current_time();
   p->conn = NULL;
+  bmp_peer_down(p);
+  bgp_rtc_free(p);
 
   if (p->p.proto_state == PS_UP)
     bgp_stop(p, 0, NULL, 0);
@@ -797,6 +827,9 @@ bgp_handle_graceful_restart(struct bgp_proto *p)
     bgp_init_bucket_table(c);
     bgp_init_prefix_table(c);
     c->packets_to_send = 0;
+    tm_stop(c->update_timer);
+    c->pack_bytes = 0;
+    c->last_update = 0;
   }
 
   /* p->gr_ready -> at least one active channel is c->gr_ready */
@@ -936,7 +969,7 @@ bgp_refresh_end(struct bgp_channel *c)
   rt_refresh_end(c->c.table, &c->c);
 
   if (c->c.in_table)
-    rt_prune_sync(c->c.in_table, 0);
+    rt_prune_sync(c->c.in_table, &c->c, 0);
 }
 
 
@@ -1038,6 +1071,61 @@ bgp_hold_timeout(timer *t)
     bgp_error(conn, 4, 0, NULL, 0);
 }
 
+static int
+bgp_initial_sync(struct bgp_proto *p)
+{
+  struct bgp_channel *c;
+
+  WALK_LIST(c, p->p.channels)
+    if ((c->feed_state == BFS_LOADING) || (c->feed_state == BFS_LOADED) ||
+	(c->load_state == BFS_LOADING))
+      return 1;
+
+  return 0;
+}
+
+/**
+ * bgp_tune_buffers - adapt kernel socket buffers during initial sync
+ * @conn: BGP connection
+ *
+ * Full table transfers over connections with high bandwidth-delay product may
+ * be limited by kernel socket buffers instead of the network. While routes are
+ * initially exchanged, the send buffer is grown to twice the data allowed in
+ * flight by the congestion window and the receive buffer to twice the kernel
+ * estimate of needed receive space, both up to the configured limit. It is
+ * called when the send buffer is full or after received data are processed,
+ * and checks the connection at most once per second.
+ */
+void
+bgp_tune_buffers(struct bgp_conn *conn)
+{
+  struct bgp_proto *p = conn->bgp;
+  uint limit = p->cf->tcp_buffer_limit;
+  struct sk_tcp_info ti;
+
+  if (!limit || !conn->sk || (conn->state != BS_ESTABLISHED))
+    return;
+
+  if (current_time() < (conn->last_buffer_tune + 1 S))
+    return;
+
+  conn->last_buffer_tune = current_time();
+
+  if (!bgp_initial_sync(p) || (sk_get_tcp_info(conn->sk, &ti) < 0))
+    return;
+
+  uint snd = MIN((u64) 2 * ti.snd_cwnd * ti.snd_mss, limit);
+  uint rcv = MIN((u64) 2 * ti.rcv_space, limit);
+
+  if ((snd <= ti.sndbuf) && (rcv <= ti.rcvbuf))
+    return;
+
+  BGP_TRACE(D_EVENTS, "Growing socket buffers to %u B rx / %u B tx", MAX(rcv, ti.rcvbuf), MAX(snd, ti.sndbuf));
+
+  if (sk_grow_kernel_buffers(conn->sk, rcv, snd) < 0)
+    sk_log_error(conn->sk, p->p.name);
+}
+
 static void
 bgp_keepalive_timeout(timer *t)
 {
@@ -1060,7 +1148,7 @@ bgp_setup_conn(struct bgp_proto *p, struct bgp_conn *conn)
   conn->packets_to_send = 0;
   conn->channels_to_send = 0;
   conn->last_channel = 0;
-  conn->last_channel_count = 0;
+  conn->last_buffer_tune = 0;
 
   conn->connect_timer	= tm_new_init(p->p.pool, bgp_connect_timeout,	 conn, 0, 0);
   conn->hold_timer 	= tm_new_init(p->p.pool, bgp_hold_timeout,	 conn, 0, 0);
@@ -1146,10 +1234,69 @@ err:
 static inline int bgp_is_dynamic(struct bgp_proto *p)
 { return ipa_zero(p->remote_ip); }
 
+/*
+ * Active BGP protocols are indexed for lookup of incoming connections. The
+ * protocols with a fixed remote address are kept in a hash table keyed by VRF,
+ * remote address and local port, the dynamic ones (with a remote range) in a
+ * separate list. Protocols are indexed from bgp_start() until bgp_cleanup().
+ */
+
+#define BRH_KEY(n)		n->p.vrf, n->remote_ip, n->cf->local_port
+#define BRH_NEXT(n)		n->next_remote
+#define BRH_EQ(v1,a1,l1,v2,a2,l2) v1 == v2 && ipa_equal(a1, a2) && l1 == l2
+#define BRH_FN(v,a,l)		ptr_hash(v) ^ ipa_hash(a) ^ u32_hash(l)
+
+#define BRH_REHASH		bgp_brh_rehash
+#define BRH_PARAMS		/8, *2, 2, 2, 6, 20
+
+HASH_DEFINE_REHASH_FN(BRH, struct bgp_proto)
+
+static HASH(struct bgp_proto) bgp_remote_hash;
+static list bgp_dynamic_protos;
+
+static void
+bgp_index_proto(struct bgp_proto *p)
+{
+  if (!bgp_remote_hash.data)
+  {
+    HASH_INIT(bgp_remote_hash, proto_pool, 6);
+    init_list(&bgp_dynamic_protos);
+  }
+
+  if (bgp_is_dynamic(p))
+    add_tail(&bgp_dynamic_protos, &p->dynamic_node);
+  else
+    HASH_INSERT2(bgp_remote_hash, BRH, proto_pool, p);
+}
+
+static void
+bgp_unindex_proto(struct bgp_proto *p)
+{
+  if (bgp_is_dynamic(p))
+    rem_node(&p->dynamic_node);
+  else
+    HASH_REMOVE2(bgp_remote_hash, BRH, proto_pool, p);
+}
+
+static inline int
+bgp_match_proto(struct bgp_proto *p, sock *sk, int link)
+{
+  return (ipa_equal(p->remote_ip, sk->daddr) || bgp_is_dynamic(p)) &&
+    (!p->cf->remote_range || ipa_in_netX(sk->daddr, p->cf->remote_range)) &&
+    (p->p.vrf == sk->vrf) &&
+    (p->cf->local_port == sk->sport) &&
+    (!link || (p->cf->iface == sk->iface)) &&
+    (ipa_zero(p->cf->local_ip) || ipa_equal(p->cf->local_ip, sk->saddr));
+}
+
 /**
  * bgp_find_proto - find existing proto for incoming connection
  * @sk: TCP socket
  *
+ * Active protocols are found in the index, a protocol with a fixed remote
+ * address is preferred to dynamic ones. When no active protocol matches, all
+ * protocols are checked, so connections to inactive protocols are rejected as
+ * known, not logged as unexpected.
  */
 static struct bgp_proto *
 bgp_find_proto(sock *sk)
@@ -1160,14 +1307,24 @@ bgp_find_proto(sock *sk)
   /* sk->iface is valid only if src or dst address is link-local */
   int link = ipa_is_link_local(sk->saddr) || ipa_is_link_local(sk->daddr);
 
+  if (bgp_remote_hash.data)
+  {
+    /* Protocols with the same key may differ by interface or local address */
+    for (p = *HASH_CHAIN(bgp_remote_hash, BRH, sk->vrf, sk->daddr, sk->sport); p; p = p->next_remote)
+      if (bgp_match_proto(p, sk, link))
+	return p;
+
+    node *n;
+    WALK_LIST2(p, n, bgp_dynamic_protos, dynamic_node)
+      if (bgp_match_proto(p, sk, link))
+	best = p;
+
+    if (best)
+      return best;
+  }
+
   WALK_LIST(p, proto_list)
-    if ((p->p.proto == &proto_bgp) &&
-	(ipa_equal(p->remote_ip, sk->daddr) || bgp_is_dynamic(p)) &&
-	(!p->cf->remote_range || ipa_in_netX(sk->daddr, p->cf->remote_range)) &&
-	(p->p.vrf == sk->vrf) &&
-	(p->cf->local_port == sk->sport) &&
-	(!link || (p->cf->iface == sk->iface)) &&
-	(ipa_zero(p->cf->local_ip) || ipa_equal(p->cf->local_ip, sk->saddr)))
+    if ((p->p.proto == &proto_bgp) && bgp_match_proto(p, sk, link))
     {
       best = p;
 
@@ -1532,6 +1689,8 @@ bgp_start(struct proto *P)
   p->gr_ready = 0;
   p->gr_active_num = 0;
 
+  bgp_index_proto(p);
+
   /* Reset some stats */
   p->stats.rx_messages = p->stats.tx_messages = 0;
   p->stats.rx_updates = p->stats.tx_updates = 0;
@@ -1549,8 +1708,8 @@ bgp_start(struct proto *P)
   p->remote_id = 0;
   p->link_addr = IPA_NONE;
 
-  /* Lock all channels when in GR recovery mode */
-  if (p->p.gr_recovery && p->cf->gr_mode)
+  /* Lock all channels when in GR recovery mode or in startup convergence */
+  if ((p->p.gr_recovery && p->cf->gr_mode) || startup_convergence_pending())
   {
     struct bgp_channel *c;
     WALK_LIST(c, p->p.channels)
@@ -1669,6 +1828,14 @@ done:
   return p->p.proto_state;
 }
 
+static void
+bgp_cleanup(struct proto *P)
+{
+  struct bgp_proto *p = (struct bgp_proto *) P;
+
+  bgp_unindex_proto(p);
+}
+
 static struct proto *
 bgp_init(struct proto_config *CF)
 {
@@ -1753,6 +1920,10 @@ bgp_channel_start(struct channel *C)
     channel_setup_out_table(C);
 
   c->stale_timer = tm_new_init(c->pool, bgp_long_lived_stale_timeout, c, 0, 0);
+  c->update_timer = tm_new_init(c->pool, bgp_update_timeout, c, 0, 0);
+
+  if (c->cf->damping)
+    bgp_damp_init(c);
 
   c->next_hop_addr = c->cf->next_hop_addr;
   c->link_addr = IPA_NONE;
@@ -1813,6 +1984,15 @@ bgp_channel_shutdown(struct channel *C)
   c->next_hop_addr = IPA_NONE;
   c->link_addr = IPA_NONE;
   c->packets_to_send = 0;
+
+  tm_stop(c->update_timer);
+  c->pack_bytes = 0;
+  c->last_update = 0;
+
+  bgp_damp_free(c);
+  bgp_orf_free(c);
+  c->orf_rx = 0;
+  bgp_leave_update_group(c);
 }
 
 static void
@@ -1828,6 +2008,8 @@ bgp_channel_cleanup(struct channel *C)
 
   c->index = 0;
 
+  bgp_leave_update_group(c);
+
   /* Cleanup rest of bgp_channel starting at pool field */
   memset(&(c->pool), 0, sizeof(struct bgp_channel) - OFFSETOF(struct bgp_channel, pool));
 }
@@ -2032,6 +2214,25 @@ bgp_postconfig(struct proto_config *CF)
 
     if (cc->secondary && !cc->c.table->sorted)
       cf_error("BGP with secondary option requires sorted table");
+
+    /* Default damping parameters from RFC 2439 */
+    if (!cc->damp_half_life)
+      cc->damp_half_life = 15 S_ * 60;
+
+    if (!cc->damp_reuse)
+      cc->damp_reuse = 750;
+
+    if (!cc->damp_suppress)
+      cc->damp_suppress = 2000;
+
+    if (!cc->damp_max_suppress)
+      cc->damp_max_suppress = 60 S_ * 60;
+
+    if (cc->damp_reuse >= cc->damp_suppress)
+      cf_error("Damping reuse limit must be lower than suppress limit");
+
+    if (cc->damp_max_suppress < cc->damp_half_life)
+      cf_error("Damping max suppress time must not be shorter than half life");
   }
 }
 
@@ -2053,7 +2254,8 @@ bgp_reconfigure(struct proto *P, struct proto_config *CF)
     && ((!old->remote_range && !new->remote_range)
 	|| (old->remote_range && new->remote_range && net_equal(old->remote_range, new->remote_range)))
     && !bstrcmp(old->dynamic_name, new->dynamic_name)
-    && (old->dynamic_name_digits == new->dynamic_name_digits);
+    && (old->dynamic_name_digits == new->dynamic_name_digits)
+    && bgp_rtc_same(old->rtc_members, new->rtc_members);
 
   /* FIXME: Move channel reconfiguration to generic protocol code ? */
   struct channel *C, *C2;
@@ -2105,8 +2307,11 @@ bgp_channel_reconfigure(struct channel *C, struct channel_config *CC, int *impor
       (new->llgr_time != old->llgr_time) ||
       (new->ext_next_hop != old->ext_next_hop) ||
       (new->add_path != old->add_path) ||
+      (new->add_path_limit != old->add_path_limit) ||
       (new->import_table != old->import_table) ||
       (new->export_table != old->export_table) ||
+      (new->damping != old->damping) ||
+      (new->orf != old->orf) ||
       (IGP_TABLE(new, ip4) != IGP_TABLE(old, ip4)) ||
       (IGP_TABLE(new, ip6) != IGP_TABLE(old, ip6)))
     return 0;
@@ -2290,6 +2495,7 @@ bgp_show_capabilities(struct bgp_proto *p UNUSED, struct bgp_caps *caps)
   uint any_mp_bgp = 0;
   uint any_gr_able = 0;
   uint any_add_path = 0;
+  uint any_orf = 0;
   uint any_ext_next_hop = 0;
   uint any_llgr_able = 0;
   u32 *afl1 = alloca(caps->af_count * sizeof(u32));
@@ -2301,6 +2507,7 @@ bgp_show_capabilities(struct bgp_proto *p UNUSED, struct bgp_caps *caps)
     any_mp_bgp |= ac->ready;
     any_gr_able |= ac->gr_able;
     any_add_path |= ac->add_path;
+    any_orf |= ac->orf;
     any_ext_next_hop |= ac->ext_next_hop;
     any_llgr_able |= ac->llgr_able;
   }
@@ -2320,6 +2527,24 @@ bgp_show_capabilities(struct bgp_proto *p UNUSED, struct bgp_caps *caps)
   if (caps->route_refresh)
     cli_msg(-1006, "      Route refresh");
 
+  if (any_orf)
+  {
+    cli_msg(-1006, "      Prefix ORF");
+
+    afn1 = afn2 = 0;
+    WALK_AF_CAPS(caps, ac)
+    {
+      if (ac->orf & BGP_ORF_RX)
+	afl1[afn1++] = ac->afi;
+
+      if (ac->orf & BGP_ORF_TX)
+	afl2[afn2++] = ac->afi;
+    }
+
+    bgp_show_afis(-1006, "        RX:", afl1, afn1);
+    bgp_show_afis(-1006, "        TX:", afl2, afn2);
+  }
+
   if (any_ext_next_hop)
   {
     cli_msg(-1006, "      Extended next hop");
@@ -2464,6 +2689,19 @@ bgp_show_proto_info(struct proto *P)
 	    tm_remains(p->conn->hold_timer), p->conn->hold_time);
     cli_msg(-1006, "    Keepalive timer:  %t/%u",
 	    tm_remains(p->conn->keepalive_timer), p->conn->keepalive_time);
+
+    struct sk_tcp_info ti;
+    if (p->conn->sk && (sk_get_tcp_info(p->conn->sk, &ti) >= 0))
+    {
+      cli_msg(-1006, "    TCP RTT:          %u.%03u ms (variation %u.%03u ms)",
+	      ti.rtt / 1000, ti.rtt % 1000, ti.rttvar / 1000, ti.rttvar % 1000);
+      cli_msg(-1006, "    TCP window:       %u segments of %u B, %u unacked",
+	      ti.snd_cwnd, ti.snd_mss, ti.unacked);
+      cli_msg(-1006, "    TCP retransmits:  %u now / %u total",
+	      ti.retrans, ti.total_retrans);
+      cli_msg(-1006, "    Socket buffers:   %u B rx / %u B tx",
+	      ti.rcvbuf, ti.sndbuf);
+    }
   }
 
   struct bgp_stats *s = &p->stats;
@@ -2475,6 +2713,8 @@ bgp_show_proto_info(struct proto *P)
 	  s->tx_messages, s->tx_updates, s->tx_bytes);
   cli_msg(-1006, "    Last rcvd update elapsed time: %t s",
 	  p->last_rx_update ? (current_time() - p->last_rx_update) : 0);
+  cli_msg(-1006, "    Memory:           %lu kB in %u resources",
+	  (u64) (rmemsize(P->pool) + 512) / 1024, rp_count(P->pool));
 
   if ((p->last_error_class != BE_NONE) &&
       (p->last_error_class != BE_MAN_DOWN))
@@ -2504,6 +2744,21 @@ bgp_show_proto_info(struct proto *P)
 	  cli_msg(-1006, "    BGP Next hop:   %I %I", c->next_hop_addr, c->link_addr);
       }
 
+      if (c->damp)
+	cli_msg(-1006, "    Damping:        %u tracked, %u suppressed",
+		c->damp->count, c->damp->suppressed);
+
+      if (c->orf)
+	cli_msg(-1006, "    Prefix ORF:     %u entries", c->orf->count);
+
+      if (p->rtc && ((c->desc->net == NET_VPN4) || (c->desc->net == NET_VPN6)))
+	cli_msg(-1006, "    RT membership:  %u received%s", p->rtc->nlri_hash.count,
+		p->rtc->any ? ", all targets" : "");
+
+      if (c->group && (c->group->uc > 1))
+	cli_msg(-1006, "    Update group:   %u channels, %lu hits, %lu misses",
+		c->group->uc, c->group->hits, c->group->misses);
+
       if (c->igp_table_ip4)
 	cli_msg(-1006, "    IGP IPv4 table: %s", c->igp_table_ip4->name);
 
@@ -2513,6 +2768,33 @@ bgp_show_proto_info(struct proto *P)
   }
 }
 
+static const struct proto_metric bgp_metrics[] = {
+  { "bgp_rx_messages_total", "Number of received BGP messages" },
+  { "bgp_tx_messages_total", "Number of sent BGP messages" },
+  { "bgp_rx_updates_total", "Number of received BGP updates" },
+  { "bgp_tx_updates_total", "Number of sent BGP updates" },
+  { "bgp_rx_bytes_total", "Number of received bytes in BGP messages" },
+  { "bgp_tx_bytes_total", "Number of sent bytes in BGP messages" },
+  { "bgp_established_transitions_total", "Number of transitions to Established state" },
+  { "bgp_session_up", "Whether BGP session is established", 1 },
+  { NULL }
+};
+
+static void
+bgp_get_metrics(struct proto *P, u64 *vals)
+{
+  struct bgp_proto *p = (void *) P;
+
+  vals[0] = p->stats.rx_messages;
+  vals[1] = p->stats.tx_messages;
+  vals[2] = p->stats.rx_updates;
+  vals[3] = p->stats.tx_updates;
+  vals[4] = p->stats.rx_bytes;
+  vals[5] = p->stats.tx_bytes;
+  vals[6] = p->stats.fsm_established_transitions;
+  vals[7] = (p->p.proto_state == PS_UP);
+}
+
 struct channel_class channel_bgp = {
   .channel_size =	sizeof(struct bgp_channel),
   .config_size =	sizeof(struct bgp_channel_config),
@@ -2531,14 +2813,18 @@ struct protocol proto_bgp = {
   .channel_mask =	NB_IP | NB_VPN | NB_FLOW,
   .proto_size =		sizeof(struct bgp_proto),
   .config_size =	sizeof(struct bgp_config),
+  .rte_size =		RTE_SIZE(bgp),
   .postconfig =		bgp_postconfig,
   .init = 		bgp_init,
   .start = 		bgp_start,
   .shutdown = 		bgp_shutdown,
+  .cleanup =		bgp_cleanup,
   .reconfigure = 	bgp_reconfigure,
   .copy_config = 	bgp_copy_config,
   .get_status = 	bgp_get_status,
   .get_attr = 		bgp_get_attr,
   .get_route_info = 	bgp_get_route_info,
-  .show_proto_info = 	bgp_show_proto_info
+  .show_proto_info = 	bgp_show_proto_info,
+  .metrics =		bgp_metrics,
+  .get_metrics =	bgp_get_metrics
 };
@@ -34,6 +34,7 @@ struct eattr;
 #define BGP_SAFI_MPLS		4
 #define BGP_SAFI_MPLS_VPN	128
 #define BGP_SAFI_VPN_MULTICAST	129
+#define BGP_SAFI_RTC		132
 #define BGP_SAFI_FLOW		133
 
 /* Internal AF codes */
@@ -54,6 +55,7 @@ struct eattr;
 #define BGP_AF_VPN6_MC		BGP_AF( BGP_AFI_IPV6, BGP_SAFI_VPN_MULTICAST )
 #define BGP_AF_FLOW4		BGP_AF( BGP_AFI_IPV4, BGP_SAFI_FLOW )
 #define BGP_AF_FLOW6		BGP_AF( BGP_AFI_IPV6, BGP_SAFI_FLOW )
+#define BGP_AF_RTC		BGP_AF( BGP_AFI_IPV4, BGP_SAFI_RTC )
 
 
 struct bgp_write_state;
@@ -104,6 +106,8 @@ struct bgp_config {
   u32 confederation;			/* Confederation ID, or zero if confeds not active */
   int confederation_member;		/* Whether neighbor AS is member of our confederation */
   int passive;				/* Do not initiate outgoing connection */
+  u32 tcp_buffer_limit;			/* Max size of adaptive kernel socket buffers, 0 to disable */
+  int rtc;				/* Exchange RT membership for VPN routes [RFC 4684] */
   int interpret_communities;		/* Hardwired handling of well-known communities */
   int allow_local_as;			/* Allow that number of local ASNs in incoming AS_PATHs */
   int allow_local_pref;			/* Allow LOCAL_PREF in EBGP sessions */
@@ -131,6 +135,7 @@ struct bgp_config {
   int dynamic_name_digits;		/* Minimum number of digits for dynamic names */
   int check_link;			/* Use iface link state for liveness detection */
   int bfd;				/* Use BFD for liveness detection */
+  struct bgp_rtc_member *rtc_members;	/* Announced RT membership, see bgp_rtc_add_member() */
 };
 
 struct bgp_channel_config {
@@ -151,11 +156,21 @@ struct bgp_channel_config {
   uint llgr_time;			/* Long-lived graceful restart stale time */
   u8 ext_next_hop;			/* Allow both IPv4 and IPv6 next hops */
   u8 add_path;				/* Use ADD-PATH extension [RFC 7911] */
+  u8 add_path_limit;			/* Max paths advertised per network with ADD-PATH TX, 0 for all */
   u8 aigp;				/* AIGP is allowed on this session */
   u8 aigp_originate;			/* AIGP is originated automatically */
   u32 cost;				/* IGP cost for direct next hops */
   u8 import_table;			/* Use c.in_table as Adj-RIB-In */
   u8 export_table;			/* Use c.out_table as Adj-RIB-Out */
+  btime pack_time;			/* Hold updates to pack more prefixes to one UPDATE */
+  u32 export_queue_limit;		/* Pause feeding when more prefixes are waiting to be sent */
+  btime mrai;				/* Minimum interval between rounds of UPDATEs */
+  u8 damping;				/* Apply route flap damping to received routes */
+  btime damp_half_life;			/* Time for damping penalty to decay by half */
+  u32 damp_reuse;			/* Penalty below which suppressed routes are reused */
+  u32 damp_suppress;			/* Penalty above which routes are suppressed */
+  btime damp_max_suppress;		/* Max time a route may stay suppressed */
+  u8 orf;				/* Accept Address Prefix ORF from neighbor [RFC 5292] */
 
   struct rtable_config *igp_table_ip4;	/* Table for recursive IPv4 next hop lookups */
   struct rtable_config *igp_table_ip6;	/* Table for recursive IPv6 next hop lookups */
@@ -180,6 +195,13 @@ struct bgp_channel_config {
 #define BGP_ADD_PATH_TX		2
 #define BGP_ADD_PATH_FULL	3
 
+#define BGP_ORF_PREFIX		64	/* Address Prefix ORF type, RFC 5292 */
+#define BGP_ORF_RX		1	/* ORF capability Send/Receive field */
+#define BGP_ORF_TX		2
+
+#define BGP_ORF_IMMEDIATE	1	/* ROUTE-REFRESH When-to-refresh field */
+#define BGP_ORF_DEFER		2
+
 #define BGP_GR_ABLE		1
 #define BGP_GR_AWARE		2
 
@@ -211,6 +233,7 @@ struct bgp_af_caps {
   u8 llgr_flags;			/* Long-lived GR per-AF flags */
   u8 ext_next_hop;			/* Extended IPv6 next hop,   RFC 5549 */
   u8 add_path;				/* Multiple paths support,   RFC 7911 */
+  u8 orf;				/* Address Prefix ORF,       RFC 5292 */
 };
 
 struct bgp_caps {
@@ -228,6 +251,7 @@ struct bgp_caps {
   u8 llgr_aware;			/* Long-lived GR capability, RFC draft */
   u8 any_ext_next_hop;			/* Bitwise OR of per-AF ext_next_hop */
   u8 any_add_path;			/* Bitwise OR of per-AF add_path */
+  u8 any_orf;				/* Bitwise OR of per-AF orf */
 
   u16 af_count;				/* Number of af_data items */
   u16 length;				/* Length of capabilities in OPEN msg */
@@ -269,12 +293,29 @@ struct bgp_conn {
   event *tx_ev;
   u32 packets_to_send;			/* Bitmap of packet types to be sent */
   u32 channels_to_send;			/* Bitmap of channels with packets to be sent */
+  uint tx_len;				/* Length of messages batched in sk->tbuf */
+  uint rx_pos;				/* Offset of unprocessed data in sk->rbuf */
   u8 last_channel;			/* Channel used last time for TX */
-  u8 last_channel_count;		/* Number of times the last channel was used in succession */
   int notify_code, notify_subcode, notify_size;
   byte *notify_data;
+  byte *local_open_msg;			/* Copy of sent OPEN message, for BMP */
+  byte *remote_open_msg;		/* Copy of received OPEN message, for BMP */
+  uint local_open_length, remote_open_length;
 
   uint hold_time, keepalive_time;	/* Times calculated from my and neighbor's requirements */
+
+  /* Keepalive thread state, see keepalive.c */
+  node ka_node;				/* Node in bgp_ka_list, protected by bgp_ka_lock */
+  int ka_fd;				/* Socket fd, as seen by the thread */
+  btime ka_interval;			/* Keepalive time for the thread */
+  btime ka_last_tx;			/* Last write to the socket, protected by bgp_ka_lock */
+  uint ka_sent;				/* Keepalives sent by the thread */
+  u8 ka_active;				/* Registered with the keepalive thread */
+  u8 ka_busy;				/* Main loop is writing, protected by bgp_ka_lock */
+  u8 ka_broken;				/* Thread left a partial message, protected by bgp_ka_lock */
+
+  btime last_buffer_tune;		/* Last check of kernel socket buffers, see bgp_tune_buffers() */
+  uint rtc_sent;			/* Number of RT membership NLRIs already sent */
 };
 
 struct bgp_proto {
@@ -300,6 +341,8 @@ struct bgp_proto {
   u8 llgr_ready;			/* Neighbor could do Long-lived GR, implies gr_ready */
   u8 gr_active_num;			/* Neighbor is doing GR, number of active channels */
   u8 channel_count;			/* Number of active channels */
+  u8 orf_channels;			/* Number of channels with received ORF */
+  struct bgp_rtc *rtc;			/* Received RT membership, NULL if RTC is not negotiated */
   u8 summary_add_path_rx;		/* Summary state of ADD_PATH RX w.r.t active channels */
   u32 *afi_map;				/* Map channel index -> AFI */
   struct bgp_channel **channel_map;	/* Map channel index -> channel */
@@ -311,6 +354,8 @@ struct bgp_proto {
   struct bgp_socket *sock;		/* Shared listening socket */
   struct bfd_request *bfd_req;		/* BFD request, if BFD is used */
   struct birdsock *postponed_sk;	/* Postponed incoming socket for dynamic BGP */
+  struct bgp_proto *next_remote;	/* Node in hash of active protocols by remote address */
+  node dynamic_node;			/* Node in list of active dynamic protocols */
   struct bgp_stats stats;		/* BGP statistics */
   btime last_established;		/* Last time of enter/leave of established state */
   btime last_rx_update;			/* Last time of RX update */
@@ -344,6 +389,7 @@ struct bgp_channel {
   HASH(struct bgp_bucket) bucket_hash;	/* Hash table of route buckets */
   struct bgp_bucket *withdraw_bucket;	/* Withdrawn routes */
   list bucket_queue;			/* Queue of buckets to send (struct bgp_bucket) */
+  struct bgp_update_group *group;	/* Update group sharing encoded attributes */
 
   HASH(struct bgp_prefix) prefix_hash;	/* Prefixes to be sent */
   slab *prefix_slab;			/* Slab holding prefix nodes */
@@ -352,13 +398,21 @@ struct bgp_channel {
   ip_addr link_addr;			/* Link-local version of next_hop_addr */
 
   u32 packets_to_send;			/* Bitmap of packet types to be sent */
+  int tx_deficit;			/* Remaining TX credit in round-robin [bytes] */
 
   u8 ext_next_hop;			/* Session allows both IPv4 and IPv6 next hops */
 
   u8 gr_ready;				/* Neighbor could do GR on this AF */
   u8 gr_active;				/* Neighbor is doing GR (BGP_GRS_*) */
 
+  struct bgp_damp_state *damp;		/* Route flap damping state, see damping.c */
+  struct bgp_orf *orf;			/* Received prefix ORF, see orf.c */
+  u8 orf_rx;				/* Session allows receive of prefix ORF */
+
   timer *stale_timer;			/* Long-lived stale timer for LLGR */
+  timer *update_timer;			/* Timer for held updates, see bgp_schedule_update() */
+  uint pack_bytes;			/* Estimated NLRI bytes held for packing */
+  btime last_update;			/* Start of the last round of UPDATEs */
   u32 stale_time;			/* Stored LLGR stale time from last session */
 
   u8 add_path_rx;			/* Session expects receive of ADD-PATH extended NLRI */
@@ -381,9 +435,100 @@ struct bgp_bucket {
   struct bgp_bucket *next;		/* Node in bucket hash table */
   list prefixes;			/* Prefixes in this bucket (struct bgp_prefix) */
   u32 hash;				/* Hash over extended attributes */
+  byte *encoded;			/* Encoded attribute block, see bgp_cache_bucket_attrs() */
+  uint encoded_length;
   ea_list eattrs[0];			/* Per-bucket extended attributes */
 };
 
+struct bgp_encoded_attrs {
+  struct bgp_encoded_attrs *next;	/* Node in encoded attribute hash table */
+  ea_list *eattrs;			/* Copy of the source attribute list */
+  u32 hash;				/* Hash over extended attributes */
+  uint length;				/* Length of encoded attributes */
+  byte data[0];
+};
+
+struct bgp_update_group {
+  node n;				/* Node in global list of update groups */
+  pool *pool;				/* Pool for encoded attributes */
+  HASH(struct bgp_encoded_attrs) hash;	/* Encoded attributes by source ea_list */
+  uint count;				/* Number of cached encoded attribute blocks */
+  uint uc;				/* Number of channels in the group */
+  u32 afi;				/* Key: AFI/SAFI of member channels */
+  u8 mp_reach;				/* Key: next hop is encoded in MP_REACH_NLRI */
+  u8 as4_session;			/* Key: 4B AS numbers are used */
+  u64 hits;				/* Encodings reused from the cache */
+  u64 misses;				/* Encodings done and stored in the cache */
+};
+
+#define BGP_UPDATE_GROUP_MAX	4096	/* Max cached blocks before the cache is flushed */
+
+struct bgp_damp {
+  node n;				/* Node in damping timer wheel */
+  struct bgp_damp *next;		/* Node in damping hash table */
+  rta *attrs;				/* Last announced route while suppressed */
+  btime updated;			/* Time when penalty was last decayed */
+  btime due;				/* Time of next check (reuse or removal) */
+  u32 penalty;				/* Damping penalty as of updated */
+  u32 path_id;
+  u32 hash;
+  u8 suppressed;			/* Route is suppressed */
+  u8 withdrawn;				/* Last received update was withdrawal */
+  net_addr net[0];
+};
+
+#define BGP_DAMP_SLOTS		64	/* Slots in damping timer wheel */
+#define BGP_DAMP_TICK		(5 S_)	/* Time covered by one slot */
+
+struct bgp_damp_state {
+  HASH(struct bgp_damp) hash;		/* Tracked routes */
+  list wheel[BGP_DAMP_SLOTS];		/* Tracked routes by time of next check */
+  timer *timer;				/* Recurrent timer scanning the wheel */
+  u64 tick;				/* Last scanned tick */
+  uint count;				/* Number of tracked routes */
+  uint suppressed;			/* Number of suppressed routes */
+};
+
+#define BGP_RTC_MAX_LENGTH	96	/* Origin AS and full route target [bits] */
+
+struct bgp_rtc_member {
+  struct bgp_rtc_member *next;
+  u64 rt;				/* Route target, or its prefix */
+  u8 len;				/* RT membership NLRI length [bits], 0 for any */
+};
+
+struct bgp_rtc_entry {
+  struct bgp_rtc_entry *next;		/* Node in NLRI hash */
+  struct bgp_rtc_entry *next_rt;	/* Node in RT hash, for full length entries */
+  node n;				/* Node in partial list, for shorter entries */
+  u64 rt;
+  u32 asn;
+  u8 len;
+};
+
+struct bgp_rtc {
+  HASH(struct bgp_rtc_entry) nlri_hash;	/* Received RT membership NLRIs */
+  HASH(struct bgp_rtc_entry) rt_hash;	/* Full length entries by route target */
+  list partial;				/* Entries with RT prefix (struct bgp_rtc_entry) */
+  uint any;				/* Number of default (zero length) entries */
+  u8 changed;				/* Membership changed since the last refeed */
+};
+
+struct bgp_orf_entry {
+  u32 seq;				/* Sequence number, entries are sorted by it */
+  u8 deny;				/* Match is deny instead of permit */
+  u8 minlen, maxlen;			/* Prefix length range as received, 0 if unspecified */
+  net_addr net;
+};
+
+struct bgp_orf {
+  linpool *lp;				/* Trie storage, flushed on rebuild */
+  struct f_trie *trie;			/* All entries, for quick implicit deny */
+  struct bgp_orf_entry *entries;	/* Entries sorted by sequence number */
+  uint count, size;
+  uint deny_count;			/* Number of deny entries */
+};
+
 struct bgp_export_state {
   struct bgp_proto *proto;
   struct bgp_channel *channel;
@@ -407,11 +552,14 @@ struct bgp_write_state {
   int as4_session;
   int add_path;
   int mpls;
+  int sham;				/* Stand-alone encoding, see bgp_bmp_encode_rte() */
 
   eattr *mp_next_hop;
   const adata *mpls_labels;
 };
 
+#define BGP_NLRI_BATCH		256
+
 struct bgp_parse_state {
   struct bgp_proto *proto;
   struct bgp_channel *channel;
@@ -449,6 +597,12 @@ struct bgp_parse_state {
   struct hostentry *hostentry;
   adata *mpls_labels;
 
+  /* Decoded NLRI waiting for bgp_flush_nlri() */
+  net_addr **nlri_nets;
+  u32 *nlri_ids;
+  uint nlri_count;
+  rta *nlri_attrs;
+
   /* Cached state for bgp_rte_update() */
   u32 last_id;
   struct rte_src *last_src;
@@ -461,9 +615,12 @@ struct bgp_parse_state {
 #define BGP_MAX_MESSAGE_LENGTH	4096
 #define BGP_MAX_EXT_MSG_LENGTH	65535
 #define BGP_RX_BUFFER_SIZE	4096
-#define BGP_TX_BUFFER_SIZE	4096
 #define BGP_RX_BUFFER_EXT_SIZE	65535
-#define BGP_TX_BUFFER_EXT_SIZE	65535
+#define BGP_RX_BUFFER_MAX	(256 * 1024)	/* Max size of adaptively grown RX buffer */
+#define BGP_TX_BATCH_SIZE	32768	/* Messages batched to one write, besides the last one */
+#define BGP_TX_BUFFER_SIZE	BGP_MAX_MESSAGE_LENGTH	/* Initial TX buffer, grown for bulk updates */
+#define BGP_TX_BUFFER_EXT_SIZE	BGP_MAX_EXT_MSG_LENGTH
+#define BGP_TX_QUANTUM		(16 * BGP_MAX_MESSAGE_LENGTH)	/* Round-robin credit per channel turn */
 
 static inline int bgp_channel_is_ipv4(struct bgp_channel *c)
 { return BGP_AFI(c->afi) == BGP_AFI_IPV4; }
@@ -500,6 +657,7 @@ void bgp_conn_enter_openconfirm_state(struct bgp_conn *conn);
 void bgp_conn_enter_established_state(struct bgp_conn *conn);
 void bgp_conn_enter_close_state(struct bgp_conn *conn);
 void bgp_conn_enter_idle_state(struct bgp_conn *conn);
+void bgp_tune_buffers(struct bgp_conn *conn);
 void bgp_handle_graceful_restart(struct bgp_proto *p);
 void bgp_graceful_restart_done(struct bgp_channel *c);
 void bgp_refresh_begin(struct bgp_channel *c);
@@ -563,6 +721,7 @@ bgp_unset_attr(ea_list **to, struct linpool *pool, uint code)
 
 int bgp_encode_attrs(struct bgp_write_state *s, ea_list *attrs, byte *buf, byte *end);
 ea_list * bgp_decode_attrs(struct bgp_parse_state *s, byte *data, uint len);
+ea_list * bgp_decode_attrs_raw(struct linpool *pool, const char *name, byte *data, uint len);
 void bgp_finish_attrs(struct bgp_parse_state *s, rta *a);
 
 void bgp_init_bucket_table(struct bgp_channel *c);
@@ -570,6 +729,12 @@ void bgp_free_bucket_table(struct bgp_channel *c);
 void bgp_free_bucket(struct bgp_channel *c, struct bgp_bucket *b);
 void bgp_defer_bucket(struct bgp_channel *c, struct bgp_bucket *b);
 void bgp_withdraw_bucket(struct bgp_channel *c, struct bgp_bucket *b);
+void bgp_update_timeout(timer *t);
+
+void bgp_join_update_group(struct bgp_channel *c);
+void bgp_leave_update_group(struct bgp_channel *c);
+int bgp_encode_bucket_attrs(struct bgp_write_state *s, struct bgp_bucket *buck, byte *buf, byte *end);
+void bgp_cache_bucket_attrs(struct bgp_channel *c, struct bgp_bucket *buck, const byte *data, uint len);
 
 void bgp_init_prefix_table(struct bgp_channel *c);
 void bgp_free_prefix_table(struct bgp_channel *c);
@@ -599,6 +764,46 @@ bgp_total_aigp_metric(rte *r)
 }
 
 
+/* damping.c */
+
+void bgp_damp_init(struct bgp_channel *c);
+void bgp_damp_free(struct bgp_channel *c);
+uint bgp_damp_import(struct bgp_channel *c, net_addr **nets, uint count, u32 path_id, rta *a);
+
+
+/* orf.c */
+
+int bgp_orf_rx(struct bgp_channel *c, const byte *pos, uint len);
+int bgp_orf_match(struct bgp_channel *c, const net_addr *n);
+int bgp_orf_export(struct bgp_proto *p, rte *e);
+void bgp_orf_free(struct bgp_channel *c);
+
+
+/* rtc.c */
+
+void bgp_rtc_add_member(struct bgp_config *cf, u64 rt, uint len);
+int bgp_rtc_same(const struct bgp_rtc_member *a, const struct bgp_rtc_member *b);
+void bgp_rtc_init(struct bgp_proto *p);
+void bgp_rtc_free(struct bgp_proto *p);
+void bgp_rtc_update(struct bgp_proto *p, u32 asn, uint len, u64 rt, int add);
+void bgp_rtc_refeed(struct bgp_proto *p);
+int bgp_rtc_export(struct bgp_proto *p, rte *e);
+
+
+/* keepalive.c */
+
+#ifdef USE_PTHREADS
+void bgp_ka_start(struct bgp_conn *conn);
+void bgp_ka_stop(struct bgp_conn *conn);
+int bgp_ka_tx_begin(struct bgp_conn *conn);
+void bgp_ka_tx_done(struct bgp_conn *conn, int pending);
+#else
+static inline void bgp_ka_start(struct bgp_conn *conn UNUSED) { }
+static inline void bgp_ka_stop(struct bgp_conn *conn UNUSED) { }
+static inline int bgp_ka_tx_begin(struct bgp_conn *conn UNUSED) { return 1; }
+static inline void bgp_ka_tx_done(struct bgp_conn *conn UNUSED, int pending UNUSED) { }
+#endif
+
 /* packets.c */
 
 void bgp_dump_state_change(struct bgp_conn *conn, uint old, uint new);
@@ -609,6 +814,8 @@ void bgp_schedule_packet(struct bgp_conn *conn, struct bgp_channel *c, int type)
 void bgp_kick_tx(void *vconn);
 void bgp_tx(struct birdsock *sk);
 int bgp_rx(struct birdsock *sk, uint size);
+int bgp_replay_update(struct bgp_proto *p, byte *pkt, uint len);
+byte *bgp_bmp_encode_rte(struct bgp_channel *c, byte *buf, rte *e);
 const char * bgp_error_dsc(unsigned code, unsigned subcode);
 void bgp_log_error(struct bgp_proto *p, u8 class, char *msg, unsigned code, unsigned subcode, byte *data, unsigned len);
 
@@ -622,6 +829,7 @@ void bgp_update_next_hop(struct bgp_export_state *s, eattr *a, ea_list **to);
 #define PKT_NOTIFICATION	0x03
 #define PKT_KEEPALIVE		0x04
 #define PKT_ROUTE_REFRESH	0x05	/* [RFC2918] */
+#define PKT_RTC_UPDATE		0x1d	/* Dummy type for RT membership UPDATE [RFC4684] */
 #define PKT_BEGIN_REFRESH	0x1e	/* Dummy type for BoRR packet [RFC7313] */
 #define PKT_SCHEDULE_CLOSE	0x1f	/* Used internally to schedule socket close */
 
@@ -0,0 +1,329 @@
+/*
+ *	BIRD -- BGP Route Flap Damping
+ *
+ *	Can be freely distributed and used under the terms of the GNU GPL.
+ */
+
+/**
+ * DOC: Route flap damping
+ *
+ * Route flap damping (RFC 2439) is applied to routes received on a BGP channel
+ * before they are passed to the routing table. Each tracked (network, path ID)
+ * pair has a &bgp_damp entry with a penalty, which is increased by every
+ * withdrawal and attribute change and decays exponentially with the configured
+ * half life. When the penalty exceeds the suppress limit, the route is
+ * withdrawn from the routing table and further announcements are just stored
+ * in the entry. Once the penalty decays below the reuse limit, the last stored
+ * route is imported again. Penalty is capped, so no route is suppressed for
+ * longer than the max suppress time.
+ *
+ * Entries are created only by withdrawals, so stable routes cost nothing. All
+ * entries are kept in a timer wheel of %BGP_DAMP_SLOTS slots, each slot
+ * covering one %BGP_DAMP_TICK, indexed by the time of their next check (reuse
+ * for suppressed entries, removal for the others). One recurrent timer per
+ * channel scans the due slots, instead of one timer per route.
+ */
+
+#undef LOCAL_DEBUG
+
+#include "nest/bird.h"
+#include "nest/protocol.h"
+#include "nest/route.h"
+#include "lib/resource.h"
+
+#include "bgp.h"
+
+#define BGP_DAMP_PENALTY_WITHDRAW	1000
+#define BGP_DAMP_PENALTY_CHANGE		500
+
+/* 2^(-k/16) in 16.16 fixed point */
+static const u32 bgp_damp_frac[16] = {
+  65536, 62757, 60097, 57549, 55109, 52773, 50535, 48393,
+  46341, 44376, 42495, 40693, 38968, 37316, 35734, 34219
+};
+
+#define BDH_KEY(e)		e->net, e->path_id, e->hash
+#define BDH_NEXT(e)		e->next
+#define BDH_EQ(n1,i1,h1,n2,i2,h2) h1 == h2 && i1 == i2 && net_equal(n1, n2)
+#define BDH_FN(n,i,h)		h
+
+#define BDH_REHASH		bgp_bdh_rehash
+#define BDH_PARAMS		/8, *2, 2, 2, 8, 24
+
+HASH_DEFINE_REHASH_FN(BDH, struct bgp_damp)
+
+
+static u32
+bgp_damp_decay(u32 penalty, btime dt, btime half_life)
+{
+  uint n = dt / half_life;
+  if (n >= 32)
+    return 0;
+
+  uint k = ((dt % half_life) * 16) / half_life;
+  return ((u64) (penalty >> n) * bgp_damp_frac[k]) >> 16;
+}
+
+/* Time needed for @penalty to decay to @target */
+static btime
+bgp_damp_time_to(u32 penalty, u32 target, btime half_life)
+{
+  btime t = 0;
+
+  while (penalty > 2 * target)
+  {
+    penalty >>= 1;
+    t += half_life;
+  }
+
+  uint k = 0;
+  while ((k < 15) && ((((u64) penalty * bgp_damp_frac[k]) >> 16) > target))
+    k++;
+
+  return t + (k * half_life) / 16;
+}
+
+/* Penalty which decays to reuse limit in max suppress time */
+static u32
+bgp_damp_ceiling(const struct bgp_channel_config *cf)
+{
+  uint n = MIN(cf->damp_max_suppress / cf->damp_half_life, 20);
+  uint k = ((cf->damp_max_suppress % cf->damp_half_life) * 16) / cf->damp_half_life;
+  u64 ceiling = (((u64) cf->damp_reuse << n) << 16) / bgp_damp_frac[k];
+
+  return MIN(ceiling, 0xffffffff);
+}
+
+static void
+bgp_damp_decay_now(struct bgp_channel *c, struct bgp_damp *e, btime now)
+{
+  e->penalty = bgp_damp_decay(e->penalty, now - e->updated, c->cf->damp_half_life);
+  e->updated = now;
+}
+
+static void
+bgp_damp_schedule(struct bgp_channel *c, struct bgp_damp *e)
+{
+  struct bgp_damp_state *ds = c->damp;
+  u32 target = e->suppressed ? c->cf->damp_reuse : c->cf->damp_reuse / 2;
+  btime due = e->updated + bgp_damp_time_to(e->penalty, target, c->cf->damp_half_life);
+
+  /* Round up to the next tick */
+  e->due = (due / BGP_DAMP_TICK + 1) * BGP_DAMP_TICK;
+
+  if (NODE_VALID(&e->n))
+    rem_node(&e->n);
+
+  add_tail(&ds->wheel[(e->due / BGP_DAMP_TICK) % BGP_DAMP_SLOTS], &e->n);
+}
+
+static void
+bgp_damp_free_entry(struct bgp_channel *c, struct bgp_damp *e)
+{
+  struct bgp_damp_state *ds = c->damp;
+
+  if (e->suppressed)
+    ds->suppressed--;
+
+  rem_node(&e->n);
+  HASH_REMOVE2(ds->hash, BDH, c->pool, e);
+  rta_free(e->attrs);
+  mb_free(e);
+  ds->count--;
+}
+
+static void
+bgp_damp_reuse(struct bgp_channel *c, struct bgp_damp *e)
+{
+  struct bgp_proto *p = (void *) c->c.proto;
+  rta *a = e->attrs;
+
+  e->suppressed = 0;
+  e->attrs = NULL;
+  c->damp->suppressed--;
+
+  if (!a)
+    return;
+
+  BGP_TRACE(D_ROUTES, "Damping: Reusing %N", e->net);
+
+  if (c->c.channel_state == CS_UP)
+  {
+    rte *r = rte_get_temp(rta_clone(a));
+    r->pflags = 0;
+    r->u.bgp.suppressed = 0;
+    r->u.bgp.stale = -1;
+    rte_update2(&c->c, e->net, r, a->src);
+  }
+
+  rta_free(a);
+}
+
+static void
+bgp_damp_check(struct bgp_channel *c, struct bgp_damp *e, btime now)
+{
+  bgp_damp_decay_now(c, e, now);
+
+  if (e->suppressed && (e->penalty < c->cf->damp_reuse))
+    bgp_damp_reuse(c, e);
+
+  if (!e->suppressed && (e->penalty < c->cf->damp_reuse / 2))
+  {
+    bgp_damp_free_entry(c, e);
+    return;
+  }
+
+  bgp_damp_schedule(c, e);
+}
+
+static void
+bgp_damp_timeout(timer *t)
+{
+  struct bgp_channel *c = t->data;
+  struct bgp_damp_state *ds = c->damp;
+  btime now = current_time();
+  u64 tick = now / BGP_DAMP_TICK;
+  uint steps = MIN(tick - ds->tick, BGP_DAMP_SLOTS);
+
+  for (uint i = steps; i > 0; i--)
+  {
+    list *l = &ds->wheel[(tick - i + 1) % BGP_DAMP_SLOTS];
+    struct bgp_damp *e, *x;
+
+    WALK_LIST_DELSAFE(e, x, *l)
+      if (e->due <= now)
+	bgp_damp_check(c, e, now);
+  }
+
+  ds->tick = tick;
+
+  if (!ds->count)
+    tm_stop(t);
+}
+
+/* Returns 1 if the update is suppressed */
+static int
+bgp_damp_update(struct bgp_channel *c, net_addr *n, u32 path_id, rta *a)
+{
+  struct bgp_proto *p = (void *) c->c.proto;
+  struct bgp_damp_state *ds = c->damp;
+  u32 hash = net_hash(n) ^ u32_hash(path_id);
+  struct bgp_damp *e = HASH_FIND(ds->hash, BDH, n, path_id, hash);
+  btime now = current_time();
+
+  if (!e)
+  {
+    /* Only withdrawals start tracking */
+    if (a)
+      return 0;
+
+    e = mb_allocz(c->pool, sizeof(struct bgp_damp) + n->length);
+    e->hash = hash;
+    e->path_id = path_id;
+    e->updated = now;
+    net_copy(e->net, n);
+
+    HASH_INSERT2(ds->hash, BDH, c->pool, e);
+    ds->count++;
+
+    if (!tm_active(ds->timer))
+    {
+      ds->tick = now / BGP_DAMP_TICK;
+      tm_start(ds->timer, BGP_DAMP_TICK);
+    }
+  }
+  else
+    bgp_damp_decay_now(c, e, now);
+
+  if (!a)
+  {
+    e->penalty += BGP_DAMP_PENALTY_WITHDRAW;
+    e->withdrawn = 1;
+  }
+  else if (e->withdrawn)
+    e->withdrawn = 0;
+  else
+    e->penalty += BGP_DAMP_PENALTY_CHANGE;
+
+  e->penalty = MIN(e->penalty, bgp_damp_ceiling(c->cf));
+
+  if (!e->suppressed && (e->penalty >= c->cf->damp_suppress))
+  {
+    BGP_TRACE(D_ROUTES, "Damping: Suppressing %N (penalty %u)", n, e->penalty);
+    e->suppressed = 1;
+    ds->suppressed++;
+  }
+
+  /* Suppressed route is kept to be imported on reuse */
+  rta_free(e->attrs);
+  e->attrs = (e->suppressed && a) ? rta_clone(a) : NULL;
+
+  bgp_damp_schedule(c, e);
+
+  return e->suppressed && a;
+}
+
+/**
+ * bgp_damp_import - apply route flap damping to received routes
+ * @c: BGP channel
+ * @nets: networks received with the same attributes
+ * @count: number of networks in @nets
+ * @path_id: ADD-PATH path ID of received routes
+ * @a: cached route attributes, or %NULL for withdrawal
+ *
+ * The function updates damping state of all networks in @nets and reorders
+ * @nets, so the networks to be imported come first, followed by the networks
+ * whose announcements are suppressed and are to be withdrawn instead.
+ *
+ * Result: Number of networks to be imported.
+ */
+uint
+bgp_damp_import(struct bgp_channel *c, net_addr **nets, uint count, u32 path_id, rta *a)
+{
+  uint pass = 0;
+
+  for (uint i = 0; i < count; i++)
+    if (!bgp_damp_update(c, nets[i], path_id, a))
+    {
+      net_addr *n = nets[pass];
+      nets[pass++] = nets[i];
+      nets[i] = n;
+    }
+
+  return pass;
+}
+
+void
+bgp_damp_init(struct bgp_channel *c)
+{
+  struct bgp_damp_state *ds = mb_allocz(c->pool, sizeof(struct bgp_damp_state));
+
+  HASH_INIT(ds->hash, c->pool, 8);
+
+  for (uint i = 0; i < BGP_DAMP_SLOTS; i++)
+    init_list(&ds->wheel[i]);
+
+  ds->timer = tm_new_init(c->pool, bgp_damp_timeout, c, BGP_DAMP_TICK, 0);
+  c->damp = ds;
+}
+
+void
+bgp_damp_free(struct bgp_channel *c)
+{
+  struct bgp_damp_state *ds = c->damp;
+
+  if (!ds)
+    return;
+
+  HASH_WALK_DELSAFE(ds->hash, next, e)
+  {
+    rta_free(e->attrs);
+    mb_free(e);
+  }
+  HASH_WALK_DELSAFE_END;
+
+  HASH_FREE(ds->hash);
+  rfree(ds->timer);
+  mb_free(ds);
+  c->damp = NULL;
+}
@@ -0,0 +1,260 @@
+/*
+ *	BIRD -- BGP Keepalive Thread
+ *
+ *	Can be freely distributed and used under the terms of the GNU GPL.
+ */
+
+/**
+ * DOC: BGP keepalive thread
+ *
+ * Keepalives are normally sent by the main loop from bgp_keepalive_timeout().
+ * When the main loop is busy for a long time (large refeeds, reconfiguration),
+ * they may be delayed enough for the neighbor to drop the session on its hold
+ * timer, which only adds more work. Therefore, established connections are
+ * also registered with a small independent thread, which sends a KEEPALIVE
+ * directly to the socket when nothing has been written to it for the whole
+ * keepalive time.
+ *
+ * The thread and the main loop must never write to the socket at the same
+ * time, as it would interleave the messages. All thread writes are done with
+ * @bgp_ka_lock held, while the main loop marks the connection as busy (under
+ * the same lock) before it starts writing a batch and clears the mark when the
+ * batch is completely written, see bgp_ka_tx_begin() and bgp_ka_tx_done().
+ * The thread skips busy connections. The lock is never held during main loop
+ * socket operations, so the socket error hook may unregister the connection.
+ *
+ * A partially written KEEPALIVE cannot be completed without blocking the main
+ * loop, so the connection is marked broken and closed by the main loop on its
+ * next write. It is extremely rare, as the thread writes only to connections
+ * with empty transmit buffers.
+ *
+ * The receive side needs no such help, bgp_hold_timeout() already postpones
+ * the hold timer when there is unprocessed data on the socket.
+ */
+
+#undef LOCAL_DEBUG
+
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "nest/bird.h"
+#include "nest/protocol.h"
+#include "lib/socket.h"
+#include "lib/unaligned.h"
+
+#include "bgp.h"
+
+#ifdef USE_PTHREADS
+#include <pthread.h>
+#endif
+
+
+#ifdef USE_PTHREADS
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+static pthread_mutex_t bgp_ka_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t bgp_ka_cond;
+static pthread_t bgp_ka_thread_id;
+static list bgp_ka_list;		/* Registered connections (struct bgp_conn, ka_node) */
+static int bgp_ka_running;
+
+/* The thread has no timeloop, so current_time() is not available there */
+static btime
+bgp_ka_now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec S + ts.tv_nsec NS;
+}
+
+static void
+bgp_ka_send(struct bgp_conn *conn, btime now)
+{
+  byte buf[BGP_HEADER_LENGTH];
+  int e;
+
+  memset(buf, 0xff, 16);		/* Marker */
+  put_u16(buf+16, BGP_HEADER_LENGTH);
+  buf[18] = PKT_KEEPALIVE;
+
+  do
+    e = send(conn->ka_fd, buf, BGP_HEADER_LENGTH, MSG_DONTWAIT | MSG_NOSIGNAL);
+  while ((e < 0) && (errno == EINTR));
+
+  /* Errors are left for the main loop, it will get them on its socket */
+  if (e <= 0)
+    return;
+
+  if (e < BGP_HEADER_LENGTH)
+  {
+    conn->ka_broken = 1;
+    rem_node(&conn->ka_node);
+    return;
+  }
+
+  conn->ka_last_tx = now;
+  conn->ka_sent++;
+}
+
+static void *
+bgp_ka_thread(void *arg UNUSED)
+{
+  pthread_mutex_lock(&bgp_ka_lock);
+
+  while (1)
+  {
+    btime now = bgp_ka_now();
+    btime next = now + 60 S;
+    struct bgp_conn *conn;
+    node *n, *nxt;
+
+    WALK_LIST_DELSAFE(n, nxt, bgp_ka_list)
+    {
+      conn = SKIP_BACK(struct bgp_conn, ka_node, n);
+      btime due = conn->ka_last_tx + conn->ka_interval;
+
+      if ((due <= now) && !conn->ka_busy)
+      {
+	bgp_ka_send(conn, now);
+	due = now + conn->ka_interval;
+      }
+      else if (due <= now)
+	due = now + 1 S;		/* The main loop is writing, check later */
+
+      next = MIN(next, due);
+    }
+
+    struct timespec ts = {
+      .tv_sec = next / (1 S),
+      .tv_nsec = (next % (1 S)) * 1000,
+    };
+
+    pthread_cond_timedwait(&bgp_ka_cond, &bgp_ka_lock, &ts);
+  }
+
+  return NULL;
+}
+
+static void
+bgp_ka_init(void)
+{
+  pthread_condattr_t attr;
+  int e;
+
+  init_list(&bgp_ka_list);
+
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&bgp_ka_cond, &attr);
+  pthread_condattr_destroy(&attr);
+
+  if ((e = pthread_create(&bgp_ka_thread_id, NULL, bgp_ka_thread, NULL)))
+    die("pthread_create: %M", e);
+
+  pthread_detach(bgp_ka_thread_id);
+  bgp_ka_running = 1;
+}
+
+/**
+ * bgp_ka_start - register connection with the keepalive thread
+ * @conn: established BGP connection
+ *
+ * The connection is watched until bgp_ka_stop() is called, which has to happen
+ * before its socket is closed.
+ */
+void
+bgp_ka_start(struct bgp_conn *conn)
+{
+  if (!conn->keepalive_time || !conn->sk)
+    return;
+
+  pthread_mutex_lock(&bgp_ka_lock);
+
+  if (!bgp_ka_running)
+    bgp_ka_init();
+
+  conn->ka_fd = conn->sk->fd;
+  conn->ka_interval = conn->keepalive_time S;
+  conn->ka_last_tx = bgp_ka_now();
+  conn->ka_sent = 0;
+  conn->ka_broken = 0;
+  add_tail(&bgp_ka_list, &conn->ka_node);
+  conn->ka_active = 1;
+
+  pthread_cond_signal(&bgp_ka_cond);
+  pthread_mutex_unlock(&bgp_ka_lock);
+}
+
+/**
+ * bgp_ka_stop - unregister connection from the keepalive thread
+ * @conn: BGP connection
+ *
+ * Keepalives sent by the thread are accounted to the protocol statistics.
+ * It is safe to call it for a connection that was not registered.
+ */
+void
+bgp_ka_stop(struct bgp_conn *conn)
+{
+  if (!conn->ka_active)
+    return;
+
+  pthread_mutex_lock(&bgp_ka_lock);
+
+  if (!conn->ka_broken)
+    rem_node(&conn->ka_node);
+
+  conn->ka_active = 0;
+  conn->ka_busy = 0;
+
+  pthread_mutex_unlock(&bgp_ka_lock);
+
+  conn->bgp->stats.tx_messages += conn->ka_sent;
+  conn->bgp->stats.tx_bytes += conn->ka_sent * BGP_HEADER_LENGTH;
+}
+
+/**
+ * bgp_ka_tx_begin - mark connection as written by the main loop
+ * @conn: BGP connection
+ *
+ * Returns 0 if the keepalive thread left a partial message on the socket and
+ * the connection cannot be used anymore.
+ */
+int
+bgp_ka_tx_begin(struct bgp_conn *conn)
+{
+  int ok = 1;
+
+  if (!conn->ka_active)
+    return 1;
+
+  pthread_mutex_lock(&bgp_ka_lock);
+  conn->ka_busy = 1;
+  ok = !conn->ka_broken;
+  pthread_mutex_unlock(&bgp_ka_lock);
+
+  return ok;
+}
+
+/**
+ * bgp_ka_tx_done - update connection after main loop write
+ * @conn: BGP connection
+ * @pending: part of the batch is left for the TX hook
+ */
+void
+bgp_ka_tx_done(struct bgp_conn *conn, int pending)
+{
+  if (!conn->ka_active)
+    return;
+
+  pthread_mutex_lock(&bgp_ka_lock);
+  conn->ka_busy = pending;
+  conn->ka_last_tx = bgp_ka_now();
+  pthread_mutex_unlock(&bgp_ka_lock);
+}
+
+#endif
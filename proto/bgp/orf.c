@@ -0,0 +1,323 @@
+/*
+ *	BIRD -- BGP Outbound Route Filtering
+ *
+ *	Can be freely distributed and used under the terms of the GNU GPL.
+ */
+
+/**
+ * DOC: Outbound route filtering
+ *
+ * Outbound route filtering (RFC 5291) allows the neighbor to push its import
+ * policy to us, so routes it would reject anyway are not sent at all. ORF
+ * entries are carried in ROUTE-REFRESH messages and applied by bgp_preexport()
+ * before the export filter. Only the Address Prefix ORF (RFC 5292) is
+ * supported and only in the receive direction, that is where the savings are
+ * on our side.
+ *
+ * Received entries of a channel are kept in a &bgp_orf, in an array sorted by
+ * sequence number. The first matching entry decides, a prefix not matched by
+ * any entry is denied. All entries are also stored in a prefix trie, which is
+ * rebuilt on each change. As neighbors typically send only permit entries,
+ * the trie alone answers most lookups and the ordered scan is needed only when
+ * there are some deny entries and the trie matched.
+ */
+
+#undef LOCAL_DEBUG
+
+#include "nest/bird.h"
+#include "nest/protocol.h"
+#include "nest/route.h"
+#include "nest/attrs.h"
+#include "lib/resource.h"
+#include "lib/unaligned.h"
+#include "filter/data.h"
+
+#include "bgp.h"
+
+#define BGP_ORF_ADD		0
+#define BGP_ORF_REMOVE		1
+#define BGP_ORF_REMOVE_ALL	2
+
+#define BGP_ORF_DENY		0x20
+
+
+static inline uint
+bgp_orf_max_pxlen(const struct bgp_orf_entry *e)
+{
+  return (e->net.type == NET_IP4) ? IP4_MAX_PREFIX_LENGTH : IP6_MAX_PREFIX_LENGTH;
+}
+
+/* Effective prefix length range, zero bounds are unspecified */
+static inline uint
+bgp_orf_low(const struct bgp_orf_entry *e)
+{
+  return e->minlen ?: net_pxlen(&e->net);
+}
+
+static inline uint
+bgp_orf_high(const struct bgp_orf_entry *e)
+{
+  return e->maxlen ?: (e->minlen ? bgp_orf_max_pxlen(e) : net_pxlen(&e->net));
+}
+
+static inline int
+bgp_orf_entry_equal(const struct bgp_orf_entry *a, const struct bgp_orf_entry *b)
+{
+  return (a->seq == b->seq) && (a->deny == b->deny) &&
+    (a->minlen == b->minlen) && (a->maxlen == b->maxlen) && net_equal(&a->net, &b->net);
+}
+
+static void
+bgp_orf_rebuild(struct bgp_orf *orf)
+{
+  lp_flush(orf->lp);
+  orf->trie = f_new_trie(orf->lp, 0);
+  orf->deny_count = 0;
+
+  for (uint i = 0; i < orf->count; i++)
+  {
+    struct bgp_orf_entry *e = &orf->entries[i];
+    trie_add_prefix(orf->trie, &e->net, bgp_orf_low(e), bgp_orf_high(e));
+    orf->deny_count += e->deny;
+  }
+
+  trie_compile(orf->trie);
+}
+
+static void
+bgp_orf_add(struct bgp_channel *c, struct bgp_orf_entry *new)
+{
+  struct bgp_proto *p = (void *) c->c.proto;
+  struct bgp_orf *orf = c->orf;
+
+  if (!orf)
+  {
+    orf = c->orf = mb_allocz(c->pool, sizeof(struct bgp_orf));
+    orf->lp = lp_new_default(c->pool);
+    p->orf_channels++;
+  }
+
+  /* Keep entries sorted by sequence number, stable for equal ones */
+  uint i = orf->count;
+  while ((i > 0) && (orf->entries[i-1].seq > new->seq))
+    i--;
+
+  for (uint j = i; (j > 0) && (orf->entries[j-1].seq == new->seq); j--)
+    if (bgp_orf_entry_equal(&orf->entries[j-1], new))
+      return;
+
+  if (orf->count == orf->size)
+  {
+    orf->size = orf->size ? 2 * orf->size : 16;
+    orf->entries = orf->entries ?
+      mb_realloc(orf->entries, orf->size * sizeof(struct bgp_orf_entry)) :
+      mb_alloc(c->pool, orf->size * sizeof(struct bgp_orf_entry));
+  }
+
+  memmove(&orf->entries[i+1], &orf->entries[i], (orf->count - i) * sizeof(struct bgp_orf_entry));
+  orf->entries[i] = *new;
+  orf->count++;
+}
+
+static void
+bgp_orf_remove(struct bgp_channel *c, struct bgp_orf_entry *old)
+{
+  struct bgp_orf *orf = c->orf;
+
+  if (!orf)
+    return;
+
+  for (uint i = 0; i < orf->count; i++)
+    if (bgp_orf_entry_equal(&orf->entries[i], old))
+    {
+      orf->count--;
+      memmove(&orf->entries[i], &orf->entries[i+1], (orf->count - i) * sizeof(struct bgp_orf_entry));
+      return;
+    }
+}
+
+/**
+ * bgp_orf_free - drop all received ORF entries of a channel
+ * @c: BGP channel
+ */
+void
+bgp_orf_free(struct bgp_channel *c)
+{
+  struct bgp_proto *p = (void *) c->c.proto;
+  struct bgp_orf *orf = c->orf;
+
+  if (!orf)
+    return;
+
+  rfree(orf->lp);
+  mb_free(orf->entries);
+  mb_free(orf);
+  c->orf = NULL;
+  p->orf_channels--;
+}
+
+/**
+ * bgp_orf_rx - process ORF entries from ROUTE-REFRESH message
+ * @c: BGP channel
+ * @pos: ORF part of the message, starting with When-to-refresh
+ * @len: length of the ORF part
+ *
+ * Entries of unknown ORF types are skipped. Returns %BGP_ORF_IMMEDIATE or
+ * %BGP_ORF_DEFER according to the message, or -1 for malformed message.
+ */
+int
+bgp_orf_rx(struct bgp_channel *c, const byte *pos, uint len)
+{
+  struct bgp_proto *p = (void *) c->c.proto;
+  int v4 = (c->desc->net == NET_IP4);
+  uint max_pxlen = v4 ? IP4_MAX_PREFIX_LENGTH : IP6_MAX_PREFIX_LENGTH;
+
+  if (len < 1)
+    return -1;
+
+  int when = pos[0];
+  if ((when != BGP_ORF_IMMEDIATE) && (when != BGP_ORF_DEFER))
+    return -1;
+
+  ADVANCE(pos, len, 1);
+
+  while (len > 0)
+  {
+    if (len < 3)
+      return -1;
+
+    uint type = pos[0];
+    uint olen = get_u16(pos + 1);
+    ADVANCE(pos, len, 3);
+
+    if (olen > len)
+      return -1;
+
+    if (type != BGP_ORF_PREFIX)
+    {
+      log(L_WARN "%s: Got ORF type %u, ignoring", p->p.name, type);
+      ADVANCE(pos, len, olen);
+      continue;
+    }
+
+    const byte *op = pos;
+    ADVANCE(pos, len, olen);
+
+    while (olen > 0)
+    {
+      uint action = op[0] >> 6;
+
+      if (action == BGP_ORF_REMOVE_ALL)
+      {
+	bgp_orf_free(c);
+	ADVANCE(op, olen, 1);
+	continue;
+      }
+
+      if ((action != BGP_ORF_ADD) && (action != BGP_ORF_REMOVE))
+	return -1;
+
+      if (olen < 8)
+	return -1;
+
+      struct bgp_orf_entry e = {
+	.seq = get_u32(op + 1),
+	.deny = !!(op[0] & BGP_ORF_DENY),
+	.minlen = op[5],
+	.maxlen = op[6],
+      };
+
+      uint pxlen = op[7];
+      uint b = (pxlen + 7) / 8;
+      ADVANCE(op, olen, 8);
+
+      if ((pxlen > max_pxlen) || (b > olen))
+	return -1;
+
+      /* Length < Minlen <= Maxlen <= max, where specified (RFC 5292 3) */
+      if ((e.minlen && ((e.minlen <= pxlen) || (e.minlen > max_pxlen))) ||
+	  (e.maxlen && ((e.maxlen <= pxlen) || (e.maxlen > max_pxlen))) ||
+	  (e.minlen && e.maxlen && (e.minlen > e.maxlen)))
+	return -1;
+
+      if (v4)
+      {
+	ip4_addr addr = IP4_NONE;
+	memcpy(&addr, op, b);
+	net_fill_ip4(&e.net, ip4_ntoh(addr), pxlen);
+      }
+      else
+      {
+	ip6_addr addr = IP6_NONE;
+	memcpy(&addr, op, b);
+	net_fill_ip6(&e.net, ip6_ntoh(addr), pxlen);
+      }
+
+      net_normalize(&e.net);
+      ADVANCE(op, olen, b);
+
+      if (action == BGP_ORF_ADD)
+	bgp_orf_add(c, &e);
+      else
+	bgp_orf_remove(c, &e);
+    }
+  }
+
+  if (c->orf)
+    bgp_orf_rebuild(c->orf);
+
+  return when;
+}
+
+/**
+ * bgp_orf_match - check route against received ORF
+ * @c: BGP channel with ORF
+ * @n: network of the route
+ *
+ * Returns 1 if the network is permitted by the neighbor, 0 otherwise.
+ */
+int
+bgp_orf_match(struct bgp_channel *c, const net_addr *n)
+{
+  struct bgp_orf *orf = c->orf;
+
+  if (!orf->count)
+    return 1;
+
+  if (!trie_match_net(orf->trie, n))
+    return 0;
+
+  if (!orf->deny_count)
+    return 1;
+
+  for (uint i = 0; i < orf->count; i++)
+  {
+    struct bgp_orf_entry *e = &orf->entries[i];
+    uint pxlen = net_pxlen(n);
+
+    if ((pxlen >= bgp_orf_low(e)) && (pxlen <= bgp_orf_high(e)) && net_in_netX(n, &e->net))
+      return !e->deny;
+  }
+
+  return 0;
+}
+
+/**
+ * bgp_orf_export - apply received ORF to exported route
+ * @p: BGP instance
+ * @e: exported route
+ *
+ * The route is checked against ORF of the channel connected to its table.
+ * Returns 0 if the route should not be sent.
+ */
+int
+bgp_orf_export(struct bgp_proto *p, rte *e)
+{
+  struct bgp_channel *c;
+
+  WALK_LIST(c, p->p.channels)
+    if (c->orf && e->sender && (c->c.table == e->sender->table))
+      return bgp_orf_match(c, e->net->n.addr);
+
+  return 1;
+}
@@ -18,10 +18,12 @@
 #include "nest/route.h"
 #include "nest/attrs.h"
 #include "proto/mrt/mrt.h"
+#include "proto/bmp/bmp.h"
 #include "conf/conf.h"
 #include "lib/unaligned.h"
 #include "lib/flowspec.h"
 #include "lib/socket.h"
+#include "lib/tracepoint.h"
 
 #include "nest/cli.h"
 
@@ -230,7 +232,7 @@ bgp_prepare_capabilities(struct bgp_conn *conn)
   }
 
   /* Prepare bgp_caps structure */
-  int n = list_length(&p->p.channels);
+  int n = list_length(&p->p.channels) + !!p->cf->rtc;
   caps = mb_allocz(p->p.pool, sizeof(struct bgp_caps) + n * sizeof(struct bgp_af_caps));
   conn->local_caps = caps;
 
@@ -265,6 +267,9 @@ bgp_prepare_capabilities(struct bgp_conn *conn)
     ac->add_path = c->cf->add_path;
     caps->any_add_path |= ac->add_path;
 
+    ac->orf = c->cf->orf ? BGP_ORF_RX : 0;
+    caps->any_orf |= ac->orf;
+
     if (c->cf->gr_able)
     {
       ac->gr_able = 1;
@@ -283,6 +288,14 @@ bgp_prepare_capabilities(struct bgp_conn *conn)
     }
   }
 
+  /* RT membership has no channel, RFC 4684 */
+  if (p->cf->rtc)
+  {
+    ac = &caps->af_data[caps->af_count++];
+    ac->afi = BGP_AF_RTC;
+    ac->ready = 1;
+  }
+
   /* Sort capability fields by AFI/SAFI */
   qsort(caps->af_data, caps->af_count, sizeof(struct bgp_af_caps), bgp_af_caps_cmp);
 }
@@ -319,6 +332,25 @@ bgp_write_capabilities(struct bgp_conn *conn, byte *buf)
     *buf++ = 0;			/* Capability data length */
   }
 
+  if (caps->route_refresh && caps->any_orf)
+  {
+    *buf++ = 3;			/* Capability 3: Outbound route filtering */
+    *buf++ = 0;			/* Capability data length, will be fixed later */
+    data = buf;
+
+    WALK_AF_CAPS(caps, ac)
+      if (ac->orf)
+      {
+	put_af4(buf, ac->afi);
+	buf[4] = 1;		/* Number of ORF types */
+	buf[5] = BGP_ORF_PREFIX;
+	buf[6] = ac->orf;
+	buf += 7;
+      }
+
+    data[-1] = buf - data;
+  }
+
   if (caps->any_ext_next_hop)
   {
     *buf++ = 5;			/* Capability 5: Support for extended next hop */
@@ -463,6 +495,23 @@ bgp_read_capabilities(struct bgp_conn *conn, byte *pos, int len)
       caps->route_refresh = 1;
       break;
 
+    case  3: /* Outbound route filtering capability, RFC 5291 */
+      for (i = 0; i < cl; )
+      {
+	if ((i + 5 > cl) || (i + 5 + 2 * pos[2+i+4] > cl))
+	  goto err;
+
+	af = get_af4(pos+2+i);
+	ac = bgp_get_af_caps(&caps, af);
+
+	for (uint j = 0; j < pos[2+i+4]; j++)
+	  if (pos[2+i+5+2*j] == BGP_ORF_PREFIX)
+	    ac->orf = pos[2+i+5+2*j+1] & (BGP_ORF_RX | BGP_ORF_TX);
+
+	i += 5 + 2 * pos[2+i+4];
+      }
+      break;
+
     case  5: /* Extended next hop encoding capability, RFC 5549 */
       if (cl % 6)
 	goto err;
@@ -753,6 +802,16 @@ bgp_create_open(struct bgp_conn *conn, byte *buf)
   return buf;
 }
 
+/* Keep a copy of OPEN message for BMP Peer Up */
+static void
+bgp_store_open(struct bgp_conn *conn, byte **msg, uint *msg_len, const byte *pkt, uint len)
+{
+  mb_free(*msg);
+  *msg = mb_alloc(conn->bgp->p.pool, len);
+  memcpy(*msg, pkt, len);
+  *msg_len = len;
+}
+
 static void
 bgp_rx_open(struct bgp_conn *conn, byte *pkt, uint len)
 {
@@ -768,6 +827,8 @@ bgp_rx_open(struct bgp_conn *conn, byte *pkt, uint len)
   if (len < 29)
   { bgp_error(conn, 1, 2, pkt+16, 2); return; }
 
+  bgp_store_open(conn, &conn->remote_open_msg, &conn->remote_open_length, pkt, len);
+
   if (pkt[19] != BGP_VERSION)
   { u16 val = BGP_VERSION; bgp_error(conn, 2, 1, (byte *) &val, 2); return; }
 
@@ -1293,7 +1354,7 @@ bgp_update_next_hop_none(struct bgp_export_state *s, eattr *a, ea_list **to)
  */
 
 static void
-bgp_rte_update(struct bgp_parse_state *s, net_addr *n, u32 path_id, rta *a0)
+bgp_rte_update_batch(struct bgp_parse_state *s, net_addr **n, uint count, u32 path_id, rta *a0)
 {
   if (path_id != s->last_id)
   {
@@ -1307,7 +1368,10 @@ bgp_rte_update(struct bgp_parse_state *s, net_addr *n, u32 path_id, rta *a0)
   if (!a0)
   {
     /* Route withdraw */
-    rte_update3(&s->channel->c, n, NULL, s->last_src);
+    if (s->channel->damp)
+      bgp_damp_import(s->channel, n, count, path_id, NULL);
+
+    rte_update_batch(&s->channel->c, n, count, NULL, s->last_src);
     return;
   }
 
@@ -1322,13 +1386,71 @@ bgp_rte_update(struct bgp_parse_state *s, net_addr *n, u32 path_id, rta *a0)
     a0->eattrs = ea;
   }
 
+  /* Suppressed routes are moved to the end and withdrawn */
+  uint pass = count;
+  if (s->channel->damp)
+  {
+    pass = bgp_damp_import(s->channel, n, count, path_id, s->cached_rta);
+
+    if (pass < count)
+      rte_update_batch(&s->channel->c, n + pass, count - pass, NULL, s->last_src);
+
+    if (!pass)
+      return;
+  }
+
   rta *a = rta_clone(s->cached_rta);
   rte *e = rte_get_temp(a);
 
   e->pflags = 0;
   e->u.bgp.suppressed = 0;
   e->u.bgp.stale = -1;
-  rte_update3(&s->channel->c, n, e, s->last_src);
+  rte_update_batch(&s->channel->c, n, pass, e, s->last_src);
+}
+
+/*
+ * NLRI are not passed to the routing table one by one as they are decoded,
+ * but collected in a batch sharing the same attributes. The batch is flushed
+ * when it is full, when the attributes are about to change and at the end of
+ * each NLRI block. Each run of NLRI with the same path ID is then imported by
+ * one rte_update_batch() call.
+ */
+static void
+bgp_flush_nlri(struct bgp_parse_state *s)
+{
+  uint i = 0;
+
+  while (i < s->nlri_count)
+  {
+    uint first = i;
+    u32 path_id = s->nlri_ids[i];
+
+    while ((i < s->nlri_count) && (s->nlri_ids[i] == path_id))
+      i++;
+
+    bgp_rte_update_batch(s, s->nlri_nets + first, i - first, path_id, s->nlri_attrs);
+  }
+
+  s->nlri_count = 0;
+}
+
+static void
+bgp_rte_update(struct bgp_parse_state *s, net_addr *n, u32 path_id, rta *a0)
+{
+  if (!s->nlri_nets)
+  {
+    s->nlri_nets = lp_alloc(s->pool, BGP_NLRI_BATCH * sizeof(net_addr *));
+    s->nlri_ids = lp_alloc(s->pool, BGP_NLRI_BATCH * sizeof(u32));
+  }
+
+  if (s->nlri_count == BGP_NLRI_BATCH)
+    bgp_flush_nlri(s);
+
+  uint i = s->nlri_count++;
+  s->nlri_nets[i] = lp_alloc(s->pool, n->length);
+  net_copy(s->nlri_nets[i], n);
+  s->nlri_ids[i] = path_id;
+  s->nlri_attrs = a0;
 }
 
 static void
@@ -1375,6 +1497,9 @@ bgp_decode_mpls_labels(struct bgp_parse_state *s, byte **pos, uint *len, uint *p
   if (!a)
     return;
 
+  /* Pending NLRI were decoded with the previous labels */
+  bgp_flush_nlri(s);
+
   /* Attach MPLS attribute unless we already have one */
   if (!s->mpls_labels)
   {
@@ -1396,6 +1521,16 @@ bgp_decode_mpls_labels(struct bgp_parse_state *s, byte **pos, uint *len, uint *p
   return;
 }
 
+/* Sham prefixes of bgp_bmp_encode_rte() are not in the prefix hash */
+static inline void
+bgp_done_prefix(struct bgp_write_state *s, struct bgp_prefix *px)
+{
+  if (s->sham)
+    rem_node(&px->buck_node);
+  else
+    bgp_free_prefix(s->channel, px);
+}
+
 static uint
 bgp_encode_nlri_ip4(struct bgp_write_state *s, struct bgp_bucket *buck, byte *buf, uint size)
 {
@@ -1427,15 +1562,77 @@ bgp_encode_nlri_ip4(struct bgp_write_state *s, struct bgp_bucket *buck, byte *bu
     memcpy(pos, &a, b);
     ADVANCE(pos, size, b);
 
-    bgp_free_prefix(s->channel, px);
+    bgp_done_prefix(s, px);
   }
 
   return pos - buf;
 }
 
+/*
+ * Plain unicast NLRI (without MPLS labels) are decoded by specialized loops,
+ * where the use of ADD-PATH is a compile-time constant. The prefix body is
+ * read by unaligned word loads when enough data are left, and host bits are
+ * masked out, which also normalizes the prefix.
+ */
+static inline void
+bgp_decode_nlri_ip4_plain(struct bgp_parse_state *s, byte *pos, uint len, rta *a, const int add_path)
+{
+  while (len)
+  {
+    u32 path_id = 0;
+
+    /* Decode path ID */
+    if (add_path)
+    {
+      if (len < 5)
+	bgp_parse_error(s, 1);
+
+      path_id = get_u32(pos);
+      ADVANCE(pos, len, 4);
+    }
+
+    /* Decode prefix length */
+    uint l = *pos;
+    ADVANCE(pos, len, 1);
+
+    uint b = (l + 7) / 8;
+    if (len < b)
+      bgp_parse_error(s, 1);
+
+    if (l > IP4_MAX_PREFIX_LENGTH)
+      bgp_parse_error(s, 10);
+
+    /* Decode prefix body */
+    u32 addr;
+    if (len >= 4)
+      addr = get_u32(pos);
+    else
+    {
+      byte buf[4] = {};
+      memcpy(buf, pos, b);
+      addr = get_u32(buf);
+    }
+    ADVANCE(pos, len, b);
+
+    net_addr_ip4 net = NET_ADDR_IP4(ip4_from_u32(addr & u32_mkmask(l)), l);
+
+    bgp_rte_update(s, (net_addr *) &net, path_id, a);
+  }
+}
+
 static void
 bgp_decode_nlri_ip4(struct bgp_parse_state *s, byte *pos, uint len, rta *a)
 {
+  if (!s->mpls)
+  {
+    if (s->add_path)
+      bgp_decode_nlri_ip4_plain(s, pos, len, a, 1);
+    else
+      bgp_decode_nlri_ip4_plain(s, pos, len, a, 0);
+
+    return;
+  }
+
   while (len)
   {
     net_addr_ip4 net;
@@ -1512,15 +1709,71 @@ bgp_encode_nlri_ip6(struct bgp_write_state *s, struct bgp_bucket *buck, byte *bu
     memcpy(pos, &a, b);
     ADVANCE(pos, size, b);
 
-    bgp_free_prefix(s->channel, px);
+    bgp_done_prefix(s, px);
   }
 
   return pos - buf;
 }
 
+static inline void
+bgp_decode_nlri_ip6_plain(struct bgp_parse_state *s, byte *pos, uint len, rta *a, const int add_path)
+{
+  while (len)
+  {
+    u32 path_id = 0;
+
+    /* Decode path ID */
+    if (add_path)
+    {
+      if (len < 5)
+	bgp_parse_error(s, 1);
+
+      path_id = get_u32(pos);
+      ADVANCE(pos, len, 4);
+    }
+
+    /* Decode prefix length */
+    uint l = *pos;
+    ADVANCE(pos, len, 1);
+
+    uint b = (l + 7) / 8;
+    if (len < b)
+      bgp_parse_error(s, 1);
+
+    if (l > IP6_MAX_PREFIX_LENGTH)
+      bgp_parse_error(s, 10);
+
+    /* Decode prefix body */
+    byte buf[16];
+    byte *src = pos;
+    if (len < 16)
+    {
+      memset(buf, 0, sizeof(buf));
+      memcpy(buf, pos, b);
+      src = buf;
+    }
+    ADVANCE(pos, len, b);
+
+    ip6_addr addr = ip6_build(get_u32(src), get_u32(src + 4), get_u32(src + 8), get_u32(src + 12));
+    net_addr_ip6 net = NET_ADDR_IP6(ip6_and(addr, ip6_mkmask(l)), l);
+
+    bgp_rte_update(s, (net_addr *) &net, path_id, a);
+  }
+}
+
 static void
 bgp_decode_nlri_ip6(struct bgp_parse_state *s, byte *pos, uint len, rta *a)
 {
+  if (!s->mpls)
+  {
+    if (s->add_path)
+      bgp_decode_nlri_ip6_plain(s, pos, len, a, 1);
+    else
+      bgp_decode_nlri_ip6_plain(s, pos, len, a, 0);
+
+    return;
+  }
+
   while (len)
   {
     net_addr_ip6 net;
@@ -1600,7 +1853,7 @@ bgp_encode_nlri_vpn4(struct bgp_write_state *s, struct bgp_bucket *buck, byte *b
     memcpy(pos, &a, b);
     ADVANCE(pos, size, b);
 
-    bgp_free_prefix(s->channel, px);
+    bgp_done_prefix(s, px);
   }
 
   return pos - buf;
@@ -1697,7 +1950,7 @@ bgp_encode_nlri_vpn6(struct bgp_write_state *s, struct bgp_bucket *buck, byte *b
     memcpy(pos, &a, b);
     ADVANCE(pos, size, b);
 
-    bgp_free_prefix(s->channel, px);
+    bgp_done_prefix(s, px);
   }
 
   return pos - buf;
@@ -1784,7 +2037,7 @@ bgp_encode_nlri_flow4(struct bgp_write_state *s, struct bgp_bucket *buck, byte *
     memcpy(pos, net->data, flen);
     ADVANCE(pos, size, flen);
 
-    bgp_free_prefix(s->channel, px);
+    bgp_done_prefix(s, px);
   }
 
   return pos - buf;
@@ -1872,7 +2125,7 @@ bgp_encode_nlri_flow6(struct bgp_write_state *s, struct bgp_bucket *buck, byte *
     memcpy(pos, net->data, flen);
     ADVANCE(pos, size, flen);
 
-    bgp_free_prefix(s->channel, px);
+    bgp_done_prefix(s, px);
   }
 
   return pos - buf;
@@ -2108,11 +2361,12 @@ bgp_create_ip_reach(struct bgp_write_state *s, struct bgp_bucket *buck, byte *bu
 
   int lr, la;
 
-  la = bgp_encode_attrs(s, buck->eattrs, buf+4, buf + MAX_ATTRS_LENGTH);
+  la = bgp_encode_bucket_attrs(s, buck, buf+4, buf + MAX_ATTRS_LENGTH);
   if (la < 0)
   {
     /* Attribute list too long */
-    bgp_withdraw_bucket(s->channel, buck);
+    if (!s->sham)
+      bgp_withdraw_bucket(s->channel, buck);
     return NULL;
   }
 
@@ -2121,6 +2375,10 @@ bgp_create_ip_reach(struct bgp_write_state *s, struct bgp_bucket *buck, byte *bu
 
   lr = bgp_encode_nlri(s, buck, buf+4+la, end);
 
+  /* Remaining prefixes are sent with the same attributes */
+  if (!s->sham)
+    bgp_cache_bucket_attrs(s->channel, buck, buf+4, la);
+
   return buf+4+la+lr;
 }
 
@@ -2155,11 +2413,12 @@ bgp_create_mp_reach(struct bgp_write_state *s, struct bgp_bucket *buck, byte *bu
 
   /* Encode attributes to temporary buffer */
   byte *abuf = alloca(MAX_ATTRS_LENGTH);
-  la = bgp_encode_attrs(s, buck->eattrs, abuf, abuf + MAX_ATTRS_LENGTH);
+  la = bgp_encode_bucket_attrs(s, buck, abuf, abuf + MAX_ATTRS_LENGTH);
   if (la < 0)
   {
     /* Attribute list too long */
-    bgp_withdraw_bucket(s->channel, buck);
+    if (!s->sham)
+      bgp_withdraw_bucket(s->channel, buck);
     return NULL;
   }
 
@@ -2175,6 +2434,10 @@ bgp_create_mp_reach(struct bgp_write_state *s, struct bgp_bucket *buck, byte *bu
   lr = bgp_encode_nlri(s, buck, pos, end - la);
   pos += lr;
 
+  /* Remaining prefixes are sent with the same attributes */
+  if (!s->sham)
+    bgp_cache_bucket_attrs(s->channel, buck, abuf, la);
+
   /* End of MP_REACH_NLRI atribute, update data length */
   put_u16(buf+6, pos-buf-8);
 
@@ -2276,6 +2539,9 @@ again: ;
   {
     buck = HEAD(c->bucket_queue);
 
+    if (!c->group)
+      bgp_join_update_group(c);
+
     /* Cleanup empty buckets */
     if (EMPTY_LIST(buck->prefixes))
     {
@@ -2309,6 +2575,75 @@ done:
   return res;
 }
 
+#ifdef CONFIG_BMP
+
+/**
+ * bgp_bmp_encode_rte - encode received route as UPDATE message
+ * @c: BGP channel which received the route
+ * @buf: buffer for the whole message, of the maximum session message length
+ * @e: route from the import table of @c
+ *
+ * The route is encoded alone in an UPDATE message with the options negotiated
+ * for receiving, as if the peer sent it so. It is used for BMP Route Monitoring
+ * messages, the export state of @c (buckets, update group caches) is neither
+ * used nor changed. Returns the end of the message, or NULL if it does not fit.
+ */
+byte *
+bgp_bmp_encode_rte(struct bgp_channel *c, byte *buf, rte *e)
+{
+  struct bgp_proto *p = (void *) c->c.proto;
+  byte *pkt = buf + BGP_HEADER_LENGTH;
+  byte *end = buf + bgp_max_packet_length(p->conn);
+  ea_list *attrs = e->attrs->eattrs;
+
+  /* Cached attributes are normalized, just one list */
+  uint ea_size = sizeof(ea_list) + (attrs ? attrs->count * sizeof(eattr) : 0);
+  uint px_size = sizeof(struct bgp_prefix) + e->net->n.addr->length;
+
+  /* Sham bucket and prefix, not linked to the channel */
+  struct bgp_bucket *b = alloca(sizeof(struct bgp_bucket) + ea_size);
+  memset(b, 0, sizeof(struct bgp_bucket) + ea_size);
+  init_list(&b->prefixes);
+
+  if (attrs)
+    memcpy(b->eattrs, attrs, ea_size);
+
+  struct bgp_prefix *px = alloca(px_size);
+  memset(px, 0, px_size);
+  px->path_id = e->attrs->src->private_id;
+  net_copy(px->net, e->net->n.addr);
+  add_tail(&b->prefixes, &px->buck_node);
+
+  struct bgp_write_state s = {
+    .proto = p,
+    .channel = c,
+    .pool = bgp_linpool,
+    .mp_reach = (c->afi != BGP_AF_IPV4) || c->ext_next_hop,
+    .as4_session = p->as4_session,
+    .add_path = c->add_path_rx,
+    .mpls = c->desc->mpls,
+    .sham = 1,
+  };
+
+  byte *res = !s.mp_reach ?
+    bgp_create_ip_reach(&s, b, pkt, end):
+    bgp_create_mp_reach(&s, b, pkt, end);
+
+  lp_flush(s.pool);
+
+  /* Attributes or the prefix did not fit */
+  if (!res || !EMPTY_LIST(b->prefixes))
+    return NULL;
+
+  memset(buf, 0xff, 16);		/* Marker */
+  put_u16(buf+16, res - buf);
+  buf[18] = PKT_UPDATE;
+
+  return res;
+}
+
+#endif
+
 static byte *
 bgp_create_ip_end_mark(struct bgp_channel *c UNUSED, byte *buf)
 {
@@ -2346,6 +2681,180 @@ bgp_create_end_mark(struct bgp_channel *c, byte *buf)
     bgp_create_mp_end_mark(c, buf);
 }
 
+/*
+ *	RT membership UPDATE, RFC 4684
+ *
+ *	1 B	NLRI length in bits (0, or 32-96)
+ *	4 B	Origin AS
+ *	var	Route target prefix
+ */
+
+static byte *
+bgp_create_rtc_update(struct bgp_conn *conn, byte *buf)
+{
+  struct bgp_proto *p = conn->bgp;
+  const struct bgp_rtc_member *m = p->cf->rtc_members;
+  byte *end = buf + bgp_max_packet_length(conn) - BGP_HEADER_LENGTH;
+  byte *pos, *mp;
+
+  for (uint i = 0; m && (i < conn->rtc_sent); i++)
+    m = m->next;
+
+  /* All sent, End-of-RIB follows */
+  if (!m)
+    return NULL;
+
+  BGP_TRACE(D_PACKETS, "Sending UPDATE with RT membership");
+  p->stats.tx_updates++;
+
+  put_u16(buf, 0);		/* Withdrawn routes length */
+  pos = buf + 4;		/* Path attributes length is fixed later */
+
+  pos[0] = BAF_TRANSITIVE;
+  pos[1] = BA_ORIGIN;
+  pos[2] = 1;
+  pos[3] = ORIGIN_IGP;
+  pos += 4;
+
+  pos[0] = BAF_TRANSITIVE;
+  pos[1] = BA_AS_PATH;
+
+  if (p->is_interior)
+  {
+    pos[2] = 0;
+    pos += 3;
+  }
+  else
+  {
+    pos[2] = p->as4_session ? 6 : 4;
+    pos[3] = AS_PATH_SEQUENCE;
+    pos[4] = 1;
+
+    if (p->as4_session)
+      put_u32(pos + 5, p->public_as);
+    else
+      put_u16(pos + 5, (p->public_as > 0xFFFF) ? AS_TRANS : p->public_as);
+
+    pos += 3 + pos[2];
+  }
+
+  if (p->is_interior)
+  {
+    pos[0] = BAF_TRANSITIVE;
+    pos[1] = BA_LOCAL_PREF;
+    pos[2] = 4;
+    put_u32(pos + 3, p->cf->default_local_pref);
+    pos += 7;
+  }
+
+  mp = pos;
+  pos[0] = BAF_OPTIONAL | BAF_EXT_LEN;
+  pos[1] = BA_MP_REACH_NLRI;
+  put_af3(pos + 4, BGP_AF_RTC);
+  pos += 7;
+
+  if (ipa_is_ip4(p->local_ip))
+  {
+    pos[0] = 4;
+    put_ip4(pos + 1, ipa_to_ip4(p->local_ip));
+    pos += 5;
+  }
+  else
+  {
+    pos[0] = 16;
+    put_ip6(pos + 1, ipa_to_ip6(p->local_ip));
+    pos += 17;
+  }
+
+  *pos++ = 0;			/* Reserved */
+
+  for (; m && (pos + 1 + BGP_RTC_MAX_LENGTH / 8 <= end); m = m->next)
+  {
+    *pos++ = m->len;
+
+    if (m->len)
+    {
+      byte rt[8];
+      put_u32(pos, p->public_as);
+      put_u64(rt, m->rt);
+      memcpy(pos + 4, rt, BYTES(m->len) - 4);
+      pos += BYTES(m->len);
+    }
+
+    conn->rtc_sent++;
+  }
+
+  put_u16(mp + 2, pos - mp - 4);
+  put_u16(buf + 2, pos - buf - 4);
+
+  return pos;
+}
+
+static byte *
+bgp_create_rtc_end_mark(struct bgp_conn *conn, byte *buf)
+{
+  struct bgp_proto *p = conn->bgp;
+
+  BGP_TRACE(D_PACKETS, "Sending END-OF-RIB for RT membership");
+  p->stats.tx_updates++;
+
+  put_u16(buf+0, 0);
+  put_u16(buf+2, 6);		/* length 4--9 */
+
+  /* Empty MP_UNREACH_NLRI atribute */
+  buf[4] = BAF_OPTIONAL;
+  buf[5] = BA_MP_UNREACH_NLRI;
+  buf[6] = 3;			/* Length 7--9 */
+  put_af3(buf+7, BGP_AF_RTC);
+
+  return buf+10;
+}
+
+static void
+bgp_decode_rtc_nlri(struct bgp_parse_state *s, byte *pos, uint len, int add)
+{
+  struct bgp_proto *p = s->proto;
+
+  if (!p->rtc)
+    DISCARD(BAD_AFI, BGP_AFI(BGP_AF_RTC), BGP_SAFI(BGP_AF_RTC));
+
+  if (!add && !len)
+  {
+    BGP_TRACE(D_PACKETS, "Got END-OF-RIB for RT membership");
+    return;
+  }
+
+  while (len)
+  {
+    uint l = *pos;
+    ADVANCE(pos, len, 1);
+
+    if (l && ((l < 32) || (l > BGP_RTC_MAX_LENGTH)))
+      bgp_parse_error(s, 10);
+
+    if (BYTES(l) > len)
+      bgp_parse_error(s, 1);
+
+    u32 asn = 0;
+    u64 rt = 0;
+
+    if (l)
+    {
+      byte buf[8] = {};
+      asn = get_u32(pos);
+      memcpy(buf, pos + 4, BYTES(l) - 4);
+      rt = get_u64(buf);
+
+      /* Clear bits beyond the prefix */
+      if (l < BGP_RTC_MAX_LENGTH)
+	rt = (l > 32) ? (rt & ~(~0ULL >> (l - 32))) : 0;
+    }
+
+    ADVANCE(pos, len, BYTES(l));
+    bgp_rtc_update(p, asn, l, rt, add);
+  }
+}
+
 static inline void
 bgp_rx_end_mark(struct bgp_parse_state *s, u32 afi)
 {
@@ -2360,8 +2869,8 @@ bgp_rx_end_mark(struct bgp_parse_state *s, u32 afi)
   if (c->load_state == BFS_LOADING)
     c->load_state = BFS_NONE;
 
-  if (p->p.gr_recovery)
-    channel_graceful_restart_unlock(&c->c);
+  /* Graceful restart recovery or startup convergence */
+  channel_graceful_restart_unlock(&c->c);
 
   if (c->gr_active)
     bgp_graceful_restart_done(c);
@@ -2408,6 +2917,7 @@ bgp_decode_nlri(struct bgp_parse_state *s, u32 afi, byte *nlri, uint len, ea_lis
   }
 
   c->desc->decode_nlri(s, nlri, len, a);
+  bgp_flush_nlri(s);
 
   rta_free(s->cached_rta);
   s->cached_rta = NULL;
@@ -2486,6 +2996,22 @@ bgp_rx_update(struct bgp_conn *conn, byte *pkt, uint len)
   else
     ea = NULL;
 
+  /* RT membership is not imported to any channel */
+  if (s.mp_unreach_af == BGP_AF_RTC)
+  {
+    bgp_decode_rtc_nlri(&s, s.mp_unreach_nlri, s.mp_unreach_len, 0);
+    s.mp_unreach_af = s.mp_unreach_len = 0;
+  }
+
+  if (s.mp_reach_af == BGP_AF_RTC)
+  {
+    bgp_decode_rtc_nlri(&s, s.mp_reach_nlri, s.mp_reach_len, 1);
+    s.mp_reach_af = s.mp_reach_len = 0;
+  }
+
+  if (p->rtc)
+    bgp_rtc_refeed(p);
+
   /* Check for End-of-RIB marker */
   if (!s.attr_len && !s.ip_unreach_len && !s.ip_reach_len)
   { bgp_rx_end_mark(&s, BGP_AF_IPV4); goto done; }
@@ -2515,6 +3041,52 @@ done:
   return;
 }
 
+/*
+ * Decoding of UPDATE includes the import of routes, but the time of nested
+ * route processing phases is not accounted to RT_PHASE_DECODE.
+ */
+static void
+bgp_rx_update_timed(struct bgp_conn *conn, byte *pkt, uint len)
+{
+  struct rt_phase_mark pm = rt_phase_begin();
+  TRACEPOINT(bgp_rx_update, conn->bgp->p.name, len);
+  bgp_rx_update(conn, pkt, len);
+  TRACEPOINT(bgp_rx_update__done, conn->bgp->p.name, len);
+  rt_phase_end(RT_PHASE_DECODE, pm);
+}
+
+/**
+ * bgp_replay_update - process a recorded UPDATE message
+ * @p: BGP instance
+ * @pkt: start of the message, including BGP header
+ * @len: message size
+ *
+ * bgp_replay_update() processes an UPDATE message, usually one recorded in
+ * an MRT BGP4MP dump, as if it was received on the established connection of
+ * @p. It is used by the Perf protocol to benchmark the import path on real
+ * data. Note that the message is decoded according to the capabilities
+ * negotiated on the connection and a malformed message closes the session.
+ * Returns 0 if the message was not processed.
+ */
+int
+bgp_replay_update(struct bgp_proto *p, byte *pkt, uint len)
+{
+  struct bgp_conn *conn = p->conn;
+
+  if (!conn || (conn->state != BS_ESTABLISHED))
+    return 0;
+
+  if ((len < BGP_HEADER_LENGTH) || (len > bgp_max_packet_length(conn)) ||
+      (get_u16(pkt + 16) != len) || (pkt[18] != PKT_UPDATE))
+    return 0;
+
+  p->stats.rx_messages++;
+  p->stats.rx_bytes += len;
+
+  bgp_rx_update_timed(conn, pkt, len);
+  return 1;
+}
+
 static uint
 bgp_find_update_afi(byte *pos, uint len)
 {
@@ -2637,10 +3209,16 @@ bgp_rx_route_refresh(struct bgp_conn *conn, byte *pkt, uint len)
   if (len < (BGP_HEADER_LENGTH + 4))
   { bgp_error(conn, 1, 2, pkt+16, 2); return; }
 
-  if (len > (BGP_HEADER_LENGTH + 4))
+  struct bgp_channel *c = bgp_get_channel(p, get_af4(pkt+19));
+
+  /* RFC 7313 redefined reserved field as RR message subtype */
+  uint subtype = p->enhanced_refresh ? pkt[21] : BGP_RR_REQUEST;
+
+  /* Only plain requests may carry ORF entries, RFC 5291 */
+  int orf = (len > (BGP_HEADER_LENGTH + 4));
+  if (orf && !(c && c->orf_rx && (subtype == BGP_RR_REQUEST)))
   { bgp_error(conn, 7, 1, pkt, MIN(len, 2048)); return; }
 
-  struct bgp_channel *c = bgp_get_channel(p, get_af4(pkt+19));
   if (!c)
   {
     log(L_WARN "%s: Got ROUTE-REFRESH subtype %u for AF %u.%u, ignoring",
@@ -2648,14 +3226,28 @@ bgp_rx_route_refresh(struct bgp_conn *conn, byte *pkt, uint len)
     return;
   }
 
-  /* RFC 7313 redefined reserved field as RR message subtype */
-  uint subtype = p->enhanced_refresh ? pkt[21] : BGP_RR_REQUEST;
-
   switch (subtype)
   {
   case BGP_RR_REQUEST:
-    BGP_TRACE(D_PACKETS, "Got ROUTE-REFRESH");
-    channel_request_feeding(&c->c);
+    if (orf)
+    {
+      BGP_TRACE(D_PACKETS, "Got ROUTE-REFRESH with ORF");
+
+      int when = bgp_orf_rx(c, pkt + BGP_HEADER_LENGTH + 4, len - BGP_HEADER_LENGTH - 4);
+      if (when < 0)
+      { bgp_error(conn, 7, 1, pkt, MIN(len, 2048)); return; }
+
+      if (when == BGP_ORF_DEFER)
+	break;
+    }
+    else
+      BGP_TRACE(D_PACKETS, "Got ROUTE-REFRESH");
+
+    /* Adj-RIB-Out is sent again without refeed, unless ORF changed */
+    if (c->c.out_table && !orf)
+      channel_request_resend(&c->c);
+    else
+      channel_request_feeding(&c->c);
     break;
 
   case BGP_RR_BEGIN:
@@ -2675,17 +3267,43 @@ bgp_rx_route_refresh(struct bgp_conn *conn, byte *pkt, uint len)
   }
 }
 
+static inline int
+bgp_has_withdraws(struct bgp_channel *c)
+{
+  return c->withdraw_bucket && !EMPTY_LIST(c->withdraw_bucket->prefixes);
+}
+
+/*
+ * Channels are served by deficit round-robin. A channel gets BGP_TX_QUANTUM
+ * bytes of credit when its turn comes and keeps sending until the credit is
+ * spent, so address families with larger messages do not get more of the
+ * link than others. Pending withdraws are sent before any announcements,
+ * regardless of the round-robin position; they are charged to the channel
+ * credit as well, so they cannot be used to jump the queue indefinitely.
+ */
 static inline struct bgp_channel *
 bgp_get_channel_to_send(struct bgp_proto *p, struct bgp_conn *conn)
 {
   uint i = conn->last_channel;
+  struct bgp_channel *c;
 
-  /* Try the last channel, but at most several times */
-  if ((conn->channels_to_send & (1 << i)) &&
-      (conn->last_channel_count < 16))
-    goto found;
+  /* Withdraws first, starting from the current channel */
+  for (uint j = 0; j < p->channel_count; j++)
+  {
+    uint k = (i + j) % p->channel_count;
+
+    if ((conn->channels_to_send & (1 << k)) &&
+	(p->channel_map[k]->packets_to_send & (1 << PKT_UPDATE)) &&
+	bgp_has_withdraws(p->channel_map[k]))
+      return p->channel_map[k];
+  }
+
+  /* Stay with the last channel while it has some credit left */
+  c = p->channel_map[i];
+  if ((conn->channels_to_send & (1 << i)) && (c->tx_deficit > 0))
+    return c;
 
-  /* Find channel with non-zero channels_to_send */
+  /* Find next channel with non-zero channels_to_send */
   do
   {
     i++;
@@ -2694,20 +3312,18 @@ bgp_get_channel_to_send(struct bgp_proto *p, struct bgp_conn *conn)
   }
   while (! (conn->channels_to_send & (1 << i)));
 
-  /* Use that channel */
+  /* Use that channel, overdraft from withdraws is carried over */
   conn->last_channel = i;
-  conn->last_channel_count = 0;
+  c = p->channel_map[i];
+  c->tx_deficit = MIN(c->tx_deficit, 0) + BGP_TX_QUANTUM;
 
-found:
-  conn->last_channel_count++;
-  return p->channel_map[i];
+  return c;
 }
 
 static inline int
 bgp_send(struct bgp_conn *conn, uint type, uint len)
 {
-  sock *sk = conn->sk;
-  byte *buf = sk->tbuf;
+  byte *buf = conn->sk->tbuf + conn->tx_len;
 
   conn->bgp->stats.tx_messages++;
   conn->bgp->stats.tx_bytes += len;
@@ -2716,7 +3332,8 @@ bgp_send(struct bgp_conn *conn, uint type, uint len)
   put_u16(buf+16, len);
   buf[18] = type;
 
-  return sk_send(sk, len);
+  conn->tx_len += len;
+  return 1;
 }
 
 /**
@@ -2727,7 +3344,8 @@ bgp_send(struct bgp_conn *conn, uint type, uint len)
  * are free and we have any packets queued for sending, the socket functions
  * call bgp_fire_tx() which takes care of selecting the highest priority packet
  * queued (Notification > Keepalive > Open > Update), assembling its header
- * and body and sending it to the connection.
+ * and body and appending it to the batch in the socket transmit buffer. The
+ * batch is then written to the connection by bgp_flush_tx().
  */
 static int
 bgp_fire_tx(struct bgp_conn *conn)
@@ -2740,12 +3358,16 @@ bgp_fire_tx(struct bgp_conn *conn)
   if (!conn->sk)
     return 0;
 
-  buf = conn->sk->tbuf;
+  buf = conn->sk->tbuf + conn->tx_len;
   pkt = buf + BGP_HEADER_LENGTH;
   s = conn->packets_to_send;
 
   if (s & (1 << PKT_SCHEDULE_CLOSE))
   {
+    /* Notification has to be flushed first */
+    if (conn->tx_len)
+      return 0;
+
     /* We can finally close connection and enter idle state */
     bgp_conn_enter_idle_state(conn);
     return 0;
@@ -2760,6 +3382,7 @@ bgp_fire_tx(struct bgp_conn *conn)
   {
     conn->packets_to_send &= ~(1 << PKT_OPEN);
     end = bgp_create_open(conn, pkt);
+    bgp_store_open(conn, &conn->local_open_msg, &conn->local_open_length, buf, end - buf);
     return bgp_send(conn, PKT_OPEN, end - buf);
   }
   else if (s & (1 << PKT_KEEPALIVE))
@@ -2769,6 +3392,17 @@ bgp_fire_tx(struct bgp_conn *conn)
     bgp_start_timer(conn->keepalive_timer, conn->keepalive_time);
     return bgp_send(conn, PKT_KEEPALIVE, BGP_HEADER_LENGTH);
   }
+  else if (s & (1 << PKT_RTC_UPDATE))
+  {
+    /* RT membership is sent before any VPN routes */
+    end = bgp_create_rtc_update(conn, pkt);
+    if (!end)
+    {
+      conn->packets_to_send &= ~(1 << PKT_RTC_UPDATE);
+      end = bgp_create_rtc_end_mark(conn, pkt);
+    }
+    return bgp_send(conn, PKT_UPDATE, end - buf);
+  }
   else while (conn->channels_to_send)
   {
     c = bgp_get_channel_to_send(p, conn);
@@ -2789,12 +3423,18 @@ bgp_fire_tx(struct bgp_conn *conn)
     }
     else if (s & (1 << PKT_UPDATE))
     {
+      TRACEPOINT(bgp_create_update, p->p.name, c->c.name);
       end = bgp_create_update(c, pkt);
+      TRACEPOINT(bgp_create_update__done, p->p.name, c->c.name, end ? end - buf : 0);
       if (end)
+      {
+	c->tx_deficit -= end - buf;
 	return bgp_send(conn, PKT_UPDATE, end - buf);
+      }
 
       /* No update to send, perhaps we need to send End-of-RIB or EoRR */
       c->packets_to_send = 0;
+      c->tx_deficit = 0;
       conn->channels_to_send &= ~(1 << c->index);
 
       if (c->feed_state == BFS_LOADED)
@@ -2815,6 +3455,7 @@ bgp_fire_tx(struct bgp_conn *conn)
       bug("Channel packets_to_send: %x", s);
 
     c->packets_to_send = 0;
+    c->tx_deficit = 0;
     conn->channels_to_send &= ~(1 << c->index);
   }
 
@@ -2841,7 +3482,7 @@ bgp_schedule_packet(struct bgp_conn *conn, struct bgp_channel *c, int type)
     if (! conn->channels_to_send)
     {
       conn->last_channel = c->index;
-      conn->last_channel_count = 0;
+      c->tx_deficit = BGP_TX_QUANTUM;
     }
 
     c->packets_to_send |= 1 << type;
@@ -2853,18 +3494,96 @@ bgp_schedule_packet(struct bgp_conn *conn, struct bgp_channel *c, int type)
   if ((conn->sk->tpos == conn->sk->tbuf) && !ev_active(conn->tx_ev))
     ev_schedule(conn->tx_ev);
 }
+/**
+ * bgp_flush_tx - write batched packets
+ * @conn: connection
+ *
+ * Sends all messages batched in the transmit buffer with one socket write.
+ * Returns the sk_send() result, i.e. 1 when everything was written, 0 when
+ * the rest is left for the TX hook and -1 on error.
+ */
+static int
+bgp_flush_tx(struct bgp_conn *conn)
+{
+  uint len = conn->tx_len;
+  int res;
+
+  conn->tx_len = 0;
+
+  /* Keepalive thread left a partial message, the stream is unusable */
+  if (!bgp_ka_tx_begin(conn))
+  {
+    log(L_ERR "%s: Keepalive partially written, closing connection", conn->bgp->p.name);
+    bgp_conn_enter_idle_state(conn);
+    return -1;
+  }
+
+  res = sk_send(conn->sk, len);
+  bgp_ka_tx_done(conn, !res);
+
+  /* Kernel buffer is full, it may be too small for the connection */
+  if (!res)
+    bgp_tune_buffers(conn);
+
+  return res;
+}
+
+static inline int
+bgp_tx_room(struct bgp_conn *conn)
+{
+  return conn->sk->tbsize - conn->tx_len >= bgp_max_packet_length(conn);
+}
+
+static void
+bgp_tx_resize(struct bgp_conn *conn, sock *sk)
+{
+  uint base = bgp_max_packet_length(conn);
+  int more = conn->packets_to_send || conn->channels_to_send;
+
+  /* The batch is limited by the buffer, more packets are waiting */
+  if (more && !bgp_tx_room(conn) && (sk->tbsize < base + BGP_TX_BATCH_SIZE))
+    sk_set_tbsize(sk, base + BGP_TX_BATCH_SIZE);
+
+  /* Everything is sent in a small batch, return to base size */
+  else if (!more && (sk->tbsize > base) && (conn->tx_len < base))
+    sk_set_tbsize(sk, base);
+}
+
+static void
+bgp_run_tx(struct bgp_conn *conn)
+{
+  uint max = 1024;
+
+  /* Previous batch is still being written, TX hook will be called later */
+  if (!conn->sk || (conn->sk->tpos != conn->sk->tbuf))
+    return;
+
+  while (max)
+  {
+    /* Batch as many packets as fit in the buffer */
+    while (max && conn->sk && bgp_tx_room(conn) && (bgp_fire_tx(conn) > 0))
+      max--;
+
+    if (!conn->sk || !conn->tx_len)
+      return;
+
+    bgp_tx_resize(conn, conn->sk);
+
+    if (bgp_flush_tx(conn) <= 0)
+      return;
+  }
+
+  if (!ev_active(conn->tx_ev))
+    ev_schedule(conn->tx_ev);
+}
+
 void
 bgp_kick_tx(void *vconn)
 {
   struct bgp_conn *conn = vconn;
 
   DBG("BGP: kicking TX\n");
-  uint max = 1024;
-  while (--max && (bgp_fire_tx(conn) > 0))
-    ;
-
-  if (!max && !ev_active(conn->tx_ev))
-    ev_schedule(conn->tx_ev);
+  bgp_run_tx(conn);
 }
 
 void
@@ -2873,15 +3592,10 @@ bgp_tx(sock *sk)
   struct bgp_conn *conn = sk->data;
 
   DBG("BGP: TX hook\n");
-  uint max = 1024;
-  while (--max && (bgp_fire_tx(conn) > 0))
-    ;
-
-  if (!max && !ev_active(conn->tx_ev))
-    ev_schedule(conn->tx_ev);
+  bgp_ka_tx_done(conn, 0);
+  bgp_run_tx(conn);
 }
 
-
 static struct {
   byte major, minor;
   byte *msg;
@@ -3091,10 +3805,13 @@ bgp_rx_packet(struct bgp_conn *conn, byte *pkt, uint len)
   if (conn->bgp->p.mrtdump & MD_MESSAGES)
     bgp_dump_message(conn, pkt, len);
 
+  if ((type == PKT_UPDATE) && (conn->state == BS_ESTABLISHED))
+    bmp_route_monitor(conn->bgp, pkt, len);
+
   switch (type)
   {
   case PKT_OPEN:		return bgp_rx_open(conn, pkt, len);
-  case PKT_UPDATE:		return bgp_rx_update(conn, pkt, len);
+  case PKT_UPDATE:		return bgp_rx_update_timed(conn, pkt, len);
   case PKT_NOTIFICATION:	return bgp_rx_notification(conn, pkt, len);
   case PKT_KEEPALIVE:		return bgp_rx_keepalive(conn);
   case PKT_ROUTE_REFRESH:	return bgp_rx_route_refresh(conn, pkt, len);
@@ -3102,22 +3819,28 @@ bgp_rx_packet(struct bgp_conn *conn, byte *pkt, uint len)
   }
 }
 
-/**
- * bgp_rx - handle received data
- * @sk: socket
- * @size: amount of data received
- *
- * bgp_rx() is called by the socket layer whenever new data arrive from
- * the underlying TCP connection. It assembles the data fragments to packets,
- * checks their headers and framing and passes complete packets to
- * bgp_rx_packet().
- */
-int
-bgp_rx(sock *sk, uint size)
+static void
+bgp_rx_resize(struct bgp_conn *conn, sock *sk, int full, uint got)
+{
+  uint base = conn->ext_messages ? BGP_RX_BUFFER_EXT_SIZE : BGP_RX_BUFFER_SIZE;
+
+  /* The read filled the buffer, the peer is sending in bulk */
+  if (full && (sk->rbsize < BGP_RX_BUFFER_MAX))
+    sk_set_rbsize(sk, MIN(2 * sk->rbsize, BGP_RX_BUFFER_MAX));
+
+  /* The buffer is drained and the peer is sending little, return to base size */
+  else if ((sk->rbsize > base) && (sk->rpos == sk->rbuf) && (got < base))
+    sk_set_rbsize(sk, base);
+}
+
+static int
+bgp_rx_(sock *sk, uint size)
 {
   struct bgp_conn *conn = sk->data;
-  byte *pkt_start = sk->rbuf;
-  byte *end = pkt_start + size;
+  byte *pkt_start = sk->rbuf + conn->rx_pos;
+  byte *end = sk->rbuf + size;
+  uint got = end - pkt_start;
+  int full = (size == sk->rbsize);
   uint i, len;
 
   DBG("BGP: RX hook: Got %d bytes\n", size);
@@ -3142,10 +3865,59 @@ bgp_rx(sock *sk, uint size)
       bgp_rx_packet(conn, pkt_start, len);
       pkt_start += len;
     }
-  if (pkt_start != sk->rbuf)
+
+  if ((conn->state == BS_CLOSE) || (conn->sk != sk))
+    return 0;
+
+  if (pkt_start == end)
     {
+      /* Everything processed */
+      conn->rx_pos = 0;
+      sk->rpos = sk->rbuf;
+    }
+  else if (sk->rbuf + sk->rbsize - pkt_start < (int) bgp_max_packet_length(conn))
+    {
+      /* Not enough room for the rest of the partial packet */
       memmove(sk->rbuf, pkt_start, end - pkt_start);
+      conn->rx_pos = 0;
       sk->rpos = sk->rbuf + (end - pkt_start);
     }
+  else
+    conn->rx_pos = pkt_start - sk->rbuf;
+
+  bgp_rx_resize(conn, sk, full, got);
   return 0;
 }
+
+/**
+ * bgp_rx - handle received data
+ * @sk: socket
+ * @size: amount of data received
+ *
+ * bgp_rx() is called by the socket layer whenever new data arrive from
+ * the underlying TCP connection. It assembles the data fragments to packets,
+ * checks their headers and framing and passes complete packets to
+ * bgp_rx_packet().
+ *
+ * All complete packets in the buffer are processed in one call. A trailing
+ * partial packet is left in place while there is room to receive the rest
+ * of it, so it is moved to the buffer start only occasionally. The receive
+ * buffer grows when reads fill it, up to %BGP_RX_BUFFER_MAX, and shrinks
+ * back when the peer goes quiet.
+ */
+int
+bgp_rx(sock *sk, uint size)
+{
+  struct bgp_conn *conn = sk->data;
+  struct bgp_proto *p = conn->bgp;
+
+  /* The connection may be closed during the call, the protocol stays */
+  struct cpu_acct_mark cm = cpu_acct_begin();
+  int rv = bgp_rx_(sk, size);
+  cpu_acct_end(&p->p.cpu, CPU_ACCT_RX, cm);
+
+  if (conn->sk == sk)
+    bgp_tune_buffers(conn);
+
+  return rv;
+}
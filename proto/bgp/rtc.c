@@ -0,0 +1,239 @@
+/*
+ *	BIRD -- BGP Route Target Constraint
+ *
+ *	Can be freely distributed and used under the terms of the GNU GPL.
+ */
+
+/**
+ * DOC: Route target constraint
+ *
+ * Route target constraint (RFC 4684) lets a neighbor announce which route
+ * targets it is interested in, so VPN routes it would drop in its import
+ * filters are not sent to it at all. The membership is exchanged as routes of
+ * a special address family (AFI 1, SAFI 132), but it is never imported to a
+ * routing table, so there is no channel for it. Our membership is taken from
+ * the configuration and sent by bgp_create_rtc_update() right after the
+ * session is established, the received one is kept in a &bgp_rtc structure
+ * of the protocol for the lifetime of the session.
+ *
+ * Received NLRIs are tracked in a hash table to handle duplicates and
+ * withdrawals. For export, full length entries are also indexed by their
+ * route target, entries with shorter RT prefix are in a list, as they are
+ * rare. bgp_preexport() rejects VPN routes with no route target matching the
+ * membership. Whenever the membership changes, VPN channels are refed.
+ */
+
+#undef LOCAL_DEBUG
+
+#include "nest/bird.h"
+#include "nest/protocol.h"
+#include "nest/route.h"
+#include "nest/attrs.h"
+#include "conf/conf.h"
+#include "lib/resource.h"
+
+#include "bgp.h"
+
+#define RTC_KEY(e)		e->asn, e->len, e->rt
+#define RTC_NEXT(e)		e->next
+#define RTC_EQ(a1,l1,r1,a2,l2,r2) a1 == a2 && l1 == l2 && r1 == r2
+#define RTC_FN(a,l,r)		(u32_hash(a ^ (u32) r ^ (u32) (r >> 32)) ^ l)
+
+#define RTC_REHASH		bgp_rtc_rehash
+#define RTC_PARAMS		/8, *2, 2, 2, 8, 24
+
+#define RTR_KEY(e)		e->rt
+#define RTR_NEXT(e)		e->next_rt
+#define RTR_EQ(r1,r2)		r1 == r2
+#define RTR_FN(r)		u32_hash((u32) r ^ (u32) (r >> 32))
+
+#define RTR_REHASH		bgp_rtr_rehash
+#define RTR_PARAMS		/8, *2, 2, 2, 8, 24
+
+HASH_DEFINE_REHASH_FN(RTC, struct bgp_rtc_entry)
+HASH_DEFINE_REHASH_FN(RTR, struct bgp_rtc_entry)
+
+
+/**
+ * bgp_rtc_add_member - add route target to configured membership
+ * @cf: BGP configuration
+ * @rt: route target, as extended community
+ * @len: RT membership NLRI length in bits, 0 for all route targets
+ *
+ * Members are kept in a linked chain, so protocols derived from a template
+ * may safely add their own to the shared tail.
+ */
+void
+bgp_rtc_add_member(struct bgp_config *cf, u64 rt, uint len)
+{
+  struct bgp_rtc_member *m = cfg_allocz(sizeof(struct bgp_rtc_member));
+  m->rt = rt;
+  m->len = len;
+  m->next = cf->rtc_members;
+  cf->rtc_members = m;
+}
+
+int
+bgp_rtc_same(const struct bgp_rtc_member *a, const struct bgp_rtc_member *b)
+{
+  for (; a && b; a = a->next, b = b->next)
+    if ((a->rt != b->rt) || (a->len != b->len))
+      return 0;
+
+  return !a && !b;
+}
+
+void
+bgp_rtc_init(struct bgp_proto *p)
+{
+  struct bgp_rtc *rtc = mb_allocz(p->p.pool, sizeof(struct bgp_rtc));
+
+  HASH_INIT(rtc->nlri_hash, p->p.pool, 8);
+  HASH_INIT(rtc->rt_hash, p->p.pool, 8);
+  init_list(&rtc->partial);
+  p->rtc = rtc;
+}
+
+void
+bgp_rtc_free(struct bgp_proto *p)
+{
+  struct bgp_rtc *rtc = p->rtc;
+
+  if (!rtc)
+    return;
+
+  HASH_WALK_DELSAFE(rtc->nlri_hash, next, e)
+    mb_free(e);
+  HASH_WALK_DELSAFE_END;
+
+  HASH_FREE(rtc->nlri_hash);
+  HASH_FREE(rtc->rt_hash);
+  mb_free(rtc);
+  p->rtc = NULL;
+}
+
+/**
+ * bgp_rtc_update - update received RT membership
+ * @p: BGP instance
+ * @asn: origin AS of the membership NLRI
+ * @len: NLRI length in bits
+ * @rt: route target (or its prefix)
+ * @add: whether the NLRI is announced or withdrawn
+ */
+void
+bgp_rtc_update(struct bgp_proto *p, u32 asn, uint len, u64 rt, int add)
+{
+  struct bgp_rtc *rtc = p->rtc;
+  struct bgp_rtc_entry *e = HASH_FIND(rtc->nlri_hash, RTC, asn, len, rt);
+
+  if (add && !e)
+  {
+    e = mb_allocz(p->p.pool, sizeof(struct bgp_rtc_entry));
+    e->asn = asn;
+    e->len = len;
+    e->rt = rt;
+    HASH_INSERT2(rtc->nlri_hash, RTC, p->p.pool, e);
+
+    if (!len)
+      rtc->any++;
+    else if (len == BGP_RTC_MAX_LENGTH)
+      HASH_INSERT2(rtc->rt_hash, RTR, p->p.pool, e);
+    else
+      add_tail(&rtc->partial, &e->n);
+
+    rtc->changed = 1;
+  }
+  else if (!add && e)
+  {
+    HASH_REMOVE2(rtc->nlri_hash, RTC, p->p.pool, e);
+
+    if (!len)
+      rtc->any--;
+    else if (len == BGP_RTC_MAX_LENGTH)
+      HASH_REMOVE2(rtc->rt_hash, RTR, p->p.pool, e);
+    else
+      rem_node(&e->n);
+
+    mb_free(e);
+    rtc->changed = 1;
+  }
+}
+
+/**
+ * bgp_rtc_refeed - propagate membership change to VPN channels
+ * @p: BGP instance
+ *
+ * Called after each UPDATE with RT membership, so a batch of changes causes
+ * just one refeed.
+ */
+void
+bgp_rtc_refeed(struct bgp_proto *p)
+{
+  struct bgp_channel *c;
+
+  if (!p->rtc->changed)
+    return;
+
+  p->rtc->changed = 0;
+
+  WALK_LIST(c, p->p.channels)
+    if (((c->desc->net == NET_VPN4) || (c->desc->net == NET_VPN6)) &&
+	(c->c.channel_state == CS_UP))
+      channel_request_feeding(&c->c);
+}
+
+static inline int
+bgp_rtc_match(struct bgp_rtc *rtc, u64 rt)
+{
+  if (HASH_FIND(rtc->rt_hash, RTR, rt))
+    return 1;
+
+  struct bgp_rtc_entry *e;
+  WALK_LIST(e, rtc->partial)
+  {
+    uint bits = e->len - 32;
+    if (!bits || !((rt ^ e->rt) >> (64 - bits)))
+      return 1;
+  }
+
+  return 0;
+}
+
+/**
+ * bgp_rtc_export - apply received RT membership to exported route
+ * @p: BGP instance with RT constraint active
+ * @e: exported route
+ *
+ * Returns 0 if the route is a VPN route and none of its route targets is in
+ * the membership of the neighbor.
+ */
+int
+bgp_rtc_export(struct bgp_proto *p, rte *e)
+{
+  struct bgp_rtc *rtc = p->rtc;
+  uint type = e->net->n.addr->type;
+
+  if ((type != NET_VPN4) && (type != NET_VPN6))
+    return 1;
+
+  if (rtc->any)
+    return 1;
+
+  eattr *a = ea_find(e->attrs->eattrs, EA_CODE(PROTOCOL_BGP, BA_EXT_COMMUNITY));
+  if (!a)
+    return 0;
+
+  const struct adata *ad = a->u.ptr;
+  const u32 *d = (const u32 *) ad->data;
+
+  for (uint i = 0; i < ad->length / 4; i += 2)
+  {
+    u64 ec = ((u64) d[i] << 32) | d[i+1];
+
+    /* Transitive route targets of all three formats */
+    if ((((ec >> 48) & 0xff) == EC_RT) && ((ec >> 56) <= 2) && bgp_rtc_match(rtc, ec))
+      return 1;
+  }
+
+  return 0;
+}
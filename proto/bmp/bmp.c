@@ -0,0 +1,803 @@
+/*
+ *	BIRD -- BGP Monitoring Protocol (BMP)
+ *
+ *	Can be freely distributed and used under the terms of the GNU GPL.
+ */
+
+/**
+ * DOC: BGP Monitoring Protocol
+ *
+ * The BMP protocol (RFC 7854) streams the state of BGP sessions to a
+ * monitoring station. It connects to the station as a TCP client, sends the
+ * Initiation message, Peer Up messages for all established BGP sessions
+ * (followed by their current routes, see bmp_send_routes()), and then follows
+ * session state changes by Peer Up and Peer Down messages and mirrors received
+ * UPDATE messages in Route Monitoring messages, i.e. the pre-policy
+ * Adj-RIB-In.
+ *
+ * BGP calls bmp_peer_up(), bmp_peer_down() and bmp_route_monitor(), which
+ * build the messages for all connected BMP instances. Received UPDATEs are
+ * not re-encoded, the raw message from the BGP receive buffer is copied after
+ * the BMP headers. Each message is built in its own &bmp_tx_buffer, which is
+ * then used as the socket transmit buffer by sk_set_tbuf(), so it is not
+ * copied again. Messages are sent from an event, so BGP receive is never
+ * blocked by the station. The queue of a station is limited. When a message
+ * does not fit into it, the station would miss it, so the connection is closed
+ * from the event and opened again later to resync the station.
+ */
+
+#undef LOCAL_DEBUG
+
+#include <unistd.h>
+
+#include "nest/bird.h"
+#include "nest/iface.h"
+#include "nest/protocol.h"
+#include "nest/cli.h"
+#include "conf/conf.h"
+#include "lib/socket.h"
+#include "lib/string.h"
+#include "lib/unaligned.h"
+#include "proto/bgp/bgp.h"
+
+#include "bmp.h"
+
+static list bmp_proto_list;
+
+
+/*
+ *	Message queue
+ */
+
+static struct bmp_tx_buffer *
+bmp_buffer_new(struct bmp_proto *p, uint type, uint len)
+{
+  len += BMP_COMMON_HDR_SIZE;
+
+  if (p->tx_queued + len > ((struct bmp_config *) p->p.cf)->tx_limit)
+  {
+    /* The station would miss the message, resync by reconnecting */
+    if (!p->tx_overflow)
+    {
+      log(L_WARN "%s: Queue full, reconnecting", p->p.name);
+      p->tx_overflow = 1;
+      ev_schedule(p->tx_ev);
+    }
+
+    p->tx_dropped++;
+    return NULL;
+  }
+
+  struct bmp_tx_buffer *b = mb_alloc(p->p.pool, sizeof(struct bmp_tx_buffer) + len);
+  b->len = len;
+
+  /* Common header */
+  b->data[0] = BMP_VERSION;
+  put_u32(b->data + 1, len);
+  b->data[5] = type;
+
+  return b;
+}
+
+static void
+bmp_buffer_submit(struct bmp_proto *p, struct bmp_tx_buffer *b)
+{
+  add_tail(&p->tx_queue, &b->n);
+  p->tx_queued += b->len;
+
+  if (!p->tx_busy)
+    ev_schedule(p->tx_ev);
+}
+
+static void
+bmp_buffer_done(struct bmp_proto *p, struct bmp_tx_buffer *b)
+{
+  rem_node(&b->n);
+  p->tx_queued -= b->len;
+  p->tx_sent++;
+  mb_free(b);
+
+  /* Resume paused import table dump when half of the queue is sent */
+  if (!EMPTY_LIST(p->dump_queue) &&
+      (p->tx_queued <= ((struct bmp_config *) p->p.cf)->tx_limit / 2))
+    ev_schedule(p->dump_ev);
+}
+
+static void
+bmp_flush_queue(struct bmp_proto *p)
+{
+  struct bmp_tx_buffer *b;
+  node *n;
+
+  WALK_LIST_DELSAFE(b, n, p->tx_queue)
+  {
+    rem_node(&b->n);
+    mb_free(b);
+  }
+
+  p->tx_queued = 0;
+  p->tx_busy = 0;
+}
+
+/*
+ * Messages are sent one by one directly from their buffers. When one cannot be
+ * sent at once, the rest is sent by the socket and bmp_tx_hook() continues.
+ */
+static void
+bmp_fire_tx(struct bmp_proto *p)
+{
+  while (p->connected && !p->tx_busy && !EMPTY_LIST(p->tx_queue))
+  {
+    struct bmp_tx_buffer *b = HEAD(p->tx_queue);
+
+    sk_set_tbuf(p->sk, b->data);
+    int rv = sk_send(p->sk, b->len);
+
+    /* Error, socket already closed by bmp_err_hook() */
+    if (rv < 0)
+      return;
+
+    if (!rv)
+    {
+      p->tx_busy = 1;
+      return;
+    }
+
+    bmp_buffer_done(p, b);
+  }
+}
+
+static void bmp_close(struct bmp_proto *p);
+static void bmp_schedule_connect(struct bmp_proto *p);
+
+static void
+bmp_tx_event(void *P)
+{
+  struct bmp_proto *p = P;
+
+  if (p->tx_overflow)
+  {
+    bmp_close(p);
+    p->resync_overflow = 1;
+    bmp_schedule_connect(p);
+    return;
+  }
+
+  bmp_fire_tx(p);
+}
+
+static void
+bmp_tx_hook(sock *sk)
+{
+  struct bmp_proto *p = sk->data;
+
+  if (p->tx_busy)
+  {
+    p->tx_busy = 0;
+    bmp_buffer_done(p, HEAD(p->tx_queue));
+  }
+
+  bmp_fire_tx(p);
+}
+
+
+/*
+ *	Messages
+ */
+
+static byte *
+bmp_put_ipa(byte *buf, ip_addr a)
+{
+  if (ipa_is_ip4(a))
+  {
+    memset(buf, 0, 12);
+    put_ip4(buf + 12, ipa_to_ip4(a));
+  }
+  else
+    put_ip6(buf, ipa_to_ip6(a));
+
+  return buf + 16;
+}
+
+static byte *
+bmp_put_tlv(byte *buf, uint type, const char *val)
+{
+  uint len = strlen(val);
+  put_u16(buf, type);
+  put_u16(buf + 2, len);
+  memcpy(buf + 4, val, len);
+  return buf + 4 + len;
+}
+
+static byte *
+bmp_put_per_peer_hdr(byte *buf, struct bgp_proto *bgp)
+{
+  btime now = current_real_time();
+
+  buf[0] = BMP_PEER_TYPE_GLOBAL;
+  buf[1] = (ipa_is_ip4(bgp->remote_ip) ? 0 : BMP_PEER_FLAG_V) |
+    (bgp->as4_session ? 0 : BMP_PEER_FLAG_A);
+  memset(buf + 2, 0, 8);		/* Peer distinguisher */
+  bmp_put_ipa(buf + 10, bgp->remote_ip);
+  put_u32(buf + 26, bgp->remote_as);
+  put_u32(buf + 30, bgp->remote_id);
+  put_u32(buf + 34, now TO_S);
+  put_u32(buf + 38, now % (1 S));
+
+  return buf + BMP_PER_PEER_HDR_SIZE;
+}
+
+static void
+bmp_send_initiation(struct bmp_proto *p)
+{
+  char name[256] = "";
+  gethostname(name, sizeof(name) - 1);
+
+  const char *descr = "BIRD " BIRD_VERSION;
+  struct bmp_tx_buffer *b = bmp_buffer_new(p, BMP_INITIATION, 8 + strlen(descr) + strlen(name));
+  if (!b)
+    return;
+
+  byte *pos = b->data + BMP_COMMON_HDR_SIZE;
+  pos = bmp_put_tlv(pos, BMP_INFO_SYS_DESCR, descr);
+  pos = bmp_put_tlv(pos, BMP_INFO_SYS_NAME, name);
+
+  bmp_buffer_submit(p, b);
+}
+
+static void
+bmp_send_termination(struct bmp_proto *p)
+{
+  struct bmp_tx_buffer *b = bmp_buffer_new(p, BMP_TERMINATION, 6);
+  if (!b)
+    return;
+
+  byte *pos = b->data + BMP_COMMON_HDR_SIZE;
+  put_u16(pos, BMP_TERM_REASON);
+  put_u16(pos + 2, 2);
+  put_u16(pos + 4, BMP_TERM_ADMIN_CLOSE);
+
+  bmp_buffer_submit(p, b);
+}
+
+static void
+bmp_send_peer_up(struct bmp_proto *p, struct bgp_conn *conn)
+{
+  struct bgp_proto *bgp = conn->bgp;
+
+  if (!conn->sk || !conn->local_open_msg || !conn->remote_open_msg)
+    return;
+
+  struct bmp_tx_buffer *b = bmp_buffer_new(p, BMP_PEER_UP, BMP_PER_PEER_HDR_SIZE + 20 +
+					   conn->local_open_length + conn->remote_open_length);
+  if (!b)
+    return;
+
+  byte *pos = b->data + BMP_COMMON_HDR_SIZE;
+  pos = bmp_put_per_peer_hdr(pos, bgp);
+  pos = bmp_put_ipa(pos, conn->sk->saddr);
+  put_u16(pos, conn->sk->sport);
+  put_u16(pos + 2, conn->sk->dport);
+  pos += 4;
+
+  memcpy(pos, conn->local_open_msg, conn->local_open_length);
+  pos += conn->local_open_length;
+  memcpy(pos, conn->remote_open_msg, conn->remote_open_length);
+
+  bmp_buffer_submit(p, b);
+}
+
+static void
+bmp_send_peer_down(struct bmp_proto *p, struct bgp_proto *bgp)
+{
+  uint reason, len;
+
+  switch (bgp->last_error_class)
+  {
+  case BE_BGP_TX:	reason = BMP_DOWN_LOCAL_NOTIFY; len = BGP_HEADER_LENGTH + 2; break;
+  case BE_BGP_RX:	reason = BMP_DOWN_REMOTE_NOTIFY; len = BGP_HEADER_LENGTH + 2; break;
+  case BE_SOCKET:	reason = BMP_DOWN_REMOTE_NO_NOTIFY; len = 0; break;
+  default:		reason = BMP_DOWN_LOCAL_NO_NOTIFY; len = 2; break;
+  }
+
+  struct bmp_tx_buffer *b = bmp_buffer_new(p, BMP_PEER_DOWN, BMP_PER_PEER_HDR_SIZE + 1 + len);
+  if (!b)
+    return;
+
+  byte *pos = b->data + BMP_COMMON_HDR_SIZE;
+  pos = bmp_put_per_peer_hdr(pos, bgp);
+  *pos++ = reason;
+
+  switch (reason)
+  {
+  case BMP_DOWN_LOCAL_NOTIFY:
+  case BMP_DOWN_REMOTE_NOTIFY:
+    /* The NOTIFICATION message, without its data */
+    memset(pos, 0xff, 16);
+    put_u16(pos + 16, BGP_HEADER_LENGTH + 2);
+    pos[18] = PKT_NOTIFICATION;
+    pos[19] = bgp->last_error_code >> 16;
+    pos[20] = bgp->last_error_code & 0xff;
+    break;
+
+  case BMP_DOWN_LOCAL_NO_NOTIFY:
+    /* FSM event code, not available */
+    put_u16(pos, 0);
+    break;
+  }
+
+  bmp_buffer_submit(p, b);
+}
+
+static void
+bmp_send_route_monitor(struct bmp_proto *p, struct bgp_proto *bgp, const byte *pkt, uint len)
+{
+  struct bmp_tx_buffer *b = bmp_buffer_new(p, BMP_ROUTE_MONITOR, BMP_PER_PEER_HDR_SIZE + len);
+  if (!b)
+    return;
+
+  byte *pos = bmp_put_per_peer_hdr(b->data + BMP_COMMON_HDR_SIZE, bgp);
+  memcpy(pos, pkt, len);
+
+  bmp_buffer_submit(p, b);
+}
+
+
+/*
+ *	Import table dumps
+ */
+
+static void
+bmp_dump_free(struct bmp_proto *p, struct bmp_dump *d)
+{
+  /* The head may be paused in the middle of its table */
+  if ((d == HEAD(p->dump_queue)) && p->dump_table)
+  {
+    FIB_ITERATE_UNLINK(&p->dump_fit, &p->dump_table->fib);
+    rt_unlock_table(p->dump_table);
+    p->dump_table = NULL;
+  }
+
+  rem_node(&d->n);
+  mb_free(d);
+}
+
+/* Cancel dumps of @bgp, or all of them if NULL */
+static void
+bmp_cancel_dumps(struct bmp_proto *p, struct bgp_proto *bgp)
+{
+  struct bmp_dump *d;
+  node *n;
+
+  WALK_LIST_DELSAFE(d, n, p->dump_queue)
+    if (!bgp || (d->bgp == bgp))
+      bmp_dump_free(p, d);
+}
+
+/*
+ * Routes of the channel are sent one per Route Monitoring message, each
+ * encoded as the peer would have sent it alone. The walk pauses while more
+ * than half of the queue is used and bmp_buffer_done() resumes it, so even a
+ * large table does not overflow the queue. Returns 0 when paused.
+ */
+static int
+bmp_dump_table(struct bmp_proto *p, struct bmp_dump *d, byte *buf)
+{
+  struct bmp_config *cf = (void *) p->p.cf;
+  struct bgp_channel *c = d->channel;
+
+  if (!p->dump_table)
+  {
+    p->dump_table = c->c.in_table;
+    rt_lock_table(p->dump_table);
+    FIB_ITERATE_INIT(&p->dump_fit, &p->dump_table->fib);
+  }
+
+  FIB_ITERATE_START(&p->dump_table->fib, &p->dump_fit, net, n)
+  {
+    if (p->tx_queued > cf->tx_limit / 2)
+    {
+      FIB_ITERATE_PUT(&p->dump_fit);
+      return 0;
+    }
+
+    for (rte *e = n->routes; e; e = e->next)
+      if (e->sender == &c->c)
+      {
+	byte *end = bgp_bmp_encode_rte(c, buf, e);
+
+	if (end)
+	  bmp_send_route_monitor(p, d->bgp, buf, end - buf);
+	else
+	  log(L_WARN "%s: Route %N of %s is too long, not sent", p->p.name, n->n.addr, d->bgp->p.name);
+      }
+  }
+  FIB_ITERATE_END;
+
+  rt_unlock_table(p->dump_table);
+  p->dump_table = NULL;
+  return 1;
+}
+
+static void
+bmp_dump_event(void *P)
+{
+  struct bmp_proto *p = P;
+  byte *buf = mb_alloc(p->p.pool, BGP_MAX_EXT_MSG_LENGTH);
+
+  while (!EMPTY_LIST(p->dump_queue) && !p->tx_overflow)
+  {
+    struct bmp_dump *d = HEAD(p->dump_queue);
+
+    if (!bmp_dump_table(p, d, buf))
+      break;
+
+    bmp_dump_free(p, d);
+  }
+
+  mb_free(buf);
+}
+
+/*
+ * RFC 7854 expects the current routes of a peer to follow its Peer Up message.
+ * Channels with import table have them, so they are sent from the table by
+ * bmp_dump_event(). Other channels do not keep received routes, these are
+ * requested again from the peer by route refresh and the resent UPDATEs are
+ * mirrored like any other ones. To avoid refresh storms by a slow or flapping
+ * station, bmp_connected() does not allow route refresh after queue overflow,
+ * nor sooner than BMP_REFRESH_INTERVAL after the last one.
+ */
+static void
+bmp_send_routes(struct bmp_proto *p, struct bgp_proto *bgp, int refresh)
+{
+  struct bgp_channel *c;
+  int missing = 0;
+
+  WALK_LIST(c, bgp->p.channels)
+  {
+    if (c->c.channel_state != CS_UP)
+      continue;
+
+    if (c->c.in_table)
+    {
+      struct bmp_dump *d = mb_allocz(p->p.pool, sizeof(struct bmp_dump));
+      d->bgp = bgp;
+      d->channel = c;
+      add_tail(&p->dump_queue, &d->n);
+      ev_schedule(p->dump_ev);
+    }
+    else if (refresh && bgp->route_refresh)
+    {
+      bgp_schedule_packet(bgp->conn, c, PKT_ROUTE_REFRESH);
+      p->refresh_time = current_time();
+    }
+    else
+      missing = 1;
+  }
+
+  if (missing)
+    log(L_WARN "%s: Current routes of %s are not sent, import table is needed", p->p.name, bgp->p.name);
+}
+
+/*
+ *	Hooks called by BGP
+ */
+
+static inline int
+bmp_monitors(struct bmp_proto *p, struct bgp_proto *bgp UNUSED)
+{
+  return p->connected && !p->tx_overflow;
+}
+
+/**
+ * bmp_peer_up - announce established BGP session
+ * @conn: BGP connection which has just been established
+ *
+ * The OPEN messages sent and received on @conn are used for the Peer Up
+ * message.
+ */
+void
+bmp_peer_up(struct bgp_conn *conn)
+{
+  struct bmp_proto *p;
+  node *n;
+
+  WALK_LIST(n, bmp_proto_list)
+  {
+    p = SKIP_BACK(struct bmp_proto, bmp_node, n);
+    if (bmp_monitors(p, conn->bgp))
+      bmp_send_peer_up(p, conn);
+  }
+}
+
+/**
+ * bmp_peer_down - announce closed BGP session
+ * @bgp: BGP instance whose session left the established state
+ *
+ * The reason is taken from the last error of @bgp. Pending dumps of its
+ * import tables are cancelled.
+ */
+void
+bmp_peer_down(struct bgp_proto *bgp)
+{
+  struct bmp_proto *p;
+  node *n;
+
+  WALK_LIST(n, bmp_proto_list)
+  {
+    p = SKIP_BACK(struct bmp_proto, bmp_node, n);
+    bmp_cancel_dumps(p, bgp);
+
+    if (bmp_monitors(p, bgp))
+      bmp_send_peer_down(p, bgp);
+  }
+}
+
+/**
+ * bmp_route_monitor - mirror received UPDATE message
+ * @bgp: BGP instance
+ * @pkt: whole received message, including the BGP header
+ * @len: length of @pkt
+ */
+void
+bmp_route_monitor(struct bgp_proto *bgp, const byte *pkt, uint len)
+{
+  struct bmp_proto *p;
+  node *n;
+
+  WALK_LIST(n, bmp_proto_list)
+  {
+    p = SKIP_BACK(struct bmp_proto, bmp_node, n);
+    if (bmp_monitors(p, bgp))
+      bmp_send_route_monitor(p, bgp, pkt, len);
+  }
+}
+
+
+/*
+ *	Connection to the station
+ */
+
+static void
+bmp_close(struct bmp_proto *p)
+{
+  if (p->sk)
+  {
+    rfree(p->sk);
+    p->sk = NULL;
+  }
+
+  p->connected = 0;
+  p->tx_overflow = 0;
+  bmp_cancel_dumps(p, NULL);
+  bmp_flush_queue(p);
+}
+
+static void
+bmp_schedule_connect(struct bmp_proto *p)
+{
+  struct bmp_config *cf = (void *) p->p.cf;
+  tm_start(p->connect_timer, cf->connect_retry_time S);
+}
+
+static void
+bmp_err_hook(sock *sk, int err)
+{
+  struct bmp_proto *p = sk->data;
+
+  if (err)
+    log(L_REMOTE "%s: Connection lost: %M", p->p.name, err);
+  else
+    log(L_REMOTE "%s: Connection closed by station", p->p.name);
+
+  bmp_close(p);
+
+  if (p->p.proto_state == PS_UP)
+    bmp_schedule_connect(p);
+}
+
+static int
+bmp_rx_hook(sock *sk UNUSED, uint size UNUSED)
+{
+  /* The station is not supposed to send anything */
+  return 1;
+}
+
+static void
+bmp_connected(sock *sk)
+{
+  struct bmp_proto *p = sk->data;
+  struct proto *P;
+
+  TRACE(D_EVENTS, "Connected to %I port %u", sk->daddr, sk->dport);
+
+  sk->rx_hook = bmp_rx_hook;
+  sk->tx_hook = bmp_tx_hook;
+  p->connected = 1;
+  p->tx_sent = 0;
+
+  /* Route refresh is limited, see bmp_send_routes() */
+  int refresh = !p->resync_overflow &&
+    (!p->refresh_time || (current_time() >= p->refresh_time + BMP_REFRESH_INTERVAL S));
+  p->resync_overflow = 0;
+
+  bmp_send_initiation(p);
+
+  /* Sessions established in the meantime */
+  WALK_LIST(P, proto_list)
+    if ((P->proto == &proto_bgp) && (P->proto_state == PS_UP))
+    {
+      struct bgp_proto *bgp = (void *) P;
+      if (bgp->conn && (bgp->conn->state == BS_ESTABLISHED) && bmp_monitors(p, bgp))
+      {
+	bmp_send_peer_up(p, bgp->conn);
+	bmp_send_routes(p, bgp, refresh);
+      }
+    }
+}
+
+static void
+bmp_connect(struct bmp_proto *p)
+{
+  struct bmp_config *cf = (void *) p->p.cf;
+
+  sock *sk = sk_new(p->p.pool);
+  sk->type = SK_TCP_ACTIVE;
+  sk->daddr = cf->station_ip;
+  sk->dport = cf->station_port;
+  sk->rbsize = BMP_RX_BUFFER_SIZE;
+  sk->tbsize = BMP_TX_BUFFER_SIZE;
+  sk->tos = IP_PREC_INTERNET_CONTROL;
+  sk->tx_hook = bmp_connected;
+  sk->err_hook = bmp_err_hook;
+  sk->data = p;
+
+  p->sk = sk;
+  TRACE(D_EVENTS, "Connecting to %I port %u", sk->daddr, sk->dport);
+
+  if (sk_open(sk) < 0)
+  {
+    sk_log_error(sk, p->p.name);
+    bmp_close(p);
+    bmp_schedule_connect(p);
+  }
+}
+
+static void
+bmp_connect_timer(timer *t)
+{
+  struct bmp_proto *p = t->data;
+
+  if (!p->sk)
+    bmp_connect(p);
+}
+
+
+/*
+ *	Protocol glue
+ */
+
+void
+bmp_init_all(void)
+{
+  init_list(&bmp_proto_list);
+}
+
+void
+bmp_check_config(struct proto_config *CF)
+{
+  struct bmp_config *cf = (void *) CF;
+
+  if (ipa_zero(cf->station_ip))
+    cf_error("Station address not specified");
+
+  if (!cf->station_port)
+    cf_error("Station port not specified");
+}
+
+static struct proto *
+bmp_init(struct proto_config *CF)
+{
+  return proto_new(CF);
+}
+
+static int
+bmp_start(struct proto *P)
+{
+  struct bmp_proto *p = (void *) P;
+
+  init_list(&p->tx_queue);
+  init_list(&p->dump_queue);
+  p->tx_queued = 0;
+  p->tx_busy = p->tx_overflow = p->resync_overflow = p->connected = 0;
+  p->dump_table = NULL;
+  p->refresh_time = 0;
+  p->sk = NULL;
+
+  p->tx_ev = ev_new_init(P->pool, bmp_tx_event, p);
+  p->dump_ev = ev_new_init(P->pool, bmp_dump_event, p);
+  p->connect_timer = tm_new_init(P->pool, bmp_connect_timer, p, 0, 0);
+  add_tail(&bmp_proto_list, &p->bmp_node);
+
+  bmp_connect(p);
+
+  return PS_UP;
+}
+
+static int
+bmp_shutdown(struct proto *P)
+{
+  struct bmp_proto *p = (void *) P;
+
+  rem_node(&p->bmp_node);
+
+  /* Best effort, whatever is not sent immediately is lost */
+  if (p->connected)
+  {
+    bmp_send_termination(p);
+    bmp_fire_tx(p);
+  }
+
+  bmp_close(p);
+
+  return PS_DOWN;
+}
+
+static int
+bmp_reconfigure(struct proto *P, struct proto_config *CF)
+{
+  struct bmp_config *old = (void *) P->cf;
+  struct bmp_config *new = (void *) CF;
+
+  return ipa_equal(old->station_ip, new->station_ip) &&
+    (old->station_port == new->station_port) &&
+    (old->connect_retry_time == new->connect_retry_time);
+}
+
+static void
+bmp_copy_config(struct proto_config *dest UNUSED, struct proto_config *src UNUSED)
+{
+  /* Just a shallow copy, not many items here */
+}
+
+static void
+bmp_get_status(struct proto *P, byte *buf)
+{
+  struct bmp_proto *p = (void *) P;
+
+  if (P->proto_state == PS_DOWN)
+    *buf = 0;
+  else
+    bsprintf(buf, p->connected ? "Connected" : "Connecting");
+}
+
+static void
+bmp_show_proto_info(struct proto *P)
+{
+  struct bmp_proto *p = (void *) P;
+  struct bmp_config *cf = (void *) P->cf;
+
+  if (P->proto_state == PS_DOWN)
+    return;
+
+  cli_msg(-1006, "  Station:          %I port %u", cf->station_ip, cf->station_port);
+  cli_msg(-1006, "  Status:           %s", p->connected ? "Connected" : "Connecting");
+  cli_msg(-1006, "  Queued:           %u of %u bytes", p->tx_queued, cf->tx_limit);
+  cli_msg(-1006, "  Messages sent:    %lu", p->tx_sent);
+  cli_msg(-1006, "  Messages dropped: %lu", p->tx_dropped);
+}
+
+struct protocol proto_bmp = {
+  .name =		"BMP",
+  .template =		"bmp%d",
+  .class =		PROTOCOL_BMP,
+  .proto_size =		sizeof(struct bmp_proto),
+  .config_size =	sizeof(struct bmp_config),
+  .init =		bmp_init,
+  .start =		bmp_start,
+  .shutdown =		bmp_shutdown,
+  .reconfigure =	bmp_reconfigure,
+  .copy_config =	bmp_copy_config,
+  .get_status =		bmp_get_status,
+  .show_proto_info =	bmp_show_proto_info,
+};
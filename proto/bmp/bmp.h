@@ -0,0 +1,111 @@
+/*
+ *	BIRD -- BGP Monitoring Protocol (BMP)
+ *
+ *	Can be freely distributed and used under the terms of the GNU GPL.
+ */
+
+#ifndef _BIRD_BMP_H_
+#define _BIRD_BMP_H_
+
+#include "nest/bird.h"
+#include "nest/protocol.h"
+#include "nest/route.h"
+#include "lib/lists.h"
+#include "lib/socket.h"
+#include "lib/event.h"
+
+struct bgp_proto;
+struct bgp_conn;
+struct bgp_channel;
+
+struct bmp_config {
+  struct proto_config c;
+  ip_addr station_ip;			/* Address of the monitoring station */
+  uint station_port;			/* Port of the monitoring station */
+  uint tx_limit;			/* Limit of queued messages [bytes] */
+  uint connect_retry_time;		/* Time between connection attempts [s] */
+};
+
+struct bmp_proto {
+  struct proto p;
+  node bmp_node;			/* Node in bmp_proto_list */
+  sock *sk;				/* Connection to the station, NULL if closed */
+  timer *connect_timer;			/* Next connection attempt */
+  event *tx_ev;				/* Sending of queued messages */
+  list tx_queue;			/* Messages to be sent (struct bmp_tx_buffer) */
+  uint tx_queued;			/* Bytes in tx_queue */
+  u64 tx_sent;				/* Messages sent in this connection */
+  u64 tx_dropped;			/* Messages dropped due to full tx_queue */
+  u8 connected;				/* Connection established, Initiation sent */
+  u8 tx_busy;				/* Head of tx_queue is being sent from sk->tbuf */
+  u8 tx_overflow;			/* Queue overflowed, reconnect is pending */
+  u8 resync_overflow;			/* Connection follows a queue overflow */
+  event *dump_ev;			/* Sending of import tables */
+  list dump_queue;			/* Import tables to be sent (struct bmp_dump) */
+  struct fib_iterator dump_fit;		/* Position in the head of dump_queue */
+  rtable *dump_table;			/* Locked table of the head of dump_queue, NULL if not started */
+  btime refresh_time;			/* Last route refresh request */
+};
+
+struct bmp_dump {
+  node n;
+  struct bgp_proto *bgp;
+  struct bgp_channel *channel;		/* Channel whose routes are sent from its import table */
+};
+
+struct bmp_tx_buffer {
+  node n;
+  uint len;
+  byte data[0];
+};
+
+#define BMP_VERSION		3
+#define BMP_COMMON_HDR_SIZE	6
+#define BMP_PER_PEER_HDR_SIZE	42
+
+/* Message types, RFC 7854 4.1 */
+#define BMP_ROUTE_MONITOR	0
+#define BMP_STATS_REPORT	1
+#define BMP_PEER_DOWN		2
+#define BMP_PEER_UP		3
+#define BMP_INITIATION		4
+#define BMP_TERMINATION		5
+
+/* Per-peer header, RFC 7854 4.2 */
+#define BMP_PEER_TYPE_GLOBAL	0
+#define BMP_PEER_FLAG_V		0x80	/* IPv6 peer address */
+#define BMP_PEER_FLAG_L		0x40	/* Post-policy Adj-RIB-In */
+#define BMP_PEER_FLAG_A		0x20	/* Legacy 2-byte AS_PATH format */
+
+/* Information TLVs, RFC 7854 4.3 and 4.5 */
+#define BMP_INFO_STRING		0
+#define BMP_INFO_SYS_DESCR	1
+#define BMP_INFO_SYS_NAME	2
+#define BMP_TERM_REASON		1
+#define BMP_TERM_ADMIN_CLOSE	0
+
+/* Peer Down reasons, RFC 7854 4.9 */
+#define BMP_DOWN_LOCAL_NOTIFY	1
+#define BMP_DOWN_LOCAL_NO_NOTIFY 2
+#define BMP_DOWN_REMOTE_NOTIFY	3
+#define BMP_DOWN_REMOTE_NO_NOTIFY 4
+
+#define BMP_DEFAULT_TX_LIMIT	16		/* [MB] */
+#define BMP_DEFAULT_CONNECT_RETRY 30		/* [s] */
+#define BMP_REFRESH_INTERVAL	300		/* [s] */
+#define BMP_RX_BUFFER_SIZE	1024
+#define BMP_TX_BUFFER_SIZE	1024
+
+#ifdef CONFIG_BMP
+void bmp_init_all(void);
+void bmp_peer_up(struct bgp_conn *conn);
+void bmp_peer_down(struct bgp_proto *p);
+void bmp_route_monitor(struct bgp_proto *p, const byte *pkt, uint len);
+void bmp_check_config(struct proto_config *C);
+#else
+static inline void bmp_peer_up(struct bgp_conn *conn UNUSED) { }
+static inline void bmp_peer_down(struct bgp_proto *p UNUSED) { }
+static inline void bmp_route_monitor(struct bgp_proto *p UNUSED, const byte *pkt UNUSED, uint len UNUSED) { }
+#endif
+
+#endif	/* _BIRD_BMP_H_ */
@@ -17,7 +17,10 @@
  * dump, the key structure is struct mrt_table_dump_state, which contains all
  * necessary data and created when the MRT dump cycle is started for the
  * duration of the MRT dump. The MBGP4MP dump is currently not bound to MRT
- * protocol instance and uses the config->mrtdump_file fd.
+ * protocol instance and uses the config->mrtdump_file fd. Its messages are
+ * collected by a global struct mrt_writer, which is flushed by a timer and
+ * drops messages (reporting their number) when its buffer is full, so the
+ * BGP receive path never waits for the disk.
  *
  * The protocol is simple, just periodically scans routing table and export it
  * to a file. It does not use the regular update mechanism, but a direct access
@@ -34,11 +37,18 @@
  * filters) are shared from the config and the running table dump may be
  * interrupted by reconfiguration.
  *
+ * Table dump messages are not written one by one, they are collected in large
+ * chunks by struct mrt_writer and written by its own thread, so the main loop
+ * does not wait for the disk. When the writer falls behind, the dump step is
+ * ended early and the dump continues in the next event.
+ *
  * Supported standards:
  * - RFC 6396 - MRT format standard
  * - RFC 8050 - ADD_PATH extension
  */
 
+#include <stdio.h>
+#include <stdlib.h>
 #include <unistd.h>
 #include <limits.h>
 #include <errno.h>
@@ -50,6 +60,10 @@
 #include "proto/bgp/bgp.h"
 #include "sysdep/unix/unix.h"
 
+#ifdef USE_PTHREADS
+#include <pthread.h>
+#endif
+
 
 #ifdef PATH_MAX
 #define BIRD_PATH_MAX PATH_MAX
@@ -169,8 +183,8 @@ mrt_init_message(buffer *b, u16 type, u16 subtype)
   mrt_put_u32_(b, 0);
 }
 
-static void
-mrt_dump_message(buffer *b, int fd)
+static uint
+mrt_finish_message(buffer *b)
 {
   uint len = mrt_buffer_pos(b);
 
@@ -178,6 +192,14 @@ mrt_dump_message(buffer *b, int fd)
   ASSERT(len >= MRT_HDR_LENGTH);
   put_u32(b->start + 8, len - MRT_HDR_LENGTH);
 
+  return len;
+}
+
+static void
+mrt_dump_message(buffer *b, int fd)
+{
+  uint len = mrt_finish_message(b);
+
   if (fd < 0)
     return;
 
@@ -185,6 +207,266 @@ mrt_dump_message(buffer *b, int fd)
     log(L_ERR "Write to MRT file failed: %m"); /* TODO: name of file */
 }
 
+/*
+ *	MRT output writer
+ *
+ *	Messages are collected into large chunks, which are written to the file
+ *	by a dedicated writer thread (or synchronously when built without
+ *	threads). The producer never waits for the disk, it may check
+ *	mrt_writer_busy() to throttle itself when too much data is queued, or
+ *	use mrt_writer_try_put(), which drops the message instead. The writer
+ *	uses its own duplicate of the file descriptor, so the file may be closed
+ *	by its owner while data are still queued.
+ */
+
+struct mrt_chunk {
+  struct mrt_chunk *next;
+  uint len;
+  byte data[0];
+};
+
+struct mrt_writer {
+  resource r;
+  int fd;				/* Output file, our duplicate */
+  int src_fd;				/* Output file as passed to mrt_writer_new() */
+  uint chunk_size;			/* Size of data in one chunk */
+  uint max_queued;			/* Queued bytes limit for mrt_writer_busy() */
+  uint dropped;				/* Messages dropped by mrt_writer_try_put() */
+  struct mrt_chunk *cur;		/* Chunk being filled */
+  u64 written;				/* Bytes written, updated by writer thread */
+  uint queued;				/* Bytes submitted but not written */
+#ifdef USE_PTHREADS
+  pthread_t thread;
+  pthread_mutex_t lock;			/* Protects fields below and queued */
+  pthread_cond_t cond;			/* Signalled on queue change */
+  struct mrt_chunk *first, **last;	/* Queue of chunks to be written */
+  int stop;				/* Writer thread should exit when queue is empty */
+#endif
+};
+
+static void
+mrt_write_chunk(struct mrt_writer *w, struct mrt_chunk *c)
+{
+  byte *pos = c->data, *end = c->data + c->len;
+
+  while ((w->fd >= 0) && (pos < end))
+  {
+    ssize_t n = write(w->fd, pos, end - pos);
+
+    if (n < 0)
+    {
+      if (errno == EINTR)
+	continue;
+
+      log(L_ERR "Write to MRT file failed: %m");
+      break;
+    }
+
+    pos += n;
+  }
+
+  w->written += c->len;
+  xfree(c);
+}
+
+#ifdef USE_PTHREADS
+
+static void *
+mrt_writer_thread(void *W)
+{
+  struct mrt_writer *w = W;
+
+  pthread_mutex_lock(&w->lock);
+  while (1)
+  {
+    struct mrt_chunk *c = w->first;
+
+    if (!c)
+    {
+      if (w->stop)
+	break;
+
+      pthread_cond_wait(&w->cond, &w->lock);
+      continue;
+    }
+
+    w->first = c->next;
+    if (!w->first)
+      w->last = &w->first;
+
+    uint len = c->len;
+    pthread_mutex_unlock(&w->lock);
+    mrt_write_chunk(w, c);
+    pthread_mutex_lock(&w->lock);
+
+    w->queued -= len;
+    pthread_cond_broadcast(&w->cond);
+  }
+  pthread_mutex_unlock(&w->lock);
+
+  return NULL;
+}
+
+static void
+mrt_writer_submit(struct mrt_writer *w)
+{
+  struct mrt_chunk *c = w->cur;
+  w->cur = NULL;
+
+  if (!c || !c->len)
+  {
+    xfree(c);
+    return;
+  }
+
+  c->next = NULL;
+
+  pthread_mutex_lock(&w->lock);
+  *w->last = c;
+  w->last = &c->next;
+  w->queued += c->len;
+  pthread_cond_broadcast(&w->cond);
+  pthread_mutex_unlock(&w->lock);
+}
+
+static uint
+mrt_writer_queued(struct mrt_writer *w)
+{
+  pthread_mutex_lock(&w->lock);
+  uint queued = w->queued;
+  pthread_mutex_unlock(&w->lock);
+
+  return queued;
+}
+
+#else
+
+static void
+mrt_writer_submit(struct mrt_writer *w)
+{
+  struct mrt_chunk *c = w->cur;
+  w->cur = NULL;
+
+  if (c && c->len)
+    mrt_write_chunk(w, c);
+  else
+    xfree(c);
+}
+
+static inline uint mrt_writer_queued(struct mrt_writer *w UNUSED) { return 0; }
+
+#endif
+
+static void
+mrt_writer_put(struct mrt_writer *w, const byte *data, uint len)
+{
+  if (w->cur && (w->cur->len + len > w->chunk_size))
+    mrt_writer_submit(w);
+
+  if (!w->cur)
+  {
+    uint size = MAX(w->chunk_size, len);
+    w->cur = xmalloc(sizeof(struct mrt_chunk) + size);
+    w->cur->len = 0;
+  }
+
+  memcpy(w->cur->data + w->cur->len, data, len);
+  w->cur->len += len;
+}
+
+static inline int
+mrt_writer_busy(struct mrt_writer *w)
+{
+  return mrt_writer_queued(w) > w->max_queued;
+}
+
+static int
+mrt_writer_try_put(struct mrt_writer *w, const byte *data, uint len)
+{
+  uint pending = mrt_writer_queued(w) + (w->cur ? w->cur->len : 0);
+
+  if (pending + len > w->max_queued)
+  {
+    w->dropped++;
+    return 0;
+  }
+
+  mrt_writer_put(w, data, len);
+  return 1;
+}
+
+static void
+mrt_writer_free(resource *r)
+{
+  struct mrt_writer *w = (void *) r;
+
+  mrt_writer_submit(w);
+
+#ifdef USE_PTHREADS
+  pthread_mutex_lock(&w->lock);
+  w->stop = 1;
+  pthread_cond_broadcast(&w->cond);
+  pthread_mutex_unlock(&w->lock);
+
+  pthread_join(w->thread, NULL);
+  pthread_cond_destroy(&w->cond);
+  pthread_mutex_destroy(&w->lock);
+#endif
+
+  if (w->fd >= 0)
+    close(w->fd);
+}
+
+static void
+mrt_writer_dump(resource *r)
+{
+  struct mrt_writer *w = (void *) r;
+  debug("(fd %d, %u queued, %lu written, %u dropped)\n", w->fd, w->queued, w->written, w->dropped);
+}
+
+static size_t
+mrt_writer_memsize(resource *r)
+{
+  struct mrt_writer *w = (void *) r;
+  return sizeof(struct mrt_writer) + w->queued + (w->cur ? w->chunk_size : 0) + ALLOC_OVERHEAD;
+}
+
+static struct resclass mrt_writer_class = {
+  "MRT writer",
+  sizeof(struct mrt_writer),
+  mrt_writer_free,
+  mrt_writer_dump,
+  NULL,
+  mrt_writer_memsize
+};
+
+static struct mrt_writer *
+mrt_writer_new(pool *pool, int fd, uint chunk_size, uint max_queued)
+{
+  struct mrt_writer *w = ralloc(pool, &mrt_writer_class);
+
+  w->fd = dup(fd);
+  w->src_fd = fd;
+  w->chunk_size = chunk_size;
+
+  if (w->fd < 0)
+    log(L_ERR "Cannot duplicate MRT file descriptor: %m");
+
+  w->max_queued = max_queued;
+
+#ifdef USE_PTHREADS
+  w->last = &w->first;
+  pthread_mutex_init(&w->lock, NULL);
+  pthread_cond_init(&w->cond, NULL);
+
+  int e = pthread_create(&w->thread, NULL, mrt_writer_thread, w);
+  if (e)
+    die("pthread_create: %M", e);
+#endif
+
+  return w;
+}
+
 static int
 bstrsub(char *dst, size_t n, const char *src, const char *key, const char *val)
 {
@@ -275,6 +557,7 @@ mrt_open_file(struct mrt_table_dump_state *s)
   }
 
   s->fd = rf_fileno(s->file);
+  s->writer = mrt_writer_new(s->pool, s->fd, MRT_WRITER_CHUNK_SIZE, MRT_WRITER_MAX_QUEUED);
   s->time_offset = now_real - now;
 
   return 1;
@@ -283,12 +566,24 @@ mrt_open_file(struct mrt_table_dump_state *s)
 static void
 mrt_close_file(struct mrt_table_dump_state *s)
 {
+  /* Writer thread must finish before the file is closed */
+  rfree(s->writer);
+  s->writer = NULL;
+
   rfree(s->file);
   s->file = NULL;
   s->fd = -1;
 }
 
 
+static void
+mrt_table_dump_message(struct mrt_table_dump_state *s)
+{
+  uint len = mrt_finish_message(&s->buf);
+  mrt_writer_put(s->writer, s->buf.start, len);
+}
+
+
 /*
  *	MRT Table Dump: Peer Index Table
  */
@@ -368,7 +663,7 @@ mrt_peer_table_dump(struct mrt_table_dump_state *s)
   /* Fix Peer Count */
   put_u16(s->buf.start + s->peer_count_offset, s->peer_count);
 
-  mrt_dump_message(&s->buf, s->fd);
+  mrt_table_dump_message(s);
 }
 
 static void
@@ -472,7 +767,7 @@ mrt_rib_table_entry(struct mrt_table_dump_state *s, rte *r)
 }
 
 static void
-mrt_rib_table_dump(struct mrt_table_dump_state *s, net *n, int add_path)
+mrt_rib_table_dump(struct mrt_table_dump_state *s, net *n, rte **routes, int add_path)
 {
   s->add_path = s->bws->add_path = add_path;
 
@@ -483,8 +778,8 @@ mrt_rib_table_dump(struct mrt_table_dump_state *s, net *n, int add_path)
   mrt_init_message(&s->buf, MRT_TABLE_DUMP_V2, subtype);
   mrt_rib_table_header(s, n->n.addr);
 
-  rte *rt, *rt0;
-  for (rt0 = n->routes; rt = rt0; rt0 = rt0->next)
+  rte *rt, *rt0, **pos;
+  for (pos = routes; rt = rt0 = *pos; pos++)
   {
     if (rte_is_filtered(rt))
       continue;
@@ -518,7 +813,7 @@ mrt_rib_table_dump(struct mrt_table_dump_state *s, net *n, int add_path)
     return;
 
   s->seqnum++;
-  mrt_dump_message(&s->buf, s->fd);
+  mrt_table_dump_message(s);
 }
 
 
@@ -550,7 +845,10 @@ static void
 mrt_table_dump_free(struct mrt_table_dump_state *s)
 {
   if (s->table_open)
-    FIB_ITERATE_UNLINK(&s->fit, &s->table->fib);
+    rfree(s->snapshot);
+
+  if (s->file)
+    mrt_close_file(s);
 
   if (s->table)
     rt_unlock_table(s->table);
@@ -582,28 +880,32 @@ mrt_table_dump_step(struct mrt_table_dump_state *s)
 
     mrt_peer_table_dump(s);
 
-    FIB_ITERATE_INIT(&s->fit, &s->table->fib);
+    s->snapshot = rt_snapshot_new(s->pool, s->table);
+    s->snapshot_pos = s->snapshot->data;
     s->table_open = 1;
 
   step:
-    FIB_ITERATE_START(&s->table->fib, &s->fit, net, n)
+    for (rte **pos = s->snapshot_pos; pos < s->snapshot->end; pos = rt_snapshot_next(pos))
     {
-      if (s->max < 0)
+      if ((s->max < 0) || mrt_writer_busy(s->writer))
       {
-	FIB_ITERATE_PUT(&s->fit);
+	s->snapshot_pos = pos;
 	return 0;
       }
 
+      net *n = pos[0]->net;
+
       /* With Always ADD_PATH option, we jump directly to second phase */
       s->want_add_path = s->always_add_path;
 
       if (s->want_add_path == 0)
-	mrt_rib_table_dump(s, n, 0);
+	mrt_rib_table_dump(s, n, pos, 0);
 
       if (s->want_add_path == 1)
-	mrt_rib_table_dump(s, n, 1);
+	mrt_rib_table_dump(s, n, pos, 1);
     }
-    FIB_ITERATE_END;
+    rfree(s->snapshot);
+    s->snapshot = NULL;
     s->table_open = 0;
 
     mrt_close_file(s);
@@ -718,6 +1020,400 @@ mrt_dump_cmd(struct mrt_dump_data *d)
 }
 
 
+/*
+ *	MRT Table Load
+ */
+
+#ifdef CONFIG_BGP
+
+static struct mrt_load_state *
+mrt_table_load_init(struct mrt_proto *p)
+{
+  struct mrt_config *cf = (void *) (p->p.cf);
+  struct channel *c = p->p.main_channel;
+  pool *pool = rp_new(p->p.pool, "MRT Table Load");
+  struct mrt_load_state *s = mb_allocz(pool, sizeof(struct mrt_load_state));
+
+  s->proto = p;
+  s->pool = pool;
+  s->linpool = lp_new(pool, 4080);
+  mrt_buffer_init(&s->buf, pool, MRT_ATTR_BUFFER_SIZE);
+  s->igp_table = cf->igp_table ? cf->igp_table->table : c->table;
+
+  s->file = rf_open(pool, cf->load_file, "r");
+  if (!s->file)
+  {
+    log(L_ERR "%s: Unable to open MRT file '%s': %m", p->p.name, cf->load_file);
+    rfree(pool);
+    return NULL;
+  }
+
+  return s;
+}
+
+static int
+mrt_load_peer_table(struct mrt_load_state *s, byte *pos, byte *end)
+{
+  /* Collector BGP ID, View Name Length, View Name, Peer Count */
+  if (end - pos < 6)
+    return 0;
+
+  uint name_len = get_u16(pos + 4);
+  pos += 6;
+
+  if (end - pos < name_len + 2)
+    return 0;
+
+  pos += name_len;
+  uint count = get_u16(pos);
+  pos += 2;
+
+  if (s->peers)
+    mb_free(s->peers);
+
+  s->peers = mb_allocz(s->pool, MAX(count, 1) * sizeof(struct mrt_load_peer));
+  s->peer_count = 0;
+
+  for (uint i = 0; i < count; i++)
+  {
+    /* Peer Type, Peer BGP ID */
+    if (end - pos < 5)
+      return 0;
+
+    uint type = pos[0];
+    uint alen = (type & MRT_PEER_TYPE_IPV6) ? 16 : 4;
+    uint aslen = (type & MRT_PEER_TYPE_32BIT_ASN) ? 4 : 2;
+    pos += 5;
+
+    if (end - pos < alen + aslen)
+      return 0;
+
+    s->peers[i].ip = (alen == 16) ? ipa_from_ip6(get_ip6(pos)) : ipa_from_ip4(get_ip4(pos));
+    pos += alen;
+
+    s->peers[i].as = (aslen == 4) ? get_u32(pos) : get_u16(pos);
+    pos += aslen;
+  }
+
+  s->peer_count = count;
+  return 1;
+}
+
+static int
+mrt_load_next_hop(byte *data, uint len, ip_addr *nh)
+{
+  switch (len)
+  {
+  case 4:
+    nh[0] = ipa_from_ip4(get_ip4(data));
+    return 1;
+
+  case 16:
+    nh[0] = ipa_from_ip6(get_ip6(data));
+    return 1;
+
+  case 32:
+    nh[0] = ipa_from_ip6(get_ip6(data));
+    nh[1] = ipa_from_ip6(get_ip6(data + 16));
+    return 1;
+
+  default:
+    return 0;
+  }
+}
+
+static int
+mrt_load_route(struct mrt_load_state *s, net_addr *n, uint peer, u32 path_id, byte *data, uint len)
+{
+  struct mrt_proto *p = s->proto;
+  struct channel *c = p->p.main_channel;
+  ip_addr nh[2] = { IPA_NONE, IPA_NONE };
+
+  if (peer >= s->peer_count)
+    return 0;
+
+  /*
+   * RIB entries carry an abbreviated MP_REACH_NLRI with just the next hop
+   * (RFC 6396 4.3.4), which the BGP decoder does not understand. We collect
+   * next hops here and pass the other attributes to the BGP decoder.
+   */
+  byte *buf = lp_alloc(s->linpool, len);
+  byte *dst = buf, *pos = data, *end = data + len;
+
+  while (pos < end)
+  {
+    if (end - pos < 3)
+      return 0;
+
+    uint flags = pos[0];
+    uint code = pos[1];
+    uint hlen = (flags & BAF_EXT_LEN) ? 4 : 3;
+
+    if (end - pos < hlen)
+      return 0;
+
+    uint alen = (flags & BAF_EXT_LEN) ? get_u16(pos + 2) : pos[2];
+
+    if (end - pos < hlen + alen)
+      return 0;
+
+    byte *adata = pos + hlen;
+
+    if (code == BA_MP_REACH_NLRI)
+    {
+      if (!alen || ((uint) adata[0] + 1 > alen) || !mrt_load_next_hop(adata + 1, adata[0], nh))
+	return 0;
+    }
+    else if ((code == BA_NEXT_HOP) && ipa_zero(nh[0]))
+    {
+      if (!mrt_load_next_hop(adata, alen, nh))
+	return 0;
+    }
+
+    if ((code != BA_MP_REACH_NLRI) && (code != BA_MP_UNREACH_NLRI))
+    {
+      memcpy(dst, pos, hlen + alen);
+      dst += hlen + alen;
+    }
+
+    pos += hlen + alen;
+  }
+
+  ea_list *ea = bgp_decode_attrs_raw(s->linpool, p->p.name, buf, dst - buf);
+  if (!ea)
+    return 0;
+
+  /* The BGP decoder keeps next hop out of attributes */
+  if (ipa_nonzero(nh[0]))
+    bgp_set_attr_data(&ea, s->linpool, BA_NEXT_HOP, 0, nh, ipa_nonzero(nh[1]) ? 32 : 16);
+
+  /* Separate route source for each peer and path ID */
+  struct rte_src *src = rt_get_source(&p->p, (path_id << 16) + peer + 1);
+
+  rta a0 = {
+    .src = src,
+    .source = RTS_BGP,
+    .scope = SCOPE_UNIVERSE,
+    .dest = RTD_UNREACHABLE,
+    .from = s->peers[peer].ip,
+    .eattrs = ea,
+  };
+
+  /* Loaded routes are resolved recursively, like multihop BGP routes */
+  if (ipa_nonzero(nh[0]) && (ipa_is_ip4(nh[0]) == (n->type == NET_IP4)))
+    rta_set_recursive_next_hop(c->table, &a0, s->igp_table, nh[0], nh[1], NULL);
+
+  rte *e = rte_get_temp(rta_lookup(&a0));
+  e->pflags = 0;
+
+  rte_update2(c, n, e, src);
+  return 1;
+}
+
+static int
+mrt_load_rib(struct mrt_load_state *s, byte *pos, byte *end, int add_path)
+{
+  int ipv4 = (s->proto->p.main_channel->net_type == NET_IP4);
+  net_addr net;
+
+  /* Sequence Number, Prefix Length */
+  if (end - pos < 5)
+    return 0;
+
+  uint pxlen = pos[4];
+  uint bytes = BYTES(pxlen);
+  pos += 5;
+
+  if ((pxlen > (ipv4 ? IP4_MAX_PREFIX_LENGTH : IP6_MAX_PREFIX_LENGTH)) || (end - pos < bytes + 2))
+    return 0;
+
+  if (ipv4)
+  {
+    ip4_addr a = IP4_NONE;
+    memcpy(&a, pos, bytes);
+    net_fill_ip4(&net, ip4_ntoh(a), pxlen);
+    net_normalize_ip4((net_addr_ip4 *) &net);
+  }
+  else
+  {
+    ip6_addr a = IP6_NONE;
+    memcpy(&a, pos, bytes);
+    net_fill_ip6(&net, ip6_ntoh(a), pxlen);
+    net_normalize_ip6((net_addr_ip6 *) &net);
+  }
+
+  pos += bytes;
+  uint count = get_u16(pos);
+  pos += 2;
+
+  for (uint i = 0; i < count; i++)
+  {
+    /* Peer Index, Originated Time, [Path Identifier], Attribute Length */
+    uint hlen = add_path ? 12 : 8;
+
+    if (end - pos < hlen)
+      return 0;
+
+    uint peer = get_u16(pos);
+    u32 path_id = add_path ? get_u32(pos + 6) : 0;
+    uint alen = get_u16(pos + hlen - 2);
+    pos += hlen;
+
+    if (end - pos < alen)
+      return 0;
+
+    if (mrt_load_route(s, &net, peer, path_id, pos, alen))
+      s->routes++;
+    else
+      s->skipped++;
+
+    pos += alen;
+    lp_flush(s->linpool);
+  }
+
+  return 1;
+}
+
+/* Returns 1 when the load is finished */
+static int
+mrt_table_load_step(struct mrt_load_state *s)
+{
+  struct mrt_proto *p = s->proto;
+  struct mrt_config *cf = (void *) (p->p.cf);
+  int ipv4 = (p->p.main_channel->net_type == NET_IP4);
+  FILE *f = rf_file(s->file);
+
+  for (uint i = 0; i < MRT_LOAD_STEP; i++)
+  {
+    byte hdr[MRT_HDR_LENGTH];
+    size_t n = fread(hdr, 1, MRT_HDR_LENGTH, f);
+
+    if (!n && !ferror(f))
+      return 1;
+
+    if (n < MRT_HDR_LENGTH)
+      goto truncated;
+
+    uint type = get_u16(hdr + 4);
+    uint subtype = get_u16(hdr + 6);
+    uint len = get_u32(hdr + 8);
+
+    if (len > MRT_LOAD_MAX_MESSAGE)
+      goto malformed;
+
+    mrt_buffer_flush(&s->buf);
+    mrt_buffer_need(&s->buf, len);
+
+    if (fread(s->buf.start, 1, len, f) < len)
+      goto truncated;
+
+    byte *pos = s->buf.start, *end = pos + len;
+    int ok = 1;
+
+    s->messages++;
+
+    if (type != MRT_TABLE_DUMP_V2)
+      continue;
+
+    switch (subtype)
+    {
+    case MRT_PEER_INDEX_TABLE:
+      ok = mrt_load_peer_table(s, pos, end);
+      break;
+
+    case MRT_RIB_IPV4_UNICAST:
+    case MRT_RIB_IPV4_UNICAST_ADDPATH:
+      if (ipv4)
+	ok = mrt_load_rib(s, pos, end, subtype == MRT_RIB_IPV4_UNICAST_ADDPATH);
+      break;
+
+    case MRT_RIB_IPV6_UNICAST:
+    case MRT_RIB_IPV6_UNICAST_ADDPATH:
+      if (!ipv4)
+	ok = mrt_load_rib(s, pos, end, subtype == MRT_RIB_IPV6_UNICAST_ADDPATH);
+      break;
+    }
+
+    if (!ok)
+      goto malformed;
+  }
+
+  return 0;
+
+truncated:
+  log(L_ERR "%s: Truncated MRT file '%s'", p->p.name, cf->load_file);
+  return 1;
+
+malformed:
+  log(L_ERR "%s: Malformed message %u in MRT file '%s'", p->p.name, s->messages + 1, cf->load_file);
+  return 1;
+}
+
+static void
+mrt_load_event(void *P)
+{
+  struct mrt_proto *p = P;
+  struct mrt_config *cf = (void *) (p->p.cf);
+  struct mrt_load_state *s = p->table_load;
+  struct channel *c = p->p.main_channel;
+
+  if (!s)
+    return;
+
+  if (!mrt_table_load_step(s))
+  {
+    ev_schedule(p->load_event);
+    return;
+  }
+
+  log(L_INFO "%s: Loaded %u routes from MRT file '%s' (%u entries skipped)",
+      p->p.name, s->routes, cf->load_file, s->skipped);
+
+  rfree(s->pool);
+  p->table_load = NULL;
+
+  /* Loaded routes are kept as stale until they expire, like after graceful restart */
+  rt_refresh_begin(c->table, c);
+  p->load_stale = 1;
+  tm_start(p->load_timer, cf->load_expire S);
+}
+
+static void
+mrt_load_timer(timer *t)
+{
+  struct mrt_proto *p = t->data;
+  struct channel *c = p->p.main_channel;
+
+  TRACE(D_EVENTS, "Loaded routes expired");
+
+  rt_refresh_end(c->table, c);
+  p->load_stale = 0;
+}
+
+static void
+mrt_table_load_start(struct mrt_proto *p)
+{
+  p->load_event = ev_new_init(p->p.pool, mrt_load_event, p);
+  p->load_timer = tm_new_init(p->p.pool, mrt_load_timer, p, 0, 0);
+
+  TRACE(D_EVENTS, "Loading of MRT file started");
+
+  p->table_load = mrt_table_load_init(p);
+  if (p->table_load)
+    ev_schedule(p->load_event);
+}
+
+#else
+
+static void
+mrt_table_load_start(struct mrt_proto *p)
+{
+  log(L_ERR "%s: Loading of MRT files requires BGP support", p->p.name);
+}
+
+#endif
+
+
 /*
  *	MRT BGP4MP dump
  */
@@ -734,6 +1430,87 @@ mrt_bgp_buffer(void)
   return &b;
 }
 
+static struct mrt_writer *mrt_bgp_writer_;
+static timer *mrt_bgp_timer;
+
+static void
+mrt_bgp_flush(void)
+{
+  struct mrt_writer *w = mrt_bgp_writer_;
+
+  if (!w)
+    return;
+
+  mrt_writer_submit(w);
+
+  if (w->dropped)
+  {
+    log(L_WARN "MRTDump: %u messages dropped, buffer full", w->dropped);
+    w->dropped = 0;
+  }
+}
+
+static void
+mrt_bgp_timer_hook(timer *t UNUSED)
+{
+  mrt_bgp_flush();
+}
+
+static void
+mrt_bgp_exit(void)
+{
+  if (mrt_bgp_writer_)
+    rfree(mrt_bgp_writer_);
+
+  mrt_bgp_writer_ = NULL;
+}
+
+/* Returns writer for the current MRTDump file, or NULL for unbuffered output */
+static struct mrt_writer *
+mrt_bgp_writer(void)
+{
+  struct mrt_writer *w = mrt_bgp_writer_;
+  int fd = config->mrtdump_file;
+  uint size = config->mrtdump_buffer;
+
+  if (w && (w->src_fd == fd) && (w->max_queued == size))
+    return w;
+
+  /* File or buffer size changed by reconfiguration */
+  if (w)
+  {
+    mrt_bgp_flush();
+    mrt_bgp_exit();
+  }
+
+  if ((fd < 0) || !size)
+    return NULL;
+
+  if (!mrt_bgp_timer)
+  {
+    mrt_bgp_timer = tm_new_init(&root_pool, mrt_bgp_timer_hook, NULL, MRT_BGP_FLUSH_TIME, 0);
+    tm_start(mrt_bgp_timer, MRT_BGP_FLUSH_TIME);
+    atexit(mrt_bgp_exit);
+  }
+
+  return mrt_bgp_writer_ = mrt_writer_new(&root_pool, fd, MIN(size, MRT_BGP_CHUNK_SIZE), size);
+}
+
+static void
+mrt_bgp_dump_message(buffer *b)
+{
+  struct mrt_writer *w = mrt_bgp_writer();
+
+  if (!w)
+  {
+    mrt_dump_message(b, config->mrtdump_file);
+    return;
+  }
+
+  uint len = mrt_finish_message(b);
+  mrt_writer_try_put(w, b->start, len);
+}
+
 static void
 mrt_bgp_header(buffer *b, struct mrt_bgp_data *d)
 {
@@ -777,7 +1554,7 @@ mrt_dump_bgp_message(struct mrt_bgp_data *d)
   mrt_init_message(b, MRT_BGP4MP, subtypes[d->as4 + 4*d->add_path]);
   mrt_bgp_header(b, d);
   mrt_put_data(b, d->message, d->msg_len);
-  mrt_dump_message(b, config->mrtdump_file);
+  mrt_bgp_dump_message(b);
 }
 
 void
@@ -797,7 +1574,7 @@ mrt_dump_bgp_state_change(struct mrt_bgp_data *d)
   mrt_bgp_header(b, d);
   mrt_put_u16(b, states[d->old_state]);
   mrt_put_u16(b, states[d->new_state]);
-  mrt_dump_message(b, config->mrtdump_file);
+  mrt_bgp_dump_message(b);
 }
 
 
@@ -810,6 +1587,21 @@ mrt_check_config(struct proto_config *CF)
 {
   struct mrt_config *cf = (void *) CF;
 
+  if (cf->load_file)
+  {
+    if (!CF->net_type)
+      cf_error("Channel not specified");
+
+    if (cf->igp_table && (cf->igp_table->addr_type != CF->net_type))
+      cf_error("Incompatible IGP table type");
+
+    /* Table dump is optional with load */
+    if (!cf->filename && !cf->period)
+      return;
+  }
+  else if (CF->net_type)
+    cf_error("Channel can be used only with load");
+
   if (!cf->table_expr && !cf->table_cf)
     cf_error("Table not specified");
 
@@ -825,6 +1617,9 @@ mrt_init(struct proto_config *CF)
 {
   struct proto *P = proto_new(CF);
 
+  if (CF->net_type)
+    P->main_channel = proto_add_channel(P, proto_cf_main_channel(CF));
+
   return P;
 }
 
@@ -834,10 +1629,16 @@ mrt_start(struct proto *P)
   struct mrt_proto *p = (void *) P;
   struct mrt_config *cf = (void *) (P->cf);
 
-  p->timer = tm_new_init(P->pool, mrt_timer, p, cf->period S, 0);
-  p->event = ev_new_init(P->pool, mrt_event, p);
+  if (cf->filename)
+  {
+    p->timer = tm_new_init(P->pool, mrt_timer, p, cf->period S, 0);
+    p->event = ev_new_init(P->pool, mrt_event, p);
+
+    tm_start(p->timer, cf->period S);
+  }
 
-  tm_start(p->timer, cf->period S);
+  if (cf->load_file)
+    mrt_table_load_start(p);
 
   return PS_UP;
 }
@@ -847,6 +1648,15 @@ mrt_shutdown(struct proto *P)
 {
   struct mrt_proto *p = (void *) P;
 
+  if (p->table_load)
+  {
+    rfree(p->table_load->pool);
+    p->table_load = NULL;
+  }
+
+  if (p->load_timer)
+    tm_stop(p->load_timer);
+
   return p->table_dump ? PS_STOP : PS_DOWN;
 }
 
@@ -857,7 +1667,16 @@ mrt_reconfigure(struct proto *P, struct proto_config *CF)
   struct mrt_config *old = (void *) (P->cf);
   struct mrt_config *new = (void *) CF;
 
-  if (new->period != old->period)
+  /* Changed load or enabled/disabled dump needs restart */
+  if (bstrcmp(new->load_file, old->load_file) ||
+      (new->igp_table != old->igp_table) ||
+      (!new->filename != !old->filename))
+    return 0;
+
+  if (!proto_configure_channel(P, &P->main_channel, proto_cf_main_channel(CF)))
+    return 0;
+
+  if (p->timer && (new->period != old->period))
   {
     TRACE(D_EVENTS, "Changing period from %u to %u s", old->period, new->period);
 
@@ -881,6 +1700,8 @@ struct protocol proto_mrt = {
   .name =		"MRT",
   .template =		"mrt%d",
   .class =		PROTOCOL_MRT,
+  .preference =		DEF_PREF_MRT,
+  .channel_mask =	NB_IP,
   .proto_size =		sizeof(struct mrt_proto),
   .config_size =	sizeof(struct mrt_config),
   .init =		mrt_init,
@@ -27,6 +27,10 @@ struct mrt_config {
   const char *filename;
   uint period;
   int always_add_path;
+
+  const char *load_file;		/* MRT file to preload the channel from (or NULL) */
+  struct rtable_config *igp_table;	/* IGP table for next hops of loaded routes */
+  uint load_expire;			/* Time after which loaded routes are removed (s) */
 };
 
 struct mrt_proto {
@@ -36,6 +40,11 @@ struct mrt_proto {
 
   struct mrt_target *file;
   struct mrt_table_dump_state *table_dump;
+
+  struct mrt_load_state *table_load;	/* Running load of MRT file (or NULL) */
+  event *load_event;			/* Next step of MRT file load */
+  timer *load_timer;			/* Expiration of loaded routes */
+  byte load_stale;			/* Loaded routes are marked stale */
 };
 
 struct mrt_dump_data {
@@ -74,8 +83,9 @@ struct mrt_table_dump_state {
   HASH(struct mrt_peer_entry) peer_hash; /* Hash for peers to find the index */
 
   struct rtable *table;			/* Processed table, NULL initially */
-  struct fib_iterator fit;		/* Iterator in processed table */
-  int table_open;			/* Whether iterator is linked */
+  struct rt_snapshot *snapshot;		/* Snapshot of processed table */
+  struct rte **snapshot_pos;		/* Next network in snapshot */
+  int table_open;			/* Whether snapshot is taken */
 
   int ipv4;				/* Processed table is IPv4 */
   int add_path;				/* Current message subtype is *_ADDPATH */
@@ -91,9 +101,31 @@ struct mrt_table_dump_state {
   u32 entry_count_offset;		/* Buffer offset to store entry_count later */
 
   struct rfile *file;			/* tracking for mrt table dump file */
+  struct mrt_writer *writer;		/* Writer of messages to file */
   int fd;
 };
 
+struct mrt_load_peer {
+  ip_addr ip;				/* Peer IP address */
+  u32 as;				/* Peer ASN */
+};
+
+struct mrt_load_state {
+  struct mrt_proto *proto;
+  pool *pool;				/* Pool for table load */
+  linpool *linpool;			/* Temporary linear pool */
+  struct rfile *file;			/* Loaded MRT file */
+  buffer buf;				/* Buffer for MRT message body */
+  rtable *igp_table;			/* Table for recursive next hop resolution */
+
+  struct mrt_load_peer *peers;		/* Peers from Peer Index Table */
+  uint peer_count;
+
+  uint messages;			/* Number of processed messages */
+  uint routes;				/* Number of loaded routes */
+  uint skipped;				/* Number of skipped RIB entries */
+};
+
 struct mrt_bgp_data {
   uint peer_as;
   uint local_as;
@@ -115,10 +147,17 @@ struct mrt_bgp_data {
 #define MRT_PEER_TYPE_IPV6	1	/* MRT Table Dump: Peer Index Table: Peer Type: Use IPv6 IP Address */
 
 #define MRT_ATTR_BUFFER_SIZE	65536
+#define MRT_WRITER_CHUNK_SIZE	(1 << 20)	/* Table dump output is written in chunks of this size */
+#define MRT_WRITER_MAX_QUEUED	(16 << 20)	/* Table dump pauses when more data waits for write */
+#define MRT_BGP_CHUNK_SIZE	(64 << 10)	/* BGP4MP output is written in chunks of this size */
+#define MRT_BGP_FLUSH_TIME	(1 S)		/* BGP4MP output is flushed at least this often */
+#define MRT_LOAD_STEP		256		/* MRT messages processed in one load step */
+#define MRT_LOAD_MAX_MESSAGE	(16 << 20)	/* Longer MRT messages are considered malformed */
 
 /* MRT Types */
 #define MRT_TABLE_DUMP_V2 	13
 #define MRT_BGP4MP		16
+#define MRT_BGP4MP_ET		17
 
 /* MRT Table Dump v2 Subtypes */
 #define MRT_PEER_INDEX_TABLE		1
@@ -103,6 +103,103 @@ ospf_dump_dbdes(struct ospf_proto *p, struct ospf_packet *pkt)
 }
 
 
+/*
+ * Database summary
+ *
+ * When a neighbor enters Exchange state, it gets a snapshot of headers of LSAs
+ * to be described in DBDES packets, already in network byte order. The snapshot
+ * is immutable and it is cached in the iface and shared by all neighbors on the
+ * iface that enter Exchange state until the LSA database is changed. Neighbors
+ * in Exchange state learn about later changes by flooding, so the summary does
+ * not need to be updated. Flushed LSAs are not removed from the database while
+ * an adjacency is being formed, so LSAs from the snapshot can be requested.
+ */
+
+struct ospf_dbsum
+{
+  uint uc;			/* Use count */
+  uint gen;			/* Value of p->lsadb_gen when created */
+  u8 opaque;			/* Opaque LSAs included */
+  uint count;			/* Number of LSA headers */
+  struct ospf_lsa_header lsas[];
+};
+
+static inline int
+ospf_dbsum_opaque(struct ospf_proto *p, struct ospf_neighbor *n)
+{
+  return ospf_is_v2(p) ? !!(n->options & OPT_O) : 1;
+}
+
+static inline int
+ospf_dbsum_accept(struct ospf_proto *p, struct ospf_neighbor *n, struct top_hash_entry *en)
+{
+  return (en->lsa.age < LSA_MAXAGE) &&
+    lsa_flooding_allowed(en->lsa_type, en->domain, n->ifa) &&
+    lsa_is_acceptable(en->lsa_type, n, p);
+}
+
+static struct ospf_dbsum *
+ospf_dbsum_new(struct ospf_proto *p, struct ospf_neighbor *n)
+{
+  struct ospf_iface *ifa = n->ifa;
+  struct top_hash_entry *en;
+  uint count = 0, i = 0;
+
+  WALK_SLIST(en, p->lsal)
+    if (ospf_dbsum_accept(p, n, en))
+      count++;
+
+  struct ospf_dbsum *s = mb_alloc(ifa->pool, sizeof(struct ospf_dbsum) +
+				  count * sizeof(struct ospf_lsa_header));
+  s->uc = 1;
+  s->gen = p->lsadb_gen;
+  s->opaque = ospf_dbsum_opaque(p, n);
+  s->count = count;
+
+  WALK_SLIST(en, p->lsal)
+    if (ospf_dbsum_accept(p, n, en))
+    {
+      lsa_update_age(en);
+      lsa_hton_hdr(&(en->lsa), s->lsas + i++);
+    }
+
+  return s;
+}
+
+static void
+ospf_dbsum_unlock(struct ospf_dbsum *s)
+{
+  if (s && !--s->uc)
+    mb_free(s);
+}
+
+void
+ospf_dbsum_init(struct ospf_proto *p, struct ospf_neighbor *n)
+{
+  struct ospf_iface *ifa = n->ifa;
+  struct ospf_dbsum *s = ifa->dbsum;
+
+  ospf_dbsum_free(n);
+
+  if (!s || (s->gen != p->lsadb_gen) || (s->opaque != ospf_dbsum_opaque(p, n)))
+  {
+    ospf_dbsum_unlock(ifa->dbsum);
+    s = ifa->dbsum = ospf_dbsum_new(p, n);
+  }
+
+  s->uc++;
+  n->dbsum = s;
+  n->dbsum_pos = 0;
+}
+
+void
+ospf_dbsum_free(struct ospf_neighbor *n)
+{
+  ospf_dbsum_unlock(n->dbsum);
+  n->dbsum = NULL;
+  n->dbsum_pos = 0;
+}
+
 static void
 ospf_prepare_dbdes(struct ospf_proto *p, struct ospf_neighbor *n)
 {
@@ -147,33 +244,25 @@ ospf_prepare_dbdes(struct ospf_proto *p, struct ospf_neighbor *n)
   /* Prepare DBDES body */
   if (!(n->myimms & DBDES_I) && (n->myimms & DBDES_M))
   {
+    struct ospf_dbsum *s = n->dbsum;
     struct ospf_lsa_header *lsas;
-    struct top_hash_entry *en;
     uint i = 0, lsa_max;
 
     ospf_dbdes_body(p, pkt, &lsas, &lsa_max);
-    en = (void *) s_get(&(n->dbsi));
 
-    while (i < lsa_max)
+    if (s)
     {
-      if (!SNODE_VALID(en))
-      {
-	n->myimms &= ~DBDES_M;	/* Unset More bit */
-	break;
-      }
-
-      if ((en->lsa.age < LSA_MAXAGE) &&
-	  lsa_flooding_allowed(en->lsa_type, en->domain, ifa) &&
-	  lsa_is_acceptable(en->lsa_type, n, p))
-      {
-	lsa_hton_hdr(&(en->lsa), lsas + i);
-	i++;
-      }
-
-      en = SNODE_NEXT(en);
+      i = MIN(s->count - n->dbsum_pos, lsa_max);
+      memcpy(lsas, s->lsas + n->dbsum_pos, i * sizeof(struct ospf_lsa_header));
+      n->dbsum_pos += i;
     }
 
-    s_put(&(n->dbsi), SNODE en);
+    /* Summary is done, unset More bit */
+    if (!s || (n->dbsum_pos == s->count))
+    {
+      n->myimms &= ~DBDES_M;
+      ospf_dbsum_free(n);
+    }
 
     length += i * sizeof(struct ospf_lsa_header);
   }
@@ -285,6 +374,9 @@ ospf_process_dbdes(struct ospf_proto *p, struct ospf_packet *pkt, struct ospf_ne
       n->got_my_rt_lsa = 1;
 
     en = ospf_hash_find(p->gr, lsa_domain, lsa.id, lsa.rt, lsa_type);
+    if (en)
+      lsa_update_age(en);
+
     if (!en || (lsa_comp(&lsa, &(en->lsa)) == CMP_NEWER))
     {
       /* This should be splitted to ospf_lsa_lsrq_up() */
@@ -291,7 +291,7 @@ ospf_receive_hello(struct ospf_packet *pkt, struct ospf_iface *ifa,
       {
 	OSPF_TRACE(D_EVENTS, "Neighbor %R on %s changed IP address to %I",
 		   n->rid, ifa->ifname, faddr);
-	n->ip = faddr;
+	ospf_neigh_set_ip(n, faddr);
       }
     }
   }
@@ -317,10 +317,8 @@ ospf_receive_hello(struct ospf_packet *pkt, struct ospf_iface *ifa,
     OSPF_TRACE(D_EVENTS, "New neighbor %R on %s, IP address %I",
 	       rcv_rid, ifa->ifname, faddr);
 
-    n = ospf_neighbor_new(ifa);
+    n = ospf_neighbor_new(ifa, rcv_rid, faddr);
 
-    n->rid = rcv_rid;
-    n->ip = faddr;
     n->dr = rcv_dr;
     n->bdr = rcv_bdr;
     n->priority = rcv_priority;
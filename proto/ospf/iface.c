@@ -129,6 +129,7 @@ ospf_sk_open(struct ospf_iface *ifa)
   sk->tos = ifa->cf->tx_tos;
   sk->priority = ifa->cf->tx_priority;
   sk->rx_hook = ospf_rx_hook;
+  sk->fast_rx = p->p.cf->io_priority;
   // sk->tx_hook = ospf_tx_hook;
   sk->err_hook = ospf_err_hook;
   sk->rbsize = sk->tbsize = ifa_bufsize(ifa);
@@ -638,6 +639,7 @@ ospf_iface_new(struct ospf_area *oa, struct ifa *addr, struct ospf_iface_patt *i
   ifa->state = OSPF_IS_DOWN;
   init_list(&ifa->neigh_list);
   init_list(&ifa->nbma_list);
+  ospf_neigh_init_hash(ifa);
 
   struct nbma_node *nb;
   WALK_LIST(nb, ip->nbma_list)
@@ -718,6 +720,7 @@ ospf_iface_new_vlink(struct ospf_proto *p, struct ospf_iface_patt *ip)
   ifa->state = OSPF_IS_DOWN;
   init_list(&ifa->neigh_list);
   init_list(&ifa->nbma_list);
+  ospf_neigh_init_hash(ifa);
 
   add_tail(&p->iface_list, NODE ifa);
 
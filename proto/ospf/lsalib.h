@@ -75,4 +75,15 @@ int lsa_validate(struct ospf_lsa_header *lsa, u32 lsa_type, int ospf2, void *bod
 static inline btime lsa_inst_age(struct top_hash_entry *en)
 { return current_time() - en->inst_time; }
 
+/*
+ * Ages of LSAs in the database are updated lazily, this has to be called before
+ * lsa.age is used. MaxAge is reached only in ospf_update_lsadb(), which also
+ * flushes the LSA.
+ */
+static inline void lsa_update_age(struct top_hash_entry *en)
+{
+  if (en->lsa.age < LSA_MAXAGE)
+    en->lsa.age = MIN_(en->init_age + (lsa_inst_age(en) TO_S), LSA_MAXAGE - 1);
+}
+
 #endif /* _BIRD_OSPF_LSALIB_H_ */
@@ -122,17 +122,29 @@ ospf_lsa_lsrq_down(struct top_hash_entry *req, struct ospf_neighbor *n)
   }
 }
 
-static inline void
-ospf_lsa_lsrt_up(struct top_hash_entry *en, struct ospf_neighbor *n)
+/*
+ * The retransmission list is ordered by the time of the last transmission of
+ * the LSA to the neighbor (stored in inst_time of the list entry), so only its
+ * head has to be examined to find LSAs due for retransmission. Entries added
+ * with @now are due immediately and are put at the head.
+ */
+static void
+ospf_lsa_lsrt_up_(struct top_hash_entry *en, struct ospf_neighbor *n, int now)
 {
   struct top_hash_entry *ret = ospf_hash_get_entry(n->lsrth, en);
 
   if (!SNODE_VALID(ret))
-  {
     en->ret_count++;
+  else
+    s_rem_node(SNODE ret);
+
+  if (now)
+    s_add_head(&n->lsrtl, SNODE ret);
+  else
     s_add_tail(&n->lsrtl, SNODE ret);
-  }
 
+  ret->inst_time = now ? 0 : current_time();
+  lsa_update_age(en);
   ret->lsa = en->lsa;
   ret->lsa_body = LSA_BODY_DUMMY;
 
@@ -140,6 +152,12 @@ ospf_lsa_lsrt_up(struct top_hash_entry *en, struct ospf_neighbor *n)
     tm_start(n->lsrt_timer, n->ifa->rxmtint S);
 }
 
+static inline void
+ospf_lsa_lsrt_up(struct top_hash_entry *en, struct ospf_neighbor *n)
+{
+  ospf_lsa_lsrt_up_(en, n, 0);
+}
+
 void
 ospf_lsa_lsrt_down_(struct top_hash_entry *en, struct ospf_neighbor *n, struct top_hash_entry *ret)
 {
@@ -173,7 +191,7 @@ ospf_add_flushed_to_lsrt(struct ospf_proto *p, struct ospf_neighbor *n)
     if ((en->lsa.age == LSA_MAXAGE) && (en->lsa_body != NULL) &&
 	lsa_flooding_allowed(en->lsa_type, en->domain, n->ifa) &&
         lsa_is_acceptable(en->lsa_type, n, p))
-      ospf_lsa_lsrt_up(en, n);
+      ospf_lsa_lsrt_up_(en, n, 1);
 
   /* If we found any flushed LSA, we send them ASAP */
   if (tm_active(n->lsrt_timer))
@@ -254,6 +272,9 @@ ospf_flood_lsa(struct ospf_proto *p, struct top_hash_entry *en, struct ospf_neig
 
   /* RFC 2328 13.3 */
 
+  /* Every change of LSA database is flooded, invalidate database summaries */
+  p->lsadb_gen++;
+
   int back = 0;
   WALK_LIST(ifa, p->iface_list)
   {
@@ -279,6 +300,7 @@ ospf_flood_lsa(struct ospf_proto *p, struct top_hash_entry *en, struct ospf_neig
 	struct top_hash_entry *req = ospf_hash_find_entry(n->lsrqh, en);
 	if (req != NULL)
 	{
+	  lsa_update_age(en);
 	  int cmp = lsa_comp(&en->lsa, &req->lsa);
 
 	  /* If same or newer, remove LSA from the link state request list */
@@ -368,6 +390,7 @@ ospf_prepare_lsupd(struct ospf_proto *p, struct ospf_iface *ifa,
     }
 
     struct ospf_lsa_header *buf = ((void *) pkt) + pos;
+    lsa_update_age(en);
     lsa_hton_hdr(&en->lsa, buf);
     lsa_hton_body(en->lsa_body, ((void *) buf) + sizeof(struct ospf_lsa_header),
 		  len - sizeof(struct ospf_lsa_header));
@@ -439,14 +462,18 @@ ospf_rxmt_lsupd(struct ospf_proto *p, struct ospf_neighbor *n)
 {
   uint max = 2 * n->ifa->flood_queue_size;
   struct top_hash_entry *entries[max];
+  struct top_hash_entry *rets[max];
   struct top_hash_entry *ret, *nxt, *en;
+  btime now = current_time();
+  btime rxmt = n->ifa->rxmtint S;
   uint i = 0;
 
   /* ASSERT((n->state >= NEIGHBOR_EXCHANGE) && !EMPTY_SLIST(n->lsrtl)); */
 
   WALK_SLIST_DELSAFE(ret, nxt, n->lsrtl)
   {
-    if (i == max)
+    /* The rest was sent recently */
+    if ((i == max) || (ret->inst_time + rxmt > now))
       break;
 
     en = ospf_hash_find_entry(p->gr, ret);
@@ -463,10 +490,26 @@ ospf_rxmt_lsupd(struct ospf_proto *p, struct ospf_neighbor *n)
     }
 
     entries[i] = en;
+    rets[i] = ret;
     i++;
   }
 
   ospf_send_lsupd(p, entries, i, n);
+
+  /* Move retransmitted entries to the tail */
+  for (uint j = 0; j < i; j++)
+  {
+    s_rem_node(SNODE rets[j]);
+    s_add_tail(&n->lsrtl, SNODE rets[j]);
+    rets[j]->inst_time = now;
+  }
+
+  if (EMPTY_SLIST(n->lsrtl))
+    return;
+
+  /* When the batch was full, keep the pace of one batch per interval */
+  ret = SHEAD(n->lsrtl);
+  tm_start(n->lsrt_timer, (i == max) ? rxmt : MAX(ret->inst_time + rxmt - now, 0));
 }
 
 
@@ -560,6 +603,8 @@ ospf_receive_lsupd(struct ospf_packet *pkt, struct ospf_iface *ifa,
 
     /* Find local copy of LSA in link state database */
     en = ospf_hash_find(p->gr, lsa_domain, lsa.id, lsa.rt, lsa_type);
+    if (en)
+      lsa_update_age(en);
 
 #ifdef LOCAL_DEBUG
     if (en)
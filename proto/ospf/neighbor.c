@@ -76,8 +76,43 @@ reset_lists(struct ospf_proto *p, struct ospf_neighbor *n)
   init_lists(p, n);
 }
 
+/*
+ * Neighbors on an iface are indexed by both Router ID and IP address, as
+ * they are looked up for each received packet and on PtMP or NBMA hub
+ * interfaces there may be many of them.
+ */
+
+#define NEIGH_RID_KEY(n)	n->rid
+#define NEIGH_RID_NEXT(n)	n->next_rid
+#define NEIGH_RID_EQ(a,b)	a == b
+#define NEIGH_RID_FN(k)		u32_hash(k)
+
+#define NEIGH_RID_REHASH	neigh_rid_rehash
+#define NEIGH_RID_PARAMS	/8, *2, 2, 2, 4, 16
+
+HASH_DEFINE_REHASH_FN(NEIGH_RID, struct ospf_neighbor)
+
+#define NEIGH_IP_KEY(n)		n->ip
+#define NEIGH_IP_NEXT(n)	n->next_ip
+#define NEIGH_IP_EQ(a,b)	ipa_equal(a,b)
+#define NEIGH_IP_FN(k)		ipa_hash(k)
+
+#define NEIGH_IP_REHASH		neigh_ip_rehash
+#define NEIGH_IP_PARAMS		/8, *2, 2, 2, 4, 16
+
+HASH_DEFINE_REHASH_FN(NEIGH_IP, struct ospf_neighbor)
+
+#define NEIGH_HASH_ORDER	4
+
+void
+ospf_neigh_init_hash(struct ospf_iface *ifa)
+{
+  HASH_INIT(ifa->neigh_rid_hash, ifa->pool, NEIGH_HASH_ORDER);
+  HASH_INIT(ifa->neigh_ip_hash, ifa->pool, NEIGH_HASH_ORDER);
+}
+
 struct ospf_neighbor *
-ospf_neighbor_new(struct ospf_iface *ifa)
+ospf_neighbor_new(struct ospf_iface *ifa, u32 rid, ip_addr ip)
 {
   struct ospf_proto *p = ifa->oa->po;
   struct pool *pool = rp_new(p->p.pool, "OSPF Neighbor");
@@ -85,11 +120,14 @@ ospf_neighbor_new(struct ospf_iface *ifa)
 
   n->pool = pool;
   n->ifa = ifa;
+  n->rid = rid;
+  n->ip = ip;
   add_tail(&ifa->neigh_list, NODE n);
+  HASH_INSERT2(ifa->neigh_rid_hash, NEIGH_RID, ifa->pool, n);
+  HASH_INSERT2(ifa->neigh_ip_hash, NEIGH_IP, ifa->pool, n);
   n->state = NEIGHBOR_DOWN;
 
   init_lists(p, n);
-  s_init(&(n->dbsi), &(p->lsal));
 
   init_list(&n->ackl[ACKL_DIRECT]);
   init_list(&n->ackl[ACKL_DELAY]);
@@ -97,7 +135,7 @@ ospf_neighbor_new(struct ospf_iface *ifa)
   n->inactim = tm_new_init(pool, inactivity_timer_hook, n, 0, 0);
   n->dbdes_timer = tm_new_init(pool, dbdes_timer_hook, n, ifa->rxmtint S, 0);
   n->lsrq_timer = tm_new_init(pool, lsrq_timer_hook, n, ifa->rxmtint S, 0);
-  n->lsrt_timer = tm_new_init(pool, lsrt_timer_hook, n, ifa->rxmtint S, 0);
+  n->lsrt_timer = tm_new_init(pool, lsrt_timer_hook, n, 0, 0);
   n->ackd_timer = tm_new_init(pool, ackd_timer_hook, n, ifa->rxmtint S / 2, 0);
 
   return (n);
@@ -117,9 +155,11 @@ ospf_neigh_down(struct ospf_neighbor *n)
       nn->found = 0;
   }
 
-  s_get(&(n->dbsi));
+  ospf_dbsum_free(n);
   release_lsrtl(p, n);
   rem_node(NODE n);
+  HASH_REMOVE2(ifa->neigh_rid_hash, NEIGH_RID, ifa->pool, n);
+  HASH_REMOVE2(ifa->neigh_ip_hash, NEIGH_IP, ifa->pool, n);
   rfree(n->pool);
 
   OSPF_TRACE(D_EVENTS, "Neighbor %R on %s removed", rid, ifa->ifname);
@@ -247,9 +287,8 @@ ospf_neigh_sm(struct ospf_neighbor *n, int event)
     {
       ospf_neigh_chstate(n, NEIGHBOR_EXCHANGE);
 
-      /* Reset DB summary list iterator */
-      s_get(&(n->dbsi));
-      s_init(&(n->dbsi), &p->lsal);
+      /* Prepare DB summary list */
+      ospf_dbsum_init(p, n);
 
       /* Add MaxAge LSA entries to retransmission list */
       ospf_add_flushed_to_lsrt(p, n);
@@ -486,6 +525,8 @@ ospf_neigh_notify_grace_lsa(struct ospf_neighbor *n, struct top_hash_entry *en)
   if (!n)
     return;
 
+  lsa_update_age(en);
+
   if (en->lsa.age < LSA_MAXAGE)
   {
     u32 period = lsa_get_tlv_u32(en, LSA_GR_PERIOD);
@@ -724,24 +765,26 @@ ospf_dr_election(struct ospf_iface *ifa)
     ospf_notify_rt_lsa(ifa->oa);
 }
 
+void
+ospf_neigh_set_ip(struct ospf_neighbor *n, ip_addr ip)
+{
+  struct ospf_iface *ifa = n->ifa;
+
+  HASH_REMOVE(ifa->neigh_ip_hash, NEIGH_IP, n);
+  n->ip = ip;
+  HASH_INSERT(ifa->neigh_ip_hash, NEIGH_IP, n);
+}
+
 struct ospf_neighbor *
 find_neigh(struct ospf_iface *ifa, u32 rid)
 {
-  struct ospf_neighbor *n;
-  WALK_LIST(n, ifa->neigh_list)
-    if (n->rid == rid)
-      return n;
-  return NULL;
+  return HASH_FIND(ifa->neigh_rid_hash, NEIGH_RID, rid);
 }
 
 struct ospf_neighbor *
 find_neigh_by_ip(struct ospf_iface *ifa, ip_addr ip)
 {
-  struct ospf_neighbor *n;
-  WALK_LIST(n, ifa->neigh_list)
-    if (ipa_equal(n->ip, ip))
-      return n;
-  return NULL;
+  return HASH_FIND(ifa->neigh_ip_hash, NEIGH_IP, ip);
 }
 
 static void
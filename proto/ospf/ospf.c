@@ -106,6 +106,7 @@
 
 #include <stdlib.h>
 #include "ospf.h"
+#include "lib/json.h"
 
 static int ospf_preexport(struct proto *P, rte **new, struct linpool *pool);
 static void ospf_make_tmp_attrs(struct rte *rt, struct linpool *pool);
@@ -114,6 +115,10 @@ static void ospf_reload_routes(struct channel *C);
 static int ospf_rte_better(struct rte *new, struct rte *old);
 static int ospf_rte_same(struct rte *new, struct rte *old);
 static void ospf_disp(timer *timer);
+static void ospf_spf_configure(struct ospf_proto *p, struct ospf_config *c);
+static void ospf_spf_timeout(timer *t);
+static void ospf_spf_holddown_timeout(timer *t);
+static void ospf_spf_learn_timeout(timer *t);
 
 
 static void
@@ -170,6 +175,9 @@ ospf_area_add(struct ospf_proto *p, struct ospf_area_config *ac)
   fib_init(&oa->rtr, p->p.pool, NET_IP4, sizeof(ort), OFFSETOF(ort, fn), 0, NULL);
   add_area_nets(oa, ac);
 
+  BUFFER_INIT(oa->cand, p->p.pool, 32);
+  BUFFER_PUSH(oa->cand) = NULL;
+
   if (oa->areaid == 0)
     p->backbone = oa;
 
@@ -200,6 +208,7 @@ ospf_area_remove(struct ospf_area *oa)
   fib_free(&oa->rtr);
   fib_free(&oa->net_fib);
   fib_free(&oa->enet_fib);
+  mb_free(oa->cand.data);
 
   if (oa->translator_timer)
     rfree(oa->translator_timer);
@@ -298,20 +307,33 @@ ospf_start(struct proto *P)
   p->tick = c->tick;
   p->disp_timer = tm_new_init(P->pool, ospf_disp, p, p->tick S, 0);
   tm_start(p->disp_timer, 100 MS);
+  p->spf_timer = tm_new_init(P->pool, ospf_spf_timeout, p, 0, 0);
+  p->spf_holddown_timer = tm_new_init(P->pool, ospf_spf_holddown_timeout, p, 0, 0);
+  p->spf_learn_timer = tm_new_init(P->pool, ospf_spf_learn_timeout, p, 0, 0);
+  ospf_spf_configure(p, c);
   p->lsab_size = 256;
   p->lsab_used = 0;
   p->lsab = mb_alloc(P->pool, p->lsab_size);
   p->nhpool = lp_new(P->pool, 12*sizeof(struct nexthop));
+  p->nhpool_ext = lp_new(P->pool, 12*sizeof(struct nexthop));
   init_list(&(p->iface_list));
   init_list(&(p->area_list));
   fib_init(&p->rtf, P->pool, ospf_get_af(p), sizeof(ort), OFFSETOF(ort, fn), 0, NULL);
+  BUFFER_INIT(p->rt_ext, P->pool, 64);
+  BUFFER_INIT(p->rt_dirty, P->pool, 64);
   if (ospf_is_v3(p))
     idm_init(&p->idm, P->pool, 16);
   p->areano = 0;
   p->gr = ospf_top_new(p, P->pool);
   s_init_list(&(p->lsal));
+  for (uint i = 0; i < OSPF_LSA_INDEX_MAX; i++)
+    init_list(&p->lsa_index[i]);
+  BUFFER_INIT(p->lsa_heap, P->pool, 64);
+  BUFFER_PUSH(p->lsa_heap) = NULL;
 
   p->flood_event = ev_new_init(P->pool, ospf_flood_event, p);
+  p->ext_event = ev_new_init(P->pool, ospf_ext_event, p);
+  BUFFER_INIT(p->ext_queue, P->pool, 64);
 
   p->log_pkt_tbf = (struct tbf){ .rate = 1, .burst = 5 };
   p->log_lsa_tbf = (struct tbf){ .rate = 4, .burst = 20 };
@@ -420,9 +442,109 @@ ospf_rte_same(struct rte *new, struct rte *old)
 }
 
 
+/*
+ * SPF backoff (RFC 8405)
+ *
+ * When enabled, routing table calculation is not done periodically from
+ * ospf_disp(), but after a delay from the first change. The delay is initial
+ * for the first change after a quiet period, short for following changes and
+ * long if changes keep coming for longer than the learn interval. The quiet
+ * state is restored when there is no change for the holddown interval.
+ */
+
+static const char *ospf_spf_states[] = {
+  [OSPF_SPF_QUIET] = "Quiet",
+  [OSPF_SPF_SHORT_WAIT] = "Short wait",
+  [OSPF_SPF_LONG_WAIT] = "Long wait",
+};
+
+static void
+ospf_spf_configure(struct ospf_proto *p, struct ospf_config *c)
+{
+  if (!c->spf_backoff && p->spf_backoff)
+  {
+    tm_stop(p->spf_timer);
+    tm_stop(p->spf_holddown_timer);
+    tm_stop(p->spf_learn_timer);
+    p->spf_state = OSPF_SPF_QUIET;
+  }
+
+  /* Pending calculation would be otherwise left for the next change */
+  if (c->spf_backoff && !p->spf_backoff && p->calcrt)
+    tm_start(p->spf_timer, 0);
+
+  p->spf_backoff = c->spf_backoff;
+  p->spf_initial_delay = c->spf_initial_delay;
+  p->spf_short_delay = c->spf_short_delay;
+  p->spf_long_delay = c->spf_long_delay;
+  p->spf_holddown = c->spf_holddown;
+  p->spf_learn = c->spf_learn;
+}
+
+static void
+ospf_spf_event(struct ospf_proto *p)
+{
+  if (!p->spf_backoff)
+    return;
+
+  switch (p->spf_state)
+  {
+  case OSPF_SPF_QUIET:
+    tm_start(p->spf_timer, p->spf_initial_delay);
+    tm_start(p->spf_learn_timer, p->spf_learn);
+    p->spf_state = OSPF_SPF_SHORT_WAIT;
+    break;
+
+  case OSPF_SPF_SHORT_WAIT:
+    if (!tm_active(p->spf_timer))
+      tm_start(p->spf_timer, p->spf_short_delay);
+    break;
+
+  case OSPF_SPF_LONG_WAIT:
+    if (!tm_active(p->spf_timer))
+      tm_start(p->spf_timer, p->spf_long_delay);
+    break;
+  }
+
+  tm_start(p->spf_holddown_timer, p->spf_holddown);
+}
+
+static void
+ospf_spf_timeout(timer *t)
+{
+  struct ospf_proto *p = t->data;
+
+  /* Originate pending topology LSAs, so they are part of the calculation */
+  ospf_update_topology(p);
+
+  if (p->calcrt)
+    ospf_rt_spf(p);
+}
+
+static void
+ospf_spf_holddown_timeout(timer *t)
+{
+  struct ospf_proto *p = t->data;
+
+  tm_stop(p->spf_learn_timer);
+  p->spf_state = OSPF_SPF_QUIET;
+}
+
+static void
+ospf_spf_learn_timeout(timer *t)
+{
+  struct ospf_proto *p = t->data;
+
+  if (p->spf_state == OSPF_SPF_SHORT_WAIT)
+    p->spf_state = OSPF_SPF_LONG_WAIT;
+}
+
 void
 ospf_schedule_rtcalc(struct ospf_proto *p)
 {
+  p->calcrt_ext = 0;
+  ospf_spf_event(p);
+
   if (p->calcrt)
     return;
 
@@ -430,6 +552,23 @@ ospf_schedule_rtcalc(struct ospf_proto *p)
   p->calcrt = 1;
 }
 
+/*
+ * Schedule recalculation of external routes only, used when just AS-external
+ * or NSSA LSAs changed. It is upgraded to full calculation by any other request.
+ */
+void
+ospf_schedule_rtcalc_ext(struct ospf_proto *p)
+{
+  ospf_spf_event(p);
+
+  if (p->calcrt)
+    return;
+
+  OSPF_TRACE(D_EVENTS, "Scheduling routing table calculation for ext routes");
+  p->calcrt = 1;
+  p->calcrt_ext = 1;
+}
+
 static void
 ospf_reload_routes(struct channel *C)
 {
@@ -440,6 +579,11 @@ ospf_reload_routes(struct channel *C)
 
   OSPF_TRACE(D_EVENTS, "Scheduling routing table calculation with route reload");
   p->calcrt = 2;
+  p->calcrt_ext = 0;
+
+  /* Reload is not a topology change, so it does not affect backoff state */
+  if (p->spf_backoff && !tm_active(p->spf_timer))
+    tm_start(p->spf_timer, 0);
 }
 
 
@@ -463,8 +607,8 @@ ospf_disp(timer * timer)
   /* Process LSA DB */
   ospf_update_lsadb(p);
 
-  /* Calculate routing table */
-  if (p->calcrt)
+  /* Calculate routing table, unless it is driven by SPF backoff */
+  if (p->calcrt && !p->spf_backoff)
     ospf_rt_spf(p);
 
   /* Cleanup after graceful restart */
@@ -741,6 +885,7 @@ ospf_reconfigure(struct proto *P, struct proto_config *CF)
   p->tick = new->tick;
   p->disp_timer->recurrent = p->tick S;
   tm_start(p->disp_timer, 10 MS);
+  ospf_spf_configure(p, new);
 
   /* Mark all areas and ifaces */
   WALK_LIST(oa, p->area_list)
@@ -831,6 +976,8 @@ ospf_sh(struct proto *P)
   cli_msg(-1014, "RFC1583 compatibility: %s", (p->rfc1583 ? "enabled" : "disabled"));
   cli_msg(-1014, "Stub router: %s", (p->stub_router ? "Yes" : "No"));
   cli_msg(-1014, "RT scheduler tick: %d", p->tick);
+  if (p->spf_backoff)
+    cli_msg(-1014, "SPF backoff state: %s", ospf_spf_states[p->spf_state]);
   cli_msg(-1014, "Number of areas: %u", p->areano);
   cli_msg(-1014, "Number of LSAs in DB:\t%u", p->gr->hash_entries);
 
@@ -1051,36 +1198,103 @@ ext_compare_for_state(const void *p1, const void *p2)
 }
 
 static inline void
-show_lsa_distance(struct top_hash_entry *he)
+show_lsa_distance(struct top_hash_entry *he, struct json_writer *w)
 {
-  if (he->color == INSPF)
+  if (w)
+  {
+    json_key(w, "distance");
+    if (he->color == INSPF)
+      json_printf(w, "%u", he->dist);
+    else
+      json_printf(w, "null");
+  }
+  else if (he->color == INSPF)
     cli_msg(-1016, "\t\tdistance %u", he->dist);
   else
     cli_msg(-1016, "\t\tunreachable");
 }
 
+/* Open an entry of a node in JSON output */
+static inline void
+json_lsa_entry(struct json_writer *w, const char *type)
+{
+  json_open(w, NULL, '{');
+  json_put_string(w, "type", type);
+}
+
 static inline void
-show_lsa_router(struct ospf_proto *p, struct top_hash_entry *he, int verbose)
+show_lsa_router(struct ospf_proto *p, struct top_hash_entry *he, int verbose, struct json_writer *w)
 {
   struct ospf_lsa_rt_walk rtl;
 
-  cli_msg(-1016, "");
-  cli_msg(-1016, "\trouter %R", he->lsa.rt);
-  show_lsa_distance(he);
+  if (w)
+  {
+    json_put_string(w, "type", "router");
+    json_key(w, "router");
+    json_printf(w, "\"%R\"", he->lsa.rt);
+    show_lsa_distance(he, w);
+    json_open(w, "entries", '[');
+  }
+  else
+  {
+    cli_msg(-1016, "");
+    cli_msg(-1016, "\trouter %R", he->lsa.rt);
+    show_lsa_distance(he, w);
+  }
 
   lsa_walk_rt_init(p, he, &rtl);
   while (lsa_walk_rt(&rtl))
-    if (rtl.type == LSART_VLNK)
+    if ((rtl.type == LSART_VLNK) && w)
+    {
+      json_lsa_entry(w, "vlink");
+      json_key(w, "router");
+      json_printf(w, "\"%R\"", rtl.id);
+      json_put_uint(w, "metric", rtl.metric);
+      json_close(w, '}');
+    }
+    else if (rtl.type == LSART_VLNK)
       cli_msg(-1016, "\t\tvlink %R metric %u", rtl.id, rtl.metric);
 
   lsa_walk_rt_init(p, he, &rtl);
   while (lsa_walk_rt(&rtl))
-    if (rtl.type == LSART_PTP)
+    if ((rtl.type == LSART_PTP) && w)
+    {
+      json_lsa_entry(w, "router");
+      json_key(w, "router");
+      json_printf(w, "\"%R\"", rtl.id);
+      json_put_uint(w, "metric", rtl.metric);
+      json_close(w, '}');
+    }
+    else if (rtl.type == LSART_PTP)
       cli_msg(-1016, "\t\trouter %R metric %u", rtl.id, rtl.metric);
 
   lsa_walk_rt_init(p, he, &rtl);
   while (lsa_walk_rt(&rtl))
-    if (rtl.type == LSART_NET)
+    if ((rtl.type == LSART_NET) && w)
+    {
+      json_lsa_entry(w, "network");
+
+      /* In OSPFv2, we try to find network-LSA to get prefix/pxlen */
+      struct top_hash_entry *net_he = ospf_is_v2(p) ?
+	ospf_hash_find_net2(p->gr, he->domain, rtl.id) : NULL;
+
+      if (net_he && (net_he->lsa.age < LSA_MAXAGE))
+      {
+	struct ospf_lsa_net *net_ln = net_he->lsa_body;
+
+	json_key(w, "network");
+	json_printf(w, "\"%I/%d\"", ipa_from_u32(net_he->lsa.id & net_ln->optx),
+		    u32_masklen(net_ln->optx));
+      }
+
+      json_key(w, "id");
+      json_printf(w, "\"%R\"", rtl.id);
+      if (!ospf_is_v2(p))
+	json_put_uint(w, "interface_id", rtl.nif);
+      json_put_uint(w, "metric", rtl.metric);
+      json_close(w, '}');
+    }
+    else if (rtl.type == LSART_NET)
     {
       if (ospf_is_v2(p))
       {
@@ -1107,19 +1321,52 @@ show_lsa_router(struct ospf_proto *p, struct top_hash_entry *he, int verbose)
   {
     lsa_walk_rt_init(p, he, &rtl);
     while (lsa_walk_rt(&rtl))
-      if (rtl.type == LSART_STUB)
+      if ((rtl.type == LSART_STUB) && w)
+      {
+	json_lsa_entry(w, "stubnet");
+	json_key(w, "network");
+	json_printf(w, "\"%I/%d\"", ipa_from_u32(rtl.id), u32_masklen(rtl.data));
+	json_put_uint(w, "metric", rtl.metric);
+	json_close(w, '}');
+      }
+      else if (rtl.type == LSART_STUB)
 	cli_msg(-1016, "\t\tstubnet %I/%d metric %u",
 		ipa_from_u32(rtl.id), u32_masklen(rtl.data), rtl.metric);
   }
 }
 
 static inline void
-show_lsa_network(struct top_hash_entry *he, int ospf2)
+show_lsa_network(struct top_hash_entry *he, int ospf2, struct json_writer *w)
 {
   struct ospf_lsa_header *lsa = &(he->lsa);
   struct ospf_lsa_net *ln = he->lsa_body;
   u32 i;
 
+  if (w)
+  {
+    json_put_string(w, "type", "network");
+    if (ospf2)
+    {
+      json_key(w, "network");
+      json_printf(w, "\"%I/%d\"", ipa_from_u32(lsa->id & ln->optx), u32_masklen(ln->optx));
+    }
+    json_key(w, "dr");
+    json_printf(w, "\"%R\"", lsa->rt);
+    if (!ospf2)
+      json_put_uint(w, "interface_id", lsa->id);
+    show_lsa_distance(he, w);
+
+    json_open(w, "entries", '[');
+    for (i = 0; i < lsa_net_count(lsa); i++)
+    {
+      json_lsa_entry(w, "router");
+      json_key(w, "router");
+      json_printf(w, "\"%R\"", ln->routers[i]);
+      json_close(w, '}');
+    }
+    return;
+  }
+
   if (ospf2)
   {
     cli_msg(-1016, "");
@@ -1132,37 +1379,57 @@ show_lsa_network(struct top_hash_entry *he, int ospf2)
     cli_msg(-1016, "\tnetwork [%R-%u]", lsa->rt, lsa->id);
   }
 
-  show_lsa_distance(he);
+  show_lsa_distance(he, w);
 
   for (i = 0; i < lsa_net_count(lsa); i++)
     cli_msg(-1016, "\t\trouter %R", ln->routers[i]);
 }
 
 static inline void
-show_lsa_sum_net(struct top_hash_entry *he, int ospf2, int af)
+show_lsa_sum_net(struct top_hash_entry *he, int ospf2, int af, struct json_writer *w)
 {
   net_addr net;
   u8 pxopts;
   u32 metric;
 
   lsa_parse_sum_net(he, ospf2, af, &net, &pxopts, &metric);
-  cli_msg(-1016, "\t\txnetwork %N metric %u", &net, metric);
+
+  if (w)
+  {
+    json_lsa_entry(w, "xnetwork");
+    json_key(w, "network");
+    json_printf(w, "\"%N\"", &net);
+    json_put_uint(w, "metric", metric);
+    json_close(w, '}');
+  }
+  else
+    cli_msg(-1016, "\t\txnetwork %N metric %u", &net, metric);
 }
 
 static inline void
-show_lsa_sum_rt(struct top_hash_entry *he, int ospf2)
+show_lsa_sum_rt(struct top_hash_entry *he, int ospf2, struct json_writer *w)
 {
   u32 metric;
   u32 dst_rid;
   u32 options;
 
   lsa_parse_sum_rt(he, ospf2, &dst_rid, &metric, &options);
-  cli_msg(-1016, "\t\txrouter %R metric %u", dst_rid, metric);
+
+  if (w)
+  {
+    json_lsa_entry(w, "xrouter");
+    json_key(w, "router");
+    json_printf(w, "\"%R\"", dst_rid);
+    json_put_uint(w, "metric", metric);
+    json_close(w, '}');
+  }
+  else
+    cli_msg(-1016, "\t\txrouter %R metric %u", dst_rid, metric);
 }
 
 
 static inline void
-show_lsa_external(struct top_hash_entry *he, int ospf2, int af)
+show_lsa_external(struct top_hash_entry *he, int ospf2, int af, struct json_writer *w)
 {
   struct ospf_lsa_ext_local rt;
   char str_via[IPA_MAX_TEXT_LENGTH + 8] = "";
@@ -1173,6 +1440,24 @@ show_lsa_external(struct top_hash_entry *he, int ospf2, int af)
 
   lsa_parse_ext(he, ospf2, af, &rt);
 
+  if (w)
+  {
+    json_lsa_entry(w, (he->lsa_type == LSA_T_NSSA) ? "nssa-ext" : "external");
+    json_key(w, "network");
+    json_printf(w, "\"%N\"", &rt.net);
+    json_put_uint(w, "metric", rt.metric);
+    json_put_uint(w, "metric_type", rt.ebit ? 2 : 1);
+    if (rt.fbit)
+    {
+      json_key(w, "via");
+      json_printf(w, "\"%I\"", rt.fwaddr);
+    }
+    if (rt.tag)
+      json_put_uint(w, "tag", rt.tag);
+    json_close(w, '}');
+    return;
+  }
+
   if (rt.fbit)
     bsprintf(str_via, " via %I", rt.fwaddr);
 
@@ -1185,7 +1470,7 @@ show_lsa_external(struct top_hash_entry *he, int ospf2, int af)
 }
 
 static inline void
-show_lsa_prefix(struct top_hash_entry *he, struct top_hash_entry *cnode, int af)
+show_lsa_prefix(struct top_hash_entry *he, struct top_hash_entry *cnode, int af, struct json_writer *w)
 {
   struct ospf_lsa_prefix *px = he->lsa_body;
   u32 *buf;
@@ -1210,21 +1495,55 @@ show_lsa_prefix(struct top_hash_entry *he, struct top_hash_entry *cnode, int af)
 
     buf = ospf3_get_prefix(buf, af, &net, &pxopts, &metric);
 
-    if (px->ref_type == LSA_T_RT)
+    if (w)
+    {
+      json_lsa_entry(w, (px->ref_type == LSA_T_RT) ? "stubnet" : "address");
+      json_key(w, "network");
+      json_printf(w, "\"%N\"", &net);
+      if (px->ref_type == LSA_T_RT)
+	json_put_uint(w, "metric", metric);
+      json_close(w, '}');
+    }
+    else if (px->ref_type == LSA_T_RT)
       cli_msg(-1016, "\t\tstubnet %N metric %u", &net, metric);
     else
       cli_msg(-1016, "\t\taddress %N", &net);
   }
 }
 
+/* Start a JSON line of a node in area or of an ASBR */
+static struct json_writer *
+json_lsa_node(u32 area)
+{
+  struct json_writer *w = cli_json_begin();
+
+  json_open(w, NULL, '{');
+  if (area != 0xFFFFFFFF)
+  {
+    json_key(w, "area");
+    json_printf(w, "\"%R\"", area);
+  }
+
+  return w;
+}
+
+static void
+json_lsa_node_end(struct json_writer *w)
+{
+  json_close(w, ']');
+  json_close(w, '}');
+  cli_json_end(this_cli, -CLI_JSON_CODE);
+}
+
 void
-ospf_sh_state(struct proto *P, int verbose, int reachable)
+ospf_sh_state(struct proto *P, int verbose, int reachable, int json)
 {
   struct ospf_proto *p = (struct ospf_proto *) P;
   int ospf2 = ospf_is_v2(p);
   int af = ospf_get_af(p);
   uint i, ix, j1, jx;
   u32 last_area = 0xFFFFFFFF;
+  struct json_writer *w = NULL;
 
   if (p->p.proto_state != PS_UP)
   {
@@ -1321,11 +1640,17 @@ ospf_sh_state(struct proto *P, int verbose, int reachable)
 
 	if (he->domain != last_area)
 	{
-	  cli_msg(-1016, "");
-	  cli_msg(-1016, "area %R", he->domain);
+	  if (!json)
+	  {
+	    cli_msg(-1016, "");
+	    cli_msg(-1016, "area %R", he->domain);
+	  }
 	  last_area = he->domain;
 	  ix = 0;
 	}
+
+	if (json)
+	  w = json_lsa_node(he->domain);
       }
       else
 	continue;
@@ -1337,30 +1662,30 @@ ospf_sh_state(struct proto *P, int verbose, int reachable)
     {
     case LSA_T_RT:
       if (he->lsa.id == cnode->lsa.id)
-	show_lsa_router(p, he, verbose);
+	show_lsa_router(p, he, verbose, w);
       break;
 
     case LSA_T_NET:
-      show_lsa_network(he, ospf2);
+      show_lsa_network(he, ospf2, w);
       break;
 
     case LSA_T_SUM_NET:
       if (cnode->lsa_type == LSA_T_RT)
-	show_lsa_sum_net(he, ospf2, af);
+	show_lsa_sum_net(he, ospf2, af, w);
       break;
 
     case LSA_T_SUM_RT:
       if (cnode->lsa_type == LSA_T_RT)
-	show_lsa_sum_rt(he, ospf2);
+	show_lsa_sum_rt(he, ospf2, w);
       break;
 
     case LSA_T_EXT:
     case LSA_T_NSSA:
-      show_lsa_external(he, ospf2, af);
+      show_lsa_external(he, ospf2, af, w);
       break;
 
     case LSA_T_PREFIX:
-      show_lsa_prefix(he, cnode, af);
+      show_lsa_prefix(he, cnode, af, w);
       break;
     }
 
@@ -1374,9 +1699,13 @@ ospf_sh_state(struct proto *P, int verbose, int reachable)
 	ix++;
 
       while ((ix < jx) && (hex[ix]->lsa.rt == cnode->lsa.rt))
-	show_lsa_external(hex[ix++], ospf2, af);
+	show_lsa_external(hex[ix++], ospf2, af, w);
+
+      if (w)
+	json_lsa_node_end(w);
 
       cnode = NULL;
+      w = NULL;
     }
   }
 
@@ -1394,24 +1723,39 @@ ospf_sh_state(struct proto *P, int verbose, int reachable)
       if ((he->color != INSPF) && reachable)
 	continue;
 
-      if (!hdr)
+      if (!hdr && !json)
       {
 	cli_msg(-1016, "");
 	cli_msg(-1016, "other ASBRs");
 	hdr = 1;
       }
 
-      if (he->lsa.rt != last_rt)
+      if ((he->lsa.rt != last_rt) && json)
+      {
+	if (w)
+	  json_lsa_node_end(w);
+
+	w = json_lsa_node(0xFFFFFFFF);
+	json_put_string(w, "type", "asbr");
+	json_key(w, "router");
+	json_printf(w, "\"%R\"", he->lsa.rt);
+	json_open(w, "entries", '[');
+	last_rt = he->lsa.rt;
+      }
+      else if (he->lsa.rt != last_rt)
       {
 	cli_msg(-1016, "");
 	cli_msg(-1016, "\trouter %R", he->lsa.rt);
 	last_rt = he->lsa.rt;
       }
 
-      show_lsa_external(he, ospf2, af);
+      show_lsa_external(he, ospf2, af, w);
     }
   }
 
+  if (w)
+    json_lsa_node_end(w);
+
   cli_msg(0, "");
 }
 
@@ -1470,7 +1814,10 @@ ospf_sh_lsadb(struct lsadb_show_data *ld)
   j = 0;
   WALK_SLIST(he, p->lsal)
     if (he->lsa_body)
+    {
+      lsa_update_age(he);
       hea[j++] = he;
+    }
 
   ASSERT(j <= num);
 
@@ -1541,6 +1888,7 @@ struct protocol proto_ospf = {
   .channel_mask =	NB_IP,
   .proto_size =		sizeof(struct ospf_proto),
   .config_size =	sizeof(struct ospf_config),
+  .rte_size =		RTE_SIZE(ospf),
   .init =		ospf_init,
   .dump =		ospf_dump,
   .start =		ospf_start,
@@ -15,6 +15,7 @@
 
 #include "lib/checksum.h"
 #include "lib/idm.h"
+#include "lib/hash.h"
 #include "lib/lists.h"
 #include "lib/slists.h"
 #include "lib/socket.h"
@@ -78,14 +79,29 @@
 #define OSPF_DEFAULT_GR_TIME 120
 #define OSPF_DEFAULT_TRANSINT 40
 
+#define OSPF_DEFAULT_SPF_INITIAL_DELAY	(50 MS_)
+#define OSPF_DEFAULT_SPF_SHORT_DELAY	(200 MS_)
+#define OSPF_DEFAULT_SPF_LONG_DELAY	(5 S_)
+#define OSPF_DEFAULT_SPF_HOLDDOWN	(10 S_)
+#define OSPF_DEFAULT_SPF_LEARN		(500 MS_)
+
 #define OSPF_MIN_PKT_SIZE 256
 #define OSPF_MAX_PKT_SIZE 65535
 
 #define OSPF_VLINK_ID_OFFSET 0x80000000
 
+#define OSPF_LSA_INDEX_SUM	0	/* Summary-net and summary-router LSAs */
+#define OSPF_LSA_INDEX_EXT	1	/* AS-external and NSSA LSAs */
+#define OSPF_LSA_INDEX_PREFIX	2	/* OSPFv3 intra-area-prefix LSAs */
+#define OSPF_LSA_INDEX_MAX	3
+
 #define OSPF_GR_ABLE		1
 #define OSPF_GR_AWARE		2
 
+#define OSPF_SPF_QUIET		0	/* RFC 8405 SPF backoff states */
+#define OSPF_SPF_SHORT_WAIT	1
+#define OSPF_SPF_LONG_WAIT	2
+
 struct ospf_config
 {
   struct proto_config c;
@@ -104,6 +120,12 @@ struct ospf_config
   u8 gr_mode;			/* Graceful restart mode (OSPF_GR_*) */
   uint gr_time;			/* Graceful restart interval */
   uint ecmp;
+  u8 spf_backoff;		/* Use SPF backoff instead of tick (RFC 8405) */
+  btime spf_initial_delay;
+  btime spf_short_delay;
+  btime spf_long_delay;
+  btime spf_holddown;
+  btime spf_learn;
   list area_list;		/* list of area configs (struct ospf_area_config) */
   list vlink_list;		/* list of configured vlinks (struct ospf_iface_patt) */
 };
@@ -217,17 +239,23 @@ struct ospf_proto
   uint tick;
   struct top_graph *gr;		/* LSA graph */
   slist lsal;			/* List of all LSA's */
+  list lsa_index[OSPF_LSA_INDEX_MAX]; /* LSAs from lsal by type (struct top_hash_entry, tn) */
+  BUFFER_(struct top_hash_entry *) lsa_heap; /* LSAs from lsal ordered by lsa_due */
   int calcrt;			/* Routing table calculation scheduled?
 				   0=no, 1=normal, 2=forced reload */
+  u8 calcrt_ext;		/* Only external routes need recalculation */
   list iface_list;		/* List of OSPF interfaces (struct ospf_iface) */
   list area_list;		/* List of OSPF areas (struct ospf_area) */
   int areano;			/* Number of area I belong to */
   int padj;			/* Number of neighbors in Exchange or Loading state */
+  uint lsadb_gen;		/* Incremented on each change of LSA database */
   int gr_count;			/* Number of neighbors in graceful restart state */
   u8 gr_recovery;		/* Graceful restart recovery is active */
   u8 gr_cleanup;		/* GR cleanup scheduled */
   btime gr_timeout;		/* The end time of grace restart recovery */
   struct fib rtf;		/* Routing table */
+  BUFFER_(struct ort *) rt_ext;	/* Entries with external routes after last rt_sync() */
+  BUFFER_(struct ort *) rt_dirty; /* Entries changed by partial recalculation */
   struct idm idm;		/* OSPFv3 LSA ID map */
   u8 ospf2;			/* OSPF v2 or v3 */
   u8 af_ext;			/* OSPFv3-AF extension */
@@ -241,12 +269,25 @@ struct ospf_proto
   u8 ecmp;			/* Maximal number of nexthops in ECMP route, or 0 */
   u8 gr_mode;			/* Graceful restart mode (OSPF_GR_*) */
   uint gr_time;			/* Graceful restart interval */
+  u8 spf_backoff;		/* SPF backoff is enabled */
+  u8 spf_state;			/* SPF backoff state (OSPF_SPF_*) */
+  btime spf_initial_delay;
+  btime spf_short_delay;
+  btime spf_long_delay;
+  btime spf_holddown;
+  btime spf_learn;
+  timer *spf_timer;		/* SPF_TIMER, delays routing table calculation */
+  timer *spf_holddown_timer;	/* HOLDDOWN_TIMER, returns to QUIET state */
+  timer *spf_learn_timer;	/* LEARN_TIMER, switches to LONG_WAIT state */
   u64 csn64;			/* Last used cryptographic sequence number */
   struct ospf_area *backbone;	/* If exists */
   event *flood_event;		/* Event for flooding LS updates */
+  event *ext_event;		/* Event for origination of external LSAs */
+  BUFFER_(struct ospf_ext_req) ext_queue; /* Pending external LSAs (struct ospf_ext_req) */
   void *lsab;			/* LSA buffer used when originating router LSAs */
   int lsab_size, lsab_used;
   linpool *nhpool;		/* Linpool used for next hops computed in SPF */
+  linpool *nhpool_ext;		/* Linpool used for next hops of external routes */
   sock *vlink_sk;		/* IP socket used for vlink TX */
   u32 router_id;
   u32 last_vlink_id;		/* Interface IDs for vlinks (starts at 0x80000000) */
@@ -261,7 +302,7 @@ struct ospf_area
   struct ospf_area_config *ac;	/* Related area config */
   struct top_hash_entry *rt;	/* My own router LSA */
   struct top_hash_entry *pxr_lsa; /* Originated prefix LSA */
-  list cand;			/* List of candidates for RT calc. */
+  BUFFER_(struct top_hash_entry *) cand; /* Heap of candidates for RT calc. */
   struct fib net_fib;		/* Networks to advertise or not */
   struct fib enet_fib;		/* External networks for NSSAs */
   u32 options;			/* Optional features */
@@ -286,6 +327,8 @@ struct ospf_iface
   pool *pool;
   sock *sk;			/* IP socket */
   list neigh_list;		/* List of neighbors (struct ospf_neighbor) */
+  HASH(struct ospf_neighbor) neigh_rid_hash; /* Neighbors by Router ID */
+  HASH(struct ospf_neighbor) neigh_ip_hash; /* Neighbors by IP address */
   u32 cost;			/* Cost of iface */
   u32 waitint;			/* Number of seconds before changing state from wait */
   u32 rxmtint;			/* Number of seconds between LSA retransmissions */
@@ -296,6 +339,7 @@ struct ospf_iface
   ip_addr vip;			/* IP of peer of virtual link */
   struct ospf_iface *vifa;	/* OSPF iface which the vlink goes through */
   struct ospf_area *voa;	/* OSPF area which the vlink goes through */
+  struct ospf_dbsum *dbsum;	/* Last database summary, shared by neighbors */
   u16 inftransdelay;		/* The estimated number of seconds it takes to
 				   transmit a Link State Update Packet over this
 				   interface.  LSAs contained in the update */
@@ -359,6 +403,8 @@ struct ospf_neighbor
   node n;
   pool *pool;
   struct ospf_iface *ifa;
+  struct ospf_neighbor *next_rid;	/* Next in ifa->neigh_rid_hash */
+  struct ospf_neighbor *next_ip;	/* Next in ifa->neigh_ip_hash */
   u8 state;
   u8 gr_active;			/* We act as GR helper for the neighbor */
   u8 got_my_rt_lsa;		/* Received my Rt-LSA in DBDES exchanged */
@@ -379,10 +425,11 @@ struct ospf_neighbor
   u32 bdr;			/* Neighbor's idea of BDR */
   u32 iface_id;			/* ID of Neighbour's iface connected to common network */
 
-  /* Database summary list iterator, controls initial dbdes exchange.
-   * Advances in the LSA list as dbdes packets are sent.
+  /* Database summary list, controls initial dbdes exchange.
+   * Position advances in the summary as dbdes packets are sent.
    */
-  siterator dbsi;		/* iterator of po->lsal */
+  struct ospf_dbsum *dbsum;	/* Shared snapshot of LSA headers, see dbdes.c */
+  uint dbsum_pos;		/* Next LSA header to be sent */
 
   /* Link state request list, controls initial LSA exchange.
    * Entries added when received in dbdes packets, removed as sent in lsreq packets.
@@ -948,6 +995,7 @@ struct lsadb_show_data {
 
 /* ospf.c */
 void ospf_schedule_rtcalc(struct ospf_proto *p);
+void ospf_schedule_rtcalc_ext(struct ospf_proto *p);
 
 static inline void ospf_notify_rt_lsa(struct ospf_area *oa)
 { oa->update_rt_lsa = 1; }
@@ -995,7 +1043,7 @@ void ospf_stop_gr_recovery(struct ospf_proto *p);
 void ospf_sh_neigh(struct proto *P, const char *iff);
 void ospf_sh(struct proto *P);
 void ospf_sh_iface(struct proto *P, const char *iff);
-void ospf_sh_state(struct proto *P, int verbose, int reachable);
+void ospf_sh_state(struct proto *P, int verbose, int reachable, int json);
 
 void ospf_sh_lsadb(struct lsadb_show_data *ld);
 
@@ -1035,7 +1083,9 @@ static inline u32 ospf_iface_get_data(struct ospf_iface *ifa)
 }
 
 /* neighbor.c */
-struct ospf_neighbor *ospf_neighbor_new(struct ospf_iface *ifa);
+void ospf_neigh_init_hash(struct ospf_iface *ifa);
+struct ospf_neighbor *ospf_neighbor_new(struct ospf_iface *ifa, u32 rid, ip_addr ip);
+void ospf_neigh_set_ip(struct ospf_neighbor *n, ip_addr ip);
 void ospf_neigh_sm(struct ospf_neighbor *n, int event);
 void ospf_neigh_cancel_graceful_restart(struct ospf_neighbor *n);
 void ospf_neigh_notify_grace_lsa(struct ospf_neighbor *n, struct top_hash_entry *en);
@@ -1098,6 +1148,8 @@ uint ospf_hello3_options(struct ospf_packet *pkt);
 void ospf_send_dbdes(struct ospf_proto *p, struct ospf_neighbor *n);
 void ospf_rxmt_dbdes(struct ospf_proto *p, struct ospf_neighbor *n);
 void ospf_reset_ldd(struct ospf_proto *p, struct ospf_neighbor *n);
+void ospf_dbsum_init(struct ospf_proto *p, struct ospf_neighbor *n);
+void ospf_dbsum_free(struct ospf_neighbor *n);
 void ospf_receive_dbdes(struct ospf_packet *pkt, struct ospf_iface *ifa, struct ospf_neighbor *n);
 uint ospf_dbdes3_options(struct ospf_packet *pkt);
 
@@ -9,9 +9,22 @@
  */
 
 #include "ospf.h"
+#include "lib/heap.h"
+#include "lib/tracepoint.h"
 
 static void add_cand(struct ospf_area *oa, struct top_hash_entry *en, struct top_hash_entry *par, u32 dist, int i, uint data, uint lif, uint nif);
 static void rt_sync(struct ospf_proto *p);
+static void rt_sync_dirty(struct ospf_proto *p);
+
+/* Candidates are ordered by distance, network vertices first (16.1. (3)) */
+#define CAND_LESS(a,b)		(((a)->dist < (b)->dist) || \
+				 (((a)->dist == (b)->dist) && \
+				  ((a)->lsa_type != LSA_T_RT) && ((b)->lsa_type == LSA_T_RT)))
+#define CAND_SWAP(heap,a,b,t)	(t = heap[a], heap[a] = heap[b], heap[b] = t, \
+				 heap[a]->cand_index = (a), heap[b]->cand_index = (b))
+
+static inline uint cand_count(struct ospf_area *oa)
+{ return oa->cand.used - 1; }
 
 
 static inline void reset_ri(ort *ort)
@@ -19,6 +32,19 @@ static inline void reset_ri(ort *ort)
   bzero(&ort->n, sizeof(orta));
 }
 
+static inline int ort_is_ext(ort *nf)
+{ return (nf->n.type == RTS_OSPF_EXT1) || (nf->n.type == RTS_OSPF_EXT2); }
+
+static inline void
+ort_mark_dirty(struct ospf_proto *p, ort *nf)
+{
+  if (nf->dirty)
+    return;
+
+  nf->dirty = 1;
+  BUFFER_PUSH(p->rt_dirty) = nf;
+}
+
 static inline int
 nh_is_vlink(struct nexthop *nhs)
 {
@@ -362,6 +388,9 @@ ri_install_ext(struct ospf_proto *p, net_addr *net, const orta *new)
   ort *old = fib_get(&p->rtf, net);
   int cmp = orta_compare_ext(p, new, &old->n);
 
+  if (cmp >= 0)
+    ort_mark_dirty(p, old);
+
   if (cmp > 0)
     ort_replace(old, new);
   else if (cmp == 0)
@@ -573,14 +602,12 @@ spfa_process_prefixes(struct ospf_proto *p, struct ospf_area *oa)
 {
   struct top_hash_entry *en, *src;
   struct ospf_lsa_prefix *px;
+  node *nn;
   u32 *buf;
   int i;
 
-  WALK_SLIST(en, p->lsal)
+  WALK_LIST2(en, nn, p->lsa_index[OSPF_LSA_INDEX_PREFIX], tn)
   {
-    if (en->lsa_type != LSA_T_PREFIX)
-      continue;
-
     if (en->domain != oa->areaid)
       continue;
 
@@ -632,7 +659,7 @@ ospf_rt_spfa(struct ospf_area *oa)
 {
   struct ospf_proto *p = oa->po;
   struct top_hash_entry *act;
-  node *n;
+  uint num;
 
   if (oa->rt == NULL)
     return;
@@ -642,22 +669,23 @@ ospf_rt_spfa(struct ospf_area *oa)
   OSPF_TRACE(D_EVENTS, "Starting routing table calculation for area %R", oa->areaid);
 
   /* 16.1. (1) */
-  init_list(&oa->cand);		/* Empty list of candidates */
+  oa->cand.used = 1;		/* Empty heap of candidates */
   oa->trcap = 0;
 
   DBG("LSA db prepared, adding me into candidate list.\n");
 
   oa->rt->dist = 0;
   oa->rt->color = CANDIDATE;
-  add_head(&oa->cand, &oa->rt->cn);
+  oa->rt->cand_index = 1;
+  BUFFER_PUSH(oa->cand) = oa->rt;
   DBG("RT LSA: rt: %R, id: %R, type: %u\n",
       oa->rt->lsa.rt, oa->rt->lsa.id, oa->rt->lsa_type);
 
-  while (!EMPTY_LIST(oa->cand))
+  while ((num = cand_count(oa)))
   {
-    n = HEAD(oa->cand);
-    act = SKIP_BACK(struct top_hash_entry, cn, n);
-    rem_node(n);
+    act = oa->cand.data[1];
+    HEAP_DELMIN(oa->cand.data, num, struct top_hash_entry *, CAND_LESS, CAND_SWAP);
+    BUFFER_POP(oa->cand);
 
     DBG("Working on LSA: rt: %R, id: %R, type: %u\n",
 	act->lsa.rt, act->lsa.id, act->lsa_type);
@@ -776,6 +804,7 @@ ospf_rt_sum(struct ospf_area *oa)
 {
   struct ospf_proto *p = oa->po;
   struct top_hash_entry *en;
+  node *nn;
   net_addr net;
   u32 dst_rid, metric, options;
   ort *abr;
@@ -784,11 +813,8 @@ ospf_rt_sum(struct ospf_area *oa)
 
   OSPF_TRACE(D_EVENTS, "Starting routing table calculation for inter-area (area %R)", oa->areaid);
 
-  WALK_SLIST(en, p->lsal)
+  WALK_LIST2(en, nn, p->lsa_index[OSPF_LSA_INDEX_SUM], tn)
   {
-    if ((en->lsa_type != LSA_T_SUM_RT) && (en->lsa_type != LSA_T_SUM_NET))
-      continue;
-
     if (en->domain != oa->areaid)
       continue;
 
@@ -876,17 +902,15 @@ ospf_rt_sum_tr(struct ospf_area *oa)
   struct ospf_proto *p = oa->po;
   struct ospf_area *bb = p->backbone;
   struct top_hash_entry *en;
+  node *nn;
   ort *re, *abr;
   u32 metric;
 
   if (!bb)
     return;
 
-  WALK_SLIST(en, p->lsal)
+  WALK_LIST2(en, nn, p->lsa_index[OSPF_LSA_INDEX_SUM], tn)
   {
-    if ((en->lsa_type != LSA_T_SUM_RT) && (en->lsa_type != LSA_T_SUM_NET))
-      continue;
-
     if (en->domain != oa->areaid)
       continue;
 
@@ -1474,6 +1498,7 @@ static void
 ospf_ext_spf(struct ospf_proto *p)
 {
   struct top_hash_entry *en;
+  node *nn;
   struct ospf_lsa_ext_local rt;
   ort *nf1, *nf2;
   u32 br_metric;
@@ -1481,14 +1506,11 @@ ospf_ext_spf(struct ospf_proto *p)
 
   OSPF_TRACE(D_EVENTS, "Starting routing table calculation for ext routes");
 
-  WALK_SLIST(en, p->lsal)
+  /* 16.4. (1) */
+  WALK_LIST2(en, nn, p->lsa_index[OSPF_LSA_INDEX_EXT], tn)
   {
     orta nfa = {};
 
-    /* 16.4. (1) */
-    if ((en->lsa_type != LSA_T_EXT) && (en->lsa_type != LSA_T_NSSA))
-      continue;
-
     if (en->lsa.age == LSA_MAXAGE)
       continue;
 
@@ -1676,6 +1698,39 @@ ospf_rt_reset(struct ospf_proto *p)
   }
 }
 
+/* Cleanup of external routes before their recalculation */
+static void
+ospf_rt_reset_ext(struct ospf_proto *p)
+{
+  struct top_hash_entry *en;
+  node *nn;
+
+  /* Entries with external routes are known from the last rt_sync() */
+  BUFFER_WALK(p->rt_ext, ri)
+  {
+    if (ort_is_ext(ri))
+    {
+      reset_ri(ri);
+      ort_mark_dirty(p, ri);
+    }
+  }
+
+  WALK_LIST2(en, nn, p->lsa_index[OSPF_LSA_INDEX_EXT], tn)
+    en->color = OUTSPF;
+}
+
+/* Next hops of external routes are kept separately, so they can be recomputed alone */
+static void
+ospf_rt_ext(struct ospf_proto *p)
+{
+  linpool *nhpool = p->nhpool;
+
+  lp_flush(p->nhpool_ext);
+  p->nhpool = p->nhpool_ext;
+  ospf_ext_spf(p);
+  p->nhpool = nhpool;
+}
+
 /**
  * ospf_rt_spf - calculate internal routes
  * @p: OSPF protocol instance
@@ -1683,6 +1738,11 @@ ospf_rt_reset(struct ospf_proto *p)
  * Calculation of internal paths in an area is described in 16.1 of RFC 2328.
  * It's based on Dijkstra's shortest path tree algorithms.
  * This function is invoked from ospf_disp().
+ *
+ * Results of the calculation (including next hops) are kept until the next
+ * one. When only AS-external or NSSA LSAs changed (see ospf_schedule_rtcalc_ext())
+ * and the router is not an ABR, just external routes are recomputed on top of
+ * kept intra-area and inter-area routes, as described in 16.6 of RFC 2328.
  */
 void
 ospf_rt_spf(struct ospf_proto *p)
@@ -1692,12 +1752,30 @@ ospf_rt_spf(struct ospf_proto *p)
   if (p->areano == 0)
     return;
 
+  TRACEPOINT(ospf_rt_spf, p->p.name, p->calcrt_ext);
+
+  /* 16.6. - incremental update of external routes */
+  if (p->calcrt_ext && (p->areano == 1))
+  {
+    ospf_rt_reset_ext(p);
+    ospf_rt_ext(p);
+    rt_sync_dirty(p);
+    goto done;
+  }
+
   OSPF_TRACE(D_EVENTS, "Starting routing table calculation");
 
   /* 16. (1) */
   ospf_rt_reset(p);
+  lp_flush(p->nhpool);
 
-  /* 16. (2) */
+  /*
+   * 16. (2) - Areas are processed one after another. Although intra-area
+   * calculations are independent in principle, they share the next hop
+   * linpool, the routing table fib (ri_install_net() compares routes from
+   * different areas) and SPF state in LSA entries of vlinks and ASBRs, and
+   * BIRD core (resources, timers, logging) is not thread-safe.
+   */
   WALK_LIST(oa, p->area_list)
     ospf_rt_spfa(oa);
 
@@ -1713,18 +1791,19 @@ ospf_rt_spf(struct ospf_proto *p)
     ospf_rt_abr1(p);
 
   /* 16. (5) */
-  ospf_ext_spf(p);
+  ospf_rt_ext(p);
 
   if (p->areano > 1)
     ospf_rt_abr2(p);
 
   rt_sync(p);
-  lp_flush(p->nhpool);
 
+done:
+  TRACEPOINT(ospf_rt_spf__done, p->p.name, p->calcrt_ext);
   p->calcrt = 0;
+  p->calcrt_ext = 0;
 }
 
-
 static inline int
 inherit_nexthops(struct nexthop *pn)
 {
@@ -1879,9 +1958,7 @@ add_cand(struct ospf_area *oa, struct top_hash_entry *en, struct top_hash_entry
 	 u32 dist, int pos, uint data, uint lif, uint nif)
 {
   struct ospf_proto *p = oa->po;
-  node *prev, *n;
-  int added = 0;
-  struct top_hash_entry *act;
+  uint num = cand_count(oa);
 
   /* 16.1. (2b) */
   if (en == NULL)
@@ -1955,44 +2032,21 @@ add_cand(struct ospf_area *oa, struct top_hash_entry *en, struct top_hash_entry
   DBG("     Adding candidate: rt: %R, id: %R, type: %u\n",
       en->lsa.rt, en->lsa.id, en->lsa_type);
 
-  if (en->color == CANDIDATE)
-  {				/* We found a shorter path */
-    rem_node(&en->cn);
-  }
   en->nhs = nhs;
-  en->dist = dist;
-  en->color = CANDIDATE;
   en->nhs_reuse = (par->nhs != nhs);
 
-  prev = NULL;
-
-  if (EMPTY_LIST(oa->cand))
-  {
-    add_head(&oa->cand, &en->cn);
+  if (en->color == CANDIDATE)
+  {				/* We found a shorter path */
+    en->dist = dist;
+    HEAP_DECREASE(oa->cand.data, num, struct top_hash_entry *, CAND_LESS, CAND_SWAP, en->cand_index);
+    return;
   }
-  else
-  {
-    WALK_LIST(n, oa->cand)
-    {
-      act = SKIP_BACK(struct top_hash_entry, cn, n);
-      if ((act->dist > dist) ||
-	  ((act->dist == dist) && (act->lsa_type == LSA_T_RT)))
-      {
-	if (prev == NULL)
-	  add_head(&oa->cand, &en->cn);
-	else
-	  insert_node(&en->cn, prev);
-	added = 1;
-	break;
-      }
-      prev = n;
-    }
 
-    if (!added)
-    {
-      add_tail(&oa->cand, &en->cn);
-    }
-  }
+  en->dist = dist;
+  en->color = CANDIDATE;
+  en->cand_index = ++num;
+  BUFFER_PUSH(oa->cand) = en;
+  HEAP_INSERT(oa->cand.data, num, struct top_hash_entry *, CAND_LESS, CAND_SWAP);
 }
 
 static inline int
@@ -2006,6 +2060,87 @@ ort_changed(ort *nf, rta *nr)
     !nexthop_same(&(nr->nh), &(or->nh));
 }
 
+/* Synchronize one entry with nest, returns 1 if the entry is no longer used */
+static int
+rt_sync_entry(struct ospf_proto *p, ort *nf, int reload)
+{
+  /* Sanity check of next-hop addresses, failure should not happen */
+  if (nf->n.type)
+  {
+    struct nexthop *nh;
+    for (nh = nf->n.nhs; nh; nh = nh->next)
+      if (ipa_nonzero(nh->gw))
+      {
+	neighbor *ng = neigh_find(&p->p, nh->gw, nh->iface, 0);
+	if (!ng || (ng->scope == SCOPE_HOST))
+	  { reset_ri(nf); break; }
+      }
+  }
+
+  /* Configured stubnets are not exported, but we keep the entries */
+  if (nf->n.type && !nf->n.nhs)
+    nf->keep = 1;
+
+  if (nf->n.type && nf->n.nhs) /* Add the route */
+  {
+    rta a0 = {
+      .src = p->p.main_source,
+      .source = nf->n.type,
+      .scope = SCOPE_UNIVERSE,
+      .dest = RTD_UNICAST,
+      .nh = *(nf->n.nhs),
+    };
+
+    if (reload || ort_changed(nf, &a0))
+    {
+      rta *a = rta_lookup(&a0);
+      rte *e = rte_get_temp(a);
+
+      rta_free(nf->old_rta);
+      nf->old_rta = rta_clone(a);
+      e->u.ospf.metric1 = nf->old_metric1 = nf->n.metric1;
+      e->u.ospf.metric2 = nf->old_metric2 = nf->n.metric2;
+      e->u.ospf.tag = nf->old_tag = nf->n.tag;
+      e->u.ospf.router_id = nf->old_rid = nf->n.rid;
+      e->pflags = EA_ID_FLAG(EA_OSPF_METRIC1) | EA_ID_FLAG(EA_OSPF_ROUTER_ID);
+
+      if (nf->n.type == RTS_OSPF_EXT2)
+	e->pflags |= EA_ID_FLAG(EA_OSPF_METRIC2);
+
+      /* Perhaps onfly if tag is non-zero? */
+      if ((nf->n.type == RTS_OSPF_EXT1) || (nf->n.type == RTS_OSPF_EXT2))
+	e->pflags |= EA_ID_FLAG(EA_OSPF_TAG);
+
+      DBG("Mod rte type %d - %N via %I on iface %s, met %d\n",
+	  a0.source, nf->fn.addr, a0.gw, a0.iface ? a0.iface->name : "(none)", nf->n.metric1);
+      rte_update(&p->p, nf->fn.addr, e);
+    }
+  }
+  else if (nf->old_rta)
+  {
+    /* Remove the route */
+    rta_free(nf->old_rta);
+    nf->old_rta = NULL;
+
+    rte_update(&p->p, nf->fn.addr, NULL);
+  }
+
+  /* Remove unused rt entry, some special entries are persistent */
+  if (!nf->n.type && !nf->external_rte && !nf->area_net && !nf->keep)
+  {
+    if (nf->lsa_id)
+      idm_free(&p->idm, nf->lsa_id);
+
+    return 1;
+  }
+
+  /* Remember entries with external routes for partial recalculation */
+  if (ort_is_ext(nf))
+    BUFFER_PUSH(p->rt_ext) = nf;
+
+  return 0;
+}
+
 static void
 rt_sync(struct ospf_proto *p)
 {
@@ -2019,81 +2154,18 @@ rt_sync(struct ospf_proto *p)
 
   OSPF_TRACE(D_EVENTS, "Starting routing table synchronization");
 
+  BUFFER_FLUSH(p->rt_ext);
+  BUFFER_FLUSH(p->rt_dirty);
+
   DBG("Now syncing my rt table with nest's\n");
   FIB_ITERATE_INIT(&fit, fib);
 again1:
   FIB_ITERATE_START(fib, &fit, ort, nf)
   {
-    /* Sanity check of next-hop addresses, failure should not happen */
-    if (nf->n.type)
-    {
-      struct nexthop *nh;
-      for (nh = nf->n.nhs; nh; nh = nh->next)
-	if (ipa_nonzero(nh->gw))
-	{
-	  neighbor *ng = neigh_find(&p->p, nh->gw, nh->iface, 0);
-	  if (!ng || (ng->scope == SCOPE_HOST))
-	    { reset_ri(nf); break; }
-	}
-    }
+    nf->dirty = 0;
 
-    /* Remove configured stubnets but keep the entries */
-    if (nf->n.type && !nf->n.nhs)
-    {
-      reset_ri(nf);
-      nf->keep = 1;
-    }
-
-    if (nf->n.type) /* Add the route */
-    {
-      rta a0 = {
-	.src = p->p.main_source,
-	.source = nf->n.type,
-	.scope = SCOPE_UNIVERSE,
-	.dest = RTD_UNICAST,
-	.nh = *(nf->n.nhs),
-      };
-
-      if (reload || ort_changed(nf, &a0))
-      {
-	rta *a = rta_lookup(&a0);
-	rte *e = rte_get_temp(a);
-
-	rta_free(nf->old_rta);
-	nf->old_rta = rta_clone(a);
-	e->u.ospf.metric1 = nf->old_metric1 = nf->n.metric1;
-	e->u.ospf.metric2 = nf->old_metric2 = nf->n.metric2;
-	e->u.ospf.tag = nf->old_tag = nf->n.tag;
-	e->u.ospf.router_id = nf->old_rid = nf->n.rid;
-	e->pflags = EA_ID_FLAG(EA_OSPF_METRIC1) | EA_ID_FLAG(EA_OSPF_ROUTER_ID);
-
-	if (nf->n.type == RTS_OSPF_EXT2)
-	  e->pflags |= EA_ID_FLAG(EA_OSPF_METRIC2);
-
-	/* Perhaps onfly if tag is non-zero? */
-	if ((nf->n.type == RTS_OSPF_EXT1) || (nf->n.type == RTS_OSPF_EXT2))
-	  e->pflags |= EA_ID_FLAG(EA_OSPF_TAG);
-
-	DBG("Mod rte type %d - %N via %I on iface %s, met %d\n",
-	    a0.source, nf->fn.addr, a0.gw, a0.iface ? a0.iface->name : "(none)", nf->n.metric1);
-	rte_update(&p->p, nf->fn.addr, e);
-      }
-    }
-    else if (nf->old_rta)
+    if (rt_sync_entry(p, nf, reload))
     {
-      /* Remove the route */
-      rta_free(nf->old_rta);
-      nf->old_rta = NULL;
-
-      rte_update(&p->p, nf->fn.addr, NULL);
-    }
-
-    /* Remove unused rt entry, some special entries are persistent */
-    if (!nf->n.type && !nf->external_rte && !nf->area_net && !nf->keep)
-    {
-      if (nf->lsa_id)
-	idm_free(&p->idm, nf->lsa_id);
-
       FIB_ITERATE_PUT(&fit);
       fib_delete(fib, nf);
       goto again1;
@@ -2125,6 +2197,25 @@ again2:
       ospf_flush_lsa(p, en);
 }
 
+/* Like rt_sync(), but only for entries changed by partial recalculation */
+static void
+rt_sync_dirty(struct ospf_proto *p)
+{
+  OSPF_TRACE(D_EVENTS, "Starting routing table synchronization (%u entries)", p->rt_dirty.used);
+
+  BUFFER_FLUSH(p->rt_ext);
+
+  BUFFER_WALK(p->rt_dirty, nf)
+  {
+    nf->dirty = 0;
+
+    if (rt_sync_entry(p, nf, 0))
+      fib_delete(&p->rtf, nf);
+  }
+
+  BUFFER_FLUSH(p->rt_dirty);
+}
+
 
 /* RFC 3623 2.2 - checking for graceful restart termination conditions */
 void
@@ -82,9 +82,11 @@ typedef struct ort
   u32 old_metric1, old_metric2, old_tag, old_rid;
   rta *old_rta;
   u32 lsa_id;
+  u32 ext_req;			/* Position of pending request in ext_queue + 1, or 0 */
   u8 external_rte;
   u8 area_net;
   u8 keep;
+  u8 dirty;			/* In ospf_proto->rt_dirty */
 
   struct fib_node fn;
 }
@@ -11,6 +11,7 @@
 
 #include "nest/bird.h"
 #include "lib/string.h"
+#include "lib/heap.h"
 
 #include "ospf.h"
 
@@ -26,6 +27,122 @@
 static inline void * lsab_flush(struct ospf_proto *p);
 static inline void lsab_reset(struct ospf_proto *p);
 
+static inline int
+ospf_lsa_index(u32 type)
+{
+  switch (type)
+  {
+  case LSA_T_SUM_NET:
+  case LSA_T_SUM_RT:
+    return OSPF_LSA_INDEX_SUM;
+
+  case LSA_T_EXT:
+  case LSA_T_NSSA:
+    return OSPF_LSA_INDEX_EXT;
+
+  case LSA_T_PREFIX:
+    return OSPF_LSA_INDEX_PREFIX;
+
+  default:
+    return -1;
+  }
+}
+
+/*
+ * LSA entries are kept in a heap ordered by lsa_due, the time when
+ * ospf_update_lsadb() has to handle them next (refresh, aging out, postponed
+ * origination, flushing). Like timers, an entry whose due time is postponed
+ * is moved in the heap lazily, it is just handled early and rescheduled.
+ * Entries being flushed or having postponed origination are handled on each
+ * tick. Therefore, callers changing an LSA entry just have to call
+ * ospf_schedule_lsa() when the change may need earlier handling.
+ */
+
+#define LSA_HEAP_LESS(a,b)	((a)->lsa_due < (b)->lsa_due)
+#define LSA_HEAP_SWAP(heap,a,b,t) (t = heap[a], heap[a] = heap[b], heap[b] = t, \
+				   heap[a]->heap_index = (a), heap[b]->heap_index = (b))
+
+static inline uint
+ospf_lsa_heap_count(struct ospf_proto *p)
+{ return p->lsa_heap.used - 1; }
+
+static inline struct top_hash_entry *
+ospf_lsa_heap_first(struct ospf_proto *p)
+{ return ospf_lsa_heap_count(p) ? p->lsa_heap.data[1] : NULL; }
+
+static btime
+ospf_lsa_due(struct ospf_proto *p, struct top_hash_entry *en)
+{
+  /* Postponed origination or flushing in progress, check in the next tick */
+  if (en->next_lsa_body || ((en->lsa.age == LSA_MAXAGE) && en->lsa_body))
+    return current_time() + 1;
+
+  /* Flushed local LSAs are kept until they would reach MaxAge */
+  uint limit = ((en->lsa.rt == p->router_id) && (en->lsa.age < LSA_MAXAGE)) ?
+    LSREFRESHTIME : LSA_MAXAGE;
+
+  return en->inst_time + ((int) limit - (int) en->init_age) S;
+}
+
+static void
+ospf_schedule_lsa(struct ospf_proto *p, struct top_hash_entry *en)
+{
+  btime due = ospf_lsa_due(p, en);
+  uint hc = ospf_lsa_heap_count(p);
+
+  if (!en->heap_index)
+  {
+    en->heap_index = ++hc;
+    en->lsa_due = due;
+    BUFFER_PUSH(p->lsa_heap) = en;
+    HEAP_INSERT(p->lsa_heap.data, hc, struct top_hash_entry *, LSA_HEAP_LESS, LSA_HEAP_SWAP);
+  }
+  else if (due < en->lsa_due)
+  {
+    en->lsa_due = due;
+    HEAP_DECREASE(p->lsa_heap.data, hc, struct top_hash_entry *, LSA_HEAP_LESS, LSA_HEAP_SWAP, en->heap_index);
+  }
+}
+
+static void
+ospf_unschedule_lsa(struct ospf_proto *p, struct top_hash_entry *en)
+{
+  uint hc = ospf_lsa_heap_count(p);
+
+  if (!en->heap_index)
+    return;
+
+  HEAP_DELETE(p->lsa_heap.data, hc, struct top_hash_entry *, LSA_HEAP_LESS, LSA_HEAP_SWAP, en->heap_index);
+  BUFFER_POP(p->lsa_heap);
+  en->heap_index = 0;
+}
+
+/* Add new entry to LSA database list and to the index of its type */
+static void
+ospf_add_lsa(struct ospf_proto *p, struct top_hash_entry *en)
+{
+  int i = ospf_lsa_index(en->lsa_type);
+
+  s_add_tail(&p->lsal, SNODE en);
+
+  if (i >= 0)
+    add_tail(&p->lsa_index[i], &en->tn);
+
+  /* Handled in the next tick, rescheduled properly then */
+  en->lsa_due = 0;
+  ospf_schedule_lsa(p, en);
+}
+
+/* Changes of external LSAs do not affect intra-area and inter-area routes */
+static inline void
+ospf_schedule_rtcalc_lsa(struct ospf_proto *p, struct top_hash_entry *en)
+{
+  if ((en->lsa_type == LSA_T_EXT) || (en->lsa_type == LSA_T_NSSA))
+    ospf_schedule_rtcalc_ext(p);
+  else
+    ospf_schedule_rtcalc(p);
+}
+
 
 /**
  * ospf_install_lsa - install new LSA into database
@@ -53,7 +170,7 @@ ospf_install_lsa(struct ospf_proto *p, struct ospf_lsa_header *lsa, u32 type, u3
   en = ospf_hash_get(p->gr, domain, lsa->id, lsa->rt, type);
 
   if (!SNODE_VALID(en))
-    s_add_tail(&p->lsal, SNODE en);
+    ospf_add_lsa(p, en);
 
   if ((en->lsa_body == NULL) ||			/* No old LSA */
       (en->lsa.length != lsa->length) ||
@@ -83,10 +200,12 @@ ospf_install_lsa(struct ospf_proto *p, struct ospf_lsa_header *lsa, u32 type, u3
   OSPF_TRACE(D_EVENTS, "Installing LSA: Type: %04x, Id: %R, Rt: %R, Seq: %08x, Age: %u",
 	     en->lsa_type, en->lsa.id, en->lsa.rt, en->lsa.sn, en->lsa.age);
 
+  ospf_schedule_lsa(p, en);
+
   if (change)
   {
     ospf_neigh_lsadb_changed(p, en);
-    ospf_schedule_rtcalc(p);
+    ospf_schedule_rtcalc_lsa(p, en);
   }
 
   return en;
@@ -185,6 +304,8 @@ ospf_advance_lsa(struct ospf_proto *p, struct top_hash_entry *en, struct ospf_ls
     en = ospf_install_lsa(p, lsa, type, domain, body);
   }
 
+  ospf_schedule_lsa(p, en);
+
   /*
    * We flood the updated LSA. Although in some cases the to-be-flooded LSA is
    * the same as the received LSA, and therefore we should propagate it as
@@ -213,6 +334,7 @@ ospf_do_originate_lsa(struct ospf_proto *p, struct top_hash_entry *en, void *lsa
 		 en->lsa_type, en->lsa.id, en->lsa.rt, en->lsa.sn);
 
       en->lsa.age = LSA_MAXAGE;
+      ospf_schedule_lsa(p, en);
       ospf_flood_lsa(p, en, NULL);
       return 0;
     }
@@ -249,6 +371,7 @@ ospf_do_originate_lsa(struct ospf_proto *p, struct top_hash_entry *en, void *lsa
   en->inst_time = current_time();
   en->gr_dirty = 0;
   lsa_generate_checksum(&en->lsa, en->lsa_body);
+  ospf_schedule_lsa(p, en);
 
   OSPF_TRACE(D_EVENTS, "Originating LSA: Type: %04x, Id: %R, Rt: %R, Seq: %08x",
 	     en->lsa_type, en->lsa.id, en->lsa.rt, en->lsa.sn);
@@ -258,7 +381,7 @@ ospf_do_originate_lsa(struct ospf_proto *p, struct top_hash_entry *en, void *lsa
   if (en->mode == LSA_M_BASIC)
   {
     ospf_neigh_lsadb_changed(p, en);
-    ospf_schedule_rtcalc(p);
+    ospf_schedule_rtcalc_lsa(p, en);
   }
 
   return 1;
@@ -297,7 +420,7 @@ ospf_originate_lsa(struct ospf_proto *p, struct ospf_new_lsa *lsa)
   en = ospf_hash_get(p->gr, lsa->dom, lsa->id, p->router_id, lsa->type);
 
   if (!SNODE_VALID(en))
-    s_add_tail(&p->lsal, SNODE en);
+    ospf_add_lsa(p, en);
 
   if (!en->nf || !en->lsa_body)
     en->nf = lsa->nf;
@@ -355,6 +478,7 @@ ospf_originate_lsa(struct ospf_proto *p, struct ospf_new_lsa *lsa)
     en->next_lsa_body = lsa_body;
     en->next_lsa_blen = lsa_blen;
     en->next_lsa_opts = lsa->opts;
+    ospf_schedule_lsa(p, en);
   }
 
   return en;
@@ -452,12 +576,13 @@ ospf_flush_lsa(struct ospf_proto *p, struct top_hash_entry *en)
 	     en->lsa_type, en->lsa.id, en->lsa.rt, en->lsa.sn);
 
   en->lsa.age = LSA_MAXAGE;
+  ospf_schedule_lsa(p, en);
   ospf_flood_lsa(p, en, NULL);
 
   if (en->mode == LSA_M_BASIC)
   {
     ospf_neigh_lsadb_changed(p, en);
-    ospf_schedule_rtcalc(p);
+    ospf_schedule_rtcalc_lsa(p, en);
   }
 
   en->mode = LSA_M_BASIC;
@@ -491,6 +616,11 @@ ospf_remove_lsa(struct ospf_proto *p, struct top_hash_entry *en)
    */
 
   s_rem_node(SNODE en);
+  ospf_unschedule_lsa(p, en);
+
+  if (NODE_VALID(&en->tn))
+    rem_node(&en->tn);
+
   ospf_hash_delete(p->gr, en);
 }
 
@@ -504,6 +634,8 @@ ospf_remove_lsa(struct ospf_proto *p, struct top_hash_entry *en)
  * by ospf_flush_lsa(). It also periodically refreshs locally originated LSAs --
  * when the current instance is older %LSREFRESHTIME, a new instance is originated.
  * Finally, it also ages stored LSAs and flushes ones that reached %LSA_MAXAGE.
+ * Only LSA entries that are due according to the LSA heap are processed, ages
+ * of other LSAs are updated lazily by lsa_update_age().
  *
  * The RFC 2328 says that a router should periodically check checksums of all
  * stored LSAs to detect hardware problems. This is not implemented.
@@ -511,12 +643,14 @@ ospf_remove_lsa(struct ospf_proto *p, struct top_hash_entry *en)
 void
 ospf_update_lsadb(struct ospf_proto *p)
 {
-  struct top_hash_entry *en, *nxt;
+  struct top_hash_entry *en;
   btime now_ = current_time();
   int real_age;
 
-  WALK_SLIST_DELSAFE(en, nxt, p->lsal)
+  while ((en = ospf_lsa_heap_first(p)) && (en->lsa_due <= now_))
   {
+    ospf_unschedule_lsa(p, en);
+
     if (en->next_lsa_body)
       ospf_originate_next_lsa(p, en);
 
@@ -529,24 +663,19 @@ ospf_update_lsadb(struct ospf_proto *p)
 
       if ((en->lsa_body == NULL) && (en->next_lsa_body == NULL) &&
 	  ((en->lsa.rt != p->router_id) || (real_age >= LSA_MAXAGE)))
+      {
 	ospf_remove_lsa(p, en);
-
-      continue;
+	continue;
+      }
     }
-
-    if ((en->lsa.rt == p->router_id) && (real_age >= LSREFRESHTIME))
-    {
+    else if ((en->lsa.rt == p->router_id) && (real_age >= LSREFRESHTIME))
       ospf_refresh_lsa(p, en);
-      continue;
-    }
-
-    if (real_age >= LSA_MAXAGE)
-    {
+    else if (real_age >= LSA_MAXAGE)
       ospf_flush_lsa(p, en);
-      continue;
-    }
+    else
+      en->lsa.age = real_age;
 
-    en->lsa.age = real_age;
+    ospf_schedule_lsa(p, en);
   }
 }
 
@@ -568,6 +697,9 @@ ospf_feed_end(struct channel *C)
   struct ospf_proto *p = (struct ospf_proto *) C->proto;
   struct top_hash_entry *en;
 
+  /* Originate pending LSAs first, so they are not flushed as stale */
+  ospf_ext_event(p);
+
   /* Flush stale LSAs */
   WALK_SLIST(en, p->lsal)
     if (en->mode == LSA_M_EXPORT_STALE)
@@ -1324,6 +1456,13 @@ ospf_rt_notify(struct proto *P, struct channel *ch UNUSED, net *n, rte *new, rte
     if (!nf || !nf->external_rte)
       return;
 
+    /* Cancel pending origination */
+    if (nf->ext_req)
+    {
+      p->ext_queue.data[nf->ext_req - 1].nf = NULL;
+      nf->ext_req = 0;
+    }
+
     ospf_flush_ext_lsa(p, oa, nf);
     nf->external_rte = 0;
 
@@ -1383,8 +1522,60 @@ ospf_rt_notify(struct proto *P, struct channel *ch UNUSED, net *n, rte *new, rte
   }
 
   nf = fib_get(&p->rtf, n->n.addr);
-  ospf_originate_ext_lsa(p, oa, nf, LSA_M_EXPORT, metric, ebit, fwd, tag, 1, p->vpn_pe);
   nf->external_rte = 1;
+
+  /* Origination is deferred, repeated updates of the same route are merged */
+  if (!nf->ext_req)
+  {
+    BUFFER_PUSH(p->ext_queue) = (struct ospf_ext_req) { .nf = nf };
+    nf->ext_req = p->ext_queue.used;
+  }
+
+  struct ospf_ext_req *req = &p->ext_queue.data[nf->ext_req - 1];
+  req->fwaddr = fwd;
+  req->metric = metric;
+  req->tag = tag;
+  req->ebit = ebit;
+
+  if (!ev_active(p->ext_event))
+    ev_schedule(p->ext_event);
+}
+
+/**
+ * ospf_ext_event - originate pending external LSAs
+ * @ptr: OSPF protocol instance
+ *
+ * External LSAs for routes exported by ospf_rt_notify() are originated in
+ * bulk from this event, so a burst of exports (e.g. the initial feed) is
+ * processed at once and each route is originated just once, with its last
+ * attributes. Flooding of the new LSAs is batched by ospf_flood_event() and
+ * MinLSInterval is handled by postponing LSAs in ospf_originate_lsa().
+ */
+void
+ospf_ext_event(void *ptr)
+{
+  struct ospf_proto *p = ptr;
+  struct ospf_area *oa = NULL;
+
+  if (!p->ext_queue.used)
+    return;
+
+  if ((p->areano == 1) && oa_is_nssa(HEAD(p->area_list)))
+    oa = HEAD(p->area_list);
+
+  OSPF_TRACE(D_EVENTS, "Originating %u external LSAs", p->ext_queue.used);
+
+  BUFFER_WALK(p->ext_queue, req)
+  {
+    if (!req.nf)
+      continue;
+
+    req.nf->ext_req = 0;
+    ospf_originate_ext_lsa(p, oa, req.nf, LSA_M_EXPORT, req.metric, req.ebit,
+			   req.fwaddr, req.tag, 1, p->vpn_pe);
+  }
+
+  BUFFER_FLUSH(p->ext_queue);
 }
 
 
@@ -2155,6 +2346,7 @@ ospf_dump_lsa(struct top_hash_entry *he, struct proto *p)
   u32 *rts = NULL;
   u32 i, max;
 
+  lsa_update_age(he);
   OSPF_TRACE(D_EVENTS, "- %1x %-1R %-1R %4u 0x%08x 0x%04x %-1R",
 	     he->lsa.type, he->lsa.id, he->lsa.rt, he->lsa.age, he->lsa.sn,
 	     he->lsa.checksum, he->domain);
@@ -14,9 +14,8 @@
 struct top_hash_entry
 {				/* Index for fast mapping (type,rtrid,LSid)->vertex */
   snode n;
-  node cn;			/* For adding into list of candidates
-				   in intra-area routing table calculation */
   struct top_hash_entry *next;	/* Next in hash chain */
+  node tn;			/* Node in per-type index (ospf_proto->lsa_index) */
   struct ospf_lsa_header lsa;
   u16 lsa_type;			/* lsa.type processed and converted to common values (LSA_T_*) */
   u16 init_age;			/* Initial value for lsa.age during inst_time */
@@ -27,11 +26,15 @@ struct top_hash_entry
   u16 next_lsa_blen;		/* For postponed LSA origination */
   u16 next_lsa_opts;		/* For postponed LSA origination */
   btime inst_time;		/* Time of installation into DB */
+  btime lsa_due;		/* Next time ospf_update_lsadb() handles the LSA */
+  uint heap_index;		/* Position in p->lsa_heap, 0 if not there */
   struct ort *nf;		/* Reference fibnode for sum and ext LSAs, NULL for otherwise */
   struct nexthop *nhs;		/* Computed nexthops - valid only in ospf_rt_spf() */
   ip_addr lb;			/* In OSPFv2, link back address. In OSPFv3, any global address in the area useful for vlinks */
   u32 lb_id;			/* Interface ID of link back iface (for bcast or NBMA networks) */
   u32 dist;			/* Distance from the root */
+  uint cand_index;		/* Position in heap of candidates in intra-area
+				   routing table calculation */
   int ret_count;		/* Number of retransmission lists referencing the entry */
   u8 gr_dirty;			/* Local LSA received during GR, will be removed unless reoriginated */
   u8 color;
@@ -181,6 +184,16 @@ struct ospf_new_lsa
   struct ort *nf;
 };
 
+/* Pending origination of external LSA for exported route */
+struct ospf_ext_req
+{
+  struct ort *nf;		/* NULL for cancelled request */
+  ip_addr fwaddr;
+  u32 metric;
+  u32 tag;
+  u8 ebit;
+};
+
 struct top_graph *ospf_top_new(struct ospf_proto *p, pool *pool);
 void ospf_top_free(struct top_graph *f);
 
@@ -191,6 +204,7 @@ void ospf_flush_lsa(struct ospf_proto *p, struct top_hash_entry *en);
 void ospf_update_lsadb(struct ospf_proto *p);
 void ospf_feed_begin(struct channel *C, int initial);
 void ospf_feed_end(struct channel *C);
+void ospf_ext_event(void *ptr);
 
 static inline void ospf_flush2_lsa(struct ospf_proto *p, struct top_hash_entry **en)
 { if (*en) { ospf_flush_lsa(p, *en); *en = NULL; } }
@@ -11,6 +11,21 @@
  *
  * Run this protocol to measure route import and export times.
  * Generates a load of dummy routes and measures time to import.
+ *
+ * In the replay mode, BGP UPDATE messages recorded in an MRT BGP4MP dump are
+ * fed to an established BGP session by bgp_replay_update(), either at maximum
+ * speed or at the recorded timing. Per-phase timing of route processing is
+ * collected in &rt_phase_stats and logged after each pass of the file. When
+ * the protocol has channels, routes exported to them are counted and the pass
+ * ends when no export came for %PERF_SETTLE_TIME, so convergence times (until
+ * the last route was imported and until the last one was exported to all
+ * channels) are logged too.
+ *
+ * In the import mode, memory used by the imported routes is measured after
+ * the update phase of each run by perf_get_memory(), relatively to the state
+ * before the first run. Bytes per route (routing table and attribute cache),
+ * bytes per channel (growth of export maps) and RSS per route are logged and
+ * may be checked against configured limits to catch memory regressions.
  */
 
 #undef LOCAL_DEBUG
@@ -23,11 +38,19 @@
 #include "conf/conf.h"
 #include "filter/filter.h"
 #include "lib/string.h"
+#include "sysdep/unix/unix.h"
 
 #include "perf.h"
 
+#ifdef CONFIG_BGP
+#include "proto/bgp/bgp.h"
+#include "proto/mrt/mrt.h"
+#endif
+
+#include <stdio.h>
 #include <stdlib.h>
 #include <time.h>
+#include <unistd.h>
 
 #define PLOG(msg, ...) log(L_INFO "Perf %s %s " msg, BIRD_VERSION, p->p.name, ##__VA_ARGS__)
 
@@ -94,6 +117,219 @@ struct perf_random_routes {
 static inline s64 timediff(struct timespec *begin, struct timespec *end)
 { return (end->tv_sec - begin->tv_sec) * (s64) 1000000000 + end->tv_nsec - begin->tv_nsec; }
 
+static inline u64 perf_now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * (u64) 1000000000 + ts.tv_nsec;
+}
+
+static const char * const perf_mode_names[] = {
+  [PERF_MODE_IMPORT] = "import",
+  [PERF_MODE_EXPORT] = "export",
+  [PERF_MODE_REPLAY] = "replay",
+};
+
+/*
+ * Results are written as JSON lines, one line per histogram. Buckets are
+ * written as [min, max, count] for non-empty ones.
+ */
+static void
+perf_write_result(struct perf_proto *p, const char *phase, const struct histogram *h)
+{
+  FILE *f = rf_file(p->results);
+  byte buf[256];
+
+  if (!h->count)
+    return;
+
+  bsnprintf(buf, sizeof(buf),
+	    "{\"version\":\"%s\",\"protocol\":\"%s\",\"mode\":\"%s\",\"exp\":%u,\"run\":%u,\"phase\":\"%s\","
+	    "\"count\":%lu,\"sum\":%lu,\"min\":%lu,\"p50\":%lu,\"p90\":%lu,\"p99\":%lu,\"max\":%lu,\"buckets\":[",
+	    BIRD_VERSION, p->p.name, perf_mode_names[p->mode],
+	    (p->mode == PERF_MODE_IMPORT) ? p->exp : 0, p->run, phase,
+	    h->count, h->sum, h->min, histogram_quantile(h, 500), histogram_quantile(h, 900),
+	    histogram_quantile(h, 990), h->max);
+  fputs(buf, f);
+
+  int first = 1;
+  for (uint i = 0; i < HISTOGRAM_BUCKETS; i++)
+    if (h->bucket[i])
+    {
+      bsnprintf(buf, sizeof(buf), "%s[%lu,%lu,%lu]", first ? "" : ",",
+		histogram_bucket_min(i), histogram_bucket_max(i), h->bucket[i]);
+      fputs(buf, f);
+      first = 0;
+    }
+
+  fputs("]}\n", f);
+}
+
+static void
+perf_write_phases(struct perf_proto *p, const char *prefix, const struct rt_phase_stats *s)
+{
+  byte name[64];
+
+  for (uint i = 0; i < RT_PHASE_MAX; i++)
+  {
+    bsnprintf(name, sizeof(name), "%s%s%s", prefix, *prefix ? "." : "", rt_phase_names[i]);
+    perf_write_result(p, name, &s->phase[i]);
+  }
+}
+
+static void
+perf_write_stats(struct perf_proto *p)
+{
+  struct perf_stats *s = p->stats;
+
+  perf_write_result(p, (p->mode == PERF_MODE_EXPORT) ? "feed" : "update", &s->update);
+  perf_write_result(p, "withdraw", &s->withdraw);
+  perf_write_phases(p, "update", &s->update_phases);
+  perf_write_phases(p, "withdraw", &s->withdraw_phases);
+  fflush(rf_file(p->results));
+}
+
+static void
+perf_write_memory(struct perf_proto *p, const struct perf_memory *m, uint routes, uint channels)
+{
+  byte buf[512];
+
+  bsnprintf(buf, sizeof(buf),
+	    "{\"version\":\"%s\",\"protocol\":\"%s\",\"mode\":\"%s\",\"exp\":%u,\"run\":%u,\"phase\":\"memory\","
+	    "\"routes\":%u,\"channels\":%u,\"table\":%lu,\"attrs\":%lu,\"proto\":%lu,\"rss\":%lu}\n",
+	    BIRD_VERSION, p->p.name, perf_mode_names[p->mode], p->exp, p->run,
+	    routes, channels, m->table, m->attrs, m->proto, m->rss);
+  fputs(buf, rf_file(p->results));
+}
+
+extern pool *rt_table_pool;
+extern pool *rta_pool;
+
+static u64
+perf_get_rss(void)
+{
+  FILE *f = fopen("/proc/self/statm", "r");
+  unsigned long size, resident;
+  u64 rss = 0;
+
+  if (!f)
+    return 0;
+
+  if (fscanf(f, "%lu %lu", &size, &resident) == 2)
+    rss = (u64) resident * (u64) sysconf(_SC_PAGESIZE);
+
+  fclose(f);
+  return rss;
+}
+
+static void
+perf_get_memory(struct perf_proto *p, struct perf_memory *m)
+{
+  m->table = rmemsize(rt_table_pool);
+  m->attrs = rmemsize(rta_pool);
+  m->proto = rmemsize(p->p.pool);
+  m->rss = perf_get_rss();
+}
+
+static inline u64
+perf_mem_diff(u64 now, u64 base, uint n)
+{
+  return (now > base) ? (now - base) / n : 0;
+}
+
+/* Log memory used by imported routes, return 0 when some limit is exceeded */
+static int
+perf_check_memory(struct perf_proto *p, const struct perf_memory *now)
+{
+  const struct perf_memory *base = &p->mem_base;
+  uint routes = p->p.main_channel->table->rt_count;
+  uint channels = list_length(&p->p.channels);
+  int ok = 1;
+
+  if (!routes)
+    return 1;
+
+  struct perf_memory m = {
+    .table = perf_mem_diff(now->table, base->table, routes),
+    .attrs = perf_mem_diff(now->attrs, base->attrs, routes),
+    .proto = perf_mem_diff(now->proto, base->proto, channels),
+    .rss = perf_mem_diff(now->rss, base->rss, routes),
+  };
+
+  PLOG("exp=%u memory: routes=%u table=%lu attrs=%lu rss=%lu per route, channel=%lu per channel",
+       p->exp, routes, m.table, m.attrs, m.rss, m.proto);
+
+  if (p->stats)
+    perf_write_memory(p, &m, routes, channels);
+
+  if (p->route_memory_limit && (m.table + m.attrs > p->route_memory_limit))
+  {
+    log(L_ERR "%s: Memory per route %lu exceeds limit %u", p->p.name, m.table + m.attrs, p->route_memory_limit);
+    ok = 0;
+  }
+
+  if (p->channel_memory_limit && (m.proto > p->channel_memory_limit))
+  {
+    log(L_ERR "%s: Memory per channel %lu exceeds limit %u", p->p.name, m.proto, p->channel_memory_limit);
+    ok = 0;
+  }
+
+  return ok;
+}
+
+#ifdef CONFIG_BGP
+
+static ea_list *
+perf_random_attrs(struct perf_proto *p)
+{
+  ea_list *ea = NULL;
+
+  if (p->aspath_len)
+  {
+    /* AS_SEQUENCE segments of up to 255 ASNs */
+    uint len = p->aspath_len;
+    uint size = 2 * ((len + 254) / 255) + 4 * len;
+    struct adata *ad = lp_alloc_adata(p->lp, size);
+    byte *pos = ad->data;
+
+    while (len)
+    {
+      uint n = MIN(len, 255);
+      *pos++ = AS_PATH_SEQUENCE;
+      *pos++ = n;
+
+      for (uint i = 0; i < n; i++, pos += 4)
+	put_u32(pos, random() | 1);
+
+      len -= n;
+    }
+
+    ea_set_attr_ptr(&ea, p->lp, EA_CODE(PROTOCOL_BGP, BA_AS_PATH),
+		    BAF_TRANSITIVE, EAF_TYPE_AS_PATH, ad);
+  }
+
+  if (p->communities)
+  {
+    struct adata *ad = lp_alloc_adata(p->lp, 4 * p->communities);
+    random_data(ad->data, ad->length);
+
+    ea_set_attr_ptr(&ea, p->lp, EA_CODE(PROTOCOL_BGP, BA_COMMUNITY),
+		    BAF_OPTIONAL | BAF_TRANSITIVE, EAF_TYPE_INT_SET, ad);
+  }
+
+  return ea;
+}
+
+#else
+
+static ea_list *
+perf_random_attrs(struct perf_proto *p UNUSED)
+{
+  return NULL;
+}
+
+#endif
+
 static void
 perf_ifa_notify(struct proto *P, uint flags, struct ifa *ad)
 {
@@ -123,69 +359,129 @@ perf_loop(void *data)
 {
   struct proto *P = data;
   struct perf_proto *p = data;
+  struct perf_stats *stats = p->stats;
+  struct channel *c = P->main_channel;
 
   const uint N = 1U << p->exp;
+  const uint R = N * p->paths;
 
   if (!p->run) {
     ASSERT(p->data == NULL);
-    p->data = xmalloc(sizeof(struct perf_random_routes) * N);
+    p->data = xmalloc(sizeof(struct perf_random_routes) * R);
     p->stop = 1;
   }
 
+  /* Memory is measured relatively to the state before the first run */
+  if ((p->exp == p->from) && !p->run)
+    perf_get_memory(p, &p->mem_base);
+
+  /* Sources are released when their routes are pruned, get them again */
+  for (uint j=0; j<p->paths; j++)
+    p->srcs[j] = j ? rt_get_source(P, j) : P->main_source;
+
   ip_addr gw = random_gw(&p->ifa->prefix);
 
-  struct timespec ts_begin, ts_generated, ts_update, ts_withdraw;
+  struct timespec ts_begin, ts_generated, ts_update, ts_measured, ts_withdraw;
+  struct perf_memory mem;
 
   clock_gettime(CLOCK_MONOTONIC, &ts_begin);
 
   for (uint i=0; i<N; i++) {
-    *((net_addr_ip4 *) &(p->data[i].net)) = random_net_ip4();
-
-    if (!p->attrs_per_rte || !(i % p->attrs_per_rte)) {
-      struct rta a0 = {
-	.src = p->p.main_source,
-	.source = RTS_PERF,
-	.scope = SCOPE_UNIVERSE,
-	.dest = RTD_UNICAST,
-	.nh.iface = p->ifa->iface,
-	.nh.gw = gw,
-	.nh.weight = 1,
-      };
-
-      p->data[i].a = rta_lookup(&a0);
+    net_addr_ip4 net = random_net_ip4();
+
+    for (uint j=0; j<p->paths; j++) {
+      uint k = i * p->paths + j;
+      *((net_addr_ip4 *) &(p->data[k].net)) = net;
+
+      if (!p->attrs_per_rte || !(i % p->attrs_per_rte)) {
+	struct rta a0 = {
+	  .src = p->srcs[j],
+	  .source = RTS_PERF,
+	  .scope = SCOPE_UNIVERSE,
+	  .dest = RTD_UNICAST,
+	  .nh.iface = p->ifa->iface,
+	  .nh.gw = gw,
+	  .nh.weight = 1,
+	  .eattrs = perf_random_attrs(p),
+	};
+
+	p->data[k].a = rta_lookup(&a0);
+      }
+      else
+	p->data[k].a = rta_clone(p->data[k - p->paths].a);
     }
-    else
-      p->data[i].a = rta_clone(p->data[i-1].a);
+
+    lp_flush(p->lp);
   }
 
   clock_gettime(CLOCK_MONOTONIC, &ts_generated);
 
-  for (uint i=0; i<N; i++) {
-    rte *e = rte_get_temp(p->data[i].a);
+  rt_phase_stats = stats ? &stats->update_phases : NULL;
+
+  for (uint k=0; k<R; k++) {
+    rte *e = rte_get_temp(p->data[k].a);
     e->pflags = 0;
 
-    rte_update(P, &(p->data[i].net), e);
+    u64 begin = stats ? perf_now() : 0;
+    rte_update2(c, &(p->data[k].net), e, p->data[k].a->src);
+
+    if (stats)
+      histogram_add(&stats->update, perf_now() - begin);
   }
 
   clock_gettime(CLOCK_MONOTONIC, &ts_update);
 
+  perf_get_memory(p, &mem);
+
+  clock_gettime(CLOCK_MONOTONIC, &ts_measured);
+
+  /* Withdraw path by path, so best routes are replaced by the next ones */
+  rt_phase_stats = stats ? &stats->withdraw_phases : NULL;
+
   if (!p->keep)
-    for (uint i=0; i<N; i++)
-      rte_update(P, &(p->data[i].net), NULL);
+    for (uint j=0; j<p->paths; j++)
+      for (uint i=0; i<N; i++) {
+	u64 begin = stats ? perf_now() : 0;
+	rte_update2(c, &(p->data[i * p->paths + j].net), NULL, p->srcs[j]);
+
+	if (stats)
+	  histogram_add(&stats->withdraw, perf_now() - begin);
+      }
+
+  rt_phase_stats = NULL;
 
   clock_gettime(CLOCK_MONOTONIC, &ts_withdraw);
 
   s64 gentime = timediff(&ts_begin, &ts_generated);
   s64 updatetime = timediff(&ts_generated, &ts_update);
-  s64 withdrawtime = timediff(&ts_update, &ts_withdraw);
+  s64 withdrawtime = timediff(&ts_measured, &ts_withdraw);
+  int mem_ok = 1;
 
   if (updatetime NS >= p->threshold_min)
+  {
     PLOG("exp=%u times: gen=%ld update=%ld withdraw=%ld",
 	p->exp, gentime, updatetime, withdrawtime);
 
+    if (stats)
+      perf_write_stats(p);
+
+    mem_ok = perf_check_memory(p, &mem);
+  }
+
+  if (stats)
+    memset(stats, 0, sizeof(struct perf_stats));
+
   if (updatetime NS < p->threshold_max)
     p->stop = 0;
 
+  if (!mem_ok) {
+    xfree(p->data);
+    p->data = NULL;
+
+    PLOG("failed with exp=%u", p->exp);
+    return;
+  }
+
   if ((updatetime NS < p->threshold_min) || (++p->run == p->repeat)) {
     xfree(p->data);
     p->data = NULL;
@@ -208,9 +504,24 @@ perf_rt_notify(struct proto *P, struct channel *c UNUSED, struct network *net UN
 {
   struct perf_proto *p = (struct perf_proto *) P;
   p->exp++;
+
+  /* Time between consecutive exports of the feed */
+  if (p->stats)
+  {
+    u64 now = perf_now();
+    histogram_add(&p->stats->update, now - p->last_notify);
+    p->last_notify = now;
+  }
+
   return;
 }
 
+static void
+perf_rt_notify_import(struct proto *P UNUSED, struct channel *c UNUSED, struct network *net UNUSED, struct rte *new UNUSED, struct rte *old UNUSED)
+{
+  /* Routes exported in import mode are just dropped */
+}
+
 static void
 perf_feed_begin(struct channel *c, int initial UNUSED)
 {
@@ -221,6 +532,7 @@ perf_feed_begin(struct channel *c, int initial UNUSED)
   p->exp = 0;
 
   clock_gettime(CLOCK_MONOTONIC, p->feed_begin);
+  p->last_notify = perf_now();
 }
 
 static void
@@ -234,6 +546,12 @@ perf_feed_end(struct channel *c)
 
   PLOG("feed n=%lu time=%lu", p->exp, feedtime);
 
+  if (p->stats)
+  {
+    perf_write_stats(p);
+    memset(p->stats, 0, sizeof(struct perf_stats));
+  }
+
   xfree(p->feed_begin);
   p->feed_begin = NULL;
 
@@ -243,12 +561,376 @@ perf_feed_end(struct channel *c)
     PLOG("feed done");
 }
 
+/*
+ *	Replay of MRT BGP4MP dumps
+ */
+
+#ifdef CONFIG_BGP
+
+struct perf_replay {
+  pool *pool;
+  struct rfile *file;
+  timer *timer;
+  event *event;
+  byte *buf;				/* Buffer for the current MRT message */
+  uint buf_size;
+  byte *msg;				/* BGP message in buf */
+  uint msg_len;
+  int msg_as4;				/* BGP message recorded on AS4 session */
+  int pending;				/* BGP message read, but not replayed yet */
+  btime msg_time;			/* Recorded time of the BGP message */
+  btime base_time;			/* Recorded time of the first BGP message */
+  btime start_time;			/* Time of replay of the first BGP message */
+  uint messages;			/* MRT messages read */
+  uint updates;				/* BGP messages replayed */
+  uint skipped;				/* BGP messages not replayed */
+  s64 busy;				/* Time spent replaying [ns] */
+  u64 begin;				/* Time of replay of the first BGP message [ns] */
+  u64 imported;				/* Time when the last BGP message was replayed [ns] */
+  u64 exported;				/* Time of the last export to our channels [ns] */
+  uint exports;				/* Routes exported to our channels */
+  uint settle_exports;			/* Exports seen by the last settle check */
+  int settling;				/* Replay finished, waiting for exports */
+  struct rt_phase_stats stats;
+};
+
+static inline int
+perf_replay_ready(struct bgp_proto *bp)
+{
+  return (bp->p.proto_state == PS_UP) && bp->conn && (bp->conn->state == BS_ESTABLISHED);
+}
+
+static int
+perf_replay_read(struct perf_proto *p, struct perf_replay *r)
+{
+  FILE *f = rf_file(r->file);
+
+  while (1)
+  {
+    byte hdr[MRT_HDR_LENGTH];
+    size_t n = fread(hdr, 1, MRT_HDR_LENGTH, f);
+
+    if (!n && !ferror(f))
+      return 0;
+
+    if (n < MRT_HDR_LENGTH)
+      goto truncated;
+
+    btime time = get_u32(hdr) S;
+    uint type = get_u16(hdr + 4);
+    uint subtype = get_u16(hdr + 6);
+    uint len = get_u32(hdr + 8);
+
+    if (len > PERF_REPLAY_MAX_MESSAGE)
+      goto malformed;
+
+    if (len > r->buf_size)
+    {
+      r->buf = mb_realloc(r->buf, len);
+      r->buf_size = len;
+    }
+
+    if (fread(r->buf, 1, len, f) < len)
+      goto truncated;
+
+    byte *pos = r->buf, *end = pos + len;
+    r->messages++;
+
+    if ((type != MRT_BGP4MP) && (type != MRT_BGP4MP_ET))
+      continue;
+
+    /* Extended timestamp: Microseconds */
+    if (type == MRT_BGP4MP_ET)
+    {
+      if (len < 4)
+	goto malformed;
+
+      time += get_u32(pos) US;
+      pos += 4;
+    }
+
+    /* Only messages received from the peer are replayed */
+    int as4;
+    switch (subtype)
+    {
+    case MRT_BGP4MP_MESSAGE:
+    case MRT_BGP4MP_MESSAGE_ADDPATH:
+      as4 = 0;
+      break;
+
+    case MRT_BGP4MP_MESSAGE_AS4:
+    case MRT_BGP4MP_MESSAGE_AS4_ADDPATH:
+      as4 = 1;
+      break;
+
+    default:
+      continue;
+    }
+
+    /* Peer AS, Local AS, Interface Index, Address Family */
+    uint skip = (as4 ? 8 : 4) + 2;
+    if (end - pos < skip + 2)
+      goto malformed;
+
+    uint afi = get_u16(pos + skip);
+    pos += skip + 2;
+
+    /* Peer IP Address, Local IP Address */
+    uint alen = (afi == BGP_AFI_IPV4) ? 4 : (afi == BGP_AFI_IPV6) ? 16 : 0;
+    if (!alen || (end - pos < 2 * alen + BGP_HEADER_LENGTH))
+      goto malformed;
+
+    pos += 2 * alen;
+
+    if (pos[18] != PKT_UPDATE)
+      continue;
+
+    r->msg = pos;
+    r->msg_len = end - pos;
+    r->msg_as4 = as4;
+    r->msg_time = time;
+
+    if (!r->start_time)
+    {
+      r->base_time = time;
+      r->start_time = current_time();
+    }
+
+    return 1;
+  }
+
+truncated:
+  log(L_ERR "%s: Truncated MRT file '%s'", p->p.name, p->replay_file);
+  return 0;
+
+malformed:
+  log(L_ERR "%s: Malformed message %u in MRT file '%s'", p->p.name, r->messages + 1, p->replay_file);
+  return 0;
+}
+
+static void
+perf_rt_notify_replay(struct proto *P, struct channel *c UNUSED, struct network *net UNUSED, struct rte *new UNUSED, struct rte *old UNUSED)
+{
+  struct perf_proto *p = (struct perf_proto *) P;
+  struct perf_replay *r = p->replay;
+
+  if (r && r->begin)
+  {
+    r->exports++;
+    r->exported = perf_now();
+  }
+}
+
+static void
+perf_replay_done(struct perf_proto *p)
+{
+  struct perf_replay *r = p->replay;
+  byte buf[256], *pos = buf;
+
+  for (uint i = 0; i < RT_PHASE_MAX; i++)
+    pos += bsprintf(pos, " %s=%lu", rt_phase_names[i], r->stats.phase[i].sum);
+
+  PLOG("replay run=%u messages=%u updates=%u skipped=%u time=%ld%s",
+       p->run, r->messages, r->updates, r->skipped, r->busy, buf);
+
+  /* Convergence times since the first replayed message */
+  u64 import_time = r->begin ? r->imported - r->begin : 0;
+  u64 export_time = r->exports ? r->exported - r->begin : 0;
+
+  if (p->p.main_channel)
+    PLOG("convergence run=%u import=%lu export=%lu exports=%u",
+	 p->run, import_time, export_time, r->exports);
+
+  if (p->results)
+  {
+    perf_write_phases(p, "", &r->stats);
+
+    if (p->p.main_channel)
+    {
+      bsnprintf(buf, sizeof(buf),
+		"{\"version\":\"%s\",\"protocol\":\"%s\",\"mode\":\"%s\",\"run\":%u,\"phase\":\"convergence\","
+		"\"import\":%lu,\"export\":%lu,\"exports\":%u}\n",
+		BIRD_VERSION, p->p.name, perf_mode_names[p->mode], p->run,
+		import_time, export_time, r->exports);
+      fputs(buf, rf_file(p->results));
+    }
+
+    fflush(rf_file(p->results));
+  }
+
+  if (++p->run < p->repeat)
+  {
+    rewind(rf_file(r->file));
+    r->pending = r->start_time = 0;
+    r->messages = r->updates = r->skipped = 0;
+    r->busy = 0;
+    r->begin = r->imported = r->exported = 0;
+    r->exports = 0;
+    memset(&r->stats, 0, sizeof(struct rt_phase_stats));
+
+    ev_schedule(r->event);
+    return;
+  }
+
+  PLOG("replay done");
+  rfree(r->pool);
+  p->replay = NULL;
+}
+
+static void
+perf_replay_loop(void *data)
+{
+  struct perf_proto *p = data;
+  struct perf_replay *r = p->replay;
+  struct bgp_proto *bp = (void *) p->replay_proto->proto;
+  struct timespec ts_begin, ts_end;
+  btime wait = 0;
+  int done = 0;
+
+  if (!bp || !perf_replay_ready(bp))
+  {
+    tm_start(r->timer, 1 S);
+    return;
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &ts_begin);
+  rt_phase_stats = &r->stats;
+
+  if (!r->begin)
+    r->begin = perf_now();
+
+  for (uint i = 0; i < PERF_REPLAY_STEP; i++)
+  {
+    if (!r->pending && !perf_replay_read(p, r))
+    {
+      done = 1;
+      break;
+    }
+
+    if (p->replay_timing)
+    {
+      btime due = r->start_time + (r->msg_time - r->base_time);
+      btime now = current_time();
+
+      if (due > now)
+      {
+	r->pending = 1;
+	wait = due - now;
+	break;
+      }
+    }
+
+    /* Session went down, wait for it with the message kept */
+    if (!perf_replay_ready(bp))
+    {
+      r->pending = 1;
+      wait = 1 S;
+      break;
+    }
+
+    r->pending = 0;
+
+    /* The message must be decoded with the same capabilities as recorded */
+    if ((r->msg_as4 == bp->as4_session) && bgp_replay_update(bp, r->msg, r->msg_len))
+      r->updates++;
+    else
+      r->skipped++;
+  }
+
+  rt_phase_stats = NULL;
+  clock_gettime(CLOCK_MONOTONIC, &ts_end);
+  r->busy += timediff(&ts_begin, &ts_end);
+
+  if (done)
+  {
+    r->imported = perf_now();
+
+    /* Wait until exports to our channels settle */
+    if (p->p.main_channel)
+    {
+      r->settling = 1;
+      r->settle_exports = r->exports;
+      tm_start(r->timer, PERF_SETTLE_TIME);
+    }
+    else
+      perf_replay_done(p);
+  }
+  else if (wait)
+    tm_start(r->timer, wait);
+  else
+    ev_schedule(r->event);
+}
+
+static void
+perf_replay_timer(timer *t)
+{
+  struct perf_proto *p = t->data;
+  struct perf_replay *r = p->replay;
+
+  if (!r->settling)
+  {
+    ev_schedule(r->event);
+    return;
+  }
+
+  if (r->exports != r->settle_exports)
+  {
+    r->settle_exports = r->exports;
+    tm_start(r->timer, PERF_SETTLE_TIME);
+    return;
+  }
+
+  r->settling = 0;
+  perf_replay_done(p);
+}
+
+static void
+perf_replay_start(struct perf_proto *p)
+{
+  pool *pool = rp_new(p->p.pool, "Perf replay");
+  struct perf_replay *r = mb_allocz(pool, sizeof(struct perf_replay));
+
+  r->pool = pool;
+  r->file = rf_open(pool, p->replay_file, "r");
+  if (!r->file)
+  {
+    log(L_ERR "%s: Unable to open MRT file '%s': %m", p->p.name, p->replay_file);
+    rfree(pool);
+    return;
+  }
+
+  r->buf_size = 4096;
+  r->buf = mb_alloc(pool, r->buf_size);
+  r->event = ev_new_init(pool, perf_replay_loop, p);
+  r->timer = tm_new_init(pool, perf_replay_timer, p, 0, 0);
+  p->replay = r;
+
+  PLOG("replaying '%s' to %s", p->replay_file, p->replay_proto->name);
+  ev_schedule(r->event);
+}
+
+#else
+
+static void
+perf_replay_start(struct perf_proto *p)
+{
+  log(L_ERR "%s: Replay of MRT files requires BGP support", p->p.name);
+}
+
+#endif
+
+
 static struct proto *
 perf_init(struct proto_config *CF)
 {
   struct proto *P = proto_new(CF);
 
-  P->main_channel = proto_add_channel(P, proto_cf_main_channel(CF));
+  if (proto_cf_main_channel(CF))
+    P->main_channel = proto_add_channel(P, proto_cf_main_channel(CF));
+
+  /* Additional channels with the same table and filters */
+  for (uint i = 0; i < ((struct perf_config *) CF)->export_channels; i++)
+    proto_add_channel(P, proto_cf_main_channel(CF));
 
   struct perf_proto *p = (struct perf_proto *) P;
 
@@ -264,16 +946,28 @@ perf_init(struct proto_config *CF)
   p->keep = cf->keep;
   p->mode = cf->mode;
   p->attrs_per_rte = cf->attrs_per_rte;
+  p->paths = cf->paths;
+  p->aspath_len = cf->aspath_len;
+  p->communities = cf->communities;
+  p->route_memory_limit = cf->route_memory_limit;
+  p->channel_memory_limit = cf->channel_memory_limit;
+  p->replay_file = cf->replay_file;
+  p->replay_proto = cf->replay_proto;
+  p->replay_timing = cf->replay_timing;
 
   switch (p->mode) {
     case PERF_MODE_IMPORT:
       P->ifa_notify = perf_ifa_notify;
+      P->rt_notify = perf_rt_notify_import;
       break;
     case PERF_MODE_EXPORT:
       P->rt_notify = perf_rt_notify;
       P->feed_begin = perf_feed_begin;
       P->feed_end = perf_feed_end;
       break;
+    case PERF_MODE_REPLAY:
+      P->rt_notify = perf_rt_notify_replay;
+      break;
   }
 
   return P;
@@ -283,15 +977,68 @@ static int
 perf_start(struct proto *P)
 {
   struct perf_proto *p = (struct perf_proto *) P;
+  struct perf_config *cf = (void *) P->cf;
 
   p->ifa = NULL;
   p->run = 0;
   p->exp = p->from;
   ASSERT(p->data == NULL);
 
+  p->lp = lp_new_default(P->pool);
+  p->srcs = mb_allocz(P->pool, p->paths * sizeof(struct rte_src *));
+  p->results = NULL;
+  p->stats = NULL;
+
+  if (cf->results)
+  {
+    p->results = rf_open(P->pool, cf->results, "a");
+    if (p->results)
+      p->stats = mb_allocz(P->pool, sizeof(struct perf_stats));
+    else
+      log(L_ERR "%s: Unable to open results file '%s': %m", P->name, cf->results);
+  }
+
+  if (p->mode == PERF_MODE_REPLAY)
+    perf_replay_start(p);
+
   return PS_UP;
 }
 
+static void
+perf_postconfig(struct proto_config *CF)
+{
+  struct perf_config *cf = (void *) CF;
+
+  if (!cf->p.net_type && (cf->mode != PERF_MODE_REPLAY))
+    cf_error("Channel not specified");
+
+#ifndef CONFIG_BGP
+  if (cf->aspath_len || cf->communities)
+    cf_error("BGP attributes require BGP support");
+#endif
+
+  if (cf->export_channels && (cf->mode == PERF_MODE_EXPORT))
+    cf_error("Export channels not allowed in export mode");
+
+  if (cf->export_channels && !cf->p.net_type)
+    cf_error("Export channels require a channel");
+
+  if ((cf->route_memory_limit || cf->channel_memory_limit) && (cf->mode != PERF_MODE_IMPORT))
+    cf_error("Memory limits are available only in import mode");
+
+  if (cf->mode != PERF_MODE_REPLAY)
+    return;
+
+  if (!cf->replay_file)
+    cf_error("File for replay not specified");
+
+  if (!cf->replay_proto)
+    cf_error("Protocol for replay not specified");
+
+  if (cf->replay_proto->protocol->class != PROTOCOL_BGP)
+    cf_error("Replay protocol %s is not BGP", cf->replay_proto->name);
+}
+
 static int
 perf_reconfigure(struct proto *P UNUSED, struct proto_config *CF UNUSED)
 {
@@ -310,6 +1057,7 @@ struct protocol proto_perf = {
   .channel_mask = 	NB_IP,
   .proto_size =		sizeof(struct perf_proto),
   .config_size = 	sizeof(struct perf_config),
+  .postconfig =		perf_postconfig,
   .init =		perf_init,
   .start =		perf_start,
   .reconfigure = 	perf_reconfigure,
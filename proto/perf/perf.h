@@ -12,8 +12,29 @@
 enum perf_mode {
   PERF_MODE_IMPORT,
   PERF_MODE_EXPORT,
+  PERF_MODE_REPLAY,
 };
 
+/* Per-route and per-phase times of one run, collected with results enabled */
+struct perf_stats {
+  struct histogram update;
+  struct histogram withdraw;
+  struct rt_phase_stats update_phases;
+  struct rt_phase_stats withdraw_phases;
+};
+
+/* Memory usage in bytes, see perf_get_memory() */
+struct perf_memory {
+  u64 table;				/* Routing tables (networks and routes) */
+  u64 attrs;				/* Cached route attributes */
+  u64 proto;				/* Protocol pool, including channel export maps */
+  u64 rss;				/* Resident set size of the process */
+};
+
+#define PERF_REPLAY_STEP	64		/* BGP messages replayed in one step */
+#define PERF_REPLAY_MAX_MESSAGE	(1 << 20)	/* Longer MRT messages are considered malformed */
+#define PERF_SETTLE_TIME	(1 S_)		/* Exports are settled after this time without one */
+
 struct perf_config {
   struct proto_config p;
   btime threshold_min;
@@ -24,6 +45,16 @@ struct perf_config {
   uint keep;
   uint attrs_per_rte;
   enum perf_mode mode;
+  uint paths;
+  uint aspath_len;
+  uint communities;
+  uint export_channels;
+  uint route_memory_limit;
+  uint channel_memory_limit;
+  const char *results;
+  const char *replay_file;
+  struct proto_config *replay_proto;
+  int replay_timing;
 };
 
 struct perf_proto {
@@ -42,7 +73,22 @@ struct perf_proto {
   uint stop;
   uint keep;
   uint attrs_per_rte;
+  uint paths;
+  uint aspath_len;
+  uint communities;
+  uint route_memory_limit;
+  uint channel_memory_limit;
+  struct perf_memory mem_base;
+  struct linpool *lp;
+  struct rte_src **srcs;
+  struct rfile *results;
+  struct perf_stats *stats;
+  u64 last_notify;
   enum perf_mode mode;
+  struct perf_replay *replay;
+  const char *replay_file;
+  struct proto_config *replay_proto;
+  int replay_timing;
 };
 
 #endif
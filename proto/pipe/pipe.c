@@ -28,6 +28,11 @@
  * set to accept, while user configured 'import' and 'export' filters
  * are used as export filters in ahooks 2 and 1. Route limits are
  * handled similarly, but on the import side of ahooks.
+ *
+ * As the import filters are not run, the route passed to the other table
+ * shares the cached &rta of the original route, so no attribute lookup is
+ * done on the way. Only routes with a recursive next hop, which is tied to
+ * the hostentry of the source table, get a private copy of their attributes.
  */
 
 #undef LOCAL_DEBUG
@@ -65,16 +70,28 @@ pipe_rt_notify(struct proto *P, struct channel *src_ch, net *n, rte *new, rte *o
 
   if (new)
     {
-      a = alloca(rta_size(new->attrs));
-      memcpy(a, new->attrs, rta_size(new->attrs));
+      if (!new->attrs->hostentry)
+	{
+	  /* Share the cached attributes, they would be looked up again anyway */
+	  a = rta_clone(new->attrs);
+	}
+      else
+	{
+	  /* Recursive next hop is resolved in the source table only */
+	  a = alloca(rta_size(new->attrs));
+	  memcpy(a, new->attrs, rta_size(new->attrs));
+
+	  a->aflags = 0;
+	  a->hostentry = NULL;
+	}
 
-      a->aflags = 0;
-      a->hostentry = NULL;
       e = rte_get_temp(a);
       e->pflags = 0;
 
-      /* Copy protocol specific embedded attributes. */
-      memcpy(&(e->u), &(new->u), sizeof(e->u));
+      /* Copy protocol specific embedded attributes, both have the same source */
+      uint size = new->attrs->src->proto->proto->rte_size;
+      if (size)
+	memcpy(&(e->u), &(new->u), size - OFFSETOF(rte, u));
       e->pref = new->pref;
       e->pflags = new->pflags;
 
@@ -409,7 +409,9 @@ radv_receive_rs(struct radv_proto *p, struct radv_iface *ifa, ip_addr from)
   RADV_TRACE(D_PACKETS, "Received RS from %I via %s",
 	     from, ifa->iface->name);
 
-  if (ifa->cf->solicited_ra_unicast && ipa_nonzero(from))
+  /* Unicast RAs are sent from the cached packet, but during mass reconnects
+     they are rate-limited and aggregated to one delayed multicast RA */
+  if (ifa->cf->solicited_ra_unicast && ipa_nonzero(from) && !tbf_limit(&ifa->unicast_tbf))
     radv_send_ra(ifa, from);
   else
     radv_iface_notify(ifa, RA_EV_RS);
@@ -209,7 +209,7 @@ radv_prune_prefixes(struct radv_iface *ifa)
   ifa->prune_time = next;
 }
 
-static char* ev_name[] = { NULL, "Init", "Change", "RS" };
+static char* ev_name[] = { NULL, "Init", "Change", "RS", "Routes" };
 
 void
 radv_iface_notify(struct radv_iface *ifa, int event)
@@ -232,6 +232,11 @@ radv_iface_notify(struct radv_iface *ifa, int event)
     radv_prune_prefixes(ifa);
     break;
 
+  case RA_EV_ROUTES:
+    radv_invalidate(ifa);
+    ifa->initial = MAX_INITIAL_RTR_ADVERTISEMENTS;
+    break;
+
   case RA_EV_RS:
     break;
   }
@@ -250,6 +255,26 @@ radv_iface_notify_all(struct radv_proto *p, int event)
     radv_iface_notify(ifa, event);
 }
 
+/*
+ * Changes of routes or trigger affect RAs on all ifaces, but not their
+ * prefixes. They are collected by an event, so a batch of route updates
+ * invalidates cached RAs on each iface just once.
+ */
+static void
+radv_routes_changed(void *data)
+{
+  struct radv_proto *p = data;
+
+  radv_iface_notify_all(p, RA_EV_ROUTES);
+}
+
+static inline void
+radv_schedule_routes(struct radv_proto *p)
+{
+  if (!ev_active(p->routes_event))
+    ev_schedule(p->routes_event);
+}
+
 static struct radv_iface *
 radv_iface_find(struct radv_proto *p, struct iface *what)
 {
@@ -293,6 +318,7 @@ radv_iface_new(struct radv_proto *p, struct iface *iface, struct radv_iface_conf
   ifa->addr = iface->llv6;
   init_list(&ifa->prefixes);
   ifa->prune_time = TIME_INFINITY;
+  ifa->unicast_tbf = (struct tbf) { .rate = RADV_UNICAST_RA_RATE, .burst = RADV_UNICAST_RA_BURST };
 
   add_tail(&p->iface_list, NODE ifa);
 
@@ -426,7 +452,7 @@ radv_rt_notify(struct proto *P, struct channel *ch UNUSED, net *n, rte *new, rte
     else
       RADV_TRACE(D_EVENTS, "Suppressed");
 
-    radv_iface_notify_all(p, RA_EV_CHANGE);
+    radv_schedule_routes(p);
     return;
   }
 
@@ -501,7 +527,7 @@ radv_rt_notify(struct proto *P, struct channel *ch UNUSED, net *n, rte *new, rte
     p->prune_time = MIN(p->prune_time, expires);
   }
 
-  radv_iface_notify_all(p, RA_EV_CHANGE);
+  radv_schedule_routes(p);
 }
 
 /*
@@ -612,6 +638,7 @@ radv_start(struct proto *P)
   p->fib_up = 0;
   radv_set_fib(p, cf->propagate_routes);
   p->prune_time = TIME_INFINITY;
+  p->routes_event = ev_new_init(P->pool, radv_routes_changed, p);
 
   return PS_UP;
 }
@@ -632,6 +659,7 @@ radv_shutdown(struct proto *P)
   struct radv_proto *p = (struct radv_proto *) P;
 
   p->valid = 0;
+  ev_postpone(p->routes_event);
 
   struct radv_iface *ifa;
   WALK_LIST(ifa, p->iface_list)
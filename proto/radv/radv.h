@@ -36,6 +36,10 @@
 
 #define DEFAULT_MAX_RA_INT 600
 #define DEFAULT_MIN_DELAY 3
+
+/* Unicast solicited RAs per second and burst, more RSs get a multicast RA */
+#define RADV_UNICAST_RA_RATE 10
+#define RADV_UNICAST_RA_BURST 20
 #define DEFAULT_CURRENT_HOP_LIMIT 64
 
 #define DEFAULT_VALID_LIFETIME 86400
@@ -150,6 +154,7 @@ struct radv_proto
   u8 fib_up;			/* FIB table (routes) is initialized */
   struct fib routes;		/* FIB table of specific routes (struct radv_route) */
   btime prune_time;		/* Next time of route table pruning */
+  event *routes_event;		/* Notify ifaces about changed routes or trigger */
 };
 
 struct radv_prefix		/* One prefix we advertise */
@@ -183,11 +188,13 @@ struct radv_iface
   btime last;			/* Time of last sending of RA */
   u16 plen;			/* Length of prepared RA in tbuf, or 0 if not valid */
   byte initial;			/* How many RAs are still to be sent as initial */
+  struct tbf unicast_tbf;	/* Rate limit of unicast solicited RAs */
 };
 
 #define RA_EV_INIT 1		/* Switch to initial mode */
 #define RA_EV_CHANGE 2		/* Change of options or prefixes */
 #define RA_EV_RS 3		/* Received RS */
+#define RA_EV_ROUTES 4		/* Change of routes or trigger, prefixes are not affected */
 
 /* Default Router Preferences (RFC 4191) */
 #define RA_PREF_LOW	0x18
@@ -660,8 +660,10 @@ rip_send_table(struct rip_proto *p, struct rip_iface *ifa, ip_addr addr, btime c
 
   rip_update_csn(p, ifa);
 
+  sk_tx_batch_begin(ifa->sk);
   while (rip_send_response(p, ifa) > 0)
     ;
+  sk_tx_batch_end(ifa->sk);
 }
 
 static void
@@ -673,8 +675,10 @@ rip_tx_hook(sock *sk)
   DBG("RIP: TX hook called (iface %s, src %I, dst %I)\n",
       sk->iface->name, sk->saddr, sk->daddr);
 
+  sk_tx_batch_begin(sk);
   while (rip_send_response(p, ifa) > 0)
     ;
+  sk_tx_batch_end(sk);
 }
 
 static void
@@ -1001,6 +1005,7 @@ rip_open_socket(struct rip_iface *ifa)
   sk->vrf = p->p.vrf;
 
   sk->rx_hook = rip_rx_hook;
+  sk->fast_rx = p->p.cf->io_priority;
   sk->tx_hook = rip_tx_hook;
   sk->err_hook = rip_err_hook;
   sk->data = ifa;
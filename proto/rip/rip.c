@@ -89,6 +89,49 @@ static void rip_iface_timer(timer *timer);
 static void rip_trigger_update(struct rip_proto *p);
 
 
+/*
+ *	RIP entry timeouts
+ */
+
+static inline u64
+rip_wheel_tick(btime time)
+{
+  return (time + RIP_WHEEL_TICK - 1) / RIP_WHEEL_TICK;
+}
+
+static void
+rip_unschedule_entry(struct rip_proto *p UNUSED, struct rip_entry *en)
+{
+  if (NODE_VALID(&en->wn))
+    rem_node(&en->wn);
+}
+
+/* Ensure that the entry is checked at @due time or earlier */
+static void
+rip_schedule_entry(struct rip_proto *p, struct rip_entry *en, btime due)
+{
+  if (due == TIME_INFINITY)
+    return;
+
+  if (NODE_VALID(&en->wn))
+  {
+    if (due >= en->due)
+      return;
+
+    rem_node(&en->wn);
+  }
+
+  /* Slot of the last processed tick is not visited until the next round */
+  u64 tick = MAX(rip_wheel_tick(due), p->wheel_tick + 1);
+
+  en->due = due;
+  add_tail(&p->wheel[tick % RIP_WHEEL_SLOTS], &en->wn);
+
+  if (tm_active(p->timer) && (p->timer->expires > (btime) (tick * RIP_WHEEL_TICK)))
+    tm_start(p->timer, MAX((btime) (tick * RIP_WHEEL_TICK) - current_time(), 100 MS));
+}
+
+
 /*
  *	RIP routes
  */
@@ -224,6 +267,8 @@ rip_update_rte(struct rip_proto *p, net_addr *n, struct rip_rte *new)
   struct rip_rte *rt, **rp;
   int changed = 0;
 
+  rip_schedule_entry(p, en, new->expires);
+
   /* If the new route is better, remove all current routes */
   if (en->routes && new->metric < en->routes->metric)
     while (en->routes)
@@ -367,6 +412,13 @@ rip_rt_notify(struct proto *P, struct channel *ch UNUSED, struct network *net, s
     en->changed = current_time();
     rip_trigger_update(p);
   }
+
+  /* Schedule garbage collection */
+  if (en->valid == RIP_ENTRY_STALE)
+  {
+    struct rip_config *cf = (void *) (p->p.cf);
+    rip_schedule_entry(p, en, en->changed + cf->max_garbage_time);
+  }
 }
 
 void
@@ -378,7 +430,10 @@ rip_flush_table(struct rip_proto *p, struct rip_neighbor *n)
   {
     for (struct rip_rte *e = en->routes; e; e = e->next)
       if ((e->from == n) && (e->expires == TIME_INFINITY))
+      {
 	e->expires = expires;
+	rip_schedule_entry(p, en, expires);
+      }
   }
   FIB_WALK_END;
 }
@@ -433,6 +488,7 @@ rip_remove_neighbor(struct rip_proto *p, struct rip_neighbor *n)
     mb_free(n);
 
   /* Related routes are removed in rip_timer() */
+  p->rt_scan = 1;
   rip_kick_timer(p);
 }
 
@@ -838,6 +894,60 @@ rip_if_notify(struct proto *P, unsigned flags, struct iface *iface)
  *	RIP timer events
  */
 
+/* Check timeouts of the entry, propagate changes and reschedule it */
+static void
+rip_check_entry(struct rip_proto *p, struct rip_entry *en, btime now_, int reload)
+{
+  struct rip_config *cf = (void *) (p->p.cf);
+  struct rip_rte *rt, **rp;
+  btime next = TIME_INFINITY;
+  int changed = 0;
+
+  /* Checking received routes for timeout and for dead neighbors */
+  for (rp = &en->routes; rt = *rp; /* rp = &rt->next */)
+  {
+    if (!rip_valid_rte(rt) || (rt->expires <= now_))
+    {
+      rip_remove_rte(p, rp);
+      changed = 1;
+      continue;
+    }
+
+    next = MIN(next, rt->expires);
+    rp = &rt->next;
+  }
+
+  /* Propagating eventual change */
+  if (changed || reload)
+    rip_announce_rte(p, en);
+
+  /* Checking stale entries for garbage collection timeout */
+  if (en->valid == RIP_ENTRY_STALE)
+  {
+    btime expires = en->changed + cf->max_garbage_time;
+
+    if (expires <= now_)
+    {
+      // TRACE(D_EVENTS, "entry is too old: %N", en->n.addr);
+      en->valid = 0;
+    }
+    else
+      next = MIN(next, expires);
+  }
+
+  /* Remove empty nodes */
+  if (!en->valid && !en->routes)
+  {
+    rip_unschedule_entry(p, en);
+    fib_delete(&p->rtable, en);
+    return;
+  }
+
+  /* Announcement may have scheduled the entry again */
+  rip_unschedule_entry(p, en);
+  rip_schedule_entry(p, en, next);
+}
+
 /**
  * rip_timer - RIP main timer hook
  * @t: timer
@@ -855,6 +965,13 @@ rip_if_notify(struct proto *P, unsigned flags, struct iface *iface)
  * while some valid entries (representing an outgoing route) may have that list
  * empty.
  *
+ * Each entry with a pending timeout (route expiration or garbage collection) is
+ * kept in a timer wheel of %RIP_WHEEL_SLOTS slots, indexed by the time of its
+ * next check, so the timer processes just the entries in due slots. The time
+ * of the next check is only a lower bound, refreshed routes are handled when
+ * the entry is checked. The full table scan is done only for route reload and
+ * when a neighbor was removed, as routes of dead neighbors are not indexed.
+ *
  * The main timer is not scheduled periodically but it uses the time of the
  * current next event and the minimal interval of any possible event to compute
  * the time of the next run.
@@ -870,33 +987,19 @@ rip_timer(timer *t)
   btime now_ = current_time();
   btime next = now_ + MIN(cf->min_timeout_time, cf->max_garbage_time);
   btime expires = 0;
+  u64 tick = now_ / RIP_WHEEL_TICK;
+  u64 last_tick = p->wheel_tick;
 
   TRACE(D_EVENTS, "Main timer fired");
 
-  FIB_ITERATE_INIT(&fit, &p->rtable);
-
-  loop:
-  FIB_ITERATE_START(&p->rtable, &fit, struct rip_entry, en)
+  if (p->rt_reload || p->rt_scan)
   {
-    struct rip_rte *rt, **rp;
-    int changed = 0;
+    int reload = p->rt_reload;
 
-    /* Checking received routes for timeout and for dead neighbors */
-    for (rp = &en->routes; rt = *rp; /* rp = &rt->next */)
-    {
-      if (!rip_valid_rte(rt) || (rt->expires <= now_))
-      {
-	rip_remove_rte(p, rp);
-	changed = 1;
-	continue;
-      }
-
-      next = MIN(next, rt->expires);
-      rp = &rt->next;
-    }
+    FIB_ITERATE_INIT(&fit, &p->rtable);
 
-    /* Propagating eventual change */
-    if (changed || p->rt_reload)
+    loop:
+    FIB_ITERATE_START(&p->rtable, &fit, struct rip_entry, en)
     {
       /*
        * We have to restart the iteration because there may be a cascade of
@@ -905,35 +1008,52 @@ rip_timer(timer *t)
        */
 
       FIB_ITERATE_PUT_NEXT(&fit, &p->rtable);
-      rip_announce_rte(p, en);
+      rip_check_entry(p, en, now_, reload);
       goto loop;
     }
+    FIB_ITERATE_END;
+
+    p->rt_reload = 0;
+    p->rt_scan = 0;
+  }
+
+  /* Processing due slots of the timer wheel, entries scheduled meanwhile go after them */
+  p->wheel_tick = tick;
+
+  for (u64 i = MIN(tick - last_tick, RIP_WHEEL_SLOTS); i > 0; i--)
+  {
+    list *slot = &p->wheel[(tick - i + 1) % RIP_WHEEL_SLOTS];
+    list due;
+    node *nd;
+
+    /* Entries may be rescheduled during processing, so detach the slot first */
+    init_list(&due);
+    add_tail_list(&due, slot);
+    init_list(slot);
 
-    /* Checking stale entries for garbage collection timeout */
-    if (en->valid == RIP_ENTRY_STALE)
+    WALK_LIST_FIRST(nd, due)
     {
-      expires = en->changed + cf->max_garbage_time;
+      struct rip_entry *en = SKIP_BACK(struct rip_entry, wn, nd);
+      rem_node(nd);
 
-      if (expires <= now_)
+      /* Entry from a later round of the wheel */
+      if (en->due > now_)
       {
-	// TRACE(D_EVENTS, "entry is too old: %N", en->n.addr);
-	en->valid = 0;
+	rip_schedule_entry(p, en, en->due);
+	continue;
       }
-      else
-	next = MIN(next, expires);
-    }
 
-    /* Remove empty nodes */
-    if (!en->valid && !en->routes)
-    {
-      FIB_ITERATE_PUT(&fit);
-      fib_delete(&p->rtable, en);
-      goto loop;
+      rip_check_entry(p, en, now_, 0);
     }
   }
-  FIB_ITERATE_END;
 
-  p->rt_reload = 0;
+  /* Next nonempty slot of the timer wheel */
+  for (uint i = 1; i <= RIP_WHEEL_SLOTS; i++)
+    if (!EMPTY_LIST(p->wheel[(tick + i) % RIP_WHEEL_SLOTS]))
+    {
+      next = MIN(next, (btime) ((tick + i) * RIP_WHEEL_TICK));
+      break;
+    }
 
   /* Handling neighbor expiration */
   WALK_LIST(ifa, p->iface_list)
@@ -1140,6 +1260,10 @@ rip_start(struct proto *P)
   p->rte_slab = sl_new(P->pool, sizeof(struct rip_rte));
   p->timer = tm_new_init(P->pool, rip_timer, p, 0, 0);
 
+  for (uint i = 0; i < RIP_WHEEL_SLOTS; i++)
+    init_list(&p->wheel[i]);
+  p->wheel_tick = current_time() / RIP_WHEEL_TICK;
+
   p->rip2 = cf->rip2;
   p->ecmp = cf->ecmp;
   p->infinity = cf->infinity;
@@ -1329,6 +1453,7 @@ struct protocol proto_rip = {
   .channel_mask =	NB_IP,
   .proto_size =		sizeof(struct rip_proto),
   .config_size =	sizeof(struct rip_config),
+  .rte_size =		RTE_SIZE(rip),
   .postconfig =		rip_postconfig,
   .init =		rip_init,
   .dump =		rip_dump,
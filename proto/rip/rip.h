@@ -43,6 +43,9 @@
 #define RIP_DEFAULT_GARBAGE_TIME (120 S_)
 #define RIP_DEFAULT_RXMT_TIME (1 S_)
 
+#define RIP_WHEEL_SLOTS		256	/* Number of slots of the entry timer wheel */
+#define RIP_WHEEL_TICK		(1 S_)	/* Time covered by one slot */
+
 
 struct rip_config
 {
@@ -100,6 +103,10 @@ struct rip_proto
   u8 infinity;				/* Maximum metric value, representing infinity */
   u8 triggered;				/* Logical AND of interface want_triggered values */
   u8 rt_reload;				/* Route reload is scheduled */
+  u8 rt_scan;				/* Full table scan is scheduled */
+
+  list wheel[RIP_WHEEL_SLOTS];		/* Entries by time of next timeout (struct rip_entry) */
+  u64 wheel_tick;			/* Last processed wheel tick */
 
   struct tbf log_pkt_tbf;		/* TBF for packet messages */
   struct tbf log_rte_tbf;		/* TBF for RTE messages */
@@ -168,6 +175,9 @@ struct rip_entry
 
   btime changed;			/* Last time when the outgoing route metric changed */
 
+  node wn;				/* Node in timer wheel, if scheduled */
+  btime due;				/* Time of next timeout (route expiry or GC) */
+
   struct fib_node n;
 };
 
@@ -752,10 +752,7 @@ rpki_handle_prefix_pdu(struct rpki_cache *cache, const struct pdu_header *pdu)
 
   /* A place for 'flags' is same for both data structures pdu_ipv4 or pdu_ipv6  */
   struct pdu_ipv4 *pfx = (void *) pdu;
-  if (pfx->flags & RPKI_ADD_FLAG)
-    rpki_table_add_roa(cache, channel, &addr);
-  else
-    rpki_table_remove_roa(cache, channel, &addr);
+  rpki_table_update_roa(cache, channel, &addr, pfx->flags & RPKI_ADD_FLAG);
 
   return RPKI_SUCCESS;
 }
@@ -829,8 +826,13 @@ rpki_rx_packet(struct rpki_cache *cache, struct pdu_header *pdu)
 {
   struct rpki_proto *p = cache->p;
 
+  /* Collected ROAs are imported before any other PDU is processed */
+  if ((pdu->type != IPV4_PREFIX) && (pdu->type != IPV6_PREFIX))
+    rpki_table_flush(cache);
+
   if (rpki_check_receive_packet(cache, pdu) == RPKI_ERROR)
   {
+    rpki_table_flush(cache);
     rpki_cache_change_state(cache, RPKI_CS_ERROR_FATAL);
     return;
   }
@@ -900,6 +902,7 @@ rpki_rx_hook(struct birdsock *sk, uint size)
     if (pdu_size < RPKI_PDU_HEADER_LEN || pdu_size > RPKI_PDU_MAX_LEN)
     {
       RPKI_WARN(p, "Received invalid packet length %u, purge the whole receiving buffer", pdu_size);
+      rpki_table_flush(cache);
       return 1; /* Purge recv buffer */
     }
 
@@ -915,6 +918,8 @@ rpki_rx_hook(struct birdsock *sk, uint size)
     pkt_start += pdu_size;
   }
 
+  rpki_table_flush(cache);
+
   if (pkt_start != sk->rbuf)
   {
     CACHE_DBG(cache, "Move %u bytes of a memory at the start of buffer", end - pkt_start);
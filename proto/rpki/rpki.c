@@ -115,31 +115,63 @@ static void rpki_stop_expire_timer_event(struct rpki_cache *cache);
  * 	Routes handling
  */
 
+/**
+ * rpki_table_update_roa - add or remove a received ROA
+ * @cache: RPKI connection instance
+ * @channel: ROA channel of the ROA type
+ * @pfxr: the ROA
+ * @add: whether the ROA is to be added or removed
+ *
+ * Received ROAs are collected and imported in batches by rpki_table_flush(),
+ * as all of them share the same attributes. Consecutive Prefix PDUs of the same
+ * type and flags form one batch. The caller must flush the batch before
+ * processing any other PDU.
+ */
 void
-rpki_table_add_roa(struct rpki_cache *cache, struct channel *channel, const net_addr_union *pfxr)
+rpki_table_update_roa(struct rpki_cache *cache, struct channel *channel, const net_addr_union *pfxr, int add)
 {
-  struct rpki_proto *p = cache->p;
-
-  rta a0 = {
-    .src = p->p.main_source,
-    .source = RTS_RPKI,
-    .scope = SCOPE_UNIVERSE,
-    .dest = RTD_NONE,
-  };
-
-  rta *a = rta_lookup(&a0);
-  rte *e = rte_get_temp(a);
-
-  e->pflags = 0;
+  if (cache->batch_count &&
+      ((cache->batch_channel != channel) || (cache->batch_add != add) ||
+       (cache->batch_count == RPKI_BATCH_SIZE)))
+    rpki_table_flush(cache);
 
-  rte_update2(channel, &pfxr->n, e, a0.src);
+  cache->batch_channel = channel;
+  cache->batch_add = add;
+  net_copy(&cache->batch[cache->batch_count++].n, &pfxr->n);
 }
 
+/**
+ * rpki_table_flush - import collected ROAs
+ * @cache: RPKI connection instance
+ */
 void
-rpki_table_remove_roa(struct rpki_cache *cache, struct channel *channel, const net_addr_union *pfxr)
+rpki_table_flush(struct rpki_cache *cache)
 {
   struct rpki_proto *p = cache->p;
-  rte_update2(channel, &pfxr->n, NULL, p->p.main_source);
+  net_addr *nets[RPKI_BATCH_SIZE];
+  rte *e = NULL;
+
+  if (!cache->batch_count)
+    return;
+
+  for (uint i = 0; i < cache->batch_count; i++)
+    nets[i] = &cache->batch[i].n;
+
+  if (cache->batch_add)
+  {
+    rta a0 = {
+      .src = p->p.main_source,
+      .source = RTS_RPKI,
+      .scope = SCOPE_UNIVERSE,
+      .dest = RTD_NONE,
+    };
+
+    e = rte_get_temp(rta_lookup(&a0));
+    e->pflags = 0;
+  }
+
+  rte_update_batch(cache->batch_channel, nets, cache->batch_count, e, p->p.main_source);
+  cache->batch_count = 0;
 }
 
 
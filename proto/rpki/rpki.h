@@ -27,6 +27,8 @@
 #define RPKI_REFRESH_INTERVAL	3600
 #define RPKI_EXPIRE_INTERVAL	7200
 
+#define RPKI_BATCH_SIZE		256	/* Max number of ROAs imported at once */
+
 #define RPKI_VERSION_0		0
 #define RPKI_VERSION_1		1
 #define RPKI_MAX_VERSION 	RPKI_VERSION_1
@@ -70,6 +72,12 @@ struct rpki_cache {
   timer *retry_timer;			/* Retry timer event */
   timer *refresh_timer;			/* Refresh timer event */
   timer *expire_timer;			/* Expire timer event */
+
+  /* Received ROAs waiting for rpki_table_flush() */
+  struct channel *batch_channel;	/* Channel of the collected ROAs */
+  u8 batch_add;				/* ROAs are to be added (1) or removed (0) */
+  uint batch_count;
+  net_addr_union batch[RPKI_BATCH_SIZE];
 };
 
 const char *rpki_get_cache_ident(struct rpki_cache *cache);
@@ -80,8 +88,8 @@ const char *rpki_cache_state_to_str(enum rpki_cache_state state);
  * 	Routes handling
  */
 
-void rpki_table_add_roa(struct rpki_cache *cache, struct channel *channel, const net_addr_union *pfxr);
-void rpki_table_remove_roa(struct rpki_cache *cache, struct channel *channel, const net_addr_union *pfxr);
+void rpki_table_update_roa(struct rpki_cache *cache, struct channel *channel, const net_addr_union *pfxr, int add);
+void rpki_table_flush(struct rpki_cache *cache);
 
 
 /*
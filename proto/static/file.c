@@ -0,0 +1,442 @@
+/*
+ *	BIRD -- Static Routes from External File
+ *
+ *	Can be freely distributed and used under the terms of the GNU GPL.
+ */
+
+/**
+ * DOC: Static route file
+ *
+ * Large and frequently changing sets of simple routes (e.g. blackhole feeds)
+ * are impractical to keep in the configuration, as each change would need a
+ * full reconfiguration. Therefore, the static protocol may also load routes
+ * from an external text file, one prefix (or address) per line, optionally
+ * followed by the route type. The file is read through mmap() and reloaded on
+ * CLI request, on reconfiguration with a different file name, or when its
+ * modification is noticed by the optional check timer.
+ *
+ * Loaded routes are kept in a &fib, each node remembers its route type and
+ * the generation of the last load it was seen in. A reload first validates the
+ * whole file, so a broken file never replaces a good set. Then it announces
+ * routes that are new or changed, and finally withdraws nodes of older
+ * generations. As the routes have no attributes besides their type, both
+ * announcements and withdrawals are collected by type and passed to
+ * rte_update_batch() in chunks.
+ */
+
+#undef LOCAL_DEBUG
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "nest/bird.h"
+#include "nest/protocol.h"
+#include "nest/route.h"
+#include "nest/cli.h"
+#include "conf/conf.h"
+#include "lib/string.h"
+
+#include "static.h"
+
+#define STATIC_FILE_BATCH	1024
+#define STATIC_FILE_DESTS	(RTD_PROHIBIT - RTD_BLACKHOLE + 1)
+
+struct static_file_batch {
+  struct static_proto *p;
+  net_addr *nets[STATIC_FILE_DESTS + 1][STATIC_FILE_BATCH];
+  uint num[STATIC_FILE_DESTS + 1];
+  uint changed;
+};
+
+
+static void
+static_file_flush(struct static_file_batch *b, uint i)
+{
+  struct static_proto *p = b->p;
+  rte *e = NULL;
+
+  if (!b->num[i])
+    return;
+
+  /* Index STATIC_FILE_DESTS is used for withdrawals */
+  if (i < STATIC_FILE_DESTS)
+  {
+    rta a0 = {
+      .src = p->p.main_source,
+      .source = RTS_STATIC,
+      .scope = SCOPE_UNIVERSE,
+      .dest = RTD_BLACKHOLE + i,
+    };
+
+    /* Shared by all networks of the chunk, must be cached */
+    e = rte_get_temp(rta_lookup(&a0));
+    e->pflags = 0;
+  }
+
+  rte_update_batch(p->p.main_channel, b->nets[i], b->num[i], e, p->p.main_source);
+  b->num[i] = 0;
+}
+
+static void
+static_file_push(struct static_file_batch *b, uint i, net_addr *n)
+{
+  if (b->num[i] == STATIC_FILE_BATCH)
+    static_file_flush(b, i);
+
+  b->nets[i][b->num[i]++] = n;
+}
+
+static int
+static_file_parse_net(net_addr *n, const char *s, uint type)
+{
+  char buf[64];
+  const char *px = strchr(s, '/');
+  uint pxlen;
+
+  if (px)
+  {
+    char *end;
+    ulong len = strtoul(px + 1, &end, 10);
+
+    if ((px - s >= (int) sizeof(buf)) || (end == px + 1) || *end || (len > 128))
+      return 0;
+
+    memcpy(buf, s, px - s);
+    buf[px - s] = 0;
+    s = buf;
+    pxlen = len;
+  }
+  else
+    pxlen = (type == NET_IP4) ? IP4_MAX_PREFIX_LENGTH : IP6_MAX_PREFIX_LENGTH;
+
+  if (type == NET_IP4)
+  {
+    ip4_addr a;
+    if (!ip4_pton(s, &a) || !net_validate_px4(a, pxlen))
+      return 0;
+
+    net_fill_ip4(n, a, pxlen);
+  }
+  else
+  {
+    ip6_addr a;
+    if (!ip6_pton(s, &a) || !net_validate_px6(a, pxlen))
+      return 0;
+
+    net_fill_ip6(n, a, pxlen);
+  }
+
+  return 1;
+}
+
+static int
+static_file_parse_dest(const char *s)
+{
+  if (!*s || !strcmp(s, "blackhole") || !strcmp(s, "drop"))
+    return RTD_BLACKHOLE;
+
+  if (!strcmp(s, "unreachable") || !strcmp(s, "reject"))
+    return RTD_UNREACHABLE;
+
+  if (!strcmp(s, "prohibit"))
+    return RTD_PROHIBIT;
+
+  return -1;
+}
+
+/*
+ * Walk lines of the file. With @b == NULL, just validate them, otherwise
+ * update the route nodes and collect announcements. Returns the number of the
+ * first invalid line, or 0.
+ */
+static uint
+static_file_walk(struct static_proto *p, const char *data, size_t len, struct static_file_batch *b)
+{
+  uint type = p->p.main_channel->net_type;
+  const char *pos = data, *end = data + len;
+  uint line = 0;
+
+  while (pos < end)
+  {
+    const char *eol = memchr(pos, '\n', end - pos) ?: end;
+    char buf[128], *tok[3];
+    uint ntok = 0;
+
+    line++;
+
+    if (eol - pos >= (int) sizeof(buf))
+      return line;
+
+    memcpy(buf, pos, eol - pos);
+    buf[eol - pos] = 0;
+    pos = eol + 1;
+
+    char *hash = strchr(buf, '#');
+    if (hash)
+      *hash = 0;
+
+    for (char *s = strtok(buf, " \t\r"); s; s = strtok(NULL, " \t\r"))
+      if (ntok < 3)
+	tok[ntok++] = s;
+      else
+	return line;
+
+    /* Empty line */
+    if (!ntok)
+      continue;
+
+    net_addr n;
+    int dest = static_file_parse_dest((ntok > 1) ? tok[1] : "");
+
+    if ((ntok > 2) || (dest < 0) || !static_file_parse_net(&n, tok[0], type))
+      return line;
+
+    if (!b)
+      continue;
+
+    struct static_file_route *r = fib_get(&p->file_routes, &n);
+
+    if (!r->gen || (r->dest != dest))
+    {
+      static_file_push(b, dest - RTD_BLACKHOLE, r->n.addr);
+      b->changed++;
+    }
+
+    r->dest = dest;
+    r->gen = p->file_gen;
+  }
+
+  return 0;
+}
+
+/*
+ * Withdraw and remove routes not seen in the current generation, using
+ * @b for batching. Returns their number.
+ */
+static uint
+static_file_expire(struct static_proto *p, struct static_file_batch *b)
+{
+  struct static_file_route **old;
+  uint num = 0, i = 0;
+
+  FIB_WALK(&p->file_routes, struct static_file_route, r)
+    num += (r->gen != p->file_gen);
+  FIB_WALK_END;
+
+  if (!num)
+    return 0;
+
+  /* Nodes cannot be deleted during the walk */
+  old = xmalloc(num * sizeof(struct static_file_route *));
+
+  FIB_WALK(&p->file_routes, struct static_file_route, r)
+    if (r->gen != p->file_gen)
+      old[i++] = r;
+  FIB_WALK_END;
+
+  for (uint pos = 0; pos < num; pos += STATIC_FILE_BATCH)
+  {
+    uint cnt = MIN(num - pos, STATIC_FILE_BATCH);
+
+    for (i = 0; i < cnt; i++)
+      static_file_push(b, STATIC_FILE_DESTS, old[pos + i]->n.addr);
+
+    static_file_flush(b, STATIC_FILE_DESTS);
+
+    for (i = 0; i < cnt; i++)
+      fib_delete(&p->file_routes, old[pos + i]);
+  }
+
+  xfree(old);
+  return num;
+}
+
+static void
+static_file_load(struct static_proto *p, const char *name)
+{
+  struct stat st;
+  void *data = NULL;
+  uint bad;
+  int fd;
+
+  if (p->p.main_channel->channel_state != CS_UP)
+    return;
+
+  if ((fd = open(name, O_RDONLY)) < 0)
+  {
+    log(L_ERR "%s: Cannot open route file %s: %m", p->p.name, name);
+    return;
+  }
+
+  if (fstat(fd, &st) < 0)
+  {
+    log(L_ERR "%s: Cannot stat route file %s: %m", p->p.name, name);
+    close(fd);
+    return;
+  }
+
+  p->file_ino = st.st_ino;
+  p->file_size = st.st_size;
+  p->file_mtime = st.st_mtime;
+
+  if (st.st_size && ((data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED))
+  {
+    log(L_ERR "%s: Cannot map route file %s: %m", p->p.name, name);
+    close(fd);
+    return;
+  }
+
+  close(fd);
+
+  if ((bad = static_file_walk(p, data, st.st_size, NULL)))
+  {
+    log(L_ERR "%s: Invalid route file %s, line %u", p->p.name, name, bad);
+    goto done;
+  }
+
+  struct static_file_batch *b = xmalloc(sizeof(struct static_file_batch));
+  memset(b, 0, sizeof(struct static_file_batch));
+  b->p = p;
+
+  p->file_gen++;
+  static_file_walk(p, data, st.st_size, b);
+
+  for (uint i = 0; i < STATIC_FILE_DESTS; i++)
+    static_file_flush(b, i);
+
+  uint changed = b->changed;
+  uint removed = static_file_expire(p, b);
+  xfree(b);
+
+  log(L_INFO "%s: Loaded %u routes from %s, %u changed, %u removed",
+      p->p.name, p->file_routes.entries, name, changed, removed);
+
+done:
+  if (data)
+    munmap(data, st.st_size);
+}
+
+static void
+static_file_check(timer *t)
+{
+  struct static_proto *p = t->data;
+  struct static_config *cf = (void *) p->p.cf;
+  struct stat st;
+
+  if (stat(cf->route_file, &st) < 0)
+    return;
+
+  if ((st.st_ino != p->file_ino) || ((u64) st.st_size != p->file_size) || (st.st_mtime != p->file_mtime))
+    static_file_load(p, cf->route_file);
+}
+
+/**
+ * static_file_start - start loading routes from route file
+ * @p: static protocol instance, with channel already up
+ */
+void
+static_file_start(struct static_proto *p)
+{
+  struct static_config *cf = (void *) p->p.cf;
+
+  fib_init(&p->file_routes, p->p.pool, p->p.main_channel->net_type,
+	   sizeof(struct static_file_route), OFFSETOF(struct static_file_route, n), 0, NULL);
+  p->file_gen = 0;
+  p->file_timer = NULL;
+
+  if (!cf->route_file)
+    return;
+
+  static_file_load(p, cf->route_file);
+
+  p->file_timer = tm_new_init(p->p.pool, static_file_check, p, cf->file_check_time S, 0);
+  if (cf->file_check_time)
+    tm_start(p->file_timer, cf->file_check_time S);
+}
+
+/**
+ * static_file_reconfigure - apply changed route file options
+ * @p: static protocol instance
+ * @o: old configuration
+ * @n: new configuration
+ *
+ * The file is reloaded when its name changed. Removing the file option
+ * withdraws all its routes.
+ */
+void
+static_file_reconfigure(struct static_proto *p, struct static_config *o, struct static_config *n)
+{
+  /* Not started yet, static_file_start() will use the new config */
+  if (p->p.proto_state != PS_UP)
+    return;
+
+  if (!n->route_file)
+  {
+    if (p->file_timer)
+      tm_stop(p->file_timer);
+
+    if (o->route_file && p->file_routes.entries)
+    {
+      struct static_file_batch *b = xmalloc(sizeof(struct static_file_batch));
+      memset(b, 0, sizeof(struct static_file_batch));
+      b->p = p;
+
+      p->file_gen++;
+      log(L_INFO "%s: Removed %u routes of route file", p->p.name, static_file_expire(p, b));
+      xfree(b);
+    }
+
+    return;
+  }
+
+  if (!o->route_file || strcmp(o->route_file, n->route_file))
+    static_file_load(p, n->route_file);
+
+  if (!p->file_timer)
+    p->file_timer = tm_new_init(p->p.pool, static_file_check, p, 0, 0);
+
+  p->file_timer->recurrent = n->file_check_time S;
+
+  if (!n->file_check_time)
+    tm_stop(p->file_timer);
+  else if (!tm_active(p->file_timer) || (n->file_check_time != o->file_check_time))
+    tm_start(p->file_timer, n->file_check_time S);
+}
+
+/**
+ * static_file_cmd_reload - reload route file on CLI request
+ * @P: static protocol instance
+ */
+void
+static_file_cmd_reload(struct proto *P)
+{
+  struct static_proto *p = (void *) P;
+  struct static_config *cf = (void *) P->cf;
+
+  if (!cf->route_file)
+  {
+    cli_msg(-8006, "%s: no route file", P->name);
+    return;
+  }
+
+  if (P->proto_state != PS_UP)
+  {
+    cli_msg(-8006, "%s: reload failed", P->name);
+    return;
+  }
+
+  static_file_load(p, cf->route_file);
+  cli_msg(-15, "%s: %u routes loaded from %s", P->name, p->file_routes.entries, cf->route_file);
+}
+
+void
+static_file_show(struct static_proto *p)
+{
+  struct static_config *cf = (void *) p->p.cf;
+
+  if (cf->route_file)
+    cli_msg(-1009, "Route file %s: %u routes", cf->route_file, p->file_routes.entries);
+}
@@ -28,7 +28,12 @@
  * The only other thing worth mentioning is that when asked for reconfiguration,
  * Static not only compares the two configurations, but it also calculates
  * difference between the lists of static routes and it just inserts the newly
- * added routes, removes the obsolete ones and reannounces changed ones.
+ * added routes, removes the obsolete ones and reannounces changed ones. Routes
+ * are paired by their network using a temporary hash table.
+ *
+ * Routes without next hops and attribute commands (e.g. black holes) share
+ * their attributes, so when (re)configured, they are collected and announced
+ * in groups by rte_update_batch() instead of one by one.
  */
 
 #undef LOCAL_DEBUG
@@ -44,9 +49,20 @@
 #include "filter/filter.h"
 #include "lib/string.h"
 #include "lib/alloca.h"
+#include "lib/hash.h"
 
 #include "static.h"
 
+#define SRH_KEY(r)		r->net
+#define SRH_NEXT(r)		r->next
+#define SRH_EQ(n1,n2)		net_equal(n1, n2)
+#define SRH_FN(n)		net_hash(n)
+
+#define SRH_REHASH		static_srh_rehash
+#define SRH_PARAMS		/8, *2, 2, 2, 10, 20
+
+HASH_DEFINE_REHASH_FN(SRH, struct static_route)
+
 static linpool *static_lp;
 
 static void
@@ -121,6 +137,54 @@ withdraw:
   r->state = SRS_DOWN;
 }
 
+static inline int
+static_batchable(struct static_route *r)
+{
+  return (r->dest != RTD_UNICAST) && (r->dest != RTDX_RECURSIVE) && !r->cmds;
+}
+
+static void
+static_announce_batch(struct static_proto *p)
+{
+  if (!p->batch.used)
+    return;
+
+  net_addr **nets = xmalloc(p->batch.used * sizeof(net_addr *));
+
+  /* Group the routes by dest, there are just a few possible values */
+  while (p->batch.used)
+  {
+    byte dest = p->batch.data[0]->dest;
+    uint num = 0, keep = 0;
+
+    BUFFER_WALK(p->batch, r)
+      if (r->dest == dest)
+      {
+	nets[num++] = r->net;
+	r->state = SRS_CLEAN;
+      }
+      else
+	p->batch.data[keep++] = r;
+
+    p->batch.used = keep;
+
+    rta a0 = {
+      .src = p->p.main_source,
+      .source = RTS_STATIC,
+      .scope = SCOPE_UNIVERSE,
+      .dest = dest,
+    };
+
+    /* Shared by all networks of the batch, must be cached */
+    rte *e = rte_get_temp(rta_lookup(&a0));
+    e->pflags = 0;
+
+    rte_update_batch(p->p.main_channel, nets, num, e, p->p.main_source);
+  }
+
+  xfree(nets);
+}
+
 static void
 static_mark_rte(struct static_proto *p, struct static_route *r)
 {
@@ -225,7 +289,11 @@ static_add_rte(struct static_proto *p, struct static_route *r)
     }
   }
 
-  static_announce_rte(p, r);
+  /* Announced later by static_announce_batch() */
+  if (static_batchable(r) && (r->state != SRS_CLEAN))
+    BUFFER_PUSH(p->batch) = r;
+  else
+    static_announce_rte(p, r);
 }
 
 static void
@@ -382,6 +450,9 @@ static_postconfig(struct proto_config *CF)
   WALK_LIST(r, cf->routes)
     if (r->net && (r->net->type != CF->net_type))
       cf_error("Route %N incompatible with channel type", r->net);
+
+  if (cf->route_file && (CF->net_type != NET_IP4) && (CF->net_type != NET_IP6))
+    cf_error("Route file requires IPv4 or IPv6 channel");
 }
 
 static struct proto *
@@ -424,6 +495,7 @@ static_start(struct proto *P)
   p->event = ev_new_init(p->p.pool, static_announce_marked, p);
 
   BUFFER_INIT(p->marked, p->p.pool, 4);
+  BUFFER_INIT(p->batch, p->p.pool, 4);
 
   /* We have to go UP before routes could be installed */
   proto_notify_state(P, PS_UP);
@@ -431,6 +503,9 @@ static_start(struct proto *P)
   WALK_LIST(r, cf->routes)
     static_add_rte(p, r);
 
+  static_announce_batch(p);
+  static_file_start(p);
+
   return PS_UP;
 }
 
@@ -486,13 +561,6 @@ static_dump(struct proto *P)
 
 #define IGP_TABLE(cf, sym) ((cf)->igp_table_##sym ? (cf)->igp_table_##sym ->table : NULL )
 
-static inline int
-static_cmp_rte(const void *X, const void *Y)
-{
-  struct static_route *x = *(void **)X, *y = *(void **)Y;
-  return net_compare(x->net, y->net);
-}
-
 static int
 static_reconfigure(struct proto *P, struct proto_config *CF)
 {
@@ -524,50 +592,38 @@ static_reconfigure(struct proto *P, struct proto_config *CF)
     static_reconfigure_rte(p, or, nr);
 
   if (!NODE_VALID(or) && !NODE_VALID(nr))
-    return 1;
-
-  /* Reconfigure remaining routes, sort them to find matching pairs */
-  struct static_route *or2, *nr2, **orbuf, **nrbuf;
-  uint ornum = 0, nrnum = 0, orpos = 0, nrpos = 0, i;
-
-  for (or2 = or; NODE_VALID(or2); or2 = NODE_NEXT(or2))
-    ornum++;
-
-  for (nr2 = nr; NODE_VALID(nr2); nr2 = NODE_NEXT(nr2))
-    nrnum++;
-
-  orbuf = xmalloc(ornum * sizeof(void *));
-  nrbuf = xmalloc(nrnum * sizeof(void *));
-
-  for (i = 0, or2 = or; i < ornum; i++, or2 = NODE_NEXT(or2))
-    orbuf[i] = or2;
+    goto done;
 
-  for (i = 0, nr2 = nr; i < nrnum; i++, nr2 = NODE_NEXT(nr2))
-    nrbuf[i] = nr2;
+  /* Reconfigure remaining routes, find matching pairs by network */
+  HASH(struct static_route) hash;
+  HASH_INIT(hash, P->pool, 10);
 
-  qsort(orbuf, ornum, sizeof(struct static_route *), static_cmp_rte);
-  qsort(nrbuf, nrnum, sizeof(struct static_route *), static_cmp_rte);
+  for (; NODE_VALID(or); or = NODE_NEXT(or))
+    HASH_INSERT2(hash, SRH, P->pool, or);
 
-  while ((orpos < ornum) && (nrpos < nrnum))
+  for (; NODE_VALID(nr); nr = NODE_NEXT(nr))
   {
-    int x = net_compare(orbuf[orpos]->net, nrbuf[nrpos]->net);
-    if (x < 0)
-      static_remove_rte(p, orbuf[orpos++]);
-    else if (x > 0)
-      static_add_rte(p, nrbuf[nrpos++]);
+    or = HASH_FIND(hash, SRH, nr->net);
+
+    if (or)
+    {
+      HASH_REMOVE2(hash, SRH, P->pool, or);
+      static_reconfigure_rte(p, or, nr);
+    }
     else
-      static_reconfigure_rte(p, orbuf[orpos++], nrbuf[nrpos++]);
+      static_add_rte(p, nr);
   }
 
-  while (orpos < ornum)
-    static_remove_rte(p, orbuf[orpos++]);
+  /* Remaining old routes are obsolete */
+  HASH_WALK(hash, next, r)
+    static_remove_rte(p, r);
+  HASH_WALK_END;
 
-  while (nrpos < nrnum)
-    static_add_rte(p, nrbuf[nrpos++]);
-
-  xfree(orbuf);
-  xfree(nrbuf);
+  HASH_FREE(hash);
 
+done:
+  static_announce_batch(p);
+  static_file_reconfigure(p, o, n);
   return 1;
 }
 
@@ -647,6 +703,9 @@ static_show(struct proto *P)
 
   WALK_LIST(r, c->routes)
     static_show_rt(r);
+
+  if (P->proto_state == PS_UP)
+    static_file_show((void *) P);
 }
 
 
@@ -19,6 +19,8 @@ struct static_config {
   int check_link;			/* Whether iface link state is used */
   struct rtable_config *igp_table_ip4;	/* Table for recursive IPv4 next hop lookups */
   struct rtable_config *igp_table_ip6;	/* Table for recursive IPv6 next hop lookups */
+  const char *route_file;		/* External file with additional routes */
+  uint file_check_time;			/* Interval of route file modification checks, 0 for none */
 };
 
 struct static_proto {
@@ -26,12 +28,20 @@ struct static_proto {
 
   struct event *event;			/* Event for announcing updated routes */
   BUFFER_(struct static_route *) marked; /* Routes marked for reannouncement */
+  BUFFER_(struct static_route *) batch;	/* Routes to be announced together, see static_announce_batch() */
   rtable *igp_table_ip4;		/* Table for recursive IPv4 next hop lookups */
   rtable *igp_table_ip6;		/* Table for recursive IPv6 next hop lookups */
+
+  struct fib file_routes;		/* Routes loaded from route file (struct static_file_route) */
+  u32 file_gen;				/* Generation of the last load, see static_file_load() */
+  timer *file_timer;			/* Check for route file modification */
+  u64 file_ino, file_size;		/* Route file identity at last load */
+  s64 file_mtime;
 };
 
 struct static_route {
   node n;
+  struct static_route *next;		/* Next in hash chain, used during reconfiguration */
   net_addr *net;			/* Network we route */
   ip_addr via;				/* Destination router */
   struct iface *iface;			/* Destination iface, for link-local vias or device routes */
@@ -60,6 +70,12 @@ struct static_route {
  * mp_head, mp_next, active are zero for other kinds of routes.
  */
 
+struct static_file_route {
+  u32 gen;				/* Generation of the load it was last seen in */
+  byte dest;				/* Destination type (RTD_*) */
+  struct fib_node n;
+};
+
 #define RTDX_RECURSIVE 0x7f		/* Phony dest value for recursive routes */
 
 #define SRS_DOWN	0		/* Route is not announced */
@@ -68,4 +84,9 @@ struct static_route {
 
 void static_show(struct proto *);
 
+void static_file_start(struct static_proto *p);
+void static_file_reconfigure(struct static_proto *p, struct static_config *o, struct static_config *n);
+void static_file_cmd_reload(struct proto *P);
+void static_file_show(struct static_proto *p);
+
 #endif
@@ -32,6 +32,7 @@
 #include "sysdep/unix/krt.h"
 #include "lib/string.h"
 #include "lib/socket.h"
+#include "lib/tracepoint.h"
 
 const int rt_default_ecmp = 0;
 
@@ -351,6 +352,8 @@ krt_replace_rte(struct krt_proto *p, net *n, rte *new, rte *old)
 {
   int err = 0;
 
+  TRACEPOINT(krt_replace_rte, p->p.name, n->n.addr, new, old);
+
   if (old)
     krt_send_route(p, RTM_DELETE, old);
 
@@ -364,6 +367,8 @@ krt_replace_rte(struct krt_proto *p, net *n, rte *new, rte *old)
     else
       bmap_set(&p->sync_map, new->id);
   }
+
+  TRACEPOINT(krt_replace_rte__done, p->p.name, n->n.addr, err);
 }
 
 #define SKIP(ARG...) do { DBG("KRT: Ignoring route - " ARG); return; } while(0)
@@ -264,6 +264,12 @@ sk_disable_mtu_disc6(sock *s UNUSED)
   return 0;
 }
 
+static inline int
+sk_get_tcp_info_(sock *s, struct sk_tcp_info *info UNUSED)
+{
+  ERR_MSG("TCP_INFO not supported");
+}
+
 int sk_priority_control = -1;
 
 static inline int
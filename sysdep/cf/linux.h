@@ -14,6 +14,9 @@
 
 #define CONFIG_MC_PROPER_SRC
 #define CONFIG_UNIX_DONTROUTE
+#define CONFIG_RECVMMSG
+#define CONFIG_SENDMMSG
+#define CONFIG_EVENTFD
 
 #define CONFIG_INCLUDE_SYSIO_H "sysdep/linux/sysio.h"
 #define CONFIG_INCLUDE_KRTSYS_H "sysdep/linux/krt-sys.h"
@@ -69,10 +69,14 @@ static inline struct ifa * kif_get_primary_ip(struct iface *i UNUSED) { return N
 struct krt_params {
   u32 table_id;				/* Kernel table ID we sync with */
   u32 metric;				/* Kernel metric used for all routes */
+  uint window;				/* Max number of requests in flight */
+  int nexthops;				/* Use kernel next hop objects */
+  uint rx_buffer;			/* Receive buffer of async socket, 0 for default */
 };
 
 struct krt_state {
   struct krt_proto *hash_next;
+  uint window;				/* Current value of krt_params.window */
 };
 
 
@@ -12,6 +12,7 @@
 #include <fcntl.h>
 #include <sys/socket.h>
 #include <sys/uio.h>
+#include <poll.h>
 #include <errno.h>
 
 #undef LOCAL_DEBUG
@@ -26,6 +27,8 @@
 #include "lib/socket.h"
 #include "lib/string.h"
 #include "lib/hash.h"
+#include "lib/idm.h"
+#include "lib/tracepoint.h"
 #include "conf/conf.h"
 
 #include <asm/types.h>
@@ -69,6 +72,22 @@
 #define RTA_ENCAP  22
 #endif
 
+#ifndef RTA_NH_ID
+#define RTA_NH_ID  30
+#endif
+
+#ifndef RTM_NEWNEXTHOP
+#define RTM_NEWNEXTHOP	104
+#define RTM_DELNEXTHOP	105
+#endif
+
+#ifndef NHA_ID
+#define NHA_ID		1
+#define NHA_GROUP	2
+#define NHA_OIF		5
+#define NHA_GATEWAY	6
+#endif
+
 #define krt_ipv4(p) ((p)->af == AF_INET)
 #define krt_ecmp6(p) ((p)->af == AF_INET6)
 
@@ -123,12 +142,13 @@ struct nl_sock
 {
   int fd;
   u32 seq;
+  u32 first_seq;			/* First sequence number of pending requests */
   byte *rx_buffer;			/* Receive buffer */
   struct nlmsghdr *last_hdr;		/* Recently received packet */
   uint last_size;
 };
 
-#define NL_RX_SIZE 8192
+#define NL_RX_SIZE 32768
 
 #define NL_OP_DELETE	0
 #define NL_OP_ADD	(NLM_F_CREATE|NLM_F_EXCL)
@@ -136,6 +156,7 @@ struct nl_sock
 #define NL_OP_APPEND	(NLM_F_CREATE|NLM_F_APPEND)
 
 static linpool *nl_linpool;
+static linpool *nl_scan_linpool;	/* Kept between steps of route dump */
 
 static struct nl_sock nl_scan = {.fd = -1};	/* Netlink socket for synchronous scan */
 static struct nl_sock nl_req  = {.fd = -1};	/* Netlink socket for requests */
@@ -170,16 +191,22 @@ nl_send(struct nl_sock *nl, struct nlmsghdr *nh)
   memset(&sa, 0, sizeof(sa));
   sa.nl_family = AF_NETLINK;
   nh->nlmsg_pid = 0;
-  nh->nlmsg_seq = ++(nl->seq);
+  nh->nlmsg_seq = nl->first_seq = ++(nl->seq);
   nh->nlmsg_len = NLMSG_ALIGN(nh->nlmsg_len);
   if (sendto(nl->fd, nh, nh->nlmsg_len, 0, (struct sockaddr *)&sa, sizeof(sa)) < 0)
     die("rtnetlink sendto: %m");
   nl->last_hdr = NULL;
 }
 
+static int nl_scan_running;		/* Route dump is being processed by steps */
+
 static void
 nl_request_dump(int af, int cmd)
 {
+  /* Finish ongoing route dump, see krt_do_scan_step() */
+  if (nl_scan_running)
+    krt_do_scan_step(NULL, ~0U);
+
   struct {
     struct nlmsghdr nh;
     struct rtgenmsg g;
@@ -192,8 +219,15 @@ nl_request_dump(int af, int cmd)
   nl_send(&nl_scan, &req.nh);
 }
 
+static uint nl_inflight_count;
+
+/*
+ * Receive next reply on @nl. Without @wait, return NULL when no reply is ready.
+ * Acknowledgements of batched requests may be lost when the receive buffer
+ * overflows, then they are forgotten and NULL is returned as well.
+ */
 static struct nlmsghdr *
-nl_get_reply(struct nl_sock *nl)
+nl_get_reply_(struct nl_sock *nl, int wait)
 {
   for(;;)
     {
@@ -208,6 +242,23 @@ nl_get_reply(struct nl_sock *nl)
 	    .msg_iovlen = 1,
 	  };
 	  int x = recvmsg(nl->fd, &m, 0);
+	  if ((x < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK)))
+	    {
+	      /* Request socket is non-blocking, see nl_open_req() */
+	      if (!wait)
+		return NULL;
+
+	      struct pollfd pfd = { .fd = nl->fd, .events = POLLIN };
+	      poll(&pfd, 1, -1);
+	      continue;
+	    }
+	  if ((x < 0) && (errno == ENOBUFS) && (nl == &nl_req) && nl_inflight_count)
+	    {
+	      log(L_WARN "Kernel dropped some netlink acknowledgements, will resync on next scan.");
+	      nl_inflight_count = 0;
+	      nl->first_seq = nl->seq + 1;
+	      return NULL;
+	    }
 	  if (x < 0)
 	    die("nl_get_reply: %m");
 	  if (sa.nl_pid)		/* It isn't from the kernel */
@@ -224,7 +275,7 @@ nl_get_reply(struct nl_sock *nl)
 	{
 	  struct nlmsghdr *h = nl->last_hdr;
 	  nl->last_hdr = NLMSG_NEXT(h, nl->last_size);
-	  if (h->nlmsg_seq != nl->seq)
+	  if ((u32) (h->nlmsg_seq - nl->first_seq) > (u32) (nl->seq - nl->first_seq))
 	    {
 	      log(L_WARN "nl_get_reply: Ignoring out of sequence netlink packet (%x != %x)",
 		  h->nlmsg_seq, nl->seq);
@@ -238,6 +289,12 @@ nl_get_reply(struct nl_sock *nl)
     }
 }
 
+static inline struct nlmsghdr *
+nl_get_reply(struct nl_sock *nl)
+{
+  return nl_get_reply_(nl, 1);
+}
+
 static struct tbf rl_netlink_err = TBF_DEFAULT_LOG_LIMITS;
 
 static int
@@ -273,11 +330,245 @@ nl_get_scan(void)
   return h;
 }
 
+/*
+ * Route requests which do not need an immediate answer are not exchanged one
+ * by one, but collected in a batch buffer and sent in one sendto() call. The
+ * kernel processes them in order and acknowledges each of them. The
+ * acknowledgements are received asynchronously through the request socket
+ * hook and matched to requests by sequence numbers, while at most @nl_window
+ * requests are in flight. A route replacement supersedes a pending, not yet
+ * sent, request for the same network, so just the latest state is sent.
+ *
+ * The batch is sent when full, from an event at the end of the current main
+ * loop iteration, when acknowledgements make room in the window, and right
+ * after a route of a priority class (see rte_is_priority()) is queued. Before
+ * any synchronous request on the same socket and before a kernel table scan,
+ * the batch is sent and all acknowledgements are waited for.
+ */
+
+#define NL_TX_SIZE	32768
+#define NL_TX_MAX	256
+#define NL_WINDOW_MAX	4096		/* Power of two */
+
+#ifndef NETLINK_CAP_ACK
+#define NETLINK_CAP_ACK	10
+#endif
+
+struct nl_request
+{
+  struct krt_proto *proto;		/* Owner of sync_map to update, or NULL */
+  const net *net;			/* Network for coalescing, or NULL */
+  u32 id;				/* Route ID in sync_map */
+  u16 len;				/* Message length */
+  u8 ignore_esrch;
+  u8 dead;				/* Superseded by a later request */
+};
+
+struct nl_batch
+{
+  byte *buf;
+  uint len;
+  uint count;
+  event *event;
+  struct nl_request req[NL_TX_MAX];
+};
+
+static struct nl_batch nl_batch;
+static struct nl_request nl_inflight[NL_WINDOW_MAX];
+static uint nl_window = NL_WINDOW_MAX;
+static sock *nl_req_sk;
+
+static void
+nl_ack(struct nlmsghdr *h)
+{
+  if (h->nlmsg_type != NLMSG_ERROR)
+  {
+    log(L_WARN "nl_ack: Unexpected reply received");
+    return;
+  }
+
+  if (!nl_inflight_count)
+    return;
+
+  struct nl_request *r = &nl_inflight[h->nlmsg_seq % NL_WINDOW_MAX];
+  int err = nl_error(h, r->ignore_esrch);
+
+  if (r->proto)
+  {
+    if (err)
+      bmap_clear(&r->proto->sync_map, r->id);
+    else
+      bmap_set(&r->proto->sync_map, r->id);
+  }
+
+  nl_inflight_count--;
+  nl_req.first_seq = h->nlmsg_seq + 1;
+}
+
+/* Process acknowledgements until at most @limit requests are in flight */
+static int
+nl_wait_acks(uint limit, int wait)
+{
+  while (nl_inflight_count > limit)
+  {
+    struct nlmsghdr *h = nl_get_reply_(&nl_req, wait);
+    if (!h)
+      return 0;
+
+    nl_ack(h);
+  }
+
+  return 1;
+}
+
+static void
+nl_send_batch(int wait)
+{
+  struct nl_batch *b = &nl_batch;
+  struct sockaddr_nl sa = { .nl_family = AF_NETLINK };
+
+  if (!b->count)
+    return;
+
+  /* Keep the window, but allow one batch regardless of its size */
+  uint limit = (nl_window > b->count) ? nl_window - b->count : 0;
+  if (!nl_wait_acks(limit, wait) && nl_inflight_count)
+    return;
+
+  if (!nl_inflight_count)
+    nl_req.first_seq = nl_req.seq + 1;
+
+  /* Drop superseded requests and number the rest */
+  byte *src = b->buf, *dst = b->buf;
+  for (uint i = 0; i < b->count; i++)
+  {
+    struct nl_request *r = &b->req[i];
+
+    if (!r->dead)
+    {
+      memmove(dst, src, r->len);
+
+      struct nlmsghdr *h = (void *) dst;
+      h->nlmsg_seq = ++(nl_req.seq);
+      nl_inflight[h->nlmsg_seq % NL_WINDOW_MAX] = *r;
+      nl_inflight_count++;
+      dst += r->len;
+    }
+
+    src += r->len;
+  }
+
+  if ((dst > b->buf) &&
+      (sendto(nl_req.fd, b->buf, dst - b->buf, 0, (struct sockaddr *) &sa, sizeof(sa)) < 0))
+    die("rtnetlink sendto: %m");
+
+  b->len = 0;
+  b->count = 0;
+}
+
+/* Send the batch and wait for all acknowledgements */
+static void
+nl_flush(void)
+{
+  nl_send_batch(1);
+  nl_wait_acks(0, 1);
+}
+
+static void
+nl_flush_event(void *data UNUSED)
+{
+  nl_send_batch(0);
+}
+
+static int
+nl_req_hook(sock *sk UNUSED, uint size UNUSED)
+{
+  nl_wait_acks(0, 0);
+  nl_send_batch(0);
+  return 0;
+}
+
+static void
+nl_req_err_hook(sock *sk, int e UNUSED)
+{
+  nl_req_hook(sk, 0);
+}
+
+static void
+nl_queue_msg(struct nlmsghdr *pkt, struct nl_request r)
+{
+  struct nl_batch *b = &nl_batch;
+  uint len = NLMSG_ALIGN(pkt->nlmsg_len);
+
+  if ((b->len + len > NL_TX_SIZE) || (b->count == NL_TX_MAX))
+    nl_send_batch(1);
+
+  if (!b->count)
+    ev_schedule(b->event);
+
+  struct nlmsghdr *h = (void *) (b->buf + b->len);
+  memcpy(h, pkt, pkt->nlmsg_len);
+  h->nlmsg_pid = 0;
+  h->nlmsg_len = len;
+
+  r.len = len;
+  b->req[b->count++] = r;
+  b->len += len;
+}
+
+static void
+nl_queue(struct nlmsghdr *pkt, struct krt_proto *p, rte *e, int op)
+{
+  struct nl_batch *b = &nl_batch;
+
+  /* Replacement supersedes pending add or replace of the same network */
+  if (op == NL_OP_REPLACE)
+    for (uint i = 0; i < b->count; i++)
+      if ((b->req[i].net == e->net) && (b->req[i].proto == p))
+	b->req[i].dead = 1;
+
+  nl_queue_msg(pkt, (struct nl_request) {
+    .proto = (op == NL_OP_DELETE) ? NULL : p,
+    .net = (op == NL_OP_DELETE) ? NULL : e->net,
+    .id = e->id,
+    .ignore_esrch = (op == NL_OP_DELETE),
+  });
+
+  /* Priority routes do not wait for the batch to fill */
+  if (rte_is_priority(e))
+    nl_send_batch(0);
+}
+
+static void
+nl_open_req(void)
+{
+  if (nl_req_sk)
+    return;
+
+  /* Room for acknowledgements of the whole window */
+  int y = 1, size = NL_WINDOW_MAX * 1024;
+  if ((setsockopt(nl_req.fd, SOL_SOCKET, SO_RCVBUFFORCE, &size, sizeof(size)) < 0) &&
+      (setsockopt(nl_req.fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size)) < 0))
+    log(L_WARN "Netlink: Cannot set receive buffer size: %m");
+
+  /* Acknowledgements of failed requests do not need to contain them */
+  setsockopt(nl_req.fd, SOL_NETLINK, NETLINK_CAP_ACK, &y, sizeof(y));
+
+  sock *sk = nl_req_sk = sk_new(krt_pool);
+  sk->type = SK_MAGIC;
+  sk->rx_hook = nl_req_hook;
+  sk->err_hook = nl_req_err_hook;
+  sk->fd = nl_req.fd;
+  if (sk_open(sk) < 0)
+    bug("Netlink: sk_open failed");
+}
+
 static int
 nl_exchange(struct nlmsghdr *pkt, int ignore_esrch)
 {
   struct nlmsghdr *h;
 
+  nl_flush();
   nl_send(&nl_req, pkt);
   for(;;)
     {
@@ -340,7 +631,7 @@ static struct nl_want_attrs ifa_attr_want6[BIRD_IFA_MAX] = {
 };
 
 
-#define BIRD_RTA_MAX  (RTA_ENCAP+1)
+#define BIRD_RTA_MAX  (RTA_NH_ID+1)
 
 static struct nl_want_attrs nexthop_attr_want4[BIRD_RTA_MAX] = {
   [RTA_GATEWAY]	  = { 1, 1, sizeof(ip4_addr) },
@@ -380,6 +671,7 @@ static struct nl_want_attrs rtm_attr_want4[BIRD_RTA_MAX] = {
   [RTA_VIA]	  = { 1, 0, 0 },
   [RTA_ENCAP_TYPE]= { 1, 1, sizeof(u16) },
   [RTA_ENCAP]	  = { 1, 0, 0 },
+  [RTA_NH_ID]	  = { 1, 1, sizeof(u32) },
 };
 
 static struct nl_want_attrs rtm_attr_want6[BIRD_RTA_MAX] = {
@@ -397,6 +689,7 @@ static struct nl_want_attrs rtm_attr_want6[BIRD_RTA_MAX] = {
   [RTA_VIA]	  = { 1, 0, 0 },
   [RTA_ENCAP_TYPE]= { 1, 1, sizeof(u16) },
   [RTA_ENCAP]	  = { 1, 0, 0 },
+  [RTA_NH_ID]	  = { 1, 1, sizeof(u32) },
 };
 
 #ifdef HAVE_MPLS_KERNEL
@@ -1216,8 +1509,267 @@ nh_bufsize(struct nexthop *nh)
   return rv;
 }
 
+/*
+ *	Kernel next hop objects
+ */
+
+/*
+ * Kernel protocols with the netlink nexthops option send routes referring to
+ * kernel next hop objects (Linux 5.3+) instead of carrying their next hops.
+ * Objects are shared by all routes with the same next hops, they are keyed by
+ * the next hop list and the address family of routes. An ECMP route refers to
+ * a group object, which refers to objects of its members.
+ *
+ * Removing an object in use would remove its routes too, therefore objects are
+ * not reference counted by our routes. Instead, after each kernel table scan,
+ * objects neither referenced by any route found in the scan nor used by routes
+ * sent since the previous scan are removed.
+ */
+
+struct nl_nh
+{
+  struct nl_nh *next;			/* Next in nl_nh_hash */
+  struct nl_nh *next_id;		/* Next in nl_nh_id_hash */
+  struct nexthop *nh;			/* Next hop list */
+  u32 hash;
+  u32 id;				/* Kernel object ID */
+  u8 af;				/* Address family of routes */
+  u8 seen;				/* Referenced by a route in the last scan */
+  u8 count;				/* Number of group members, 0 for single next hop */
+  struct nl_nh *member[0];
+};
+
+struct nl_nh_grp
+{
+  u32 id;
+  u8 weight;
+  u8 resvd1;
+  u16 resvd2;
+};
+
+struct nl_nhmsg
+{
+  u8 nh_family;
+  u8 nh_scope;
+  u8 nh_protocol;
+  u8 resvd;
+  u32 nh_flags;
+};
+
+/* Separate ranges, as the kernel cannot replace a single object by a group */
+#define NL_NH_ID_SINGLE	0x42000000
+#define NL_NH_ID_GROUP	0x43000000
+
+#define NHH_KEY(n)		n->nh, n->af, n->hash
+#define NHH_NEXT(n)		n->next
+#define NHH_EQ(n1,a1,h1,n2,a2,h2) h1 == h2 && a1 == a2 && nexthop_same(n1, n2)
+#define NHH_FN(n,a,h)		h
+
+#define NHH_REHASH		nl_nh_rehash
+#define NHH_PARAMS		/8, *2, 2, 2, 6, 20
+
+HASH_DEFINE_REHASH_FN(NHH, struct nl_nh)
+
+#define NHI_KEY(n)		n->id
+#define NHI_NEXT(n)		n->next_id
+#define NHI_EQ(a,b)		a == b
+#define NHI_FN(a)		u32_hash(a)
+
+#define NHI_REHASH		nl_nh_id_rehash
+#define NHI_PARAMS		/8, *2, 2, 2, 6, 20
+
+HASH_DEFINE_REHASH_FN(NHI, struct nl_nh)
+
+static HASH(struct nl_nh) nl_nh_hash;
+static HASH(struct nl_nh) nl_nh_id_hash;
+static struct idm nl_nh_idm;
+
+static int
+nl_nh_usable(struct krt_proto *p, struct nexthop *nh)
+{
+  if (!KRT_CF->sys.nexthops || ((p->af != AF_INET) && (p->af != AF_INET6)))
+    return 0;
+
+  for (; nh; nh = nh->next)
+    if (nh->labels)
+      return 0;
+
+  return 1;
+}
+
+static void
+nl_nh_send(struct nl_nh *n, int af)
+{
+  /* Group size is limited by u8 count */
+  struct {
+    struct nlmsghdr h;
+    struct nl_nhmsg n;
+    char buf[64 + 255 * sizeof(struct nl_nh_grp)];
+  } req = {
+    .h.nlmsg_type = RTM_NEWNEXTHOP,
+    .h.nlmsg_len = NLMSG_LENGTH(sizeof(struct nl_nhmsg)),
+    .h.nlmsg_flags = NL_OP_REPLACE | NLM_F_REQUEST | NLM_F_ACK,
+    .n.nh_protocol = RTPROT_BIRD,
+  }, *r = &req;
+
+  int rsize = sizeof(req);
+
+  nl_add_attr_u32(&r->h, rsize, NHA_ID, n->id);
+
+  if (n->count)
+  {
+    struct nl_nh_grp grp[n->count];
+    struct nexthop *nh = n->nh;
+
+    for (uint i = 0; i < n->count; i++, nh = nh->next)
+      grp[i] = (struct nl_nh_grp) { .id = n->member[i]->id, .weight = nh->weight };
+
+    r->n.nh_family = AF_UNSPEC;
+    nl_add_attr(&r->h, rsize, NHA_GROUP, grp, sizeof(grp));
+  }
+  else
+  {
+    struct nexthop *nh = n->nh;
+
+    r->n.nh_family = ipa_zero(nh->gw) ? af : (ipa_is_ip4(nh->gw) ? AF_INET : AF_INET6);
+    nl_add_attr_u32(&r->h, rsize, NHA_OIF, nh->iface->index);
+
+    if (ipa_nonzero(nh->gw))
+      nl_add_attr_ipa(&r->h, rsize, NHA_GATEWAY, nh->gw);
+
+    if (nh->flags & RNF_ONLINK)
+      r->n.nh_flags |= RTNH_F_ONLINK;
+  }
+
+  nl_queue_msg(&r->h, (struct nl_request) {});
+}
+
+static struct nl_nh *
+nl_nh_get(struct nexthop *nh, int af)
+{
+  u32 hash = nexthop_hash(nh);
+  struct nl_nh *n = HASH_FIND(nl_nh_hash, NHH, nh, af, hash);
+
+  /* Keep objects used during incremental scan, see nl_nh_prune() */
+  if (n)
+  {
+    n->seen = 1;
+    return n;
+  }
+
+  uint count = 0;
+  if (nh->next)
+    for (struct nexthop *x = nh; x; x = x->next)
+      count++;
+
+  n = mb_allocz(krt_pool, sizeof(struct nl_nh) + count * sizeof(struct nl_nh *));
+  n->hash = hash;
+  n->af = af;
+  n->seen = 1;
+  n->count = count;
+
+  struct nexthop **last = &n->nh;
+  for (struct nexthop *x = nh; x; x = x->next)
+  {
+    struct nexthop *y = mb_alloc(krt_pool, sizeof(struct nexthop));
+    *y = *x;
+    y->next = NULL;
+    *last = y;
+    last = &y->next;
+  }
+
+  if (count)
+  {
+    /* Members are single next hops, without weight */
+    uint i = 0;
+    for (struct nexthop *x = n->nh; x; x = x->next)
+    {
+      struct nexthop m = *x;
+      m.next = NULL;
+      m.weight = 0;
+      n->member[i++] = nl_nh_get(&m, af);
+    }
+  }
+
+  n->id = (count ? NL_NH_ID_GROUP : NL_NH_ID_SINGLE) + idm_alloc(&nl_nh_idm);
+
+  HASH_INSERT2(nl_nh_hash, NHH, krt_pool, n);
+  HASH_INSERT2(nl_nh_id_hash, NHI, krt_pool, n);
+
+  nl_nh_send(n, af);
+  return n;
+}
+
+static void
+nl_nh_free(struct nl_nh *n)
+{
+  struct {
+    struct nlmsghdr h;
+    struct nl_nhmsg n;
+    char buf[16];
+  } r = {
+    .h.nlmsg_type = RTM_DELNEXTHOP,
+    .h.nlmsg_len = NLMSG_LENGTH(sizeof(struct nl_nhmsg)),
+    .h.nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK,
+  };
+
+  nl_add_attr_u32(&r.h, sizeof(r), NHA_ID, n->id);
+  nl_queue_msg(&r.h, (struct nl_request) { .ignore_esrch = 1 });
+
+  /* Called while walking nl_nh_hash, resized by nl_nh_prune() */
+  HASH_REMOVE(nl_nh_hash, NHH, n);
+  HASH_REMOVE2(nl_nh_id_hash, NHI, krt_pool, n);
+  idm_free(&nl_nh_idm, n->id - (n->count ? NL_NH_ID_GROUP : NL_NH_ID_SINGLE));
+
+  struct nexthop *x, *y;
+  for (x = n->nh; x; x = y)
+  {
+    y = x->next;
+    mb_free(x);
+  }
+
+  mb_free(n);
+}
+
+static inline void
+nl_nh_seen(u32 id)
+{
+  struct nl_nh *n = HASH_FIND(nl_nh_id_hash, NHI, id);
+
+  if (n)
+    n->seen = 1;
+}
+
+/* Remove objects not referenced by routes found in the last scan */
+static void
+nl_nh_prune(void)
+{
+  HASH_WALK(nl_nh_hash, next, n)
+    if (n->seen)
+      for (uint i = 0; i < n->count; i++)
+	n->member[i]->seen = 1;
+  HASH_WALK_END;
+
+  /* Groups go first, so their members are not in use when removed */
+  for (int group = 1; group >= 0; group--)
+  {
+    HASH_WALK_DELSAFE(nl_nh_hash, next, n)
+      if (!!n->count == group)
+      {
+	if (!n->seen)
+	  nl_nh_free(n);
+	else
+	  n->seen = 0;
+      }
+    HASH_WALK_DELSAFE_END;
+  }
+
+  HASH_MAY_RESIZE_DOWN(nl_nh_hash, NHH, krt_pool);
+}
+
+/* With @batch, the request is queued and sync_map of @p is updated later */
 static int
-nl_send_route(struct krt_proto *p, rte *e, int op, int dest, struct nexthop *nh)
+nl_send_route(struct krt_proto *p, rte *e, int op, int dest, struct nexthop *nh, int batch)
 {
   eattr *ea;
   net *net = e->net;
@@ -1338,7 +1890,9 @@ dest:
     {
     case RTD_UNICAST:
       r->r.rtm_type = RTN_UNICAST;
-      if (nh->next && !krt_ecmp6(p))
+      if ((op != NL_OP_DELETE) && nl_nh_usable(p, nh))
+	nl_add_attr_u32(&r->h, rsize, RTA_NH_ID, nl_nh_get(nh, p->af)->id);
+      else if (nh->next && !krt_ecmp6(p))
 	nl_add_multipath(&r->h, rsize, nh, p->af);
       else
       {
@@ -1365,6 +1919,12 @@ dest:
     }
 
   /* Ignore missing for DELETE */
+  if (batch)
+  {
+    nl_queue(&r->h, p, e, op);
+    return 0;
+  }
+
   return nl_exchange(&r->h, (op == NL_OP_DELETE));
 }
 
@@ -1374,21 +1934,25 @@ nl_add_rte(struct krt_proto *p, rte *e)
   rta *a = e->attrs;
   int err = 0;
 
+  /* With next hop objects, even IPv6 ECMP routes are sent as one route */
+  if ((a->dest == RTD_UNICAST) && nl_nh_usable(p, &(a->nh)))
+    return nl_send_route(p, e, NL_OP_ADD, a->dest, &(a->nh), 1);
+
   if (krt_ecmp6(p) && a->nh.next)
   {
     struct nexthop *nh = &(a->nh);
 
-    err = nl_send_route(p, e, NL_OP_ADD, RTD_UNICAST, nh);
+    err = nl_send_route(p, e, NL_OP_ADD, RTD_UNICAST, nh, 0);
     if (err < 0)
       return err;
 
     for (nh = nh->next; nh; nh = nh->next)
-      err += nl_send_route(p, e, NL_OP_APPEND, RTD_UNICAST, nh);
+      err += nl_send_route(p, e, NL_OP_APPEND, RTD_UNICAST, nh, 0);
 
     return err;
   }
 
-  return nl_send_route(p, e, NL_OP_ADD, a->dest, &(a->nh));
+  return nl_send_route(p, e, NL_OP_ADD, a->dest, &(a->nh), !krt_ecmp6(p));
 }
 
 static inline int
@@ -1397,9 +1961,12 @@ nl_delete_rte(struct krt_proto *p, rte *e)
   int err = 0;
 
   /* For IPv6, we just repeatedly request DELETE until we get error */
+  if (!krt_ecmp6(p))
+    return nl_send_route(p, e, NL_OP_DELETE, RTD_NONE, NULL, 1);
+
   do
-    err = nl_send_route(p, e, NL_OP_DELETE, RTD_NONE, NULL);
-  while (krt_ecmp6(p) && !err);
+    err = nl_send_route(p, e, NL_OP_DELETE, RTD_NONE, NULL, 0);
+  while (!err);
 
   return err;
 }
@@ -1408,7 +1975,7 @@ static inline int
 nl_replace_rte(struct krt_proto *p, rte *e)
 {
   rta *a = e->attrs;
-  return nl_send_route(p, e, NL_OP_REPLACE, a->dest, &(a->nh));
+  return nl_send_route(p, e, NL_OP_REPLACE, a->dest, &(a->nh), 1);
 }
 
 
@@ -1417,6 +1984,8 @@ krt_replace_rte(struct krt_proto *p, net *n UNUSED, rte *new, rte *old)
 {
   int err = 0;
 
+  TRACEPOINT(krt_replace_rte, p->p.name, n->n.addr, new, old);
+
   /*
    * We use NL_OP_REPLACE for IPv4, it has an issue with not checking for
    * matching rtm_protocol, but that is OK when dedicated priority is used.
@@ -1449,6 +2018,8 @@ krt_replace_rte(struct krt_proto *p, net *n UNUSED, rte *new, rte *old)
     else
       bmap_set(&p->sync_map, new->id);
   }
+
+  TRACEPOINT(krt_replace_rte__done, p->p.name, n->n.addr, err);
 }
 
 static int
@@ -1573,6 +2144,9 @@ nl_parse_route(struct nl_parse_state *s, struct nlmsghdr *h)
       return;
     }
 
+  if (s->scan && a[RTA_NH_ID])
+    nl_nh_seen(rta_get_u32(a[RTA_NH_ID]));
+
   if (a[RTA_OIF])
     oif = rta_get_u32(a[RTA_OIF]);
 
@@ -1858,19 +2432,60 @@ nl_parse_route(struct nl_parse_state *s, struct nlmsghdr *h)
 }
 
 void
-krt_do_scan(struct krt_proto *p UNUSED)	/* CONFIG_ALL_TABLES_AT_ONCE => p is NULL */
+krt_do_scan_begin(struct krt_proto *p UNUSED)	/* CONFIG_ALL_TABLES_AT_ONCE => p is NULL */
+{
+  /* Scan results are compared with sync_map */
+  nl_flush();
+
+  nl_request_dump(AF_UNSPEC, RTM_GETROUTE);
+  nl_scan_running = 1;
+}
+
+/*
+ * Process at most @limit messages of the route dump. Routes are announced at
+ * the end of each step, as the network of a postponed route may be removed
+ * between steps. Returns 1 when the dump is finished.
+ */
+int
+krt_do_scan_step(struct krt_proto *p UNUSED, uint limit)
 {
   struct nlmsghdr *h;
   struct nl_parse_state s;
 
+  if (!nl_scan_running)
+    return 1;
+
   nl_parse_begin(&s, 1);
-  nl_request_dump(AF_UNSPEC, RTM_GETROUTE);
-  while (h = nl_get_scan())
+  s.pool = nl_scan_linpool;
+
+  for (; limit; limit--)
+  {
+    if (!(h = nl_get_scan()))
+    {
+      nl_scan_running = 0;
+      break;
+    }
+
     if (h->nlmsg_type == RTM_NEWROUTE || h->nlmsg_type == RTM_DELROUTE)
       nl_parse_route(&s, h);
     else
       log(L_DEBUG "nl_scan_fire: Unknown packet received (type=%d)", h->nlmsg_type);
+  }
+
   nl_parse_end(&s);
+
+  if (nl_scan_running)
+    return 0;
+
+  nl_nh_prune();
+  return 1;
+}
+
+void
+krt_do_scan(struct krt_proto *p)
+{
+  krt_do_scan_begin(p);
+  krt_do_scan_step(p, ~0U);
 }
 
 /*
@@ -1933,10 +2548,12 @@ nl_async_hook(sock *sk, uint size UNUSED)
 	{
 	  /*
 	   *  Netlink reports some packets have been thrown away.
-	   *  One day we might react to it by asking for route table
-	   *  scan in near future.
+	   *  Interface state is maintained from async notifications,
+	   *  so we ask for interface scan in near future. Routes are
+	   *  resynced on next periodic route scan.
 	   */
 	  log(L_WARN "Kernel dropped some netlink messages, will resync on next scan.");
+	  kif_request_scan();
 	  return 1;	/* More data are likely to be ready */
 	}
       else if (errno != EWOULDBLOCK)
@@ -1971,6 +2588,25 @@ nl_async_err_hook(sock *sk, int e UNUSED)
   nl_async_hook(sk, 0);
 }
 
+/* Socket receive buffer may only grow, as it is shared by all protocols */
+static void
+nl_async_set_rcvbuf(uint size)
+{
+  static uint current;
+
+  if (!nl_async_sk || (size <= current))
+    return;
+
+  if ((setsockopt(nl_async_sk->fd, SOL_SOCKET, SO_RCVBUFFORCE, &size, sizeof(size)) < 0) &&
+      (setsockopt(nl_async_sk->fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size)) < 0))
+  {
+    log(L_WARN "Netlink: Cannot set async receive buffer size: %m");
+    return;
+  }
+
+  current = size;
+}
+
 static void
 nl_open_async(void)
 {
@@ -2019,11 +2655,29 @@ nl_open_async(void)
  *	Interface to the UNIX krt module
  */
 
+static void
+nl_update_window(void)
+{
+  nl_window = NL_WINDOW_MAX;
+
+  HASH_WALK(nl_table_map, sys.hash_next, p)
+    nl_window = MIN(nl_window, p->sys.window);
+  HASH_WALK_END;
+}
+
 void
 krt_sys_io_init(void)
 {
   nl_linpool = lp_new_default(krt_pool);
+  nl_scan_linpool = lp_new_default(krt_pool);
   HASH_INIT(nl_table_map, krt_pool, 6);
+
+  HASH_INIT(nl_nh_hash, krt_pool, 6);
+  HASH_INIT(nl_nh_id_hash, krt_pool, 6);
+  idm_init(&nl_nh_idm, krt_pool, 64);
+
+  nl_batch.buf = xmalloc(NL_TX_SIZE);
+  nl_batch.event = ev_new_init(krt_pool, nl_flush_event, NULL);
 }
 
 int
@@ -2040,22 +2694,40 @@ krt_sys_start(struct krt_proto *p)
 
   HASH_INSERT2(nl_table_map, RTH, krt_pool, p);
 
+  p->sys.window = KRT_CF->sys.window;
+  nl_update_window();
+
   nl_open();
+  nl_open_req();
   nl_open_async();
 
+  if (KRT_CF->sys.rx_buffer)
+    nl_async_set_rcvbuf(KRT_CF->sys.rx_buffer);
+
   return 1;
 }
 
 void
 krt_sys_shutdown(struct krt_proto *p)
 {
+  nl_flush();
   HASH_REMOVE2(nl_table_map, RTH, krt_pool, p);
+  nl_update_window();
 }
 
 int
-krt_sys_reconfigure(struct krt_proto *p UNUSED, struct krt_config *n, struct krt_config *o)
+krt_sys_reconfigure(struct krt_proto *p, struct krt_config *n, struct krt_config *o)
 {
-  return (n->sys.table_id == o->sys.table_id) && (n->sys.metric == o->sys.metric);
+  if ((n->sys.table_id != o->sys.table_id) || (n->sys.metric != o->sys.metric))
+    return 0;
+
+  p->sys.window = n->sys.window;
+  nl_update_window();
+
+  if (n->sys.rx_buffer)
+    nl_async_set_rcvbuf(n->sys.rx_buffer);
+
+  return 1;
 }
 
 void
@@ -2063,6 +2735,9 @@ krt_sys_init_config(struct krt_config *cf)
 {
   cf->sys.table_id = RT_TABLE_MAIN;
   cf->sys.metric = 32;
+  cf->sys.window = 1024;
+  cf->sys.nexthops = 0;
+  cf->sys.rx_buffer = 0;
 }
 
 void
@@ -2070,6 +2745,9 @@ krt_sys_copy_config(struct krt_config *d, struct krt_config *s)
 {
   d->sys.table_id = s->sys.table_id;
   d->sys.metric = s->sys.metric;
+  d->sys.window = s->sys.window;
+  d->sys.nexthops = s->sys.nexthops;
+  d->sys.rx_buffer = s->sys.rx_buffer;
 }
 
 static const char *krt_metrics_names[KRT_METRICS_MAX] = {
@@ -255,6 +255,27 @@ sk_disable_mtu_disc6(sock *s)
   return 0;
 }
 
+static inline int
+sk_get_tcp_info_(sock *s, struct sk_tcp_info *info)
+{
+  struct tcp_info ti;
+  socklen_t len = sizeof(ti);
+
+  if (getsockopt(s->fd, SOL_TCP, TCP_INFO, &ti, &len) < 0)
+    ERR("TCP_INFO");
+
+  info->rtt = ti.tcpi_rtt;
+  info->rttvar = ti.tcpi_rttvar;
+  info->snd_cwnd = ti.tcpi_snd_cwnd;
+  info->snd_mss = ti.tcpi_snd_mss;
+  info->unacked = ti.tcpi_unacked;
+  info->retrans = ti.tcpi_retrans;
+  info->total_retrans = ti.tcpi_total_retrans;
+  info->rcv_space = ti.tcpi_rcv_space;
+
+  return 0;
+}
+
 int sk_priority_control = 7;
 
 static inline int
@@ -15,7 +15,7 @@
 #include <sys/time.h>
 
 #include "nest/bird.h"
-#include "proto/bfd/io.h"
+#include "lib/io-loop.h"
 
 #include "lib/buffer.h"
 #include "lib/lists.h"
@@ -24,6 +24,8 @@
 #include "lib/timer.h"
 #include "lib/socket.h"
 
+#ifdef USE_PTHREADS
+
 
 struct birdloop
 {
@@ -532,4 +534,4 @@ birdloop_main(void *arg)
   return NULL;
 }
 
-
+#endif /* USE_PTHREADS */
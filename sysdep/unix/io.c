@@ -38,12 +38,23 @@
 #include "lib/event.h"
 #include "lib/timer.h"
 #include "lib/string.h"
+#include "lib/histogram.h"
 #include "nest/iface.h"
+#include "nest/route.h"
+#include "nest/cli.h"
 #include "conf/conf.h"
 
 #include "sysdep/unix/unix.h"
 #include CONFIG_INCLUDE_SYSIO_H
 
+#ifdef CONFIG_EVENTFD
+#include <sys/eventfd.h>
+#endif
+
+#ifdef HAVE_EPOLL
+#include <sys/epoll.h>
+#endif
+
 /* Maximum number of calls of tx handler for one socket in one
  * poll iteration. Should be small enough to not monopolize CPU by
  * one protocol instance.
@@ -55,6 +66,10 @@
    this to gen small latencies */
 #define MAX_RX_STEPS 4
 
+/* Time budget for bulk work events (see ev_schedule_work()) in one poll
+   iteration. At least one such event is run in each iteration. */
+#define WORK_BUDGET (5 MS)
+
 
 /*
  *	Tracked Files
@@ -676,6 +691,77 @@ sk_set_md5_auth(sock *s, ip_addr local, ip_addr remote, struct iface *ifa, char
 { DUMMY; }
 #endif
 
+/**
+ * sk_get_tcp_info - get kernel state of TCP connection
+ * @s: connected TCP socket
+ * @info: structure to be filled
+ *
+ * Reads round-trip time, congestion window, retransmission counters and socket
+ * buffer sizes from the kernel. Not all systems provide TCP state, the function
+ * fails there.
+ *
+ * Result: 0 for success, -1 for an error.
+ */
+
+int
+sk_get_tcp_info(sock *s, struct sk_tcp_info *info)
+{
+  socklen_t len;
+  int val;
+
+  memset(info, 0, sizeof(struct sk_tcp_info));
+
+  len = sizeof(val);
+  if (getsockopt(s->fd, SOL_SOCKET, SO_SNDBUF, &val, &len) < 0)
+    ERR("SO_SNDBUF");
+  info->sndbuf = val;
+
+  len = sizeof(val);
+  if (getsockopt(s->fd, SOL_SOCKET, SO_RCVBUF, &val, &len) < 0)
+    ERR("SO_RCVBUF");
+  info->rcvbuf = val;
+
+  return sk_get_tcp_info_(s, info);
+}
+
+/**
+ * sk_grow_kernel_buffers - enlarge kernel socket buffers
+ * @s: socket
+ * @rcv: requested receive buffer size, 0 to keep
+ * @snd: requested send buffer size, 0 to keep
+ *
+ * Sets kernel socket buffers to given sizes, but only when they are larger
+ * than the current ones. Note that the kernel may cap the values and that on
+ * some systems (e.g. Linux) an explicit size disables automatic buffer tuning.
+ *
+ * Result: 0 for success, -1 for an error.
+ */
+
+int
+sk_grow_kernel_buffers(sock *s, uint rcv, uint snd)
+{
+  socklen_t len;
+  int val;
+
+  len = sizeof(val);
+  if (rcv && (getsockopt(s->fd, SOL_SOCKET, SO_RCVBUF, &val, &len) >= 0) && ((uint) val < rcv))
+  {
+    val = rcv;
+    if (setsockopt(s->fd, SOL_SOCKET, SO_RCVBUF, &val, sizeof(val)) < 0)
+      ERR("SO_RCVBUF");
+  }
+
+  len = sizeof(val);
+  if (snd && (getsockopt(s->fd, SOL_SOCKET, SO_SNDBUF, &val, &len) >= 0) && ((uint) val < snd))
+  {
+    val = snd;
+    if (setsockopt(s->fd, SOL_SOCKET, SO_SNDBUF, &val, sizeof(val)) < 0)
+      ERR("SO_SNDBUF");
+  }
+
+  return 0;
+}
+
 /**
  * sk_set_ipv6_checksum - specify IPv6 checksum offset for given socket
  * @s: socket
@@ -729,6 +815,10 @@ static list sock_list;
 static struct birdsock *current_sock;
 static struct birdsock *stored_sock;
 
+#ifdef HAVE_EPOLL
+static void io_epoll_remove(sock *s);
+#endif
+
 static inline sock *
 sk_next(sock *s)
 {
@@ -738,6 +828,16 @@ sk_next(sock *s)
     return SKIP_BACK(sock, n, s->n.next);
 }
 
+/* Report changed sizes of allocated buffers to the pool */
+static void
+sk_account_bufs(sock *s)
+{
+  uint size = (s->rbuf_alloc ? s->rbsize : 0) + (s->tbuf_alloc ? s->tbsize : 0);
+
+  rmem_update(&s->r, (ssize_t) size - (ssize_t) s->bufs_size);
+  s->bufs_size = size;
+}
+
 static void
 sk_alloc_bufs(sock *s)
 {
@@ -747,6 +847,7 @@ sk_alloc_bufs(sock *s)
   if (!s->tbuf && s->tbsize)
     s->tbuf = s->tbuf_alloc = xmalloc(s->tbsize);
   s->tpos = s->ttx = s->tbuf;
+  sk_account_bufs(s);
 }
 
 static void
@@ -762,6 +863,12 @@ sk_free_bufs(sock *s)
     xfree(s->tbuf_alloc);
     s->tbuf = s->tbuf_alloc = NULL;
   }
+  if (s->txb)
+  {
+    xfree(s->txb);
+    s->txb = NULL;
+  }
+  sk_account_bufs(s);
 }
 
 #ifdef HAVE_LIBSSH
@@ -815,6 +922,10 @@ sk_free(resource *r)
     if (s == stored_sock)
       stored_sock = sk_next(s);
     rem_node(&s->n);
+
+#ifdef HAVE_EPOLL
+    io_epoll_remove(s);
+#endif
   }
 
   if (s->type != SK_SSH && s->type != SK_SSH_ACTIVE)
@@ -831,10 +942,13 @@ sk_set_rbsize(sock *s, uint val)
   if (s->rbsize == val)
     return;
 
+  /* Keep pending data in stream sockets as long as they fit */
+  uint used = MIN(s->rpos - s->rbuf, val);
+
   s->rbsize = val;
-  xfree(s->rbuf_alloc);
-  s->rbuf_alloc = xmalloc(val);
-  s->rpos = s->rbuf = s->rbuf_alloc;
+  s->rbuf = s->rbuf_alloc = xrealloc(s->rbuf_alloc, val);
+  s->rpos = s->rbuf + used;
+  sk_account_bufs(s);
 }
 
 void
@@ -851,6 +965,7 @@ sk_set_tbsize(sock *s, uint val)
   s->tbuf = s->tbuf_alloc = xrealloc(s->tbuf_alloc, val);
   s->tpos = s->tbuf + (s->tpos - old_tbuf);
   s->ttx  = s->tbuf + (s->ttx  - old_tbuf);
+  sk_account_bufs(s);
 }
 
 void
@@ -867,6 +982,13 @@ sk_reallocate(sock *s)
   sk_alloc_bufs(s);
 }
 
+static size_t
+sk_memsize(resource *r)
+{
+  sock *s = (sock *) r;
+  return sizeof(sock) + ALLOC_OVERHEAD + s->bufs_size;
+}
+
 static void
 sk_dump(resource *r)
 {
@@ -891,7 +1013,7 @@ static struct resclass sk_class = {
   sk_free,
   sk_dump,
   NULL,
-  NULL
+  sk_memsize
 };
 
 /**
@@ -913,6 +1035,7 @@ sock_new(pool *p)
   // s->saddr = s->daddr = IPA_NONE;
   s->tos = s->priority = s->ttl = -1;
   s->fd = -1;
+  s->index = -1;
   return s;
 }
 
@@ -1631,6 +1754,266 @@ sk_recvmsg(sock *s)
   return rv;
 }
 
+#ifdef CONFIG_RECVMMSG
+
+#define SK_RX_BATCH	16
+#define SK_RX_BATCH_BUF	256	/* Max rbsize for batched receive */
+
+/*
+ * Receive up to SK_RX_BATCH datagrams with one recvmmsg() and call rx_hook for
+ * each of them, as if they were received by sk_recvmsg() one by one. Returns 1
+ * if the socket may have more datagrams pending.
+ */
+static int
+sk_read_batch(sock *s)
+{
+  byte data[SK_RX_BATCH][SK_RX_BATCH_BUF];
+  byte cmsg_buf[SK_RX_BATCH][CMSG_RX_SPACE];
+  sockaddr src[SK_RX_BATCH];
+  struct iovec iov[SK_RX_BATCH];
+  struct mmsghdr msgs[SK_RX_BATCH];
+
+  for (uint i = 0; i < SK_RX_BATCH; i++)
+  {
+    iov[i] = (struct iovec) { data[i], s->rbsize };
+    msgs[i].msg_len = 0;
+    msgs[i].msg_hdr = (struct msghdr) {
+      .msg_name = &src[i].sa,
+      .msg_namelen = sizeof(src[i]),
+      .msg_iov = &iov[i],
+      .msg_iovlen = 1,
+      .msg_control = cmsg_buf[i],
+      .msg_controllen = sizeof(cmsg_buf[i]),
+      .msg_flags = 0
+    };
+  }
+
+  int n = recvmmsg(s->fd, msgs, SK_RX_BATCH, 0, NULL);
+
+  if (n < 0)
+  {
+    if (errno != EINTR && errno != EAGAIN)
+      s->err_hook(s, errno);
+    return 0;
+  }
+
+  for (int i = 0; i < n; i++)
+  {
+    uint len = msgs[i].msg_len;
+    memcpy(s->rbuf, data[i], len);
+
+    sockaddr_read(&src[i], s->af, &s->faddr, NULL, &s->fport);
+    sk_process_cmsgs(s, &msgs[i].msg_hdr);
+
+    if (msgs[i].msg_hdr.msg_flags & MSG_TRUNC)
+      s->flags |= SKF_TRUNCATED;
+    else
+      s->flags &= ~SKF_TRUNCATED;
+
+    s->rpos = s->rbuf + len;
+    s->rx_hook(s, len);
+  }
+
+  /* Partial batch means the socket queue was drained */
+  return n == SK_RX_BATCH;
+}
+
+#endif
+
+
+#ifdef CONFIG_SENDMMSG
+
+#define SK_TX_BATCH	16
+
+/*
+ * Datagrams queued between sk_tx_batch_begin() and sk_tx_batch_end() are sent
+ * with one sendmmsg() when the queue is full or the batch ends. Datagrams the
+ * kernel did not accept stay queued and are sent from the TX path before the
+ * regular TX buffer, so the order and the flow control of sk_send_to() (return
+ * value 0 and tx_hook) are kept.
+ */
+struct sk_tx_batch {
+  uint active;				/* Between sk_tx_batch_begin() and sk_tx_batch_end() */
+  uint first, cnt;			/* Queued datagrams, in slots first .. first+cnt-1 */
+  uint size;				/* Size of one slot */
+  struct {
+    ip_addr daddr;
+    uint dport, len;
+  } dg[SK_TX_BATCH];
+  byte data[];				/* SK_TX_BATCH slots of @size bytes */
+};
+
+static inline int
+sk_tx_pending(sock *s)
+{
+  return (s->ttx != s->tpos) || (s->txb && s->txb->cnt);
+}
+
+static int
+sk_tx_batch_flush(sock *s)
+{
+  struct sk_tx_batch *b = s->txb;
+  struct mmsghdr msgs[SK_TX_BATCH];
+  struct iovec iov[SK_TX_BATCH];
+  byte cmsg_buf[SK_TX_BATCH][CMSG_TX_SPACE];
+  sockaddr dst[SK_TX_BATCH];
+
+  if (!b || !b->cnt)
+    return 1;
+
+  for (uint i = 0; i < b->cnt; i++)
+  {
+    uint k = b->first + i;
+    sockaddr_fill(&dst[i], s->af, b->dg[k].daddr, s->iface, b->dg[k].dport);
+    iov[i] = (struct iovec) { b->data + k * b->size, b->dg[k].len };
+    msgs[i].msg_len = 0;
+    msgs[i].msg_hdr = (struct msghdr) {
+      .msg_name = &dst[i].sa,
+      .msg_namelen = SA_LEN(dst[i]),
+      .msg_iov = &iov[i],
+      .msg_iovlen = 1
+    };
+
+    if (s->flags & SKF_PKTINFO)
+      sk_prepare_cmsgs(s, &msgs[i].msg_hdr, cmsg_buf[i], sizeof(cmsg_buf[i]));
+  }
+
+  int n = sendmmsg(s->fd, msgs, b->cnt, 0);
+
+  if (n < 0)
+  {
+    if (errno != EINTR && errno != EAGAIN)
+    {
+      b->first = b->cnt = 0;
+      s->err_hook(s, errno);
+      return -1;
+    }
+    return 0;
+  }
+
+  b->first += n;
+  b->cnt -= n;
+
+  if (b->cnt)
+    return 0;
+
+  b->first = 0;
+  return 1;
+}
+
+static int
+sk_tx_batch_queue(sock *s, uint len)
+{
+  struct sk_tx_batch *b = s->txb;
+  int e = 1;
+
+  if (b->first + b->cnt == SK_TX_BATCH)
+  {
+    e = sk_tx_batch_flush(s);
+    if (e < 0)
+      return e;
+
+    /* Keep the rest at the start, to make room */
+    if (b->cnt && b->first)
+    {
+      memmove(b->dg, b->dg + b->first, b->cnt * sizeof(b->dg[0]));
+      memmove(b->data, b->data + b->first * b->size, b->cnt * b->size);
+      b->first = 0;
+    }
+
+    /* Nothing sent, leave the datagram in the TX buffer as sk_send_to() would */
+    if (b->cnt == SK_TX_BATCH)
+    {
+      s->ttx = s->tbuf;
+      s->tpos = s->tbuf + len;
+      return 0;
+    }
+  }
+
+  uint k = b->first + b->cnt++;
+  b->dg[k].daddr = s->daddr;
+  b->dg[k].dport = s->dport;
+  b->dg[k].len = len;
+  memcpy(b->data + k * b->size, s->tbuf, len);
+
+  /* Zero when the kernel did not take everything, the caller should wait */
+  return e;
+}
+
+/**
+ * sk_tx_batch_begin - start queueing datagrams
+ * @s: UDP or IP socket
+ *
+ * Datagrams passed to sk_send_to() are queued and sent together by
+ * sk_tx_batch_end(), or earlier when there are too many of them. It is
+ * intended for protocols sending many datagrams at once, like routing table
+ * updates. Until the batch ends, sk_send_to() returns 1 for queued datagrams
+ * and 0 when the caller should wait for tx_hook, as usual.
+ */
+void
+sk_tx_batch_begin(sock *s)
+{
+  if ((s->type != SK_UDP) && (s->type != SK_IP))
+    return;
+
+  if (s->txb && !s->txb->cnt && (s->txb->size != s->tbsize))
+  {
+    xfree(s->txb);
+    s->txb = NULL;
+  }
+
+  if (!s->txb)
+  {
+    s->txb = xmalloc(sizeof(struct sk_tx_batch) + SK_TX_BATCH * s->tbsize);
+    s->txb->first = s->txb->cnt = 0;
+    s->txb->size = s->tbsize;
+  }
+
+  /* Regular TX buffer was resized while the batch is still pending */
+  if (s->txb->size != s->tbsize)
+    return;
+
+  s->txb->active = 1;
+}
+
+/**
+ * sk_tx_batch_end - send queued datagrams
+ * @s: socket
+ *
+ * Returns a value like sk_send(): 1 when everything was sent, 0 when the rest
+ * will be sent later and tx_hook called, or negative value on error.
+ */
+int
+sk_tx_batch_end(sock *s)
+{
+  struct sk_tx_batch *b = s->txb;
+
+  if (!b || !b->active)
+    return sk_tx_buffer_empty(s);
+
+  b->active = 0;
+
+  int e = sk_tx_batch_flush(s);
+
+  /* Do not keep the buffers for idle sockets */
+  if ((e > 0) && !sk_tx_pending(s))
+  {
+    xfree(s->txb);
+    s->txb = NULL;
+  }
+
+  return e;
+}
+
+#else
+
+static inline int sk_tx_pending(sock *s) { return s->ttx != s->tpos; }
+
+void sk_tx_batch_begin(sock *s UNUSED) { }
+int sk_tx_batch_end(sock *s) { return sk_tx_buffer_empty(s); }
+
+#endif
+
 
 static inline void reset_tx_buffer(sock *s) { s->ttx = s->tpos = s->tbuf; }
 
@@ -1689,6 +2072,12 @@ sk_maybe_write(sock *s)
   case SK_UDP:
   case SK_IP:
     {
+#ifdef CONFIG_SENDMMSG
+      /* Datagrams queued in a batch go first */
+      if ((e = sk_tx_batch_flush(s)) <= 0)
+	return e;
+#endif
+
       if (s->tbuf == s->tpos)
 	return 1;
 
@@ -1770,6 +2159,11 @@ sk_send_to(sock *s, unsigned len, ip_addr addr, unsigned port)
   if (port)
     s->dport = port;
 
+#ifdef CONFIG_SENDMMSG
+  if (s->txb && s->txb->active && sk_tx_buffer_empty(s))
+    return sk_tx_batch_queue(s, len);
+#endif
+
   s->ttx = s->tbuf;
   s->tpos = s->tbuf + len;
   return sk_maybe_write(s);
@@ -1897,6 +2291,11 @@ sk_read(sock *s, int revents)
 
   default:
     {
+#ifdef CONFIG_RECVMMSG
+      if ((s->flags & SKF_BATCH_RX) && (s->rbsize <= SK_RX_BATCH_BUF))
+	return sk_read_batch(s);
+#endif
+
       int e = sk_recvmsg(s);
 
       if (e < 0)
@@ -1952,7 +2351,7 @@ sk_write(sock *s)
 #endif
 
   default:
-    if (s->ttx != s->tpos && sk_maybe_write(s) > 0)
+    if (sk_tx_pending(s) && sk_maybe_write(s) > 0)
     {
       if (s->tx_hook)
 	s->tx_hook(s);
@@ -1999,6 +2398,113 @@ sk_dump_all(void)
 }
 
 
+/*
+ *	Cross-thread event queues
+ */
+
+static int
+ev_queue_rx_hook(sock *sk, uint len UNUSED)
+{
+  ev_queue *q = sk->data;
+
+#ifdef CONFIG_EVENTFD
+  u64 cnt;
+  if ((read(sk->fd, &cnt, sizeof(cnt)) < 0) && (errno != EAGAIN) && (errno != EINTR))
+    die("ev_queue: read: %m");
+#else
+  char buf[64];
+  while (read(sk->fd, buf, sizeof(buf)) > 0)
+    ;
+#endif
+
+  ev_queue_run(q);
+  return 0;
+}
+
+static void
+ev_queue_err_hook(sock *sk UNUSED, int err)
+{
+  log(L_ERR "Event queue wakeup error: %M", err);
+}
+
+/**
+ * ev_queue_new - create a cross-thread event queue
+ * @p: resource pool
+ *
+ * This function creates an event queue (see ev_send()) consumed by the main
+ * I/O loop. Its wakeup fd (an eventfd, or a pipe where not available) is
+ * registered as a socket, so the queue is run whenever the fd is readable.
+ * The queue is freed together with the pool @p, no more events may be sent
+ * to it afterwards.
+ */
+ev_queue *
+ev_queue_new(pool *p)
+{
+  ev_queue *q = mb_allocz(p, sizeof(ev_queue));
+  int rfd, wfd;
+
+#ifdef CONFIG_EVENTFD
+  rfd = wfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (rfd < 0)
+    die("eventfd: %m");
+#else
+  int pfds[2];
+  if (pipe(pfds) < 0)
+    die("pipe: %m");
+
+  rfd = pfds[0];
+  wfd = pfds[1];
+  fcntl(rfd, F_SETFL, O_NONBLOCK);
+  fcntl(wfd, F_SETFL, O_NONBLOCK);
+#endif
+
+  sock *sk = q->rsk = sk_new(p);
+  sk->type = SK_MAGIC;
+  sk->rx_hook = ev_queue_rx_hook;
+  sk->err_hook = ev_queue_err_hook;
+  sk->fd = rfd;
+  sk->data = q;
+  if (sk_open(sk) < 0)
+    die("ev_queue: sk_open failed");
+
+  /* The write end is not added to any event loop */
+  if (wfd != rfd)
+  {
+    sk = q->wsk = sk_new(p);
+    sk->type = SK_MAGIC;
+    sk->fd = wfd;
+    sk->data = q;
+    sk->flags = SKF_THREAD;
+    if (sk_open(sk) < 0)
+      die("ev_queue: sk_open failed");
+  }
+
+  q->wfd = wfd;
+  return q;
+}
+
+/**
+ * ev_queue_kick - wake up the consumer of an event queue
+ * @q: an event queue
+ *
+ * This function is called by ev_send() from any thread when the first event is
+ * sent to an empty queue @q.
+ */
+void
+ev_queue_kick(ev_queue *q)
+{
+#ifdef CONFIG_EVENTFD
+  u64 cnt = 1;
+#else
+  u8 cnt = 1;
+#endif
+
+  /* Full pipe or overflowing counter means a pending wakeup anyway */
+  if ((write(q->wfd, &cnt, sizeof(cnt)) < 0) && (errno != EAGAIN) && (errno != EINTR))
+    die("ev_queue: write: %m");
+}
+
+
 /*
  *	Internal event log and watchdog
  */
@@ -2011,6 +2517,7 @@ struct event_log_entry
   void *data;
   btime timestamp;
   btime duration;
+  uint kind;
 };
 
 static struct event_log_entry event_log[EVENT_LOG_LENGTH];
@@ -2019,6 +2526,69 @@ static int event_log_pos, event_log_num, watchdog_active;
 static btime last_time;
 static btime loop_time;
 
+/* Latency statistics per hook kind, with the slowest hook seen */
+struct io_latency
+{
+  struct histogram hist;
+  void *max_hook;
+  void *max_data;
+};
+
+static struct io_latency io_latency[IO_HOOK_MAX];
+
+const char * const io_hook_kind_names[IO_HOOK_MAX] = {
+  [IO_HOOK_EVENT] = "events",
+  [IO_HOOK_TABLE] = "table events",
+  [IO_HOOK_TIMER] = "timers",
+  [IO_HOOK_RX] = "socket rx",
+  [IO_HOOK_TX] = "socket tx",
+  [IO_HOOK_ASYNC] = "signals",
+  [IO_HOOK_TIMER_DELAY] = "timer delay",
+  [IO_HOOK_LOOP] = "loop cycles",
+};
+
+static void
+io_log_latency(uint kind, btime duration, void *hook, void *data)
+{
+  struct io_latency *l = &io_latency[kind];
+
+  if (duration < 0)
+    duration = 0;
+
+  if (!l->hist.count || ((u64) duration > l->hist.max))
+  {
+    l->max_hook = hook;
+    l->max_data = data;
+  }
+
+  histogram_add(&l->hist, duration);
+}
+
+/**
+ * io_log_delay - record latency not related to a particular hook
+ * @kind: latency kind, like %IO_HOOK_TIMER_DELAY
+ * @delay: measured time
+ */
+void
+io_log_delay(uint kind, btime delay)
+{
+  io_log_latency(kind, delay, NULL, NULL);
+}
+
+/**
+ * io_latency_histogram - get latency statistics of main loop hooks
+ * @kind: hook kind
+ *
+ * Returns the histogram of durations of hooks of the given kind (in us). Note
+ * that durations of hooks are tracked only with latency debugging enabled,
+ * while timer delays and loop cycles are tracked always.
+ */
+const struct histogram *
+io_latency_histogram(uint kind)
+{
+  return &io_latency[kind].hist;
+}
+
 static void
 io_update_time(void)
 {
@@ -2040,6 +2610,7 @@ io_update_time(void)
   if (event_open)
   {
     event_open->duration = last_time - event_open->timestamp;
+    io_log_latency(event_open->kind, event_open->duration, event_open->hook, event_open->data);
 
     if (event_open->duration > config->latency_limit)
       log(L_WARN "Event 0x%p 0x%p took %d ms",
@@ -2053,23 +2624,30 @@ io_update_time(void)
  * io_log_event - mark approaching event into event log
  * @hook: event hook address
  * @data: event data address
+ * @kind: kind of the hook, see &io_hook_kind
  *
  * Store info (hook, data, timestamp) about the following internal event into
  * a circular event log (@event_log). When latency tracking is enabled, the log
- * entry is kept open (in @event_open) so the duration can be filled later.
+ * entry is kept open (in @event_open) so the duration can be filled later and
+ * accounted into latency statistics of the hook kind.
  */
 void
-io_log_event(void *hook, void *data)
+io_log_event(void *hook, void *data, uint kind)
 {
   if (config->latency_debug)
     io_update_time();
 
+  /* Table maintenance is run as a regular event */
+  if ((kind == IO_HOOK_EVENT) && (hook == rt_event))
+    kind = IO_HOOK_TABLE;
+
   struct event_log_entry *en = event_log + event_log_pos;
 
   en->hook = hook;
   en->data = data;
   en->timestamp = last_time;
   en->duration = 0;
+  en->kind = kind;
 
   event_log_num++;
   event_log_pos++;
@@ -2100,6 +2678,34 @@ io_log_dump(void)
   }
 }
 
+void
+cmd_show_loop_latency(void)
+{
+  cli_msg(-1026, "%-14s %10s %8s %8s %8s %8s  %s", "Kind", "Count",
+	  "Avg us", "p50 us", "p99 us", "Max us", "Slowest hook");
+
+  for (uint i = 0; i < IO_HOOK_MAX; i++)
+  {
+    struct io_latency *l = &io_latency[i];
+    const struct histogram *h = &l->hist;
+
+    if (l->max_hook)
+      cli_msg(-1026, "%-14s %10lu %8lu %8lu %8lu %8lu  0x%p 0x%p",
+	      io_hook_kind_names[i], h->count, h->sum / (h->count ?: 1),
+	      histogram_quantile(h, 500), histogram_quantile(h, 990), h->max,
+	      l->max_hook, l->max_data);
+    else
+      cli_msg(-1026, "%-14s %10lu %8lu %8lu %8lu %8lu",
+	      io_hook_kind_names[i], h->count, h->sum / (h->count ?: 1),
+	      histogram_quantile(h, 500), histogram_quantile(h, 990), h->max);
+  }
+
+  if (!config->latency_debug)
+    cli_msg(-1026, "Durations of hooks are tracked with debug latency enabled");
+
+  cli_msg(0, "");
+}
+
 void
 watchdog_sigalrm(int sig UNUSED)
 {
@@ -2146,6 +2752,8 @@ watchdog_stop(void)
   }
 
   btime duration = last_time - loop_time;
+  io_log_latency(IO_HOOK_LOOP, duration, NULL, NULL);
+
   if (duration > config->watchdog_warning)
     log(L_WARN "I/O loop cycle took %d ms for %d events",
 	(int) (duration TO_MS), event_log_num);
@@ -2161,6 +2769,7 @@ io_init(void)
 {
   init_list(&sock_list);
   init_list(&global_event_list);
+  init_list(&global_work_list);
   krt_io_init();
   // XXX init_times();
   // XXX update_times();
@@ -2173,12 +2782,107 @@ io_init(void)
 static int short_loops = 0;
 #define SHORT_LOOP_MAX 10
 
+/* End of time budget for work events, 0 outside of them */
+static btime work_end;
+
+/**
+ * ev_work_yield - check time budget of work events
+ *
+ * Long-running work events (see ev_schedule_work()) call this function after
+ * each chunk of work. It returns 1 when the time budget for work events in the
+ * current loop iteration is spent, so the event should save its state,
+ * reschedule itself and return. Outside of work events it always returns 1.
+ */
+int
+ev_work_yield(void)
+{
+  struct timespec ts;
+
+  if (!work_end)
+    return 1;
+
+  if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0)
+    die("clock_gettime: %m");
+
+  return (ts.tv_sec S + ts.tv_nsec NS) >= work_end;
+}
+
+/* Run events and timers, return poll timeout in milliseconds */
+static int
+io_loop_prepare(int *events)
+{
+  int poll_tout, timeout;
+  timer *t;
+
+  times_update(&main_timeloop);
+  *events = ev_run_list(&global_event_list);
+  timers_fire(&main_timeloop);
+  io_close_event();
+
+  /* Bulk work is run for a limited time, then sockets are polled */
+  work_end = current_time() + WORK_BUDGET;
+  while (ev_run_list_limited(&global_work_list, 1) && !ev_work_yield())
+    ;
+  work_end = 0;
+  io_close_event();
+
+  log_flush();
+
+  *events = !EMPTY_LIST(global_event_list) || !EMPTY_LIST(global_work_list);
+
+  // FIXME
+  poll_tout = (*events ? 0 : 3000); /* Time in milliseconds */
+  if (t = timers_first(&main_timeloop))
+  {
+    times_update(&main_timeloop);
+    timeout = (tm_remains(t) TO_MS) + 1;
+    poll_tout = MIN(poll_tout, timeout);
+  }
+
+  return poll_tout;
+}
+
+/* Handle signals, return 1 if any was handled */
+static int
+io_loop_async(void)
+{
+  /*
+   * Yes, this is racy. But even if the signal comes before this test
+   * and entering poll(), it gets caught on the next timer tick.
+   */
+
+  if (async_config_flag)
+  {
+    io_log_event(async_config, NULL, IO_HOOK_ASYNC);
+    async_config();
+    async_config_flag = 0;
+    return 1;
+  }
+  if (async_dump_flag)
+  {
+    io_log_event(async_dump, NULL, IO_HOOK_ASYNC);
+    async_dump();
+    async_dump_flag = 0;
+    return 1;
+  }
+  if (async_shutdown_flag)
+  {
+    io_log_event(async_shutdown, NULL, IO_HOOK_ASYNC);
+    async_shutdown();
+    async_shutdown_flag = 0;
+    return 1;
+  }
+
+  return 0;
+}
+
+#ifndef HAVE_EPOLL
+
 void
 io_loop(void)
 {
-  int poll_tout, timeout;
+  int poll_tout;
   int nfds, events, pout;
-  timer *t;
   sock *s;
   node *n;
   int fdmax = 256;
@@ -2187,19 +2891,7 @@ io_loop(void)
   watchdog_start1();
   for(;;)
     {
-      times_update(&main_timeloop);
-      events = ev_run_list(&global_event_list);
-      timers_fire(&main_timeloop);
-      io_close_event();
-
-      // FIXME
-      poll_tout = (events ? 0 : 3000); /* Time in milliseconds */
-      if (t = timers_first(&main_timeloop))
-      {
-	times_update(&main_timeloop);
-	timeout = (tm_remains(t) TO_MS) + 1;
-	poll_tout = MIN(poll_tout, timeout);
-      }
+      poll_tout = io_loop_prepare(&events);
 
       nfds = 0;
       WALK_LIST(n, sock_list)
@@ -2211,7 +2903,7 @@ io_loop(void)
 	      pfd[nfds].fd = s->fd;
 	      pfd[nfds].events |= POLLIN;
 	    }
-	  if (s->tx_hook && s->ttx != s->tpos)
+	  if (s->tx_hook && sk_tx_pending(s))
 	    {
 	      pfd[nfds].fd = s->fd;
 	      pfd[nfds].events |= POLLOUT;
@@ -2231,32 +2923,12 @@ io_loop(void)
 	    }
 	}
 
-      /*
-       * Yes, this is racy. But even if the signal comes before this test
-       * and entering poll(), it gets caught on the next timer tick.
-       */
+      if (io_loop_async())
+	continue;
 
-      if (async_config_flag)
-	{
-	  io_log_event(async_config, NULL);
-	  async_config();
-	  async_config_flag = 0;
-	  continue;
-	}
-      if (async_dump_flag)
-	{
-	  io_log_event(async_dump, NULL);
-	  async_dump();
-	  async_dump_flag = 0;
-	  continue;
-	}
-      if (async_shutdown_flag)
-	{
-	  io_log_event(async_shutdown, NULL);
-	  async_shutdown();
-	  async_shutdown_flag = 0;
-	  continue;
-	}
+      /* Nothing else to do, give unused memory back */
+      if (!events)
+	slab_reclaim();
 
       /* And finally enter poll() to find active sockets */
       watchdog_stop();
@@ -2293,7 +2965,7 @@ io_loop(void)
 		do
 		  {
 		    steps--;
-		    io_log_event(s->rx_hook, s->data);
+		    io_log_event(s->rx_hook, s->data, IO_HOOK_RX);
 		    e = sk_read(s, pfd[s->index].revents);
 		    if (s != current_sock)
 		      goto next;
@@ -2305,7 +2977,7 @@ io_loop(void)
 		do
 		  {
 		    steps--;
-		    io_log_event(s->tx_hook, s->data);
+		    io_log_event(s->tx_hook, s->data, IO_HOOK_TX);
 		    e = sk_write(s);
 		    if (s != current_sock)
 		      goto next;
@@ -2338,7 +3010,7 @@ io_loop(void)
 	      if (!s->fast_rx && (pfd[s->index].revents & POLLIN) && s->rx_hook)
 		{
 		  count++;
-		  io_log_event(s->rx_hook, s->data);
+		  io_log_event(s->rx_hook, s->data, IO_HOOK_RX);
 		  sk_read(s, pfd[s->index].revents);
 		  if (s != current_sock)
 		    goto next2;
@@ -2361,6 +3033,223 @@ io_loop(void)
     }
 }
 
+#else
+
+/*
+ * Main loop with epoll(7) backend. Sockets stay registered in the epoll
+ * instance, their registrations are updated only when requested events change
+ * (rx_hook set or reset, TX data pending). Only ready sockets are dispatched.
+ * These are kept in ep_ready[] during dispatch, sk_free() resets the entry of a
+ * freed socket, its index there is kept in s->index. The current_sock is set
+ * for call_rx_hook().
+ */
+
+static int epoll_fd = -1;
+static struct epoll_event *ep_events;
+static sock **ep_ready;
+static int *ep_revents;
+static int ep_ready_num;
+static int ep_max;
+
+static inline int
+io_epoll_revents(u32 ev)
+{
+  return ((ev & EPOLLIN) ? POLLIN : 0) | ((ev & EPOLLOUT) ? POLLOUT : 0) |
+    ((ev & EPOLLHUP) ? POLLHUP : 0) | ((ev & EPOLLERR) ? POLLERR : 0);
+}
+
+static void
+io_epoll_update(sock *s)
+{
+  u32 events = (s->rx_hook ? EPOLLIN : 0) |
+    ((s->tx_hook && sk_tx_pending(s)) ? EPOLLOUT : 0);
+
+  if (events == s->ep_events)
+    return;
+
+  struct epoll_event ev = { .events = events, .data.ptr = s };
+  int op = !s->ep_events ? EPOLL_CTL_ADD : (events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL);
+  int rv = epoll_ctl(epoll_fd, op, s->fd, &ev);
+
+  /* The fd may have been replaced or closed behind our back */
+  if ((rv < 0) && (errno == ENOENT) && (op == EPOLL_CTL_MOD))
+    rv = epoll_ctl(epoll_fd, EPOLL_CTL_ADD, s->fd, &ev);
+  else if ((rv < 0) && (errno == EEXIST))
+    rv = epoll_ctl(epoll_fd, EPOLL_CTL_MOD, s->fd, &ev);
+  else if ((rv < 0) && (errno == ENOENT))
+    rv = 0;
+
+  if (rv < 0)
+    die("epoll_ctl: %m");
+
+  s->ep_events = events;
+}
+
+static void
+io_epoll_remove(sock *s)
+{
+  if ((s->index >= 0) && (s->index < ep_ready_num) && (ep_ready[s->index] == s))
+    ep_ready[s->index] = NULL;
+
+  if (s->ep_events)
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, s->fd, NULL);
+
+  s->ep_events = 0;
+  s->index = -1;
+}
+
+static void
+io_epoll_done(void)
+{
+  for (int i = 0; i < ep_ready_num; i++)
+    if (ep_ready[i])
+      ep_ready[i]->index = -1;
+
+  ep_ready_num = 0;
+  current_sock = NULL;
+}
+
+void
+io_loop(void)
+{
+  int poll_tout;
+  int nfds, events, pout;
+  sock *s;
+  node *n;
+
+  epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  if (epoll_fd < 0)
+    die("epoll_create1: %m");
+
+  ep_max = 256;
+  ep_events = xmalloc(ep_max * sizeof(struct epoll_event));
+  ep_ready = xmalloc(ep_max * sizeof(sock *));
+  ep_revents = xmalloc(ep_max * sizeof(int));
+
+  watchdog_start1();
+  for(;;)
+    {
+      poll_tout = io_loop_prepare(&events);
+
+      nfds = 0;
+      WALK_LIST(n, sock_list)
+	{
+	  s = SKIP_BACK(sock, n, n);
+	  io_epoll_update(s);
+	  nfds += !!s->ep_events;
+	}
+
+      if (nfds > ep_max)
+	{
+	  ep_max = MAX(nfds, 2 * ep_max);
+	  ep_events = xrealloc(ep_events, ep_max * sizeof(struct epoll_event));
+	  ep_ready = xrealloc(ep_ready, ep_max * sizeof(sock *));
+	  ep_revents = xrealloc(ep_revents, ep_max * sizeof(int));
+	}
+
+      if (io_loop_async())
+	continue;
+
+      /* Nothing else to do, give unused memory back */
+      if (!events)
+	slab_reclaim();
+
+      /* And finally enter epoll_wait() to find active sockets */
+      watchdog_stop();
+      pout = epoll_wait(epoll_fd, ep_events, ep_max, poll_tout);
+      watchdog_start();
+
+      if (pout < 0)
+	{
+	  if (errno == EINTR || errno == EAGAIN)
+	    continue;
+	  die("epoll_wait: %m");
+	}
+      if (pout)
+	{
+	  times_update(&main_timeloop);
+
+	  for (int i = 0; i < pout; i++)
+	    {
+	      s = ep_events[i].data.ptr;
+	      s->index = i;
+	      ep_ready[i] = s;
+	      ep_revents[i] = io_epoll_revents(ep_events[i].events);
+	    }
+	  ep_ready_num = pout;
+
+	  for (int i = 0; i < pout; i++)
+	    {
+	      int e;
+	      int steps;
+
+	      if (!(s = ep_ready[i]))
+		continue;
+
+	      current_sock = s;
+	      steps = MAX_STEPS;
+	      if (s->fast_rx && (ep_revents[i] & POLLIN) && s->rx_hook)
+		do
+		  {
+		    steps--;
+		    io_log_event(s->rx_hook, s->data, IO_HOOK_RX);
+		    e = sk_read(s, ep_revents[i]);
+		    if (s != ep_ready[i])
+		      goto next;
+		  }
+		while (e && s->rx_hook && steps);
+
+	      steps = MAX_STEPS;
+	      if (ep_revents[i] & POLLOUT)
+		do
+		  {
+		    steps--;
+		    io_log_event(s->tx_hook, s->data, IO_HOOK_TX);
+		    e = sk_write(s);
+		    if (s != ep_ready[i])
+		      goto next;
+		  }
+		while (e && steps);
+
+	    next: ;
+	    }
+
+	  short_loops++;
+	  if (events && (short_loops < SHORT_LOOP_MAX))
+	    {
+	      io_epoll_done();
+	      continue;
+	    }
+	  short_loops = 0;
+
+	  /* Sockets not handled due to MAX_RX_STEPS are reported again by epoll_wait() */
+	  int count = 0;
+	  for (int i = 0; (i < pout) && (count < MAX_RX_STEPS); i++)
+	    {
+	      if (!(s = ep_ready[i]))
+		continue;
+
+	      current_sock = s;
+	      if (!s->fast_rx && (ep_revents[i] & POLLIN) && s->rx_hook)
+		{
+		  count++;
+		  io_log_event(s->rx_hook, s->data, IO_HOOK_RX);
+		  sk_read(s, ep_revents[i]);
+		  if (s != ep_ready[i])
+		    continue;
+		}
+
+	      if (ep_revents[i] & (POLLHUP | POLLERR))
+		sk_err(s, ep_revents[i]);
+	    }
+
+	  io_epoll_done();
+	}
+    }
+}
+
+#endif
+
 void
 test_old_bird(char *path)
 {
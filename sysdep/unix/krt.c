@@ -71,6 +71,9 @@ pool *krt_pool;
 static linpool *krt_filter_lp;
 static list krt_proto_list;
 
+/* Initial size of route maps [bytes], they grow as needed */
+#define KRT_MAP_SIZE	128
+
 void
 krt_io_init(void)
 {
@@ -99,6 +102,14 @@ kif_get_iface_config(struct iface *iface)
   return ic ?: &kif_default_iface;
 }
 
+static inline void
+kif_scan_timer_start(btime scan_time)
+{
+  /* Scan time of 0 means scan on startup only */
+  if (scan_time)
+    tm_start(kif_scan_timer, scan_time);
+}
+
 static void
 kif_scan(timer *t)
 {
@@ -115,14 +126,18 @@ kif_force_scan(void)
   if (kif_proto && ((kif_last_shot + 2 S) < current_time()))
     {
       kif_scan(kif_scan_timer);
-      tm_start(kif_scan_timer, ((struct kif_config *) kif_proto->p.cf)->scan_time);
+      kif_scan_timer_start(((struct kif_config *) kif_proto->p.cf)->scan_time);
     }
 }
 
+/*
+ * Also used on loss of asynchronous notifications, so it must work even if
+ * periodic scanning is disabled (scan time 0) and the timer is not active.
+ */
 void
 kif_request_scan(void)
 {
-  if (kif_proto && (kif_scan_timer->expires > (current_time() + 1 S)))
+  if (kif_proto && (!tm_active(kif_scan_timer) || (kif_scan_timer->expires > (current_time() + 1 S))))
     tm_start(kif_scan_timer, 1 S);
 }
 
@@ -146,7 +161,7 @@ kif_start(struct proto *P)
   /* Start periodic interface scanning */
   kif_scan_timer = tm_new_init(P->pool, kif_scan, p, KIF_CF->scan_time, 0);
   kif_scan(kif_scan_timer);
-  tm_start(kif_scan_timer, KIF_CF->scan_time);
+  kif_scan_timer_start(KIF_CF->scan_time);
 
   return PS_UP;
 }
@@ -177,7 +192,7 @@ kif_reconfigure(struct proto *p, struct proto_config *new)
       tm_stop(kif_scan_timer);
       kif_scan_timer->recurrent = n->scan_time;
       kif_scan(kif_scan_timer);
-      tm_start(kif_scan_timer, n->scan_time);
+      kif_scan_timer_start(n->scan_time);
     }
 
   if (!EMPTY_LIST(o->iface_list) || !EMPTY_LIST(n->iface_list))
@@ -312,6 +327,55 @@ krt_learn_announce_delete(struct krt_proto *p, net *n)
   rte_update(&p->p, n->n.addr, NULL);
 }
 
+/*
+ * Learned routes are kept up to date incrementally. Both scan and async
+ * changes update the private table and the best route of the affected network
+ * immediately. Routes seen during a scan are stamped with the scan epoch, and
+ * their number is compared with the number of learned routes at the end of
+ * the scan. Only when some route was not seen (it disappeared without an async
+ * notification) or a reload was requested, the whole table is walked.
+ */
+
+static void
+krt_learn_select(struct krt_proto *p, net *n, int force)
+{
+  rte *g, **gg, *best = NULL, **bestp = NULL, *old_best = NULL;
+
+  for (gg = &n->routes; g = *gg; gg = &g->next)
+  {
+    if (g->u.krt.best)
+      old_best = g;
+
+    if (!best || best->u.krt.metric > g->u.krt.metric)
+    {
+      best = g;
+      bestp = gg;
+    }
+
+    g->u.krt.best = 0;
+  }
+
+  if (best)
+  {
+    best->u.krt.best = 1;
+    *bestp = best->next;
+    best->next = n->routes;
+    n->routes = best;
+  }
+
+  if ((best != old_best) || force)
+  {
+    DBG("%N: distributing change\n", n->n.addr);
+    if (best)
+      krt_learn_announce_update(p, best);
+    else if (old_best)
+      krt_learn_announce_delete(p, n);
+  }
+
+  if (!n->routes)
+    fib_delete(&p->krt_table.fib, n);
+}
+
 /* Called when alien route is discovered during scan */
 static void
 krt_learn_scan(struct krt_proto *p, rte *e)
@@ -325,30 +389,42 @@ krt_learn_scan(struct krt_proto *p, rte *e)
   for(mm=&n->routes; m = *mm; mm=&m->next)
     if (krt_same_key(m, e))
       break;
-  if (m)
+
+  if (m && krt_uptodate(m, e))
+  {
+    krt_trace_in_rl(&rl_alien, p, e, "[alien] seen");
+    rte_free(e);
+
+    if (m->u.krt.seen != p->learn_epoch)
     {
-      if (krt_uptodate(m, e))
-	{
-	  krt_trace_in_rl(&rl_alien, p, e, "[alien] seen");
-	  rte_free(e);
-	  m->u.krt.seen = 1;
-	}
-      else
-	{
-	  krt_trace_in(p, e, "[alien] updated");
-	  *mm = m->next;
-	  rte_free(m);
-	  m = NULL;
-	}
+      m->u.krt.seen = p->learn_epoch;
+      p->learn_seen++;
     }
+    return;
+  }
+
+  if (m)
+  {
+    krt_trace_in(p, e, "[alien] updated");
+    *mm = m->next;
+
+    if (m->u.krt.seen == p->learn_epoch)
+      p->learn_seen--;
+
+    rte_free(m);
+  }
   else
+  {
     krt_trace_in(p, e, "[alien] created");
-  if (!m)
-    {
-      e->next = n->routes;
-      n->routes = e;
-      e->u.krt.seen = 1;
-    }
+    p->learn_count++;
+  }
+
+  e->next = n->routes;
+  n->routes = e;
+  e->u.krt.seen = p->learn_epoch;
+  p->learn_seen++;
+
+  krt_learn_select(p, n, 0);
 }
 
 static void
@@ -357,69 +433,47 @@ krt_learn_prune(struct krt_proto *p)
   struct fib *fib = &p->krt_table.fib;
   struct fib_iterator fit;
 
+  if ((p->learn_seen == p->learn_count) && !p->reload)
+  {
+    KRT_TRACE(p, D_EVENTS, "Inherited routes up to date");
+    return;
+  }
+
   KRT_TRACE(p, D_EVENTS, "Pruning inherited routes");
 
   FIB_ITERATE_INIT(&fit, fib);
 again:
   FIB_ITERATE_START(fib, &fit, net, n)
     {
-      rte *e, **ee, *best, **pbest, *old_best;
+      rte *e, **ee;
+      int changed = 0;
 
-      /*
-       * Note that old_best may be NULL even if there was an old best route in
-       * the previous step, because it might be replaced in krt_learn_scan().
-       * But in that case there is a new valid best route.
-       */
-
-      old_best = NULL;
-      best = NULL;
-      pbest = NULL;
       ee = &n->routes;
       while (e = *ee)
 	{
-	  if (e->u.krt.best)
-	    old_best = e;
-
-	  if (!e->u.krt.seen)
+	  if (e->u.krt.seen != p->learn_epoch)
 	    {
 	      *ee = e->next;
 	      rte_free(e);
+	      p->learn_count--;
+	      changed = 1;
 	      continue;
 	    }
 
-	  if (!best || best->u.krt.metric > e->u.krt.metric)
-	    {
-	      best = e;
-	      pbest = ee;
-	    }
-
-	  e->u.krt.seen = 0;
-	  e->u.krt.best = 0;
 	  ee = &e->next;
 	}
+
+      if (!changed && !p->reload)
+	continue;
+
       if (!n->routes)
 	{
-	  DBG("%I/%d: deleting\n", n->n.prefix, n->n.pxlen);
-	  if (old_best)
-	    krt_learn_announce_delete(p, n);
-
 	  FIB_ITERATE_PUT(&fit);
-	  fib_delete(fib, n);
+	  krt_learn_select(p, n, p->reload);
 	  goto again;
 	}
 
-      best->u.krt.best = 1;
-      *pbest = best->next;
-      best->next = n->routes;
-      n->routes = best;
-
-      if ((best != old_best) || p->reload)
-	{
-	  DBG("%I/%d: announcing (metric=%d)\n", n->n.prefix, n->n.pxlen, best->u.krt.metric);
-	  krt_learn_announce_update(p, best);
-	}
-      else
-	DBG("%I/%d: uptodate (metric=%d)\n", n->n.prefix, n->n.pxlen, best->u.krt.metric);
+      krt_learn_select(p, n, p->reload);
     }
   FIB_ITERATE_END;
 
@@ -431,11 +485,10 @@ krt_learn_async(struct krt_proto *p, rte *e, int new)
 {
   net *n0 = e->net;
   net *n = net_get(&p->krt_table, n0->n.addr);
-  rte *g, **gg, *best, **bestp, *old_best;
+  rte *g, **gg;
 
   e->attrs = rta_lookup(e->attrs);
 
-  old_best = n->routes;
   for(gg=&n->routes; g = *gg; gg = &g->next)
     if (krt_same_key(g, e))
       break;
@@ -451,56 +504,46 @@ krt_learn_async(struct krt_proto *p, rte *e, int new)
 	    }
 	  krt_trace_in(p, e, "[alien async] updated");
 	  *gg = g->next;
+
+	  if (g->u.krt.seen == p->learn_epoch)
+	    p->learn_seen--;
+
 	  rte_free(g);
 	}
       else
-	krt_trace_in(p, e, "[alien async] created");
+	{
+	  krt_trace_in(p, e, "[alien async] created");
+	  p->learn_count++;
+	}
 
+      /* Fresh from the kernel, so not to be pruned by an ongoing scan */
       e->next = n->routes;
       n->routes = e;
+      e->u.krt.seen = p->learn_epoch;
+      p->learn_seen++;
     }
   else if (!g)
     {
       krt_trace_in(p, e, "[alien async] delete failed");
       rte_free(e);
+      if (!n->routes)
+	fib_delete(&p->krt_table.fib, n);
       return;
     }
   else
     {
       krt_trace_in(p, e, "[alien async] removed");
       *gg = g->next;
-      rte_free(e);
-      rte_free(g);
-    }
-  best = n->routes;
-  bestp = &n->routes;
-  for(gg=&n->routes; g=*gg; gg=&g->next)
-  {
-    if (best->u.krt.metric > g->u.krt.metric)
-      {
-	best = g;
-	bestp = gg;
-      }
 
-    g->u.krt.best = 0;
-  }
+      if (g->u.krt.seen == p->learn_epoch)
+	p->learn_seen--;
+      p->learn_count--;
 
-  if (best)
-    {
-      best->u.krt.best = 1;
-      *bestp = best->next;
-      best->next = n->routes;
-      n->routes = best;
+      rte_free(e);
+      rte_free(g);
     }
 
-  if (best != old_best)
-    {
-      DBG("krt_learn_async: distributing change\n");
-      if (best)
-	krt_learn_announce_update(p, best);
-      else
-	krt_learn_announce_delete(p, n);
-    }
+  krt_learn_select(p, n, 0);
 }
 
 static void
@@ -711,17 +754,53 @@ done:
 static void
 krt_init_scan(struct krt_proto *p)
 {
-  bmap_reset(&p->seen_map, 1024);
+  bmap_reset(&p->seen_map, KRT_MAP_SIZE);
+  p->scan_state = KRT_SCAN_DUMP;
+
+#ifdef KRT_ALLOW_LEARN
+  /* Epoch 0 is never used, so routes not yet stamped are never seen */
+  p->learn_epoch = (p->learn_epoch % 255) + 1;
+  p->learn_seen = 0;
+#endif
 }
 
 static void
-krt_prune(struct krt_proto *p)
+krt_prune_init(struct krt_proto *p)
 {
   struct rtable *t = p->p.main_channel->table;
 
+  /*
+   * The table walk just installs exported routes not seen in the kernel. When
+   * all exported routes were seen, which is the usual case, it is skipped.
+   */
+  if (!p->ready || bmap_is_subset(&p->p.main_channel->export_map, &p->seen_map))
+  {
+    p->scan_state = KRT_SCAN_FINISH;
+    return;
+  }
+
   KRT_TRACE(p, D_EVENTS, "Pruning table %s", t->name);
-  FIB_WALK(&t->fib, net, n)
+  FIB_ITERATE_INIT(&p->prune_fit, &t->fib);
+  p->scan_state = KRT_SCAN_PRUNE;
+}
+
+/* Returns 1 when the table is pruned, 0 when @limit of networks is reached */
+static int
+krt_prune_step(struct krt_proto *p, uint limit)
+{
+  struct rtable *t = p->p.main_channel->table;
+
+  if (p->scan_state == KRT_SCAN_FINISH)
+    goto done;
+
+  FIB_ITERATE_START(&t->fib, &p->prune_fit, net, n)
   {
+    if (!limit--)
+    {
+      FIB_ITERATE_PUT(&p->prune_fit);
+      return 0;
+    }
+
     if (p->ready && krt_is_installed(p, n) && !bmap_test(&p->seen_map, n->routes->id))
     {
       rte *rt_free = NULL;
@@ -739,8 +818,9 @@ krt_prune(struct krt_proto *p)
       lp_flush(krt_filter_lp);
     }
   }
-  FIB_WALK_END;
+  FIB_ITERATE_END;
 
+done:
 #ifdef KRT_ALLOW_LEARN
   if (KRT_CF->learn)
     krt_learn_prune(p);
@@ -748,6 +828,18 @@ krt_prune(struct krt_proto *p)
 
   if (p->ready)
     p->initialized = 1;
+
+  p->scan_state = KRT_SCAN_IDLE;
+  return 1;
+}
+
+static void
+krt_scan_abort(struct krt_proto *p)
+{
+  if (p->scan_state == KRT_SCAN_PRUNE)
+    FIB_ITERATE_UNLINK(&p->prune_fit, &p->p.main_channel->table->fib);
+
+  p->scan_state = KRT_SCAN_IDLE;
 }
 
 void
@@ -789,8 +881,59 @@ krt_got_route_async(struct krt_proto *p, rte *e, int new)
 
 #ifdef CONFIG_ALL_TABLES_AT_ONCE
 
+/*
+ * The scan of all tables is done incrementally, so it does not block other
+ * protocols for long with large kernel tables. The kernel dump is processed
+ * and then BIRD tables are pruned in steps of %KRT_SCAN_STEP routes, each step
+ * run from a separate event. Routes exported during the scan are marked as
+ * seen, so they are not installed again by the prune. A scan requested while
+ * another one is running is done right after it.
+ */
+
+#define KRT_SCAN_STEP	4096
+
 static timer *krt_scan_timer;
+static event *krt_scan_event;
 static int krt_scan_count;
+static int krt_scan_running;
+static int krt_scan_again;
+
+static void
+krt_scan_continue(void *data UNUSED)
+{
+  struct krt_proto *p;
+  node *n;
+  int done = 1;
+
+  if (!krt_do_scan_step(NULL, KRT_SCAN_STEP))
+  {
+    ev_schedule(krt_scan_event);
+    return;
+  }
+
+  WALK_LIST2(p, n, krt_proto_list, krt_node)
+  {
+    if (p->scan_state == KRT_SCAN_DUMP)
+      krt_prune_init(p);
+
+    if ((p->scan_state >= KRT_SCAN_PRUNE) && !krt_prune_step(p, KRT_SCAN_STEP))
+      done = 0;
+  }
+
+  if (!done)
+  {
+    ev_schedule(krt_scan_event);
+    return;
+  }
+
+  krt_scan_running = 0;
+
+  if (krt_scan_again)
+  {
+    krt_scan_again = 0;
+    tm_start(krt_scan_timer, 0);
+  }
+}
 
 static void
 krt_scan(timer *t UNUSED)
@@ -798,6 +941,12 @@ krt_scan(timer *t UNUSED)
   struct krt_proto *p;
   node *n;
 
+  if (krt_scan_running)
+  {
+    krt_scan_again = 1;
+    return;
+  }
+
   kif_force_scan();
 
   /* We need some node to decide whether to print the debug messages or not */
@@ -807,17 +956,19 @@ krt_scan(timer *t UNUSED)
   WALK_LIST2(p, n, krt_proto_list, krt_node)
     krt_init_scan(p);
 
-  krt_do_scan(NULL);
-
-  WALK_LIST2(p, n, krt_proto_list, krt_node)
-    krt_prune(p);
+  krt_do_scan_begin(NULL);
+  krt_scan_running = 1;
+  krt_scan_continue(NULL);
 }
 
 static void
 krt_scan_timer_start(struct krt_proto *p)
 {
   if (!krt_scan_count)
+  {
     krt_scan_timer = tm_new_init(krt_pool, krt_scan, NULL, KRT_CF->scan_time, 0);
+    krt_scan_event = ev_new_init(krt_pool, krt_scan_continue, NULL);
+  }
 
   krt_scan_count++;
 
@@ -825,14 +976,19 @@ krt_scan_timer_start(struct krt_proto *p)
 }
 
 static void
-krt_scan_timer_stop(struct krt_proto *p UNUSED)
+krt_scan_timer_stop(struct krt_proto *p)
 {
+  krt_scan_abort(p);
   krt_scan_count--;
 
   if (!krt_scan_count)
   {
     rfree(krt_scan_timer);
+    rfree(krt_scan_event);
     krt_scan_timer = NULL;
+    krt_scan_event = NULL;
+    krt_scan_running = 0;
+    krt_scan_again = 0;
   }
 }
 
@@ -844,6 +1000,13 @@ krt_scan_timer_kick(struct krt_proto *p UNUSED)
 
 #else
 
+static void
+krt_prune(struct krt_proto *p)
+{
+  krt_prune_init(p);
+  krt_prune_step(p, ~0U);
+}
+
 static void
 krt_scan(timer *t)
 {
@@ -868,6 +1031,7 @@ static void
 krt_scan_timer_stop(struct krt_proto *p)
 {
   tm_stop(p->scan_timer);
+  krt_scan_abort(p);
 }
 
 static void
@@ -939,6 +1103,10 @@ krt_rt_notify(struct proto *P, struct channel *ch UNUSED, net *net,
 
   if (p->initialized)		/* Before first scan we don't touch the routes */
     krt_replace_rte(p, net, new, old);
+
+  /* Do not install it again when pruning after the ongoing scan */
+  if (new && p->scan_state)
+    bmap_set(&p->seen_map, new->id);
 }
 
 static void
@@ -1068,8 +1236,8 @@ krt_start(struct proto *P)
   default: log(L_ERR "KRT: Tried to start with strange net type: %d", p->p.net_type); return PS_START; break;
   }
 
-  bmap_init(&p->sync_map, p->p.pool, 1024);
-  bmap_init(&p->seen_map, p->p.pool, 1024);
+  bmap_init(&p->sync_map, p->p.pool, KRT_MAP_SIZE);
+  bmap_init(&p->seen_map, p->p.pool, KRT_MAP_SIZE);
   add_tail(&krt_proto_list, &p->krt_node);
 
 #ifdef KRT_ALLOW_LEARN
@@ -1194,6 +1362,7 @@ struct protocol proto_unix_kernel = {
   .channel_mask =	NB_IP | MAYBE_IP6_SADR | MAYBE_MPLS,
   .proto_size =		sizeof(struct krt_proto),
   .config_size =	sizeof(struct krt_config),
+  .rte_size =		RTE_SIZE(krt),
   .preconfig =		krt_preconfig,
   .postconfig =		krt_postconfig,
   .init =		krt_init,
@@ -50,6 +50,9 @@ struct krt_proto {
 
 #ifdef KRT_ALLOW_LEARN
   struct rtable krt_table;	/* Internal table of inherited routes */
+  uint learn_count;		/* Number of routes in krt_table */
+  uint learn_seen;		/* Number of them seen during current scan */
+  byte learn_epoch;		/* Current scan, stamped to u.krt.seen */
 #endif
 
 #ifndef CONFIG_ALL_TABLES_AT_ONCE
@@ -63,8 +66,15 @@ struct krt_proto {
   byte ready;			/* Initial feed has been finished */
   byte initialized;		/* First scan has been finished */
   byte reload;			/* Next scan is doing reload */
+  byte scan_state;		/* Phase of ongoing scan (KRT_SCAN_*) */
+  struct fib_iterator prune_fit;	/* Position of table prune after scan */
 };
 
+#define KRT_SCAN_IDLE	0
+#define KRT_SCAN_DUMP	1		/* Kernel table is being dumped */
+#define KRT_SCAN_PRUNE	2		/* BIRD table is being pruned */
+#define KRT_SCAN_FINISH	3		/* Nothing to prune, just finish the scan */
+
 extern pool *krt_pool;
 
 #define KRT_CF ((struct krt_config *)p->p.cf)
@@ -140,6 +150,10 @@ void krt_sys_copy_config(struct krt_config *, struct krt_config *);
 
 int  krt_capable(rte *e);
 void krt_do_scan(struct krt_proto *);
+#ifdef CONFIG_ALL_TABLES_AT_ONCE
+void krt_do_scan_begin(struct krt_proto *);
+int krt_do_scan_step(struct krt_proto *, uint limit);
+#endif
 void krt_replace_rte(struct krt_proto *p, net *n, rte *new, rte *old);
 int krt_sys_get_attr(const eattr *a, byte *buf, int buflen);
 
@@ -13,6 +13,12 @@
  * messages to system logs and to the debug output. Message classes
  * used by this module are described in |birdlib.h| and also in the
  * user's manual.
+ *
+ * Messages written to log files are not flushed one by one. Less important
+ * messages (up to %L_REMOTE) are left in the stdio buffer and flushed by
+ * log_flush() once per main loop iteration, so bursts of debug and trace
+ * messages are written in large blocks. More important messages are flushed
+ * immediately together with the preceding ones.
  */
 
 #include <stdio.h>
@@ -34,6 +40,7 @@
 static FILE *dbgf;
 static list *current_log_list;
 static char *current_syslog_name; /* NULL -> syslog closed */
+static int log_pending;		/* Some log files have unflushed messages */
 
 
 #ifdef USE_PTHREADS
@@ -193,7 +200,11 @@ log_commit(int class, buffer *buf)
 	    }
 	  fputs(buf->start, l->fh);
 	  fputc('\n', l->fh);
-	  fflush(l->fh);
+
+	  if (class > *L_REMOTE)
+	    fflush(l->fh);
+	  else
+	    log_pending = 1;
 	}
 #ifdef HAVE_SYSLOG_H
       else
@@ -209,6 +220,29 @@ log_commit(int class, buffer *buf)
   buf->pos = buf->start;
 }
 
+/**
+ * log_flush - flush pending log messages
+ *
+ * This function writes messages left in buffers of log files by log_commit().
+ * It is called from the main loop before waiting for I/O.
+ */
+void
+log_flush(void)
+{
+  struct log_config *l;
+
+  if (!log_pending)
+    return;
+
+  log_lock();
+  WALK_LIST(l, *current_log_list)
+    if (l->fh)
+      fflush(l->fh);
+
+  log_pending = 0;
+  log_unlock();
+}
+
 int buffer_vprint(buffer *buf, const char *fmt, va_list args);
 
 static void
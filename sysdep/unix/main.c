@@ -14,12 +14,14 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <signal.h>
 #include <pwd.h>
 #include <grp.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <libgen.h>
 
 #include "nest/bird.h"
@@ -173,6 +175,8 @@ sysdep_preconfig(struct config *c)
 
   c->latency_limit = UNIX_DEFAULT_LATENCY_LIMIT;
   c->watchdog_warning = UNIX_DEFAULT_WATCHDOG_WARNING;
+  c->slab_watermark = SLAB_DEFAULT_WATERMARK;
+  c->mrtdump_buffer = UNIX_DEFAULT_MRTDUMP_BUFFER;
 
 #ifdef PATH_IPROUTE_DIR
   read_iproute_table(PATH_IPROUTE_DIR "/rt_protos", "ipp_", 256);
@@ -186,6 +190,7 @@ int
 sysdep_commit(struct config *new, struct config *old UNUSED)
 {
   log_switch(0, &new->logfiles, new->syslog_name);
+  slab_set_watermark(new->slab_watermark);
   return 0;
 }
 
@@ -375,11 +380,72 @@ static sock *cli_sk;
 static char *path_control_socket = PATH_CONTROL_SOCKET;
 
 
+#define CLI_IOV_MAX 16
+
+/*
+ * Write as many TX buffers as possible by one writev() call. Returns 1 if
+ * everything passed was written, 0 otherwise. Errors are left to sk_send().
+ */
+static int
+cli_writev(cli *c)
+{
+  sock *s = c->priv;
+  struct iovec iov[CLI_IOV_MAX];
+  struct cli_out *o;
+  uint cnt = 0;
+  size_t len = 0;
+
+  for (o = c->tx_pos; o && (cnt < CLI_IOV_MAX); o = o->next)
+    if (o->wpos > o->outpos)
+    {
+      iov[cnt] = (struct iovec) { .iov_base = o->outpos, .iov_len = o->wpos - o->outpos };
+      len += iov[cnt++].iov_len;
+    }
+
+  if (!cnt)
+    return 1;
+
+  ssize_t e;
+  do
+    e = writev(s->fd, iov, cnt);
+  while ((e < 0) && (errno == EINTR));
+
+  if (e <= 0)
+    return 0;
+
+  /* Skip what was written */
+  size_t done = e;
+  for (o = c->tx_pos; o && (done >= (size_t) (o->wpos - o->outpos)); o = o->next)
+  {
+    done -= o->wpos - o->outpos;
+    o->outpos = o->wpos;
+  }
+
+  if (o)
+    o->outpos += done;
+
+  return (size_t) e == len;
+}
+
 static void
 cli_write(cli *c)
 {
   sock *s = c->priv;
 
+  /* Write directly when the socket has no pending data */
+  if ((s->type == SK_UNIX) && (s->ttx == s->tpos))
+    while (c->tx_pos)
+    {
+      int done = cli_writev(c);
+
+      /* Skip fully written buffers */
+      while (c->tx_pos && (c->tx_pos->outpos == c->tx_pos->wpos))
+	c->tx_pos = c->tx_pos->next;
+
+      if (!done)
+	break;
+    }
+
   while (c->tx_pos)
     {
       struct cli_out *o = c->tx_pos;
@@ -388,8 +454,16 @@ cli_write(cli *c)
       s->tbuf = o->outpos;
       o->outpos = o->wpos;
 
-      if (sk_send(s, len) <= 0)
+      int e = sk_send(s, len);
+      if (e < 0)
+	return;
+
+      if (e == 0)
+      {
+	/* Wait for the socket, but release what was written */
+	cli_write_progress(c);
 	return;
+      }
 
       c->tx_pos = o->next;
     }
@@ -414,6 +488,8 @@ cli_tx(sock *s)
   cli_write(s->data);
 }
 
+static int cli_rx(sock *s, uint size);
+
 int
 cli_get_command(cli *c)
 {
@@ -431,8 +507,15 @@ cli_get_command(cli *c)
 	{
 	  t++;
 	  c->rx_pos = c->rx_buf;
-	  c->rx_aux = t;
 	  *d = 0;
+
+	  /* Move pipelined commands to the start, so the buffer never fills up with them */
+	  uint l = tend - t;
+	  memmove(s->rbuf, t, l);
+	  s->rpos = s->rbuf + l;
+	  c->rx_aux = s->rbuf;
+	  s->rx_hook = cli_rx;
+
 	  return (d < dend) ? 1 : -1;
 	}
       else if (d < dend)
@@ -440,12 +523,17 @@ cli_get_command(cli *c)
     }
   c->rx_aux = s->rpos = s->rbuf;
   c->rx_pos = d;
+  s->rx_hook = cli_rx;
   return 0;
 }
 
 static int
 cli_rx(sock *s, uint size UNUSED)
 {
+  /* Stop reading until a command is taken from the full buffer */
+  if (s->rpos == s->rbuf + s->rbsize)
+    s->rx_hook = NULL;
+
   cli_kick(s->data);
   return 0;
 }
@@ -909,6 +997,9 @@ main(int argc, char **argv)
 
   signal_init();
 
+  if (conf->startup_wait)
+    startup_convergence();
+
   config_commit(conf, RECONFIG_HARD, 0);
 
   graceful_restart_init();
@@ -31,11 +31,13 @@ void cmd_reconfig_undo(void);
 void cmd_reconfig_status(void);
 void cmd_shutdown(void);
 void cmd_graceful_restart(void);
+void cmd_show_loop_latency(void);
 
 #define UNIX_DEFAULT_CONFIGURE_TIMEOUT	300
 
 #define UNIX_DEFAULT_LATENCY_LIMIT	(1 S_)
 #define UNIX_DEFAULT_WATCHDOG_WARNING	(5 S_)
+#define UNIX_DEFAULT_MRTDUMP_BUFFER	(4 << 20)
 
 /* io.c */
 
@@ -121,6 +123,7 @@ void krt_io_init(void);
 void main_thread_init(void);
 void log_init_debug(char *);		/* Initialize debug dump to given file (NULL=stderr, ""=off) */
 void log_switch(int initial, list *l, const char *);
+void log_flush(void);
 
 struct log_config {
   node n;
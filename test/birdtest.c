@@ -19,6 +19,7 @@
 #include <sys/wait.h>
 
 #include "test/birdtest.h"
+#include "lib/resource.h"
 #include "lib/string.h"
 
 #ifdef HAVE_EXECINFO_H
@@ -36,6 +37,7 @@ static int do_core;
 static int do_die;
 static int no_fork;
 static int no_timeout;
+static int do_bench;
 static int is_terminal;		/* Whether stdout is a live terminal or pipe redirect */
 
 volatile sig_atomic_t async_config_flag;		/* Asynchronous reconfiguration/dump scheduled */
@@ -71,7 +73,7 @@ bt_init(int argc, char *argv[])
   bt_test_id = NULL;
   is_terminal = isatty(fileno(stdout));
 
-  while ((c = getopt(argc, argv, "lcdftv")) >= 0)
+  while ((c = getopt(argc, argv, "lcdftvb")) >= 0)
     switch (c)
     {
       case 'l':
@@ -98,6 +100,10 @@ bt_init(int argc, char *argv[])
 	bt_verbose++;
 	break;
 
+      case 'b':
+	do_bench = 1;
+	break;
+
       default:
 	goto usage;
     }
@@ -122,13 +128,14 @@ bt_init(int argc, char *argv[])
   return;
 
  usage:
-  printf("Usage: %s [-l] [-c] [-d] [-f] [-t] [-vvv] [<test_suit_name>]\n", argv[0]);
+  printf("Usage: %s [-l] [-c] [-d] [-f] [-t] [-b] [-vvv] [<test_suit_name>]\n", argv[0]);
   printf("Options: \n");
   printf("  -l   List all test suite names and descriptions \n");
   printf("  -c   Force unlimit core dumps (needs root privileges) \n");
   printf("  -d	 Die on first failed test case \n");
   printf("  -f   No forking \n");
   printf("  -t   No timeout limit \n");
+  printf("  -b   Run benchmarks, not just once as a test \n");
   printf("  -v   More verbosity, maximum is 3 -vvv \n");
   exit(3);
 }
@@ -397,6 +404,103 @@ bt_test_suite_base(int (*fn)(const void *), const char *id, const void *fn_arg,
   return bt_suite_result;
 }
 
+static inline u64
+bt_cycles(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+  return __builtin_ia32_rdtsc();
+#else
+  return 0;
+#endif
+}
+
+static int
+bt_bench_run(const void *arg)
+{
+  const void * const *a = arg;
+  void (*fn)(const void *, uint) = a[0];
+  const void *fn_arg = a[1];
+
+  resource_init();
+
+  /* Setup and warm-up */
+  fn(fn_arg, 1);
+
+  if (!do_bench)
+  {
+    fn(fn_arg, 16);
+    return 1;
+  }
+
+  uint n = 1;
+  u64 best_time = ~0ULL, best_cycles = 0;
+  size_t best_bytes = 0;
+
+  for (int i = 0; i < BT_BENCH_RUNS; )
+  {
+    struct timespec begin;
+    size_t mem = rmemsize(&root_pool);
+    u64 cycles = bt_cycles();
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+
+    fn(fn_arg, n);
+
+    u64 time = get_time_diff(&begin);
+    cycles = bt_cycles() - cycles;
+    size_t mem2 = rmemsize(&root_pool);
+
+    /* Calibrate the number of iterations first */
+    if (!i && (time < BT_BENCH_TIME) && (n < (1U << 30)))
+    {
+      n *= 2;
+      continue;
+    }
+
+    if (time < best_time)
+    {
+      best_time = time;
+      best_cycles = cycles;
+      best_bytes = (mem2 > mem) ? (mem2 - mem) : 0;
+    }
+
+    i++;
+  }
+
+  printf("BENCH %s %s %u %.2f %.2f %.2f\n", bt_filename, bt_test_id, n,
+	 (double) best_time / n, (double) best_cycles / n, (double) best_bytes / n);
+  fflush(stdout);
+
+  return 1;
+}
+
+/**
+ * bt_bench_base - run a benchmark
+ * @fn: benchmark function, runs the benchmarked operation given number of times
+ * @id: benchmark name
+ * @fn_arg: argument for @fn
+ * @dsc: a description message
+ *
+ * Benchmarks are run as test suites. Without option -b, @fn is just called
+ * with a few iterations, so the benchmark code is checked by regular test
+ * runs. With option -b, the number of iterations is doubled until one call
+ * takes at least %BT_BENCH_TIME, then the fastest of %BT_BENCH_RUNS calls is
+ * reported in a machine readable line:
+ *
+ * BENCH <file> <id> <iterations> <ns/op> <cycles/op> <bytes/op>
+ *
+ * Cycles are read from TSC if available, otherwise reported as 0. Bytes per
+ * operation are the growth of memory used by &root_pool, which is initialized
+ * before the benchmark. Any setup should be done by @fn on its first call,
+ * which is not measured.
+ */
+int
+bt_bench_base(void (*fn)(const void *, uint), const char *id, const void *fn_arg, const char *dsc)
+{
+  const void *arg[2] = { fn, fn_arg };
+
+  return bt_test_suite_base(bt_bench_run, id, arg, BT_FORKING, do_bench ? 0 : BT_TIMEOUT, "%s", dsc);
+}
+
 int
 bt_exit_value(void)
 {
@@ -40,6 +40,8 @@ void bt_log_suite_result(int result, const char *fmt, ...);
 void bt_log_suite_case_result(int result, const char *fmt, ...);
 
 #define BT_TIMEOUT 			5	/* Default timeout in seconds */
+#define BT_BENCH_TIME			(200 * 1000000ULL)	/* Minimal time of one benchmark run in ns */
+#define BT_BENCH_RUNS			5	/* Number of measured benchmark runs */
 #define BT_FORKING 			1	/* Forking is enabled in default */
 
 #define BT_RANDOM_SEED 			0x5097d2bb
@@ -69,6 +71,13 @@ static inline int bt_test_fn_noarg(const void *cp) { return ((int (*)(void)) cp)
 #define bt_test_suite_arg_extra(fn, arg, f, t, dsc, ...) \
   bt_test_suite_base(fn, #fn, arg, f, t, dsc, ##__VA_ARGS__)
 
+int bt_bench_base(void (*fn)(const void *, uint), const char *id, const void *fn_arg, const char *dsc);
+
+static inline void bt_bench_fn_noarg(const void *cp, uint n) { ((void (*)(uint)) cp)(n); }
+
+#define bt_bench(fn, dsc) \
+  bt_bench_base(bt_bench_fn_noarg, #fn, fn, dsc)
+
 #define bt_abort() \
   bt_abort_msg("Aborted at %s:%d", __FILE__, __LINE__)
 